@@ -99,13 +99,26 @@ EXPORT_SYMBOL_GPL(xen_free_vm_area);
 
 int arch_gnttab_map_shared(unsigned long *frames, unsigned long nr_gframes,
 			   unsigned long max_nr_gframes,
-			   struct grant_entry **__shared)
+			   void **__shared)
 {
 	*__shared = __va(frames[0] << PAGE_SHIFT);
 	return 0;
 }
 
-void arch_gnttab_unmap_shared(struct grant_entry *shared,
+int arch_gnttab_map_status(uint64_t *frames, unsigned long nr_gframes,
+			   unsigned long max_nr_gframes,
+			   grant_status_t **__shared)
+{
+	*__shared = __va(frames[0] << PAGE_SHIFT);
+	return 0;
+}
+
+void arch_gnttab_unmap_shared(void *shared, unsigned long nr_gframes)
+{
+	/* nothing */
+}
+
+void arch_gnttab_unmap_status(grant_status_t *shared,
 			      unsigned long nr_gframes)
 {
 	/* nothing */
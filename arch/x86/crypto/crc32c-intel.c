@@ -31,6 +31,7 @@
 #include <crypto/internal/hash.h>
 
 #include <asm/cpufeature.h>
+#include <asm/i387.h>
 
 #define CHKSUM_BLOCK_SIZE	1
 #define CHKSUM_DIGEST_SIZE	4
@@ -79,6 +80,115 @@ static u32 __pure crc32c_intel_le_hw(u32 crc, unsigned char const *p, size_t len
 	return crc;
 }
 
+#ifdef CONFIG_X86_64
+/*
+ * CRC32 has a latency of three cycles but can issue one per cycle, so
+ * large buffers are split into three streams that are checksummed side
+ * by side.  The crcs of the first two streams are then shifted over the
+ * length of the streams after them with a carry-less multiplication by
+ * x^(8 * len - 33) mod P, which a CRC32 of the 64 bit product reduces to
+ * x^(8 * len) mod P, and folded into the crc of the next stream.
+ *
+ * Below the break even the FPU save and restore costs more than the
+ * interleaving wins.
+ */
+#define CRC32C_PCL_BREAKEVEN	512
+#define CRC32C_PCL_MAX_QWORDS	128	/* per stream and round */
+
+static int crc32c_has_pcl;
+
+/* crc32c_pcl_shift[n - 1]: x^(64 * n - 33) mod P, bit reflected */
+static u32 crc32c_pcl_shift[CRC32C_PCL_MAX_QWORDS];
+
+static void __init crc32c_pcl_init(void)
+{
+	u32 k = 0x80000000;	/* x^0 */
+	int i, n;
+
+	/* multiplying by x is a right shift in the bit reflected domain */
+	for (n = 0; n < 31; n++)
+		k = (k >> 1) ^ ((k & 1) ? 0x82F63B78 : 0);
+
+	for (i = 0; i < CRC32C_PCL_MAX_QWORDS; i++) {
+		crc32c_pcl_shift[i] = k;
+		for (n = 0; n < 64; n++)
+			k = (k >> 1) ^ ((k & 1) ? 0x82F63B78 : 0);
+	}
+}
+
+/* crc * x^(64 * n) mod P, with the FPU owned by the caller */
+static u32 crc32c_pcl_shift_crc(u32 crc, unsigned int n)
+{
+	unsigned long prod;
+
+	__asm__ __volatile__(
+		"movd %1, %%xmm0\n\t"
+		"movd %2, %%xmm1\n\t"
+		/* pclmulqdq $0x00, %xmm1, %xmm0 */
+		".byte 0x66, 0xf, 0x3a, 0x44, 0xc1, 0x00\n\t"
+		"movq %%xmm0, %0"
+		:"=r"(prod)
+		:"r"(crc), "r"(crc32c_pcl_shift[n - 1])
+		:"xmm0", "xmm1"
+	);
+
+	crc = 0;
+	__asm__ __volatile__(
+		".byte 0xf2, " REX_PRE "0xf, 0x38, 0xf1, 0xf1;"
+		:"=S"(crc)
+		:"0"(crc), "c"(prod)
+	);
+
+	return crc;
+}
+
+static u32 crc32c_pcl_3way(u32 crc, unsigned char const *p, size_t len)
+{
+	kernel_fpu_begin();
+	while (len >= 3 * SCALE_F) {
+		unsigned int n = min_t(size_t, len / (3 * SCALE_F),
+				       CRC32C_PCL_MAX_QWORDS);
+		unsigned long *p0 = (unsigned long *)p;
+		unsigned long *p1 = p0 + n;
+		unsigned long *p2 = p1 + n;
+		u32 crc1 = 0, crc2 = 0;
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			__asm__(
+				/* crc32q %rcx, %rsi */
+				".byte 0xf2, 0x48, 0xf, 0x38, 0xf1, 0xf1;"
+				/* crc32q %rdx, %rdi */
+				".byte 0xf2, 0x48, 0xf, 0x38, 0xf1, 0xfa;"
+				/* crc32q %rbx, %rax */
+				".byte 0xf2, 0x48, 0xf, 0x38, 0xf1, 0xc3;"
+				:"=S"(crc), "=D"(crc1), "=a"(crc2)
+				:"0"(crc), "1"(crc1), "2"(crc2),
+				 "c"(p0[i]), "d"(p1[i]), "b"(p2[i])
+			);
+		}
+
+		crc = crc32c_pcl_shift_crc(crc, n) ^ crc1;
+		crc = crc32c_pcl_shift_crc(crc, n) ^ crc2;
+
+		p += 3 * n * SCALE_F;
+		len -= 3 * n * SCALE_F;
+	}
+	kernel_fpu_end();
+
+	return crc32c_intel_le_hw(crc, p, len);
+}
+#endif
+
+static u32 crc32c_intel_le(u32 crc, unsigned char const *p, size_t len)
+{
+#ifdef CONFIG_X86_64
+	if (len >= CRC32C_PCL_BREAKEVEN && crc32c_has_pcl && irq_fpu_usable())
+		return crc32c_pcl_3way(crc, p, len);
+#endif
+	return crc32c_intel_le_hw(crc, p, len);
+}
+
 /*
  * Setting the seed allows arbitrary accumulators and flexible XOR policy
  * If your algorithm starts with ~0, then XOR with ~0 before you set
@@ -112,14 +222,14 @@ static int crc32c_intel_update(struct shash_desc *desc, const u8 *data,
 {
 	u32 *crcp = shash_desc_ctx(desc);
 
-	*crcp = crc32c_intel_le_hw(*crcp, data, len);
+	*crcp = crc32c_intel_le(*crcp, data, len);
 	return 0;
 }
 
 static int __crc32c_intel_finup(u32 *crcp, const u8 *data, unsigned int len,
 				u8 *out)
 {
-	*(__le32 *)out = ~cpu_to_le32(crc32c_intel_le_hw(*crcp, data, len));
+	*(__le32 *)out = ~cpu_to_le32(crc32c_intel_le(*crcp, data, len));
 	return 0;
 }
 
@@ -176,10 +286,16 @@ static struct shash_alg alg = {
 
 static int __init crc32c_intel_mod_init(void)
 {
-	if (cpu_has_xmm4_2)
-		return crypto_register_shash(&alg);
-	else
+	if (!cpu_has_xmm4_2)
 		return -ENODEV;
+
+#ifdef CONFIG_X86_64
+	if (cpu_has_pclmulqdq) {
+		crc32c_pcl_init();
+		crc32c_has_pcl = 1;
+	}
+#endif
+	return crypto_register_shash(&alg);
 }
 
 static void __exit crc32c_intel_mod_fini(void)
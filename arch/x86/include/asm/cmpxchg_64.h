@@ -186,4 +186,30 @@ static inline unsigned long __cmpxchg_local(volatile void *ptr,
 	cmpxchg_local((ptr), (o), (n));					\
 })
 
+/*
+ * Compare and exchange two adjacent, 16 byte aligned words with
+ * cmpxchg16b.  Not locked: only safe against the local cpu (interrupts,
+ * preemption), which is all per cpu data needs.  Callers must check
+ * system_has_cmpxchg_double() first; returns true on success.
+ */
+#define cmpxchg_double_local(p1, p2, o1, o2, n1, n2)			\
+({									\
+	char __ret;							\
+	__typeof__(o2) __junk;						\
+	__typeof__(*(p1)) __old1 = (o1);				\
+	__typeof__(o2) __old2 = (o2);					\
+	__typeof__(*(p1)) __new1 = (n1);				\
+	__typeof__(o2) __new2 = (n2);					\
+	BUILD_BUG_ON(sizeof(*(p1)) != 8 || sizeof(*(p2)) != 8);	\
+	asm volatile("cmpxchg16b %2\n\tsetz %1"			\
+		     : "=d"(__junk), "=a"(__ret), "+m"(*(p1))		\
+		     : "b"(__new1), "c"(__new2),			\
+		       "a"(__old1), "d"(__old2)				\
+		     : "memory");					\
+	__ret;								\
+})
+
+#define system_has_cmpxchg_double() boot_cpu_has(X86_FEATURE_CX16)
+#define __HAVE_ARCH_CMPXCHG_DOUBLE 1
+
 #endif /* _ASM_X86_CMPXCHG_64_H */
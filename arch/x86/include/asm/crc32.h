@@ -0,0 +1,16 @@
+#ifndef _ASM_X86_CRC32_H
+#define _ASM_X86_CRC32_H
+
+#include <linux/types.h>
+
+/*
+ * Fold @len bytes at @buf, a multiple of 16 and at least 64, into the 16
+ * bytes at @out whose crc with a seed of 0 is the crc of @buf seeded with
+ * @crc.  The caller owns the FPU.  See arch/x86/lib/crc32-pclmul_64.S.
+ */
+asmlinkage void crc32_pclmul_le_fold(u8 *out, const u8 *buf, size_t len,
+				     u32 crc);
+asmlinkage void crc32_pclmul_be_fold(u8 *out, const u8 *buf, size_t len,
+				     u32 crc);
+
+#endif /* _ASM_X86_CRC32_H */
@@ -16,6 +16,7 @@
 
 #ifndef __ASSEMBLY__
 #include <linux/kernel.h>
+#include <linux/cache.h>
 #include <asm/acpi.h>
 #include <asm/apicdef.h>
 #include <asm/page.h>
@@ -45,6 +46,10 @@ extern unsigned long __FIXADDR_TOP;
 #else
 #define FIXADDR_TOP	(VSYSCALL_END-PAGE_SIZE)
 
+/* one struct pvclock_vsyscall_time_info per cpu */
+#define PVCLOCK_VSYSCALL_NR_PAGES \
+	(((NR_CPUS - 1) / (PAGE_SIZE / SMP_CACHE_BYTES)) + 1)
+
 /* Only covers 32bit vsyscalls currently. Need another set for 64bit. */
 #define FIXADDR_USER_START	((unsigned long)VSYSCALL32_VSYSCALL)
 #define FIXADDR_USER_END	(FIXADDR_USER_START + PAGE_SIZE)
@@ -79,6 +84,10 @@ enum fixed_addresses {
 	VSYSCALL_FIRST_PAGE = VSYSCALL_LAST_PAGE
 			    + ((VSYSCALL_END-VSYSCALL_START) >> PAGE_SHIFT) - 1,
 	VSYSCALL_HPET,
+#ifdef CONFIG_PARAVIRT_CLOCK
+	PVCLOCK_FIXMAP_BEGIN,
+	PVCLOCK_FIXMAP_END = PVCLOCK_FIXMAP_BEGIN + PVCLOCK_VSYSCALL_NR_PAGES - 1,
+#endif
 #endif
 	FIX_DBGP_BASE,
 	FIX_EARLYCON_MEM_BASE,
@@ -230,6 +230,13 @@ static inline unsigned long long paravirt_sched_clock(void)
 	return PVOP_CALL0(unsigned long long, pv_time_ops.sched_clock);
 }
 
+extern bool paravirt_steal_enabled;
+
+static inline unsigned long long paravirt_steal_clock(int cpu)
+{
+	return PVOP_CALL1(unsigned long long, pv_time_ops.steal_clock, cpu);
+}
+
 static inline unsigned long long paravirt_read_pmc(int counter)
 {
 	return PVOP_CALL1(u64, pv_cpu_ops.read_pmc, counter);
@@ -90,6 +90,12 @@ struct pv_lazy_ops {
 struct pv_time_ops {
 	unsigned long long (*sched_clock)(void);
 	unsigned long (*get_tsc_khz)(void);
+
+	/* ns the hypervisor has kept a cpu from running; local cpu only */
+	unsigned long long (*steal_clock)(int cpu);
+
+	/* has the hypervisor descheduled this (any) cpu until an event? */
+	bool (*vcpu_is_blocked)(int cpu);
 };
 
 struct pv_cpu_ops {
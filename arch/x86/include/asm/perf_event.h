@@ -94,15 +94,19 @@ union cpuid10_edx {
 #define X86_PMC_IDX_FIXED_BTS				(X86_PMC_IDX_FIXED + 16)
 
 
+struct pt_regs;
+
 #ifdef CONFIG_PERF_EVENTS
 extern void init_hw_perf_events(void);
 extern void perf_events_lapic_init(void);
+extern int perf_event_handle_irq(struct pt_regs *regs);
 
 #define PERF_EVENT_INDEX_OFFSET			0
 
 #else
 static inline void init_hw_perf_events(void)		{ }
 static inline void perf_events_lapic_init(void)	{ }
+static inline int perf_event_handle_irq(struct pt_regs *regs)	{ return 0; }
 #endif
 
 #endif /* _ASM_X86_PERF_EVENT_H */
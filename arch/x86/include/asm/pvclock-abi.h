@@ -29,9 +29,12 @@ struct pvclock_vcpu_time_info {
 	u64   system_time;
 	u32   tsc_to_system_mul;
 	s8    tsc_shift;
-	u8    pad[3];
+	u8    flags;
+	u8    pad[2];
 } __attribute__((__packed__)); /* 32 bytes */
 
+#define PVCLOCK_TSC_STABLE_BIT	(1 << 0)
+
 struct pvclock_wall_clock {
 	u32   version;
 	u32   sec;
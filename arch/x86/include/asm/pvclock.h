@@ -2,6 +2,7 @@
 #define _ASM_X86_PVCLOCK_H
 
 #include <linux/clocksource.h>
+#include <linux/cache.h>
 #include <asm/pvclock-abi.h>
 
 /* some helper functions for xen and kvm pv clock sources */
@@ -12,6 +13,14 @@ void pvclock_read_wallclock(struct pvclock_wall_clock *wall,
 			    struct timespec *ts);
 void pvclock_resume(void);
 
+/*
+ * Per-cpu time info for user space, in the PVCLOCK_FIXMAP pages; one
+ * cacheline each, so PVCLOCK_VSYSCALL_NR_PAGES cover NR_CPUS.
+ */
+struct pvclock_vsyscall_time_info {
+	struct pvclock_vcpu_time_info pvti;
+} __attribute__((__aligned__(SMP_CACHE_BYTES)));
+
 /*
  * Scale a 64-bit delta by scaling and multiplying by a 32-bit fraction,
  * yielding a 64-bit result.
@@ -48,6 +48,8 @@
 #include <xen/interface/platform.h>
 #include <xen/interface/xen-mca.h>
 
+#include <trace/events/xen.h>
+
 /*
  * The hypercall asms have to meet several constraints:
  * - Work on 32- and 64-bit.
@@ -229,14 +231,27 @@ static inline int
 HYPERVISOR_mmu_update(struct mmu_update *req, int count,
 		      int *success_count, domid_t domid)
 {
-	return _hypercall4(int, mmu_update, req, count, success_count, domid);
+	int ret;
+
+	trace_xen_mmu_update(req->ptr, req->val, count, domid, 0);
+	trace_xen_hypercall_entry(__HYPERVISOR_mmu_update, 0, count);
+	ret = _hypercall4(int, mmu_update, req, count, success_count, domid);
+	trace_xen_hypercall_exit(__HYPERVISOR_mmu_update, 0, ret);
+
+	return ret;
 }
 
 static inline int
 HYPERVISOR_mmuext_op(struct mmuext_op *op, int count,
 		     int *success_count, domid_t domid)
 {
-	return _hypercall4(int, mmuext_op, op, count, success_count, domid);
+	int ret;
+
+	trace_xen_hypercall_entry(__HYPERVISOR_mmuext_op, op->cmd, count);
+	ret = _hypercall4(int, mmuext_op, op, count, success_count, domid);
+	trace_xen_hypercall_exit(__HYPERVISOR_mmuext_op, op->cmd, ret);
+
+	return ret;
 }
 
 static inline int
@@ -289,7 +304,13 @@ HYPERVISOR_fpu_taskswitch(int set)
 static inline int
 HYPERVISOR_sched_op(int cmd, void *arg)
 {
-	return _hypercall2(int, sched_op, cmd, arg);
+	int ret;
+
+	trace_xen_hypercall_entry(__HYPERVISOR_sched_op, cmd, 1);
+	ret = _hypercall2(int, sched_op, cmd, arg);
+	trace_xen_hypercall_exit(__HYPERVISOR_sched_op, cmd, ret);
+
+	return ret;
 }
 
 static inline long
@@ -343,7 +364,13 @@ HYPERVISOR_memory_op(unsigned int cmd, void *arg)
 static inline int
 HYPERVISOR_multicall(void *call_list, int nr_calls)
 {
-	return _hypercall2(int, multicall, call_list, nr_calls);
+	int ret;
+
+	trace_xen_hypercall_entry(__HYPERVISOR_multicall, 0, nr_calls);
+	ret = _hypercall2(int, multicall, call_list, nr_calls);
+	trace_xen_hypercall_exit(__HYPERVISOR_multicall, 0, ret);
+
+	return ret;
 }
 
 static inline int
@@ -361,7 +388,10 @@ HYPERVISOR_update_va_mapping(unsigned long va, pte_t new_val,
 static inline int
 HYPERVISOR_event_channel_op(int cmd, void *arg)
 {
-	int rc = _hypercall2(int, event_channel_op, cmd, arg);
+	int rc;
+
+	trace_xen_hypercall_entry(__HYPERVISOR_event_channel_op, cmd, 1);
+	rc = _hypercall2(int, event_channel_op, cmd, arg);
 	if (unlikely(rc == -ENOSYS)) {
 		struct evtchn_op op;
 		op.cmd = cmd;
@@ -369,6 +399,7 @@ HYPERVISOR_event_channel_op(int cmd, void *arg)
 		rc = _hypercall1(int, event_channel_op_compat, &op);
 		memcpy(arg, &op.u, sizeof(op.u));
 	}
+	trace_xen_hypercall_exit(__HYPERVISOR_event_channel_op, cmd, rc);
 	return rc;
 }
 
@@ -401,7 +432,13 @@ HYPERVISOR_physdev_op(int cmd, void *arg)
 static inline int
 HYPERVISOR_grant_table_op(unsigned int cmd, void *uop, unsigned int count)
 {
-	return _hypercall3(int, grant_table_op, cmd, uop, count);
+	int ret;
+
+	trace_xen_hypercall_entry(__HYPERVISOR_grant_table_op, cmd, count);
+	ret = _hypercall3(int, grant_table_op, cmd, uop, count);
+	trace_xen_hypercall_exit(__HYPERVISOR_grant_table_op, cmd, ret);
+
+	return ret;
 }
 
 static inline int
@@ -429,6 +466,12 @@ HYPERVISOR_vcpu_op(int cmd, int vcpuid, void *extra_args)
 	return _hypercall3(int, vcpu_op, cmd, vcpuid, extra_args);
 }
 
+static inline int
+HYPERVISOR_xenpmu_op(unsigned int op, void *arg)
+{
+	return _hypercall2(int, xenpmu_op, op, arg);
+}
+
 #ifdef CONFIG_X86_64
 static inline int
 HYPERVISOR_set_segment_base(int reg, unsigned long value)
@@ -463,6 +506,14 @@ HYPERVISOR_hvm_op(int op, void *arg)
        return _hypercall2(unsigned long, hvm_op, op, arg);
 }
 
+struct tmem_op;
+
+static inline int
+HYPERVISOR_tmem_op(struct tmem_op *op)
+{
+	return _hypercall1(int, tmem_op, op);
+}
+
 static inline void
 MULTI_fpu_taskswitch(struct multicall_entry *mcl, int set)
 {
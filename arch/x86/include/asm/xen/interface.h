@@ -55,6 +55,7 @@ DEFINE_GUEST_HANDLE(char);
 DEFINE_GUEST_HANDLE(int);
 DEFINE_GUEST_HANDLE(long);
 DEFINE_GUEST_HANDLE(void);
+DEFINE_GUEST_HANDLE(uint64_t);
 #endif
 
 #ifndef HYPERVISOR_VIRT_START
@@ -160,6 +161,83 @@ struct vcpu_guest_context {
 #endif
 };
 DEFINE_GUEST_HANDLE_STRUCT(vcpu_guest_context);
+
+/*
+ * PMU context shared with Xen, see xen/interface/xenpmu.h.
+ */
+
+/* AMD PMU registers; counters and ctrls are offsets from the struct start */
+struct xen_pmu_amd_ctxt {
+    uint32_t counters;
+    uint32_t ctrls;
+};
+
+/* Intel PMU registers */
+struct xen_pmu_cntr_pair {
+    uint64_t counter;
+    uint64_t control;
+};
+
+struct xen_pmu_intel_ctxt {
+    /* Offsets of the fixed counters and of the architectural counter pairs */
+    uint32_t fixed_counters;
+    uint32_t arch_counters;
+
+    uint64_t global_ctrl;
+    uint64_t global_ovf_ctrl;
+    uint64_t global_status;
+    uint64_t fixed_ctrl;
+    uint64_t ds_area;
+    uint64_t pebs_enable;
+    uint64_t debugctl;
+};
+
+/* Sampled domain's registers */
+struct xen_pmu_regs {
+    uint64_t ip;
+    uint64_t sp;
+    uint64_t flags;
+    uint16_t cs;
+    uint16_t ss;
+    uint8_t cpl;
+    uint8_t pad[3];
+};
+
+/* PMU flags */
+#define PMU_CACHED         (1<<0) /* PMU MSRs are cached in the context */
+#define PMU_SAMPLE_USER    (1<<1) /* Sample is from user or kernel mode */
+#define PMU_SAMPLE_REAL    (1<<2) /* Sample is from realmode */
+#define PMU_SAMPLE_PV      (1<<3) /* Sample from a PV guest */
+
+#define XENPMU_CTXT_PAD_SZ 128
+
+struct xen_pmu_arch {
+    union {
+        /* Registers at the time of the PMU interrupt */
+        struct xen_pmu_regs regs;
+        uint8_t pad[64];
+    } r;
+
+    /* PMU_* flags */
+    uint64_t pmu_flags;
+
+    /* The guest's view of the LAPIC LVTPC, written with XENPMU_lvtpc_set */
+    union {
+        uint32_t lapic_lvtpc;
+        uint64_t pad;
+    } l;
+
+    /*
+     * Vendor-specific PMU registers.  While the PMU interrupt is being
+     * handled, the guest reads and writes these instead of the MSRs and
+     * Xen loads them back into the hardware on XENPMU_flush.
+     */
+    union {
+        struct xen_pmu_amd_ctxt amd;
+        struct xen_pmu_intel_ctxt intel;
+        uint8_t pad[XENPMU_CTXT_PAD_SZ];
+    } c;
+};
 #endif	/* !__ASSEMBLY__ */
 
 /*
@@ -39,9 +39,21 @@ typedef struct xpaddr {
 extern unsigned long *machine_to_phys_mapping;
 extern unsigned int   machine_to_phys_order;
 
-extern unsigned long get_phys_to_machine(unsigned long pfn);
+extern unsigned long *xen_p2m_flat;
+extern unsigned long xen_p2m_flat_size;
+
+extern unsigned long __get_phys_to_machine(unsigned long pfn);
 extern bool set_phys_to_machine(unsigned long pfn, unsigned long mfn);
 
+static inline unsigned long get_phys_to_machine(unsigned long pfn)
+{
+	/* The boot-time pfns are a flat array; see xen_p2m_flat. */
+	if (likely(pfn < xen_p2m_flat_size))
+		return xen_p2m_flat[pfn];
+
+	return __get_phys_to_machine(pfn);
+}
+
 static inline unsigned long pfn_to_mfn(unsigned long pfn)
 {
 	unsigned long mfn;
@@ -8,6 +8,7 @@ int xen_register_gsi(u32 gsi, int triggering, int polarity);
 int xen_create_msi_irq(struct pci_dev *dev,
 			struct msi_desc *msidesc,
 			int type);
+int xen_create_msi_irqs(struct pci_dev *dev, int nvec, int type);
 void xen_pci_teardown_msi_dev(struct pci_dev *dev);
 void xen_pci_teardown_msi_irq(int irq);
 int xen_pci_setup_msi_irqs(struct pci_dev *dev, int nvec, int type);
@@ -55,6 +56,10 @@ static inline int xen_create_msi_irq(struct pci_dev *dev,
 {
 	return -1;
 }
+static inline int xen_create_msi_irqs(struct pci_dev *dev, int nvec, int type)
+{
+	return -1;
+}
 static inline void xen_pci_teardown_msi_dev(struct pci_dev *dev) { }
 static inline void xen_pci_teardown_msi_irq(int irq) { }
 static inline int xen_pci_setup_msi_irqs(struct pci_dev *dev, int nvec, int type)
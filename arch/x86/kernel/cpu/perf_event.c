@@ -1940,6 +1940,19 @@ perf_event_nmi_handler(struct notifier_block *self,
 	return NOTIFY_STOP;
 }
 
+/*
+ * Counter overflows that are not delivered as an NMI through the local
+ * APIC, like the PMU virq of a Xen PV guest, end up here.  The caller
+ * provides the registers of the interrupted context.
+ */
+int perf_event_handle_irq(struct pt_regs *regs)
+{
+	if (!x86_pmu_initialized() || !atomic_read(&active_events))
+		return 0;
+
+	return x86_pmu.handle_irq(regs);
+}
+
 static __read_mostly struct notifier_block perf_event_nmi_notifier = {
 	.notifier_call		= perf_event_nmi_handler,
 	.next			= NULL,
@@ -294,6 +294,25 @@ void arch_flush_lazy_mmu_mode(void)
 	preempt_enable();
 }
 
+static unsigned long long native_steal_clock(int cpu)
+{
+	return 0;
+}
+
+/* set by a backend whose steal_clock returns something useful */
+bool paravirt_steal_enabled;
+
+static bool native_vcpu_is_blocked(int cpu)
+{
+	return false;
+}
+
+/* overrides the generic version in kernel/sched.c */
+bool vcpu_is_blocked(int cpu)
+{
+	return pv_time_ops.vcpu_is_blocked(cpu);
+}
+
 struct pv_info pv_info = {
 	.name = "bare hardware",
 	.paravirt_enabled = 0,
@@ -307,6 +326,8 @@ struct pv_init_ops pv_init_ops = {
 
 struct pv_time_ops pv_time_ops = {
 	.sched_clock = native_sched_clock,
+	.steal_clock = native_steal_clock,
+	.vcpu_is_blocked = native_vcpu_is_blocked,
 };
 
 struct pv_irq_ops pv_irq_ops = {
@@ -571,10 +571,40 @@ static void __init reserve_crashkernel(void)
 	crashk_res.end   = crash_base + crash_size - 1;
 	insert_resource(&iomem_resource, &crashk_res);
 }
+
+/*
+ * Done before anything is allocated from e820, so that nothing of this
+ * kernel lands where the previous one left data for it.
+ */
+static void __init reserve_kexec_preserve(void)
+{
+	u64 start = kexec_preserve_res.start;
+	u64 size = resource_size(&kexec_preserve_res);
+
+	if (!kexec_preserve_res.end)
+		return;
+
+	if (!e820_all_mapped(start, start + size, E820_RAM) ||
+	    find_e820_area(start, start + size, size, PAGE_SIZE) != start) {
+		pr_info("kexec_preserve reservation failed - "
+			"memory is not free RAM\n");
+		kexec_preserve_res.start = kexec_preserve_res.end = 0;
+		return;
+	}
+
+	reserve_early(start, start + size, "KEXEC PRESERVE");
+	printk(KERN_INFO "Preserving %ldMB of memory at %ldMB across kexec\n",
+	       (unsigned long)(size >> 20), (unsigned long)(start >> 20));
+	insert_resource(&iomem_resource, &kexec_preserve_res);
+}
 #else
 static void __init reserve_crashkernel(void)
 {
 }
+
+static void __init reserve_kexec_preserve(void)
+{
+}
 #endif
 
 static struct resource standard_io_resources[] = {
@@ -849,6 +879,8 @@ void __init setup_arch(char **cmdline_p)
 
 	finish_e820_parsing();
 
+	reserve_kexec_preserve();
+
 	if (efi_enabled)
 		efi_init();
 
@@ -1067,6 +1067,20 @@ do_page_fault(struct pt_regs *regs, unsigned long error_code)
 		return;
 	}
 
+	/*
+	 * A user's first touch of private anonymous memory can usually be
+	 * handled without mmap_sem, so that the threads of a process keep
+	 * faulting while one of them is in mmap or munmap:
+	 */
+	if ((error_code & (PF_USER | PF_PROT | PF_INSTR)) == PF_USER &&
+	    handle_speculative_fault(mm, address,
+			(error_code & PF_WRITE) ? FAULT_FLAG_WRITE : 0)) {
+		tsk->min_flt++;
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 0,
+				     regs, address);
+		return;
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -59,25 +59,37 @@ static int __init setup_userpte(char *arg)
 }
 early_param("userpte", setup_userpte);
 
+/*
+ * In a lazy MMU section paravirt_release_* may only have queued its
+ * work: fast mode frees the page at once, so push that out first.
+ * tlb_flush_mmu does the same for the gathered pages.
+ */
+static inline void tlb_remove_table(struct mmu_gather *tlb, struct page *page)
+{
+	if (tlb_fast_mode(tlb))
+		arch_flush_lazy_mmu_mode();
+	tlb_remove_page(tlb, page);
+}
+
 void ___pte_free_tlb(struct mmu_gather *tlb, struct page *pte)
 {
 	pgtable_page_dtor(pte);
 	paravirt_release_pte(page_to_pfn(pte));
-	tlb_remove_page(tlb, pte);
+	tlb_remove_table(tlb, pte);
 }
 
 #if PAGETABLE_LEVELS > 2
 void ___pmd_free_tlb(struct mmu_gather *tlb, pmd_t *pmd)
 {
 	paravirt_release_pmd(__pa(pmd) >> PAGE_SHIFT);
-	tlb_remove_page(tlb, virt_to_page(pmd));
+	tlb_remove_table(tlb, virt_to_page(pmd));
 }
 
 #if PAGETABLE_LEVELS > 3
 void ___pud_free_tlb(struct mmu_gather *tlb, pud_t *pud)
 {
 	paravirt_release_pud(__pa(pud) >> PAGE_SHIFT);
-	tlb_remove_page(tlb, virt_to_page(pud));
+	tlb_remove_table(tlb, virt_to_page(pud));
 }
 #endif	/* PAGETABLE_LEVELS > 3 */
 #endif	/* PAGETABLE_LEVELS > 2 */
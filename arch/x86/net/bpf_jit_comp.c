@@ -0,0 +1,525 @@
+/*
+ * Just-in-time compiler for socket filters on x86_64.
+ *
+ * A filter is translated once, when it is attached, into a native
+ * function equivalent to sk_run_filter().  Registers hold the filter
+ * machine state for the whole program:
+ *
+ *	ebx	A
+ *	ebp	X
+ *	r12	skb
+ *	r13	skb->data
+ *	r14d	skb headlen (skb->len - skb->data_len)
+ *
+ * and the BPF_MEMWORDS scratch words live in the stack frame.  Packet
+ * loads that fall inside the linear part of the skb are done inline;
+ * anything else (fragments, negative offsets, ancillary data) calls
+ * sk_filter_load_slow(), which shares its code with the interpreter.
+ *
+ * Each instruction is emitted with fixed-size encodings (all jumps are
+ * rel32), so two passes suffice: the first one only computes the offset
+ * of every instruction, the second one emits the code.
+ */
+
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+int bpf_jit_enable __read_mostly;
+
+struct jit_context {
+	u8 *image;		/* NULL in the sizing pass */
+	unsigned int len;	/* bytes emitted so far */
+	unsigned int *addrs;	/* offset of each filter instruction */
+	unsigned int epilogue;	/* offset of the epilogue */
+	unsigned int ret0;	/* offset of the "return 0" stub */
+};
+
+/* Size of the scratch memory in the stack frame, keeps rsp aligned */
+#define SCRATCH_SIZE	(BPF_MEMWORDS * 4)
+
+static inline void emit1(struct jit_context *ctx, u8 b)
+{
+	if (ctx->image)
+		ctx->image[ctx->len] = b;
+	ctx->len++;
+}
+
+static inline void emit2(struct jit_context *ctx, u8 b1, u8 b2)
+{
+	emit1(ctx, b1);
+	emit1(ctx, b2);
+}
+
+static inline void emit3(struct jit_context *ctx, u8 b1, u8 b2, u8 b3)
+{
+	emit1(ctx, b1);
+	emit1(ctx, b2);
+	emit1(ctx, b3);
+}
+
+static inline void emit32(struct jit_context *ctx, u32 v)
+{
+	emit1(ctx, v);
+	emit1(ctx, v >> 8);
+	emit1(ctx, v >> 16);
+	emit1(ctx, v >> 24);
+}
+
+static inline void emit64(struct jit_context *ctx, u64 v)
+{
+	emit32(ctx, v);
+	emit32(ctx, v >> 32);
+}
+
+/* jmp rel32 to an offset in the image */
+static void emit_jmp(struct jit_context *ctx, unsigned int target)
+{
+	emit1(ctx, 0xe9);
+	emit32(ctx, target - (ctx->len + 4));
+}
+
+/* jcc rel32, @op is the second opcode byte (0x80 | cc) */
+static void emit_jcc(struct jit_context *ctx, u8 op, unsigned int target)
+{
+	emit2(ctx, 0x0f, op);
+	emit32(ctx, target - (ctx->len + 4));
+}
+
+#define X86_JB	0x82
+#define X86_JAE	0x83
+#define X86_JE	0x84
+#define X86_JNE	0x85
+#define X86_JBE	0x86
+#define X86_JA	0x87
+#define X86_JS	0x88
+
+/*
+ * Conditional filter jump: the flags are set, go to jt or jf.  A zero
+ * displacement falls through.
+ */
+static void emit_cond_jump(struct jit_context *ctx, int pc,
+			   const struct sock_filter *f, u8 op_true, u8 op_false)
+{
+	if (f->jt && f->jf) {
+		emit_jcc(ctx, op_true, ctx->addrs[pc + 1 + f->jt]);
+		emit_jmp(ctx, ctx->addrs[pc + 1 + f->jf]);
+	} else if (f->jt)
+		emit_jcc(ctx, op_true, ctx->addrs[pc + 1 + f->jt]);
+	else if (f->jf)
+		emit_jcc(ctx, op_false, ctx->addrs[pc + 1 + f->jf]);
+}
+
+/* Inline load sequences, their sizes are needed for the local jumps */
+#define LOAD_W_SIZE	7	/* mov eax,[r13+rsi]; bswap eax */
+#define LOAD_H_SIZE	10	/* movzx eax,word [r13+rsi]; rol ax,8 */
+#define LOAD_B_SIZE	6	/* movzx eax,byte [r13+rsi] */
+#define SLOW_PATH_SIZE	34
+
+/*
+ * Load @size bytes at the packet offset in esi into eax, byte swapped.
+ * @size 0 is the byte load of BPF_LDX|BPF_B|BPF_MSH, which has no
+ * ancillary data.  A failed load returns 0 from the filter.
+ */
+static void emit_load(struct jit_context *ctx, unsigned int size)
+{
+	unsigned int load_size;
+
+	switch (size) {
+	case 4:
+		load_size = LOAD_W_SIZE;
+		break;
+	case 2:
+		load_size = LOAD_H_SIZE;
+		break;
+	default:
+		load_size = LOAD_B_SIZE;
+		break;
+	}
+
+	/* test esi,esi; js slow */
+	emit2(ctx, 0x85, 0xf6);
+	emit2(ctx, 0x0f, X86_JS);
+	emit32(ctx, 3 + 3 + 6 + load_size + 5);
+	/* lea eax,[rsi+size]; cmp eax,r14d; ja slow */
+	emit3(ctx, 0x8d, 0x46, size ? size : 1);
+	emit3(ctx, 0x44, 0x39, 0xf0);
+	emit2(ctx, 0x0f, X86_JA);
+	emit32(ctx, load_size + 5);
+
+	switch (size) {
+	case 4:
+		emit3(ctx, 0x41, 0x8b, 0x44);
+		emit2(ctx, 0x35, 0x00);
+		emit2(ctx, 0x0f, 0xc8);
+		break;
+	case 2:
+		emit3(ctx, 0x41, 0x0f, 0xb7);
+		emit3(ctx, 0x44, 0x35, 0x00);
+		emit2(ctx, 0x66, 0xc1);
+		emit2(ctx, 0xc0, 0x08);
+		break;
+	default:
+		emit3(ctx, 0x41, 0x0f, 0xb6);
+		emit3(ctx, 0x44, 0x35, 0x00);
+		break;
+	}
+	/* jmp done */
+	emit1(ctx, 0xe9);
+	emit32(ctx, SLOW_PATH_SIZE);
+
+	/* slow: sk_filter_load_slow(skb, esi, size, A, X) */
+	emit3(ctx, 0x4c, 0x89, 0xe7);		/* mov rdi,r12 */
+	emit1(ctx, 0xba);			/* mov edx,size */
+	emit32(ctx, size);
+	emit2(ctx, 0x89, 0xd9);			/* mov ecx,ebx */
+	emit3(ctx, 0x41, 0x89, 0xe8);		/* mov r8d,ebp */
+	emit2(ctx, 0x48, 0xb8);			/* mov rax,imm64 */
+	emit64(ctx, (unsigned long)sk_filter_load_slow);
+	emit2(ctx, 0xff, 0xd0);			/* call rax */
+	emit3(ctx, 0x48, 0x85, 0xc0);		/* test rax,rax */
+	emit_jcc(ctx, X86_JS, ctx->ret0);
+	/* done: */
+}
+
+static void emit_prologue(struct jit_context *ctx, unsigned long mem_read)
+{
+	int i;
+
+	emit1(ctx, 0x55);			/* push rbp */
+	emit1(ctx, 0x53);			/* push rbx */
+	emit2(ctx, 0x41, 0x54);			/* push r12 */
+	emit2(ctx, 0x41, 0x55);			/* push r13 */
+	emit2(ctx, 0x41, 0x56);			/* push r14 */
+	emit3(ctx, 0x48, 0x83, 0xec);		/* sub rsp,SCRATCH_SIZE */
+	emit1(ctx, SCRATCH_SIZE);
+
+	emit3(ctx, 0x49, 0x89, 0xfc);		/* mov r12,rdi */
+	emit2(ctx, 0x31, 0xdb);			/* xor ebx,ebx */
+	emit2(ctx, 0x31, 0xed);			/* xor ebp,ebp */
+
+	/* mov r13,[rdi+data] */
+	emit3(ctx, 0x4c, 0x8b, 0xaf);
+	emit32(ctx, offsetof(struct sk_buff, data));
+	/* mov r14d,[rdi+len]; sub r14d,[rdi+data_len] */
+	emit3(ctx, 0x44, 0x8b, 0xb7);
+	emit32(ctx, offsetof(struct sk_buff, len));
+	emit3(ctx, 0x44, 0x2b, 0xb7);
+	emit32(ctx, offsetof(struct sk_buff, data_len));
+
+	/* Scratch words read before being written load as 0 */
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		if (!(mem_read & (1UL << i)))
+			continue;
+		emit3(ctx, 0xc7, 0x44, 0x24);	/* mov dword [rsp+4i],0 */
+		emit1(ctx, i * 4);
+		emit32(ctx, 0);
+	}
+}
+
+static void emit_epilogue(struct jit_context *ctx)
+{
+	ctx->epilogue = ctx->len;
+
+	emit3(ctx, 0x48, 0x83, 0xc4);		/* add rsp,SCRATCH_SIZE */
+	emit1(ctx, SCRATCH_SIZE);
+	emit2(ctx, 0x41, 0x5e);			/* pop r14 */
+	emit2(ctx, 0x41, 0x5d);			/* pop r13 */
+	emit2(ctx, 0x41, 0x5c);			/* pop r12 */
+	emit1(ctx, 0x5b);			/* pop rbx */
+	emit1(ctx, 0x5d);			/* pop rbp */
+	emit1(ctx, 0xc3);			/* ret */
+
+	ctx->ret0 = ctx->len;
+	emit2(ctx, 0x31, 0xc0);			/* xor eax,eax */
+	emit_jmp(ctx, ctx->epilogue);
+}
+
+/* Emit the whole program, returns -EINVAL on an unknown instruction */
+static int jit_pass(struct jit_context *ctx, const struct sock_filter *filter,
+		    int flen, unsigned long mem_read)
+{
+	int pc;
+
+	ctx->len = 0;
+	emit_prologue(ctx, mem_read);
+
+	for (pc = 0; pc < flen; pc++) {
+		const struct sock_filter *f = &filter[pc];
+		u32 k = f->k;
+
+		ctx->addrs[pc] = ctx->len;
+
+		switch (f->code) {
+		case BPF_ALU|BPF_ADD|BPF_X:	/* add ebx,ebp */
+			emit2(ctx, 0x01, 0xeb);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:	/* add ebx,k */
+			emit2(ctx, 0x81, 0xc3);
+			emit32(ctx, k);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:	/* sub ebx,ebp */
+			emit2(ctx, 0x29, 0xeb);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:	/* sub ebx,k */
+			emit2(ctx, 0x81, 0xeb);
+			emit32(ctx, k);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:	/* imul ebx,ebp */
+			emit3(ctx, 0x0f, 0xaf, 0xdd);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:	/* imul ebx,ebx,k */
+			emit2(ctx, 0x69, 0xdb);
+			emit32(ctx, k);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			emit2(ctx, 0x85, 0xed);		/* test ebp,ebp */
+			emit_jcc(ctx, X86_JE, ctx->ret0);
+			emit2(ctx, 0x89, 0xd8);		/* mov eax,ebx */
+			emit2(ctx, 0x31, 0xd2);		/* xor edx,edx */
+			emit2(ctx, 0xf7, 0xf5);		/* div ebp */
+			emit2(ctx, 0x89, 0xc3);		/* mov ebx,eax */
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			emit1(ctx, 0xb9);		/* mov ecx,k */
+			emit32(ctx, k);
+			emit2(ctx, 0x89, 0xd8);		/* mov eax,ebx */
+			emit2(ctx, 0x31, 0xd2);		/* xor edx,edx */
+			emit2(ctx, 0xf7, 0xf1);		/* div ecx */
+			emit2(ctx, 0x89, 0xc3);		/* mov ebx,eax */
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:	/* and ebx,ebp */
+			emit2(ctx, 0x21, 0xeb);
+			break;
+		case BPF_ALU|BPF_AND|BPF_K:	/* and ebx,k */
+			emit2(ctx, 0x81, 0xe3);
+			emit32(ctx, k);
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:	/* or ebx,ebp */
+			emit2(ctx, 0x09, 0xeb);
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:	/* or ebx,k */
+			emit2(ctx, 0x81, 0xcb);
+			emit32(ctx, k);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:	/* mov ecx,ebp; shl ebx,cl */
+			emit2(ctx, 0x89, 0xe9);
+			emit2(ctx, 0xd3, 0xe3);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:	/* shl ebx,k */
+			emit3(ctx, 0xc1, 0xe3, k);
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:	/* mov ecx,ebp; shr ebx,cl */
+			emit2(ctx, 0x89, 0xe9);
+			emit2(ctx, 0xd3, 0xeb);
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:	/* shr ebx,k */
+			emit3(ctx, 0xc1, 0xeb, k);
+			break;
+		case BPF_ALU|BPF_NEG:		/* neg ebx */
+			emit2(ctx, 0xf7, 0xdb);
+			break;
+		case BPF_JMP|BPF_JA:
+			if (k)
+				emit_jmp(ctx, ctx->addrs[pc + 1 + k]);
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			emit2(ctx, 0x81, 0xfb);		/* cmp ebx,k */
+			emit32(ctx, k);
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			emit2(ctx, 0xf7, 0xc3);		/* test ebx,k */
+			emit32(ctx, k);
+			goto cond_jump;
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			emit2(ctx, 0x39, 0xeb);		/* cmp ebx,ebp */
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			emit2(ctx, 0x85, 0xeb);		/* test ebx,ebp */
+cond_jump:
+			switch (BPF_OP(f->code)) {
+			case BPF_JGT:
+				emit_cond_jump(ctx, pc, f, X86_JA, X86_JBE);
+				break;
+			case BPF_JGE:
+				emit_cond_jump(ctx, pc, f, X86_JAE, X86_JB);
+				break;
+			case BPF_JEQ:
+				emit_cond_jump(ctx, pc, f, X86_JE, X86_JNE);
+				break;
+			default:	/* BPF_JSET */
+				emit_cond_jump(ctx, pc, f, X86_JNE, X86_JE);
+				break;
+			}
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+			emit1(ctx, 0xbe);		/* mov esi,k */
+			emit32(ctx, k);
+			goto load;
+		case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND:
+		case BPF_LD|BPF_B|BPF_IND:
+			emit2(ctx, 0x89, 0xee);		/* mov esi,ebp */
+			emit2(ctx, 0x81, 0xc6);		/* add esi,k */
+			emit32(ctx, k);
+load:
+			switch (BPF_SIZE(f->code)) {
+			case BPF_W:
+				emit_load(ctx, 4);
+				break;
+			case BPF_H:
+				emit_load(ctx, 2);
+				break;
+			default:
+				emit_load(ctx, 1);
+				break;
+			}
+			emit2(ctx, 0x89, 0xc3);		/* mov ebx,eax */
+			break;
+		case BPF_LDX|BPF_B|BPF_MSH:
+			emit1(ctx, 0xbe);		/* mov esi,k */
+			emit32(ctx, k);
+			emit_load(ctx, 0);
+			emit3(ctx, 0x83, 0xe0, 0x0f);	/* and eax,0xf */
+			emit3(ctx, 0xc1, 0xe0, 0x02);	/* shl eax,2 */
+			emit2(ctx, 0x89, 0xc5);		/* mov ebp,eax */
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:	/* mov ebx,[r12+len] */
+			emit2(ctx, 0x41, 0x8b);
+			emit2(ctx, 0x9c, 0x24);
+			emit32(ctx, offsetof(struct sk_buff, len));
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:	/* mov ebp,[r12+len] */
+			emit2(ctx, 0x41, 0x8b);
+			emit2(ctx, 0xac, 0x24);
+			emit32(ctx, offsetof(struct sk_buff, len));
+			break;
+		case BPF_LD|BPF_IMM:		/* mov ebx,k */
+			emit1(ctx, 0xbb);
+			emit32(ctx, k);
+			break;
+		case BPF_LDX|BPF_IMM:		/* mov ebp,k */
+			emit1(ctx, 0xbd);
+			emit32(ctx, k);
+			break;
+		case BPF_LD|BPF_MEM:		/* mov ebx,[rsp+4k] */
+			emit3(ctx, 0x8b, 0x5c, 0x24);
+			emit1(ctx, k * 4);
+			break;
+		case BPF_LDX|BPF_MEM:		/* mov ebp,[rsp+4k] */
+			emit3(ctx, 0x8b, 0x6c, 0x24);
+			emit1(ctx, k * 4);
+			break;
+		case BPF_ST:			/* mov [rsp+4k],ebx */
+			emit3(ctx, 0x89, 0x5c, 0x24);
+			emit1(ctx, k * 4);
+			break;
+		case BPF_STX:			/* mov [rsp+4k],ebp */
+			emit3(ctx, 0x89, 0x6c, 0x24);
+			emit1(ctx, k * 4);
+			break;
+		case BPF_MISC|BPF_TAX:		/* mov ebp,ebx */
+			emit2(ctx, 0x89, 0xdd);
+			break;
+		case BPF_MISC|BPF_TXA:		/* mov ebx,ebp */
+			emit2(ctx, 0x89, 0xeb);
+			break;
+		case BPF_RET|BPF_K:		/* mov eax,k */
+			emit1(ctx, 0xb8);
+			emit32(ctx, k);
+			goto ret;
+		case BPF_RET|BPF_A:		/* mov eax,ebx */
+			emit2(ctx, 0x89, 0xd8);
+ret:
+			/* The last instruction falls through */
+			if (pc != flen - 1)
+				emit_jmp(ctx, ctx->epilogue);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	ctx->addrs[flen] = ctx->len;
+
+	emit_epilogue(ctx);
+	return 0;
+}
+
+/**
+ *	bpf_jit_compile - compile a socket filter to native code
+ *	@fp: checked filter
+ *
+ * Sets fp->bpf_func when bpf_jit_enable is on and the filter could be
+ * compiled; the filter is interpreted otherwise.
+ */
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	struct jit_context ctx;
+	unsigned long mem_read = 0;
+	int pc, flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	for (pc = 0; pc < flen; pc++) {
+		u16 code = fp->insns[pc].code;
+
+		if (code == (BPF_LD|BPF_MEM) || code == (BPF_LDX|BPF_MEM))
+			mem_read |= 1UL << fp->insns[pc].k;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.addrs = kmalloc((flen + 1) * sizeof(*ctx.addrs), GFP_KERNEL);
+	if (!ctx.addrs)
+		return;
+
+	/* Sizing pass, then the real one with all offsets known */
+	if (jit_pass(&ctx, fp->insns, flen, mem_read))
+		goto out;
+
+	ctx.image = module_alloc(max_t(unsigned int, ctx.len,
+				       sizeof(struct work_struct)));
+	if (!ctx.image)
+		goto out;
+
+	jit_pass(&ctx, fp->insns, flen, mem_read);
+
+	if (bpf_jit_enable > 1) {
+		printk(KERN_INFO "flen=%d proglen=%u image=%p\n",
+		       flen, ctx.len, ctx.image);
+		print_hex_dump(KERN_INFO, "JIT code: ", DUMP_PREFIX_OFFSET,
+			       16, 1, ctx.image, ctx.len, false);
+	}
+
+	fp->bpf_func = (void *)ctx.image;
+out:
+	kfree(ctx.addrs);
+}
+
+static void jit_free_defer(struct work_struct *work)
+{
+	module_free(NULL, work);
+}
+
+/*
+ * Filters are released from RCU callbacks, where the image cannot be
+ * vfree()d; it is not run anymore, so reuse it as the work item.
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
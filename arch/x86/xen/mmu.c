@@ -44,6 +44,7 @@
 #include <linux/bug.h>
 #include <linux/vmalloc.h>
 #include <linux/module.h>
+#include <linux/swap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -199,6 +200,17 @@ DEFINE_PER_CPU(unsigned long, xen_current_cr3);	 /* actual vcpu cr3 */
 
 unsigned long xen_max_p2m_pfn __read_mostly;
 
+/*
+ * The leaves for the pfns the domain builder gave us all point into its
+ * mfn_list, so for those the tree is really one flat array, which
+ * get_phys_to_machine() indexes directly.  The tree is only walked for
+ * pfns beyond it (ballooned-in or hot-added memory).
+ */
+unsigned long *xen_p2m_flat __read_mostly;
+EXPORT_SYMBOL_GPL(xen_p2m_flat);
+unsigned long xen_p2m_flat_size __read_mostly;
+EXPORT_SYMBOL_GPL(xen_p2m_flat_size);
+
 #define P2M_PER_PAGE		(PAGE_SIZE / sizeof(unsigned long))
 #define P2M_MID_PER_PAGE	(PAGE_SIZE / sizeof(unsigned long *))
 #define P2M_TOP_PER_PAGE	(PAGE_SIZE / sizeof(unsigned long **))
@@ -426,9 +438,12 @@ void __init xen_build_dynamic_phys_to_machine(void)
 		}
 		p2m_top[topidx][mididx] = &mfn_list[pfn];
 	}
+
+	xen_p2m_flat = mfn_list;
+	xen_p2m_flat_size = max_pfn;
 }
 
-unsigned long get_phys_to_machine(unsigned long pfn)
+unsigned long __get_phys_to_machine(unsigned long pfn)
 {
 	unsigned topidx, mididx, idx;
 
@@ -441,7 +456,7 @@ unsigned long get_phys_to_machine(unsigned long pfn)
 
 	return p2m_top[topidx][mididx][idx];
 }
-EXPORT_SYMBOL_GPL(get_phys_to_machine);
+EXPORT_SYMBOL_GPL(__get_phys_to_machine);
 
 static void *alloc_p2m_page(void)
 {
@@ -650,6 +665,7 @@ void xen_set_domain_pte(pte_t *ptep, pte_t pteval, unsigned domid)
 	u->val = pte_val_ma(pteval);
 
 	MULTI_mmu_update(mcs.mc, mcs.args, 1, NULL, domid);
+	trace_xen_mmu_update(u->ptr, u->val, 1, domid, 1);
 
 	xen_mc_issue(PARAVIRT_LAZY_MMU);
 }
@@ -681,6 +697,7 @@ static void xen_extend_mmu_update(const struct mmu_update *update)
 
 	u = mcs.args;
 	*u = *update;
+	trace_xen_mmu_update(u->ptr, u->val, mcs.mc->args[1], DOMID_SELF, 1);
 }
 
 void xen_set_pmd_hyper(pmd_t *ptr, pmd_t val)
@@ -1239,6 +1256,87 @@ static void xen_do_pin(unsigned level, unsigned long pfn)
 	MULTI_mmuext_op(mcs.mc, op, 1, NULL, DOMID_SELF);
 }
 
+/*
+ * Change the protection of a pagetable page's kernel mapping.  Done as
+ * an mmu_update on the mapping's pte rather than an update_va_mapping,
+ * so a whole walk's worth of pages coalesce into a few multicall
+ * entries.
+ */
+static void xen_set_linear_prot(void *pt, pgprot_t prot)
+{
+	unsigned long pfn = PFN_DOWN(__pa(pt));
+	unsigned int level;
+	pte_t *ptep = lookup_address((unsigned long)pt, &level);
+	struct mmu_update u;
+
+	BUG_ON(ptep == NULL || level != PG_LEVEL_4K);
+
+	u.ptr = arbitrary_virt_to_machine(ptep).maddr | MMU_NORMAL_PT_UPDATE;
+	u.val = pte_val_ma(mfn_pte(pfn_to_mfn(pfn), prot));
+	xen_extend_mmu_update(&u);
+}
+
+/*
+ * With split pte locks, each pte page has to be (un)pinned on its own
+ * while its lock is held (see xen_pin_page).  Rather than one mmuext op
+ * per page, the pins are collected here and issued as a single
+ * mmuext_op entry; the locks are dropped once that batch has been
+ * flushed.  Unpinned pages are only made writable after the unpin.
+ */
+#define XEN_PIN_BATCH	16
+
+struct xen_pin_batch {
+	unsigned cmd;
+	unsigned nr;
+	unsigned long pfn[XEN_PIN_BATCH];
+	spinlock_t *ptl[XEN_PIN_BATCH];
+};
+
+static DEFINE_PER_CPU(struct xen_pin_batch, xen_pin_batch);
+
+static void xen_pin_batch_flush(void)
+{
+	struct xen_pin_batch *pb = &__get_cpu_var(xen_pin_batch);
+	struct multicall_space mcs;
+	struct mmuext_op *op;
+	unsigned i;
+
+	if (!pb->nr)
+		return;
+
+	mcs = __xen_mc_entry(pb->nr * sizeof(*op));
+	op = mcs.args;
+	for (i = 0; i < pb->nr; i++) {
+		op[i].cmd = pb->cmd;
+		op[i].arg1.mfn = pfn_to_mfn(pb->pfn[i]);
+	}
+	MULTI_mmuext_op(mcs.mc, op, pb->nr, NULL, DOMID_SELF);
+
+	for (i = 0; i < pb->nr; i++) {
+		if (pb->cmd == MMUEXT_UNPIN_TABLE)
+			xen_set_linear_prot(__va(PFN_PHYS(pb->pfn[i])),
+					    PAGE_KERNEL);
+		xen_mc_callback(xen_pte_unlock, pb->ptl[i]);
+	}
+
+	pb->nr = 0;
+}
+
+static void xen_pin_batch_add(unsigned cmd, unsigned long pfn, spinlock_t *ptl)
+{
+	struct xen_pin_batch *pb = &__get_cpu_var(xen_pin_batch);
+
+	if (pb->nr && pb->cmd != cmd)
+		xen_pin_batch_flush();
+
+	pb->cmd = cmd;
+	pb->pfn[pb->nr] = pfn;
+	pb->ptl[pb->nr] = ptl;
+
+	if (++pb->nr == XEN_PIN_BATCH)
+		xen_pin_batch_flush();
+}
+
 static int xen_pin_page(struct mm_struct *mm, struct page *page,
 			enum pt_level level)
 {
@@ -1254,7 +1352,6 @@ static int xen_pin_page(struct mm_struct *mm, struct page *page,
 	else {
 		void *pt = lowmem_page_address(page);
 		unsigned long pfn = page_to_pfn(page);
-		struct multicall_space mcs = __xen_mc_entry(0);
 		spinlock_t *ptl;
 
 		flush = 0;
@@ -1273,7 +1370,7 @@ static int xen_pin_page(struct mm_struct *mm, struct page *page,
 		 * bits).  The solution is to mark RO and pin each PTE
 		 * page while holding the lock.  This means the number
 		 * of locks we end up holding is never more than a
-		 * batch size (~32 entries, at present).
+		 * pin batch (XEN_PIN_BATCH entries).
 		 *
 		 * If we're not using split pte locks, we needn't pin
 		 * the PTE pages independently, because we're
@@ -1283,17 +1380,21 @@ static int xen_pin_page(struct mm_struct *mm, struct page *page,
 		if (level == PT_PTE)
 			ptl = xen_pte_lock(page, mm);
 
-		MULTI_update_va_mapping(mcs.mc, (unsigned long)pt,
-					pfn_pte(pfn, PAGE_KERNEL_RO),
-					level == PT_PGD ? UVMF_TLB_FLUSH : 0);
+		if (level == PT_PGD) {
+			struct multicall_space mcs;
 
-		if (ptl) {
-			xen_do_pin(MMUEXT_PIN_L1_TABLE, pfn);
+			/* The pgd's TLB flush comes after everything else. */
+			xen_pin_batch_flush();
+			mcs = __xen_mc_entry(0);
+			MULTI_update_va_mapping(mcs.mc, (unsigned long)pt,
+						pfn_pte(pfn, PAGE_KERNEL_RO),
+						UVMF_TLB_FLUSH);
+		} else
+			xen_set_linear_prot(pt, PAGE_KERNEL_RO);
 
-			/* Queue a deferred unlock for when this batch
-			   is completed. */
-			xen_mc_callback(xen_pte_unlock, ptl);
-		}
+		/* The lock is dropped once the (batched) pin is done. */
+		if (ptl)
+			xen_pin_batch_add(MMUEXT_PIN_L1_TABLE, pfn, ptl);
 	}
 
 	return flush;
@@ -1304,9 +1405,14 @@ static int xen_pin_page(struct mm_struct *mm, struct page *page,
    read-only, and can be pinned. */
 static void __xen_pgd_pin(struct mm_struct *mm, pgd_t *pgd)
 {
+	int flush;
+
 	xen_mc_batch();
 
-	if (__xen_pgd_walk(mm, pgd, xen_pin_page, USER_LIMIT)) {
+	flush = __xen_pgd_walk(mm, pgd, xen_pin_page, USER_LIMIT);
+	xen_pin_batch_flush();
+
+	if (flush) {
 		/* re-enable interrupts for flushing */
 		xen_mc_issue(0);
 
@@ -1396,32 +1502,31 @@ static int xen_unpin_page(struct mm_struct *mm, struct page *page,
 		void *pt = lowmem_page_address(page);
 		unsigned long pfn = page_to_pfn(page);
 		spinlock_t *ptl = NULL;
-		struct multicall_space mcs;
 
 		/*
 		 * Do the converse to pin_page.  If we're using split
 		 * pte locks, we must be holding the lock for while
 		 * the pte page is unpinned but still RO to prevent
 		 * concurrent updates from seeing it in this
-		 * partially-pinned state.
+		 * partially-pinned state.  The pin batch makes the
+		 * page RW after the unpin and then drops the lock.
 		 */
-		if (level == PT_PTE) {
+		if (level == PT_PTE)
 			ptl = xen_pte_lock(page, mm);
 
-			if (ptl)
-				xen_do_pin(MMUEXT_UNPIN_TABLE, pfn);
-		}
-
-		mcs = __xen_mc_entry(0);
-
-		MULTI_update_va_mapping(mcs.mc, (unsigned long)pt,
-					pfn_pte(pfn, PAGE_KERNEL),
-					level == PT_PGD ? UVMF_TLB_FLUSH : 0);
+		if (ptl)
+			xen_pin_batch_add(MMUEXT_UNPIN_TABLE, pfn, ptl);
+		else if (level == PT_PGD) {
+			struct multicall_space mcs;
 
-		if (ptl) {
-			/* unlock when batch completed */
-			xen_mc_callback(xen_pte_unlock, ptl);
-		}
+			/* The pgd's TLB flush comes after everything else. */
+			xen_pin_batch_flush();
+			mcs = __xen_mc_entry(0);
+			MULTI_update_va_mapping(mcs.mc, (unsigned long)pt,
+						pfn_pte(pfn, PAGE_KERNEL),
+						UVMF_TLB_FLUSH);
+		} else
+			xen_set_linear_prot(pt, PAGE_KERNEL);
 	}
 
 	return 0;		/* never need to flush on unpin */
@@ -1453,6 +1558,7 @@ static void __xen_pgd_unpin(struct mm_struct *mm, pgd_t *pgd)
 #endif
 
 	__xen_pgd_walk(mm, pgd, xen_unpin_page, USER_LIMIT);
+	xen_pin_batch_flush();
 
 	xen_mc_issue(0);
 }
@@ -1663,8 +1769,8 @@ static void xen_flush_tlb_single(unsigned long addr)
  * doesn't give us an opportunity to kick out cpus which are in lazy
  * tlb state, so we may end up reflushing some cpus unnecessarily.
  */
-static void xen_flush_tlb_others(const struct cpumask *cpus,
-				 struct mm_struct *mm, unsigned long va)
+static void __xen_flush_tlb_others(const struct cpumask *cpus,
+				   unsigned long va)
 {
 	struct {
 		struct mmuext_op op;
@@ -1672,9 +1778,6 @@ static void xen_flush_tlb_others(const struct cpumask *cpus,
 	} *args;
 	struct multicall_space mcs;
 
-	if (cpumask_empty(cpus))
-		return;		/* nothing to do */
-
 	mcs = xen_mc_entry(sizeof(*args));
 	args = mcs.args;
 	args->op.arg2.vcpumask = to_cpumask(args->mask);
@@ -1695,6 +1798,109 @@ static void xen_flush_tlb_others(const struct cpumask *cpus,
 	xen_mc_issue(PARAVIRT_LAZY_MMU);
 }
 
+/*
+ * Within a lazy MMU section the remote flushes are only needed by the
+ * time the section ends, so they are collected here and issued together
+ * from xen_leave_lazy_mmu: one INVLPG_MULTI per distinct address, all
+ * sharing one vcpu mask, or a single TLB_FLUSH_MULTI once there are more
+ * than XEN_TLB_BATCH addresses.
+ */
+#define XEN_TLB_BATCH	8
+
+struct xen_tlb_batch {
+	bool pending;
+	bool flush_all;
+	unsigned nr;
+	unsigned long va[XEN_TLB_BATCH];
+	struct cpumask mask;
+};
+
+static DEFINE_PER_CPU(struct xen_tlb_batch, xen_tlb_batch);
+
+static void xen_tlb_batch_add(const struct cpumask *cpus, unsigned long va)
+{
+	struct xen_tlb_batch *tb = &__get_cpu_var(xen_tlb_batch);
+	unsigned i;
+
+	if (!tb->pending) {
+		cpumask_clear(&tb->mask);
+		tb->flush_all = false;
+		tb->nr = 0;
+		tb->pending = true;
+	}
+	cpumask_or(&tb->mask, &tb->mask, cpus);
+
+	if (tb->flush_all)
+		return;
+
+	if (va == TLB_FLUSH_ALL) {
+		tb->flush_all = true;
+		return;
+	}
+
+	va &= PAGE_MASK;
+	for (i = 0; i < tb->nr; i++)
+		if (tb->va[i] == va)
+			return;
+
+	if (tb->nr == XEN_TLB_BATCH)
+		tb->flush_all = true;
+	else
+		tb->va[tb->nr++] = va;
+}
+
+static void xen_tlb_batch_issue(void)
+{
+	struct xen_tlb_batch *tb = &__get_cpu_var(xen_tlb_batch);
+	struct multicall_space mcs;
+	struct mmuext_op *op;
+	unsigned long *mask;
+	unsigned i, nr;
+
+	if (!tb->pending)
+		return;
+	tb->pending = false;
+
+	/* Remove us, and any offline CPUS. */
+	cpumask_and(&tb->mask, &tb->mask, cpu_online_mask);
+	cpumask_clear_cpu(smp_processor_id(), &tb->mask);
+	if (cpumask_empty(&tb->mask))
+		return;
+
+	nr = tb->flush_all ? 1 : tb->nr;
+
+	mcs = xen_mc_entry(nr * sizeof(*op) + cpumask_size());
+	op = mcs.args;
+	mask = (unsigned long *)(op + nr);
+	cpumask_copy(to_cpumask(mask), &tb->mask);
+
+	for (i = 0; i < nr; i++) {
+		op[i].arg2.vcpumask = mask;
+		if (tb->flush_all) {
+			op[i].cmd = MMUEXT_TLB_FLUSH_MULTI;
+		} else {
+			op[i].cmd = MMUEXT_INVLPG_MULTI;
+			op[i].arg1.linear_addr = tb->va[i];
+		}
+	}
+
+	MULTI_mmuext_op(mcs.mc, op, nr, NULL, DOMID_SELF);
+
+	xen_mc_issue(PARAVIRT_LAZY_MMU);
+}
+
+static void xen_flush_tlb_others(const struct cpumask *cpus,
+				 struct mm_struct *mm, unsigned long va)
+{
+	if (cpumask_empty(cpus))
+		return;		/* nothing to do */
+
+	if (paravirt_get_lazy_mode() == PARAVIRT_LAZY_MMU)
+		xen_tlb_batch_add(cpus, va);
+	else
+		__xen_flush_tlb_others(cpus, va);
+}
+
 static unsigned long xen_read_cr3(void)
 {
 	return percpu_read(xen_cr3);
@@ -1936,6 +2142,61 @@ static void xen_alloc_pmd(struct mm_struct *mm, unsigned long pfn)
 	xen_alloc_ptpage(mm, pfn, PT_PMD);
 }
 
+/*
+ * Releasing a pinned pagetable page costs an unpin (for a pte page with
+ * split pte locks) and an update to make it writable again.  In a lazy
+ * MMU section, which free_pgd_range runs in, the released pages are
+ * collected here and issued together: one mmuext_op entry for all the
+ * unpins, then the mmu_updates, which coalesce into another.  The batch
+ * is issued from xen_leave_lazy_mmu, which the mmu_gather code forces
+ * before any of the pages can be freed.
+ */
+#define XEN_RELEASE_BATCH	32
+
+struct xen_release_batch {
+	unsigned nr;
+	unsigned nr_unpin;
+	unsigned long pfn[XEN_RELEASE_BATCH];
+	unsigned long unpin[XEN_RELEASE_BATCH];
+};
+
+static DEFINE_PER_CPU(struct xen_release_batch, xen_release_batch);
+
+/* Called within xen_mc_batch() */
+static void xen_release_batch_flush(void)
+{
+	struct xen_release_batch *rb = &__get_cpu_var(xen_release_batch);
+	struct multicall_space mcs;
+	struct mmuext_op *op;
+	unsigned i;
+
+	if (!rb->nr)
+		return;
+
+	if (rb->nr_unpin) {
+		mcs = __xen_mc_entry(rb->nr_unpin * sizeof(*op));
+		op = mcs.args;
+		for (i = 0; i < rb->nr_unpin; i++) {
+			op[i].cmd = MMUEXT_UNPIN_TABLE;
+			op[i].arg1.mfn = pfn_to_mfn(rb->unpin[i]);
+		}
+		MULTI_mmuext_op(mcs.mc, op, rb->nr_unpin, NULL, DOMID_SELF);
+	}
+
+	for (i = 0; i < rb->nr; i++)
+		xen_set_linear_prot(__va(PFN_PHYS(rb->pfn[i])), PAGE_KERNEL);
+
+	rb->nr = 0;
+	rb->nr_unpin = 0;
+}
+
+static void xen_release_batch_issue(void)
+{
+	xen_mc_batch();
+	xen_release_batch_flush();
+	xen_mc_issue(PARAVIRT_LAZY_MMU);
+}
+
 /* This should never happen until we're OK to use struct page */
 static void xen_release_ptpage(unsigned long pfn, unsigned level)
 {
@@ -1943,9 +2204,17 @@ static void xen_release_ptpage(unsigned long pfn, unsigned level)
 
 	if (PagePinned(page)) {
 		if (!PageHighMem(page)) {
+			struct xen_release_batch *rb;
+
+			xen_mc_batch();
+			rb = &__get_cpu_var(xen_release_batch);
 			if (level == PT_PTE && USE_SPLIT_PTLOCKS)
-				pin_pagetable_pfn(MMUEXT_UNPIN_TABLE, pfn);
-			make_lowmem_page_readwrite(__va(PFN_PHYS(pfn)));
+				rb->unpin[rb->nr_unpin++] = pfn;
+			rb->pfn[rb->nr++] = pfn;
+			if (rb->nr == XEN_RELEASE_BATCH ||
+			    paravirt_get_lazy_mode() != PARAVIRT_LAZY_MMU)
+				xen_release_batch_flush();
+			xen_mc_issue(PARAVIRT_LAZY_MMU);
 		}
 		ClearPagePinned(page);
 	}
@@ -2259,6 +2528,7 @@ static void xen_set_fixmap(unsigned idx, phys_addr_t phys, pgprot_t prot)
 # endif
 #else
 	case VSYSCALL_LAST_PAGE ... VSYSCALL_FIRST_PAGE:
+	case PVCLOCK_FIXMAP_BEGIN ... PVCLOCK_FIXMAP_END:
 #endif
 #ifdef CONFIG_X86_LOCAL_APIC
 	case FIX_APIC_BASE:	/* maps dummy local APIC */
@@ -2296,7 +2566,8 @@ static void xen_set_fixmap(unsigned idx, phys_addr_t phys, pgprot_t prot)
 #ifdef CONFIG_X86_64
 	/* Replicate changes to map the vsyscall page into the user
 	   pagetable vsyscall mapping. */
-	if (idx >= VSYSCALL_LAST_PAGE && idx <= VSYSCALL_FIRST_PAGE) {
+	if ((idx >= VSYSCALL_LAST_PAGE && idx <= VSYSCALL_FIRST_PAGE) ||
+	    (idx >= PVCLOCK_FIXMAP_BEGIN && idx <= PVCLOCK_FIXMAP_END)) {
 		unsigned long vaddr = __fix_to_virt(idx);
 		set_pte_vaddr_pud(level3_user_vsyscall, vaddr, pte);
 	}
@@ -2355,6 +2626,8 @@ static __init void xen_post_allocator_init(void)
 static void xen_leave_lazy_mmu(void)
 {
 	preempt_disable();
+	xen_release_batch_issue();
+	xen_tlb_batch_issue();
 	xen_mc_flush();
 	paravirt_leave_lazy_mmu();
 	preempt_enable();
@@ -2437,6 +2710,15 @@ void __init xen_init_mmu_ops(void)
 	x86_init.paging.pagetable_setup_start = xen_pagetable_setup_start;
 	x86_init.paging.pagetable_setup_done = xen_pagetable_setup_done;
 	pv_mmu_ops = xen_mmu_ops;
+
+#ifdef CONFIG_X86_64
+	/*
+	 * Every lazy vmap purge ends in a TLB flush hypercall covering all
+	 * vcpus.  Backends map and unmap rings and grants often enough for
+	 * that to show, and there is vmalloc space to spare for batching.
+	 */
+	vmap_lazy_scale = 4;
+#endif
 }
 
 /* Protected by xen_reservation_lock. */
@@ -2634,6 +2916,105 @@ void xen_destroy_contiguous_region(unsigned long vstart, unsigned int order)
 }
 EXPORT_SYMBOL_GPL(xen_destroy_contiguous_region);
 
+/*
+ * xen_contig_mem=<size> ("all" for no limit): late in boot, allocate
+ * free memory in MAX_CONTIG_ORDER blocks and exchange every block that
+ * is not machine-contiguous for one that is, then give them all back.
+ * The page allocator keeps handing out pfn neighbours, which are now
+ * machine neighbours too, so bios merge and swiotlb-xen can DMA
+ * straight from them instead of bouncing.  Blocks already in use are
+ * left alone, so this is best done before the I/O load starts.
+ */
+static unsigned long xen_contig_mem;
+
+static int __init parse_xen_contig_mem(char *arg)
+{
+	if (!strcmp(arg, "all"))
+		xen_contig_mem = ~0UL;
+	else
+		xen_contig_mem = memparse(arg, &arg) >> PAGE_SHIFT;
+	return 1;
+}
+__setup("xen_contig_mem=", parse_xen_contig_mem);
+
+static bool xen_pfn_range_contiguous(unsigned long pfn, unsigned long nr)
+{
+	unsigned long mfn = pfn_to_mfn(pfn);
+	unsigned long i;
+
+	if (mfn == INVALID_P2M_ENTRY)
+		return false;
+
+	for (i = 1; i < nr; i++)
+		if (pfn_to_mfn(pfn + i) != mfn + i)
+			return false;
+	return true;
+}
+
+/* MAX_CONTIG_ORDER aligned chunks of the p2m, and machine-contiguous ones */
+static unsigned long xen_p2m_contig_chunks(unsigned long *total)
+{
+	unsigned long pfn, contig = 0;
+
+	*total = 0;
+	for (pfn = 0; pfn + (1UL << MAX_CONTIG_ORDER) <= max_pfn;
+	     pfn += 1UL << MAX_CONTIG_ORDER) {
+		(*total)++;
+		if (xen_pfn_range_contiguous(pfn, 1UL << MAX_CONTIG_ORDER))
+			contig++;
+		cond_resched();
+	}
+	return contig;
+}
+
+static int __init xen_make_contig_mem(void)
+{
+	unsigned long nr = 1UL << MAX_CONTIG_ORDER;
+	unsigned long done = 0, exchanged = 0, contig, total;
+	unsigned long floor = totalram_pages / 32;
+	LIST_HEAD(blocks);
+	struct page *page, *next;
+	int failures = 0;
+
+	if (!xen_contig_mem || xen_feature(XENFEAT_auto_translated_physmap))
+		return 0;
+
+	while (done < xen_contig_mem && nr_free_pages() > floor + nr &&
+	       failures < 8) {
+		page = alloc_pages(GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY,
+				   MAX_CONTIG_ORDER);
+		if (!page)
+			break;
+		list_add(&page->lru, &blocks);
+		done += nr;
+
+		if (xen_pfn_range_contiguous(page_to_pfn(page), nr))
+			continue;
+
+		if (xen_create_contiguous_region((unsigned long)page_address(page),
+						 MAX_CONTIG_ORDER, 0) == 0) {
+			exchanged++;
+			failures = 0;
+		} else
+			failures++;
+
+		cond_resched();
+	}
+
+	list_for_each_entry_safe(page, next, &blocks, lru) {
+		list_del(&page->lru);
+		__free_pages(page, MAX_CONTIG_ORDER);
+	}
+
+	contig = xen_p2m_contig_chunks(&total);
+	printk(KERN_INFO "xen: exchanged %lu blocks of %lukB for "
+	       "machine-contiguous ones; %lu of %lu are now contiguous\n",
+	       exchanged, (PAGE_SIZE << MAX_CONTIG_ORDER) >> 10, contig, total);
+
+	return 0;
+}
+late_initcall(xen_make_contig_mem);
+
 #define REMAP_BATCH_SIZE 16
 
 struct remap_data {
@@ -2700,6 +3081,87 @@ out:
 }
 EXPORT_SYMBOL_GPL(xen_remap_domain_mfn_range);
 
+struct remap_array_data {
+	unsigned long *mfn;
+	pgprot_t prot;
+	struct mmu_update *mmu_update;
+};
+
+static int remap_area_mfn_array_pte_fn(pte_t *ptep, pgtable_t token,
+				       unsigned long addr, void *data)
+{
+	struct remap_array_data *rmd = data;
+	pte_t pte = pte_mkspecial(pfn_pte(*rmd->mfn++, rmd->prot));
+
+	rmd->mmu_update->ptr = arbitrary_virt_to_machine(ptep).maddr;
+	rmd->mmu_update->val = pte_val_ma(pte);
+	rmd->mmu_update++;
+
+	return 0;
+}
+
+/*
+ * Map the nr (not necessarily contiguous) foreign frames in mfn[] at
+ * addr, storing each page's result in err[].  A frame Xen refuses only
+ * fails its own entry; the rest of its batch is resubmitted rather than
+ * being retried page by page.  Returns the number of failed pages.
+ */
+int xen_remap_domain_mfn_array(struct vm_area_struct *vma,
+			       unsigned long addr,
+			       unsigned long *mfn, int nr, int *err,
+			       pgprot_t prot, unsigned domid)
+{
+	struct remap_array_data rmd;
+	struct mmu_update mmu_update[REMAP_BATCH_SIZE];
+	int batch, done, i, rc, failed = 0;
+
+	prot = __pgprot(pgprot_val(prot) | _PAGE_IOMAP);
+
+	vma->vm_flags |= VM_IO | VM_RESERVED | VM_PFNMAP;
+
+	rmd.prot = prot;
+
+	while (nr) {
+		batch = min(REMAP_BATCH_SIZE, nr);
+
+		rmd.mfn = mfn;
+		rmd.mmu_update = mmu_update;
+		rc = apply_to_page_range(vma->vm_mm, addr,
+					 (unsigned long)batch << PAGE_SHIFT,
+					 remap_area_mfn_array_pte_fn, &rmd);
+		if (rc) {
+			for (i = 0; i < nr; i++)
+				err[i] = rc;
+			failed += nr;
+			break;
+		}
+
+		for (i = 0; i < batch; ) {
+			done = 0;
+			rc = HYPERVISOR_mmu_update(mmu_update + i, batch - i,
+						   &done, domid);
+			if (rc >= 0)
+				done = batch - i;
+			while (done--)
+				err[i++] = 0;
+			if (rc < 0) {
+				err[i++] = rc;
+				failed++;
+			}
+		}
+
+		mfn += batch;
+		err += batch;
+		nr -= batch;
+		addr += (unsigned long)batch << PAGE_SHIFT;
+	}
+
+	flush_tlb_all();
+
+	return failed;
+}
+EXPORT_SYMBOL_GPL(xen_remap_domain_mfn_array);
+
 #ifdef CONFIG_XEN_PVHVM
 static void xen_hvm_exit_mmap(struct mm_struct *mm)
 {
@@ -2738,6 +3200,25 @@ void __init xen_hvm_init_mmu_ops(void)
 
 static struct dentry *d_mmu_debug;
 
+static ssize_t p2m_contig_read(struct file *file, char __user *buf,
+			       size_t len, loff_t *ppos)
+{
+	unsigned long contig, total;
+	char tmp[64];
+	int n;
+
+	contig = xen_p2m_contig_chunks(&total);
+	n = snprintf(tmp, sizeof(tmp), "%lu %lu %lu\n", contig, total,
+		     (PAGE_SIZE << MAX_CONTIG_ORDER) >> 10);
+
+	return simple_read_from_buffer(buf, len, ppos, tmp, n);
+}
+
+/* machine-contiguous chunks, all chunks, chunk size in kB */
+static const struct file_operations p2m_contig_fops = {
+	.read = p2m_contig_read,
+};
+
 static int __init xen_mmu_debugfs(void)
 {
 	struct dentry *d_xen = xen_init_debugfs();
@@ -2791,6 +3272,9 @@ static int __init xen_mmu_debugfs(void)
 	debugfs_create_u32("prot_commit_batched", 0444, d_mmu_debug,
 			   &mmu_stats.prot_commit_batched);
 
+	debugfs_create_file("p2m_contig", 0444, d_mmu_debug, NULL,
+			    &p2m_contig_fops);
+
 	return 0;
 }
 fs_initcall(xen_mmu_debugfs);
@@ -22,6 +22,10 @@
 #include <linux/percpu.h>
 #include <linux/hardirq.h>
 #include <linux/debugfs.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+
+#include <asm/page.h>
 
 #include <asm/xen/hypercall.h>
 
@@ -32,26 +36,91 @@
 
 #define MC_DEBUG	1
 
-#define MC_ARGS		(MC_BATCH * 16)
+/*
+ * Argument space is what limits runs of coalesced mmu_updates (see
+ * xen_extend_mmu_update): at 16 bytes per update, a page holds 256 of
+ * them, so a large mprotect or munmap under lazy MMU mode traps into Xen
+ * once per 256 ptes rather than once per 32.
+ */
+#define MC_ARGS		PAGE_SIZE
 
+/*
+ * A cpu starts out with MC_BATCH slots and MC_ARGS of arguments in its
+ * mc_buffer.  If more than 1 in MC_GROW_RATIO of the last MC_GROW_WINDOW
+ * flushes were forced by a full buffer, its batches want to be longer:
+ * the buffer is reallocated at twice the size from a workqueue, up to
+ * MC_BATCH_MAX slots.
+ */
+#define MC_BATCH_MAX	(MC_BATCH * 8)
+#define MC_GROW_WINDOW	256
+#define MC_GROW_RATIO	8
 
-struct mc_buffer {
-	struct multicall_entry entries[MC_BATCH];
+struct mc_storage {
+	struct multicall_entry *entries;
 #if MC_DEBUG
-	struct multicall_entry debug[MC_BATCH];
-	void *caller[MC_BATCH];
+	struct multicall_entry *debug;
+	void **caller;
 #endif
-	unsigned char args[MC_ARGS];
+	unsigned char *args;
+};
+
+struct mc_buffer {
+	struct mc_storage s;	/* NULL entries: the boot arrays below */
+	unsigned batch, nargs;	/* current capacity */
+	unsigned mcidx, argidx, cbidx;
+
+	unsigned flushes, full;	/* flushes this window, forced ones */
+	int cpu;
+	struct work_struct grow;
+
 	struct callback {
 		void (*fn)(void *);
 		void *data;
 	} callbacks[MC_BATCH];
-	unsigned mcidx, argidx, cbidx;
+
+	struct multicall_entry boot_entries[MC_BATCH];
+#if MC_DEBUG
+	struct multicall_entry boot_debug[MC_BATCH];
+	void *boot_caller[MC_BATCH];
+#endif
+	unsigned char boot_args[MC_ARGS];
 };
 
 static DEFINE_PER_CPU(struct mc_buffer, mc_buffer);
 DEFINE_PER_CPU(unsigned long, xen_mc_irq_flags);
 
+static inline struct multicall_entry *mc_entries(struct mc_buffer *b)
+{
+	return likely(b->s.entries) ? b->s.entries : b->boot_entries;
+}
+
+static inline unsigned char *mc_args(struct mc_buffer *b)
+{
+	return likely(b->s.args) ? b->s.args : b->boot_args;
+}
+
+#if MC_DEBUG
+static inline struct multicall_entry *mc_debug(struct mc_buffer *b)
+{
+	return likely(b->s.debug) ? b->s.debug : b->boot_debug;
+}
+
+static inline void **mc_caller(struct mc_buffer *b)
+{
+	return likely(b->s.caller) ? b->s.caller : b->boot_caller;
+}
+#endif
+
+static inline unsigned mc_batch(const struct mc_buffer *b)
+{
+	return b->batch ? b->batch : MC_BATCH;
+}
+
+static inline unsigned mc_nargs(const struct mc_buffer *b)
+{
+	return b->nargs ? b->nargs : MC_ARGS;
+}
+
 /* flush reasons 0- slots, 1- args, 2- callbacks */
 enum flush_reasons
 {
@@ -62,6 +131,25 @@ enum flush_reasons
 	FL_N_REASONS
 };
 
+/*
+ * Paravirt paths a batched hypercall comes from, told apart by op (and
+ * mmuext cmd): 0- mmu_update, 1- update_va_mapping, 2- pin/unpin,
+ * 3- TLB flush, 4- LDT/GDT, 5- context switch (stack, fpu, segment
+ * base), 6- anything else.
+ */
+enum mc_sites
+{
+	MC_SITE_MMU_UPDATE,
+	MC_SITE_VA_MAPPING,
+	MC_SITE_PIN,
+	MC_SITE_TLB_FLUSH,
+	MC_SITE_DESC,
+	MC_SITE_SWITCH,
+	MC_SITE_OTHER,
+
+	MC_N_SITES
+};
+
 #ifdef CONFIG_XEN_DEBUG_FS
 #define NHYPERCALLS	40		/* not really */
 
@@ -74,6 +162,13 @@ static struct {
 	unsigned histo_hypercalls[NHYPERCALLS];
 
 	unsigned flush[FL_N_REASONS];
+
+	/* per site: calls, flushes the site closed, and those batches' lengths */
+	unsigned site_calls[MC_N_SITES];
+	unsigned site_flushes[MC_N_SITES];
+	unsigned site_batch_total[MC_N_SITES];
+
+	unsigned grown;
 } mc_stats;
 
 static u8 zero_stats;
@@ -86,21 +181,64 @@ static inline void check_zero(void)
 	}
 }
 
-static void mc_add_stats(const struct mc_buffer *mc)
+static enum mc_sites mc_site(const struct multicall_entry *mc)
+{
+	const struct mmuext_op *op;
+
+	switch (mc->op) {
+	case __HYPERVISOR_mmu_update:
+		return MC_SITE_MMU_UPDATE;
+	case __HYPERVISOR_update_va_mapping:
+		return MC_SITE_VA_MAPPING;
+	case __HYPERVISOR_update_descriptor:
+	case __HYPERVISOR_set_gdt:
+		return MC_SITE_DESC;
+	case __HYPERVISOR_stack_switch:
+	case __HYPERVISOR_fpu_taskswitch:
+	case __HYPERVISOR_set_segment_base:
+		return MC_SITE_SWITCH;
+	case __HYPERVISOR_mmuext_op:
+		op = (const struct mmuext_op *)mc->args[0];
+		switch (op->cmd) {
+		case MMUEXT_PIN_L1_TABLE ... MMUEXT_UNPIN_TABLE:
+			return MC_SITE_PIN;
+		case MMUEXT_TLB_FLUSH_LOCAL ... MMUEXT_INVLPG_ALL:
+			return MC_SITE_TLB_FLUSH;
+		case MMUEXT_SET_LDT:
+			return MC_SITE_DESC;
+		}
+		break;
+	}
+
+	return MC_SITE_OTHER;
+}
+
+static void mc_add_stats(struct mc_buffer *b)
 {
+	struct multicall_entry *entries = mc_entries(b);
+	enum mc_sites site = MC_SITE_OTHER;
 	int i;
 
 	check_zero();
 
 	mc_stats.issued++;
-	mc_stats.hypercalls += mc->mcidx;
-	mc_stats.arg_total += mc->argidx;
+	mc_stats.hypercalls += b->mcidx;
+	mc_stats.arg_total += b->argidx;
 
-	mc_stats.histo[mc->mcidx]++;
-	for(i = 0; i < mc->mcidx; i++) {
-		unsigned op = mc->entries[i].op;
+	mc_stats.histo[min(b->mcidx, (unsigned)MC_BATCH)]++;
+	for(i = 0; i < b->mcidx; i++) {
+		unsigned op = entries[i].op;
 		if (op < NHYPERCALLS)
 			mc_stats.histo_hypercalls[op]++;
+
+		site = mc_site(&entries[i]);
+		mc_stats.site_calls[site]++;
+	}
+
+	/* The last call queued is the one that got the batch issued. */
+	if (b->mcidx) {
+		mc_stats.site_flushes[site]++;
+		mc_stats.site_batch_total[site] += b->mcidx;
 	}
 }
 
@@ -111,20 +249,109 @@ static void mc_stats_flush(enum flush_reasons idx)
 	mc_stats.flush[idx]++;
 }
 
+static void mc_stats_grown(void)
+{
+	mc_stats.grown++;
+}
+
 #else  /* !CONFIG_XEN_DEBUG_FS */
 
-static inline void mc_add_stats(const struct mc_buffer *mc)
+static inline void mc_add_stats(struct mc_buffer *b)
 {
 }
 
 static inline void mc_stats_flush(enum flush_reasons idx)
 {
 }
+
+static inline void mc_stats_grown(void)
+{
+}
 #endif	/* CONFIG_XEN_DEBUG_FS */
 
+static void mc_storage_free(struct mc_storage *s)
+{
+	kfree(s->entries);
+#if MC_DEBUG
+	kfree(s->debug);
+	kfree(s->caller);
+#endif
+	kfree(s->args);
+}
+
+static int mc_storage_alloc(struct mc_storage *s, unsigned batch,
+			    unsigned nargs)
+{
+	memset(s, 0, sizeof(*s));
+
+	s->entries = kmalloc(batch * sizeof(*s->entries), GFP_KERNEL);
+#if MC_DEBUG
+	s->debug = kmalloc(batch * sizeof(*s->debug), GFP_KERNEL);
+	s->caller = kmalloc(batch * sizeof(*s->caller), GFP_KERNEL);
+	if (!s->debug || !s->caller)
+		goto nomem;
+#endif
+	s->args = kmalloc(nargs, GFP_KERNEL);
+	if (!s->entries || !s->args)
+		goto nomem;
+
+	return 0;
+
+nomem:
+	mc_storage_free(s);
+	return -ENOMEM;
+}
+
+static void mc_grow_work(struct work_struct *work)
+{
+	struct mc_buffer *b = container_of(work, struct mc_buffer, grow);
+	unsigned batch = mc_batch(b) * 2;
+	unsigned nargs = mc_nargs(b) * 2;
+	struct mc_storage s;
+	unsigned long flags;
+
+	if (mc_storage_alloc(&s, batch, nargs))
+		return;
+
+	local_irq_save(flags);
+
+	/* Swap only on the buffer's own cpu; it may have gone offline. */
+	if (b == &__get_cpu_var(mc_buffer) && batch > mc_batch(b)) {
+		xen_mc_flush();
+
+		swap(b->s, s);
+		b->batch = batch;
+		b->nargs = nargs;
+		mc_stats_grown();
+	}
+
+	local_irq_restore(flags);
+
+	mc_storage_free(&s);
+}
+
+/* Called after a flush forced by a full buffer. */
+static void mc_note_full(struct mc_buffer *b)
+{
+	b->full++;
+
+	if (b->full * MC_GROW_RATIO < MC_GROW_WINDOW ||
+	    mc_batch(b) >= MC_BATCH_MAX || !keventd_up())
+		return;
+
+	if (!b->grow.func) {
+		b->cpu = smp_processor_id();
+		INIT_WORK(&b->grow, mc_grow_work);
+	}
+	schedule_work_on(b->cpu, &b->grow);
+
+	b->flushes = b->full = 0;
+}
+
 void xen_mc_flush(void)
 {
 	struct mc_buffer *b = &__get_cpu_var(mc_buffer);
+	struct multicall_entry *entries = mc_entries(b);
 	int ret = 0;
 	unsigned long flags;
 	int i;
@@ -136,31 +363,38 @@ void xen_mc_flush(void)
 	local_irq_save(flags);
 
 	mc_add_stats(b);
+	trace_xen_mc_flush(b->mcidx, b->argidx, b->cbidx);
+
+	if (++b->flushes == MC_GROW_WINDOW)
+		b->flushes = b->full = 0;
 
 	if (b->mcidx) {
 #if MC_DEBUG
-		memcpy(b->debug, b->entries,
+		memcpy(mc_debug(b), entries,
 		       b->mcidx * sizeof(struct multicall_entry));
 #endif
 
-		if (HYPERVISOR_multicall(b->entries, b->mcidx) != 0)
+		if (HYPERVISOR_multicall(entries, b->mcidx) != 0)
 			BUG();
 		for (i = 0; i < b->mcidx; i++)
-			if (b->entries[i].result < 0)
+			if (entries[i].result < 0)
 				ret++;
 
 #if MC_DEBUG
 		if (ret) {
+			struct multicall_entry *debug = mc_debug(b);
+			void **caller = mc_caller(b);
+
 			printk(KERN_ERR "%d multicall(s) failed: cpu %d\n",
 			       ret, smp_processor_id());
 			dump_stack();
 			for (i = 0; i < b->mcidx; i++) {
 				printk(KERN_DEBUG "  call %2d/%d: op=%lu arg=[%lx] result=%ld\t%pF\n",
 				       i+1, b->mcidx,
-				       b->debug[i].op,
-				       b->debug[i].args[0],
-				       b->entries[i].result,
-				       b->caller[i]);
+				       debug[i].op,
+				       debug[i].args[0],
+				       entries[i].result,
+				       caller[i]);
 			}
 		}
 #endif
@@ -189,24 +423,25 @@ struct multicall_space __xen_mc_entry(size_t args)
 	unsigned argidx = roundup(b->argidx, sizeof(u64));
 
 	BUG_ON(preemptible());
-	BUG_ON(b->argidx >= MC_ARGS);
+	BUG_ON(b->argidx >= mc_nargs(b));
 
-	if (b->mcidx == MC_BATCH ||
-	    (argidx + args) >= MC_ARGS) {
-		mc_stats_flush(b->mcidx == MC_BATCH ? FL_SLOTS : FL_ARGS);
+	if (b->mcidx == mc_batch(b) ||
+	    (argidx + args) >= mc_nargs(b)) {
+		mc_stats_flush(b->mcidx == mc_batch(b) ? FL_SLOTS : FL_ARGS);
 		xen_mc_flush();
+		mc_note_full(b);
 		argidx = roundup(b->argidx, sizeof(u64));
 	}
 
-	ret.mc = &b->entries[b->mcidx];
+	ret.mc = &mc_entries(b)[b->mcidx];
 #ifdef MC_DEBUG
-	b->caller[b->mcidx] = __builtin_return_address(0);
+	mc_caller(b)[b->mcidx] = __builtin_return_address(0);
 #endif
 	b->mcidx++;
-	ret.args = &b->args[argidx];
+	ret.args = &mc_args(b)[argidx];
 	b->argidx = argidx + args;
 
-	BUG_ON(b->argidx >= MC_ARGS);
+	BUG_ON(b->argidx >= mc_nargs(b));
 	return ret;
 }
 
@@ -216,22 +451,22 @@ struct multicall_space xen_mc_extend_args(unsigned long op, size_t size)
 	struct multicall_space ret = { NULL, NULL };
 
 	BUG_ON(preemptible());
-	BUG_ON(b->argidx >= MC_ARGS);
+	BUG_ON(b->argidx >= mc_nargs(b));
 
 	if (b->mcidx == 0)
 		return ret;
 
-	if (b->entries[b->mcidx - 1].op != op)
+	if (mc_entries(b)[b->mcidx - 1].op != op)
 		return ret;
 
-	if ((b->argidx + size) >= MC_ARGS)
+	if ((b->argidx + size) >= mc_nargs(b))
 		return ret;
 
-	ret.mc = &b->entries[b->mcidx - 1];
-	ret.args = &b->args[b->argidx];
+	ret.mc = &mc_entries(b)[b->mcidx - 1];
+	ret.args = &mc_args(b)[b->argidx];
 	b->argidx += size;
 
-	BUG_ON(b->argidx >= MC_ARGS);
+	BUG_ON(b->argidx >= mc_nargs(b));
 	return ret;
 }
 
@@ -270,12 +505,21 @@ static int __init xen_mc_debugfs(void)
 	debugfs_create_u32("arg_total", 0444, d_mc_debug, &mc_stats.arg_total);
 
 	xen_debugfs_create_u32_array("batch_histo", 0444, d_mc_debug,
-				     mc_stats.histo, MC_BATCH);
+				     mc_stats.histo, MC_BATCH + 1);
 	xen_debugfs_create_u32_array("hypercall_histo", 0444, d_mc_debug,
 				     mc_stats.histo_hypercalls, NHYPERCALLS);
 	xen_debugfs_create_u32_array("flush_reasons", 0444, d_mc_debug,
 				     mc_stats.flush, FL_N_REASONS);
 
+	xen_debugfs_create_u32_array("site_calls", 0444, d_mc_debug,
+				     mc_stats.site_calls, MC_N_SITES);
+	xen_debugfs_create_u32_array("site_flushes", 0444, d_mc_debug,
+				     mc_stats.site_flushes, MC_N_SITES);
+	xen_debugfs_create_u32_array("site_batch_total", 0444, d_mc_debug,
+				     mc_stats.site_batch_total, MC_N_SITES);
+
+	debugfs_create_u32("grown", 0444, d_mc_debug, &mc_stats.grown);
+
 	return 0;
 }
 fs_initcall(xen_mc_debugfs);
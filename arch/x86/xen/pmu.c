@@ -0,0 +1,313 @@
+/*
+ * PMU support for Xen PV guests.
+ *
+ * A PV kernel cannot take the PMU NMI from the local APIC itself.  Xen
+ * virtualizes the counters instead: the MSR accesses of the regular x86
+ * perf_event driver trap into Xen, and counter overflows are delivered
+ * as VIRQ_XENPMU together with the interrupted registers in a page
+ * shared with Xen.
+ *
+ * While such an overflow is being handled, the PMU registers in the
+ * shared page are live and Xen loads them back into the hardware on
+ * XENPMU_flush, so the handler touches them in memory rather than
+ * trapping on every MSR access.
+ */
+#include <linux/types.h>
+#include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/gfp.h>
+
+#include <asm/xen/hypercall.h>
+#include <xen/page.h>
+#include <xen/interface/xen.h>
+#include <xen/interface/vcpu.h>
+#include <xen/interface/xenpmu.h>
+
+#include <asm/perf_event.h>
+#include <asm/apicdef.h>
+
+#include "xen-ops.h"
+#include "pmu.h"
+
+/* The handler is running and the context in the shared page is live */
+#define XENPMU_IRQ_PROCESSING	1
+
+struct xenpmu {
+	/* Shared page between hypervisor and domain */
+	struct xen_pmu_data *xenpmu_data;
+
+	uint8_t flags;
+};
+static DEFINE_PER_CPU(struct xenpmu, xenpmu_shared);
+
+/* Address of a register bank in the vendor context */
+#define field_offset(ctxt, field)	\
+	((void *)((uintptr_t)(ctxt) + (uintptr_t)(ctxt)->field))
+
+/* Counters the x86 perf_event driver knows about */
+#define AMD_NUM_COUNTERS	4
+
+static __read_mostly int intel_num_arch_counters;
+static __read_mostly int intel_num_fixed_counters;
+
+static void xen_pmu_arch_init(void)
+{
+	union cpuid10_eax eax;
+	union cpuid10_edx edx;
+	unsigned int ebx, ecx;
+
+	if (boot_cpu_data.x86_vendor != X86_VENDOR_INTEL)
+		return;
+
+	cpuid(10, &eax.full, &ebx, &ecx, &edx.full);
+	intel_num_arch_counters = eax.split.num_events;
+	if (eax.split.version_id > 1)
+		intel_num_fixed_counters = edx.split.num_events_fixed;
+}
+
+static u64 *xen_intel_pmu_reg(struct xen_pmu_intel_ctxt *ctxt,
+			      unsigned int msr)
+{
+	struct xen_pmu_cntr_pair *arch_cntr_pair;
+	u64 *fix_counters;
+
+	switch (msr) {
+	case MSR_CORE_PERF_GLOBAL_OVF_CTRL:
+		return &ctxt->global_ovf_ctrl;
+	case MSR_CORE_PERF_GLOBAL_STATUS:
+		return &ctxt->global_status;
+	case MSR_CORE_PERF_GLOBAL_CTRL:
+		return &ctxt->global_ctrl;
+	case MSR_CORE_PERF_FIXED_CTR_CTRL:
+		return &ctxt->fixed_ctrl;
+	}
+
+	if (msr >= MSR_CORE_PERF_FIXED_CTR0 &&
+	    msr < MSR_CORE_PERF_FIXED_CTR0 + intel_num_fixed_counters) {
+		fix_counters = field_offset(ctxt, fixed_counters);
+		return &fix_counters[msr - MSR_CORE_PERF_FIXED_CTR0];
+	}
+
+	if (msr >= MSR_ARCH_PERFMON_PERFCTR0 &&
+	    msr < MSR_ARCH_PERFMON_PERFCTR0 + intel_num_arch_counters) {
+		arch_cntr_pair = field_offset(ctxt, arch_counters);
+		return &arch_cntr_pair[msr - MSR_ARCH_PERFMON_PERFCTR0].counter;
+	}
+
+	if (msr >= MSR_ARCH_PERFMON_EVENTSEL0 &&
+	    msr < MSR_ARCH_PERFMON_EVENTSEL0 + intel_num_arch_counters) {
+		arch_cntr_pair = field_offset(ctxt, arch_counters);
+		return &arch_cntr_pair[msr - MSR_ARCH_PERFMON_EVENTSEL0].control;
+	}
+
+	return NULL;
+}
+
+static u64 *xen_amd_pmu_reg(struct xen_pmu_amd_ctxt *ctxt, unsigned int msr)
+{
+	u64 *regs;
+
+	if (msr >= MSR_K7_EVNTSEL0 && msr < MSR_K7_EVNTSEL0 + AMD_NUM_COUNTERS) {
+		regs = field_offset(ctxt, ctrls);
+		return &regs[msr - MSR_K7_EVNTSEL0];
+	}
+
+	if (msr >= MSR_K7_PERFCTR0 && msr < MSR_K7_PERFCTR0 + AMD_NUM_COUNTERS) {
+		regs = field_offset(ctxt, counters);
+		return &regs[msr - MSR_K7_PERFCTR0];
+	}
+
+	return NULL;
+}
+
+/*
+ * Access @msr in the shared context if the PMU interrupt is being
+ * handled on this cpu.  Returns false if the MSR has to go to Xen.
+ */
+static bool xen_pmu_emulate(unsigned int msr, u64 *val, bool is_read)
+{
+	struct xen_pmu_data *xenpmu_data;
+	u64 *reg;
+
+	if (!(percpu_read(xenpmu_shared.flags) & XENPMU_IRQ_PROCESSING))
+		return false;
+
+	xenpmu_data = percpu_read(xenpmu_shared.xenpmu_data);
+
+	if (boot_cpu_data.x86_vendor == X86_VENDOR_AMD)
+		reg = xen_amd_pmu_reg(&xenpmu_data->pmu.c.amd, msr);
+	else
+		reg = xen_intel_pmu_reg(&xenpmu_data->pmu.c.intel, msr);
+	if (!reg)
+		return false;
+
+	if (is_read) {
+		*val = *reg;
+		return true;
+	}
+
+	*reg = *val;
+	if (boot_cpu_data.x86_vendor != X86_VENDOR_AMD &&
+	    msr == MSR_CORE_PERF_GLOBAL_OVF_CTRL)
+		xenpmu_data->pmu.c.intel.global_status &= ~*val;
+
+	return true;
+}
+
+bool xen_pmu_msr_read(unsigned int msr, u64 *val, int *err)
+{
+	if (!xen_pmu_emulate(msr, val, true))
+		return false;
+
+	*err = 0;
+	return true;
+}
+
+bool xen_pmu_msr_write(unsigned int msr, u32 low, u32 high, int *err)
+{
+	u64 val = ((u64)high << 32) | low;
+
+	if (!xen_pmu_emulate(msr, &val, false))
+		return false;
+
+	*err = 0;
+	return true;
+}
+
+/* Writes to the LVTPC are how perf_event (un)masks the PMU interrupt */
+void xen_pmu_apic_update(u32 val)
+{
+	struct xen_pmu_data *xenpmu_data;
+
+	xenpmu_data = percpu_read(xenpmu_shared.xenpmu_data);
+	if (!xenpmu_data)
+		return;
+
+	xenpmu_data->pmu.l.lapic_lvtpc = val;
+
+	/* XENPMU_flush at the end of the handler picks it up */
+	if (percpu_read(xenpmu_shared.flags) & XENPMU_IRQ_PROCESSING)
+		return;
+
+	HYPERVISOR_xenpmu_op(XENPMU_lvtpc_set, NULL);
+}
+
+/* Convert the interrupted registers from Xen's format to Linux' */
+static void xen_convert_regs(const struct xen_pmu_regs *xen_regs,
+			     struct pt_regs *regs, u64 pmu_flags)
+{
+	memset(regs, 0, sizeof(*regs));
+
+	regs->ip = xen_regs->ip;
+	regs->sp = xen_regs->sp;
+	regs->flags = xen_regs->flags;
+	regs->cs = xen_regs->cs;
+	regs->ss = xen_regs->ss;
+
+	/*
+	 * A PV kernel does not run in ring 0, so tell user_mode() what
+	 * Xen found rather than trusting the selector's RPL.
+	 */
+	if (pmu_flags & PMU_SAMPLE_PV) {
+		if (pmu_flags & PMU_SAMPLE_USER)
+			regs->cs |= 3;
+		else
+			regs->cs &= ~3;
+	} else {
+		if (xen_regs->cpl)
+			regs->cs |= 3;
+		else
+			regs->cs &= ~3;
+	}
+}
+
+irqreturn_t xen_pmu_irq_handler(int irq, void *dev_id)
+{
+	struct xen_pmu_data *xenpmu_data;
+	struct pt_regs regs;
+	irqreturn_t ret = IRQ_NONE;
+	int err;
+
+	xenpmu_data = percpu_read(xenpmu_shared.xenpmu_data);
+	if (!xenpmu_data)
+		return IRQ_NONE;
+
+	percpu_write(xenpmu_shared.flags, XENPMU_IRQ_PROCESSING);
+
+	xen_convert_regs(&xenpmu_data->pmu.r.regs, &regs,
+			 xenpmu_data->pmu.pmu_flags);
+	if (perf_event_handle_irq(&regs))
+		ret = IRQ_HANDLED;
+
+	/* Write the cached context back to the hardware and unmask */
+	err = HYPERVISOR_xenpmu_op(XENPMU_flush, NULL);
+	percpu_write(xenpmu_shared.flags, 0);
+	if (err) {
+		printk_once(KERN_WARNING "xen: PMU flush failed: %d\n", err);
+		return IRQ_NONE;
+	}
+
+	return ret;
+}
+
+bool xen_is_pmu(int cpu)
+{
+	return per_cpu(xenpmu_shared, cpu).xenpmu_data != NULL;
+}
+
+/* Share a page with Xen for @cpu's PMU state; called before it comes up */
+void xen_pmu_init(int cpu)
+{
+	struct xen_pmu_data *xenpmu_data;
+	struct xen_pmu_params xp;
+	int err;
+
+	BUILD_BUG_ON(sizeof(struct xen_pmu_data) > PAGE_SIZE);
+
+	if (!xen_pv_domain())
+		return;
+
+	xenpmu_data = (struct xen_pmu_data *)get_zeroed_page(GFP_KERNEL);
+	if (!xenpmu_data) {
+		printk(KERN_ERR "xen: no memory for the PMU of cpu %d\n", cpu);
+		return;
+	}
+
+	xp.val = virt_to_mfn(xenpmu_data);
+	xp.vcpu = cpu;
+	xp.version.maj = XENPMU_VER_MAJ;
+	xp.version.min = XENPMU_VER_MIN;
+	err = HYPERVISOR_xenpmu_op(XENPMU_init, &xp);
+	if (err) {
+		if (err == -EOPNOTSUPP || err == -ENOSYS)
+			printk_once(KERN_INFO "xen: PMU not offered by Xen\n");
+		else
+			printk(KERN_INFO "xen: could not initialize the PMU of "
+			       "cpu %d: %d\n", cpu, err);
+		free_page((unsigned long)xenpmu_data);
+		return;
+	}
+
+	per_cpu(xenpmu_shared, cpu).xenpmu_data = xenpmu_data;
+	per_cpu(xenpmu_shared, cpu).flags = 0;
+
+	if (cpu == 0)
+		xen_pmu_arch_init();
+}
+
+void xen_pmu_finish(int cpu)
+{
+	struct xen_pmu_params xp;
+
+	if (!xen_is_pmu(cpu))
+		return;
+
+	xp.vcpu = cpu;
+	xp.version.maj = XENPMU_VER_MAJ;
+	xp.version.min = XENPMU_VER_MIN;
+
+	(void)HYPERVISOR_xenpmu_op(XENPMU_finish, &xp);
+
+	free_page((unsigned long)per_cpu(xenpmu_shared, cpu).xenpmu_data);
+	per_cpu(xenpmu_shared, cpu).xenpmu_data = NULL;
+}
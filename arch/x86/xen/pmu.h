@@ -0,0 +1,37 @@
+#ifndef __XEN_PMU_H
+#define __XEN_PMU_H
+
+#include <linux/irqreturn.h>
+
+#ifdef CONFIG_XEN_PMU
+irqreturn_t xen_pmu_irq_handler(int irq, void *dev_id);
+void xen_pmu_init(int cpu);
+void xen_pmu_finish(int cpu);
+bool xen_is_pmu(int cpu);
+bool xen_pmu_msr_read(unsigned int msr, u64 *val, int *err);
+bool xen_pmu_msr_write(unsigned int msr, u32 low, u32 high, int *err);
+void xen_pmu_apic_update(u32 val);
+#else
+static inline irqreturn_t xen_pmu_irq_handler(int irq, void *dev_id)
+{
+	return IRQ_NONE;
+}
+static inline void xen_pmu_init(int cpu) {}
+static inline void xen_pmu_finish(int cpu) {}
+static inline bool xen_is_pmu(int cpu)
+{
+	return false;
+}
+static inline bool xen_pmu_msr_read(unsigned int msr, u64 *val, int *err)
+{
+	return false;
+}
+static inline bool xen_pmu_msr_write(unsigned int msr, u32 low, u32 high,
+				     int *err)
+{
+	return false;
+}
+static inline void xen_pmu_apic_update(u32 val) {}
+#endif
+
+#endif /* __XEN_PMU_H */
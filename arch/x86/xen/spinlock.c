@@ -24,6 +24,7 @@ static struct xen_spinlock_stats
 	u32 taken_slow_pickup;
 	u32 taken_slow_spurious;
 	u32 taken_slow_irqenable;
+	u32 spin_threshold_stolen;
 
 	u64 released;
 	u32 released_slow;
@@ -115,179 +116,248 @@ static inline void spin_time_accum_blocked(u64 start)
 }
 #endif  /* CONFIG_XEN_DEBUG_FS */
 
+/*
+ * Ticket lock: a cpu takes the lock when head reaches its ticket, and
+ * the unlocker advances head, so waiters get the lock in FIFO order.
+ * Tickets go up in steps of two, leaving bit 0 of tail free as a flag
+ * that someone has blocked in the slow path.  Only then does the unlock
+ * path look for the cpu holding the next ticket - just that one - and
+ * kick it.
+ */
+#define XEN_TICKET_INC		2
+#define XEN_TICKET_SLOWPATH	1
+#define XEN_TICKET_SHIFT	16
+
 struct xen_spinlock {
-	unsigned char lock;		/* 0 -> free; 1 -> locked */
-	unsigned short spinners;	/* count of waiting cpus */
+	union {
+		u32 head_tail;
+		struct {
+			u16 head;	/* ticket being served */
+			u16 tail;	/* next ticket to hand out */
+		};
+	};
 };
 
+static inline u16 xen_ticket_tail(u32 head_tail)
+{
+	return (head_tail >> XEN_TICKET_SHIFT) & ~XEN_TICKET_SLOWPATH;
+}
+
 static int xen_spin_is_locked(struct raw_spinlock *lock)
 {
 	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
+	u32 old = ACCESS_ONCE(xl->head_tail);
 
-	return xl->lock != 0;
+	return (u16)old != xen_ticket_tail(old);
 }
 
 static int xen_spin_is_contended(struct raw_spinlock *lock)
 {
 	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
+	u32 old = ACCESS_ONCE(xl->head_tail);
 
-	/* Not strictly true; this is only the count of contended
-	   lock-takers entering the slow path. */
-	return xl->spinners != 0;
+	return (u16)(xen_ticket_tail(old) - (u16)old) > XEN_TICKET_INC;
 }
 
 static int xen_spin_trylock(struct raw_spinlock *lock)
 {
 	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
-	u8 old = 1;
+	u32 old = ACCESS_ONCE(xl->head_tail);
 
-	asm("xchgb %b0,%1"
-	    : "+q" (old), "+m" (xl->lock) : : "memory");
+	if ((u16)old != xen_ticket_tail(old))
+		return 0;
 
-	return old == 0;
+	return cmpxchg(&xl->head_tail, old,
+		       old + (XEN_TICKET_INC << XEN_TICKET_SHIFT)) == old;
 }
 
-static DEFINE_PER_CPU(int, lock_kicker_irq) = -1;
-static DEFINE_PER_CPU(struct xen_spinlock *, lock_spinners);
-
 /*
- * Mark a cpu as interested in a lock.  Returns the CPU's previous
- * lock of interest, in case we got preempted by an interrupt.
+ * How long to spin before blocking is adapted per cpu.  Locks that
+ * come free quickly pull the threshold down towards twice the spin
+ * actually needed; running out of spin pushes it up, unless this vcpu
+ * lost time to the hypervisor meanwhile.  On an overcommitted host the
+ * holder is likely preempted too, so spinning on is wasted, and the
+ * threshold is halved instead.  TIMEOUT caps it (~0: never block).
  */
-static inline struct xen_spinlock *spinning_lock(struct xen_spinlock *xl)
-{
-	struct xen_spinlock *prev;
+#define SPIN_THRESHOLD_MIN	(1 << 4)
 
-	prev = __get_cpu_var(lock_spinners);
-	__get_cpu_var(lock_spinners) = xl;
+static DEFINE_PER_CPU(unsigned, spin_threshold);
 
-	wmb();			/* set lock of interest before count */
+static inline unsigned xen_spin_threshold(void)
+{
+	unsigned t = __get_cpu_var(spin_threshold);
 
-	asm(LOCK_PREFIX " incw %0"
-	    : "+m" (xl->spinners) : : "memory");
+	if (t == 0 || t > TIMEOUT)
+		t = TIMEOUT;
+	return t;
+}
 
-	return prev;
+static inline void xen_spin_threshold_set(unsigned t)
+{
+	if (t < SPIN_THRESHOLD_MIN)
+		t = SPIN_THRESHOLD_MIN;
+	if (t > TIMEOUT)
+		t = TIMEOUT;
+	__get_cpu_var(spin_threshold) = t;
 }
 
-/*
- * Mark a cpu as no longer interested in a lock.  Restores previous
- * lock of interest (NULL for none).
- */
-static inline void unspinning_lock(struct xen_spinlock *xl, struct xen_spinlock *prev)
+/* Got the lock after spinning for spins of a threshold of t. */
+static inline void xen_spin_threshold_hit(unsigned t, unsigned spins)
 {
-	asm(LOCK_PREFIX " decw %0"
-	    : "+m" (xl->spinners) : : "memory");
-	wmb();			/* decrement count before restoring lock */
-	__get_cpu_var(lock_spinners) = prev;
+	xen_spin_threshold_set(t - t / 8 + spins / 4);
 }
 
-static noinline int xen_spin_lock_slow(struct raw_spinlock *lock, bool irq_enable)
+/* Spun for all of t without getting the lock. */
+static void xen_spin_threshold_miss(unsigned t, u64 stolen_start)
 {
-	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
-	struct xen_spinlock *prev;
+	if (xen_vcpu_stolen_time() != stolen_start) {
+		ADD_STATS(spin_threshold_stolen, 1);
+		xen_spin_threshold_set(t / 2);
+	} else
+		xen_spin_threshold_set(t + t / 4);
+}
+
+static DEFINE_PER_CPU(int, lock_kicker_irq) = -1;
+
+/* The lock and ticket each blocked cpu is waiting for. */
+struct xen_lock_waiting {
+	struct xen_spinlock *lock;
+	u16 want;
+};
+
+static DEFINE_PER_CPU(struct xen_lock_waiting, lock_waiting);
+static cpumask_t waiting_cpus;
+
+static noinline void xen_spin_lock_slow(struct xen_spinlock *xl, u16 want,
+					bool irq_enable)
+{
+	struct xen_lock_waiting *w = &__get_cpu_var(lock_waiting);
+	int cpu = smp_processor_id();
 	int irq = __get_cpu_var(lock_kicker_irq);
-	int ret;
+	unsigned long flags;
 	u64 start;
 
 	/* If kicker interrupts not initialized yet, just spin */
 	if (irq == -1)
-		return 0;
+		return;
 
 	start = spin_time_start();
 
-	/* announce we're spinning */
-	prev = spinning_lock(xl);
+	/*
+	 * Make sure an interrupt handler can't upset things in a
+	 * partially setup state.
+	 */
+	flags = __raw_local_save_flags();
+	raw_local_irq_disable();
 
+	/*
+	 * An interrupt may have come in while an outer lock was blocking
+	 * here.  Overwriting its (lock, want) is fine: the interrupt has
+	 * already kicked the outer context out of xen_poll_irq(), so it
+	 * returns spuriously and sets up again.  The lock pointer is only
+	 * ever non-NULL with the right ticket in want.
+	 */
+	ADD_STATS(taken_slow_nested, w->lock != NULL);
+	w->lock = NULL;
+	smp_wmb();
+	w->want = want;
+	smp_wmb();
+	w->lock = xl;
+
+	/* This uses set_bit, which is atomic and therefore a barrier. */
+	cpumask_set_cpu(cpu, &waiting_cpus);
 	ADD_STATS(taken_slow, 1);
-	ADD_STATS(taken_slow_nested, prev != NULL);
-
-	do {
-		unsigned long flags;
-
-		/* clear pending */
-		xen_clear_irq_pending(irq);
-
-		/* check again make sure it didn't become free while
-		   we weren't looking  */
-		ret = xen_spin_trylock(lock);
-		if (ret) {
-			ADD_STATS(taken_slow_pickup, 1);
-
-			/*
-			 * If we interrupted another spinlock while it
-			 * was blocking, make sure it doesn't block
-			 * without rechecking the lock.
-			 */
-			if (prev != NULL)
-				xen_set_irq_pending(irq);
-			goto out;
-		}
 
-		flags = __raw_local_save_flags();
-		if (irq_enable) {
-			ADD_STATS(taken_slow_irqenable, 1);
-			raw_local_irq_enable();
-		}
+	/* clear pending */
+	xen_clear_irq_pending(irq);
+	barrier();
+
+	/*
+	 * Flag the slow path before the final check, so an unlocker
+	 * either sees the flag and kicks us or has already advanced
+	 * head to our ticket.
+	 */
+	asm(LOCK_PREFIX " orw %1, %0"
+	    : "+m" (xl->tail) : "i" (XEN_TICKET_SLOWPATH) : "memory");
+
+	if (ACCESS_ONCE(xl->head) == want) {
+		ADD_STATS(taken_slow_pickup, 1);
+		goto out;
+	}
 
-		/*
-		 * Block until irq becomes pending.  If we're
-		 * interrupted at this point (after the trylock but
-		 * before entering the block), then the nested lock
-		 * handler guarantees that the irq will be left
-		 * pending if there's any chance the lock became free;
-		 * xen_poll_irq() returns immediately if the irq is
-		 * pending.
-		 */
-		xen_poll_irq(irq);
+	if (irq_enable) {
+		ADD_STATS(taken_slow_irqenable, 1);
+		raw_local_irq_enable();
+	}
 
-		raw_local_irq_restore(flags);
+	/*
+	 * Block until irq becomes pending.  An interrupt taken here
+	 * leaves the irq pending if it was kicked, and xen_poll_irq()
+	 * then returns immediately.
+	 */
+	xen_poll_irq(irq);
+	ADD_STATS(taken_slow_spurious, !xen_test_irq_pending(irq));
 
-		ADD_STATS(taken_slow_spurious, !xen_test_irq_pending(irq));
-	} while (!xen_test_irq_pending(irq)); /* check for spurious wakeups */
+	raw_local_irq_disable();
 
 	kstat_incr_irqs_this_cpu(irq, irq_to_desc(irq));
 
 out:
-	unspinning_lock(xl, prev);
-	spin_time_accum_blocked(start);
+	cpumask_clear_cpu(cpu, &waiting_cpus);
+	w->lock = NULL;
+
+	raw_local_irq_restore(flags);
 
-	return ret;
+	spin_time_accum_blocked(start);
 }
 
 static inline void __xen_spin_lock(struct raw_spinlock *lock, bool irq_enable)
 {
 	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
-	unsigned timeout;
-	u8 oldval;
-	u64 start_spin;
+	u32 inc = XEN_TICKET_INC << XEN_TICKET_SHIFT;
+	unsigned threshold, timeout;
+	u16 want;
+	u64 start_spin, stolen;
 
 	ADD_STATS(taken, 1);
 
 	start_spin = spin_time_start();
 
-	do {
+	asm volatile(LOCK_PREFIX "xaddl %0, %1"
+		     : "+r" (inc), "+m" (xl->head_tail) : : "memory");
+	want = xen_ticket_tail(inc);
+
+	if (likely((u16)inc == want))
+		goto out;
+
+	for (;;) {
 		u64 start_spin_fast = spin_time_start();
 
-		timeout = TIMEOUT;
-
-		asm("1: xchgb %1,%0\n"
-		    "   testb %1,%1\n"
-		    "   jz 3f\n"
-		    "2: rep;nop\n"
-		    "   cmpb $0,%0\n"
-		    "   je 1b\n"
-		    "   dec %2\n"
-		    "   jnz 2b\n"
-		    "3:\n"
-		    : "+m" (xl->lock), "=q" (oldval), "+r" (timeout)
-		    : "1" (1)
-		    : "memory");
+		threshold = xen_spin_threshold();
+		stolen = xen_vcpu_stolen_time();
+
+		timeout = threshold;
+		do {
+			if (ACCESS_ONCE(xl->head) == want)
+				break;
+			cpu_relax();
+		} while (--timeout);
 
 		spin_time_accum_spinning(start_spin_fast);
 
-	} while (unlikely(oldval != 0 &&
-			  (TIMEOUT == ~0 || !xen_spin_lock_slow(lock, irq_enable))));
+		if (ACCESS_ONCE(xl->head) == want) {
+			xen_spin_threshold_hit(threshold, threshold - timeout);
+			break;
+		}
+
+		if (TIMEOUT != ~0) {
+			xen_spin_threshold_miss(threshold, stolen);
+			xen_spin_lock_slow(xl, want, irq_enable);
+		}
+	}
 
+out:
+	barrier();	/* make sure nothing creeps before the lock is taken */
 	spin_time_accum_total(start_spin);
 }
 
@@ -301,15 +371,17 @@ static void xen_spin_lock_flags(struct raw_spinlock *lock, unsigned long flags)
 	__xen_spin_lock(lock, !raw_irqs_disabled_flags(flags));
 }
 
-static noinline void xen_spin_unlock_slow(struct xen_spinlock *xl)
+/* Kick the one cpu waiting for ticket next, if it is blocked. */
+static noinline void xen_spin_unlock_slow(struct xen_spinlock *xl, u16 next)
 {
 	int cpu;
 
 	ADD_STATS(released_slow, 1);
 
-	for_each_online_cpu(cpu) {
-		/* XXX should mix up next cpu selection */
-		if (per_cpu(lock_spinners, cpu) == xl) {
+	for_each_cpu(cpu, &waiting_cpus) {
+		const struct xen_lock_waiting *w = &per_cpu(lock_waiting, cpu);
+
+		if (ACCESS_ONCE(w->lock) == xl && ACCESS_ONCE(w->want) == next) {
 			ADD_STATS(released_slow_kicked, 1);
 			xen_send_IPI_one(cpu, XEN_SPIN_UNLOCK_VECTOR);
 			break;
@@ -320,22 +392,30 @@ static noinline void xen_spin_unlock_slow(struct xen_spinlock *xl)
 static void xen_spin_unlock(struct raw_spinlock *lock)
 {
 	struct xen_spinlock *xl = (struct xen_spinlock *)lock;
+	u32 old, new;
 
 	ADD_STATS(released, 1);
 
-	smp_wmb();		/* make sure no writes get moved after unlock */
-	xl->lock = 0;		/* release lock */
+	old = ACCESS_ONCE(xl->head_tail);
+
+	/* Release the lock; a locked add is also the full barrier
+	   needed before looking at the slow path flag. */
+	asm volatile(LOCK_PREFIX "addw %1, %0"
+		     : "+m" (xl->head) : "i" (XEN_TICKET_INC) : "memory");
+
+	if (likely(!(ACCESS_ONCE(xl->tail) & XEN_TICKET_SLOWPATH)))
+		return;
 
 	/*
-	 * Make sure unlock happens before checking for waiting
-	 * spinners.  We need a strong barrier to enforce the
-	 * write-read ordering to different memory locations, as the
-	 * CPU makes no implied guarantees about their ordering.
+	 * If nobody is queued any more, clear the flag; cmpxchg in case
+	 * a new waiter turns up behind our back.  Otherwise wake the next
+	 * ticket holder.
 	 */
-	mb();
-
-	if (unlikely(xl->spinners))
-		xen_spin_unlock_slow(xl);
+	old = (old & ~0xffff) | (u16)(old + XEN_TICKET_INC);
+	new = old & ~(XEN_TICKET_SLOWPATH << XEN_TICKET_SHIFT);
+	if ((u16)new != xen_ticket_tail(new) ||
+	    cmpxchg(&xl->head_tail, old, new) != old)
+		xen_spin_unlock_slow(xl, (u16)old);
 }
 
 static irqreturn_t dummy_handler(int irq, void *dev_id)
@@ -372,6 +452,9 @@ void xen_uninit_lock_cpu(int cpu)
 
 void __init xen_init_spinlocks(void)
 {
+	BUILD_BUG_ON(sizeof(struct xen_spinlock) > sizeof(struct raw_spinlock));
+	BUILD_BUG_ON(NR_CPUS * XEN_TICKET_INC > 1 << XEN_TICKET_SHIFT);
+
 	pv_lock_ops.spin_is_locked = xen_spin_is_locked;
 	pv_lock_ops.spin_is_contended = xen_spin_is_contended;
 	pv_lock_ops.spin_lock = xen_spin_lock;
@@ -408,6 +491,8 @@ static int __init xen_spinlock_debugfs(void)
 			   &spinlock_stats.taken_slow_spurious);
 	debugfs_create_u32("taken_slow_irqenable", 0444, d_spin_debug,
 			   &spinlock_stats.taken_slow_irqenable);
+	debugfs_create_u32("spin_threshold_stolen", 0444, d_spin_debug,
+			   &spinlock_stats.spin_threshold_stolen);
 
 	debugfs_create_u64("released", 0444, d_spin_debug, &spinlock_stats.released);
 	debugfs_create_u32("released_slow", 0444, d_spin_debug,
@@ -12,9 +12,13 @@
 #include <linux/clocksource.h>
 #include <linux/clockchips.h>
 #include <linux/kernel_stat.h>
+#include <linux/sched.h>
 #include <linux/math64.h>
+#include <linux/debugfs.h>
 
 #include <asm/pvclock.h>
+#include <asm/fixmap.h>
+#include <asm/vgtod.h>
 #include <asm/xen/hypervisor.h>
 #include <asm/xen/hypercall.h>
 
@@ -24,6 +28,7 @@
 #include <xen/interface/vcpu.h>
 
 #include "xen-ops.h"
+#include "debugfs.h"
 
 #define XEN_SHIFT 22
 
@@ -101,6 +106,22 @@ bool xen_vcpu_stolen(int vcpu)
 	return per_cpu(runstate, vcpu).state == RUNSTATE_runnable;
 }
 
+/* true when a vcpu is waiting in the hypervisor for an event */
+static bool xen_vcpu_is_blocked(int vcpu)
+{
+	return per_cpu(runstate, vcpu).state == RUNSTATE_blocked;
+}
+
+/* total time this vcpu has wanted to run but been kept off a real cpu */
+u64 xen_vcpu_stolen_time(void)
+{
+	struct vcpu_runstate_info state;
+
+	get_runstate_snapshot(&state);
+
+	return state.time[RUNSTATE_runnable] + state.time[RUNSTATE_offline];
+}
+
 void xen_setup_runstate_info(int cpu)
 {
 	struct vcpu_register_runstate_memory_area area;
@@ -229,6 +250,124 @@ static struct clocksource xen_clocksource __read_mostly = {
 	.flags = CLOCK_SOURCE_IS_CONTINUOUS,
 };
 
+#ifdef CONFIG_X86_64
+/*
+ * Xen keeps a second copy of each vcpu's time info in pages that the
+ * PVCLOCK fixmap shows read-only to user space, so the vsyscall and
+ * vDSO gettimeofday/clock_gettime can do the pvclock arithmetic
+ * without a syscall.  User space has no last_value to keep the clock
+ * monotonic across vcpus, so this is only used when Xen says the TSC
+ * is stable.
+ */
+static struct pvclock_vsyscall_time_info *xen_vsyscall_time_info;
+
+#define XEN_PVTI_PER_PAGE (PAGE_SIZE / sizeof(struct pvclock_vsyscall_time_info))
+
+static __always_inline const struct pvclock_vcpu_time_info *
+xen_vsyscall_pvti(unsigned cpu)
+{
+	const struct pvclock_vsyscall_time_info *page;
+
+	page = (void *)__fix_to_virt(PVCLOCK_FIXMAP_BEGIN +
+				     cpu / XEN_PVTI_PER_PAGE);
+	return &page[cpu % XEN_PVTI_PER_PAGE].pvti;
+}
+
+static __always_inline unsigned xen_vsyscall_cpu(void)
+{
+	unsigned p;
+
+	/* the cpu number is in the limit of the per-cpu segment */
+	asm("lsl %1,%0" : "=r" (p) : "r" (__PER_CPU_SEG));
+	return p & 0xfff;
+}
+
+static cycle_t __vsyscall_fn vread_xen_pvclock(void)
+{
+	const struct pvclock_vcpu_time_info *src;
+	unsigned cpu, version;
+	cycle_t ret;
+
+	do {
+		cpu = xen_vsyscall_cpu();
+		src = xen_vsyscall_pvti(cpu);
+
+		version = src->version;
+		rmb();		/* fetch version before data */
+		rdtsc_barrier();
+		ret = src->system_time +
+			pvclock_scale_delta(__native_read_tsc() -
+					    src->tsc_timestamp,
+					    src->tsc_to_system_mul,
+					    src->tsc_shift);
+		rdtsc_barrier();
+		rmb();		/* test version after fetching data */
+	} while (unlikely((version & 1) || version != src->version ||
+			  cpu != xen_vsyscall_cpu()));
+
+	return ret >= __vsyscall_gtod_data.clock.cycle_last ?
+		ret : __vsyscall_gtod_data.clock.cycle_last;
+}
+
+static void xen_vsyscall_disable(const char *why)
+{
+	if (!xen_clocksource.vread)
+		return;
+
+	printk(KERN_INFO "xen: %s, no vsyscall clock\n", why);
+	xen_clocksource.vread = NULL;
+}
+
+static void xen_vsyscall_check_stable(void)
+{
+	struct pvclock_vcpu_time_info *src = &__get_cpu_var(xen_vcpu)->time;
+
+	if (!(src->flags & PVCLOCK_TSC_STABLE_BIT))
+		xen_vsyscall_disable("tsc not stable across vcpus");
+}
+
+static void xen_setup_vsyscall_time_info(int cpu)
+{
+	struct vcpu_register_time_memory_area t;
+
+	if (!xen_vsyscall_time_info)
+		return;
+
+	t.addr.v = (struct vcpu_time_info *)&xen_vsyscall_time_info[cpu].pvti;
+
+	if (HYPERVISOR_vcpu_op(VCPUOP_register_vcpu_time_memory_area,
+			       cpu, &t))
+		xen_vsyscall_disable("cannot register user time info");
+}
+
+static void __init xen_vsyscall_init(void)
+{
+	unsigned long size = nr_cpu_ids * sizeof(*xen_vsyscall_time_info);
+	int i;
+
+	BUILD_BUG_ON(sizeof(struct pvclock_vsyscall_time_info) != SMP_CACHE_BYTES);
+
+	if (!(__get_cpu_var(xen_vcpu)->time.flags & PVCLOCK_TSC_STABLE_BIT))
+		return;
+
+	xen_vsyscall_time_info = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+							  get_order(size));
+	if (!xen_vsyscall_time_info)
+		return;
+
+	for (i = 0; i < DIV_ROUND_UP(size, PAGE_SIZE); i++)
+		__set_fixmap(PVCLOCK_FIXMAP_BEGIN + i,
+			     __pa(xen_vsyscall_time_info) + i * PAGE_SIZE,
+			     PAGE_KERNEL_VSYSCALL);
+
+	xen_clocksource.vread = vread_xen_pvclock;
+}
+#else
+static inline void xen_vsyscall_check_stable(void) {}
+static inline void xen_setup_vsyscall_time_info(int cpu) {}
+static inline void xen_vsyscall_init(void) {}
+#endif	/* CONFIG_X86_64 */
+
 /*
    Xen clockevent implementation
 
@@ -317,11 +456,62 @@ static const struct clock_event_device xen_timerop_clockevent = {
 
 
 
+/*
+ * An idle vcpu's timer may wait for the next multiple of
+ * xen_timer_slack ns of Xen system time.  That timebase is common to
+ * every vcpu on the host, so idle vcpus of this and other guests wake
+ * up together rather than one after another, and a deadline that lands
+ * on the slot already programmed costs no hypercall.  Timers set by a
+ * busy vcpu are left exact.
+ */
+static unsigned xen_timer_slack = TIMER_SLOP;
+
+static int __init parse_xen_timer_slack(char *arg)
+{
+	xen_timer_slack = simple_strtoul(arg, NULL, 0);
+	return 1;
+}
+__setup("xen_timer_slack=", parse_xen_timer_slack);
+
+/* singleshot deadline Xen has for each vcpu, 0 if none */
+static DEFINE_PER_CPU(u64, xen_timer_deadline);
+
+#ifdef CONFIG_XEN_DEBUG_FS
+static struct xen_timer_stats
+{
+	u32 set_next_event;
+	u32 coalesced;
+	u32 reprogram_skipped;
+} timer_stats;
+
+#define ADD_TIMER_STATS(elem, val)	do { timer_stats.elem += (val); } while (0)
+#else
+#define ADD_TIMER_STATS(elem, val)	do { (void)(val); } while (0)
+#endif
+
+static u64 xen_timer_coalesce(int cpu, u64 deadline)
+{
+	unsigned slack = ACCESS_ONCE(xen_timer_slack);
+	u32 rem;
+
+	if (slack <= 1 || !idle_cpu(cpu))
+		return deadline;
+
+	div_u64_rem(deadline, slack, &rem);
+	if (rem == 0)
+		return deadline;
+
+	ADD_TIMER_STATS(coalesced, 1);
+	return deadline + slack - rem;
+}
+
 static void xen_vcpuop_set_mode(enum clock_event_mode mode,
 				struct clock_event_device *evt)
 {
 	int cpu = smp_processor_id();
 
+	per_cpu(xen_timer_deadline, cpu) = 0;
+
 	switch (mode) {
 	case CLOCK_EVT_MODE_PERIODIC:
 		WARN_ON(1);	/* unsupported */
@@ -352,13 +542,23 @@ static int xen_vcpuop_set_next_event(unsigned long delta,
 
 	WARN_ON(evt->mode != CLOCK_EVT_MODE_ONESHOT);
 
-	single.timeout_abs_ns = get_abs_timeout(delta);
+	ADD_TIMER_STATS(set_next_event, 1);
+
+	single.timeout_abs_ns = xen_timer_coalesce(cpu, get_abs_timeout(delta));
 	single.flags = VCPU_SSHOTTMR_future;
 
+	/* Already armed for that slot; the event will come. */
+	if (single.timeout_abs_ns == per_cpu(xen_timer_deadline, cpu)) {
+		ADD_TIMER_STATS(reprogram_skipped, 1);
+		return 0;
+	}
+
 	ret = HYPERVISOR_vcpu_op(VCPUOP_set_singleshot_timer, cpu, &single);
 
 	BUG_ON(ret != 0 && ret != -ETIME);
 
+	per_cpu(xen_timer_deadline, cpu) = ret ? 0 : single.timeout_abs_ns;
+
 	return ret;
 }
 
@@ -386,6 +586,8 @@ static irqreturn_t xen_timer_interrupt(int irq, void *dev_id)
 	struct clock_event_device *evt = &__get_cpu_var(xen_clock_events);
 	irqreturn_t ret;
 
+	__get_cpu_var(xen_timer_deadline) = 0;
+
 	ret = IRQ_NONE;
 	if (evt->event_handler) {
 		evt->event_handler(evt);
@@ -422,6 +624,7 @@ void xen_setup_timer(int cpu)
 	evt->irq = irq;
 
 	xen_setup_runstate_info(cpu);
+	xen_setup_vsyscall_time_info(cpu);
 }
 
 void xen_teardown_timer(int cpu)
@@ -445,10 +648,16 @@ void xen_timer_resume(void)
 
 	pvclock_resume();
 
+	/* the time info copies are lost with the rest of the vcpu state */
+	for_each_online_cpu(cpu)
+		xen_setup_vsyscall_time_info(cpu);
+	xen_vsyscall_check_stable();
+
 	if (xen_clockevent != &xen_vcpuop_clockevent)
 		return;
 
 	for_each_online_cpu(cpu) {
+		per_cpu(xen_timer_deadline, cpu) = 0;
 		if (HYPERVISOR_vcpu_op(VCPUOP_stop_periodic_timer, cpu, NULL))
 			BUG();
 	}
@@ -458,6 +667,7 @@ static __init void xen_time_init(void)
 {
 	int cpu = smp_processor_id();
 
+	xen_vsyscall_init();
 	clocksource_register(&xen_clocksource);
 
 	if (HYPERVISOR_vcpu_op(VCPUOP_stop_periodic_timer, cpu, NULL) == 0) {
@@ -479,13 +689,22 @@ static __init void xen_time_init(void)
 	xen_setup_cpu_clockevents();
 }
 
+/* only ever asked about the local cpu, see pv_time_ops */
+static unsigned long long xen_steal_clock(int cpu)
+{
+	return xen_vcpu_stolen_time();
+}
+
 static const struct pv_time_ops xen_time_ops __initdata = {
        .sched_clock = xen_clocksource_read,
+       .steal_clock = xen_steal_clock,
+       .vcpu_is_blocked = xen_vcpu_is_blocked,
 };
 
 __init void xen_init_time_ops(void)
 {
 	pv_time_ops = xen_time_ops;
+	paravirt_steal_enabled = true;
 
 	x86_init.timers.timer_init = xen_time_init;
 	x86_init.timers.setup_percpu_clockev = x86_init_noop;
@@ -519,6 +738,7 @@ __init void xen_hvm_init_time_ops(void)
 	}
 
 	pv_time_ops = xen_time_ops;
+	paravirt_steal_enabled = true;
 	x86_init.timers.setup_percpu_clockev = xen_time_init;
 	x86_cpuinit.setup_percpu_clockev = xen_hvm_setup_cpu_clockevents;
 
@@ -527,3 +747,31 @@ __init void xen_hvm_init_time_ops(void)
 	x86_platform.set_wallclock = xen_set_wallclock;
 }
 #endif
+
+#ifdef CONFIG_XEN_DEBUG_FS
+
+static struct dentry *d_timer_debug;
+
+static int __init xen_timer_debugfs(void)
+{
+	struct dentry *d_xen = xen_init_debugfs();
+
+	if (d_xen == NULL)
+		return -ENOMEM;
+
+	d_timer_debug = debugfs_create_dir("timer", d_xen);
+
+	debugfs_create_u32("slack_ns", 0644, d_timer_debug, &xen_timer_slack);
+
+	debugfs_create_u32("set_next_event", 0444, d_timer_debug,
+			   &timer_stats.set_next_event);
+	debugfs_create_u32("coalesced", 0444, d_timer_debug,
+			   &timer_stats.coalesced);
+	debugfs_create_u32("reprogram_skipped", 0444, d_timer_debug,
+			   &timer_stats.reprogram_skipped);
+
+	return 0;
+}
+fs_initcall(xen_timer_debugfs);
+
+#endif	/* CONFIG_XEN_DEBUG_FS */
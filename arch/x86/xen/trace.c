@@ -0,0 +1,13 @@
+/*
+ * Xen hypercall trace points
+ */
+#include <linux/module.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/xen.h>
+
+/* grant table and event channel users are often modules */
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_hypercall_entry);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_hypercall_exit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_mmu_update);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_evtchn_send);
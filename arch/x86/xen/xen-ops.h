@@ -60,6 +60,7 @@ void __init xen_hvm_init_time_ops(void);
 irqreturn_t xen_debug_interrupt(int irq, void *dev_id);
 
 bool xen_vcpu_stolen(int vcpu);
+u64 xen_vcpu_stolen_time(void);
 
 void xen_setup_vcpu_info_placement(void);
 
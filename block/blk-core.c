@@ -436,6 +436,32 @@ void blk_run_queue(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_run_queue);
 
+/**
+ * blk_poll - reap completed requests of a polling queue
+ * @q:	The queue to poll
+ *
+ * Description:
+ *    Lets a task that is waiting on its own I/O spin on the device
+ *    rather than sleep until the interrupt.  The driver's completions go
+ *    through the block softirq as usual; with bottom halves disabled
+ *    around ->poll_fn that runs right here, on local_bh_enable(), rather
+ *    than in ksoftirqd.  Returns the number of requests completed.
+ */
+int blk_poll(struct request_queue *q)
+{
+	int found;
+
+	if (!q->poll_fn || !blk_queue_poll(q))
+		return 0;
+
+	local_bh_disable();
+	found = q->poll_fn(q);
+	local_bh_enable();
+
+	return found;
+}
+EXPORT_SYMBOL(blk_poll);
+
 void blk_put_queue(struct request_queue *q)
 {
 	kobject_put(&q->kobj);
@@ -1155,15 +1181,98 @@ static inline bool queue_should_plug(struct request_queue *q)
 	return !(blk_queue_nonrot(q) && blk_queue_tagged(q));
 }
 
+static bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+				   struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+
+	if (!ll_back_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff)
+		blk_rq_set_mixed_merge(req);
+
+	req->biotail->bi_next = bio;
+	req->biotail = bio;
+	req->__data_len += bio->bi_size;
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+static bool bio_attempt_front_merge(struct request_queue *q,
+				    struct request *req, struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+
+	if (!ll_front_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_frontmerge(q, bio);
+
+	if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff) {
+		blk_rq_set_mixed_merge(req);
+		req->cmd_flags &= ~REQ_FAILFAST_MASK;
+		req->cmd_flags |= ff;
+	}
+
+	bio->bi_next = req->bio;
+	req->bio = bio;
+
+	/*
+	 * may not be valid. if the low level driver said
+	 * it didn't need a bounce buffer then it better
+	 * not touch req->buffer either...
+	 */
+	req->buffer = bio_data(bio);
+	req->__sector = bio->bi_sector;
+	req->__data_len += bio->bi_size;
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+/*
+ * Try to merge @bio into a request on the task's plug list.  Those are
+ * not on the queue yet, so no queue_lock is needed.
+ */
+static bool attempt_plug_merge(struct task_struct *tsk,
+			       struct request_queue *q, struct bio *bio)
+{
+	struct blk_plug *plug = tsk->plug;
+	struct request *rq;
+
+	if (!plug)
+		return false;
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+		if (rq->q != q || !elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) == bio->bi_sector) {
+			if (bio_attempt_back_merge(q, rq, bio))
+				return true;
+		} else if (blk_rq_pos(rq) - bio_sectors(bio) == bio->bi_sector) {
+			if (bio_attempt_front_merge(q, rq, bio))
+				return true;
+		}
+	}
+	return false;
+}
+
 static int __make_request(struct request_queue *q, struct bio *bio)
 {
 	struct request *req;
 	int el_ret;
-	unsigned int bytes = bio->bi_size;
-	const unsigned short prio = bio_prio(bio);
 	const bool sync = bio_rw_flagged(bio, BIO_RW_SYNCIO);
 	const bool unplug = bio_rw_flagged(bio, BIO_RW_UNPLUG);
-	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	struct blk_plug *plug;
 	int rw_flags;
 
 	if (bio_rw_flagged(bio, BIO_RW_BARRIER) &&
@@ -1178,9 +1287,17 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		spin_lock_irq(q->queue_lock);
+		goto get_rq;
+	}
+
+	if (attempt_plug_merge(current, q, bio))
+		return 0;
+
 	spin_lock_irq(q->queue_lock);
 
-	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER)) || elv_queue_empty(q))
+	if (elv_queue_empty(q))
 		goto get_rq;
 
 	el_ret = elv_merge(q, &req, bio);
@@ -1188,21 +1305,9 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_BACK_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_back_merge_fn(q, req, bio))
+		if (!bio_attempt_back_merge(q, req, bio))
 			break;
 
-		trace_block_bio_backmerge(q, bio);
-
-		if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff)
-			blk_rq_set_mixed_merge(req);
-
-		req->biotail->bi_next = bio;
-		req->biotail = bio;
-		req->__data_len += bytes;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_back_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1210,32 +1315,9 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_FRONT_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_front_merge_fn(q, req, bio))
+		if (!bio_attempt_front_merge(q, req, bio))
 			break;
 
-		trace_block_bio_frontmerge(q, bio);
-
-		if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff) {
-			blk_rq_set_mixed_merge(req);
-			req->cmd_flags &= ~REQ_FAILFAST_MASK;
-			req->cmd_flags |= ff;
-		}
-
-		bio->bi_next = req->bio;
-		req->bio = bio;
-
-		/*
-		 * may not be valid. if the low level driver said
-		 * it didn't need a bounce buffer then it better
-		 * not touch req->buffer either...
-		 */
-		req->buffer = bio_data(bio);
-		req->__sector = bio->bi_sector;
-		req->__data_len += bytes;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_front_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1269,6 +1351,19 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
+	/*
+	 * A plugging task queues its requests itself and hands them over
+	 * in one go from blk_flush_plug_list().
+	 */
+	plug = current->plug;
+	if (plug && !unplug) {
+		if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+		    bio_flagged(bio, BIO_CPU_AFFINE))
+			req->cpu = blk_cpu_to_group(raw_smp_processor_id());
+		list_add_tail(&req->queuelist, &plug->list);
+		return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE))
@@ -1481,6 +1576,10 @@ static inline void __generic_make_request(struct bio *bio)
 			goto end_io;
 		}
 
+		/* Over its cgroup's limits: submitted again later. */
+		if (blk_throtl_bio(bio))
+			return;
+
 		trace_block_bio_queue(q, bio);
 
 		ret = q->make_request_fn(q, bio);
@@ -2490,6 +2589,73 @@ int kblockd_schedule_work(struct request_queue *q, struct work_struct *work)
 }
 EXPORT_SYMBOL(kblockd_schedule_work);
 
+/**
+ * blk_start_plug - hold back the requests the current task submits
+ * @plug:	the &struct blk_plug, usually on the caller's stack
+ *
+ * Description:
+ *     Until blk_finish_plug(), new requests of request_fn queues go on
+ *     @plug instead of their queue, where later bios can be merged into
+ *     them without the queue_lock.  They are handed over to their queues
+ *     by blk_finish_plug(), or earlier if the task goes to sleep.
+ *
+ *     Plugs do not nest: an inner plug leaves the outer one in charge.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	plug->magic = PLUG_MAGIC;
+	INIT_LIST_HEAD(&plug->list);
+
+	if (!tsk->plug)
+		tsk->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/*
+ * Insert the plugged requests of one queue at a time, each under a
+ * single queue_lock hold, and run the queue right away rather than
+ * leaving it to the unplug timer.
+ */
+void blk_flush_plug_list(struct blk_plug *plug)
+{
+	struct request_queue *q;
+	struct request *rq, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	BUG_ON(plug->magic != PLUG_MAGIC);
+
+	list_splice_init(&plug->list, &list);
+
+	local_irq_save(flags);
+	while (!list_empty(&list)) {
+		q = list_entry_rq(list.next)->q;
+
+		spin_lock(q->queue_lock);
+		list_for_each_entry_safe(rq, tmp, &list, queuelist) {
+			if (rq->q != q)
+				continue;
+			list_del_init(&rq->queuelist);
+			add_request(q, rq);
+		}
+		__blk_run_queue(q);
+		spin_unlock(q->queue_lock);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug);
+
+	if (plug == current->plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
 int __init blk_dev_init(void)
 {
 	BUILD_BUG_ON(__REQ_NR_BITS > 8 *
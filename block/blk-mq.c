@@ -0,0 +1,638 @@
+/*
+ * Multi-queue block layer
+ *
+ * Bios become requests on per-cpu software queues, without the
+ * queue_lock and without an io scheduler.  Each cpu maps onto one of the
+ * driver's hardware queues; running a hardware queue pulls the requests
+ * of its cpus onto a dispatch list and hands them to ->queue_rq.
+ * Requests are preallocated per hardware queue and identified by tag,
+ * so submission never touches a mempool or a shared request list.
+ *
+ * Barriers drain the whole queue, as QUEUE_ORDERED_DRAIN* does, and the
+ * cache flushes around the barrier write go out as requests of their
+ * own, built by the driver's prepare_flush_fn.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/completion.h>
+#include <linux/ioprio.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		nr_queued;	/* since the last run */
+} ____cacheline_aligned_in_smp;
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct request *rq;
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(hctx->tags, hctx->queue_depth);
+		if (tag >= hctx->queue_depth)
+			return NULL;
+	} while (test_and_set_bit(tag, hctx->tags));
+
+	rq = &hctx->rqs[tag];
+	blk_rq_init(hctx->queue, rq);
+	rq->tag = tag;
+	rq->mq_hctx = hctx;
+	if (blk_queue_io_stat(hctx->queue))
+		rq->cmd_flags |= REQ_IO_STAT;
+	return rq;
+}
+
+/*
+ * Get a free request of @hctx, sleeping until one is completed if
+ * they are all in use.
+ */
+static struct request *blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx)
+{
+	struct request *rq;
+	DEFINE_WAIT(wait);
+
+	rq = __blk_mq_alloc_request(hctx);
+	while (!rq) {
+		prepare_to_wait_exclusive(&hctx->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		rq = __blk_mq_alloc_request(hctx);
+		if (rq)
+			break;
+		blk_mq_run_hw_queue(hctx, false);
+		io_schedule();
+	}
+	finish_wait(&hctx->wait, &wait);
+	return rq;
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_hctx;
+
+	clear_bit(rq->tag, hctx->tags);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->wait))
+		wake_up(&hctx->wait);
+}
+
+/*
+ * Only the per-cpu disk statistics are kept up to date: in_flight and
+ * the io_ticks derived from it would need the queue_lock.
+ */
+static void blk_mq_account_done(struct request *rq)
+{
+	if (blk_do_io_stat(rq)) {
+		const int rw = rq_data_dir(rq);
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+		part_stat_inc(cpu, part, ios[rw]);
+		part_stat_add(cpu, part, ticks[rw], jiffies - rq->start_time);
+		part_stat_unlock();
+	}
+}
+
+/**
+ * blk_mq_end_request - complete a request of a multi-queue device
+ * @rq:		the request
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *     Ends all bios of @rq and frees its tag.  May be called from any
+ *     context; no block layer lock is taken.
+ */
+void blk_mq_end_request(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_mq_account_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_request);
+
+static void blk_mq_insert_dispatch(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_hctx;
+	unsigned long flags;
+
+	rq->cmd_flags &= ~REQ_STARTED;
+
+	spin_lock_irqsave(&hctx->lock, flags);
+	list_add_tail(&rq->queuelist, &hctx->dispatch);
+	spin_unlock_irqrestore(&hctx->lock, flags);
+}
+
+/**
+ * blk_mq_requeue_request - give a started request back to its queue
+ * @rq:		the request
+ *
+ * Description:
+ *     @rq goes back on its hardware queue, ahead of anything still on the
+ *     software queues, and is passed to ->queue_rq again the next time the
+ *     queue runs.  Must not be called with a lock held that ->queue_rq
+ *     takes.
+ */
+void blk_mq_requeue_request(struct request *rq)
+{
+	blk_mq_insert_dispatch(rq);
+}
+EXPORT_SYMBOL(blk_mq_requeue_request);
+
+/*
+ * Move the requests of all cpus mapped onto @hctx to its dispatch list.
+ * Called with hctx->lock held.
+ */
+static void blk_mq_flush_ctxs(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	unsigned int cpu;
+
+	for (cpu = hctx->queue_num; cpu < nr_cpu_ids; cpu += q->nr_hw_queues) {
+		struct blk_mq_ctx *ctx;
+
+		if (!cpu_possible(cpu))
+			continue;
+
+		/*
+		 * The submitter runs the queue after adding to its list, so
+		 * a request we miss here is not left behind.
+		 */
+		ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		if (list_empty(&ctx->rq_list))
+			continue;
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &hctx->dispatch);
+		ctx->nr_queued = 0;
+		spin_unlock(&ctx->lock);
+	}
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	unsigned long flags;
+	int queued = 0;
+
+	spin_lock_irqsave(&hctx->lock, flags);
+	if (test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		goto out;
+
+	blk_mq_flush_ctxs(hctx);
+
+	while (!list_empty(&hctx->dispatch)) {
+		rq = list_first_entry(&hctx->dispatch, struct request,
+				      queuelist);
+		list_del_init(&rq->queuelist);
+
+		rq->cmd_flags |= REQ_STARTED;
+		trace_block_rq_issue(q, rq);
+
+		switch (q->mq_ops->queue_rq(hctx, rq)) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			rq->cmd_flags &= ~REQ_STARTED;
+			list_add(&rq->queuelist, &hctx->dispatch);
+			break;
+		default:
+			blk_mq_end_request(rq, -EIO);
+			continue;
+		}
+		break;
+	}
+
+	if (queued && q->mq_ops->commit_rqs)
+		q->mq_ops->commit_rqs(hctx);
+out:
+	spin_unlock_irqrestore(&hctx->lock, flags);
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx =
+		container_of(work, struct blk_mq_hw_ctx, run_work);
+
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the pending requests of a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	run it from kblockd instead of in the caller's context
+ *
+ * Description:
+ *     Does nothing while the queue is stopped.  A synchronous run must
+ *     not be done with a lock held that ->queue_rq takes.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_run_hw_queue(q->queue_hw_ctx[i], async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *     Typically called from ->queue_rq before returning
+ *     %BLK_MQ_RQ_QUEUE_BUSY.  The driver restarts the queue with
+ *     blk_mq_start_stopped_hw_queues() once it has room again.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_stop_hw_queue(q->queue_hw_ctx[i]);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[i];
+
+		if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/*
+ * Wait until every request of @q has been completed.
+ */
+static void blk_mq_drain_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[i];
+
+		blk_mq_run_hw_queue(hctx, false);
+		wait_event(hctx->wait,
+			   find_first_bit(hctx->tags, hctx->queue_depth) >=
+			   hctx->queue_depth);
+	}
+}
+
+static void blk_mq_sync_end_io(struct request *rq, int error)
+{
+	struct completion *waiting = rq->end_io_data;
+
+	rq->errors = error;
+	complete(waiting);
+}
+
+/*
+ * Issue @rq and wait for it to complete.  Frees @rq.
+ */
+static int blk_mq_execute_rq(struct request *rq)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	int err;
+
+	rq->end_io = blk_mq_sync_end_io;
+	rq->end_io_data = &wait;
+	blk_mq_insert_dispatch(rq);
+	blk_mq_run_hw_queue(rq->mq_hctx, false);
+	wait_for_completion(&wait);
+
+	err = rq->errors;
+	blk_mq_free_request(rq);
+	return err;
+}
+
+static int blk_mq_flush(struct request_queue *q, struct blk_mq_hw_ctx *hctx,
+			struct gendisk *disk)
+{
+	struct request *rq = blk_mq_alloc_request(hctx);
+
+	rq->cmd_flags |= REQ_HARDBARRIER;
+	rq->rq_disk = disk;
+	q->prepare_flush_fn(q, rq);
+
+	return blk_mq_execute_rq(rq);
+}
+
+/*
+ * Nothing is dispatched past a barrier, nor the barrier past anything
+ * submitted before it: submitters hold mq_barrier_sem for read until
+ * their request is queued, and the barrier holds it for write while it
+ * drains the queue and goes through its flush sequence synchronously.
+ */
+static void blk_mq_barrier(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[0];
+	struct gendisk *disk = bio->bi_bdev->bd_disk;
+	bio_end_io_t *end_io;
+	struct request *rq;
+	unsigned ordered;
+	int err = 0;
+
+	down_write(&q->mq_barrier_sem);
+	blk_mq_drain_queue(q);
+
+	ordered = q->next_ordered;
+	if (ordered == QUEUE_ORDERED_NONE) {
+		err = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if (ordered & QUEUE_ORDERED_DO_PREFLUSH) {
+		err = blk_mq_flush(q, hctx, disk);
+		if (err)
+			goto out;
+	}
+
+	/* An empty barrier is done once the cache is flushed. */
+	if (!bio->bi_size)
+		goto out;
+
+	rq = blk_mq_alloc_request(hctx);
+	init_request_from_bio(rq, bio);
+	if (!(ordered & QUEUE_ORDERED_BY_TAG))
+		rq->cmd_flags &= ~REQ_HARDBARRIER;
+	if (ordered & QUEUE_ORDERED_DO_FUA)
+		rq->cmd_flags |= REQ_FUA;
+
+	/* The bio is ended here, after the post-flush. */
+	end_io = bio->bi_end_io;
+	bio->bi_end_io = NULL;
+	err = blk_mq_execute_rq(rq);
+	bio->bi_end_io = end_io;
+
+	if (!err && (ordered & QUEUE_ORDERED_DO_POSTFLUSH))
+		err = blk_mq_flush(q, hctx, disk);
+out:
+	up_write(&q->mq_barrier_sem);
+	bio_endio(bio, err);
+}
+
+/*
+ * Try to append @bio to the last request queued on @ctx.  Only back
+ * merges are tried: they are what sequential submission produces.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	struct request *rq;
+	bool merged = false;
+
+	spin_lock_irq(&ctx->lock);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry(ctx->rq_list.prev, struct request, queuelist);
+	if (!rq_mergeable(rq) || rq->special ||
+	    bio_rw_flagged(bio, BIO_RW_DISCARD) !=
+	    bio_rw_flagged(rq->bio, BIO_RW_DISCARD) ||
+	    bio_data_dir(bio) != rq_data_dir(rq) ||
+	    rq->rq_disk != bio->bi_bdev->bd_disk ||
+	    bio_integrity(bio) != blk_integrity_rq(rq) ||
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector ||
+	    !ll_back_merge_fn(q, rq, bio))
+		goto out;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) != ff)
+		blk_rq_set_mixed_merge(rq);
+
+	rq->biotail->bi_next = bio;
+	rq->biotail = bio;
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+	if (blk_do_io_stat(rq)) {
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+		part_stat_inc(cpu, part, merges[rq_data_dir(rq)]);
+		part_stat_unlock();
+	}
+	merged = true;
+out:
+	spin_unlock_irq(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool unplug = bio_rw_flagged(bio, BIO_RW_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	bool run = unplug;
+	int cpu;
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		blk_mq_barrier(q, bio);
+		return 0;
+	}
+
+	down_read(&q->mq_barrier_sem);
+
+	cpu = get_cpu();
+	put_cpu();
+	ctx = per_cpu_ptr(q->queue_ctx, cpu);
+	hctx = blk_mq_map_queue(q, cpu);
+
+	if (blk_mq_attempt_merge(q, ctx, bio))
+		goto out;
+
+	/* May sleep; the request still goes onto the list of @cpu. */
+	rq = blk_mq_alloc_request(hctx);
+	init_request_from_bio(rq, bio);
+	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    bio_flagged(bio, BIO_CPU_AFFINE))
+		rq->cpu = blk_cpu_to_group(cpu);
+
+	trace_block_rq_insert(q, rq);
+
+	spin_lock_irq(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	if (++ctx->nr_queued >= q->unplug_thresh)
+		run = true;
+	spin_unlock_irq(&ctx->lock);
+out:
+	up_read(&q->mq_barrier_sem);
+
+	/*
+	 * Unless asked to unplug, give a few more bios the chance to be
+	 * merged before the unplug timer runs the queues.
+	 */
+	if (run)
+		blk_mq_run_hw_queue(hctx, false);
+	else if (!timer_pending(&q->unplug_timer))
+		mod_timer(&q->unplug_timer, jiffies + q->unplug_delay);
+	return 0;
+}
+
+static void blk_mq_unplug(struct request_queue *q)
+{
+	del_timer(&q->unplug_timer);
+	blk_mq_run_queues(q, false);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int queue_num,
+					       void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+	if (!hctx)
+		return NULL;
+
+	hctx->rqs = kzalloc_node(reg->queue_depth * sizeof(struct request),
+				 GFP_KERNEL, reg->numa_node);
+	hctx->tags = kzalloc_node(BITS_TO_LONGS(reg->queue_depth) *
+				  sizeof(unsigned long), GFP_KERNEL,
+				  reg->numa_node);
+	if (!hctx->rqs || !hctx->tags) {
+		kfree(hctx->tags);
+		kfree(hctx->rqs);
+		kfree(hctx);
+		return NULL;
+	}
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->wait);
+	hctx->queue = q;
+	hctx->queue_num = queue_num;
+	hctx->driver_data = driver_data;
+	hctx->queue_depth = reg->queue_depth;
+	return hctx;
+}
+
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[i];
+
+		if (!hctx)
+			continue;
+		cancel_work_sync(&hctx->run_work);
+		kfree(hctx->tags);
+		kfree(hctx->rqs);
+		kfree(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+}
+
+/**
+ * blk_mq_init_queue - allocate a multi-queue request queue
+ * @reg:	hardware queue count and depth, and the driver's operations
+ * @driver_data: stored in ->queuedata and in each hardware queue
+ *
+ * Description:
+ *     The queue has no io scheduler and no request_fn; requests reach
+ *     the driver through @reg->ops->queue_rq and are completed with
+ *     blk_mq_end_request().  Barriers are ordered as set up with
+ *     blk_queue_ordered().  Returns %NULL on failure.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	unsigned int i;
+	int cpu;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth || !reg->ops->queue_rq)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues *
+				       sizeof(*q->queue_hw_ctx), GFP_KERNEL,
+				       reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+	q->nr_hw_queues = reg->nr_hw_queues;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+	}
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		q->queue_hw_ctx[i] = blk_mq_alloc_hctx(q, reg, i, driver_data);
+		if (!q->queue_hw_ctx[i])
+			goto fail;
+	}
+
+	q->queuedata = driver_data;
+	q->queue_flags = (1 << QUEUE_FLAG_IO_STAT) | (1 << QUEUE_FLAG_SAME_COMP);
+	init_rwsem(&q->mq_barrier_sem);
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	q->mq_ops = reg->ops;
+	return q;
+
+fail:
+	/* ->mq_ops is not set yet, so the queue release leaves these be */
+	blk_mq_free_queue(q);
+	blk_put_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
@@ -62,6 +62,22 @@ void blk_queue_softirq_done(struct request_queue *q, softirq_done_fn *fn)
 }
 EXPORT_SYMBOL(blk_queue_softirq_done);
 
+/**
+ * blk_queue_poll_fn - set a queue's completion poll function
+ * @q:		the request queue for the device
+ * @fn:		reaps completed requests without waiting for the interrupt
+ *
+ * Description:
+ *    @fn is called from blk_poll() in process context, with bottom halves
+ *    disabled, and returns how many requests it completed.  Waiters only
+ *    poll once it is switched on through the queue's io_poll attribute.
+ */
+void blk_queue_poll_fn(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL(blk_queue_poll_fn);
+
 void blk_queue_rq_timeout(struct request_queue *q, unsigned int timeout)
 {
 	q->rq_timeout = timeout;
@@ -0,0 +1,447 @@
+/*
+ * Block bio throttling, the "blkio" cgroup subsystem
+ *
+ * Each cgroup may cap the read and write bandwidth and iops its tasks
+ * get from a disk.  Bios are checked in generic_make_request(), before
+ * any io scheduler sees them, so the caps hold for every scheduler and
+ * for stacked devices such as dm and md alike.
+ *
+ * A limit is a token bucket refilled at the configured rate and holding
+ * at most one slice worth of tokens.  A bio is let through while the
+ * bucket is not in debt, and charged afterwards; bios that must wait are
+ * queued per cgroup, device and direction, and dispatched in order from
+ * kthrotld once the debt is paid back.
+ *
+ * Only the cgroup of the submitting task counts, so writeback done by
+ * the flusher threads is not charged to the tasks that dirtied the
+ * pages.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/cgroup.h>
+#include <linux/genhd.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "blk.h"
+
+/* Burst allowance: this much time worth of I/O can go back to back. */
+static unsigned long throtl_slice = HZ / 10;
+
+static struct workqueue_struct *kthrotld_workqueue;
+
+struct blkio_cgroup {
+	struct cgroup_subsys_state css;
+	spinlock_t lock;
+	struct list_head grps;
+};
+
+struct throtl_grp;
+
+/* Bios of one direction held back by a throtl_grp. */
+struct throtl_queue {
+	struct throtl_grp *tg;
+	int rw;
+	struct bio_list bios;
+	unsigned int nr_queued;
+	struct delayed_work work;
+};
+
+/*
+ * The limits of a cgroup on one disk.  Once created it lives as long as
+ * the cgroup does; a limit of 0 means unlimited.
+ */
+struct throtl_grp {
+	struct list_head node;
+	struct blkio_cgroup *blkcg;
+	dev_t dev;
+
+	u64 bps[2];
+	unsigned int iops[2];
+
+	/* may go negative: a bio is charged after it was let through */
+	s64 bytes_tok[2];
+	s64 io_tok[2];		/* in 1/HZ of an io */
+	unsigned long last[2];
+
+	struct throtl_queue queue[2];
+};
+
+enum {
+	THROTL_READ_BPS,
+	THROTL_WRITE_BPS,
+	THROTL_READ_IOPS,
+	THROTL_WRITE_IOPS,
+};
+
+static inline struct blkio_cgroup *cgroup_to_blkio_cgroup(struct cgroup *cgrp)
+{
+	return container_of(cgroup_subsys_state(cgrp, blkio_subsys_id),
+			    struct blkio_cgroup, css);
+}
+
+static inline struct blkio_cgroup *task_blkio_cgroup(struct task_struct *tsk)
+{
+	return container_of(task_subsys_state(tsk, blkio_subsys_id),
+			    struct blkio_cgroup, css);
+}
+
+/* called with blkcg->lock held */
+static struct throtl_grp *throtl_find_grp(struct blkio_cgroup *blkcg,
+					  dev_t dev)
+{
+	struct throtl_grp *tg;
+
+	list_for_each_entry(tg, &blkcg->grps, node)
+		if (tg->dev == dev)
+			return tg;
+	return NULL;
+}
+
+static void throtl_refill(struct throtl_grp *tg, int rw)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - tg->last[rw];
+	s64 cap;
+
+	if (!elapsed)
+		return;
+	tg->last[rw] = now;
+
+	/* Long idle periods refill to the cap anyway. */
+	elapsed = min_t(unsigned long, elapsed, 10 * HZ);
+
+	if (tg->bps[rw]) {
+		cap = div_u64(tg->bps[rw] * throtl_slice, HZ);
+		tg->bytes_tok[rw] += div_u64(tg->bps[rw] * elapsed, HZ);
+		tg->bytes_tok[rw] = min(tg->bytes_tok[rw], cap);
+	}
+	if (tg->iops[rw]) {
+		cap = (s64)tg->iops[rw] * throtl_slice;
+		tg->io_tok[rw] += (s64)tg->iops[rw] * elapsed;
+		tg->io_tok[rw] = min(tg->io_tok[rw], cap);
+	}
+}
+
+/*
+ * Returns how many jiffies to wait before the next bio of direction @rw
+ * may go, 0 if it may go now.
+ */
+static unsigned long throtl_wait(struct throtl_grp *tg, int rw)
+{
+	unsigned long wait = 0;
+
+	throtl_refill(tg, rw);
+
+	if (tg->bps[rw] && tg->bytes_tok[rw] < 0)
+		wait = div64_u64(-tg->bytes_tok[rw] * HZ + tg->bps[rw] - 1,
+				 tg->bps[rw]);
+	if (tg->iops[rw] && tg->io_tok[rw] < 0)
+		wait = max_t(unsigned long, wait,
+			     div_u64(-tg->io_tok[rw] + tg->iops[rw] - 1,
+				     tg->iops[rw]));
+	return wait;
+}
+
+static void throtl_charge(struct throtl_grp *tg, int rw, struct bio *bio)
+{
+	if (tg->bps[rw])
+		tg->bytes_tok[rw] -= bio->bi_size;
+	if (tg->iops[rw])
+		tg->io_tok[rw] -= HZ;
+}
+
+static void throtl_dispatch_work(struct work_struct *work)
+{
+	struct throtl_queue *tq =
+		container_of(work, struct throtl_queue, work.work);
+	struct throtl_grp *tg = tq->tg;
+	struct blkio_cgroup *blkcg = tg->blkcg;
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long wait = 0;
+
+	bio_list_init(&bios);
+
+	spin_lock(&blkcg->lock);
+	while ((bio = bio_list_peek(&tq->bios))) {
+		wait = throtl_wait(tg, tq->rw);
+		if (wait)
+			break;
+		bio_list_pop(&tq->bios);
+		tq->nr_queued--;
+		throtl_charge(tg, tq->rw, bio);
+		bio_list_add(&bios, bio);
+	}
+	if (tq->nr_queued)
+		queue_delayed_work(kthrotld_workqueue, &tq->work, wait);
+	spin_unlock(&blkcg->lock);
+
+	while ((bio = bio_list_pop(&bios))) {
+		set_bit(BIO_THROTTLED, &bio->bi_flags);
+		generic_make_request(bio);
+		/* taken when the bio was queued, see blk_throtl_bio() */
+		css_put(&blkcg->css);
+	}
+}
+
+/**
+ * blk_throtl_bio - apply the blkio limits of the current task to a bio
+ * @bio:	the bio, already remapped to the whole disk
+ *
+ * Description:
+ *     Returns true if @bio was queued to be submitted later, false if
+ *     the caller should go on with it right away.
+ */
+bool blk_throtl_bio(struct bio *bio)
+{
+	const int rw = bio_data_dir(bio);
+	struct blkio_cgroup *blkcg;
+	struct throtl_queue *tq;
+	struct throtl_grp *tg;
+	bool queued = false;
+
+	/* Coming back from throtl_dispatch_work(). */
+	if (bio_flagged(bio, BIO_THROTTLED)) {
+		clear_bit(BIO_THROTTLED, &bio->bi_flags);
+		return false;
+	}
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	if (list_empty(&blkcg->grps) || !css_tryget(&blkcg->css)) {
+		rcu_read_unlock();
+		return false;
+	}
+	rcu_read_unlock();
+
+	spin_lock(&blkcg->lock);
+	tg = throtl_find_grp(blkcg, disk_devt(bio->bi_bdev->bd_disk));
+	if (!tg || (!tg->bps[rw] && !tg->iops[rw]))
+		goto out;
+
+	/* Bios of a direction go out in order. */
+	tq = &tg->queue[rw];
+	if (!tq->nr_queued && !throtl_wait(tg, rw)) {
+		throtl_charge(tg, rw, bio);
+		goto out;
+	}
+
+	bio_list_add(&tq->bios, bio);
+	if (!tq->nr_queued++)
+		queue_delayed_work(kthrotld_workqueue, &tq->work,
+				   throtl_wait(tg, rw));
+	queued = true;
+out:
+	spin_unlock(&blkcg->lock);
+	if (!queued)
+		css_put(&blkcg->css);
+	return queued;
+}
+
+static int throtl_seq_read(struct cgroup *cgrp, struct cftype *cft,
+			   struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	struct throtl_grp *tg;
+	u64 val;
+
+	spin_lock(&blkcg->lock);
+	list_for_each_entry(tg, &blkcg->grps, node) {
+		switch (cft->private) {
+		case THROTL_READ_BPS:
+		case THROTL_WRITE_BPS:
+			val = tg->bps[cft->private == THROTL_WRITE_BPS];
+			break;
+		default:
+			val = tg->iops[cft->private == THROTL_WRITE_IOPS];
+			break;
+		}
+		if (val)
+			seq_printf(m, "%u:%u %llu\n", MAJOR(tg->dev),
+				   MINOR(tg->dev), (unsigned long long)val);
+	}
+	spin_unlock(&blkcg->lock);
+	return 0;
+}
+
+static struct throtl_grp *throtl_alloc_grp(struct blkio_cgroup *blkcg,
+					   dev_t dev)
+{
+	struct throtl_grp *tg;
+	int rw;
+
+	tg = kzalloc(sizeof(*tg), GFP_KERNEL);
+	if (!tg)
+		return NULL;
+
+	tg->blkcg = blkcg;
+	tg->dev = dev;
+	for (rw = READ; rw <= WRITE; rw++) {
+		struct throtl_queue *tq = &tg->queue[rw];
+
+		tg->last[rw] = jiffies;
+		tq->tg = tg;
+		tq->rw = rw;
+		bio_list_init(&tq->bios);
+		INIT_DELAYED_WORK(&tq->work, throtl_dispatch_work);
+	}
+	return tg;
+}
+
+/*
+ * "<major>:<minor> <limit>", for a whole disk.  A limit of 0 removes it.
+ */
+static int throtl_write(struct cgroup *cgrp, struct cftype *cft,
+			const char *buffer)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	struct throtl_grp *tg, *new;
+	unsigned int major, minor;
+	unsigned long long val;
+	struct gendisk *disk;
+	struct throtl_queue *tq;
+	dev_t dev;
+	int partno, rw;
+
+	if (sscanf(buffer, "%u:%u %llu", &major, &minor, &val) != 3)
+		return -EINVAL;
+
+	dev = MKDEV(major, minor);
+	disk = get_gendisk(dev, &partno);
+	if (!disk)
+		return -ENODEV;
+	put_disk(disk);
+	if (partno)
+		return -EINVAL;
+
+	if ((cft->private == THROTL_READ_IOPS ||
+	     cft->private == THROTL_WRITE_IOPS) && val > UINT_MAX)
+		return -EINVAL;
+
+	new = throtl_alloc_grp(blkcg, dev);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock(&blkcg->lock);
+	tg = throtl_find_grp(blkcg, dev);
+	if (!tg) {
+		tg = new;
+		new = NULL;
+		list_add(&tg->node, &blkcg->grps);
+	}
+
+	switch (cft->private) {
+	case THROTL_READ_BPS:
+	case THROTL_WRITE_BPS:
+		rw = cft->private == THROTL_WRITE_BPS;
+		tg->bps[rw] = val;
+		tg->bytes_tok[rw] = 0;
+		break;
+	default:
+		rw = cft->private == THROTL_WRITE_IOPS;
+		tg->iops[rw] = val;
+		tg->io_tok[rw] = 0;
+		break;
+	}
+	tg->last[rw] = jiffies;
+
+	/* Queued bios are waiting for the old limit: recheck them now. */
+	tq = &tg->queue[rw];
+	if (tq->nr_queued && cancel_delayed_work(&tq->work))
+		queue_delayed_work(kthrotld_workqueue, &tq->work, 0);
+	spin_unlock(&blkcg->lock);
+
+	kfree(new);
+	return 0;
+}
+
+static struct cftype throtl_files[] = {
+	{
+		.name = "throttle.read_bps_device",
+		.read_seq_string = throtl_seq_read,
+		.write_string = throtl_write,
+		.max_write_len = 256,
+		.private = THROTL_READ_BPS,
+	},
+	{
+		.name = "throttle.write_bps_device",
+		.read_seq_string = throtl_seq_read,
+		.write_string = throtl_write,
+		.max_write_len = 256,
+		.private = THROTL_WRITE_BPS,
+	},
+	{
+		.name = "throttle.read_iops_device",
+		.read_seq_string = throtl_seq_read,
+		.write_string = throtl_write,
+		.max_write_len = 256,
+		.private = THROTL_READ_IOPS,
+	},
+	{
+		.name = "throttle.write_iops_device",
+		.read_seq_string = throtl_seq_read,
+		.write_string = throtl_write,
+		.max_write_len = 256,
+		.private = THROTL_WRITE_IOPS,
+	},
+};
+
+static int blkiocg_populate(struct cgroup_subsys *ss, struct cgroup *cgrp)
+{
+	return cgroup_add_files(cgrp, ss, throtl_files,
+				ARRAY_SIZE(throtl_files));
+}
+
+static struct cgroup_subsys_state *blkiocg_create(struct cgroup_subsys *ss,
+						  struct cgroup *cgrp)
+{
+	struct blkio_cgroup *blkcg;
+
+	blkcg = kzalloc(sizeof(*blkcg), GFP_KERNEL);
+	if (!blkcg)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&blkcg->lock);
+	INIT_LIST_HEAD(&blkcg->grps);
+	return &blkcg->css;
+}
+
+/*
+ * Queued bios hold a reference on the css, so by now nothing is queued;
+ * a dispatch work may still be on its way out.
+ */
+static void blkiocg_destroy(struct cgroup_subsys *ss, struct cgroup *cgrp)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgrp);
+	struct throtl_grp *tg, *tmp;
+	int rw;
+
+	list_for_each_entry_safe(tg, tmp, &blkcg->grps, node) {
+		for (rw = READ; rw <= WRITE; rw++)
+			cancel_delayed_work_sync(&tg->queue[rw].work);
+		list_del(&tg->node);
+		kfree(tg);
+	}
+	kfree(blkcg);
+}
+
+struct cgroup_subsys blkio_subsys = {
+	.name = "blkio",
+	.create = blkiocg_create,
+	.destroy = blkiocg_destroy,
+	.populate = blkiocg_populate,
+	.subsys_id = blkio_subsys_id,
+};
+
+static int __init throtl_init(void)
+{
+	kthrotld_workqueue = create_workqueue("kthrotld");
+	if (!kthrotld_workqueue)
+		panic("Failed to create kthrotld\n");
+	return 0;
+}
+module_init(throtl_init);
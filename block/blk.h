@@ -24,6 +24,16 @@ void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
 void __generic_unplug_device(struct request_queue *);
+void blk_mq_free_queue(struct request_queue *q);
+
+#ifdef CONFIG_BLK_DEV_THROTTLING
+bool blk_throtl_bio(struct bio *bio);
+#else
+static inline bool blk_throtl_bio(struct bio *bio)
+{
+	return false;
+}
+#endif
 
 /*
  * Internal atomic flags for request handling
@@ -254,6 +254,19 @@ static inline int rq_in_driver(struct cfq_data *cfqd)
 	return cfqd->rq_in_driver[0] + cfqd->rq_in_driver[1];
 }
 
+/*
+ * A queuing device without seek penalty, an SSD or a virtual disk on SAN
+ * or flash storage, loses throughput to idling and gains nothing from
+ * it.  Such devices are run without idle windows and with deeper
+ * dispatch; the time slices still keep them fair.  Drivers that cannot
+ * queue are left alone, otherwise we still have a problem with sync vs
+ * async workloads.
+ */
+static inline bool cfq_nonrot_queuing(struct cfq_data *cfqd)
+{
+	return blk_queue_nonrot(cfqd->queue) && cfqd->hw_tag;
+}
+
 static inline struct cfq_queue *cic_to_cfqq(struct cfq_io_context *cic,
 					    bool is_sync)
 {
@@ -1074,12 +1087,7 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 	struct cfq_io_context *cic;
 	unsigned long sl;
 
-	/*
-	 * SSD device without seek penalty, disable idling. But only do so
-	 * for devices that support queuing, otherwise we still have a problem
-	 * with sync vs async workloads.
-	 */
-	if (blk_queue_nonrot(cfqd->queue) && cfqd->hw_tag)
+	if (cfq_nonrot_queuing(cfqd))
 		return;
 
 	WARN_ON(!RB_EMPTY_ROOT(&cfqq->sort_list));
@@ -1356,9 +1364,10 @@ static bool cfq_may_dispatch(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 			return false;
 
 		/*
-		 * We have other queues, don't allow more IO from this one
+		 * We have other queues, don't allow more IO from this one,
+		 * unless the device is better off kept busy
 		 */
-		if (cfqd->busy_queues > 1)
+		if (cfqd->busy_queues > 1 && !cfq_nonrot_queuing(cfqd))
 			return false;
 
 		/*
@@ -2108,6 +2117,7 @@ cfq_update_idle_window(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 	enable_idle = old_idle = cfq_cfqq_idle_window(cfqq);
 
 	if (!atomic_read(&cic->ioc->nr_tasks) || !cfqd->cfq_slice_idle ||
+	    cfq_nonrot_queuing(cfqd) ||
 	    (!cfqd->cfq_latency && cfqd->hw_tag && CFQQ_SEEKY(cfqq)))
 		enable_idle = 0;
 	else if (sample_valid(cic->ttime_samples)) {
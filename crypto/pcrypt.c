@@ -0,0 +1,400 @@
+/*
+ * pcrypt - Parallel crypto wrapper.
+ *
+ * Runs the requests of one tfm on all cpus through padata, and completes
+ * them in the order they were submitted in, eg. to spread the packets
+ * of a single IPsec SA over the cpus without reordering them.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <crypto/algapi.h>
+#include <crypto/internal/aead.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/padata.h>
+#include <linux/slab.h>
+
+static struct padata_instance *pcrypt_enc_padata;
+static struct padata_instance *pcrypt_dec_padata;
+static struct workqueue_struct *encwq;
+static struct workqueue_struct *decwq;
+
+struct pcrypt_request {
+	struct padata_priv	padata;
+	void			*__ctx[] CRYPTO_MINALIGN_ATTR;
+};
+
+struct pcrypt_instance_ctx {
+	struct crypto_aead_spawn	spawn;
+	atomic_t			tfm_count;
+};
+
+struct pcrypt_aead_ctx {
+	struct crypto_aead	*child;
+	int			cb_cpu;
+};
+
+static inline void *pcrypt_request_ctx(struct pcrypt_request *preq)
+{
+	return preq->__ctx;
+}
+
+static inline struct pcrypt_request *pcrypt_padata_request(
+	struct padata_priv *padata)
+{
+	return container_of(padata, struct pcrypt_request, padata);
+}
+
+static int pcrypt_aead_setkey(struct crypto_aead *parent,
+			      const u8 *key, unsigned int keylen)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(parent);
+
+	return crypto_aead_setkey(ctx->child, key, keylen);
+}
+
+static int pcrypt_aead_setauthsize(struct crypto_aead *parent,
+				   unsigned int authsize)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(parent);
+
+	return crypto_aead_setauthsize(ctx->child, authsize);
+}
+
+static void pcrypt_aead_serial(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct aead_request *creq = pcrypt_request_ctx(preq);
+
+	aead_request_complete(creq->base.data, padata->info);
+}
+
+static void pcrypt_aead_giv_serial(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct aead_givcrypt_request *creq = pcrypt_request_ctx(preq);
+
+	aead_request_complete(creq->areq.base.data, padata->info);
+}
+
+/* the child completed asynchronously, data is our own request */
+static void pcrypt_aead_done(struct crypto_async_request *areq, int err)
+{
+	struct aead_request *req = areq->data;
+	struct pcrypt_request *preq = aead_request_ctx(req);
+	struct padata_priv *padata = &preq->padata;
+
+	padata->info = err;
+	req->base.flags &= ~CRYPTO_TFM_REQ_MAY_SLEEP;
+
+	padata_do_serial(padata);
+}
+
+static void pcrypt_aead_enc(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct aead_request *creq = pcrypt_request_ctx(preq);
+
+	padata->info = crypto_aead_encrypt(creq);
+	if (padata->info == -EINPROGRESS)
+		return;
+
+	padata_do_serial(padata);
+}
+
+static void pcrypt_aead_dec(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct aead_request *creq = pcrypt_request_ctx(preq);
+
+	padata->info = crypto_aead_decrypt(creq);
+	if (padata->info == -EINPROGRESS)
+		return;
+
+	padata_do_serial(padata);
+}
+
+static void pcrypt_aead_givenc(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct aead_givcrypt_request *creq = pcrypt_request_ctx(preq);
+
+	padata->info = crypto_aead_givencrypt(creq);
+	if (padata->info == -EINPROGRESS)
+		return;
+
+	padata_do_serial(padata);
+}
+
+/*
+ * The child runs from padata's workers with bottom halves off, so it
+ * must neither sleep nor be allowed to backlog: a backlogged request is
+ * completed twice, which would serialize it twice.
+ */
+static u32 pcrypt_child_flags(u32 flags)
+{
+	return flags & ~(CRYPTO_TFM_REQ_MAY_SLEEP | CRYPTO_TFM_REQ_MAY_BACKLOG);
+}
+
+static int pcrypt_do_parallel(struct padata_instance *pinst,
+			      struct padata_priv *padata,
+			      void (*parallel)(struct padata_priv *padata),
+			      void (*serial)(struct padata_priv *padata),
+			      int cb_cpu)
+{
+	int err;
+
+	memset(padata, 0, sizeof(*padata));
+	padata->parallel = parallel;
+	padata->serial = serial;
+
+	err = padata_do_parallel(pinst, padata, cb_cpu);
+	return err ? err : -EINPROGRESS;
+}
+
+static int pcrypt_aead_encrypt(struct aead_request *req)
+{
+	struct pcrypt_request *preq = aead_request_ctx(req);
+	struct aead_request *creq = pcrypt_request_ctx(preq);
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(aead);
+
+	aead_request_set_tfm(creq, ctx->child);
+	aead_request_set_callback(creq,
+				  pcrypt_child_flags(aead_request_flags(req)),
+				  pcrypt_aead_done, req);
+	aead_request_set_crypt(creq, req->src, req->dst,
+			       req->cryptlen, req->iv);
+	aead_request_set_assoc(creq, req->assoc, req->assoclen);
+
+	return pcrypt_do_parallel(pcrypt_enc_padata, &preq->padata,
+				  pcrypt_aead_enc, pcrypt_aead_serial,
+				  ctx->cb_cpu);
+}
+
+static int pcrypt_aead_decrypt(struct aead_request *req)
+{
+	struct pcrypt_request *preq = aead_request_ctx(req);
+	struct aead_request *creq = pcrypt_request_ctx(preq);
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(aead);
+
+	aead_request_set_tfm(creq, ctx->child);
+	aead_request_set_callback(creq,
+				  pcrypt_child_flags(aead_request_flags(req)),
+				  pcrypt_aead_done, req);
+	aead_request_set_crypt(creq, req->src, req->dst,
+			       req->cryptlen, req->iv);
+	aead_request_set_assoc(creq, req->assoc, req->assoclen);
+
+	return pcrypt_do_parallel(pcrypt_dec_padata, &preq->padata,
+				  pcrypt_aead_dec, pcrypt_aead_serial,
+				  ctx->cb_cpu);
+}
+
+static int pcrypt_aead_givencrypt(struct aead_givcrypt_request *req)
+{
+	struct aead_request *areq = &req->areq;
+	struct pcrypt_request *preq = aead_request_ctx(areq);
+	struct aead_givcrypt_request *creq = pcrypt_request_ctx(preq);
+	struct crypto_aead *aead = aead_givcrypt_reqtfm(req);
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(aead);
+
+	aead_givcrypt_set_tfm(creq, ctx->child);
+	aead_givcrypt_set_callback(creq,
+				   pcrypt_child_flags(aead_request_flags(areq)),
+				   pcrypt_aead_done, areq);
+	aead_givcrypt_set_crypt(creq, areq->src, areq->dst,
+				areq->cryptlen, areq->iv);
+	aead_givcrypt_set_assoc(creq, areq->assoc, areq->assoclen);
+	aead_givcrypt_set_giv(creq, req->giv, req->seq);
+
+	return pcrypt_do_parallel(pcrypt_enc_padata, &preq->padata,
+				  pcrypt_aead_givenc, pcrypt_aead_giv_serial,
+				  ctx->cb_cpu);
+}
+
+static int pcrypt_aead_init_tfm(struct crypto_tfm *tfm)
+{
+	struct crypto_instance *inst = crypto_tfm_alg_instance(tfm);
+	struct pcrypt_instance_ctx *ictx = crypto_instance_ctx(inst);
+	struct pcrypt_aead_ctx *ctx = crypto_tfm_ctx(tfm);
+	struct crypto_aead *cipher;
+
+	/*
+	 * All requests of a tfm complete on one cpu, so their callbacks
+	 * run in order; spread the tfms over the cpus.
+	 */
+	ctx->cb_cpu = atomic_inc_return(&ictx->tfm_count);
+
+	cipher = crypto_spawn_aead(&ictx->spawn);
+	if (IS_ERR(cipher))
+		return PTR_ERR(cipher);
+
+	ctx->child = cipher;
+	tfm->crt_aead.reqsize = sizeof(struct pcrypt_request) +
+				sizeof(struct aead_givcrypt_request) +
+				crypto_aead_reqsize(cipher);
+
+	return 0;
+}
+
+static void pcrypt_aead_exit_tfm(struct crypto_tfm *tfm)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_aead(ctx->child);
+}
+
+static struct crypto_instance *pcrypt_alloc_aead(struct rtattr **tb,
+						 struct crypto_attr_type *algt)
+{
+	struct crypto_instance *inst;
+	struct pcrypt_instance_ctx *ctx;
+	struct crypto_alg *alg;
+	const char *name;
+	int err;
+
+	name = crypto_attr_alg_name(tb[1]);
+	if (IS_ERR(name))
+		return ERR_CAST(name);
+
+	inst = kzalloc(sizeof(*inst) + sizeof(*ctx), GFP_KERNEL);
+	if (!inst)
+		return ERR_PTR(-ENOMEM);
+
+	ctx = crypto_instance_ctx(inst);
+	crypto_set_aead_spawn(&ctx->spawn, inst);
+	err = crypto_grab_aead(&ctx->spawn, name, 0, 0);
+	if (err)
+		goto out_free_inst;
+
+	alg = crypto_aead_spawn_alg(&ctx->spawn);
+
+	err = -ENAMETOOLONG;
+	if (snprintf(inst->alg.cra_driver_name, CRYPTO_MAX_ALG_NAME,
+		     "pcrypt(%s)", alg->cra_driver_name) >= CRYPTO_MAX_ALG_NAME)
+		goto out_drop_aead;
+
+	memcpy(inst->alg.cra_name, alg->cra_name, CRYPTO_MAX_ALG_NAME);
+
+	inst->alg.cra_flags = CRYPTO_ALG_TYPE_AEAD | CRYPTO_ALG_ASYNC;
+	inst->alg.cra_priority = alg->cra_priority + 100;
+	inst->alg.cra_blocksize = alg->cra_blocksize;
+	inst->alg.cra_alignmask = alg->cra_alignmask;
+	inst->alg.cra_type = &crypto_aead_type;
+
+	inst->alg.cra_aead.ivsize = alg->cra_aead.ivsize;
+	inst->alg.cra_aead.geniv = alg->cra_aead.geniv;
+	inst->alg.cra_aead.maxauthsize = alg->cra_aead.maxauthsize;
+
+	inst->alg.cra_ctxsize = sizeof(struct pcrypt_aead_ctx);
+
+	inst->alg.cra_init = pcrypt_aead_init_tfm;
+	inst->alg.cra_exit = pcrypt_aead_exit_tfm;
+
+	inst->alg.cra_aead.setkey = pcrypt_aead_setkey;
+	inst->alg.cra_aead.setauthsize = pcrypt_aead_setauthsize;
+	inst->alg.cra_aead.encrypt = pcrypt_aead_encrypt;
+	inst->alg.cra_aead.decrypt = pcrypt_aead_decrypt;
+	inst->alg.cra_aead.givencrypt = pcrypt_aead_givencrypt;
+
+	atomic_set(&ctx->tfm_count, -1);
+	return inst;
+
+out_drop_aead:
+	crypto_drop_aead(&ctx->spawn);
+out_free_inst:
+	kfree(inst);
+	return ERR_PTR(err);
+}
+
+static struct crypto_instance *pcrypt_alloc(struct rtattr **tb)
+{
+	struct crypto_attr_type *algt;
+
+	algt = crypto_get_attr_type(tb);
+	if (IS_ERR(algt))
+		return ERR_CAST(algt);
+
+	switch (algt->type & algt->mask & CRYPTO_ALG_TYPE_MASK) {
+	case CRYPTO_ALG_TYPE_AEAD:
+		return pcrypt_alloc_aead(tb, algt);
+	}
+
+	return ERR_PTR(-EINVAL);
+}
+
+static void pcrypt_free(struct crypto_instance *inst)
+{
+	struct pcrypt_instance_ctx *ctx = crypto_instance_ctx(inst);
+
+	crypto_drop_aead(&ctx->spawn);
+	kfree(inst);
+}
+
+static struct crypto_template pcrypt_tmpl = {
+	.name = "pcrypt",
+	.alloc = pcrypt_alloc,
+	.free = pcrypt_free,
+	.module = THIS_MODULE,
+};
+
+static int __init pcrypt_init(void)
+{
+	int err = -ENOMEM;
+
+	encwq = create_workqueue("pencrypt");
+	if (!encwq)
+		goto err;
+
+	decwq = create_workqueue("pdecrypt");
+	if (!decwq)
+		goto err_destroy_encwq;
+
+	pcrypt_enc_padata = padata_alloc(cpu_possible_mask, encwq);
+	if (!pcrypt_enc_padata)
+		goto err_destroy_decwq;
+
+	pcrypt_dec_padata = padata_alloc(cpu_possible_mask, decwq);
+	if (!pcrypt_dec_padata)
+		goto err_free_enc_padata;
+
+	err = crypto_register_template(&pcrypt_tmpl);
+	if (err)
+		goto err_free_dec_padata;
+
+	return 0;
+
+err_free_dec_padata:
+	padata_free(pcrypt_dec_padata);
+err_free_enc_padata:
+	padata_free(pcrypt_enc_padata);
+err_destroy_decwq:
+	destroy_workqueue(decwq);
+err_destroy_encwq:
+	destroy_workqueue(encwq);
+err:
+	return err;
+}
+
+static void __exit pcrypt_exit(void)
+{
+	crypto_unregister_template(&pcrypt_tmpl);
+
+	padata_free(pcrypt_dec_padata);
+	padata_free(pcrypt_enc_padata);
+
+	destroy_workqueue(decwq);
+	destroy_workqueue(encwq);
+}
+
+module_init(pcrypt_init);
+module_exit(pcrypt_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Parallel crypto wrapper");
@@ -23,11 +23,48 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/async.h>
+#include <linux/slab.h>
 #include <linux/pm_runtime.h>
 
 #include "base.h"
 #include "power/power.h"
 
+/*
+ * Probes of the drivers that ask for it (or are named in
+ * driver_async_probe=) run from the async threads, so that a slow probe
+ * waiting for its hardware, or for a backend in another domain, does not
+ * hold up the rest of the boot.  Only drivers that do not care in which
+ * order their devices show up should do this, and their probe must not
+ * itself wait for async work to finish.
+ */
+static LIST_HEAD(async_probe_domain);
+static char async_probe_drv_names[64];
+
+static int __init save_async_options(char *buf)
+{
+	strlcpy(async_probe_drv_names, buf, sizeof(async_probe_drv_names));
+	return 1;
+}
+__setup("driver_async_probe=", save_async_options);
+
+static bool driver_allows_async_probing(struct device_driver *drv)
+{
+	const char *p = async_probe_drv_names;
+	size_t len = strlen(drv->name);
+
+	if (drv->async_probe)
+		return true;
+
+	while (*p) {
+		if (!strncmp(p, drv->name, len) && (!p[len] || p[len] == ','))
+			return true;
+		p = strchr(p, ',');
+		if (!p)
+			break;
+		p++;
+	}
+	return false;
+}
 
 static void driver_bound(struct device *dev)
 {
@@ -211,6 +248,53 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 	return ret;
 }
 
+struct async_probe {
+	struct device_driver *drv;
+	struct device *dev;
+};
+
+static void driver_probe_async(void *data, async_cookie_t cookie)
+{
+	struct async_probe *ap = data;
+	struct device *dev = ap->dev;
+
+	if (dev->parent)	/* Needed for USB */
+		down(&dev->parent->sem);
+	down(&dev->sem);
+	if (!dev->driver)
+		driver_probe_device(ap->drv, dev);
+	up(&dev->sem);
+	if (dev->parent)
+		up(&dev->parent->sem);
+
+	put_device(dev);
+	kfree(ap);
+}
+
+/*
+ * Hand the probe of @dev by @drv to the async threads if the driver allows
+ * it.  Returns false when the caller has to probe synchronously after all.
+ * The device is pinned until the probe ran; the driver is, because
+ * driver_detach() waits for the pending probes.
+ */
+static bool driver_schedule_probe(struct device_driver *drv,
+				  struct device *dev)
+{
+	struct async_probe *ap;
+
+	if (!driver_allows_async_probing(drv))
+		return false;
+
+	ap = kmalloc(sizeof(*ap), GFP_KERNEL);
+	if (!ap)
+		return false;
+
+	ap->drv = drv;
+	ap->dev = get_device(dev);
+	async_schedule_domain(driver_probe_async, ap, &async_probe_domain);
+	return true;
+}
+
 static int __device_attach(struct device_driver *drv, void *data)
 {
 	struct device *dev = data;
@@ -218,6 +302,10 @@ static int __device_attach(struct device_driver *drv, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	/* the device is as good as taken, stop looking */
+	if (driver_schedule_probe(drv, dev))
+		return 1;
+
 	return driver_probe_device(drv, dev);
 }
 
@@ -275,6 +363,9 @@ static int __driver_attach(struct device *dev, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	if (driver_schedule_probe(drv, dev))
+		return 0;
+
 	if (dev->parent)	/* Needed for USB */
 		down(&dev->parent->sem);
 	down(&dev->sem);
@@ -367,6 +458,9 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	if (driver_allows_async_probing(drv))
+		async_synchronize_full_domain(&async_probe_domain);
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
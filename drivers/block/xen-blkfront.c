@@ -37,10 +37,13 @@
 
 #include <linux/interrupt.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/cdrom.h>
 #include <linux/module.h>
 #include <linux/scatterlist.h>
+#include <linux/highmem.h>
+#include <linux/blktrace_api.h>
 
 #include <xen/xen.h>
 #include <xen/xenbus.h>
@@ -55,21 +58,81 @@
 
 #include <asm/xen/hypervisor.h>
 
+#include <trace/events/xen_blkif.h>
+
 enum blkif_state {
 	BLKIF_STATE_DISCONNECTED,
 	BLKIF_STATE_CONNECTED,
 	BLKIF_STATE_SUSPENDED,
 };
 
+/* A page that stays granted to the backend while the device is up. */
+struct blkfront_grant {
+	struct list_head node;
+	grant_ref_t gref;
+	struct page *page;
+};
+
 struct blk_shadow {
 	struct blkif_request req;
 	unsigned long request;
 	unsigned long frame[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	/* Segment list and data frames of an indirect request. */
+	struct blkif_request_segment *indirect;
+	unsigned long *indirect_frame;
+	/* Data was bounced through persistent grants. */
+	int persistent;
+	struct blkfront_grant *grants[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct blkfront_grant **indirect_grants;
 };
 
+/*
+ * Largest request sent with an indirect descriptor: 1MB, and as many
+ * segments as the backend can put in one bio.
+ */
+#define BLKFRONT_MAX_INDIRECT_SEGMENTS 256
+#define BLKFRONT_INDIRECT_PAGES(nseg) \
+	DIV_ROUND_UP(nseg, BLKIF_SEGS_PER_INDIRECT_FRAME)
+#define BLKFRONT_INDIRECT_ORDER \
+	get_order(BLKFRONT_INDIRECT_PAGES(BLKFRONT_MAX_INDIRECT_SEGMENTS) * \
+		  PAGE_SIZE)
+
+static unsigned int blkif_max_indirect_segs = BLKFRONT_MAX_INDIRECT_SEGMENTS;
+module_param_named(max_indirect_segments, blkif_max_indirect_segs, uint, 0444);
+MODULE_PARM_DESC(max_indirect_segments,
+		 "Maximum number of segments in an indirect request");
+
+static int blkif_feature_persistent = 1;
+module_param_named(feature_persistent, blkif_feature_persistent, bool, 0444);
+MODULE_PARM_DESC(feature_persistent,
+		 "Copy data through persistently granted pages if the backend allows it");
+
+/* Enough to keep a single-page ring full. */
+static unsigned int blkif_max_persistent_gnts =
+	__CONST_RING_SIZE(blkif, PAGE_SIZE) * BLKIF_MAX_SEGMENTS_PER_REQUEST;
+module_param_named(max_persistent_grants, blkif_max_persistent_gnts, uint, 0444);
+MODULE_PARM_DESC(max_persistent_grants,
+		 "Maximum number of pages granted persistently per device");
+
 static const struct block_device_operations xlvbd_block_fops;
 
-#define BLK_RING_SIZE __CONST_RING_SIZE(blkif, PAGE_SIZE)
+/* Readahead window: requests to keep in flight, and an upper bound. */
+#define BLKIF_RA_REQUESTS	4
+#define BLKIF_MAX_RA_BYTES	(2 * 1024 * 1024)
+
+/*
+ * Request ids index the shadow array, which is sized for the largest
+ * ring: how many of them are in flight is bounded by the ring actually
+ * negotiated with the backend.
+ */
+#define BLK_RING_SIZE \
+	__CONST_RING_SIZE(blkif, PAGE_SIZE * BLKIF_MAX_RING_PAGES)
+
+/* Log2 of the number of ring pages to use if the backend allows it. */
+static unsigned int blkif_max_ring_order = BLKIF_MAX_RING_PAGE_ORDER;
+module_param_named(max_ring_page_order, blkif_max_ring_order, uint, 0444);
+MODULE_PARM_DESC(max_ring_page_order,
+		 "Log2 of the maximum number of pages in a shared ring");
 
 /*
  * We have one of these per vbd, whether ide, scsi or 'other'.  They
@@ -84,17 +147,26 @@ struct blkfront_info
 	int vdevice;
 	blkif_vdev_t handle;
 	enum blkif_state connected;
-	int ring_ref;
+	unsigned int ring_order;
+	int ring_ref[BLKIF_MAX_RING_PAGES];
 	struct blkif_front_ring ring;
-	struct scatterlist sg[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct scatterlist sg[BLKFRONT_MAX_INDIRECT_SEGMENTS];
 	unsigned int evtchn, irq;
-	struct tasklet_struct tasklet;
 	struct request_queue *rq;
 	struct work_struct work;
 	struct gnttab_free_callback callback;
 	struct blk_shadow shadow[BLK_RING_SIZE];
 	unsigned long shadow_free;
+	unsigned int max_indirect_segs;	/* 0: no indirect requests */
 	int feature_barrier;
+	int feature_discard;
+	int feature_persistent;
+	int rotational;		/* backing storage has a seek penalty */
+	/* Persistent grants: the unused ones, and how many exist. */
+	struct list_head grants;
+	unsigned int nr_free_grants;
+	unsigned int nr_grants;
+	unsigned int max_grants;
 	int is_ready;
 
 	spinlock_t io_lock;
@@ -142,6 +214,184 @@ static void add_id_to_freelist(struct blkfront_info *info,
 	info->shadow_free = id;
 }
 
+/* Chain the shadow entries the current ring can have in flight. */
+static void blkif_init_freelist(struct blkfront_info *info)
+{
+	unsigned int i = RING_SIZE(&info->ring);
+
+	info->shadow_free = 0x0fffffff;
+	while (i-- > 0)
+		if (!info->shadow[i].request)
+			add_id_to_freelist(info, i);
+}
+
+/* Indirect buffers of the shadow entries the current ring can use. */
+static int blkif_alloc_indirect(struct blkfront_info *info)
+{
+	unsigned int i, nr = RING_SIZE(&info->ring);
+
+	for (i = 0; i < nr; i++) {
+		struct blk_shadow *s = &info->shadow[i];
+
+		if (!s->indirect)
+			s->indirect = (void *)__get_free_pages(GFP_NOIO,
+						BLKFRONT_INDIRECT_ORDER);
+		if (!s->indirect_frame)
+			s->indirect_frame = kmalloc(sizeof(unsigned long) *
+					BLKFRONT_MAX_INDIRECT_SEGMENTS, GFP_NOIO);
+		if (!s->indirect_grants)
+			s->indirect_grants = kmalloc(sizeof(s->indirect_grants[0]) *
+					BLKFRONT_MAX_INDIRECT_SEGMENTS, GFP_NOIO);
+		if (!s->indirect || !s->indirect_frame || !s->indirect_grants)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void blkif_free_indirect(struct blkfront_info *info)
+{
+	unsigned int i;
+
+	for (i = 0; i < BLK_RING_SIZE; i++) {
+		struct blk_shadow *s = &info->shadow[i];
+
+		if (s->indirect)
+			free_pages((unsigned long)s->indirect,
+				   BLKFRONT_INDIRECT_ORDER);
+		kfree(s->indirect_frame);
+		kfree(s->indirect_grants);
+		s->indirect = NULL;
+		s->indirect_frame = NULL;
+		s->indirect_grants = NULL;
+	}
+}
+
+/* The segments a request may carry over the current connection. */
+static unsigned int blkif_max_segments(struct blkfront_info *info)
+{
+	return info->max_indirect_segs ? : BLKIF_MAX_SEGMENTS_PER_REQUEST;
+}
+
+static unsigned int blkif_shadow_segments(struct blk_shadow *s)
+{
+	if (s->req.operation == BLKIF_OP_INDIRECT)
+		return ((struct blkif_request_indirect *)&s->req)->nr_segments;
+	return s->req.nr_segments;
+}
+
+static struct blkfront_grant **blkif_shadow_grants(struct blk_shadow *s)
+{
+	if (s->req.operation == BLKIF_OP_INDIRECT)
+		return s->indirect_grants;
+	return s->grants;
+}
+
+/*
+ * Grow the pool of persistent grants to info->max_grants.  Grants
+ * owned by requests in flight across a resume count towards it.
+ */
+static int blkif_fill_grants(struct blkfront_info *info)
+{
+	domid_t domid = info->xbdev->otherend_id;
+	struct blkfront_grant *gnt;
+	int ref;
+
+	while (info->nr_grants < info->max_grants) {
+		gnt = kzalloc(sizeof(*gnt), GFP_NOIO);
+		if (!gnt)
+			return -ENOMEM;
+		gnt->page = alloc_page(GFP_NOIO);
+		if (!gnt->page) {
+			kfree(gnt);
+			return -ENOMEM;
+		}
+		ref = gnttab_grant_foreign_access(domid,
+				pfn_to_mfn(page_to_pfn(gnt->page)), 0);
+		if (ref < 0) {
+			__free_page(gnt->page);
+			kfree(gnt);
+			return ref;
+		}
+		gnt->gref = ref;
+
+		spin_lock_irq(&info->io_lock);
+		list_add(&gnt->node, &info->grants);
+		info->nr_free_grants++;
+		info->nr_grants++;
+		spin_unlock_irq(&info->io_lock);
+	}
+
+	return 0;
+}
+
+static struct blkfront_grant *blkif_get_grant(struct blkfront_info *info)
+{
+	struct blkfront_grant *gnt;
+
+	BUG_ON(list_empty(&info->grants));
+	gnt = list_first_entry(&info->grants, struct blkfront_grant, node);
+	list_del(&gnt->node);
+	info->nr_free_grants--;
+	return gnt;
+}
+
+static void blkif_destroy_grant(struct blkfront_info *info,
+				struct blkfront_grant *gnt)
+{
+	gnttab_end_foreign_access(gnt->gref, 0,
+				  (unsigned long)page_address(gnt->page));
+	kfree(gnt);
+	info->nr_grants--;
+}
+
+/* Back into the pool, unless the connection no longer uses one. */
+static void blkif_put_grant(struct blkfront_info *info,
+			    struct blkfront_grant *gnt)
+{
+	if (!info->feature_persistent || info->nr_grants > info->max_grants) {
+		blkif_destroy_grant(info, gnt);
+		return;
+	}
+	list_add(&gnt->node, &info->grants);
+	info->nr_free_grants++;
+}
+
+/* Called with the ring down: the backend has let go of the pages. */
+static void blkif_release_grants(struct blkfront_info *info)
+{
+	struct blkfront_grant *gnt, *n;
+
+	list_for_each_entry_safe(gnt, n, &info->grants, node) {
+		list_del(&gnt->node);
+		info->nr_free_grants--;
+		blkif_destroy_grant(info, gnt);
+	}
+}
+
+/* A completed read: copy the data out of the granted pages. */
+static void blkif_copy_from_grants(struct blkfront_info *info,
+				   struct blk_shadow *s)
+{
+	struct request *req = (struct request *)s->request;
+	struct blkfront_grant **grants = blkif_shadow_grants(s);
+	struct scatterlist *sg;
+	unsigned int nseg;
+	char *dst;
+	int i;
+
+	nseg = blk_rq_map_sg(req->q, req, info->sg);
+	BUG_ON(nseg != blkif_shadow_segments(s));
+
+	for_each_sg(info->sg, sg, nseg, i) {
+		dst = kmap_atomic(sg_page(sg), KM_IRQ0);
+		memcpy(dst + sg->offset,
+		       (char *)page_address(grants[i]->page) + sg->offset,
+		       sg->length);
+		kunmap_atomic(dst, KM_IRQ0);
+	}
+}
+
 static int xlbd_reserve_minors(unsigned int minor, unsigned int nr)
 {
 	unsigned int end = minor + nr;
@@ -246,6 +496,75 @@ static int blkif_ioctl(struct block_device *bdev, fmode_t mode,
 	return 0;
 }
 
+/* The backend traces the request under the same vbd and id. */
+static void blkif_trace_queue(struct blkfront_info *info, struct request *req,
+			      unsigned long id, unsigned int op,
+			      unsigned int nseg)
+{
+	trace_xen_blkfront_queue(info->handle, id, op, blk_rq_pos(req), nseg);
+	blk_add_trace_msg(req->q, "blkif vbd %u id %lu queued",
+			  info->handle, id);
+}
+
+/* A discard carries no data, so needs no grants. */
+static int blkif_queue_discard(struct blkfront_info *info, struct request *req)
+{
+	struct blkif_request_discard *ring_req;
+	unsigned long id;
+
+	ring_req = (struct blkif_request_discard *)
+		RING_GET_REQUEST(&info->ring, info->ring.req_prod_pvt);
+	id = get_id_from_freelist(info);
+	info->shadow[id].request = (unsigned long)req;
+	info->shadow[id].persistent = 0;
+
+	memset(ring_req, 0, sizeof(*ring_req));
+	ring_req->operation = BLKIF_OP_DISCARD;
+	ring_req->handle = info->handle;
+	ring_req->id = id;
+	ring_req->sector_number = (blkif_sector_t)blk_rq_pos(req);
+	ring_req->nr_sectors = blk_rq_sectors(req);
+
+	info->ring.req_prod_pvt++;
+
+	/* Keep a private copy so we can reissue requests when recovering. */
+	info->shadow[id].req = *(struct blkif_request *)ring_req;
+
+	blkif_trace_queue(info, req, id, BLKIF_OP_DISCARD, 0);
+	return 0;
+}
+
+/* Nor does a cache flush. */
+static int blkif_queue_flush(struct blkfront_info *info, struct request *req)
+{
+	struct blkif_request *ring_req;
+	unsigned long id;
+
+	ring_req = RING_GET_REQUEST(&info->ring, info->ring.req_prod_pvt);
+	id = get_id_from_freelist(info);
+	info->shadow[id].request = (unsigned long)req;
+	info->shadow[id].persistent = 0;
+
+	memset(ring_req, 0, sizeof(*ring_req));
+	ring_req->operation = BLKIF_OP_FLUSH_DISKCACHE;
+	ring_req->handle = info->handle;
+	ring_req->id = id;
+
+	info->ring.req_prod_pvt++;
+
+	/* Keep a private copy so we can reissue requests when recovering. */
+	info->shadow[id].req = *ring_req;
+
+	blkif_trace_queue(info, req, id, BLKIF_OP_FLUSH_DISKCACHE, 0);
+	return 0;
+}
+
+static int blkif_flush_rq(struct request *req)
+{
+	return req->cmd_type == REQ_TYPE_LINUX_BLOCK &&
+	       req->cmd[0] == REQ_LB_OP_FLUSH;
+}
+
 /*
  * blkif_queue_request
  *
@@ -261,8 +580,12 @@ static int blkif_queue_request(struct request *req)
 	struct blkfront_info *info = req->rq_disk->private_data;
 	unsigned long buffer_mfn;
 	struct blkif_request *ring_req;
+	struct blkif_request_indirect *ind_req = NULL;
+	struct blkif_request_segment *segs;
+	struct blkfront_grant **grants, *gnt;
+	unsigned long *frames;
 	unsigned long id;
-	unsigned int fsect, lsect;
+	unsigned int fsect, lsect, nseg, nr_grefs, operation;
 	int i, ref;
 	grant_ref_t gref_head;
 	struct scatterlist *sg;
@@ -270,13 +593,31 @@ static int blkif_queue_request(struct request *req)
 	if (unlikely(info->connected != BLKIF_STATE_CONNECTED))
 		return 1;
 
-	if (gnttab_alloc_grant_references(
-		BLKIF_MAX_SEGMENTS_PER_REQUEST, &gref_head) < 0) {
+	if (unlikely(blk_discard_rq(req)))
+		return blkif_queue_discard(info, req);
+
+	if (unlikely(blkif_flush_rq(req)))
+		return blkif_queue_flush(info, req);
+
+	nseg = blk_rq_map_sg(req->q, req, info->sg);
+	BUG_ON(nseg > blkif_max_segments(info));
+
+	/* Wait for completions to hand persistent grants back. */
+	if (info->feature_persistent && info->nr_free_grants < nseg)
+		return 1;
+
+	/* Beyond a ring slot's segments, list them in granted pages. */
+	nr_grefs = info->feature_persistent ? 0 : nseg;
+	if (nseg > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+		nr_grefs += BLKFRONT_INDIRECT_PAGES(nseg);
+
+	if (nr_grefs &&
+	    gnttab_alloc_grant_references(nr_grefs, &gref_head) < 0) {
 		gnttab_request_free_callback(
 			&info->callback,
 			blkif_restart_queue_callback,
 			info,
-			BLKIF_MAX_SEGMENTS_PER_REQUEST);
+			nr_grefs);
 		return 1;
 	}
 
@@ -285,47 +626,96 @@ static int blkif_queue_request(struct request *req)
 	id = get_id_from_freelist(info);
 	info->shadow[id].request = (unsigned long)req;
 
-	ring_req->id = id;
-	ring_req->sector_number = (blkif_sector_t)blk_rq_pos(req);
-	ring_req->handle = info->handle;
-
-	ring_req->operation = rq_data_dir(req) ?
-		BLKIF_OP_WRITE : BLKIF_OP_READ;
-	if (blk_barrier_rq(req))
-		ring_req->operation = BLKIF_OP_WRITE_BARRIER;
-
-	ring_req->nr_segments = blk_rq_map_sg(req->q, req, info->sg);
-	BUG_ON(ring_req->nr_segments > BLKIF_MAX_SEGMENTS_PER_REQUEST);
+	operation = rq_data_dir(req) ? BLKIF_OP_WRITE : BLKIF_OP_READ;
+	/* With cache flushes around it, the barrier is an ordinary write. */
+	if (blk_barrier_rq(req) &&
+	    !(info->feature_barrier & QUEUE_ORDERED_DO_PREFLUSH))
+		operation = BLKIF_OP_WRITE_BARRIER;
+
+	if (nseg > BLKIF_MAX_SEGMENTS_PER_REQUEST) {
+		ind_req = (struct blkif_request_indirect *)ring_req;
+		ind_req->operation = BLKIF_OP_INDIRECT;
+		ind_req->indirect_op = operation;
+		ind_req->nr_segments = nseg;
+		ind_req->id = id;
+		ind_req->sector_number = (blkif_sector_t)blk_rq_pos(req);
+		ind_req->handle = info->handle;
+		segs = info->shadow[id].indirect;
+		frames = info->shadow[id].indirect_frame;
+		grants = info->shadow[id].indirect_grants;
+	} else {
+		ring_req->id = id;
+		ring_req->sector_number = (blkif_sector_t)blk_rq_pos(req);
+		ring_req->handle = info->handle;
+		ring_req->operation = operation;
+		ring_req->nr_segments = nseg;
+		segs = ring_req->seg;
+		frames = info->shadow[id].frame;
+		grants = info->shadow[id].grants;
+	}
+	info->shadow[id].persistent = info->feature_persistent;
 
-	for_each_sg(info->sg, sg, ring_req->nr_segments, i) {
-		buffer_mfn = pfn_to_mfn(page_to_pfn(sg_page(sg)));
+	for_each_sg(info->sg, sg, nseg, i) {
 		fsect = sg->offset >> 9;
 		lsect = fsect + (sg->length >> 9) - 1;
-		/* install a grant reference. */
-		ref = gnttab_claim_grant_reference(&gref_head);
-		BUG_ON(ref == -ENOSPC);
 
-		gnttab_grant_foreign_access_ref(
-				ref,
-				info->xbdev->otherend_id,
-				buffer_mfn,
-				rq_data_dir(req) );
+		if (info->feature_persistent) {
+			/* Bounce through a page the backend keeps mapped. */
+			gnt = blkif_get_grant(info);
+			if (rq_data_dir(req)) {
+				char *src = kmap_atomic(sg_page(sg), KM_IRQ0);
+
+				memcpy((char *)page_address(gnt->page) +
+				       sg->offset, src + sg->offset,
+				       sg->length);
+				kunmap_atomic(src, KM_IRQ0);
+			}
+			grants[i] = gnt;
+			ref = gnt->gref;
+			buffer_mfn = pfn_to_mfn(page_to_pfn(gnt->page));
+		} else {
+			buffer_mfn = pfn_to_mfn(page_to_pfn(sg_page(sg)));
+			/* install a grant reference. */
+			ref = gnttab_claim_grant_reference(&gref_head);
+			BUG_ON(ref == -ENOSPC);
+
+			gnttab_grant_foreign_access_ref(
+					ref,
+					info->xbdev->otherend_id,
+					buffer_mfn,
+					rq_data_dir(req) );
+		}
 
-		info->shadow[id].frame[i] = mfn_to_pfn(buffer_mfn);
-		ring_req->seg[i] =
+		frames[i] = mfn_to_pfn(buffer_mfn);
+		segs[i] =
 				(struct blkif_request_segment) {
 					.gref       = ref,
 					.first_sect = fsect,
 					.last_sect  = lsect };
 	}
 
+	/* The backend only reads the segment list. */
+	for (i = 0; ind_req && i < BLKFRONT_INDIRECT_PAGES(nseg); i++) {
+		ref = gnttab_claim_grant_reference(&gref_head);
+		BUG_ON(ref == -ENOSPC);
+
+		gnttab_grant_foreign_access_ref(
+				ref,
+				info->xbdev->otherend_id,
+				virt_to_mfn((char *)segs + i * PAGE_SIZE),
+				1);
+		ind_req->indirect_grefs[i] = ref;
+	}
+
 	info->ring.req_prod_pvt++;
 
 	/* Keep a private copy so we can reissue requests when recovering. */
 	info->shadow[id].req = *ring_req;
 
-	gnttab_free_grant_references(gref_head);
+	if (nr_grefs)
+		gnttab_free_grant_references(gref_head);
 
+	blkif_trace_queue(info, req, id, operation, nseg);
 	return 0;
 }
 
@@ -335,94 +725,149 @@ static inline void flush_requests(struct blkfront_info *info)
 	int notify;
 
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&info->ring, notify);
+	trace_xen_blkfront_push(info->handle, info->ring.req_prod_pvt, notify);
 
 	if (notify)
 		notify_remote_via_irq(info->irq);
 }
 
 /*
- * do_blkif_request
- *  read a block; request is in a request queue
+ * blkif_queue_rq
+ *  hand a request to the ring; called with irqs off
  */
-static void do_blkif_request(struct request_queue *rq)
+static int blkif_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
 {
-	struct blkfront_info *info = NULL;
-	struct request *req;
-	int queued;
-
-	pr_debug("Entered do_blkif_request\n");
-
-	queued = 0;
+	struct blkfront_info *info = hctx->driver_data;
+
+	if (!blk_fs_request(req) && !blkif_flush_rq(req))
+		return BLK_MQ_RQ_QUEUE_ERROR;
+
+	pr_debug("do_blk_req %p: cmd %p, sec %lx, "
+		 "(%u/%u) buffer:%p [%s]\n",
+		 req, req->cmd, (unsigned long)blk_rq_pos(req),
+		 blk_rq_cur_sectors(req), blk_rq_sectors(req),
+		 req->buffer, rq_data_dir(req) ? "write" : "read");
+
+	spin_lock(&info->io_lock);
+	if (RING_FULL(&info->ring) || blkif_queue_request(req)) {
+		/* Restarted by kick_pending_request_queues(). */
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock(&info->io_lock);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+	spin_unlock(&info->io_lock);
 
-	while ((req = blk_peek_request(rq)) != NULL) {
-		info = req->rq_disk->private_data;
+	return BLK_MQ_RQ_QUEUE_OK;
+}
 
-		if (RING_FULL(&info->ring))
-			goto wait;
+static void blkif_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	struct blkfront_info *info = hctx->driver_data;
 
-		blk_start_request(req);
+	spin_lock(&info->io_lock);
+	flush_requests(info);
+	spin_unlock(&info->io_lock);
+}
 
-		if (!blk_fs_request(req)) {
-			__blk_end_request_all(req, -EIO);
-			continue;
-		}
+static struct blk_mq_ops blkfront_mq_ops = {
+	.queue_rq	= blkif_queue_rq,
+	.commit_rqs	= blkif_commit_rqs,
+};
 
-		pr_debug("do_blk_req %p: cmd %p, sec %lx, "
-			 "(%u/%u) buffer:%p [%s]\n",
-			 req, req->cmd, (unsigned long)blk_rq_pos(req),
-			 blk_rq_cur_sectors(req), blk_rq_sectors(req),
-			 req->buffer, rq_data_dir(req) ? "write" : "read");
-
-		if (blkif_queue_request(req)) {
-			blk_requeue_request(rq, req);
-wait:
-			/* Avoid pointless unplugs. */
-			blk_stop_queue(rq);
-			break;
-		}
+/* Ensure a merged request will fit in a single I/O ring slot. */
+static void blkif_set_queue_limits(struct blkfront_info *info,
+				   struct request_queue *rq)
+{
+	unsigned int segs = blkif_max_segments(info);
 
-		queued++;
-	}
+	blk_queue_max_sectors(rq, max(512U, segs << (PAGE_SHIFT - 9)));
+	blk_queue_max_phys_segments(rq, segs);
+	blk_queue_max_hw_segments(rq, segs);
+}
 
-	if (queued != 0)
-		flush_requests(info);
+/*
+ * Requests are ended from the block softirq on the CPU that submitted
+ * them, where their state is still cached, rather than all on the CPU
+ * the event channel is bound to.  The ring itself was done with when
+ * blkif_do_interrupt() handed them over.
+ */
+static void blkif_softirq_done(struct request *req)
+{
+	blk_mq_end_request(req, req->errors);
 }
 
+static int blkif_poll(struct request_queue *q);
+
 static int xlvbd_init_blk_queue(struct blkfront_info *info,
 				struct gendisk *gd, u16 sector_size)
 {
+	struct blk_mq_reg reg = {
+		.ops		= &blkfront_mq_ops,
+		.nr_hw_queues	= 1,
+		.queue_depth	= BLK_RING_SIZE,
+		.numa_node	= -1,
+	};
 	struct request_queue *rq;
+	unsigned long ra_pages;
 
-	rq = blk_init_queue(do_blkif_request, &info->io_lock);
+	/* One ring, so one hardware queue behind the per-cpu ones. */
+	rq = blk_mq_init_queue(&reg, info);
 	if (rq == NULL)
 		return -1;
 
-	queue_flag_set_unlocked(QUEUE_FLAG_VIRT, rq);
+	/*
+	 * Without a hint from the backend, assume the virtual disk does
+	 * not care about seeks, as it is usually backed by SAN or flash.
+	 */
+	if (!info->rotational)
+		queue_flag_set_unlocked(QUEUE_FLAG_VIRT, rq);
 
 	/* Hard sector size and max sectors impersonate the equiv. hardware. */
 	blk_queue_logical_block_size(rq, sector_size);
-	blk_queue_max_sectors(rq, 512);
+	blkif_set_queue_limits(info, rq);
+
+	/*
+	 * The default readahead window is about one full-sized request.
+	 * Size it to keep several in flight instead, so that a streaming
+	 * reader keeps the ring busy across the round trip to the backend.
+	 */
+	ra_pages = min_t(unsigned long,
+			 BLKIF_RA_REQUESTS * blkif_max_segments(info),
+			 BLKIF_MAX_RA_BYTES / PAGE_CACHE_SIZE);
+	if (rq->backing_dev_info.ra_pages < ra_pages)
+		rq->backing_dev_info.ra_pages = ra_pages;
 
 	/* Each segment in a request is up to an aligned page in size. */
 	blk_queue_segment_boundary(rq, PAGE_SIZE - 1);
 	blk_queue_max_segment_size(rq, PAGE_SIZE);
 
-	/* Ensure a merged request will fit in a single I/O ring slot. */
-	blk_queue_max_phys_segments(rq, BLKIF_MAX_SEGMENTS_PER_REQUEST);
-	blk_queue_max_hw_segments(rq, BLKIF_MAX_SEGMENTS_PER_REQUEST);
-
 	/* Make sure buffer addresses are sector-aligned. */
 	blk_queue_dma_alignment(rq, 511);
 
 	/* Make sure we don't use bounce buffers. */
 	blk_queue_bounce_limit(rq, BLK_BOUNCE_ANY);
 
+	blk_queue_softirq_done(rq, blkif_softirq_done);
+	blk_queue_poll_fn(rq, blkif_poll);
+
+	if (info->feature_discard) {
+		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, rq);
+		blk_queue_max_discard_sectors(rq,
+			min_t(sector_t, get_capacity(gd), UINT_MAX));
+	}
+
 	gd->queue = rq;
 
 	return 0;
 }
 
 
+static void blkif_prepare_flush(struct request_queue *q, struct request *rq)
+{
+	rq->cmd_type = REQ_TYPE_LINUX_BLOCK;
+	rq->cmd[0] = REQ_LB_OP_FLUSH;
+}
+
 static int xlvbd_barrier(struct blkfront_info *info)
 {
 	int err;
@@ -430,12 +875,14 @@ static int xlvbd_barrier(struct blkfront_info *info)
 
 	switch (info->feature_barrier) {
 	case QUEUE_ORDERED_DRAIN:	barrier = "enabled (drain)"; break;
+	case QUEUE_ORDERED_DRAIN_FLUSH:	barrier = "enabled (drain, flush)"; break;
 	case QUEUE_ORDERED_TAG:		barrier = "enabled (tag)"; break;
 	case QUEUE_ORDERED_NONE:	barrier = "disabled"; break;
 	default:			return -EINVAL;
 	}
 
-	err = blk_queue_ordered(info->rq, info->feature_barrier, NULL);
+	err = blk_queue_ordered(info->rq, info->feature_barrier,
+				blkif_prepare_flush);
 
 	if (err)
 		return err;
@@ -616,7 +1063,7 @@ static void xlvbd_release_gendisk(struct blkfront_info *info)
 	spin_lock_irqsave(&info->io_lock, flags);
 
 	/* No more blkif_request(). */
-	blk_stop_queue(info->rq);
+	blk_mq_stop_hw_queues(info->rq);
 
 	/* No more gnttab callback work. */
 	gnttab_cancel_free_callback(&info->callback);
@@ -638,24 +1085,45 @@ static void xlvbd_release_gendisk(struct blkfront_info *info)
 	info->gd = NULL;
 }
 
+/*
+ * Must be called without io_lock: running the queue takes it in
+ * blkif_queue_rq().
+ */
 static void kick_pending_request_queues(struct blkfront_info *info)
 {
-	if (!RING_FULL(&info->ring)) {
-		/* Re-enable calldowns. */
-		blk_start_queue(info->rq);
-		/* Kick things off immediately. */
-		do_blkif_request(info->rq);
-	}
+	if (!RING_FULL(&info->ring))
+		blk_mq_start_stopped_hw_queues(info->rq, false);
 }
 
 static void blkif_restart_queue(struct work_struct *work)
 {
 	struct blkfront_info *info = container_of(work, struct blkfront_info, work);
 
-	spin_lock_irq(&info->io_lock);
 	if (info->connected == BLKIF_STATE_CONNECTED)
 		kick_pending_request_queues(info);
-	spin_unlock_irq(&info->io_lock);
+}
+
+static void blkif_free_ring(struct blkfront_info *info)
+{
+	unsigned int i, nr_pages = 1U << info->ring_order;
+	int busy = 0;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (info->ring_ref[i] == GRANT_INVALID_REF)
+			continue;
+		if (gnttab_end_foreign_access_ref(info->ring_ref[i], 0))
+			gnttab_free_grant_reference(info->ring_ref[i]);
+		else
+			busy = 1;
+		info->ring_ref[i] = GRANT_INVALID_REF;
+	}
+
+	/* A page the backend still maps must not be reused. */
+	if (busy)
+		printk(KERN_WARNING "blkfront: leaking ring still in use\n");
+	else
+		free_pages((unsigned long)info->ring.sring, info->ring_order);
+	info->ring.sring = NULL;
 }
 
 static void blkif_free(struct blkfront_info *info, int suspend)
@@ -666,7 +1134,7 @@ static void blkif_free(struct blkfront_info *info, int suspend)
 		BLKIF_STATE_SUSPENDED : BLKIF_STATE_DISCONNECTED;
 	/* No more blkif_request(). */
 	if (info->rq)
-		blk_stop_queue(info->rq);
+		blk_mq_stop_hw_queues(info->rq);
 	/* No more gnttab callback work. */
 	gnttab_cancel_free_callback(&info->callback);
 	spin_unlock_irq(&info->io_lock);
@@ -675,34 +1143,47 @@ static void blkif_free(struct blkfront_info *info, int suspend)
 	flush_scheduled_work();
 
 	/* Free resources associated with old device channel. */
-	if (info->ring_ref != GRANT_INVALID_REF) {
-		gnttab_end_foreign_access(info->ring_ref, 0,
-					  (unsigned long)info->ring.sring);
-		info->ring_ref = GRANT_INVALID_REF;
-		info->ring.sring = NULL;
-	}
+	if (info->ring.sring)
+		blkif_free_ring(info);
+	blkif_release_grants(info);
 	if (info->irq)
 		unbind_from_irqhandler(info->irq, info);
 	info->evtchn = info->irq = 0;
 
 }
 
-static void blkif_completion(struct blk_shadow *s)
+static void blkif_completion(struct blkfront_info *info, struct blk_shadow *s)
 {
+	struct blkif_request_indirect *ind_req;
+	struct blkfront_grant **grants = blkif_shadow_grants(s);
+	unsigned int nseg = blkif_shadow_segments(s);
 	int i;
-	for (i = 0; i < s->req.nr_segments; i++)
-		gnttab_end_foreign_access(s->req.seg[i].gref, 0, 0UL);
+
+	for (i = 0; i < nseg; i++) {
+		if (s->persistent)
+			blkif_put_grant(info, grants[i]);
+		else if (s->req.operation != BLKIF_OP_INDIRECT)
+			gnttab_end_foreign_access(s->req.seg[i].gref, 0, 0UL);
+		else
+			gnttab_end_foreign_access(s->indirect[i].gref, 0, 0UL);
+	}
+
+	if (s->req.operation != BLKIF_OP_INDIRECT)
+		return;
+
+	ind_req = (struct blkif_request_indirect *)&s->req;
+	for (i = 0; i < BLKFRONT_INDIRECT_PAGES(nseg); i++)
+		gnttab_end_foreign_access(ind_req->indirect_grefs[i], 1, 0UL);
 }
 
-static void
-blkif_do_interrupt(unsigned long data)
+/* Returns the number of responses consumed. */
+static int blkif_reap_responses(struct blkfront_info *info)
 {
-	struct blkfront_info *info = (struct blkfront_info *)data;
 	struct request *req;
 	struct blkif_response *bret;
 	RING_IDX i, rp;
 	unsigned long flags;
-	int error;
+	int error, found = 0;
 
 	spin_lock_irqsave(&info->io_lock, flags);
 
@@ -720,17 +1201,43 @@ blkif_do_interrupt(unsigned long data)
 		id   = bret->id;
 		req  = (struct request *)info->shadow[id].request;
 
-		blkif_completion(&info->shadow[id]);
+		trace_xen_blkfront_response(info->handle, id, bret->operation,
+					    bret->status);
+		blk_add_trace_msg(req->q, "blkif vbd %u id %lu status %d",
+				  info->handle, id, bret->status);
+
+		if (bret->operation == BLKIF_OP_READ &&
+		    bret->status == BLKIF_RSP_OKAY &&
+		    info->shadow[id].persistent)
+			blkif_copy_from_grants(info, &info->shadow[id]);
+
+		blkif_completion(info, &info->shadow[id]);
 
 		add_id_to_freelist(info, id);
 
 		error = (bret->status == BLKIF_RSP_OKAY) ? 0 : -EIO;
 		switch (bret->operation) {
-		case BLKIF_OP_WRITE_BARRIER:
+		case BLKIF_OP_DISCARD:
 			if (unlikely(bret->status == BLKIF_RSP_EOPNOTSUPP)) {
-				printk(KERN_WARNING "blkfront: %s: write barrier op failed\n",
+				printk(KERN_WARNING "blkfront: %s: discard op failed\n",
 				       info->gd->disk_name);
 				error = -EOPNOTSUPP;
+				info->feature_discard = 0;
+				spin_lock(info->rq->queue_lock);
+				queue_flag_clear(QUEUE_FLAG_DISCARD, info->rq);
+				spin_unlock(info->rq->queue_lock);
+			}
+			req->errors = error;
+			blk_complete_request(req);
+			break;
+		case BLKIF_OP_FLUSH_DISKCACHE:
+		case BLKIF_OP_WRITE_BARRIER:
+			if (unlikely(bret->status == BLKIF_RSP_EOPNOTSUPP)) {
+				printk(KERN_WARNING "blkfront: %s: %s op failed\n",
+				       info->gd->disk_name,
+				       bret->operation == BLKIF_OP_FLUSH_DISKCACHE ?
+				       "flush diskcache" : "write barrier");
+				error = -EOPNOTSUPP;
 				info->feature_barrier = QUEUE_ORDERED_NONE;
 				xlvbd_barrier(info);
 			}
@@ -741,13 +1248,15 @@ blkif_do_interrupt(unsigned long data)
 				dev_dbg(&info->xbdev->dev, "Bad return from blkdev data "
 					"request: %x\n", bret->status);
 
-			__blk_end_request_all(req, error);
+			req->errors = error;
+			blk_complete_request(req);
 			break;
 		default:
 			BUG();
 		}
 	}
 
+	found += i - info->ring.rsp_cons;
 	info->ring.rsp_cons = i;
 
 	if (i != info->ring.req_prod_pvt) {
@@ -758,57 +1267,74 @@ blkif_do_interrupt(unsigned long data)
 	} else
 		info->ring.sring->rsp_event = i + 1;
 
+	spin_unlock_irqrestore(&info->io_lock, flags);
+
 	kick_pending_request_queues(info);
+	return found;
 
 out:
 	spin_unlock_irqrestore(&info->io_lock, flags);
+	return 0;
 }
 
-
+/*
+ * Runs from the irq thread.  The completions are only raised here, with
+ * bottom halves off they run when we are done rather than from ksoftirqd.
+ */
 static irqreturn_t
 blkif_interrupt(int irq, void *dev_id)
 {
-	struct blkfront_info *info = (struct blkfront_info *)dev_id;
-
-	tasklet_schedule(&info->tasklet);
+	local_bh_disable();
+	blkif_reap_responses(dev_id);
+	local_bh_enable();
 
 	return IRQ_HANDLED;
 }
 
+/* Called from blk_poll() for waiters spinning on the ring. */
+static int blkif_poll(struct request_queue *q)
+{
+	return blkif_reap_responses(q->queuedata);
+}
+
 
 static int setup_blkring(struct xenbus_device *dev,
 			 struct blkfront_info *info)
 {
 	struct blkif_sring *sring;
+	unsigned int i, nr_pages = 1U << info->ring_order;
 	int err;
 
-	info->ring_ref = GRANT_INVALID_REF;
+	for (i = 0; i < nr_pages; i++)
+		info->ring_ref[i] = GRANT_INVALID_REF;
 
-	sring = (struct blkif_sring *)__get_free_page(GFP_NOIO | __GFP_HIGH);
+	sring = (struct blkif_sring *)__get_free_pages(GFP_NOIO | __GFP_HIGH,
+						       info->ring_order);
 	if (!sring) {
 		xenbus_dev_fatal(dev, -ENOMEM, "allocating shared ring");
 		return -ENOMEM;
 	}
 	SHARED_RING_INIT(sring);
-	FRONT_RING_INIT(&info->ring, sring, PAGE_SIZE);
+	FRONT_RING_INIT(&info->ring, sring, PAGE_SIZE * nr_pages);
 
-	sg_init_table(info->sg, BLKIF_MAX_SEGMENTS_PER_REQUEST);
+	sg_init_table(info->sg, BLKFRONT_MAX_INDIRECT_SEGMENTS);
 
-	err = xenbus_grant_ring(dev, virt_to_mfn(info->ring.sring));
-	if (err < 0) {
-		free_page((unsigned long)sring);
-		info->ring.sring = NULL;
-		goto fail;
+	for (i = 0; i < nr_pages; i++) {
+		err = xenbus_grant_ring(dev,
+					virt_to_mfn((char *)sring + i * PAGE_SIZE));
+		if (err < 0)
+			goto fail;
+		info->ring_ref[i] = err;
 	}
-	info->ring_ref = err;
 
 	err = xenbus_alloc_evtchn(dev, &info->evtchn);
 	if (err)
 		goto fail;
 
-	err = bind_evtchn_to_irqhandler(info->evtchn,
-					blkif_interrupt,
-					IRQF_SAMPLE_RANDOM, "blkif", info);
+	err = bind_evtchn_to_threaded_irqhandler(info->evtchn,
+						 NULL, blkif_interrupt,
+						 IRQF_SAMPLE_RANDOM, "blkif",
+						 info);
 	if (err <= 0) {
 		xenbus_dev_fatal(dev, err,
 				 "bind_evtchn_to_irqhandler failed");
@@ -829,13 +1355,56 @@ static int talk_to_blkback(struct xenbus_device *dev,
 {
 	const char *message = NULL;
 	struct xenbus_transaction xbt;
+	unsigned int i, max_order, max_segs;
 	int err;
 
+	err = xenbus_scanf(XBT_NIL, dev->otherend,
+			   "max-ring-page-order", "%u", &max_order);
+	if (err != 1)
+		max_order = 0;
+	info->ring_order = min(max_order, blkif_max_ring_order);
+
+	err = xenbus_scanf(XBT_NIL, dev->otherend,
+			   "feature-max-indirect-segments", "%u", &max_segs);
+	if (err != 1)
+		max_segs = 0;
+	max_segs = min(max_segs, blkif_max_indirect_segs);
+	info->max_indirect_segs =
+		max_segs > BLKIF_MAX_SEGMENTS_PER_REQUEST ? max_segs : 0;
+
+	err = xenbus_scanf(XBT_NIL, dev->otherend,
+			   "feature-persistent", "%d", &info->feature_persistent);
+	if (err != 1)
+		info->feature_persistent = 0;
+	info->feature_persistent &= blkif_feature_persistent;
+
 	/* Create shared ring, alloc event channel. */
 	err = setup_blkring(dev, info);
 	if (err)
 		goto out;
 
+	/* Requests in flight across a resume are sorted out on recovery. */
+	if (info->connected != BLKIF_STATE_SUSPENDED)
+		blkif_init_freelist(info);
+
+	if (info->max_indirect_segs && blkif_alloc_indirect(info)) {
+		dev_warn(&dev->dev, "no memory for indirect requests\n");
+		info->max_indirect_segs = 0;
+	}
+
+	/* However small the pool, the largest request must fit in it. */
+	info->max_grants = max(blkif_max_segments(info),
+			       min(blkif_max_persistent_gnts,
+				   RING_SIZE(&info->ring) *
+				   BLKIF_MAX_SEGMENTS_PER_REQUEST));
+	if (info->feature_persistent && blkif_fill_grants(info)) {
+		dev_warn(&dev->dev, "no memory for persistent grants\n");
+		spin_lock_irq(&info->io_lock);
+		info->feature_persistent = 0;
+		blkif_release_grants(info);
+		spin_unlock_irq(&info->io_lock);
+	}
+
 again:
 	err = xenbus_transaction_start(&xbt);
 	if (err) {
@@ -843,11 +1412,31 @@ again:
 		goto destroy_blkring;
 	}
 
-	err = xenbus_printf(xbt, dev->nodename,
-			    "ring-ref", "%u", info->ring_ref);
-	if (err) {
-		message = "writing ring-ref";
-		goto abort_transaction;
+	if (info->ring_order == 0) {
+		err = xenbus_printf(xbt, dev->nodename,
+				    "ring-ref", "%u", info->ring_ref[0]);
+		if (err) {
+			message = "writing ring-ref";
+			goto abort_transaction;
+		}
+	} else {
+		err = xenbus_printf(xbt, dev->nodename,
+				    "ring-page-order", "%u", info->ring_order);
+		if (err) {
+			message = "writing ring-page-order";
+			goto abort_transaction;
+		}
+		for (i = 0; i < (1U << info->ring_order); i++) {
+			char node[16];
+
+			snprintf(node, sizeof(node), "ring-ref%u", i);
+			err = xenbus_printf(xbt, dev->nodename,
+					    node, "%u", info->ring_ref[i]);
+			if (err) {
+				message = "writing ring-ref";
+				goto abort_transaction;
+			}
+		}
 	}
 	err = xenbus_printf(xbt, dev->nodename,
 			    "event-channel", "%u", info->evtchn);
@@ -861,6 +1450,12 @@ again:
 		message = "writing protocol";
 		goto abort_transaction;
 	}
+	err = xenbus_printf(xbt, dev->nodename, "feature-persistent", "%d",
+			    info->feature_persistent);
+	if (err) {
+		message = "writing feature-persistent";
+		goto abort_transaction;
+	}
 
 	err = xenbus_transaction_end(xbt, 0);
 	if (err) {
@@ -893,7 +1488,7 @@ again:
 static int blkfront_probe(struct xenbus_device *dev,
 			  const struct xenbus_device_id *id)
 {
-	int err, vdevice, i;
+	int err, vdevice;
 	struct blkfront_info *info;
 
 	/* FIXME: Use dynamic device id if this is not set. */
@@ -950,77 +1545,116 @@ static int blkfront_probe(struct xenbus_device *dev,
 	info->connected = BLKIF_STATE_DISCONNECTED;
 	INIT_WORK(&info->work, blkif_restart_queue);
 	spin_lock_init(&info->io_lock);
-	tasklet_init(&info->tasklet, blkif_do_interrupt, (unsigned long)info);
-
-	for (i = 0; i < BLK_RING_SIZE; i++)
-		info->shadow[i].req.id = i+1;
-	info->shadow[BLK_RING_SIZE-1].req.id = 0x0fffffff;
+	INIT_LIST_HEAD(&info->grants);
 
 	/* Front end dir is a number, which is used as the id. */
 	info->handle = simple_strtoul(strrchr(dev->nodename, '/')+1, NULL, 0);
 	dev_set_drvdata(&dev->dev, info);
 
-	err = talk_to_blkback(dev, info);
-	if (err) {
-		kfree(info);
-		dev_set_drvdata(&dev->dev, NULL);
-		return err;
-	}
-
+	/*
+	 * The ring is set up once the backend reaches InitWait, as only
+	 * then has it published how large a ring it accepts.
+	 */
 	return 0;
 }
 
 
+/* Rewrite any grant references invalidated by susp/resume. */
+static void blkif_regrant(struct blkfront_info *info, struct blk_shadow *s)
+{
+	struct blkif_request_indirect *ind_req;
+	int readonly = rq_data_dir((struct request *)s->request);
+	domid_t domid = info->xbdev->otherend_id;
+	int i;
+
+	/* Persistent grants are writable whichever way the data goes. */
+	if (s->persistent)
+		readonly = 0;
+
+	if (s->req.operation != BLKIF_OP_INDIRECT) {
+		for (i = 0; i < s->req.nr_segments; i++)
+			gnttab_grant_foreign_access_ref(s->req.seg[i].gref,
+				domid, pfn_to_mfn(s->frame[i]), readonly);
+		return;
+	}
+
+	ind_req = (struct blkif_request_indirect *)&s->req;
+	for (i = 0; i < ind_req->nr_segments; i++)
+		gnttab_grant_foreign_access_ref(s->indirect[i].gref,
+			domid, pfn_to_mfn(s->indirect_frame[i]), readonly);
+	for (i = 0; i < BLKFRONT_INDIRECT_PAGES(ind_req->nr_segments); i++)
+		gnttab_grant_foreign_access_ref(ind_req->indirect_grefs[i],
+			domid, virt_to_mfn((char *)s->indirect + i * PAGE_SIZE),
+			1);
+}
+
 static int blkif_recover(struct blkfront_info *info)
 {
+	struct request *rq, *tmp;
+	struct blk_shadow *s;
+	unsigned int nseg;
+	LIST_HEAD(requeue);
 	int i;
-	struct blkif_request *req;
-	struct blk_shadow *copy;
-	int j;
-
-	/* Stage 1: Make a safe copy of the shadow state. */
-	copy = kmalloc(sizeof(info->shadow),
-		       GFP_NOIO | __GFP_REPEAT | __GFP_HIGH);
-	if (!copy)
-		return -ENOMEM;
-	memcpy(copy, info->shadow, sizeof(info->shadow));
 
-	/* Stage 2: Set up free list. */
-	memset(&info->shadow, 0, sizeof(info->shadow));
-	for (i = 0; i < BLK_RING_SIZE; i++)
-		info->shadow[i].req.id = i+1;
-	info->shadow_free = info->ring.req_prod_pvt;
-	info->shadow[BLK_RING_SIZE-1].req.id = 0x0fffffff;
+	spin_lock_irq(&info->io_lock);
 
-	/* Stage 3: Find pending requests and requeue them. */
+	/*
+	 * Stage 1: Set up free list.  Requests in flight keep their ids,
+	 * and with them their shadow state and indirect buffers.
+	 */
+	blkif_init_freelist(info);
+
+	/* Stage 2: Find pending requests and requeue them. */
 	for (i = 0; i < BLK_RING_SIZE; i++) {
+		s = &info->shadow[i];
+		rq = (struct request *)s->request;
+
 		/* Not in use? */
-		if (copy[i].request == 0)
+		if (!rq)
 			continue;
 
-		/* Grab a request slot and copy shadow state into it. */
-		req = RING_GET_REQUEST(&info->ring, info->ring.req_prod_pvt);
-		*req = copy[i].req;
+		nseg = blkif_shadow_segments(s);
 
-		/* We get a new request id, and must reset the shadow state. */
-		req->id = get_id_from_freelist(info);
-		memcpy(&info->shadow[req->id], &copy[i], sizeof(copy[i]));
+		/*
+		 * The new backend may allow a smaller ring than the old
+		 * one: give what no longer fits back to the block layer.
+		 * A request with more segments than it accepts can no
+		 * longer be expressed at all.
+		 */
+		if (RING_FULL(&info->ring) || nseg > blkif_max_segments(info)) {
+			blkif_completion(info, s);
+			if (i < RING_SIZE(&info->ring))
+				add_id_to_freelist(info, i);
+			else
+				s->request = 0;
+
+			if (nseg <= blkif_max_segments(info)) {
+				list_add_tail(&rq->queuelist, &requeue);
+			} else {
+				printk(KERN_WARNING "blkfront: %s: failing "
+				       "%u-segment request on resume\n",
+				       info->gd->disk_name, nseg);
+				blk_mq_end_request(rq, -EIO);
+			}
+			continue;
+		}
 
-		/* Rewrite any grant references invalidated by susp/resume. */
-		for (j = 0; j < req->nr_segments; j++)
-			gnttab_grant_foreign_access_ref(
-				req->seg[j].gref,
-				info->xbdev->otherend_id,
-				pfn_to_mfn(info->shadow[req->id].frame[j]),
-				rq_data_dir(
-					(struct request *)
-					info->shadow[req->id].request));
-		info->shadow[req->id].req = *req;
+		blkif_regrant(info, s);
 
+		/* Grab a request slot and copy shadow state into it. */
+		*RING_GET_REQUEST(&info->ring, info->ring.req_prod_pvt) = s->req;
 		info->ring.req_prod_pvt++;
 	}
 
-	kfree(copy);
+	blkif_set_queue_limits(info, info->rq);
+
+	spin_unlock_irq(&info->io_lock);
+
+	/* Requeueing takes the lock blkif_queue_rq() is called under. */
+	list_for_each_entry_safe(rq, tmp, &requeue, queuelist) {
+		list_del_init(&rq->queuelist);
+		blk_mq_requeue_request(rq);
+	}
 
 	xenbus_switch_state(info->xbdev, XenbusStateConnected);
 
@@ -1032,11 +1666,11 @@ static int blkif_recover(struct blkfront_info *info)
 	/* Send off requeued requests */
 	flush_requests(info);
 
+	spin_unlock_irq(&info->io_lock);
+
 	/* Kick any other new requests queued since we resumed */
 	kick_pending_request_queues(info);
 
-	spin_unlock_irq(&info->io_lock);
-
 	return 0;
 }
 
@@ -1110,7 +1744,7 @@ static void blkfront_connect(struct blkfront_info *info)
 	unsigned long sector_size;
 	unsigned int binfo;
 	int err;
-	int barrier;
+	int barrier, flush;
 
 	switch (info->connected) {
 	case BLKIF_STATE_CONNECTED:
@@ -1150,9 +1784,22 @@ static void blkfront_connect(struct blkfront_info *info)
 		return;
 	}
 
+	err = xenbus_gather(XBT_NIL, info->xbdev->otherend,
+			    "feature-discard", "%d", &info->feature_discard,
+			    NULL);
+	if (err)
+		info->feature_discard = 0;
+
 	err = xenbus_gather(XBT_NIL, info->xbdev->otherend,
 			    "feature-barrier", "%d", &barrier,
 			    NULL);
+	if (xenbus_scanf(XBT_NIL, info->xbdev->otherend,
+			 "feature-flush-cache", "%d", &flush) != 1)
+		flush = 0;
+
+	if (xenbus_scanf(XBT_NIL, info->xbdev->otherend,
+			 "rotational", "%d", &info->rotational) != 1)
+		info->rotational = 0;
 
 	/*
 	 * If there's no "feature-barrier" defined, then it means
@@ -1164,8 +1811,13 @@ static void blkfront_connect(struct blkfront_info *info)
 	 *
 	 * If barriers are not supported, then there's no much we can
 	 * do, so just set ordering to NONE.
+	 *
+	 * Cache flushes are preferred to either: the backend then need
+	 * not stall its other requests behind each barrier.
 	 */
-	if (err)
+	if (flush)
+		info->feature_barrier = QUEUE_ORDERED_DRAIN_FLUSH;
+	else if (err)
 		info->feature_barrier = QUEUE_ORDERED_DRAIN;
 	else if (barrier)
 		info->feature_barrier = QUEUE_ORDERED_TAG;
@@ -1184,8 +1836,8 @@ static void blkfront_connect(struct blkfront_info *info)
 	/* Kick pending requests. */
 	spin_lock_irq(&info->io_lock);
 	info->connected = BLKIF_STATE_CONNECTED;
-	kick_pending_request_queues(info);
 	spin_unlock_irq(&info->io_lock);
+	kick_pending_request_queues(info);
 
 	add_disk(info->gd);
 
@@ -1203,8 +1855,12 @@ static void blkback_changed(struct xenbus_device *dev,
 	dev_dbg(&dev->dev, "blkfront:blkback_changed to state %d.\n", backend_state);
 
 	switch (backend_state) {
-	case XenbusStateInitialising:
 	case XenbusStateInitWait:
+		if (dev->state == XenbusStateInitialising)
+			talk_to_blkback(dev, info);
+		break;
+
+	case XenbusStateInitialising:
 	case XenbusStateInitialised:
 	case XenbusStateReconfiguring:
 	case XenbusStateReconfigured:
@@ -1242,6 +1898,7 @@ static int blkfront_remove(struct xenbus_device *xbdev)
 	mutex_unlock(&info->mutex);
 
 	if (!bdev) {
+		blkif_free_indirect(info);
 		kfree(info);
 		return 0;
 	}
@@ -1262,6 +1919,7 @@ static int blkfront_remove(struct xenbus_device *xbdev)
 	if (info && !bdev->bd_openers) {
 		xlvbd_release_gendisk(info);
 		disk->private_data = NULL;
+		blkif_free_indirect(info);
 		kfree(info);
 	}
 
@@ -1334,6 +1992,7 @@ static int blkif_release(struct gendisk *disk, fmode_t mode)
 		dev_info(disk_to_dev(bdev->bd_disk), "releasing disk\n");
 		xlvbd_release_gendisk(info);
 		disk->private_data = NULL;
+		blkif_free_indirect(info);
 		kfree(info);
 	}
 
@@ -1364,6 +2023,8 @@ static struct xenbus_driver blkfront = {
 	.resume = blkfront_resume,
 	.otherend_changed = blkback_changed,
 	.is_ready = blkfront_is_ready,
+	/* the disks are named after their vdevice, not the probe order */
+	.driver.async_probe = true,
 };
 
 static int __init xlblk_init(void)
@@ -1371,6 +2032,9 @@ static int __init xlblk_init(void)
 	if (!xen_domain())
 		return -ENODEV;
 
+	if (blkif_max_ring_order > BLKIF_MAX_RING_PAGE_ORDER)
+		blkif_max_ring_order = BLKIF_MAX_RING_PAGE_ORDER;
+
 	if (register_blkdev(XENVBD_MAJOR, DEV_NAME)) {
 		printk(KERN_WARNING "xen_blk: can't get major %d with name %s\n",
 		       XENVBD_MAJOR, DEV_NAME);
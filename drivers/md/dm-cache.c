@@ -0,0 +1,781 @@
+/*
+ * A target that caches the hot blocks of a slow origin device on a
+ * faster cache device, such as a local SSD in front of SAN storage.
+ *
+ * The cache is write-through: every write goes to the origin, and
+ * blocks which are cached also get their copy on the cache device
+ * updated.  The mapping of origin blocks to cache blocks is only kept
+ * in memory, so the cache starts out cold on each table load.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/mempool.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/device-mapper.h>
+
+#include "dm-bio-record.h"
+
+#define DM_MSG_PREFIX "cache"
+
+#define DEFAULT_PROMOTE_THRESHOLD	2
+#define MIN_RECORDS			64
+#define CACHE_IO_PAGES			64
+#define CACHE_COPY_PAGES		256
+
+/*
+ * Upper bound on the promotions copying at any time, so that a burst
+ * of newly hot blocks does not swamp the origin with copy reads.
+ */
+#define MAX_COPIES			128
+
+enum cache_block_state {
+	CB_FREE,	/* on the free list */
+	CB_COPYING,	/* being filled from the origin */
+	CB_STALE,	/* written to while being filled, dropped afterwards */
+	CB_VALID,	/* holds a copy of its origin block, on the lru */
+	CB_DEAD,	/* invalidated, freed once no io is left on it */
+};
+
+struct cache_block {
+	struct hlist_node hash;
+	struct list_head list;
+	sector_t oblock;
+	unsigned state;
+	unsigned inflight;
+};
+
+/*
+ * Recently missed origin blocks.  A block is promoted once it has been
+ * missed threshold times in a row without another block hashing to the
+ * same slot in between, which keeps one-off streaming reads out of the
+ * cache.
+ *
+ * writes counts the uncached writes in flight to any block hashing to
+ * the slot.  Those blocks are not promoted meanwhile, or the copy could
+ * read the origin before the write lands and cache stale data.
+ */
+struct hot_entry {
+	sector_t oblock;
+	unsigned count;
+	unsigned writes;
+};
+
+struct cache_c {
+	struct dm_dev *origin;
+	struct dm_dev *cache;
+
+	sector_t block_size;
+	unsigned block_shift;
+	sector_t nr_cblocks;
+	unsigned promote_threshold;
+
+	spinlock_t lock;
+	struct cache_block *cblocks;
+	struct list_head free;
+	struct list_head lru;
+	struct hlist_head *buckets;
+	unsigned hash_shift;
+	struct hot_entry *hot;
+	unsigned hot_shift;
+	unsigned copies;
+	sector_t nr_valid;
+
+	struct dm_kcopyd_client *kcopyd_client;
+	struct dm_io_client *io_client;
+	mempool_t *record_pool;
+
+	struct work_struct retry_work;
+	struct bio_list retries;
+
+	/* statistics, protected by lock */
+	unsigned long read_hits;
+	unsigned long read_misses;
+	unsigned long write_hits;
+	unsigned long promotions;
+	unsigned long evictions;
+};
+
+/*
+ * State of an io to the cache device: a read, so that end_io can release
+ * the cache block and retry on the origin if it fails, a write-through
+ * or a promotion copy.
+ */
+struct cache_record {
+	struct cache_c *cc;
+	struct cache_block *cb;
+	struct bio *bio;
+	struct dm_bio_details details;
+};
+
+static struct workqueue_struct *kcached_wq;
+static struct kmem_cache *_record_cache;
+
+static sector_t origin_block(struct cache_c *cc, struct dm_target *ti,
+			     sector_t sector)
+{
+	return (sector - ti->begin) >> cc->block_shift;
+}
+
+static sector_t cache_sector(struct cache_c *cc, struct cache_block *cb,
+			     sector_t sector)
+{
+	return ((sector_t)(cb - cc->cblocks) << cc->block_shift) +
+	       (sector & (cc->block_size - 1));
+}
+
+static struct hlist_head *cache_bucket(struct cache_c *cc, sector_t oblock)
+{
+	return cc->buckets + hash_long((unsigned long)oblock, cc->hash_shift);
+}
+
+static struct cache_block *lookup_cblock(struct cache_c *cc, sector_t oblock)
+{
+	struct cache_block *cb;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(cb, pos, cache_bucket(cc, oblock), hash)
+		if (cb->oblock == oblock)
+			return cb;
+
+	return NULL;
+}
+
+/*
+ * Called with lock held.
+ */
+static void free_cblock(struct cache_c *cc, struct cache_block *cb)
+{
+	cb->state = CB_FREE;
+	list_add(&cb->list, &cc->free);
+}
+
+/*
+ * Stop using cb for its origin block, eg. because the cache device
+ * failed io to it.  Called with lock held.
+ */
+static void invalidate_cblock(struct cache_c *cc, struct cache_block *cb)
+{
+	switch (cb->state) {
+	case CB_COPYING:
+		/* the copy completion gets rid of it */
+		cb->state = CB_STALE;
+		break;
+
+	case CB_VALID:
+		hlist_del_init(&cb->hash);
+		list_del(&cb->list);
+		cc->nr_valid--;
+		cb->state = CB_DEAD;
+		if (!cb->inflight)
+			free_cblock(cc, cb);
+		break;
+	}
+}
+
+/*
+ * Called with lock held.
+ */
+static void put_cblock(struct cache_c *cc, struct cache_block *cb)
+{
+	if (!--cb->inflight && cb->state == CB_DEAD)
+		free_cblock(cc, cb);
+}
+
+/*
+ * Get a cache block to promote an origin block into, evicting the
+ * least recently used block nobody is doing io to if there are no free
+ * ones.  Called with lock held.
+ */
+static struct cache_block *alloc_cblock(struct cache_c *cc)
+{
+	struct cache_block *cb;
+
+	if (!list_empty(&cc->free)) {
+		cb = list_first_entry(&cc->free, struct cache_block, list);
+		list_del(&cb->list);
+		return cb;
+	}
+
+	list_for_each_entry(cb, &cc->lru, list) {
+		if (cb->inflight)
+			continue;
+
+		hlist_del_init(&cb->hash);
+		list_del(&cb->list);
+		cc->nr_valid--;
+		cc->evictions++;
+		return cb;
+	}
+
+	return NULL;
+}
+
+static struct hot_entry *hot_entry(struct cache_c *cc, sector_t oblock)
+{
+	return cc->hot + hash_long((unsigned long)oblock, cc->hot_shift);
+}
+
+/*
+ * Count a read miss on oblock, and return whether it is hot enough to
+ * be promoted.  Called with lock held.
+ */
+static int block_is_hot(struct cache_c *cc, sector_t oblock)
+{
+	struct hot_entry *he = hot_entry(cc, oblock);
+
+	if (he->oblock != oblock || !he->count) {
+		he->oblock = oblock;
+		he->count = 0;
+	}
+
+	if (++he->count < cc->promote_threshold || he->writes)
+		return 0;
+
+	he->count = 0;
+	return 1;
+}
+
+static struct cache_record *alloc_record(struct cache_c *cc,
+					 struct cache_block *cb,
+					 struct bio *bio)
+{
+	struct cache_record *rec = mempool_alloc(cc->record_pool, GFP_NOIO);
+
+	rec->cc = cc;
+	rec->cb = cb;
+	rec->bio = bio;
+	if (bio)
+		dm_bio_record(&rec->details, bio);
+	return rec;
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct cache_record *rec = context;
+	struct cache_c *cc = rec->cc;
+	struct cache_block *cb = rec->cb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	cc->copies--;
+
+	if (read_err || write_err || cb->state == CB_STALE) {
+		hlist_del_init(&cb->hash);
+		free_cblock(cc, cb);
+	} else {
+		cb->state = CB_VALID;
+		list_add_tail(&cb->list, &cc->lru);
+		cc->nr_valid++;
+	}
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	mempool_free(rec, cc->record_pool);
+}
+
+/*
+ * Fill a cache block from its origin block.  While this is going on the
+ * block is hashed but not valid: reads keep going to the origin and
+ * writes mark it stale.
+ */
+static void start_promotion(struct cache_c *cc, struct dm_target *ti,
+			    struct cache_block *cb)
+{
+	struct dm_io_region src, dest;
+
+	src.bdev = cc->origin->bdev;
+	src.sector = cb->oblock << cc->block_shift;
+	src.count = min(cc->block_size, ti->len - src.sector);
+
+	dest.bdev = cc->cache->bdev;
+	dest.sector = (sector_t)(cb - cc->cblocks) << cc->block_shift;
+	dest.count = src.count;
+
+	dm_kcopyd_copy(cc->kcopyd_client, &src, 1, &dest, 0,
+		       copy_complete, alloc_record(cc, cb, NULL));
+}
+
+static void map_to_origin(struct cache_c *cc, struct dm_target *ti,
+			  struct bio *bio)
+{
+	bio->bi_bdev = cc->origin->bdev;
+	bio->bi_sector = bio->bi_sector - ti->begin;
+}
+
+static int cache_read(struct cache_c *cc, struct dm_target *ti,
+		      struct bio *bio, union map_info *map_context)
+{
+	sector_t oblock = origin_block(cc, ti, bio->bi_sector);
+	struct cache_block *cb, *promote = NULL;
+
+	spin_lock_irq(&cc->lock);
+	cb = lookup_cblock(cc, oblock);
+	if (cb && cb->state == CB_VALID) {
+		cb->inflight++;
+		list_move_tail(&cb->list, &cc->lru);
+		cc->read_hits++;
+		spin_unlock_irq(&cc->lock);
+
+		map_context->ptr = alloc_record(cc, cb, bio);
+		bio->bi_bdev = cc->cache->bdev;
+		bio->bi_sector = cache_sector(cc, cb, bio->bi_sector - ti->begin);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	cc->read_misses++;
+	if (!cb && cc->copies < MAX_COPIES && block_is_hot(cc, oblock)) {
+		promote = alloc_cblock(cc);
+		if (promote) {
+			promote->oblock = oblock;
+			promote->state = CB_COPYING;
+			hlist_add_head(&promote->hash, cache_bucket(cc, oblock));
+			cc->copies++;
+			cc->promotions++;
+		}
+	}
+	spin_unlock_irq(&cc->lock);
+
+	if (promote)
+		start_promotion(cc, ti, promote);
+
+	map_to_origin(cc, ti, bio);
+	return DM_MAPIO_REMAPPED;
+}
+
+static void write_complete(unsigned long error, void *context)
+{
+	struct cache_record *rec = context;
+	struct cache_c *cc = rec->cc;
+	struct bio *bio = rec->bio;
+	unsigned long flags;
+
+	/* region 1 is the cache: drop the block instead of failing the io */
+	if (test_bit(1, &error))
+		DMERR_LIMIT("Write to cache device failed, dropping block.");
+
+	spin_lock_irqsave(&cc->lock, flags);
+	if (test_bit(1, &error))
+		invalidate_cblock(cc, rec->cb);
+	put_cblock(cc, rec->cb);
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	mempool_free(rec, cc->record_pool);
+	bio_endio(bio, test_bit(0, &error) ? -EIO : 0);
+}
+
+/*
+ * Write bio to the origin and, if its block is cached, to the cache
+ * device in the same go.
+ */
+static int cache_write(struct cache_c *cc, struct dm_target *ti,
+		       struct bio *bio, union map_info *map_context)
+{
+	sector_t oblock = origin_block(cc, ti, bio->bi_sector);
+	struct cache_block *cb;
+	struct dm_io_region io[2];
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE,
+		.mem.type = DM_IO_BVEC,
+		.mem.ptr.bvec = bio->bi_io_vec + bio->bi_idx,
+		.notify.fn = write_complete,
+		.client = cc->io_client,
+	};
+
+	spin_lock_irq(&cc->lock);
+	cb = lookup_cblock(cc, oblock);
+	if (cb && cb->state == CB_VALID) {
+		cb->inflight++;
+		list_move_tail(&cb->list, &cc->lru);
+		cc->write_hits++;
+	} else {
+		if (cb)
+			invalidate_cblock(cc, cb);
+		cb = NULL;
+		/* cache_end_io() drops this again */
+		hot_entry(cc, oblock)->writes++;
+		map_context->ll = oblock + 1;
+	}
+	spin_unlock_irq(&cc->lock);
+
+	if (!cb) {
+		map_to_origin(cc, ti, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	io_req.notify.context = alloc_record(cc, cb, bio);
+
+	io[0].bdev = cc->origin->bdev;
+	io[0].sector = bio->bi_sector - ti->begin;
+	io[0].count = bio_sectors(bio);
+
+	io[1].bdev = cc->cache->bdev;
+	io[1].sector = cache_sector(cc, cb, io[0].sector);
+	io[1].count = io[0].count;
+
+	BUG_ON(dm_io(&io_req, 2, io, NULL));
+	return DM_MAPIO_SUBMITTED;
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache_c *cc = ti->private;
+
+	map_context->ll = 0;
+
+	/* the cache is write-through, only the origin needs flushing */
+	if (unlikely(bio_empty_barrier(bio))) {
+		bio->bi_bdev = cc->origin->bdev;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (bio_data_dir(bio) == WRITE)
+		return cache_write(cc, ti, bio, map_context);
+
+	return cache_read(cc, ti, bio, map_context);
+}
+
+static void retry_reads(struct work_struct *work)
+{
+	struct cache_c *cc = container_of(work, struct cache_c, retry_work);
+	struct bio_list bios;
+	struct bio *bio;
+
+	spin_lock_irq(&cc->lock);
+	bios = cc->retries;
+	bio_list_init(&cc->retries);
+	spin_unlock_irq(&cc->lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache_c *cc = ti->private;
+	struct cache_record *rec = map_context->ptr;
+	unsigned long flags;
+	int retry = 0;
+
+	if (bio_data_dir(bio) == WRITE) {
+		/* an uncached write, see cache_write() */
+		if (map_context->ll) {
+			spin_lock_irqsave(&cc->lock, flags);
+			hot_entry(cc, map_context->ll - 1)->writes--;
+			spin_unlock_irqrestore(&cc->lock, flags);
+		}
+		return error;
+	}
+
+	if (!rec)
+		return error;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	if (error && bio_data_dir(bio) == READ && error != -EWOULDBLOCK) {
+		/*
+		 * The cache device failed us, but the origin still has the
+		 * data: stop using the block and read it from there.
+		 */
+		invalidate_cblock(cc, rec->cb);
+		retry = 1;
+	}
+	put_cblock(cc, rec->cb);
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	if (retry) {
+		DMERR_LIMIT("Read from cache device failed, trying origin.");
+		dm_bio_restore(&rec->details, bio);
+		map_to_origin(cc, ti, bio);
+	}
+
+	mempool_free(rec, cc->record_pool);
+	map_context->ptr = NULL;
+
+	if (retry) {
+		spin_lock_irqsave(&cc->lock, flags);
+		bio_list_add(&cc->retries, bio);
+		spin_unlock_irqrestore(&cc->lock, flags);
+		queue_work(kcached_wq, &cc->retry_work);
+		return DM_ENDIO_INCOMPLETE;
+	}
+
+	return error;
+}
+
+static int alloc_tables(struct cache_c *cc)
+{
+	sector_t i;
+
+	cc->cblocks = vmalloc(cc->nr_cblocks * sizeof(*cc->cblocks));
+	if (!cc->cblocks)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&cc->free);
+	INIT_LIST_HEAD(&cc->lru);
+	for (i = 0; i < cc->nr_cblocks; i++) {
+		INIT_HLIST_NODE(&cc->cblocks[i].hash);
+		cc->cblocks[i].inflight = 0;
+		free_cblock(cc, cc->cblocks + i);
+	}
+
+	/* about four cache blocks per hash chain */
+	cc->hash_shift = max(ilog2(cc->nr_cblocks) - 2, 4);
+	cc->buckets = vmalloc(sizeof(*cc->buckets) << cc->hash_shift);
+	if (!cc->buckets)
+		goto bad_buckets;
+	for (i = 0; i < (1UL << cc->hash_shift); i++)
+		INIT_HLIST_HEAD(cc->buckets + i);
+
+	cc->hot_shift = max(ilog2(cc->nr_cblocks), 4);
+	cc->hot = vmalloc(sizeof(*cc->hot) << cc->hot_shift);
+	if (!cc->hot)
+		goto bad_hot;
+	memset(cc->hot, 0, sizeof(*cc->hot) << cc->hot_shift);
+
+	return 0;
+
+bad_hot:
+	vfree(cc->buckets);
+bad_buckets:
+	vfree(cc->cblocks);
+	return -ENOMEM;
+}
+
+static void free_tables(struct cache_c *cc)
+{
+	vfree(cc->hot);
+	vfree(cc->buckets);
+	vfree(cc->cblocks);
+}
+
+/*
+ * Construct a cache mapping:
+ * <origin dev> <cache dev> <block size> [<promote threshold>]
+ *
+ * The block size is in sectors and must be a power of two of at least
+ * a page.  A block gets promoted to the cache after this many read
+ * misses on it.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct cache_c *cc;
+	unsigned long long block_size;
+	sector_t cache_size;
+	int r = -EINVAL;
+
+	if (argc != 3 && argc != 4) {
+		ti->error = "requires exactly 3 or 4 arguments";
+		return -EINVAL;
+	}
+
+	cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc) {
+		ti->error = "Cannot allocate context";
+		return -ENOMEM;
+	}
+
+	if (sscanf(argv[2], "%llu", &block_size) != 1 ||
+	    !is_power_of_2(block_size) ||
+	    block_size < (PAGE_SIZE >> SECTOR_SHIFT)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+	cc->block_size = block_size;
+	cc->block_shift = ilog2(block_size);
+
+	cc->promote_threshold = DEFAULT_PROMOTE_THRESHOLD;
+	if (argc == 4 && (sscanf(argv[3], "%u", &cc->promote_threshold) != 1 ||
+			  !cc->promote_threshold)) {
+		ti->error = "Invalid promote threshold";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[0], 0, ti->len,
+			  dm_table_get_mode(ti->table), &cc->origin)) {
+		ti->error = "Origin device lookup failed";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[1], 0, 0,
+			  dm_table_get_mode(ti->table), &cc->cache)) {
+		ti->error = "Cache device lookup failed";
+		goto bad_cache_dev;
+	}
+
+	cache_size = i_size_read(cc->cache->bdev->bd_inode) >> SECTOR_SHIFT;
+	cc->nr_cblocks = cache_size >> cc->block_shift;
+	if (!cc->nr_cblocks) {
+		ti->error = "Cache device smaller than one block";
+		goto bad_tables;
+	}
+
+	r = alloc_tables(cc);
+	if (r) {
+		ti->error = "Cannot allocate cache tables";
+		goto bad_tables;
+	}
+
+	r = -ENOMEM;
+	cc->record_pool = mempool_create_slab_pool(MIN_RECORDS, _record_cache);
+	if (!cc->record_pool) {
+		ti->error = "Cannot allocate record mempool";
+		goto bad_record_pool;
+	}
+
+	cc->io_client = dm_io_client_create(CACHE_IO_PAGES);
+	if (IS_ERR(cc->io_client)) {
+		r = PTR_ERR(cc->io_client);
+		ti->error = "Cannot allocate dm io client";
+		goto bad_io_client;
+	}
+
+	r = dm_kcopyd_client_create(CACHE_COPY_PAGES, &cc->kcopyd_client);
+	if (r) {
+		ti->error = "Cannot allocate kcopyd client";
+		goto bad_kcopyd;
+	}
+
+	spin_lock_init(&cc->lock);
+	bio_list_init(&cc->retries);
+	INIT_WORK(&cc->retry_work, retry_reads);
+
+	ti->split_io = cc->block_size;
+	ti->num_flush_requests = 1;
+	ti->private = cc;
+	return 0;
+
+bad_kcopyd:
+	dm_io_client_destroy(cc->io_client);
+bad_io_client:
+	mempool_destroy(cc->record_pool);
+bad_record_pool:
+	free_tables(cc);
+bad_tables:
+	dm_put_device(ti, cc->cache);
+bad_cache_dev:
+	dm_put_device(ti, cc->origin);
+bad:
+	kfree(cc);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache_c *cc = ti->private;
+
+	/* waits for the promotions still copying */
+	dm_kcopyd_client_destroy(cc->kcopyd_client);
+	flush_workqueue(kcached_wq);
+
+	dm_io_client_destroy(cc->io_client);
+	mempool_destroy(cc->record_pool);
+	free_tables(cc);
+	dm_put_device(ti, cc->cache);
+	dm_put_device(ti, cc->origin);
+	kfree(cc);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct cache_c *cc = ti->private;
+	int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irq(&cc->lock);
+		DMEMIT("%lu %lu %lu %lu %lu %llu/%llu",
+		       cc->read_hits, cc->read_misses, cc->write_hits,
+		       cc->promotions, cc->evictions,
+		       (unsigned long long)cc->nr_valid,
+		       (unsigned long long)cc->nr_cblocks);
+		spin_unlock_irq(&cc->lock);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu %u", cc->origin->name, cc->cache->name,
+		       (unsigned long long)cc->block_size,
+		       cc->promote_threshold);
+		break;
+	}
+
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache_c *cc = ti->private;
+
+	return fn(ti, cc->origin, 0, ti->len, data);
+}
+
+static struct target_type cache_target = {
+	.name	     = "cache",
+	.version     = {1, 0, 0},
+	.module      = THIS_MODULE,
+	.ctr	     = cache_ctr,
+	.dtr	     = cache_dtr,
+	.map	     = cache_map,
+	.end_io	     = cache_end_io,
+	.status	     = cache_status,
+	.iterate_devices = cache_iterate_devices,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r = -ENOMEM;
+
+	kcached_wq = create_singlethread_workqueue("kcached");
+	if (!kcached_wq) {
+		DMERR("Couldn't start kcached");
+		goto bad_queue;
+	}
+
+	_record_cache = KMEM_CACHE(cache_record, 0);
+	if (!_record_cache) {
+		DMERR("Couldn't create cache record cache.");
+		goto bad_memcache;
+	}
+
+	r = dm_register_target(&cache_target);
+	if (r < 0) {
+		DMERR("register failed %d", r);
+		goto bad_register;
+	}
+
+	return 0;
+
+bad_register:
+	kmem_cache_destroy(_record_cache);
+bad_memcache:
+	destroy_workqueue(kcached_wq);
+bad_queue:
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_record_cache);
+	destroy_workqueue(kcached_wq);
+}
+
+/* Module hooks */
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " block cache target");
+MODULE_LICENSE("GPL");
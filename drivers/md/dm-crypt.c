@@ -15,6 +15,7 @@
 #include <linux/blkdev.h>
 #include <linux/mempool.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
@@ -131,9 +132,13 @@ struct crypt_config {
 	 *
 	 * The padding is added so that dm_crypt_request and the IV are
 	 * correctly aligned.
+	 *
+	 * req points to a per cpu slot caching the next request to use.
+	 * kcryptd runs one thread per cpu, and a slot is only ever touched
+	 * by the kcryptd thread bound to that cpu.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
+	struct ablkcipher_request **req;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -441,16 +446,24 @@ static int crypt_convert_block(struct crypt_config *cc,
 
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
-static void crypt_alloc_req(struct crypt_config *cc,
-			    struct convert_context *ctx)
+static struct ablkcipher_request **this_crypt_req(struct crypt_config *cc)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+	return per_cpu_ptr(cc->req, smp_processor_id());
+}
+
+static struct ablkcipher_request *crypt_alloc_req(struct crypt_config *cc,
+						  struct convert_context *ctx)
+{
+	struct ablkcipher_request **reqp = this_crypt_req(cc);
+
+	if (!*reqp)
+		*reqp = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(*reqp, cc->tfm);
+	ablkcipher_request_set_callback(*reqp, CRYPTO_TFM_REQ_MAY_BACKLOG |
 					CRYPTO_TFM_REQ_MAY_SLEEP,
 					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+					dmreq_of_req(cc, *reqp));
+	return *reqp;
 }
 
 /*
@@ -459,6 +472,7 @@ static void crypt_alloc_req(struct crypt_config *cc,
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
 {
+	struct ablkcipher_request *req;
 	int r;
 
 	atomic_set(&ctx->pending, 1);
@@ -466,11 +480,11 @@ static int crypt_convert(struct crypt_config *cc,
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
-		crypt_alloc_req(cc, ctx);
+		req = crypt_alloc_req(cc, ctx);
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, req);
 
 		switch (r) {
 		/* async */
@@ -479,7 +493,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			*this_crypt_req(cc) = NULL;
 			ctx->sector++;
 			continue;
 
@@ -1116,7 +1130,12 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
+
+	cc->req = alloc_percpu(struct ablkcipher_request *);
+	if (!cc->req) {
+		ti->error = "Cannot allocate per cpu crypt requests";
+		goto bad_req_percpu;
+	}
 
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
@@ -1171,7 +1190,11 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	/*
+	 * One kcryptd thread per cpu, so that encryption of bios submitted
+	 * or completed on different cpus proceeds in parallel.
+	 */
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		goto bad_crypt_queue;
@@ -1192,6 +1215,8 @@ bad_device:
 bad_bs:
 	mempool_destroy(cc->page_pool);
 bad_page_pool:
+	free_percpu(cc->req);
+bad_req_percpu:
 	mempool_destroy(cc->req_pool);
 bad_req_pool:
 	mempool_destroy(cc->io_pool);
@@ -1209,12 +1234,18 @@ bad_cipher:
 static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
+	struct ablkcipher_request *req;
+	int cpu;
 
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
 
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
+	for_each_possible_cpu(cpu) {
+		req = *per_cpu_ptr(cc->req, cpu);
+		if (req)
+			mempool_free(req, cc->req_pool);
+	}
+	free_percpu(cc->req);
 
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
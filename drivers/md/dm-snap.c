@@ -150,6 +150,12 @@ struct dm_snap_pending_exception {
 	/* Pointer back to snapshot context */
 	struct dm_snapshot *snap;
 
+	/*
+	 * Further pending_exceptions of other snapshots whose chunk
+	 * is written by the same kcopyd job as this one.
+	 */
+	struct dm_snap_pending_exception *next_copy;
+
 	/*
 	 * 1 indicates the exception has already been sent to
 	 * kcopyd.
@@ -950,30 +956,105 @@ static void copy_callback(int read_err, unsigned long write_err, void *context)
 }
 
 /*
- * Dispatches the copy operation to kcopyd.
+ * Completion of a kcopyd job shared by several snapshots: bit i of
+ * write_err belongs to the i-th pending_exception of the group.
  */
-static void start_copy(struct dm_snap_pending_exception *pe)
+static void copy_group_callback(int read_err, unsigned long write_err,
+				void *context)
+{
+	struct dm_snap_pending_exception *pe = context, *next;
+	unsigned i = 0;
+
+	while (pe) {
+		/* pe may be freed by copy_callback() */
+		next = pe->next_copy;
+		copy_callback(read_err, write_err & (1UL << i), pe);
+		pe = next;
+		i++;
+	}
+}
+
+static void copy_regions(struct dm_snap_pending_exception *pe,
+			 struct dm_io_region *src, struct dm_io_region *dest)
 {
 	struct dm_snapshot *s = pe->snap;
-	struct dm_io_region src, dest;
 	struct block_device *bdev = s->origin->bdev;
 	sector_t dev_size;
 
 	dev_size = get_dev_size(bdev);
 
-	src.bdev = bdev;
-	src.sector = chunk_to_sector(s->store, pe->e.old_chunk);
-	src.count = min((sector_t)s->store->chunk_size, dev_size - src.sector);
+	src->bdev = bdev;
+	src->sector = chunk_to_sector(s->store, pe->e.old_chunk);
+	src->count = min((sector_t)s->store->chunk_size,
+			 dev_size - src->sector);
 
-	dest.bdev = s->store->cow->bdev;
-	dest.sector = chunk_to_sector(s->store, pe->e.new_chunk);
-	dest.count = src.count;
+	dest->bdev = s->store->cow->bdev;
+	dest->sector = chunk_to_sector(s->store, pe->e.new_chunk);
+	dest->count = src->count;
+}
+
+/*
+ * Dispatches the copy operation to kcopyd.
+ */
+static void start_copy(struct dm_snap_pending_exception *pe)
+{
+	struct dm_snapshot *s = pe->snap;
+	struct dm_io_region src, dest;
+
+	copy_regions(pe, &src, &dest);
 
 	/* Hand over to kcopyd */
 	dm_kcopyd_copy(s->kcopyd_client,
 		    &src, 1, &dest, 0, copy_callback, pe);
 }
 
+/*
+ * Dispatches the copies an origin write triggered in several snapshots.
+ *
+ * Snapshots with the same chunk size need the very same origin chunk
+ * copied, so rather than reading it once per snapshot, read it once
+ * and let kcopyd write it to all of their COW devices.  This keeps
+ * the origin reads of a write constant in the number of snapshots.
+ */
+static void start_origin_copies(struct list_head *pe_queue)
+{
+	struct dm_snap_pending_exception *leader, *last, *pe, *next_pe;
+	struct dm_io_region src, dests[DM_KCOPYD_MAX_REGIONS];
+	unsigned num_dests;
+
+	while (!list_empty(pe_queue)) {
+		leader = list_first_entry(pe_queue,
+					  struct dm_snap_pending_exception,
+					  list);
+		list_del(&leader->list);
+		leader->next_copy = NULL;
+		copy_regions(leader, &src, &dests[0]);
+		num_dests = 1;
+
+		last = leader;
+		list_for_each_entry_safe(pe, next_pe, pe_queue, list) {
+			if (num_dests == DM_KCOPYD_MAX_REGIONS)
+				break;
+			if (pe->snap->store->chunk_size !=
+			    leader->snap->store->chunk_size)
+				continue;
+
+			list_del(&pe->list);
+			pe->next_copy = NULL;
+			last->next_copy = pe;
+			last = pe;
+			copy_regions(pe, &src, &dests[num_dests++]);
+		}
+
+		/*
+		 * The leader's snapshot cannot go away before the job
+		 * completes, its destructor waits for the leader.
+		 */
+		dm_kcopyd_copy(leader->snap->kcopyd_client, &src, num_dests,
+			       dests, 0, copy_group_callback, leader);
+	}
+}
+
 static struct dm_snap_pending_exception *
 __lookup_pending_exception(struct dm_snapshot *s, chunk_t chunk)
 {
@@ -1211,7 +1292,7 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 	int r = DM_MAPIO_REMAPPED, first = 0;
 	struct dm_snapshot *snap;
 	struct dm_snap_exception *e;
-	struct dm_snap_pending_exception *pe, *next_pe, *primary_pe = NULL;
+	struct dm_snap_pending_exception *pe, *primary_pe = NULL;
 	chunk_t chunk;
 	LIST_HEAD(pe_queue);
 
@@ -1321,8 +1402,7 @@ static int __origin_write(struct list_head *snapshots, struct bio *bio)
 	/*
 	 * Now that we have a complete pe list we can start the copying.
 	 */
-	list_for_each_entry_safe(pe, next_pe, &pe_queue, list)
-		start_copy(pe);
+	start_origin_copies(&pe_queue);
 
 	return r;
 }
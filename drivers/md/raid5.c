@@ -191,6 +191,17 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+/* Called with device_lock held, after queueing a stripe on handle_list */
+static void raid5_wakeup_worker(raid5_conf_t *conf)
+{
+	if (!conf->worker_cnt)
+		return;
+
+	md_wakeup_thread(conf->workers[conf->next_worker]);
+	if (++conf->next_worker >= conf->worker_cnt)
+		conf->next_worker = 0;
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -207,6 +218,7 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
+				raid5_wakeup_worker(conf);
 			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
@@ -4456,6 +4468,84 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * A worker thread only takes stripes off handle_list, everything else
+ * (retrying aligned reads, bitmap and delayed stripes, recovery) stays
+ * with raid5d.  handle_stripe() already copes with being run on other
+ * stripes concurrently, as sync_request() does.
+ */
+static void raid5_worker(mddev_t *mddev)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct stripe_head *sh;
+	int handled = 0;
+
+	spin_lock_irq(&conf->device_lock);
+	while ((sh = __get_priority_stripe(conf)) != NULL) {
+		spin_unlock_irq(&conf->device_lock);
+
+		handled++;
+		handle_stripe(sh);
+		release_stripe(sh);
+		cond_resched();
+
+		spin_lock_irq(&conf->device_lock);
+	}
+	spin_unlock_irq(&conf->device_lock);
+
+	if (handled) {
+		async_tx_issue_pending_all();
+		unplug_slaves(mddev);
+	}
+}
+
+static void free_workers(mdk_thread_t **workers, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		md_unregister_thread(workers[i]);
+	kfree(workers);
+}
+
+static int set_worker_cnt(raid5_conf_t *conf, int cnt)
+{
+	mdk_thread_t **workers = NULL, **old;
+	char name[16];
+	int i, old_cnt;
+
+	if (cnt) {
+		workers = kcalloc(cnt, sizeof(*workers), GFP_KERNEL);
+		if (!workers)
+			return -ENOMEM;
+		for (i = 0; i < cnt; i++) {
+			snprintf(name, sizeof(name), "raid5w%d", i);
+			workers[i] = md_register_thread(raid5_worker,
+							conf->mddev, name);
+			if (!workers[i]) {
+				free_workers(workers, i);
+				return -ENOMEM;
+			}
+		}
+	}
+
+	spin_lock_irq(&conf->device_lock);
+	old = conf->workers;
+	old_cnt = conf->worker_cnt;
+	conf->workers = workers;
+	conf->worker_cnt = cnt;
+	conf->next_worker = 0;
+	spin_unlock_irq(&conf->device_lock);
+
+	/* stopping a worker waits for it to finish its current run */
+	free_workers(old, old_cnt);
+
+	/* have the new workers pick up whatever is already queued */
+	for (i = 0; i < cnt; i++)
+		md_wakeup_thread(workers[i]);
+	return 0;
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4551,10 +4641,50 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	unsigned long new;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->worker_cnt)
+		return len;
+	err = set_worker_cnt(conf, new);
+	if (err)
+		return err;
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -5106,6 +5236,7 @@ static int stop(mddev_t *mddev)
 
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
+	set_worker_cnt(conf, 0);
 	mddev->queue->backing_dev_info.congested_fn = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
 	sysfs_remove_group(&mddev->kobj, &raid5_attrs_group);
@@ -432,6 +432,13 @@ struct raid5_private_data {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct mdk_thread_s	*thread;
+
+	/* Threads handling stripes from handle_list alongside raid5d,
+	 * woken in turn as stripes get queued.  Protected by device_lock.
+	 */
+	struct mdk_thread_s	**workers;
+	int			worker_cnt;
+	int			next_worker;
 };
 
 typedef struct raid5_private_data raid5_conf_t;
@@ -38,6 +38,7 @@
 #include <linux/ipv6.h>
 #include <net/checksum.h>
 #include <net/ip6_checksum.h>
+#include <net/busy_poll.h>
 #include <linux/ethtool.h>
 #include <linux/if_vlan.h>
 #include <scsi/fc/fc_fcoe.h>
@@ -558,6 +559,7 @@ static void ixgbe_receive_skb(struct ixgbe_q_vector *q_vector,
 	u16 tag = le16_to_cpu(rx_desc->wb.upper.vlan);
 
 	skb_record_rx_queue(skb, ring->queue_index);
+	skb_mark_napi_id(skb, napi);
 	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL)) {
 		if (adapter->vlgrp && is_vlan && (tag & VLAN_VID_MASK))
 			vlan_gro_receive(napi, adapter->vlgrp, tag, skb);
@@ -3699,7 +3701,7 @@ out:
  **/
 static int ixgbe_alloc_q_vectors(struct ixgbe_adapter *adapter)
 {
-	int q_idx, num_q_vectors;
+	int q_idx, num_q_vectors, i;
 	struct ixgbe_q_vector *q_vector;
 	int napi_vectors;
 	int (*poll)(struct napi_struct *, int);
@@ -3725,12 +3727,17 @@ static int ixgbe_alloc_q_vectors(struct ixgbe_adapter *adapter)
 			q_vector->eitr = adapter->rx_eitr_param;
 		q_vector->v_idx = q_idx;
 		netif_napi_add(adapter->netdev, &q_vector->napi, (*poll), 64);
+		napi_hash_add(&q_vector->napi);
 		adapter->q_vector[q_idx] = q_vector;
 	}
 
 	return 0;
 
 err_out:
+	for (i = 0; i < q_idx; i++)
+		napi_hash_del(&adapter->q_vector[i]->napi);
+	synchronize_net();
+
 	while (q_idx) {
 		q_idx--;
 		q_vector = adapter->q_vector[q_idx];
@@ -3758,6 +3765,11 @@ static void ixgbe_free_q_vectors(struct ixgbe_adapter *adapter)
 	else
 		num_q_vectors = 1;
 
+	/* one grace period for the busy pollers of all the vectors */
+	for (q_idx = 0; q_idx < num_q_vectors; q_idx++)
+		napi_hash_del(&adapter->q_vector[q_idx]->napi);
+	synchronize_net();
+
 	for (q_idx = 0; q_idx < num_q_vectors; q_idx++) {
 		struct ixgbe_q_vector *q_vector = adapter->q_vector[q_idx];
 		adapter->q_vector[q_idx] = NULL;
@@ -40,7 +40,9 @@
 #include <linux/udp.h>
 #include <linux/moduleparam.h>
 #include <linux/mm.h>
+#include <linux/rtnetlink.h>
 #include <net/ip.h>
+#include <net/busy_poll.h>
 
 #include <xen/xen.h>
 #include <xen/xenbus.h>
@@ -58,15 +60,35 @@ static int use_smartpoll = 0;
 module_param(use_smartpoll, int, 0600);
 MODULE_PARM_DESC (use_smartpoll, "Use smartpoll mechanism if available");
 
+/* Upper bound on the number of queue pairs negotiated with the backend. */
+#define XENNET_MAX_QUEUES 8
+
+static unsigned int xennet_max_queues;
+module_param_named(max_queues, xennet_max_queues, uint, 0644);
+MODULE_PARM_DESC(max_queues, "Maximum number of queues per virtual interface");
+
+static int xennet_persistent = 1;
+module_param_named(feature_persistent, xennet_persistent, bool, 0644);
+MODULE_PARM_DESC(feature_persistent,
+		 "Transmit through persistently granted buffers if available");
+
 struct netfront_cb {
 	struct page *page;
 	unsigned offset;
+	grant_ref_t ref;	/* still granted: page goes back to the pool */
 };
 
 #define MICRO_SECOND 1000000UL
 #define NANO_SECOND 1000000000UL
 #define DEFAULT_SMART_POLL_FREQ   1000UL
 
+/* Adaptive smart poll defaults, see xennet_smart_poll_adapt(). */
+#define DEFAULT_ADAPT_USECS_LOW   20U
+#define DEFAULT_ADAPT_USECS_HIGH  1000U
+#define DEFAULT_ADAPT_FRAMES      16U
+#define DEFAULT_ADAPT_RATE_LOW    1000U
+#define ADAPT_SAMPLE_NSECS        (10 * NSEC_PER_MSEC)
+
 struct netfront_smart_poll {
 	struct hrtimer timer;
 	struct net_device *netdev;
@@ -74,6 +96,20 @@ struct netfront_smart_poll {
 	unsigned int feature_smart_poll;
 	unsigned int active;
 	unsigned long counter;
+
+	/*
+	 * Adaptive mode picks the poll interval so that each poll finds
+	 * about 'frames' packets, within [usecs_low, usecs_high], and
+	 * goes back to event channel notifications below 'rate_low'
+	 * packets per second.
+	 */
+	unsigned int adaptive;
+	unsigned int usecs_low;
+	unsigned int usecs_high;
+	unsigned int frames;
+	unsigned int rate_low;
+	unsigned long packets;		/* received in this sample */
+	ktime_t sample_start;
 };
 
 #define NETFRONT_SKB_CB(skb)	((struct netfront_cb *)((skb)->cb))
@@ -86,13 +122,27 @@ struct netfront_smart_poll {
 #define NET_RX_RING_SIZE __CONST_RING_SIZE(xen_netif_rx, PAGE_SIZE)
 #define TX_MAX_TARGET min_t(int, NET_RX_RING_SIZE, 256)
 
+/* Granted RX pages kept for reuse, per queue. */
+#define XENNET_RX_POOL_SIZE 64
+
 struct netfront_info {
 	struct list_head list;
 	struct net_device *netdev;
 
+	/*
+	 * Multi-queue support.  Every queue is a complete netfront_info
+	 * with its own rings, event channel and NAPI context.  Queue 0 is
+	 * the net_device private area; queues[] is only valid there.
+	 */
+	unsigned int queue_index;
+	unsigned int num_queues;
+	struct netfront_info *queues[XENNET_MAX_QUEUES];
+
 	struct napi_struct napi;
 
 	unsigned int evtchn;
+	unsigned int irq;
+	char irq_name[IFNAMSIZ + 4];
 	struct xenbus_device *xbdev;
 
 	spinlock_t   tx_lock;
@@ -116,6 +166,15 @@ struct netfront_info {
 	grant_ref_t grant_tx_ref[NET_TX_RING_SIZE];
 	unsigned tx_skb_freelist;
 
+	/*
+	 * Persistent grants: every TX slot owns a page granted to the
+	 * backend once per connection.  Packets are copied into it and
+	 * grant_tx_ref[] stays GRANT_INVALID_REF.
+	 */
+	unsigned int persistent;
+	void *tx_pers_buf[NET_TX_RING_SIZE];
+	grant_ref_t tx_pers_ref[NET_TX_RING_SIZE];
+
 	spinlock_t   rx_lock ____cacheline_aligned_in_smp;
 	struct xen_netif_rx_front_ring rx;
 	int rx_ring_ref;
@@ -133,6 +192,16 @@ struct netfront_info {
 	grant_ref_t gref_rx_head;
 	grant_ref_t grant_rx_ref[NET_RX_RING_SIZE];
 
+	/*
+	 * Pages of packets that were copied entirely into the skb head are
+	 * not freed but kept here, still granted to the backend, and
+	 * handed out again by xennet_alloc_rx_buffers().  Protected by
+	 * rx_lock.
+	 */
+	struct page *rx_pool_page[XENNET_RX_POOL_SIZE];
+	grant_ref_t rx_pool_ref[XENNET_RX_POOL_SIZE];
+	unsigned int rx_pool_count;
+
 	unsigned long rx_pfn_array[NET_RX_RING_SIZE];
 	struct multicall_entry rx_mcl[NET_RX_RING_SIZE+1];
 	struct mmu_update rx_mmu[NET_RX_RING_SIZE];
@@ -211,11 +280,15 @@ static int xennet_can_sg(struct net_device *dev)
 	return dev->features & NETIF_F_SG;
 }
 
+static struct netdev_queue *xennet_txq(struct netfront_info *np)
+{
+	return netdev_get_tx_queue(np->netdev, np->queue_index);
+}
+
 
 static void rx_refill_timeout(unsigned long data)
 {
-	struct net_device *dev = (struct net_device *)data;
-	struct netfront_info *np = netdev_priv(dev);
+	struct netfront_info *np = (struct netfront_info *)data;
 	napi_schedule(&np->napi);
 }
 
@@ -225,27 +298,77 @@ static int netfront_tx_slot_available(struct netfront_info *np)
 		(TX_MAX_TARGET - MAX_SKB_FRAGS - 2));
 }
 
-static void xennet_maybe_wake_tx(struct net_device *dev)
+static void xennet_maybe_wake_tx(struct netfront_info *np)
 {
-	struct netfront_info *np = netdev_priv(dev);
-
-	if (unlikely(netif_queue_stopped(dev)) &&
+	if (unlikely(netif_tx_queue_stopped(xennet_txq(np))) &&
 	    netfront_tx_slot_available(np) &&
-	    likely(netif_running(dev)))
-		netif_wake_queue(dev);
+	    likely(netif_running(np->netdev)))
+		netif_tx_wake_queue(xennet_txq(np));
+}
+
+/* Give back @page, still granted through @ref, or let both go. */
+static void xennet_recycle_rx_page(struct netfront_info *np,
+				   struct page *page, grant_ref_t ref)
+{
+	unsigned long ret;
+
+	if (np->rx_pool_count < XENNET_RX_POOL_SIZE &&
+	    page_count(page) == 1) {
+		np->rx_pool_page[np->rx_pool_count] = page;
+		np->rx_pool_ref[np->rx_pool_count] = ref;
+		np->rx_pool_count++;
+		return;
+	}
+
+	ret = gnttab_end_foreign_access_ref(ref, 0);
+	BUG_ON(!ret);
+	gnttab_release_grant_reference(&np->gref_rx_head, ref);
+	__free_page(page);
+}
+
+/* Revoke the pool's grants, e.g. before the backend goes away. */
+static void xennet_release_rx_pool(struct netfront_info *np)
+{
+	struct sk_buff *skb;
+	unsigned long ret;
+
+	spin_lock_bh(&np->rx_lock);
+
+	while (np->rx_pool_count) {
+		np->rx_pool_count--;
+		ret = gnttab_end_foreign_access_ref(
+			np->rx_pool_ref[np->rx_pool_count], 0);
+		BUG_ON(!ret);
+		gnttab_release_grant_reference(&np->gref_rx_head,
+				np->rx_pool_ref[np->rx_pool_count]);
+		__free_page(np->rx_pool_page[np->rx_pool_count]);
+	}
+
+	/* Batched skbs may hold pool pages too; they get fresh grants. */
+	skb_queue_walk(&np->rx_batch, skb) {
+		grant_ref_t ref = NETFRONT_SKB_CB(skb)->ref;
+
+		if (ref == GRANT_INVALID_REF)
+			continue;
+		ret = gnttab_end_foreign_access_ref(ref, 0);
+		BUG_ON(!ret);
+		gnttab_release_grant_reference(&np->gref_rx_head, ref);
+		NETFRONT_SKB_CB(skb)->ref = GRANT_INVALID_REF;
+	}
+
+	spin_unlock_bh(&np->rx_lock);
 }
 
-static void xennet_alloc_rx_buffers(struct net_device *dev)
+static void xennet_alloc_rx_buffers(struct netfront_info *np)
 {
 	unsigned short id;
-	struct netfront_info *np = netdev_priv(dev);
+	struct net_device *dev = np->netdev;
 	struct sk_buff *skb;
 	struct page *page;
 	int i, batch_target, notify;
 	RING_IDX req_prod = np->rx.req_prod_pvt;
 	grant_ref_t ref;
 	unsigned long pfn;
-	void *vaddr;
 	struct xen_netif_rx_request *req;
 
 	if (unlikely(!netif_carrier_ok(dev)))
@@ -267,7 +390,16 @@ static void xennet_alloc_rx_buffers(struct net_device *dev)
 		/* Align ip header to a 16 bytes boundary */
 		skb_reserve(skb, NET_IP_ALIGN);
 
-		page = alloc_page(GFP_ATOMIC | __GFP_NOWARN);
+		/* Reuse a page that is still granted if there is one. */
+		NETFRONT_SKB_CB(skb)->ref = GRANT_INVALID_REF;
+		if (np->rx_pool_count) {
+			np->rx_pool_count--;
+			page = np->rx_pool_page[np->rx_pool_count];
+			NETFRONT_SKB_CB(skb)->ref =
+				np->rx_pool_ref[np->rx_pool_count];
+		} else {
+			page = alloc_page(GFP_ATOMIC | __GFP_NOWARN);
+		}
 		if (!page) {
 			kfree_skb(skb);
 no_skb:
@@ -310,18 +442,20 @@ no_skb:
 		BUG_ON(np->rx_skbs[id]);
 		np->rx_skbs[id] = skb;
 
-		ref = gnttab_claim_grant_reference(&np->gref_rx_head);
-		BUG_ON((signed short)ref < 0);
+		ref = NETFRONT_SKB_CB(skb)->ref;
+		if (ref == GRANT_INVALID_REF) {
+			ref = gnttab_claim_grant_reference(&np->gref_rx_head);
+			BUG_ON((signed short)ref < 0);
+
+			pfn = page_to_pfn(skb_shinfo(skb)->frags[0].page);
+			gnttab_grant_foreign_access_ref(ref,
+							np->xbdev->otherend_id,
+							pfn_to_mfn(pfn),
+							0);
+		}
 		np->grant_rx_ref[id] = ref;
 
-		pfn = page_to_pfn(skb_shinfo(skb)->frags[0].page);
-		vaddr = page_address(skb_shinfo(skb)->frags[0].page);
-
 		req = RING_GET_REQUEST(&np->rx, req_prod + i);
-		gnttab_grant_foreign_access_ref(ref,
-						np->xbdev->otherend_id,
-						pfn_to_mfn(pfn),
-						0);
 
 		req->id = id;
 		req->gref = ref;
@@ -334,38 +468,42 @@ no_skb:
  push:
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&np->rx, notify);
 	if (notify)
-		notify_remote_via_irq(np->netdev->irq);
+		notify_remote_via_irq(np->irq);
 }
 
 static int xennet_open(struct net_device *dev)
 {
-	struct netfront_info *np = netdev_priv(dev);
+	struct netfront_info *info = netdev_priv(dev);
+	unsigned int i;
 
-	napi_enable(&np->napi);
+	for (i = 0; i < info->num_queues; i++) {
+		struct netfront_info *np = info->queues[i];
 
-	spin_lock_bh(&np->rx_lock);
-	if (netif_carrier_ok(dev)) {
-		xennet_alloc_rx_buffers(dev);
-		np->rx.sring->rsp_event = np->rx.rsp_cons + 1;
-		if (RING_HAS_UNCONSUMED_RESPONSES(&np->rx))
-			napi_schedule(&np->napi);
+		napi_enable(&np->napi);
+
+		spin_lock_bh(&np->rx_lock);
+		if (netif_carrier_ok(dev)) {
+			xennet_alloc_rx_buffers(np);
+			np->rx.sring->rsp_event = np->rx.rsp_cons + 1;
+			if (RING_HAS_UNCONSUMED_RESPONSES(&np->rx))
+				napi_schedule(&np->napi);
+		}
+		spin_unlock_bh(&np->rx_lock);
 	}
-	spin_unlock_bh(&np->rx_lock);
 
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 
 	return 0;
 }
 
-static int xennet_tx_buf_gc(struct net_device *dev)
+static int xennet_tx_buf_gc(struct netfront_info *np)
 {
 	RING_IDX cons, prod;
 	RING_IDX cons_begin, cons_end;
 	unsigned short id;
-	struct netfront_info *np = netdev_priv(dev);
 	struct sk_buff *skb;
 
-	BUG_ON(!netif_carrier_ok(dev));
+	BUG_ON(!netif_carrier_ok(np->netdev));
 
 	cons_begin = np->tx.rsp_cons;
 	do {
@@ -381,6 +519,8 @@ static int xennet_tx_buf_gc(struct net_device *dev)
 
 			id  = txrsp->id;
 			skb = np->tx_skbs[id].skb;
+			if (np->grant_tx_ref[id] == GRANT_INVALID_REF)
+				goto persistent;
 			if (unlikely(gnttab_query_foreign_access(
 				np->grant_tx_ref[id]) != 0)) {
 				printk(KERN_ALERT "xennet_tx_buf_gc: warning "
@@ -393,6 +533,7 @@ static int xennet_tx_buf_gc(struct net_device *dev)
 			gnttab_release_grant_reference(
 				&np->gref_tx_head, np->grant_tx_ref[id]);
 			np->grant_tx_ref[id] = GRANT_INVALID_REF;
+ persistent:
 			add_id_to_freelist(&np->tx_skb_freelist, np->tx_skbs, id);
 			dev_kfree_skb_irq(skb);
 		}
@@ -414,15 +555,14 @@ static int xennet_tx_buf_gc(struct net_device *dev)
 
 	cons_end = np->tx.rsp_cons;
 
-	xennet_maybe_wake_tx(dev);
+	xennet_maybe_wake_tx(np);
 
 	return (cons_begin == cons_end);
 }
 
-static void xennet_make_frags(struct sk_buff *skb, struct net_device *dev,
+static void xennet_make_frags(struct sk_buff *skb, struct netfront_info *np,
 			      struct xen_netif_tx_request *tx)
 {
-	struct netfront_info *np = netdev_priv(dev);
 	char *data = skb->data;
 	unsigned long mfn;
 	RING_IDX prod = np->tx.req_prod_pvt;
@@ -485,10 +625,49 @@ static void xennet_make_frags(struct sk_buff *skb, struct net_device *dev,
 	np->tx.req_prod_pvt = prod;
 }
 
+/*
+ * Persistent-grant counterpart of xennet_make_frags(): pack the whole
+ * packet, page by page, into the pre-granted buffers of the slots used.
+ * @tx is the first request, whose id the caller has already claimed.
+ */
+static void xennet_copy_persistent(struct sk_buff *skb,
+				   struct netfront_info *np,
+				   struct xen_netif_tx_request *tx)
+{
+	RING_IDX prod = np->tx.req_prod_pvt;
+	unsigned int offset = 0;
+	unsigned short id = tx->id;
+
+	for (;;) {
+		unsigned int len = min_t(unsigned int, skb->len - offset,
+					 PAGE_SIZE);
+
+		skb_copy_bits(skb, offset, np->tx_pers_buf[id], len);
+		tx->gref = np->tx_pers_ref[id];
+		tx->offset = 0;
+		tx->size = len;
+
+		offset += len;
+		if (offset == skb->len)
+			break;
+
+		tx->flags |= NETTXF_more_data;
+
+		id = get_id_from_freelist(&np->tx_skb_freelist, np->tx_skbs);
+		np->tx_skbs[id].skb = skb_get(skb);
+		tx = RING_GET_REQUEST(&np->tx, prod++);
+		tx->id = id;
+		tx->flags = 0;
+	}
+
+	np->tx.req_prod_pvt = prod;
+}
+
 static int xennet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	unsigned short id;
 	struct netfront_info *np = netdev_priv(dev);
+	u16 queue_index = skb_get_queue_mapping(skb);
 	struct xen_netif_tx_request *tx;
 	struct xen_netif_extra_info *extra;
 	char *data = skb->data;
@@ -500,7 +679,15 @@ static int xennet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	unsigned int offset = offset_in_page(data);
 	unsigned int len = skb_headlen(skb);
 
-	frags += DIV_ROUND_UP(offset + len, PAGE_SIZE);
+	/* Deliver on the ring pair of the stack-selected queue. */
+	if (unlikely(queue_index >= np->num_queues))
+		queue_index = 0;
+	np = np->queues[queue_index];
+
+	if (np->persistent)
+		frags = DIV_ROUND_UP(skb->len, PAGE_SIZE);
+	else
+		frags += DIV_ROUND_UP(offset + len, PAGE_SIZE);
 	if (unlikely(frags > MAX_SKB_FRAGS + 1)) {
 		printk(KERN_ALERT "xennet: skb rides the rocket: %d frags\n",
 		       frags);
@@ -525,14 +712,16 @@ static int xennet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	tx = RING_GET_REQUEST(&np->tx, i);
 
 	tx->id   = id;
-	ref = gnttab_claim_grant_reference(&np->gref_tx_head);
-	BUG_ON((signed short)ref < 0);
-	mfn = virt_to_mfn(data);
-	gnttab_grant_foreign_access_ref(
-		ref, np->xbdev->otherend_id, mfn, GNTMAP_readonly);
-	tx->gref = np->grant_tx_ref[id] = ref;
-	tx->offset = offset;
-	tx->size = len;
+	if (!np->persistent) {
+		ref = gnttab_claim_grant_reference(&np->gref_tx_head);
+		BUG_ON((signed short)ref < 0);
+		mfn = virt_to_mfn(data);
+		gnttab_grant_foreign_access_ref(
+			ref, np->xbdev->otherend_id, mfn, GNTMAP_readonly);
+		tx->gref = np->grant_tx_ref[id] = ref;
+		tx->offset = offset;
+		tx->size = len;
+	}
 	extra = NULL;
 
 	tx->flags = 0;
@@ -566,21 +755,24 @@ static int xennet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	np->tx.req_prod_pvt = i + 1;
 
-	xennet_make_frags(skb, dev, tx);
+	if (np->persistent)
+		xennet_copy_persistent(skb, np, tx);
+	else
+		xennet_make_frags(skb, np, tx);
 	tx->size = skb->len;
 
 	RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&np->tx, notify);
 	if (notify)
-		notify_remote_via_irq(np->netdev->irq);
+		notify_remote_via_irq(np->irq);
 
 	dev->stats.tx_bytes += skb->len;
 	dev->stats.tx_packets++;
 
 	/* Note: It is not safe to access skb after xennet_tx_buf_gc()! */
-	xennet_tx_buf_gc(dev);
+	xennet_tx_buf_gc(np);
 
 	if (!netfront_tx_slot_available(np))
-		netif_stop_queue(dev);
+		netif_tx_stop_queue(xennet_txq(np));
 
 	spin_unlock_irq(&np->tx_lock);
 
@@ -594,9 +786,12 @@ static int xennet_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 static int xennet_close(struct net_device *dev)
 {
-	struct netfront_info *np = netdev_priv(dev);
-	netif_stop_queue(np->netdev);
-	napi_disable(&np->napi);
+	struct netfront_info *info = netdev_priv(dev);
+	unsigned int i;
+
+	netif_tx_stop_all_queues(dev);
+	for (i = 0; i < info->num_queues; i++)
+		napi_disable(&info->queues[i]->napi);
 	return 0;
 }
 
@@ -701,10 +896,20 @@ static int xennet_get_responses(struct netfront_info *np,
 			goto next;
 		}
 
-		ret = gnttab_end_foreign_access_ref(ref, 0);
-		BUG_ON(!ret);
+		/*
+		 * A packet that fits the skb head is copied out of its
+		 * page, which can then be reused with the grant in place.
+		 */
+		if (frags == 1 && !(rx->flags & NETRXF_more_data) &&
+		    rx->status <= RX_COPY_THRESHOLD) {
+			NETFRONT_SKB_CB(skb)->ref = ref;
+		} else {
+			ret = gnttab_end_foreign_access_ref(ref, 0);
+			BUG_ON(!ret);
 
-		gnttab_release_grant_reference(&np->gref_rx_head, ref);
+			gnttab_release_grant_reference(&np->gref_rx_head, ref);
+			NETFRONT_SKB_CB(skb)->ref = GRANT_INVALID_REF;
+		}
 
 		__skb_queue_tail(list, skb);
 
@@ -833,9 +1038,10 @@ out:
 	return err;
 }
 
-static int handle_incoming_queue(struct net_device *dev,
+static int handle_incoming_queue(struct netfront_info *np,
 				 struct sk_buff_head *rxq)
 {
+	struct net_device *dev = np->netdev;
 	int packets_dropped = 0;
 	struct sk_buff *skb;
 
@@ -847,7 +1053,10 @@ static int handle_incoming_queue(struct net_device *dev,
 		memcpy(skb->data, vaddr + offset,
 		       skb_headlen(skb));
 
-		if (page != skb_shinfo(skb)->frags[0].page)
+		if (NETFRONT_SKB_CB(skb)->ref != GRANT_INVALID_REF)
+			xennet_recycle_rx_page(np, page,
+					       NETFRONT_SKB_CB(skb)->ref);
+		else if (page != skb_shinfo(skb)->frags[0].page)
 			__free_page(page);
 
 		/* Ethernet work: Delayed to here as it peeks the header. */
@@ -865,8 +1074,11 @@ static int handle_incoming_queue(struct net_device *dev,
 		dev->stats.rx_packets++;
 		dev->stats.rx_bytes += skb->len;
 
-		/* Pass it up. */
-		netif_receive_skb(skb);
+		skb_record_rx_queue(skb, np->queue_index);
+		skb_mark_napi_id(skb, &np->napi);
+
+		/* Pass it up, merging TCP streams where GRO can. */
+		napi_gro_receive(&np->napi, skb);
 	}
 
 	return packets_dropped;
@@ -985,9 +1197,19 @@ err:
 		work_done++;
 	}
 
-	__skb_queue_purge(&errq);
+	while ((skb = __skb_dequeue(&errq)) != NULL) {
+		if (NETFRONT_SKB_CB(skb)->ref != GRANT_INVALID_REF) {
+			xennet_recycle_rx_page(np,
+					       skb_shinfo(skb)->frags[0].page,
+					       NETFRONT_SKB_CB(skb)->ref);
+			skb_shinfo(skb)->nr_frags = 0;
+		}
+		kfree_skb(skb);
+	}
+
+	work_done -= handle_incoming_queue(np, &rxq);
 
-	work_done -= handle_incoming_queue(dev, &rxq);
+	np->smart_poll.packets += work_done;
 
 	/* If we get a callback with very few responses, reduce fill target. */
 	/* NB. Note exponential increase, linear decrease. */
@@ -996,11 +1218,14 @@ err:
 	    (--np->rx_target < np->rx_min_target))
 		np->rx_target = np->rx_min_target;
 
-	xennet_alloc_rx_buffers(dev);
+	xennet_alloc_rx_buffers(np);
 
 	if (work_done < budget) {
 		int more_to_do = 0;
 
+		/* Don't hold on to merged packets across the idle period. */
+		napi_gro_flush(napi);
+
 		local_irq_save(flags);
 
 		RING_FINAL_CHECK_FOR_RESPONSES(&np->rx, more_to_do);
@@ -1036,11 +1261,13 @@ static void xennet_release_tx_bufs(struct netfront_info *np)
 			continue;
 
 		skb = np->tx_skbs[i].skb;
-		gnttab_end_foreign_access_ref(np->grant_tx_ref[i],
-					      GNTMAP_readonly);
-		gnttab_release_grant_reference(&np->gref_tx_head,
-					       np->grant_tx_ref[i]);
-		np->grant_tx_ref[i] = GRANT_INVALID_REF;
+		if (np->grant_tx_ref[i] != GRANT_INVALID_REF) {
+			gnttab_end_foreign_access_ref(np->grant_tx_ref[i],
+						      GNTMAP_readonly);
+			gnttab_release_grant_reference(&np->gref_tx_head,
+						       np->grant_tx_ref[i]);
+			np->grant_tx_ref[i] = GRANT_INVALID_REF;
+		}
 		add_id_to_freelist(&np->tx_skb_freelist, np->tx_skbs, i);
 		dev_kfree_skb_irq(skb);
 	}
@@ -1141,21 +1368,16 @@ static const struct net_device_ops xennet_netdev_ops = {
 	.ndo_validate_addr   = eth_validate_addr,
 };
 
-static struct net_device * __devinit xennet_create_dev(struct xenbus_device *dev)
+/* Set up the software state of one queue: locks, freelists and grants. */
+static int xennet_init_queue(struct netfront_info *np,
+			     struct net_device *netdev,
+			     struct xenbus_device *dev, unsigned int index)
 {
-	int i, err;
-	struct net_device *netdev;
-	struct netfront_info *np;
-
-	netdev = alloc_etherdev(sizeof(struct netfront_info));
-	if (!netdev) {
-		printk(KERN_WARNING "%s> alloc_etherdev failed.\n",
-		       __func__);
-		return ERR_PTR(-ENOMEM);
-	}
+	int i;
 
-	np                   = netdev_priv(netdev);
+	np->netdev           = netdev;
 	np->xbdev            = dev;
+	np->queue_index      = index;
 
 	spin_lock_init(&np->tx_lock);
 	spin_lock_init(&np->rx_lock);
@@ -1166,14 +1388,21 @@ static struct net_device * __devinit xennet_create_dev(struct xenbus_device *dev
 	np->rx_max_target = RX_MAX_TARGET;
 
 	init_timer(&np->rx_refill_timer);
-	np->rx_refill_timer.data = (unsigned long)netdev;
+	np->rx_refill_timer.data = (unsigned long)np;
 	np->rx_refill_timer.function = rx_refill_timeout;
 
+	np->smart_poll.adaptive = 1;
+	np->smart_poll.usecs_low = DEFAULT_ADAPT_USECS_LOW;
+	np->smart_poll.usecs_high = DEFAULT_ADAPT_USECS_HIGH;
+	np->smart_poll.frames = DEFAULT_ADAPT_FRAMES;
+	np->smart_poll.rate_low = DEFAULT_ADAPT_RATE_LOW;
+
 	/* Initialise tx_skbs as a free chain containing every entry. */
 	np->tx_skb_freelist = 0;
 	for (i = 0; i < NET_TX_RING_SIZE; i++) {
 		skb_entry_set_link(&np->tx_skbs[i], i+1);
 		np->grant_tx_ref[i] = GRANT_INVALID_REF;
+		np->tx_pers_ref[i] = GRANT_INVALID_REF;
 	}
 
 	/* Clear out rx_skbs */
@@ -1186,33 +1415,128 @@ static struct net_device * __devinit xennet_create_dev(struct xenbus_device *dev
 	if (gnttab_alloc_grant_references(TX_MAX_TARGET,
 					  &np->gref_tx_head) < 0) {
 		printk(KERN_ALERT "#### netfront can't alloc tx grant refs\n");
-		err = -ENOMEM;
-		goto exit;
+		return -ENOMEM;
 	}
-	/* A grant for every rx ring slot */
-	if (gnttab_alloc_grant_references(RX_MAX_TARGET,
+	/* A grant for every rx ring slot, and for every pooled page */
+	if (gnttab_alloc_grant_references(RX_MAX_TARGET + XENNET_RX_POOL_SIZE,
 					  &np->gref_rx_head) < 0) {
 		printk(KERN_ALERT "#### netfront can't alloc rx grant refs\n");
-		err = -ENOMEM;
-		goto exit_free_tx;
+		gnttab_free_grant_references(np->gref_tx_head);
+		return -ENOMEM;
+	}
+
+	netif_napi_add(netdev, &np->napi, xennet_poll, 64);
+	napi_hash_add(&np->napi);
+
+	return 0;
+}
+
+static void xennet_destroy_queue(struct netfront_info *np)
+{
+	napi_hash_del(&np->napi);
+	synchronize_net();
+	netif_napi_del(&np->napi);
+	del_timer_sync(&np->rx_refill_timer);
+	xennet_release_tx_bufs(np);
+	xennet_release_rx_bufs(np);
+	gnttab_free_grant_references(np->gref_tx_head);
+	gnttab_free_grant_references(np->gref_rx_head);
+	kfree(np);
+}
+
+/*
+ * Grow or shrink the set of queues to @num_queues.  Queue 0 is never
+ * freed here.  Called with the backend disconnected.  If memory is
+ * short we carry on with however many queues could be set up.
+ */
+static void xennet_create_queues(struct netfront_info *info,
+				 unsigned int num_queues)
+{
+	struct net_device *netdev = info->netdev;
+	struct netfront_info *old[XENNET_MAX_QUEUES];
+	unsigned int i, nr_old = 0;
+
+	rtnl_lock();
+
+	/* Quiesce every transmitter before swapping the queue table. */
+	netif_tx_lock_bh(netdev);
+	for (i = num_queues; i < info->num_queues; i++) {
+		old[nr_old++] = info->queues[i];
+		info->queues[i] = NULL;
+	}
+	if (num_queues < info->num_queues) {
+		info->num_queues = num_queues;
+		netdev->real_num_tx_queues = num_queues;
 	}
+	netif_tx_unlock_bh(netdev);
+
+	for (i = 0; i < nr_old; i++) {
+		if (netif_running(netdev))
+			napi_disable(&old[i]->napi);
+		xennet_destroy_queue(old[i]);
+	}
+
+	for (i = info->num_queues; i < num_queues; i++) {
+		struct netfront_info *np = kzalloc(sizeof(*np), GFP_KERNEL);
+
+		if (!np)
+			break;
+		if (xennet_init_queue(np, netdev, info->xbdev, i)) {
+			kfree(np);
+			break;
+		}
+		if (netif_running(netdev))
+			napi_enable(&np->napi);
+		info->queues[i] = np;
+	}
+
+	if (i < num_queues)
+		dev_warn(&netdev->dev, "only %u of %u queues allocated\n",
+			 i, num_queues);
+
+	netif_tx_lock_bh(netdev);
+	info->num_queues = i;
+	netdev->real_num_tx_queues = i;
+	netif_tx_unlock_bh(netdev);
+
+	rtnl_unlock();
+}
+
+static struct net_device * __devinit xennet_create_dev(struct xenbus_device *dev)
+{
+	int err;
+	struct net_device *netdev;
+	struct netfront_info *np;
+
+	netdev = alloc_etherdev_mq(sizeof(struct netfront_info),
+				   XENNET_MAX_QUEUES);
+	if (!netdev) {
+		printk(KERN_WARNING "%s> alloc_etherdev failed.\n",
+		       __func__);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* Only one queue until the backend has been asked for more. */
+	netdev->real_num_tx_queues = 1;
+
+	np                   = netdev_priv(netdev);
+	err = xennet_init_queue(np, netdev, dev, 0);
+	if (err)
+		goto exit;
+	np->num_queues = 1;
+	np->queues[0] = np;
 
 	netdev->netdev_ops	= &xennet_netdev_ops;
 
-	netif_napi_add(netdev, &np->napi, xennet_poll, 64);
-	netdev->features        = NETIF_F_IP_CSUM;
+	netdev->features        = NETIF_F_IP_CSUM | NETIF_F_GRO;
 
 	SET_ETHTOOL_OPS(netdev, &xennet_ethtool_ops);
 	SET_NETDEV_DEV(netdev, &dev->dev);
 
-	np->netdev = netdev;
-
 	netif_carrier_off(netdev);
 
 	return netdev;
 
- exit_free_tx:
-	gnttab_free_grant_references(np->gref_tx_head);
  exit:
 	free_netdev(netdev);
 	return ERR_PTR(err);
@@ -1258,6 +1582,8 @@ static int __devinit netfront_probe(struct xenbus_device *dev,
 	return 0;
 
  fail:
+	napi_hash_del(&info->napi);
+	synchronize_net();
 	free_netdev(netdev);
 	dev_set_drvdata(&dev->dev, NULL);
 	return err;
@@ -1270,34 +1596,94 @@ static void xennet_end_access(int ref, void *page)
 		gnttab_end_foreign_access(ref, 0, (unsigned long)page);
 }
 
-static void xennet_disconnect_backend(struct netfront_info *info)
+static void xennet_release_persistent(struct netfront_info *np)
 {
-	/* Stop old i/f to prevent errors whilst we rebuild the state. */
-	spin_lock_bh(&info->rx_lock);
-	spin_lock_irq(&info->tx_lock);
-	netif_carrier_off(info->netdev);
-	spin_unlock_irq(&info->tx_lock);
-	spin_unlock_bh(&info->rx_lock);
+	int i;
+
+	for (i = 0; i < NET_TX_RING_SIZE; i++) {
+		if (!np->tx_pers_buf[i])
+			continue;
+		if (np->tx_pers_ref[i] != GRANT_INVALID_REF)
+			xennet_end_access(np->tx_pers_ref[i],
+					  np->tx_pers_buf[i]);
+		else
+			free_page((unsigned long)np->tx_pers_buf[i]);
+		np->tx_pers_buf[i] = NULL;
+		np->tx_pers_ref[i] = GRANT_INVALID_REF;
+	}
+}
+
+/* Grant the backend a buffer for each TX slot, for this connection. */
+static int xennet_setup_persistent(struct xenbus_device *dev,
+				   struct netfront_info *np)
+{
+	int i, ref;
+
+	for (i = 0; i < NET_TX_RING_SIZE; i++) {
+		np->tx_pers_buf[i] = (void *)__get_free_page(GFP_NOIO |
+							     __GFP_HIGH);
+		if (!np->tx_pers_buf[i])
+			goto fail;
+		ref = gnttab_grant_foreign_access(dev->otherend_id,
+						  virt_to_mfn(np->tx_pers_buf[i]),
+						  GNTMAP_readonly);
+		if (ref < 0)
+			goto fail;
+		np->tx_pers_ref[i] = ref;
+	}
+	return 0;
 
-	if (info->netdev->irq)
-		unbind_from_irqhandler(info->netdev->irq, info->netdev);
-	info->evtchn = info->netdev->irq = 0;
+ fail:
+	xennet_release_persistent(np);
+	return -ENOMEM;
+}
+
+static void xennet_disconnect_queue(struct netfront_info *np)
+{
+	if (np->irq)
+		unbind_from_irqhandler(np->irq, np);
+	np->evtchn = np->irq = 0;
 
 	/* End access and free the pages */
-	xennet_end_access(info->tx_ring_ref, info->tx.sring);
-	xennet_end_access(info->rx_ring_ref, info->rx.sring);
+	xennet_end_access(np->tx_ring_ref, np->tx.sring);
+	xennet_end_access(np->rx_ring_ref, np->rx.sring);
 
-	info->tx_ring_ref = GRANT_INVALID_REF;
-	info->rx_ring_ref = GRANT_INVALID_REF;
-	info->tx.sring = NULL;
-	info->rx.sring = NULL;
+	np->tx_ring_ref = GRANT_INVALID_REF;
+	np->rx_ring_ref = GRANT_INVALID_REF;
+	np->tx.sring = NULL;
+	np->rx.sring = NULL;
+
+	xennet_release_persistent(np);
+	xennet_release_rx_pool(np);
+}
+
+static void xennet_disconnect_backend(struct netfront_info *info)
+{
+	unsigned int i;
+
+	/* Stop old i/f to prevent errors whilst we rebuild the state. */
+	for (i = 0; i < info->num_queues; i++) {
+		struct netfront_info *np = info->queues[i];
+
+		spin_lock_bh(&np->rx_lock);
+		spin_lock_irq(&np->tx_lock);
+		netif_carrier_off(info->netdev);
+		spin_unlock_irq(&np->tx_lock);
+		spin_unlock_bh(&np->rx_lock);
+	}
+
+	for (i = 0; i < info->num_queues; i++)
+		xennet_disconnect_queue(info->queues[i]);
+	info->netdev->irq = 0;
 }
 
 static int netfront_suspend(struct xenbus_device *dev, pm_message_t state)
 {
 	struct netfront_info *info = dev_get_drvdata(&dev->dev);
-	struct hrtimer *timer = &info->smart_poll.timer;
-	hrtimer_cancel(timer);
+	unsigned int i;
+
+	for (i = 0; i < info->num_queues; i++)
+		hrtimer_cancel(&info->queues[i]->smart_poll.timer);
 	return 0;
 }
 
@@ -1339,6 +1725,39 @@ static int xen_net_read_mac(struct xenbus_device *dev, u8 mac[])
 	return 0;
 }
 
+static void xennet_smart_poll_restart_sample(struct netfront_smart_poll *sp)
+{
+	sp->packets = 0;
+	sp->sample_start = ktime_get();
+}
+
+/*
+ * Re-derive the poll frequency from the packet rate of the last sample.
+ * Returns 0 if the rate is too low to be worth polling for.
+ */
+static int xennet_smart_poll_adapt(struct netfront_smart_poll *sp)
+{
+	u64 elapsed, rate, usecs;
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), sp->sample_start));
+	if (elapsed < ADAPT_SAMPLE_NSECS)
+		return 1;
+
+	rate = div64_u64((u64)sp->packets * NSEC_PER_SEC, elapsed);
+	xennet_smart_poll_restart_sample(sp);
+
+	if (rate < sp->rate_low) {
+		/* Resume polling at the low-latency end next time. */
+		sp->smart_poll_freq = MICRO_SECOND / sp->usecs_low;
+		return 0;
+	}
+
+	usecs = div64_u64((u64)sp->frames * MICRO_SECOND, rate);
+	usecs = clamp_t(u64, usecs, sp->usecs_low, sp->usecs_high);
+	sp->smart_poll_freq = MICRO_SECOND / (unsigned int)usecs;
+	return 1;
+}
+
 static enum hrtimer_restart smart_poll_function(struct hrtimer *timer)
 {
 	struct netfront_smart_poll *psmart_poll;
@@ -1348,8 +1767,8 @@ static enum hrtimer_restart smart_poll_function(struct hrtimer *timer)
 	unsigned int tx_active = 0, rx_active = 0;
 
 	psmart_poll = container_of(timer, struct netfront_smart_poll, timer);
-	dev = psmart_poll->netdev;
-	np = netdev_priv(dev);
+	np = container_of(psmart_poll, struct netfront_info, smart_poll);
+	dev = np->netdev;
 
 	spin_lock_irqsave(&np->tx_lock, flags);
 
@@ -1359,7 +1778,7 @@ static enum hrtimer_restart smart_poll_function(struct hrtimer *timer)
 	np->smart_poll.counter++;
 
 	if (likely(netif_carrier_ok(dev))) {
-		tx_active = !(xennet_tx_buf_gc(dev));
+		tx_active = !(xennet_tx_buf_gc(np));
 		/* Under tx_lock: protects access to rx shared-ring indexes. */
 		if (RING_HAS_UNCONSUMED_RESPONSES(&np->rx)) {
 			rx_active = 1;
@@ -1368,8 +1787,13 @@ static enum hrtimer_restart smart_poll_function(struct hrtimer *timer)
 	}
 
 	np->smart_poll.active |= (tx_active || rx_active);
-	if (np->smart_poll.counter %
-			(np->smart_poll.smart_poll_freq / 10) == 0) {
+	if (np->smart_poll.adaptive) {
+		if (!xennet_smart_poll_adapt(&np->smart_poll)) {
+			np->rx.sring->private.netif.smartpoll_active = 0;
+			goto end;
+		}
+	} else if (np->smart_poll.counter %
+			max(np->smart_poll.smart_poll_freq / 10, 1U) == 0) {
 		if (!np->smart_poll.active) {
 			np->rx.sring->private.netif.smartpoll_active = 0;
 			goto end;
@@ -1394,20 +1818,22 @@ end:
 
 static irqreturn_t xennet_interrupt(int irq, void *dev_id)
 {
-	struct net_device *dev = dev_id;
-	struct netfront_info *np = netdev_priv(dev);
+	struct netfront_info *np = dev_id;
+	struct net_device *dev = np->netdev;
 	unsigned long flags;
 
 	spin_lock_irqsave(&np->tx_lock, flags);
 
 	if (likely(netif_carrier_ok(dev))) {
-		xennet_tx_buf_gc(dev);
+		xennet_tx_buf_gc(np);
 		/* Under tx_lock: protects access to rx shared-ring indexes. */
 		if (RING_HAS_UNCONSUMED_RESPONSES(&np->rx))
 			napi_schedule(&np->napi);
 	}
 
 	if (np->smart_poll.feature_smart_poll) {
+		if (np->smart_poll.adaptive)
+			xennet_smart_poll_restart_sample(&np->smart_poll);
 		if ( hrtimer_start(&np->smart_poll.timer,
 			ktime_set(0,NANO_SECOND/np->smart_poll.smart_poll_freq),
 			HRTIMER_MODE_REL) ) {
@@ -1433,13 +1859,7 @@ static int setup_netfront(struct xenbus_device *dev, struct netfront_info *info)
 	info->rx_ring_ref = GRANT_INVALID_REF;
 	info->rx.sring = NULL;
 	info->tx.sring = NULL;
-	netdev->irq = 0;
-
-	err = xen_net_read_mac(dev, netdev->dev_addr);
-	if (err) {
-		xenbus_dev_fatal(dev, err, "parsing %s/mac", dev->nodename);
-		goto fail;
-	}
+	info->irq = 0;
 
 	txs = (struct xen_netif_tx_sring *)get_zeroed_page(GFP_NOIO | __GFP_HIGH);
 	if (!txs) {
@@ -1473,34 +1893,84 @@ static int setup_netfront(struct xenbus_device *dev, struct netfront_info *info)
 	}
 	info->rx_ring_ref = err;
 
+	if (info->persistent) {
+		err = xennet_setup_persistent(dev, info);
+		if (err) {
+			xenbus_dev_fatal(dev, err, "granting persistent buffers");
+			goto fail;
+		}
+	}
+
 	err = xenbus_alloc_evtchn(dev, &info->evtchn);
 	if (err)
 		goto fail;
 
+	if (info->queue_index)
+		snprintf(info->irq_name, sizeof(info->irq_name), "%s-q%u",
+			 netdev->name, info->queue_index);
+	else
+		strlcpy(info->irq_name, netdev->name, sizeof(info->irq_name));
+
 	err = bind_evtchn_to_irqhandler(info->evtchn, xennet_interrupt,
-					IRQF_SAMPLE_RANDOM, netdev->name,
-					netdev);
+					IRQF_SAMPLE_RANDOM, info->irq_name,
+					info);
 	if (err < 0)
 		goto fail;
-	netdev->irq = err;
+	info->irq = err;
+	if (info->queue_index == 0)
+		netdev->irq = err;
 	return 0;
 
  fail:
 	return err;
 }
 
+/* Write the ring references and event channel of one queue to @dir. */
+static int write_queue_xenstore_keys(struct netfront_info *np,
+				     struct xenbus_transaction xbt,
+				     const char *dir, const char **message)
+{
+	int err;
+
+	err = xenbus_printf(xbt, dir, "tx-ring-ref", "%u", np->tx_ring_ref);
+	if (err) {
+		*message = "writing tx ring-ref";
+		return err;
+	}
+	err = xenbus_printf(xbt, dir, "rx-ring-ref", "%u", np->rx_ring_ref);
+	if (err) {
+		*message = "writing rx ring-ref";
+		return err;
+	}
+	err = xenbus_printf(xbt, dir, "event-channel", "%u", np->evtchn);
+	if (err) {
+		*message = "writing event-channel";
+		return err;
+	}
+	return 0;
+}
+
 /* Common code used when first setting up, and when resuming. */
 static int talk_to_netback(struct xenbus_device *dev,
 			   struct netfront_info *info)
 {
 	const char *message;
 	struct xenbus_transaction xbt;
+	unsigned int i;
 	int err;
 
-	/* Create shared ring, alloc event channel. */
-	err = setup_netfront(dev, info);
-	if (err)
+	err = xen_net_read_mac(dev, info->netdev->dev_addr);
+	if (err) {
+		xenbus_dev_fatal(dev, err, "parsing %s/mac", dev->nodename);
 		goto out;
+	}
+
+	/* Create shared rings, alloc event channels. */
+	for (i = 0; i < info->num_queues; i++) {
+		err = setup_netfront(dev, info->queues[i]);
+		if (err)
+			goto destroy_ring;
+	}
 
 again:
 	err = xenbus_transaction_start(&xbt);
@@ -1509,23 +1979,34 @@ again:
 		goto destroy_ring;
 	}
 
-	err = xenbus_printf(xbt, dev->nodename, "tx-ring-ref", "%u",
-			    info->tx_ring_ref);
-	if (err) {
-		message = "writing tx ring-ref";
-		goto abort_transaction;
-	}
-	err = xenbus_printf(xbt, dev->nodename, "rx-ring-ref", "%u",
-			    info->rx_ring_ref);
-	if (err) {
-		message = "writing rx ring-ref";
-		goto abort_transaction;
-	}
-	err = xenbus_printf(xbt, dev->nodename,
-			    "event-channel", "%u", info->evtchn);
-	if (err) {
-		message = "writing event-channel";
-		goto abort_transaction;
+	if (info->num_queues == 1) {
+		err = write_queue_xenstore_keys(info, xbt, dev->nodename,
+						&message);
+		if (err)
+			goto abort_transaction;
+	} else {
+		err = xenbus_printf(xbt, dev->nodename,
+				    "multi-queue-num-queues", "%u",
+				    info->num_queues);
+		if (err) {
+			message = "writing multi-queue-num-queues";
+			goto abort_transaction;
+		}
+
+		for (i = 0; i < info->num_queues; i++) {
+			char *path = kasprintf(GFP_KERNEL, "%s/queue-%u",
+					       dev->nodename, i);
+			if (!path) {
+				err = -ENOMEM;
+				message = "allocating queue path";
+				goto abort_transaction;
+			}
+			err = write_queue_xenstore_keys(info->queues[i], xbt,
+							path, &message);
+			kfree(path);
+			if (err)
+				goto abort_transaction;
+		}
 	}
 
 	err = xenbus_printf(xbt, dev->nodename, "request-rx-copy", "%u",
@@ -1559,6 +2040,13 @@ again:
 		goto abort_transaction;
 	}
 
+	err = xenbus_printf(xbt, dev->nodename, "feature-persistent", "%u",
+			    info->persistent);
+	if (err) {
+		message = "writing feature-persistent";
+		goto abort_transaction;
+	}
+
 	err = xenbus_transaction_end(xbt, 0);
 	if (err) {
 		if (err == -EAGAIN)
@@ -1628,14 +2116,15 @@ static void xennet_set_features(struct net_device *dev)
 
 static int xennet_connect(struct net_device *dev)
 {
-	struct netfront_info *np = netdev_priv(dev);
+	struct netfront_info *info = netdev_priv(dev);
 	int i, requeue_idx, err;
 	struct sk_buff *skb;
 	grant_ref_t ref;
 	struct xen_netif_rx_request *req;
-	unsigned int feature_rx_copy;
+	unsigned int feature_rx_copy, feature_persistent;
+	unsigned int max_queues, q;
 
-	err = xenbus_scanf(XBT_NIL, np->xbdev->otherend,
+	err = xenbus_scanf(XBT_NIL, info->xbdev->otherend,
 			   "feature-rx-copy", "%u", &feature_rx_copy);
 	if (err != 1)
 		feature_rx_copy = 0;
@@ -1646,58 +2135,85 @@ static int xennet_connect(struct net_device *dev)
 		return -ENODEV;
 	}
 
-	np->smart_poll.feature_smart_poll = 0;
-	if (use_smartpoll) {
-		err = xenbus_scanf(XBT_NIL, np->xbdev->otherend,
-				   "feature-smart-poll", "%u",
-				   &np->smart_poll.feature_smart_poll);
-		if (err != 1)
-			np->smart_poll.feature_smart_poll = 0;
-	}
+	err = xenbus_scanf(XBT_NIL, info->xbdev->otherend,
+			   "multi-queue-max-queues", "%u", &max_queues);
+	if (err != 1)
+		max_queues = 1;
+	max_queues = clamp_t(unsigned int, max_queues, 1, xennet_max_queues);
 
-	hrtimer_init(&np->smart_poll.timer, CLOCK_MONOTONIC,
-		     HRTIMER_MODE_REL);
-	if (np->smart_poll.feature_smart_poll) {
-		np->smart_poll.timer.function = smart_poll_function;
-		np->smart_poll.netdev = dev;
-		np->smart_poll.smart_poll_freq = DEFAULT_SMART_POLL_FREQ;
-		np->smart_poll.active = 0;
-		np->smart_poll.counter = 0;
+	xennet_create_queues(info, max_queues);
+
+	err = xenbus_scanf(XBT_NIL, info->xbdev->otherend,
+			   "feature-persistent", "%u", &feature_persistent);
+	if (err != 1)
+		feature_persistent = 0;
+
+	for (q = 0; q < info->num_queues; q++) {
+		struct netfront_info *np = info->queues[q];
+
+		np->persistent = xennet_persistent && feature_persistent;
+
+		np->smart_poll.feature_smart_poll = 0;
+		if (use_smartpoll) {
+			err = xenbus_scanf(XBT_NIL, np->xbdev->otherend,
+					   "feature-smart-poll", "%u",
+					   &np->smart_poll.feature_smart_poll);
+			if (err != 1)
+				np->smart_poll.feature_smart_poll = 0;
+		}
+
+		hrtimer_init(&np->smart_poll.timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL);
+		if (np->smart_poll.feature_smart_poll) {
+			np->smart_poll.timer.function = smart_poll_function;
+			np->smart_poll.netdev = dev;
+			np->smart_poll.smart_poll_freq = DEFAULT_SMART_POLL_FREQ;
+			np->smart_poll.active = 0;
+			np->smart_poll.counter = 0;
+			xennet_smart_poll_restart_sample(&np->smart_poll);
+		}
 	}
 
-	err = talk_to_netback(np->xbdev, np);
+	err = talk_to_netback(info->xbdev, info);
 	if (err)
 		return err;
 
 	xennet_set_features(dev);
 
-	spin_lock_bh(&np->rx_lock);
-	spin_lock_irq(&np->tx_lock);
+	for (q = 0; q < info->num_queues; q++) {
+		struct netfront_info *np = info->queues[q];
 
-	/* Step 1: Discard all pending TX packet fragments. */
-	xennet_release_tx_bufs(np);
+		spin_lock_bh(&np->rx_lock);
+		spin_lock_irq(&np->tx_lock);
 
-	/* Step 2: Rebuild the RX buffer freelist and the RX ring itself. */
-	for (requeue_idx = 0, i = 0; i < NET_RX_RING_SIZE; i++) {
-		if (!np->rx_skbs[i])
-			continue;
+		/* Step 1: Discard all pending TX packet fragments. */
+		xennet_release_tx_bufs(np);
 
-		skb = np->rx_skbs[requeue_idx] = xennet_get_rx_skb(np, i);
-		ref = np->grant_rx_ref[requeue_idx] = xennet_get_rx_ref(np, i);
-		req = RING_GET_REQUEST(&np->rx, requeue_idx);
+		/* Step 2: Rebuild the RX buffer freelist and the RX ring itself. */
+		for (requeue_idx = 0, i = 0; i < NET_RX_RING_SIZE; i++) {
+			if (!np->rx_skbs[i])
+				continue;
 
-		gnttab_grant_foreign_access_ref(
-			ref, np->xbdev->otherend_id,
-			pfn_to_mfn(page_to_pfn(skb_shinfo(skb)->
-					       frags->page)),
-			0);
-		req->gref = ref;
-		req->id   = requeue_idx;
+			skb = np->rx_skbs[requeue_idx] = xennet_get_rx_skb(np, i);
+			ref = np->grant_rx_ref[requeue_idx] = xennet_get_rx_ref(np, i);
+			req = RING_GET_REQUEST(&np->rx, requeue_idx);
 
-		requeue_idx++;
-	}
+			gnttab_grant_foreign_access_ref(
+				ref, np->xbdev->otherend_id,
+				pfn_to_mfn(page_to_pfn(skb_shinfo(skb)->
+						       frags->page)),
+				0);
+			req->gref = ref;
+			req->id   = requeue_idx;
+
+			requeue_idx++;
+		}
 
-	np->rx.req_prod_pvt = requeue_idx;
+		np->rx.req_prod_pvt = requeue_idx;
+
+		spin_unlock_irq(&np->tx_lock);
+		spin_unlock_bh(&np->rx_lock);
+	}
 
 	/*
 	 * Step 3: All public and private state should now be sane.  Get
@@ -1705,13 +2221,21 @@ static int xennet_connect(struct net_device *dev)
 	 * domain a kick because we've probably just requeued some
 	 * packets.
 	 */
-	netif_carrier_on(np->netdev);
-	notify_remote_via_irq(np->netdev->irq);
-	xennet_tx_buf_gc(dev);
-	xennet_alloc_rx_buffers(dev);
+	netif_carrier_on(dev);
 
-	spin_unlock_irq(&np->tx_lock);
-	spin_unlock_bh(&np->rx_lock);
+	for (q = 0; q < info->num_queues; q++) {
+		struct netfront_info *np = info->queues[q];
+
+		spin_lock_bh(&np->rx_lock);
+		spin_lock_irq(&np->tx_lock);
+
+		notify_remote_via_irq(np->irq);
+		xennet_tx_buf_gc(np);
+		xennet_alloc_rx_buffers(np);
+
+		spin_unlock_irq(&np->tx_lock);
+		spin_unlock_bh(&np->rx_lock);
+	}
 
 	return 0;
 }
@@ -1757,14 +2281,42 @@ static int xennet_get_coalesce(struct net_device *netdev,
 {
 	struct netfront_info *np = netdev_priv(netdev);
 	ec->rx_coalesce_usecs = MICRO_SECOND / np->smart_poll.smart_poll_freq;
+	ec->use_adaptive_rx_coalesce = np->smart_poll.adaptive;
+	ec->rx_coalesce_usecs_low = np->smart_poll.usecs_low;
+	ec->rx_coalesce_usecs_high = np->smart_poll.usecs_high;
+	ec->rx_max_coalesced_frames = np->smart_poll.frames;
+	ec->pkt_rate_low = np->smart_poll.rate_low;
 	return 0;
 }
 
 static int xennet_set_coalesce(struct net_device *netdev,
 		struct ethtool_coalesce *ec)
 {
-	struct netfront_info *np = netdev_priv(netdev);
-	np->smart_poll.smart_poll_freq = MICRO_SECOND / ec->rx_coalesce_usecs;
+	struct netfront_info *info = netdev_priv(netdev);
+	unsigned int i;
+
+	if (!ec->rx_coalesce_usecs || ec->rx_coalesce_usecs > MICRO_SECOND)
+		return -EINVAL;
+
+	if (ec->use_adaptive_rx_coalesce &&
+	    (!ec->rx_coalesce_usecs_low || !ec->rx_max_coalesced_frames ||
+	     ec->rx_coalesce_usecs_low > ec->rx_coalesce_usecs_high ||
+	     ec->rx_coalesce_usecs_high > MICRO_SECOND))
+		return -EINVAL;
+
+	for (i = 0; i < info->num_queues; i++) {
+		struct netfront_smart_poll *sp = &info->queues[i]->smart_poll;
+
+		sp->smart_poll_freq = MICRO_SECOND / ec->rx_coalesce_usecs;
+		sp->adaptive = ec->use_adaptive_rx_coalesce;
+		if (sp->adaptive) {
+			sp->usecs_low = ec->rx_coalesce_usecs_low;
+			sp->usecs_high = ec->rx_coalesce_usecs_high;
+			sp->frames = ec->rx_max_coalesced_frames;
+			sp->rate_low = ec->pkt_rate_low;
+			xennet_smart_poll_restart_sample(sp);
+		}
+	}
 	return 0;
 }
 
@@ -1793,9 +2345,10 @@ static ssize_t store_rxbuf_min(struct device *dev,
 			       const char *buf, size_t len)
 {
 	struct net_device *netdev = to_net_dev(dev);
-	struct netfront_info *np = netdev_priv(netdev);
+	struct netfront_info *info = netdev_priv(netdev);
 	char *endp;
 	unsigned long target;
+	unsigned int i;
 
 	if (!capable(CAP_NET_ADMIN))
 		return -EPERM;
@@ -1809,16 +2362,20 @@ static ssize_t store_rxbuf_min(struct device *dev,
 	if (target > RX_MAX_TARGET)
 		target = RX_MAX_TARGET;
 
-	spin_lock_bh(&np->rx_lock);
-	if (target > np->rx_max_target)
-		np->rx_max_target = target;
-	np->rx_min_target = target;
-	if (target > np->rx_target)
-		np->rx_target = target;
+	for (i = 0; i < info->num_queues; i++) {
+		struct netfront_info *np = info->queues[i];
 
-	xennet_alloc_rx_buffers(netdev);
+		spin_lock_bh(&np->rx_lock);
+		if (target > np->rx_max_target)
+			np->rx_max_target = target;
+		np->rx_min_target = target;
+		if (target > np->rx_target)
+			np->rx_target = target;
 
-	spin_unlock_bh(&np->rx_lock);
+		xennet_alloc_rx_buffers(np);
+
+		spin_unlock_bh(&np->rx_lock);
+	}
 	return len;
 }
 
@@ -1836,9 +2393,10 @@ static ssize_t store_rxbuf_max(struct device *dev,
 			       const char *buf, size_t len)
 {
 	struct net_device *netdev = to_net_dev(dev);
-	struct netfront_info *np = netdev_priv(netdev);
+	struct netfront_info *info = netdev_priv(netdev);
 	char *endp;
 	unsigned long target;
+	unsigned int i;
 
 	if (!capable(CAP_NET_ADMIN))
 		return -EPERM;
@@ -1852,16 +2410,20 @@ static ssize_t store_rxbuf_max(struct device *dev,
 	if (target > RX_MAX_TARGET)
 		target = RX_MAX_TARGET;
 
-	spin_lock_bh(&np->rx_lock);
-	if (target < np->rx_min_target)
-		np->rx_min_target = target;
-	np->rx_max_target = target;
-	if (target < np->rx_target)
-		np->rx_target = target;
+	for (i = 0; i < info->num_queues; i++) {
+		struct netfront_info *np = info->queues[i];
+
+		spin_lock_bh(&np->rx_lock);
+		if (target < np->rx_min_target)
+			np->rx_min_target = target;
+		np->rx_max_target = target;
+		if (target < np->rx_target)
+			np->rx_target = target;
 
-	xennet_alloc_rx_buffers(netdev);
+		xennet_alloc_rx_buffers(np);
 
-	spin_unlock_bh(&np->rx_lock);
+		spin_unlock_bh(&np->rx_lock);
+	}
 	return len;
 }
 
@@ -1925,10 +2487,14 @@ static int __devexit xennet_remove(struct xenbus_device *dev)
 
 	xennet_disconnect_backend(info);
 
+	xennet_create_queues(info, 1);
+
 	del_timer_sync(&info->rx_refill_timer);
 
 	xennet_sysfs_delif(info->netdev);
 
+	napi_hash_del(&info->napi);
+	synchronize_net();
 	free_netdev(info->netdev);
 
 	return 0;
@@ -1955,6 +2521,11 @@ static int __init netif_init(void)
 
 	printk(KERN_INFO "Initialising Xen virtual ethernet driver.\n");
 
+	if (xennet_max_queues == 0)
+		xennet_max_queues = num_online_cpus();
+	xennet_max_queues = min_t(unsigned int, xennet_max_queues,
+				  XENNET_MAX_QUEUES);
+
 	return xenbus_register_frontend(&netfront_driver);
 }
 module_init(netif_init);
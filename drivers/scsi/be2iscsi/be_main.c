@@ -58,6 +58,8 @@ static int beiscsi_slave_configure(struct scsi_device *sdev)
 	return 0;
 }
 
+static int beiscsi_poll(struct Scsi_Host *shost);
+
 static struct scsi_host_template beiscsi_sht = {
 	.module = THIS_MODULE,
 	.name = "ServerEngines 10Gbe open-iscsi Initiator Driver",
@@ -69,6 +71,7 @@ static struct scsi_host_template beiscsi_sht = {
 	.target_alloc = iscsi_target_alloc,
 	.eh_device_reset_handler = iscsi_eh_device_reset,
 	.eh_target_reset_handler = iscsi_eh_target_reset,
+	.poll = beiscsi_poll,
 	.sg_tablesize = BEISCSI_SGLIST_ELEMENTS,
 	.can_queue = BE2_IO_DEPTH,
 	.this_id = -1,
@@ -1392,6 +1395,29 @@ static int be_iopoll(struct blk_iopoll *iop, int budget)
 	return ret;
 }
 
+/*
+ * Synchronous polling for waiters spinning on the host.  Owning the
+ * iopoll instance keeps the softirq poller off the CQ meanwhile; and an
+ * interrupt that came in during that left the EQ for us to rearm, just
+ * as be_iopoll() does when it is done.
+ */
+static int beiscsi_poll(struct Scsi_Host *shost)
+{
+	struct beiscsi_hba *phba = iscsi_host_priv(shost);
+	struct hwi_context_memory *phwi_context;
+	unsigned int ret;
+
+	if (!blk_iopoll_enabled || blk_iopoll_sched_prep(&phba->iopoll))
+		return 0;
+
+	ret = beiscsi_process_cq(phba);
+
+	phwi_context = phba->phwi_ctrlr->phwi_ctxt;
+	clear_bit_unlock(IOPOLL_F_SCHED, &phba->iopoll.state);
+	hwi_ring_eq_db(phba, phwi_context->be_eq.q.id, 0, 0, 1, 1);
+	return ret;
+}
+
 static void
 hwi_write_sgl(struct iscsi_wrb *pwrb, struct scatterlist *sg,
 	      unsigned int num_sg, struct beiscsi_io_task *io_task)
@@ -1377,6 +1377,16 @@ static int scsi_lld_busy(struct request_queue *q)
 	return 0;
 }
 
+static int scsi_poll(struct request_queue *q)
+{
+	struct scsi_device *sdev = q->queuedata;
+
+	if (!sdev)
+		return 0;
+
+	return sdev->host->hostt->poll(sdev->host);
+}
+
 /*
  * Kill a request for a dead device
  */
@@ -1684,6 +1694,8 @@ struct request_queue *scsi_alloc_queue(struct scsi_device *sdev)
 	blk_queue_softirq_done(q, scsi_softirq_done);
 	blk_queue_rq_timed_out(q, scsi_times_out);
 	blk_queue_lld_busy(q, scsi_lld_busy);
+	if (sdev->host->hostt->poll)
+		blk_queue_poll_fn(q, scsi_poll);
 	return q;
 }
 
@@ -258,6 +258,25 @@ static int xen_cx_notifier(struct acpi_processor *pr, int action)
 	return ret;
 }
 
+/* The dom0 pcpu governor picks frequencies out of the same table. */
+static void xen_px_pass_to_pcpu(struct acpi_processor *pr,
+				struct xen_processor_px *states)
+{
+	unsigned int i, count = pr->performance->state_count;
+	uint32_t *mhz;
+
+	mhz = kmalloc(count * sizeof(*mhz), GFP_KERNEL);
+	if (!mhz)
+		return;
+
+	for (i = 0; i < count; i++)
+		mhz[i] = states[i].core_frequency;
+
+	xen_pcpu_set_pstates(pr->acpi_id, count, mhz,
+			     pr->performance_platform_limit);
+	kfree(mhz);
+}
+
 static int xen_px_notifier(struct acpi_processor *pr, int action)
 {
 	int ret = -EINVAL;
@@ -285,6 +304,9 @@ static int xen_px_notifier(struct acpi_processor *pr, int action)
 		perf->platform_limit = pr->performance_platform_limit;
 
 		ret = HYPERVISOR_dom0_op(&op);
+		if (!ret)
+			xen_pcpu_set_pstates(pr->acpi_id, 0, NULL,
+					     perf->platform_limit);
 		break;
 
 	case PROCESSOR_PM_INIT:
@@ -315,6 +337,7 @@ static int xen_px_notifier(struct acpi_processor *pr, int action)
 		/* psd */
 		pdomain = &px->domain_info;
 		xen_convert_psd_pack(&perf->domain_info, pdomain);
+		xen_px_pass_to_pcpu(pr, states);
 		if (pdomain->coord_type == DOMAIN_COORD_TYPE_SW_ALL)
 			perf->shared_type = CPUFREQ_SHARED_TYPE_ALL;
 		else if (pdomain->coord_type == DOMAIN_COORD_TYPE_SW_ANY)
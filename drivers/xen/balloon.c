@@ -44,6 +44,9 @@
 #include <linux/list.h>
 #include <linux/sysdev.h>
 #include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/memory.h>
+#include <linux/memory_hotplug.h>
 
 #include <asm/page.h>
 #include <asm/pgalloc.h>
@@ -61,15 +64,22 @@
 #include <xen/xenbus.h>
 #include <xen/features.h>
 #include <xen/page.h>
+#include <xen/balloon.h>
 
-#define PAGES2KB(_p) ((_p)<<(PAGE_SHIFT+balloon_order-10))
+#define PAGES2KB(_p) ((_p)<<(PAGE_SHIFT-10))
 
 #define BALLOON_CLASS_NAME "xen_memory"
 
+/* All counts are in PAGE_SIZE pages, whatever the extent order. */
 struct balloon_stats {
 	/* We aim for 'current allocation' == 'target allocation'. */
 	unsigned long current_pages;
 	unsigned long target_pages;
+	/*
+	 * Target last set by the toolstack or through sysfs.  Self-ballooning
+	 * moves target_pages around below it, never above.
+	 */
+	unsigned long host_target_pages;
 	/*
 	 * Drivers may alter the memory reservation independently, but they
 	 * must inform the balloon driver so we avoid hitting the hard limit.
@@ -78,6 +88,10 @@ struct balloon_stats {
 	/* Number of pages in high- and low-memory balloons. */
 	unsigned long balloon_low;
 	unsigned long balloon_high;
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+	/* Hot-added pages that have not been onlined (and ballooned) yet. */
+	unsigned long hotplug_pages;
+#endif
 };
 
 static DEFINE_MUTEX(balloon_mutex);
@@ -89,47 +103,107 @@ static int register_balloon(struct sys_device *sysdev);
 static struct balloon_stats balloon_stats;
 
 /*
- * Work in pages of this order.  Can be either 0 for normal pages
- * or 9 for hugepages.
+ * Preferred extent order: 0 for normal pages, or 9 for hugepages.  With
+ * hugepages, extents fall back to single pages wherever a 2MB one cannot
+ * be found, in the guest or in Xen.
  */
 static int balloon_order;
 static unsigned long balloon_npages;
-static unsigned long discontig_frame_list[PAGE_SIZE / sizeof(unsigned long)];
+static unsigned long discontig_frame_list[1 << 9];
 
-/* We increase/decrease in batches which fit in a page */
-static unsigned long frame_list[PAGE_SIZE / sizeof(unsigned long)];
+/* We increase/decrease in batches of this many extents per hypercall. */
+#define BALLOON_BATCH	(4 * PAGE_SIZE / sizeof(unsigned long))
+static unsigned long frame_list[BALLOON_BATCH];
+
+/* Kernel mapping updates for the extents, issued as multicalls. */
+#define BALLOON_MCL_SIZE	64
+static struct multicall_entry balloon_mcl[BALLOON_MCL_SIZE];
+static unsigned int balloon_mcl_count;
 
 #ifdef CONFIG_HIGHMEM
-#define inc_totalhigh_pages() (totalhigh_pages++)
-#define dec_totalhigh_pages() (totalhigh_pages--)
+#define inc_totalhigh_pages(n) (totalhigh_pages += (n))
+#define dec_totalhigh_pages(n) (totalhigh_pages -= (n))
 #else
-#define inc_totalhigh_pages() do {} while(0)
-#define dec_totalhigh_pages() do {} while(0)
+#define inc_totalhigh_pages(n) do {} while(0)
+#define dec_totalhigh_pages(n) do {} while(0)
 #endif
 
-/* List of ballooned pages, threaded through the mem_map array. */
+/*
+ * List of ballooned extents, threaded through the mem_map array by their
+ * first page, which holds the extent order in page_private.
+ */
 static LIST_HEAD(ballooned_pages);
 
+#ifdef CONFIG_XEN_SCRUB_PAGES
+/*
+ * Extents taken from the guest but not yet scrubbed.  They are no longer
+ * counted in current_pages; balloon_scrub_process clears them outside
+ * balloon_mutex, a batch at a time, and then gives them to Xen.
+ */
+static LIST_HEAD(scrub_pages);
+static unsigned long scrub_nr_pages;
+#endif
+
 /* Main work function, always executed in process context. */
 static void balloon_process(struct work_struct *work);
 static DECLARE_WORK(balloon_worker, balloon_process);
 static struct timer_list balloon_timer;
 
+/*
+ * Self-ballooning: periodically aim the balloon at what the guest has
+ * committed, so idle memory (mostly clean page cache) goes back to Xen,
+ * and grow again as soon as commitments rise or reclaim starts.
+ */
+static int selfballooning;
+static unsigned int selfballoon_interval = 5;	/* seconds */
+static unsigned long selfballoon_min_pages;
+static unsigned long selfballoon_reserve_pages;
+
+/* Give back 1/8 of the excess per interval, but take all that is needed. */
+#define SELFBALLOON_DOWNHYSTERESIS	8
+#define SELFBALLOON_UPHYSTERESIS	1
+
+static void selfballoon_process(struct work_struct *work);
+static DECLARE_DELAYED_WORK(selfballoon_worker, selfballoon_process);
+
 /* When ballooning out (allocating memory to return to Xen) we don't really
    want the kernel to try too hard since that can trigger the oom killer. */
 #define GFP_BALLOON \
 	(GFP_HIGHUSER | __GFP_NOWARN | __GFP_NORETRY | __GFP_NOMEMALLOC)
 
-static void scrub_page(struct page *page)
+static void scrub_page(struct page *page, unsigned int order)
 {
 #ifdef CONFIG_XEN_SCRUB_PAGES
 	int i;
 
-	for (i = 0; i < balloon_npages; i++)
+	for (i = 0; i < (1 << order); i++)
 		clear_highpage(page++);
 #endif
 }
 
+static void balloon_flush_va(void)
+{
+	int i, ret;
+
+	if (!balloon_mcl_count)
+		return;
+
+	ret = HYPERVISOR_multicall(balloon_mcl, balloon_mcl_count);
+	BUG_ON(ret);
+	for (i = 0; i < balloon_mcl_count; i++)
+		BUG_ON(balloon_mcl[i].result != 0);
+
+	balloon_mcl_count = 0;
+}
+
+static void balloon_queue_va(unsigned long pfn, pte_t pte)
+{
+	MULTI_update_va_mapping(&balloon_mcl[balloon_mcl_count++],
+				(unsigned long)__va(pfn << PAGE_SHIFT), pte, 0);
+	if (balloon_mcl_count == BALLOON_MCL_SIZE)
+		balloon_flush_va();
+}
+
 static void free_discontig_frame(void)
 {
 	int rc;
@@ -145,43 +219,51 @@ static void free_discontig_frame(void)
 	BUG_ON(rc != balloon_npages);
 }
 
-static unsigned long shrink_frame(unsigned long nr_pages)
+/* Squeeze the extents already given back (zeroed) out of frame_list. */
+static unsigned long shrink_frame(unsigned long nr_extents)
 {
 	unsigned long i, j;
 
-	for (i = 0, j = 0; i < nr_pages; i++, j++) {
-		if (frame_list[i] == 0)
-			j++;
-		if (i != j)
-			frame_list[i] = frame_list[j];
-	}
-	return i;
+	for (i = 0, j = 0; i < nr_extents; i++)
+		if (frame_list[i] != 0)
+			frame_list[j++] = frame_list[i];
+	return j;
 }
 
-/* balloon_append: add the given page to the balloon. */
-static void __balloon_append(struct page *page)
+static unsigned int balloon_extent_order(struct page *page)
 {
+	return page_private(page);
+}
+
+/* balloon_append: add the given extent to the balloon. */
+static void __balloon_append(struct page *page, unsigned int order)
+{
+	unsigned long nr = 1UL << order;
+
+	set_page_private(page, order);
+
 	/* Lowmem is re-populated first, so highmem pages go at list tail. */
 	if (PageHighMem(page)) {
 		list_add_tail(&page->lru, &ballooned_pages);
-		balloon_stats.balloon_high++;
-		dec_totalhigh_pages();
+		balloon_stats.balloon_high += nr;
+		dec_totalhigh_pages(nr);
 	} else {
 		list_add(&page->lru, &ballooned_pages);
-		balloon_stats.balloon_low++;
+		balloon_stats.balloon_low += nr;
 	}
 }
 
-static void balloon_append(struct page *page)
+static void balloon_append(struct page *page, unsigned int order)
 {
-	__balloon_append(page);
-	totalram_pages--;
+	__balloon_append(page, order);
+	totalram_pages -= 1UL << order;
 }
 
-/* balloon_retrieve: rescue a page from the balloon, if it is not empty. */
-static struct page *balloon_retrieve(void)
+/* balloon_retrieve: rescue an extent from the balloon, if it is not empty. */
+static struct page *balloon_retrieve(unsigned int *order)
 {
 	struct page *page;
+	unsigned long nr;
 
 	if (list_empty(&ballooned_pages))
 		return NULL;
@@ -189,18 +271,33 @@ static struct page *balloon_retrieve(void)
 	page = list_entry(ballooned_pages.next, struct page, lru);
 	list_del(&page->lru);
 
+	*order = balloon_extent_order(page);
+	nr = 1UL << *order;
+
 	if (PageHighMem(page)) {
-		balloon_stats.balloon_high--;
-		inc_totalhigh_pages();
+		balloon_stats.balloon_high -= nr;
+		inc_totalhigh_pages(nr);
 	}
 	else
-		balloon_stats.balloon_low--;
+		balloon_stats.balloon_low -= nr;
 
-	totalram_pages++;
+	totalram_pages += nr;
 
 	return page;
 }
 
+/* Replace a multi-page extent in the balloon by its single pages. */
+static void balloon_split(struct page *page)
+{
+	unsigned int i, order = balloon_extent_order(page);
+
+	for (i = (1 << order) - 1; i > 0; i--) {
+		set_page_private(page + i, 0);
+		list_add(&page[i].lru, &page->lru);
+	}
+	set_page_private(page, 0);
+}
+
 static struct page *balloon_first_page(void)
 {
 	if (list_empty(&ballooned_pages))
@@ -221,21 +318,112 @@ static void balloon_alarm(unsigned long unused)
 	schedule_work(&balloon_worker);
 }
 
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+/* Next pfn to hot-add memory at, and whether the last attempt failed. */
+static unsigned long hotplug_pfn;
+static int hotplug_failed;
+
+/*
+ * Grow the guest beyond the memory it booted with: hot-add enough whole
+ * sections to cover the credit.  They come up offline; as each page is
+ * onlined it goes into the balloon (see xen_online_page) and is then
+ * populated like any other ballooned page.
+ */
+static int reserve_additional_memory(unsigned long credit)
+{
+	unsigned long nr_pages = roundup(credit, PAGES_PER_SECTION);
+	u64 start = PFN_PHYS((u64)hotplug_pfn);
+	int nid, rc;
+
+	if (xen_pv_domain() && hotplug_pfn + nr_pages > MAX_DOMAIN_PAGES) {
+		rc = -ENOSPC;
+		goto failed;
+	}
+
+	nid = memory_add_physaddr_to_nid(start);
+	rc = add_memory(nid, start, (u64)nr_pages << PAGE_SHIFT);
+	if (rc)
+		goto failed;
+
+	pr_info("xen_balloon: hot-added %lu KiB at %#llx\n",
+		PAGES2KB(nr_pages), (unsigned long long)start);
+
+	hotplug_pfn += nr_pages;
+	balloon_stats.hotplug_pages += nr_pages;
+	return 0;
+
+ failed:
+	pr_info("xen_balloon: cannot hot-add memory at %#llx: %d\n",
+		(unsigned long long)start, rc);
+	hotplug_failed = 1;
+	return rc;
+}
+
+/* Onlining hot-added memory: balloon the pages instead of freeing them. */
+static void xen_online_page(struct page *page)
+{
+	__online_page_set_limits(page);
+	__online_page_increment_counters(page);
+
+	mutex_lock(&balloon_mutex);
+	balloon_append(page, 0);
+	if (balloon_stats.hotplug_pages)
+		balloon_stats.hotplug_pages--;
+	mutex_unlock(&balloon_mutex);
+}
+
+static int xen_memory_notifier(struct notifier_block *nb,
+			       unsigned long val, void *v)
+{
+	if (val == MEM_ONLINE)
+		schedule_work(&balloon_worker);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block xen_memory_nb = {
+	.notifier_call = xen_memory_notifier,
+	.priority = 0
+};
+#endif
+
+static unsigned long scrub_pending_pages(void)
+{
+#ifdef CONFIG_XEN_SCRUB_PAGES
+	return scrub_nr_pages;
+#else
+	return 0;
+#endif
+}
+
 static unsigned long current_target(void)
 {
 	unsigned long target = balloon_stats.target_pages;
 
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+	/* Anything beyond the balloon is hot-added. */
+	if (!hotplug_failed)
+		return target;
+#endif
+
 	target = min(target,
 		     balloon_stats.current_pages +
 		     balloon_stats.balloon_low +
-		     balloon_stats.balloon_high);
+		     balloon_stats.balloon_high +
+		     scrub_pending_pages());
 
 	return target;
 }
 
+/*
+ * Populate a batch of extents of the order at the head of the balloon.
+ * Xen may be out of superpages even when it has memory: the 2MB extents
+ * it could not populate are split and retried as single pages.
+ */
 static int increase_reservation(unsigned long nr_pages)
 {
-	unsigned long  pfn, mfn, i, j;
+	unsigned long  pfn, mfn, i, j, nr_extents, done = 0;
+	unsigned int   order, extent_order;
 	struct page   *page;
 	long           rc;
 	struct xen_memory_reservation reservation = {
@@ -243,127 +431,279 @@ static int increase_reservation(unsigned long nr_pages)
 		.domid        = DOMID_SELF
 	};
 
-	if (nr_pages > ARRAY_SIZE(frame_list))
-		nr_pages = ARRAY_SIZE(frame_list);
-
 	page = balloon_first_page();
-	for (i = 0; i < nr_pages; i++) {
-		BUG_ON(page == NULL);
+	BUG_ON(page == NULL);
+	order = balloon_extent_order(page);
+
+	for (i = 0; i < ARRAY_SIZE(frame_list); i++) {
+		if (page == NULL || balloon_extent_order(page) != order ||
+		    done + (1UL << order) > nr_pages)
+			break;
 		frame_list[i] = page_to_pfn(page);
+		done += 1UL << order;
 		page = balloon_next_page(page);
 	}
+	nr_extents = i;
+
+	/* Want less than the first extent: take single pages from it. */
+	if (nr_extents == 0) {
+		balloon_split(balloon_first_page());
+		return 0;
+	}
 
 	set_xen_guest_handle(reservation.extent_start, frame_list);
-	reservation.nr_extents = nr_pages;
-	reservation.extent_order = balloon_order;
+	reservation.nr_extents = nr_extents;
+	reservation.extent_order = order;
 
 	rc = HYPERVISOR_memory_op(XENMEM_populate_physmap, &reservation);
-	if (rc < 0)
-		goto out;
+	if (rc < 0) {
+		if (!order)
+			goto out;
+		rc = 0;
+	}
 
 	for (i = 0; i < rc; i++) {
-		page = balloon_retrieve();
-		BUG_ON(page == NULL);
+		page = balloon_retrieve(&extent_order);
+		BUG_ON(page == NULL || extent_order != order);
 
 		pfn = page_to_pfn(page);
 		mfn = frame_list[i];
 		BUG_ON(!xen_feature(XENFEAT_auto_translated_physmap) &&
 		       phys_to_machine_mapping_valid(pfn));
 
-		for (j = 0; j < balloon_npages; j++, pfn++, mfn++) {
+		/* Free it once the mappings below have been flushed. */
+		frame_list[i] = pfn;
+
+		for (j = 0; j < (1UL << order); j++, pfn++, mfn++) {
 			set_phys_to_machine(pfn, mfn);
 
 			/* Link back into the page tables if not highmem. */
-			if (!xen_hvm_domain() && pfn < max_low_pfn) {
-				int ret;
-				ret = HYPERVISOR_update_va_mapping(
-					(unsigned long)__va(pfn << PAGE_SHIFT),
-					mfn_pte(mfn, PAGE_KERNEL),
-					0);
-				BUG_ON(ret);
-			}
+			if (!xen_hvm_domain() && pfn < max_low_pfn)
+				balloon_queue_va(pfn, mfn_pte(mfn, PAGE_KERNEL));
 		}
+	}
+	balloon_flush_va();
 
-		/* Relinquish the page back to the allocator. */
-		ClearPageReserved(page);
-		init_page_count(page);
-		__free_page(page);
+	/* Relinquish the pages back to the allocator. */
+	for (i = 0; i < rc; i++) {
+		page = pfn_to_page(frame_list[i]);
+		for (j = 0; j < (1UL << order); j++, page++) {
+			ClearPageReserved(page);
+			init_page_count(page);
+			__free_page(page);
+		}
+		balloon_stats.current_pages += 1UL << order;
 	}
 
-	balloon_stats.current_pages += rc;
+	if (order && rc < (long)nr_extents) {
+		page = balloon_first_page();
+		for (i = rc; i < nr_extents; i++) {
+			struct page *next = balloon_next_page(page);
+
+			balloon_split(page);
+			page = next;
+		}
+		return 0;
+	}
 
  out:
-	return rc < 0 ? rc : rc != nr_pages;
+	return rc < 0 ? rc : rc != nr_extents;
 }
 
-static int decrease_reservation(unsigned long nr_pages)
+/*
+ * Release a batch of extents, 2MB ones if hugepages are in use and the
+ * guest can still find them, single pages otherwise.
+ */
+/*
+ * Give extents back to Xen: frame_list[0..nr_extents) holds their first
+ * pfns, all of the given order.  Pages must be unmapped from highmem and
+ * scrubbed already.
+ */
+static void release_extents(unsigned long nr_extents, unsigned int order)
 {
 	unsigned long  pfn, lpfn, mfn, i, j;
-	struct page   *page = NULL;
-	int            need_sleep = 0;
-	int		discontig, discontig_free;
+	int		discontig = 0, discontig_free;
 	int		ret;
+	struct page   *page;
 	struct xen_memory_reservation reservation = {
 		.address_bits = 0,
 		.domid        = DOMID_SELF
 	};
 
-	if (nr_pages > ARRAY_SIZE(frame_list))
-		nr_pages = ARRAY_SIZE(frame_list);
-
-	for (i = 0; i < nr_pages; i++) {
-		if ((page = alloc_pages(GFP_BALLOON, balloon_order)) == NULL) {
-			nr_pages = i;
-			need_sleep = 1;
-			break;
-		}
-
-		pfn = page_to_pfn(page);
-		frame_list[i] = pfn_to_mfn(pfn);
-
-		scrub_page(page);
-	}
-
-	/* Ensure that ballooned highmem pages don't have kmaps. */
-	kmap_flush_unused();
-	flush_tlb_all();
-
 	/* No more mappings: invalidate P2M and add to balloon. */
-	for (i = 0; i < nr_pages; i++) {
-		mfn = frame_list[i];
-		lpfn = pfn = mfn_to_pfn(mfn);
-		balloon_append(pfn_to_page(pfn));
+	for (i = 0; i < nr_extents; i++) {
+		lpfn = pfn = frame_list[i];
+		frame_list[i] = mfn = pfn_to_mfn(pfn);
+		balloon_append(pfn_to_page(pfn), order);
 		discontig_free = 0;
-		for (j = 0; j < balloon_npages; j++, lpfn++, mfn++) {
-			if ((discontig_frame_list[j] = pfn_to_mfn(lpfn)) != mfn)
+		for (j = 0; j < (1UL << order); j++, lpfn++, mfn++) {
+			if (order &&
+			    (discontig_frame_list[j] = pfn_to_mfn(lpfn)) != mfn)
 				discontig_free = 1;
 
 			set_phys_to_machine(lpfn, INVALID_P2M_ENTRY);
-                        page = pfn_to_page(lpfn);
+			page = pfn_to_page(lpfn);
 
-			if (!xen_hvm_domain() && !PageHighMem(page)) {
-				ret = HYPERVISOR_update_va_mapping(
-					(unsigned long)__va(lpfn << PAGE_SHIFT),
-					__pte_ma(0), 0);
-				BUG_ON(ret);
-			}
+			if (!xen_hvm_domain() && !PageHighMem(page))
+				balloon_queue_va(lpfn, __pte_ma(0));
 		}
+		/* Machine-discontiguous: give the frames back one by one. */
 		if (discontig_free) {
+			balloon_flush_va();
 			free_discontig_frame();
 			frame_list[i] = 0;
 			discontig = 1;
 		}
 	}
-	balloon_stats.current_pages -= nr_pages;
+	balloon_flush_va();
 
 	if (discontig)
-		nr_pages = shrink_frame(nr_pages);
+		nr_extents = shrink_frame(nr_extents);
 
 	set_xen_guest_handle(reservation.extent_start, frame_list);
-	reservation.nr_extents   = nr_pages;
-	reservation.extent_order = balloon_order;
+	reservation.nr_extents   = nr_extents;
+	reservation.extent_order = order;
 	ret = HYPERVISOR_memory_op(XENMEM_decrease_reservation, &reservation);
-	BUG_ON(ret != nr_pages);
+	BUG_ON(ret != nr_extents);
+}
+
+#ifdef CONFIG_XEN_SCRUB_PAGES
+#define BALLOON_SCRUB_BATCH	256	/* pages per run */
+
+static void balloon_scrub_process(struct work_struct *work);
+static DECLARE_DELAYED_WORK(balloon_scrub_worker, balloon_scrub_process);
+
+static void balloon_queue_scrub(unsigned long nr_extents, unsigned int order)
+{
+	struct page *page;
+	unsigned long i;
+
+	for (i = 0; i < nr_extents; i++) {
+		page = pfn_to_page(frame_list[i]);
+		set_page_private(page, order);
+		list_add_tail(&page->lru, &scrub_pages);
+	}
+	scrub_nr_pages += nr_extents << order;
+
+	schedule_delayed_work(&balloon_scrub_worker, 0);
+}
+
+/*
+ * The target went up again before the pages were scrubbed: hand them
+ * straight back to the guest.  Returns the number of pages reclaimed.
+ */
+static unsigned long balloon_unqueue_scrub(unsigned long nr_pages)
+{
+	struct page *page;
+	unsigned long done = 0, nr;
+
+	while (!list_empty(&scrub_pages)) {
+		page = list_entry(scrub_pages.prev, struct page, lru);
+		nr = 1UL << balloon_extent_order(page);
+		if (done + nr > nr_pages)
+			break;
+
+		list_del(&page->lru);
+		scrub_nr_pages -= nr;
+		done += nr;
+
+		set_page_private(page, 0);
+		__free_pages(page, fls(nr) - 1);
+	}
+	balloon_stats.current_pages += done;
+
+	return done;
+}
+
+static void balloon_scrub_process(struct work_struct *work)
+{
+	LIST_HEAD(batch);
+	struct page *page, *tmp;
+	unsigned long done = 0, nr_extents;
+	unsigned int order = 0;
+
+	mutex_lock(&balloon_mutex);
+	while (!list_empty(&scrub_pages) && done < BALLOON_SCRUB_BATCH) {
+		page = list_entry(scrub_pages.next, struct page, lru);
+		list_move_tail(&page->lru, &batch);
+		done += 1UL << balloon_extent_order(page);
+	}
+	mutex_unlock(&balloon_mutex);
+
+	list_for_each_entry(page, &batch, lru) {
+		scrub_page(page, balloon_extent_order(page));
+		cond_resched();
+	}
+
+	mutex_lock(&balloon_mutex);
+
+	/* Ensure that ballooned highmem pages don't have kmaps. */
+	kmap_flush_unused();
+	flush_tlb_all();
+
+	nr_extents = 0;
+	list_for_each_entry_safe(page, tmp, &batch, lru) {
+		if (nr_extents && (nr_extents == ARRAY_SIZE(frame_list) ||
+				   balloon_extent_order(page) != order)) {
+			release_extents(nr_extents, order);
+			nr_extents = 0;
+		}
+		order = balloon_extent_order(page);
+		list_del(&page->lru);
+		frame_list[nr_extents++] = page_to_pfn(page);
+	}
+	if (nr_extents)
+		release_extents(nr_extents, order);
+	scrub_nr_pages -= done;
+
+	if (!list_empty(&scrub_pages))
+		schedule_delayed_work(&balloon_scrub_worker, 1);
+
+	mutex_unlock(&balloon_mutex);
+}
+#endif
+
+static int decrease_reservation(unsigned long nr_pages)
+{
+	unsigned long  i, nr_extents, done = 0;
+	unsigned int   order = 0;
+	struct page   *page = NULL;
+	int            need_sleep = 0;
+
+	if (balloon_order && nr_pages >= balloon_npages)
+		order = balloon_order;
+
+	for (i = 0; i < ARRAY_SIZE(frame_list); ) {
+		if (done + (1UL << order) > nr_pages)
+			break;
+
+		page = alloc_pages(GFP_BALLOON, order);
+		if (page == NULL) {
+			if (order && i == 0) {
+				order = 0;
+				continue;
+			}
+			need_sleep = !order;
+			break;
+		}
+
+		frame_list[i++] = page_to_pfn(page);
+		done += 1UL << order;
+
+		cond_resched();
+	}
+	nr_extents = i;
+	balloon_stats.current_pages -= done;
+
+#ifdef CONFIG_XEN_SCRUB_PAGES
+	balloon_queue_scrub(nr_extents, order);
+#else
+	/* Ensure that ballooned highmem pages don't have kmaps. */
+	kmap_flush_unused();
+	flush_tlb_all();
+
+	release_extents(nr_extents, order);
+#endif
 
 	return need_sleep;
 }
@@ -383,7 +723,24 @@ static void balloon_process(struct work_struct *work)
 
 	do {
 		credit = current_target() - balloon_stats.current_pages;
-		if (credit > 0)
+#ifdef CONFIG_XEN_SCRUB_PAGES
+		if (credit > 0 && scrub_nr_pages) {
+			credit -= balloon_unqueue_scrub(credit);
+			if (!credit)
+				continue;
+		}
+#endif
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+		if (credit > 0 && list_empty(&ballooned_pages)) {
+			/* Hot-added memory still has to be onlined. */
+			if (balloon_stats.hotplug_pages ||
+			    reserve_additional_memory(credit))
+				need_sleep = 1;
+			else
+				continue;
+		}
+#endif
+		if (credit > 0 && !need_sleep)
 			need_sleep = (increase_reservation(credit) != 0);
 		if (credit < 0)
 			need_sleep = (decrease_reservation(-credit) != 0);
@@ -405,10 +762,94 @@ static void balloon_process(struct work_struct *work)
 static void balloon_set_new_target(unsigned long target)
 {
 	/* No need for lock. Not read-modify-write updates. */
-	balloon_stats.target_pages = target;
+	balloon_stats.host_target_pages = target;
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+	hotplug_failed = 0;
+#endif
+	if (!selfballooning || balloon_stats.target_pages > target)
+		balloon_stats.target_pages = target;
 	schedule_work(&balloon_worker);
 }
 
+/* Memory the guest wants right now: committed_AS plus the reserves. */
+static unsigned long selfballoon_goal(void)
+{
+	unsigned long goal;
+
+	goal = percpu_counter_read_positive(&vm_committed_as) +
+		totalreserve_pages + selfballoon_reserve_pages;
+
+	return max(goal, selfballoon_min_pages);
+}
+
+static void selfballoon_process(struct work_struct *work)
+{
+	unsigned long cur, goal, target;
+
+	if (!selfballooning)
+		return;
+
+	cur = balloon_stats.current_pages;
+	goal = selfballoon_goal();
+
+	if (cur > goal)
+		target = cur - (cur - goal) / SELFBALLOON_DOWNHYSTERESIS;
+	else
+		target = cur + (goal - cur) / SELFBALLOON_UPHYSTERESIS;
+
+	target = min(target, balloon_stats.host_target_pages);
+	if (target != balloon_stats.target_pages) {
+		balloon_stats.target_pages = target;
+		schedule_work(&balloon_worker);
+	}
+
+	schedule_delayed_work(&selfballoon_worker,
+			      selfballoon_interval * HZ);
+}
+
+/*
+ * Reclaim is running: the cache we squeezed out is being missed, so hand
+ * back what reclaim is after (the balloon worker repopulates in process
+ * context) rather than wait for the next interval.  Nothing is freed
+ * here.
+ */
+static int selfballoon_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	unsigned long target;
+
+	if (!selfballooning || !nr_to_scan)
+		return 0;
+
+	target = balloon_stats.target_pages + nr_to_scan;
+	target = min(target, balloon_stats.host_target_pages);
+	if (target > balloon_stats.target_pages) {
+		balloon_stats.target_pages = target;
+		schedule_work(&balloon_worker);
+	}
+
+	return 0;
+}
+
+static struct shrinker selfballoon_shrinker = {
+	.shrink = selfballoon_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static void selfballoon_set(int enable)
+{
+	if (selfballooning == enable)
+		return;
+
+	selfballooning = enable;
+	if (enable) {
+		schedule_delayed_work(&selfballoon_worker, 0);
+	} else {
+		cancel_delayed_work_sync(&selfballoon_worker);
+		balloon_stats.target_pages = balloon_stats.host_target_pages;
+		schedule_work(&balloon_worker);
+	}
+}
+
 static struct xenbus_watch target_watch =
 {
 	.node = "memory/target"
@@ -430,7 +871,7 @@ static void watch_target(struct xenbus_watch *watch,
 	/* The given memory/target value is in KiB, so it needs converting to
 	 * pages. PAGE_SHIFT converts bytes to pages, hence PAGE_SHIFT - 10.
 	 */
-	balloon_set_new_target(new_target >> ((PAGE_SHIFT - 10) + balloon_order));
+	balloon_set_new_target(new_target >> (PAGE_SHIFT - 10));
 }
 
 static int balloon_init_watcher(struct notifier_block *notifier,
@@ -465,8 +906,9 @@ static int __init balloon_init(void)
  		nr_pages = xen_start_info->nr_pages;
  	else
  		nr_pages = max_pfn;
- 	balloon_stats.current_pages = (min(nr_pages, max_pfn)) >> balloon_order;
+ 	balloon_stats.current_pages = min(nr_pages, max_pfn);
 	balloon_stats.target_pages  = balloon_stats.current_pages;
+	balloon_stats.host_target_pages = balloon_stats.current_pages;
 	balloon_stats.balloon_low   = 0;
 	balloon_stats.balloon_high  = 0;
 	balloon_stats.driver_pages  = 0UL;
@@ -477,6 +919,15 @@ static int __init balloon_init(void)
 
 	register_balloon(&balloon_sysdev);
 
+	/* Never squeeze below 1/8 of the boot allocation, nor 64MB. */
+	selfballoon_min_pages = max(balloon_stats.current_pages / 8,
+				    64UL << (20 - PAGE_SHIFT));
+	selfballoon_reserve_pages = balloon_stats.current_pages / 32;
+	register_shrinker(&selfballoon_shrinker);
+	if (selfballooning)
+		schedule_delayed_work(&selfballoon_worker,
+				      selfballoon_interval * HZ);
+
 	/*
 	 * Initialise the balloon with excess memory space.  We need
 	 * to make sure we don't add memory which doesn't exist or
@@ -488,15 +939,26 @@ static int __init balloon_init(void)
 	 */
 	extra_pfn_end = min(min(max_pfn, e820_end_of_ram_pfn()),
 			    (unsigned long)PFN_DOWN(xen_extra_mem_start + xen_extra_mem_size));
-	for (pfn = PFN_UP(xen_extra_mem_start);
-	     pfn < extra_pfn_end;
-	     pfn += balloon_npages) {
+	for (pfn = PFN_UP(xen_extra_mem_start); pfn < extra_pfn_end; ) {
+		unsigned int order = 0;
+
+		if (balloon_order && !(pfn & (balloon_npages - 1)) &&
+		    pfn + balloon_npages <= extra_pfn_end)
+			order = balloon_order;
+
 		page = pfn_to_page(pfn);
 		/* totalram_pages doesn't include the boot-time
 		   balloon extension, so don't subtract from it. */
-		__balloon_append(page);
+		__balloon_append(page, order);
+		pfn += 1UL << order;
 	}
 
+#ifdef CONFIG_XEN_BALLOON_MEMORY_HOTPLUG
+	hotplug_pfn = roundup(max(max_pfn, extra_pfn_end), PAGES_PER_SECTION);
+	set_online_page_callback(&xen_online_page);
+	register_memory_notifier(&xen_memory_nb);
+#endif
+
 	target_watch.callback = watch_target;
 	xenstore_notifier.notifier_call = balloon_init_watcher;
 
@@ -523,84 +985,134 @@ static int __init balloon_parse_huge(char *s)
 
 __setup("balloon_hugepages", balloon_parse_huge);
 
-static int dealloc_pte_fn(pte_t *pte, struct page *pmd_page,
-			  unsigned long addr, void *data)
+static int __init balloon_parse_selfballooning(char *s)
+{
+	selfballooning = 1;
+	return 1;
+}
+
+__setup("selfballooning", balloon_parse_selfballooning);
+
+/*
+ * Empty pages freed by drivers are kept here, off the balloon, so the
+ * next device attach finds them again instead of the balloon worker
+ * repopulating them in between.  They cost pfn space only.
+ */
+static LIST_HEAD(empty_pages);
+static unsigned long empty_nr_pages;
+
+#define EMPTY_PAGES_MAX	2048
+
+/* Take an empty lowmem page from the pool or the balloon. */
+static struct page *empty_page_retrieve(void)
 {
-	unsigned long mfn = pte_mfn(*pte);
-	int ret;
+	struct page *page;
+
+	if (!list_empty(&empty_pages)) {
+		page = list_entry(empty_pages.next, struct page, lru);
+		list_del(&page->lru);
+		empty_nr_pages--;
+		return page;
+	}
+
+	page = balloon_first_page();
+	if (page == NULL || PageHighMem(page))
+		return NULL;
+
+	if (balloon_extent_order(page))
+		balloon_split(page);
+	list_del(&page->lru);
+	balloon_stats.balloon_low--;
+
+	/* Boot-time and hot-added pages were never handed out. */
+	ClearPageReserved(page);
+	init_page_count(page);
+
+	return page;
+}
+
+/*
+ * Give the frames behind freshly allocated pages back to Xen, a
+ * frame_list at a time, with their kernel mappings zapped in multicalls.
+ */
+static void release_empty_pages(struct page **pages, int nr_pages)
+{
+	unsigned long pfn;
+	int i, n, ret;
 	struct xen_memory_reservation reservation = {
-		.nr_extents   = 1,
+		.address_bits = 0,
 		.extent_order = 0,
 		.domid        = DOMID_SELF
 	};
 
-	set_xen_guest_handle(reservation.extent_start, &mfn);
-	set_pte_at(&init_mm, addr, pte, __pte_ma(0));
-	set_phys_to_machine(__pa(addr) >> PAGE_SHIFT, INVALID_P2M_ENTRY);
+	for (i = 0; i < nr_pages; i += n) {
+		for (n = 0; n < ARRAY_SIZE(frame_list) && i + n < nr_pages; n++) {
+			pfn = page_to_pfn(pages[i + n]);
+			frame_list[n] = pfn_to_mfn(pfn);
 
-	ret = HYPERVISOR_memory_op(XENMEM_decrease_reservation, &reservation);
-	BUG_ON(ret != 1);
+			if (!xen_hvm_domain())
+				balloon_queue_va(pfn, __pte_ma(0));
+			set_phys_to_machine(pfn, INVALID_P2M_ENTRY);
+		}
+		balloon_flush_va();
 
-	return 0;
+		set_xen_guest_handle(reservation.extent_start, frame_list);
+		reservation.nr_extents = n;
+		ret = HYPERVISOR_memory_op(XENMEM_decrease_reservation,
+					   &reservation);
+		BUG_ON(ret != n);
+
+		balloon_stats.current_pages -= n;
+		totalram_pages -= n;
+	}
 }
 
+/* Drivers get single pages, whatever extent order the balloon uses. */
 struct page **alloc_empty_pages_and_pagevec(int nr_pages)
 {
 	struct page *page, **pagevec;
-	int npages;
-	int i, j, ret;
-
-	/* Round up to next number of balloon_order pages */
-	npages = (nr_pages + (balloon_npages-1)) >> balloon_order;
+	int i, nr_fresh;
 
-	pagevec = kmalloc(sizeof(page) * nr_pages << balloon_order, GFP_KERNEL);
+	pagevec = kmalloc(sizeof(page) * nr_pages, GFP_KERNEL);
 	if (pagevec == NULL)
 		return NULL;
 
+	mutex_lock(&balloon_mutex);
 	for (i = 0; i < nr_pages; i++) {
-		void *v;
-
-		page = alloc_pages(GFP_KERNEL|__GFP_COLD, balloon_order);
+		page = empty_page_retrieve();
 		if (page == NULL)
-			goto err;
-
-		scrub_page(page);
-
-		mutex_lock(&balloon_mutex);
-
-		v = page_address(page);
+			break;
+		pagevec[i] = page;
+	}
+	mutex_unlock(&balloon_mutex);
 
-		ret = apply_to_page_range(&init_mm, (unsigned long)v,
-					  PAGE_SIZE << balloon_order,
-					  dealloc_pte_fn, NULL);
+	if (i == nr_pages)
+		return pagevec;
 
-		if (ret != 0) {
-			mutex_unlock(&balloon_mutex);
-			//balloon_free_page(page); /* tries to use free_cold_page */
-			__free_page(page);
+	/* Not enough empty pages about: make the rest from RAM. */
+	for (nr_fresh = 0; i + nr_fresh < nr_pages; nr_fresh++) {
+		page = alloc_page(GFP_KERNEL|__GFP_COLD);
+		if (page == NULL)
 			goto err;
-		}
-		for (j = 0; j < balloon_npages; j++)
-			pagevec[(i<<balloon_order)+j] = page++;
-
-		totalram_pages = balloon_stats.current_pages -= balloon_npages;
 
-		mutex_unlock(&balloon_mutex);
+		scrub_page(page, 0);
+		pagevec[i + nr_fresh] = page;
 	}
 
- out:
-	schedule_work(&balloon_worker);
+	mutex_lock(&balloon_mutex);
+	release_empty_pages(pagevec + i, nr_fresh);
+	mutex_unlock(&balloon_mutex);
+
 	flush_tlb_all();
+	schedule_work(&balloon_worker);
+
 	return pagevec;
 
  err:
-	mutex_lock(&balloon_mutex);
-	while (--i >= 0)
-		balloon_append(pagevec[i << balloon_order]);
-	mutex_unlock(&balloon_mutex);
-	kfree(pagevec);
-	pagevec = NULL;
-	goto out;
+	while (--nr_fresh >= 0)
+		__free_page(pagevec[i + nr_fresh]);
+	free_empty_pages_and_pagevec(pagevec, i);
+	return NULL;
 }
 EXPORT_SYMBOL_GPL(alloc_empty_pages_and_pagevec);
 
@@ -608,19 +1120,21 @@ void free_empty_pages_and_pagevec(struct page **pagevec, int nr_pages)
 {
 	struct page *page;
 	int i;
-	int npages;
 
 	if (pagevec == NULL)
 		return;
 
-	/* Round up to next number of balloon_order pages */
-	npages = (nr_pages + (balloon_npages-1)) >> balloon_order;
-
 	mutex_lock(&balloon_mutex);
 	for (i = 0; i < nr_pages; i++) {
-		page = pagevec[i << balloon_order];
+		page = pagevec[i];
 		BUG_ON(page_count(page) != 1);
-		balloon_append(page);
+		if (empty_nr_pages < EMPTY_PAGES_MAX) {
+			list_add(&page->lru, &empty_pages);
+			empty_nr_pages++;
+		} else {
+			/* Already out of totalram_pages. */
+			__balloon_append(page, 0);
+		}
 	}
 	mutex_unlock(&balloon_mutex);
 
@@ -643,11 +1157,13 @@ BALLOON_SHOW(current_kb, "%lu\n", PAGES2KB(balloon_stats.current_pages));
 BALLOON_SHOW(low_kb, "%lu\n", PAGES2KB(balloon_stats.balloon_low));
 BALLOON_SHOW(high_kb, "%lu\n", PAGES2KB(balloon_stats.balloon_high));
 BALLOON_SHOW(driver_kb, "%lu\n", PAGES2KB(balloon_stats.driver_pages));
+BALLOON_SHOW(scrub_kb, "%lu\n", PAGES2KB(scrub_pending_pages()));
+BALLOON_SHOW(empty_kb, "%lu\n", PAGES2KB(empty_nr_pages));
 
 static ssize_t show_target_kb(struct sys_device *dev, struct sysdev_attribute *attr,
 			      char *buf)
 {
-	return sprintf(buf, "%lu\n", PAGES2KB(balloon_stats.target_pages));
+	return sprintf(buf, "%lu\n", PAGES2KB(balloon_stats.host_target_pages));
 }
 
 static ssize_t store_target_kb(struct sys_device *dev,
@@ -663,7 +1179,7 @@ static ssize_t store_target_kb(struct sys_device *dev,
 
 	target_bytes = simple_strtoull(buf, &endchar, 0) * 1024;
 
-	balloon_set_new_target(target_bytes >> (PAGE_SHIFT + balloon_order));
+	balloon_set_new_target(target_bytes >> PAGE_SHIFT);
 
 	return count;
 }
@@ -676,8 +1192,8 @@ static ssize_t show_target(struct sys_device *dev, struct sysdev_attribute *attr
 			      char *buf)
 {
 	return sprintf(buf, "%llu\n",
-		       (unsigned long long)balloon_stats.target_pages
-		       << (PAGE_SHIFT + balloon_order));
+		       (unsigned long long)balloon_stats.host_target_pages
+		       << PAGE_SHIFT);
 }
 
 static ssize_t store_target(struct sys_device *dev,
@@ -693,7 +1209,7 @@ static ssize_t store_target(struct sys_device *dev,
 
 	target_bytes = memparse(buf, &endchar);
 
-	balloon_set_new_target(target_bytes >> (PAGE_SHIFT + balloon_order));
+	balloon_set_new_target(target_bytes >> PAGE_SHIFT);
 
 	return count;
 }
@@ -702,9 +1218,95 @@ static SYSDEV_ATTR(target, S_IRUGO | S_IWUSR,
 		   show_target, store_target);
 
 
+static ssize_t show_selfballooning(struct sys_device *dev,
+				   struct sysdev_attribute *attr,
+				   char *buf)
+{
+	return sprintf(buf, "%d\n", selfballooning);
+}
+
+static ssize_t store_selfballooning(struct sys_device *dev,
+				    struct sysdev_attribute *attr,
+				    const char *buf,
+				    size_t count)
+{
+	char *endchar;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	selfballoon_set(!!simple_strtoul(buf, &endchar, 0));
+
+	return count;
+}
+
+static SYSDEV_ATTR(selfballooning, S_IRUGO | S_IWUSR,
+		   show_selfballooning, store_selfballooning);
+
+static ssize_t show_selfballoon_interval(struct sys_device *dev,
+					 struct sysdev_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", selfballoon_interval);
+}
+
+static ssize_t store_selfballoon_interval(struct sys_device *dev,
+					  struct sysdev_attribute *attr,
+					  const char *buf,
+					  size_t count)
+{
+	char *endchar;
+	unsigned long val;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	val = simple_strtoul(buf, &endchar, 0);
+	if (val == 0 || val > 3600)
+		return -EINVAL;
+	selfballoon_interval = val;
+
+	return count;
+}
+
+static SYSDEV_ATTR(selfballoon_interval, S_IRUGO | S_IWUSR,
+		   show_selfballoon_interval, store_selfballoon_interval);
+
+static ssize_t show_selfballoon_min_kb(struct sys_device *dev,
+				       struct sysdev_attribute *attr,
+				       char *buf)
+{
+	return sprintf(buf, "%lu\n", PAGES2KB(selfballoon_min_pages));
+}
+
+static ssize_t store_selfballoon_min_kb(struct sys_device *dev,
+					struct sysdev_attribute *attr,
+					const char *buf,
+					size_t count)
+{
+	char *endchar;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	selfballoon_min_pages = simple_strtoul(buf, &endchar, 0) >>
+		(PAGE_SHIFT - 10);
+
+	return count;
+}
+
+static SYSDEV_ATTR(selfballoon_min_kb, S_IRUGO | S_IWUSR,
+		   show_selfballoon_min_kb, store_selfballoon_min_kb);
+
+BALLOON_SHOW(selfballoon_target_kb, "%lu\n",
+	     PAGES2KB(balloon_stats.target_pages));
+
 static struct sysdev_attribute *balloon_attrs[] = {
 	&attr_target_kb,
 	&attr_target,
+	&attr_selfballooning,
+	&attr_selfballoon_interval,
+	&attr_selfballoon_min_kb,
 };
 
 static struct attribute *balloon_info_attrs[] = {
@@ -712,6 +1314,9 @@ static struct attribute *balloon_info_attrs[] = {
 	&attr_low_kb.attr,
 	&attr_high_kb.attr,
 	&attr_driver_kb.attr,
+	&attr_scrub_kb.attr,
+	&attr_empty_kb.attr,
+	&attr_selfballoon_target_kb.attr,
 	NULL
 };
 
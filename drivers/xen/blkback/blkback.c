@@ -40,12 +40,15 @@
 #include <linux/list.h>
 #include <linux/delay.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/blktrace_api.h>
 
 #include <xen/balloon.h>
 #include <xen/events.h>
 #include <xen/page.h>
 #include <asm/xen/hypervisor.h>
 #include <asm/xen/hypercall.h>
+#include <trace/events/xen_blkif.h>
 #include "common.h"
 
 /*
@@ -56,12 +59,66 @@
  * ** TRY INCREASING 'blkif_reqs' IF WRITE SPEEDS SEEM TOO LOW **
  *
  * This will increase the chances of being able to write whole tracks.
- * 64 should be enough to keep us competitive with Linux.
+ * The default lets a single vbd fill a ring of the largest size.
  */
-static int blkif_reqs = 64;
+/* One bio's worth of pages: 1MB. */
+#define BLKBACK_MAX_INDIRECT_SEGMENTS 256
+#define BLKBACK_MAX_INDIRECT_PAGES \
+	DIV_ROUND_UP(BLKBACK_MAX_INDIRECT_SEGMENTS, BLKIF_SEGS_PER_INDIRECT_FRAME)
+#define BLKBACK_INDIRECT_ORDER \
+	get_order(BLKBACK_MAX_INDIRECT_PAGES * PAGE_SIZE)
+
+static int blkif_reqs = __CONST_RING_SIZE(blkif, PAGE_SIZE * BLKIF_MAX_RING_PAGES);
 module_param_named(reqs, blkif_reqs, int, 0);
 MODULE_PARM_DESC(reqs, "Number of blkback requests to allocate");
 
+/*
+ * Each connected vbd sets aside this many of the requests for itself,
+ * on a free list of its own; only the rest are shared between them.
+ */
+static unsigned int blkif_reserved_reqs = __CONST_RING_SIZE(blkif, PAGE_SIZE) / 2;
+module_param_named(reserved_reqs, blkif_reserved_reqs, uint, 0644);
+MODULE_PARM_DESC(reserved_reqs,
+		 "Number of blkback requests reserved for each vbd");
+
+/*
+ * Indirect requests carry up to BLKBACK_MAX_INDIRECT_SEGMENTS segments
+ * and draw on a pool of their own, so the pages backing them are only
+ * set aside for a few requests.  0 turns the feature off.
+ */
+static int blkif_indirect_reqs = 16;
+module_param_named(indirect_reqs, blkif_indirect_reqs, int, 0);
+MODULE_PARM_DESC(indirect_reqs,
+		 "Number of blkback requests with indirect segments to allocate");
+
+unsigned int blkif_max_indirect_segs;
+
+int blkif_feature_persistent = 1;
+module_param_named(feature_persistent, blkif_feature_persistent, bool, 0644);
+MODULE_PARM_DESC(feature_persistent,
+		 "Keep frontend data pages mapped across requests if it wishes");
+
+/* Enough to keep a single-page ring full. */
+static unsigned int blkif_max_persistent_gnts =
+	__CONST_RING_SIZE(blkif, PAGE_SIZE) * BLKIF_MAX_SEGMENTS_PER_REQUEST;
+module_param_named(max_persistent_grants, blkif_max_persistent_gnts, uint, 0644);
+MODULE_PARM_DESC(max_persistent_grants,
+		 "Maximum number of frontend pages kept mapped per device");
+
+/*
+ * Threads servicing each vbd's ring.  They take turns pulling requests
+ * off it and map and submit them in parallel.
+ */
+unsigned int blkif_nr_workers = 1;
+module_param_named(workers, blkif_nr_workers, uint, 0644);
+MODULE_PARM_DESC(workers, "Number of service threads per vbd");
+
+/* Log2 of the largest shared ring a frontend may set up. */
+unsigned int blkif_max_ring_order = BLKIF_MAX_RING_PAGE_ORDER;
+module_param_named(max_ring_page_order, blkif_max_ring_order, uint, 0444);
+MODULE_PARM_DESC(max_ring_page_order,
+		 "Log2 of the maximum number of pages in a shared ring");
+
 /* Run-time switchable: /sys/module/blkback/parameters/ */
 static unsigned int log_stats = 0;
 static unsigned int debug_lvl = 0;
@@ -74,7 +131,7 @@ module_param(debug_lvl, int, 0644);
  * the pendcnt towards zero. When it hits zero, the specified domain has a
  * response queued for it, with the saved 'id' passed back.
  */
-typedef struct {
+typedef struct pending_req {
 	blkif_t       *blkif;
 	u64            id;
 	int            nr_pages;
@@ -82,10 +139,27 @@ typedef struct {
 	unsigned short operation;
 	int            status;
 	struct list_head free_list;
+	/* First of the pending pages that belong to this request. */
+	int            page_base;
+	/* Private copy of the segment list of an indirect request. */
+	struct blkif_request_segment *indirect;
+	/* The vbd this is reserved for, NULL if shared. */
+	blkif_t       *owner;
+	/* Later requests that went out in this request's last bio. */
+	struct bio    *merge_bio;
+	unsigned int   nr_merged;
+	struct pending_req *merged[BLKBACK_BATCH - 1];
+	/* When taken off the ring and when its I/O was submitted. */
+	ktime_t        t_ring;
+	ktime_t        t_submit;
 } pending_req_t;
 
+/* Room a new bio leaves for the requests after it to join. */
+#define BLKBACK_BIO_VECS (BLKIF_MAX_SEGMENTS_PER_REQUEST * BLKBACK_BATCH)
+
 static pending_req_t *pending_reqs;
 static struct list_head pending_free;
+static struct list_head pending_free_indirect;
 static DEFINE_SPINLOCK(pending_free_lock);
 static DECLARE_WAIT_QUEUE_HEAD(pending_free_wq);
 
@@ -93,13 +167,16 @@ static DECLARE_WAIT_QUEUE_HEAD(pending_free_wq);
 
 static struct page **pending_pages;
 static grant_handle_t *pending_grant_handles;
+/* The page each segment's I/O goes to: mapped now, or persistently. */
+static struct page **pending_seg_pages;
 
 static inline int vaddr_pagenr(pending_req_t *req, int seg)
 {
-	return (req - pending_reqs) * BLKIF_MAX_SEGMENTS_PER_REQUEST + seg;
+	return req->page_base + seg;
 }
 
 #define pending_page(req, seg) pending_pages[vaddr_pagenr(req, seg)]
+#define pending_seg_page(req, seg) pending_seg_pages[vaddr_pagenr(req, seg)]
 
 static inline unsigned long vaddr(pending_req_t *req, int seg)
 {
@@ -111,67 +188,208 @@ static inline unsigned long vaddr(pending_req_t *req, int seg)
 	(pending_grant_handles[vaddr_pagenr(_req, _seg)])
 
 
-static int do_block_io_op(blkif_t *blkif);
-static void dispatch_rw_block_io(blkif_t *blkif,
+static int do_block_io_op(struct blkif_worker *w);
+static void dispatch_rw_block_io(struct blkif_worker *w,
 				 struct blkif_request *req,
 				 pending_req_t *pending_req);
+static void dispatch_discard_io(blkif_t *blkif,
+				struct blkif_request *req,
+				pending_req_t *pending_req);
+static void dispatch_flush_io(struct blkif_worker *w,
+			      struct blkif_request *req,
+			      pending_req_t *pending_req);
 static void make_response(blkif_t *blkif, u64 id,
 			  unsigned short op, int st);
 
 /******************************************************************
  * misc small helpers
  */
-static pending_req_t* alloc_req(void)
+static inline struct list_head *pending_free_list(int indirect)
+{
+	return indirect ? &pending_free_indirect : &pending_free;
+}
+
+static pending_req_t *take_req(struct list_head *free, spinlock_t *lock)
 {
 	pending_req_t *req = NULL;
 	unsigned long flags;
 
-	spin_lock_irqsave(&pending_free_lock, flags);
-	if (!list_empty(&pending_free)) {
-		req = list_entry(pending_free.next, pending_req_t, free_list);
+	spin_lock_irqsave(lock, flags);
+	if (!list_empty(free)) {
+		req = list_entry(free->next, pending_req_t, free_list);
 		list_del(&req->free_list);
 	}
-	spin_unlock_irqrestore(&pending_free_lock, flags);
+	spin_unlock_irqrestore(lock, flags);
+	return req;
+}
+
+/* The vbd's own requests first; only then the shared ones. */
+static pending_req_t* alloc_req(blkif_t *blkif, int indirect)
+{
+	pending_req_t *req = NULL;
+
+	if (!indirect)
+		req = take_req(&blkif->pending_free, &blkif->pending_lock);
+	if (!req)
+		req = take_req(pending_free_list(indirect), &pending_free_lock);
 	return req;
 }
 
 static void free_req(pending_req_t *req)
 {
+	blkif_t *owner = req->owner;
+	struct list_head *free = pending_free_list(req->indirect != NULL);
+	spinlock_t *lock = &pending_free_lock;
 	unsigned long flags;
 	int was_empty;
 
-	spin_lock_irqsave(&pending_free_lock, flags);
-	was_empty = list_empty(&pending_free);
-	list_add(&req->free_list, &pending_free);
-	spin_unlock_irqrestore(&pending_free_lock, flags);
+	if (owner) {
+		free = &owner->pending_free;
+		lock = &owner->pending_lock;
+	}
+
+	spin_lock_irqsave(lock, flags);
+	was_empty = list_empty(free);
+	list_add(&req->free_list, free);
+	spin_unlock_irqrestore(lock, flags);
 	if (was_empty)
 		wake_up(&pending_free_wq);
 }
 
-static void unplug_queue(blkif_t *blkif)
+/* Set aside the vbd's share of the requests when it connects. */
+void blkif_reserve_reqs(blkif_t *blkif)
 {
-	if (blkif->plug == NULL)
-		return;
-	if (blkif->plug->unplug_fn)
-		blkif->plug->unplug_fn(blkif->plug);
-	blk_put_queue(blkif->plug);
-	blkif->plug = NULL;
+	unsigned int i, nr;
+	pending_req_t *req;
+
+	nr = min_t(unsigned int, blkif_reserved_reqs,
+		   RING_SIZE(&blkif->blk_rings.common));
+
+	for (i = 0; i < nr; i++) {
+		req = take_req(&pending_free, &pending_free_lock);
+		if (!req)
+			break;
+		req->owner = blkif;
+		free_req(req);
+	}
+	blkif->nr_reserved_reqs = i;
+
+	if (i < nr)
+		printk(KERN_WARNING "blkback: vbd %u of domain %u reserved "
+		       "only %u of %u requests\n",
+		       blkif->handle, blkif->domid, i, nr);
 }
 
-static void plug_queue(blkif_t *blkif, struct block_device *bdev)
+/* Called once none of the vbd's requests are in flight. */
+void blkif_release_reqs(blkif_t *blkif)
 {
-	struct request_queue *q = bdev_get_queue(bdev);
+	pending_req_t *req;
+
+	while ((req = take_req(&blkif->pending_free, &blkif->pending_lock))) {
+		req->owner = NULL;
+		free_req(req);
+		blkif->nr_reserved_reqs--;
+	}
+	BUG_ON(blkif->nr_reserved_reqs);
+}
 
-	if (q == blkif->plug)
+static int blkif_stat_op(unsigned short op)
+{
+	switch (op) {
+	case BLKIF_OP_READ:
+		return BLKIF_STAT_RD;
+	case BLKIF_OP_DISCARD:
+		return BLKIF_STAT_DS;
+	default:
+		return BLKIF_STAT_WR;
+	}
+}
+
+static void blkif_lat_add(atomic_t *hist, ktime_t now, ktime_t start)
+{
+	s64 us = ktime_us_delta(now, start);
+	int n = 0;
+
+	if (us > 0)
+		n = min_t(int, fls64(us), BLKBACK_LAT_BUCKETS - 1);
+	atomic_inc(&hist[n]);
+}
+
+static void blkif_stat_submit(blkif_t *blkif, pending_req_t *req,
+			      unsigned short op)
+{
+	req->t_submit = ktime_get();
+	blkif_lat_add(blkif->st_lat[blkif_stat_op(op)].queue,
+		      req->t_submit, req->t_ring);
+}
+
+static void blkif_stat_complete(blkif_t *blkif, pending_req_t *req,
+				unsigned short op)
+{
+	/* Requests that failed before reaching the device don't count. */
+	if (!req->t_submit.tv64)
 		return;
-	unplug_queue(blkif);
-	blk_get_queue(q);
-	blkif->plug = q;
+	blkif_lat_add(blkif->st_lat[blkif_stat_op(op)].device,
+		      ktime_get(), req->t_submit);
+}
+
+/*
+ * Tracing: the tracepoints, and messages on the dom0 device's blktrace,
+ * carry the guest, vbd and request id that the frontend traces as well.
+ */
+#define blkif_trace_msg(blkif, fmt, ...)				\
+	do {								\
+		if ((blkif)->vbd.bdev)					\
+			blk_add_trace_msg(bdev_get_queue((blkif)->vbd.bdev), \
+					  fmt, ##__VA_ARGS__);		\
+	} while (0)
+
+static void blkif_trace_request(blkif_t *blkif, struct blkif_request *req)
+{
+	struct blkif_request_indirect *ind_req;
+	struct blkif_request_discard *discard;
+
+	switch (req->operation) {
+	case BLKIF_OP_INDIRECT:
+		ind_req = (struct blkif_request_indirect *)req;
+		trace_xen_blkback_request(blkif->domid, blkif->vbd.handle,
+					  ind_req->id, ind_req->indirect_op,
+					  ind_req->sector_number,
+					  ind_req->nr_segments);
+		break;
+	case BLKIF_OP_DISCARD:
+		discard = (struct blkif_request_discard *)req;
+		trace_xen_blkback_request(blkif->domid, blkif->vbd.handle,
+					  discard->id, BLKIF_OP_DISCARD,
+					  discard->sector_number, 0);
+		break;
+	default:
+		trace_xen_blkback_request(blkif->domid, blkif->vbd.handle,
+					  req->id, req->operation,
+					  req->sector_number, req->nr_segments);
+		break;
+	}
+}
+
+static void blkif_trace_submit(blkif_t *blkif, u64 id, unsigned short op)
+{
+	trace_xen_blkback_submit(blkif->domid, blkif->vbd.handle, id, op);
+	blkif_trace_msg(blkif, "blkif dom %u vbd %u id %llu submit",
+			blkif->domid, blkif->vbd.handle,
+			(unsigned long long)id);
+}
+
+static int pending_req_available(struct blkif_worker *w)
+{
+	if (!w->waiting_indirect && !list_empty(&w->blkif->pending_free))
+		return 1;
+	return !list_empty(pending_free_list(w->waiting_indirect));
 }
 
 static void fast_flush_area(pending_req_t *req)
 {
 	struct gnttab_unmap_grant_ref unmap[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct page *pages[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 	unsigned int i, invcount = 0;
 	grant_handle_t handle;
 	int ret;
@@ -183,12 +401,18 @@ static void fast_flush_area(pending_req_t *req)
 		blkback_pagemap_clear(pending_page(req, i));
 		gnttab_set_unmap_op(&unmap[invcount], vaddr(req, i),
 				    GNTMAP_host_map, handle);
+		pages[invcount] = pending_page(req, i);
 		pending_handle(req, i) = BLKBACK_INVALID_HANDLE;
-		invcount++;
+
+		/* Indirect requests are unmapped a batch at a time. */
+		if (++invcount == ARRAY_SIZE(unmap)) {
+			ret = gnttab_unmap_refs(unmap, pages, invcount);
+			BUG_ON(ret);
+			invcount = 0;
+		}
 	}
 
-	ret = HYPERVISOR_grant_table_op(
-		GNTTABOP_unmap_grant_ref, unmap, invcount);
+	ret = gnttab_unmap_refs(unmap, pages, invcount);
 	BUG_ON(ret);
 }
 
@@ -209,8 +433,12 @@ static void print_stats(blkif_t *blkif)
 
 int blkif_schedule(void *arg)
 {
-	blkif_t *blkif = arg;
+	struct blkif_worker *w = arg;
+	blkif_t *blkif = w->blkif;
 	struct vbd *vbd = &blkif->vbd;
+	/* Housekeeping is left to the first thread. */
+	int first = w == &blkif->workers[0];
+	struct blk_plug plug;
 
 	blkif_get(blkif);
 
@@ -220,7 +448,7 @@ int blkif_schedule(void *arg)
 	while (!kthread_should_stop()) {
 		if (try_to_freeze())
 			continue;
-		if (unlikely(vbd->size != vbd_size(vbd)))
+		if (first && unlikely(vbd->size != vbd_size(vbd)))
 			vbd_resize(blkif);
 
 		wait_event_interruptible(
@@ -228,25 +456,27 @@ int blkif_schedule(void *arg)
 			blkif->waiting_reqs || kthread_should_stop());
 		wait_event_interruptible(
 			pending_free_wq,
-			!list_empty(&pending_free) || kthread_should_stop());
+			pending_req_available(w) || kthread_should_stop());
 
 		blkif->waiting_reqs = 0;
 		smp_mb(); /* clear flag *before* checking for work */
 
-		if (do_block_io_op(blkif))
+		/* A whole ring's worth of requests goes to the queue at once. */
+		blk_start_plug(&plug);
+		if (do_block_io_op(w))
 			blkif->waiting_reqs = 1;
-		unplug_queue(blkif);
+		blk_finish_plug(&plug);
 
-		if (log_stats && time_after(jiffies, blkif->st_print))
+		if (first && log_stats && time_after(jiffies, blkif->st_print))
 			print_stats(blkif);
 	}
 
-	if (log_stats)
+	if (first && log_stats)
 		print_stats(blkif);
 	if (debug_lvl)
 		printk(KERN_DEBUG "%s: exiting\n", current->comm);
 
-	blkif->xenblkd = NULL;
+	w->task = NULL;
 	blkif_put(blkif);
 
 	return 0;
@@ -271,6 +501,8 @@ static void __end_block_io_op(pending_req_t *pending_req, int error)
 	}
 
 	if (atomic_dec_and_test(&pending_req->pendcnt)) {
+		blkif_stat_complete(pending_req->blkif, pending_req,
+				    pending_req->operation);
 		fast_flush_area(pending_req);
 		make_response(pending_req->blkif, pending_req->id,
 			      pending_req->operation, pending_req->status);
@@ -281,7 +513,14 @@ static void __end_block_io_op(pending_req_t *pending_req, int error)
 
 static void end_block_io_op(struct bio *bio, int error)
 {
-	__end_block_io_op(bio->bi_private, error);
+	pending_req_t *pending_req = bio->bi_private;
+	unsigned int i;
+
+	/* Requests that joined the bio are finished with it as well. */
+	if (bio == pending_req->merge_bio)
+		for (i = 0; i < pending_req->nr_merged; i++)
+			__end_block_io_op(pending_req->merged[i], error);
+	__end_block_io_op(pending_req, error);
 	bio_put(bio);
 }
 
@@ -302,83 +541,379 @@ irqreturn_t blkif_be_int(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+/* The vbd has earned enough tokens to carry on with its ring. */
+void blkif_rate_timer(unsigned long data)
+{
+	blkif_notify_work((blkif_t *)data);
+}
+
+
+/******************************************************************
+ * RATE LIMITING -- per-vbd token buckets, checked at ring consumption.
+ *
+ * Tokens are kept scaled by HZ, so that a jiffy's worth of refill is not
+ * rounded away, and the buckets hold one second's worth.  A request may
+ * overdraw them; the ring is then left alone until the debt is repaid,
+ * so a throttled guest sees its requests delayed, never failed.
+ */
+
+static s64 rate_fill(s64 tokens, unsigned long rate, unsigned long elapsed)
+{
+	s64 max = (s64)rate * HZ;
+
+	tokens += (s64)rate * min_t(unsigned long, elapsed, HZ);
+	return min(tokens, max);
+}
+
+static unsigned long rate_debt(s64 tokens, unsigned long rate)
+{
+	if (!rate || tokens > 0)
+		return 0;
+	return div_u64(-tokens, rate) + 1;
+}
+
+void blkif_set_rate(blkif_t *blkif, unsigned long iops, unsigned long bytes)
+{
+	mutex_lock(&blkif->ring_mutex);
+	blkif->rate_iops    = iops;
+	blkif->rate_bytes   = bytes;
+	blkif->iops_tokens  = (s64)iops * HZ;
+	blkif->bytes_tokens = (s64)bytes * HZ;
+	blkif->rate_stamp   = jiffies;
+	mutex_unlock(&blkif->ring_mutex);
+
+	/* A ring held back under the old limits may go on now. */
+	blkif_notify_work(blkif);
+}
+
+/* Jiffies to wait before taking another request off the ring. */
+static unsigned long blkif_rate_wait(blkif_t *blkif)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - blkif->rate_stamp;
+
+	if (!blkif->rate_iops && !blkif->rate_bytes)
+		return 0;
+
+	blkif->rate_stamp = now;
+	blkif->iops_tokens = rate_fill(blkif->iops_tokens,
+				       blkif->rate_iops, elapsed);
+	blkif->bytes_tokens = rate_fill(blkif->bytes_tokens,
+					blkif->rate_bytes, elapsed);
+
+	return max(rate_debt(blkif->iops_tokens, blkif->rate_iops),
+		   rate_debt(blkif->bytes_tokens, blkif->rate_bytes));
+}
+
+static unsigned long blkif_request_bytes(struct blkif_request *req)
+{
+	unsigned long bytes = 0;
+	int i, nseg;
+
+	switch (req->operation) {
+	case BLKIF_OP_INDIRECT:
+		/* The segments are read only at dispatch: assume full pages. */
+		nseg = ((struct blkif_request_indirect *)req)->nr_segments;
+		return (unsigned long)nseg << PAGE_SHIFT;
+	case BLKIF_OP_DISCARD:
+		return 0;
+	}
+
+	nseg = min_t(int, req->nr_segments, BLKIF_MAX_SEGMENTS_PER_REQUEST);
+	for (i = 0; i < nseg; i++)
+		if (req->seg[i].last_sect >= req->seg[i].first_sect)
+			bytes += (req->seg[i].last_sect -
+				  req->seg[i].first_sect + 1) << 9;
+	return bytes;
+}
+
+static void blkif_rate_charge(blkif_t *blkif, struct blkif_request *req)
+{
+	if (blkif->rate_iops)
+		blkif->iops_tokens -= HZ;
+	if (blkif->rate_bytes)
+		blkif->bytes_tokens -= (s64)blkif_request_bytes(req) * HZ;
+}
+
 
 
 /******************************************************************
  * DOWNWARD CALLS -- These interface with the block-device layer proper.
  */
 
-static int do_block_io_op(blkif_t *blkif)
+static int is_barrier(struct blkif_request *req)
 {
+	if (req->operation == BLKIF_OP_INDIRECT)
+		return ((struct blkif_request_indirect *)req)->indirect_op ==
+			BLKIF_OP_WRITE_BARRIER;
+	return req->operation == BLKIF_OP_WRITE_BARRIER;
+}
+
+static struct bio *blkif_alloc_bio(pending_req_t *pending_req,
+				   struct phys_req *preq, int nr_vecs)
+{
+	struct bio *bio;
+
+	if (nr_vecs)
+		nr_vecs = min_t(int, BIO_MAX_PAGES,
+				max_t(int, nr_vecs, BLKBACK_BIO_VECS));
+
+	bio = bio_alloc(GFP_KERNEL, nr_vecs);
+	if (unlikely(bio == NULL))
+		return NULL;
+
+	bio->bi_bdev    = preq->bdev;
+	bio->bi_private = pending_req;
+	bio->bi_end_io  = end_block_io_op;
+	bio->bi_sector  = preq->sector_number;
+	atomic_inc(&pending_req->pendcnt);
+	return bio;
+}
+
+static void blkif_flush_bio(struct blkif_worker *w)
+{
+	struct bio *bio = w->bio;
+
+	if (bio == NULL)
+		return;
+	w->bio = NULL;
+
+	/* Nothing went in before a failure: just drop the references. */
+	if (!bio->bi_size && w->bio_op != WRITE_BARRIER) {
+		bio_endio(bio, 0);
+		return;
+	}
+	submit_bio(w->bio_op, bio);
+}
+
+/*
+ * Requests of a batch that carry on where the previous one stopped go out
+ * in the same bio, instead of relying on the elevator to merge them.
+ * Returns the held bio if @pending_req may add to it, else sends it.
+ */
+static struct bio *blkif_join_bio(struct blkif_worker *w,
+				  pending_req_t *pending_req, int operation,
+				  struct phys_req *preq)
+{
+	struct bio *bio = w->bio;
+	pending_req_t *head;
+
+	if (bio == NULL)
+		return NULL;
+	head = bio->bi_private;
+
+	if (operation == WRITE_BARRIER || w->bio_op != operation ||
+	    bio->bi_bdev != preq->bdev ||
+	    bio->bi_sector + (bio->bi_size >> 9) != preq->sector_number ||
+	    head->nr_merged == ARRAY_SIZE(head->merged)) {
+		blkif_flush_bio(w);
+		return NULL;
+	}
+
+	w->bio = NULL;
+	atomic_inc(&w->blkif->st_merged);
+	head->merged[head->nr_merged++] = pending_req;
+	head->merge_bio = bio;
+	atomic_inc(&pending_req->pendcnt);
+	return bio;
+}
+
+/*
+ * The service threads of a vbd take turns at the ring under ring_mutex;
+ * the mapping and submission that follow run in parallel.  A barrier
+ * must not overtake the requests before it, nor be overtaken by those
+ * after it, so it is dispatched holding barrier_sem for writing while
+ * everything else holds it for reading.  The semaphore is taken before
+ * the ring is let go, so that its users queue up in ring order.
+ */
+/*
+ * Take up to BLKBACK_BATCH requests off the ring while holding the ring
+ * mutex.  A barrier always makes up a batch of its own.  Returns the
+ * number taken; *stop is set once the ring is empty or out of requests.
+ */
+static int get_block_io_batch(struct blkif_worker *w, int *barrier_req,
+			      int *stop, int *more_to_do)
+{
+	blkif_t *blkif = w->blkif;
 	union blkif_back_rings *blk_rings = &blkif->blk_rings;
-	struct blkif_request req;
+	struct blkif_batch_req *b;
+	struct blkif_request *req;
 	pending_req_t *pending_req;
 	RING_IDX rc, rp;
-	int more_to_do = 0;
+	unsigned long wait;
+	int nr, n;
 
-	rc = blk_rings->common.req_cons;
-	rp = blk_rings->common.sring->req_prod;
-	rmb(); /* Ensure we see queued requests up to 'rp'. */
+	*barrier_req = 0;
 
-	while (rc != rp) {
+	for (nr = 0; nr < BLKBACK_BATCH && !*barrier_req; nr++) {
+		rc = blk_rings->common.req_cons;
+		rp = blk_rings->common.sring->req_prod;
+		rmb(); /* Ensure we see queued requests up to 'rp'. */
 
-		if (RING_REQUEST_CONS_OVERFLOW(&blk_rings->common, rc))
+		if (rc == rp ||
+		    RING_REQUEST_CONS_OVERFLOW(&blk_rings->common, rc)) {
+			*stop = 1;
 			break;
+		}
 
 		if (kthread_should_stop()) {
-			more_to_do = 1;
+			*more_to_do = 1;
+			*stop = 1;
 			break;
 		}
 
-		pending_req = alloc_req();
-		if (NULL == pending_req) {
-			blkif->st_oo_req++;
-			more_to_do = 1;
-			break;
-		}
+		b = &w->batch[nr];
+		req = &b->req;
 
 		switch (blkif->blk_protocol) {
 		case BLKIF_PROTOCOL_NATIVE:
-			memcpy(&req, RING_GET_REQUEST(&blk_rings->native, rc), sizeof(req));
+			memcpy(req, RING_GET_REQUEST(&blk_rings->native, rc), sizeof(*req));
 			break;
 		case BLKIF_PROTOCOL_X86_32:
-			blkif_get_x86_32_req(&req, RING_GET_REQUEST(&blk_rings->x86_32, rc));
+			blkif_get_x86_32_req(req, RING_GET_REQUEST(&blk_rings->x86_32, rc));
 			break;
 		case BLKIF_PROTOCOL_X86_64:
-			blkif_get_x86_64_req(&req, RING_GET_REQUEST(&blk_rings->x86_64, rc));
+			blkif_get_x86_64_req(req, RING_GET_REQUEST(&blk_rings->x86_64, rc));
 			break;
 		default:
 			BUG();
 		}
+
+		/* Leave a barrier on the ring for the next batch. */
+		if (nr && is_barrier(req))
+			break;
+
+		wait = blkif_rate_wait(blkif);
+		if (wait) {
+			blkif->st_throttled++;
+			mod_timer(&blkif->rate_timer, jiffies + wait);
+			*stop = 1;
+			break;
+		}
+
+		/* Without the feature an indirect request is just refused. */
+		b->indirect = req->operation == BLKIF_OP_INDIRECT &&
+			      blkif_max_indirect_segs;
+
+		pending_req = alloc_req(blkif, b->indirect);
+		if (NULL == pending_req) {
+			blkif->st_oo_req++;
+			if (b->indirect)
+				blkif->st_oo_indirect++;
+			w->waiting_indirect = b->indirect;
+			*more_to_do = 1;
+			*stop = 1;
+			break;
+		}
+		w->waiting_indirect = 0;
+		b->pending_req = pending_req;
+		pending_req->t_ring = ktime_get();
+		pending_req->t_submit.tv64 = 0;
+		blkif_trace_request(blkif, req);
+
+		n = atomic_inc_return(&blkif->st_inflight);
+		if (n > blkif->st_max_inflight)
+			blkif->st_max_inflight = n;
+
 		blk_rings->common.req_cons = ++rc; /* before make_response() */
 
 		/* Apply all sanity checks to /private copy/ of request. */
 		barrier();
 
-		switch (req.operation) {
+		blkif_rate_charge(blkif, req);
+
+		switch (req->operation) {
 		case BLKIF_OP_READ:
 			blkif->st_rd_req++;
-			dispatch_rw_block_io(blkif, &req, pending_req);
 			break;
 		case BLKIF_OP_WRITE_BARRIER:
 			blkif->st_br_req++;
 			/* fall through */
 		case BLKIF_OP_WRITE:
 			blkif->st_wr_req++;
-			dispatch_rw_block_io(blkif, &req, pending_req);
 			break;
-		default:
-			/* A good sign something is wrong: sleep for a while to
-			 * avoid excessive CPU consumption by a bad guest. */
-			msleep(1);
-			DPRINTK("error: unknown block io operation [%d]\n",
-				req.operation);
-			make_response(blkif, req.id, req.operation,
-				      BLKIF_RSP_ERROR);
-			free_req(pending_req);
+		case BLKIF_OP_DISCARD:
+			blkif->st_ds_req++;
+			break;
+		case BLKIF_OP_FLUSH_DISKCACHE:
+			blkif->st_fl_req++;
 			break;
 		}
 
+		*barrier_req = is_barrier(req);
+	}
+
+	return nr;
+}
+
+static void dispatch_block_io(struct blkif_worker *w,
+			      struct blkif_batch_req *b)
+{
+	blkif_t *blkif = w->blkif;
+	struct blkif_request *req = &b->req;
+
+	switch (req->operation) {
+	case BLKIF_OP_READ:
+	case BLKIF_OP_WRITE_BARRIER:
+	case BLKIF_OP_WRITE:
+		dispatch_rw_block_io(w, req, b->pending_req);
+		break;
+	case BLKIF_OP_DISCARD:
+		dispatch_discard_io(blkif, req, b->pending_req);
+		break;
+	case BLKIF_OP_FLUSH_DISKCACHE:
+		dispatch_flush_io(w, req, b->pending_req);
+		break;
+	case BLKIF_OP_INDIRECT:
+		if (b->indirect) {
+			dispatch_rw_block_io(w, req, b->pending_req);
+			break;
+		}
+		/* fall through */
+	default:
+		/* A good sign something is wrong: sleep for a while to
+		 * avoid excessive CPU consumption by a bad guest. */
+		msleep(1);
+		DPRINTK("error: unknown block io operation [%d]\n",
+			req->operation);
+		make_response(blkif, req->id, req->operation,
+			      BLKIF_RSP_ERROR);
+		free_req(b->pending_req);
+		break;
+	}
+}
+
+static int do_block_io_op(struct blkif_worker *w)
+{
+	blkif_t *blkif = w->blkif;
+	int more_to_do = 0, stop = 0;
+	int i, nr, barrier_req;
+
+	while (!stop) {
+		mutex_lock(&blkif->ring_mutex);
+
+		nr = get_block_io_batch(w, &barrier_req, &stop, &more_to_do);
+		if (!nr) {
+			mutex_unlock(&blkif->ring_mutex);
+			continue;
+		}
+
+		if (barrier_req)
+			down_write(&blkif->barrier_sem);
+		else
+			down_read(&blkif->barrier_sem);
+
+		mutex_unlock(&blkif->ring_mutex);
+
+		for (i = 0; i < nr; i++)
+			dispatch_block_io(w, &w->batch[i]);
+		blkif_flush_bio(w);
+
+		if (barrier_req)
+			up_write(&blkif->barrier_sem);
+		else
+			up_read(&blkif->barrier_sem);
+
 		/* Yield point for this unbounded loop. */
 		cond_resched();
 	}
@@ -386,21 +921,212 @@ static int do_block_io_op(blkif_t *blkif)
 	return more_to_do;
 }
 
-static void dispatch_rw_block_io(blkif_t *blkif,
+static inline unsigned long persistent_gnt_kaddr(struct blkbk_persistent_gnt *gnt)
+{
+	return (unsigned long)pfn_to_kaddr(page_to_pfn(gnt->page));
+}
+
+/*
+ * Failing this is not fatal: with no pool to put them in, grants are
+ * just mapped for the duration of each request.
+ */
+void blkif_alloc_persistent_gnts(blkif_t *blkif)
+{
+	unsigned int i, nr;
+
+	nr = min_t(unsigned int, blkif_max_persistent_gnts,
+		   RING_SIZE(&blkif->blk_rings.common) *
+		   BLKIF_MAX_SEGMENTS_PER_REQUEST);
+
+	blkif->persistent_gnts = RB_ROOT;
+	blkif->persistent_gnt_c = 0;
+	blkif->max_persistent_gnts = 0;
+
+	blkif->persistent_pool = kcalloc(nr, sizeof(*blkif->persistent_pool),
+					 GFP_KERNEL);
+	if (!blkif->persistent_pool)
+		return;
+
+	blkif->persistent_pages = alloc_empty_pages_and_pagevec(nr);
+	if (!blkif->persistent_pages) {
+		kfree(blkif->persistent_pool);
+		blkif->persistent_pool = NULL;
+		return;
+	}
+
+	for (i = 0; i < nr; i++)
+		blkif->persistent_pool[i].page = blkif->persistent_pages[i];
+	blkif->max_persistent_gnts = nr;
+}
+
+/* Called once no requests are in flight and the kthread is gone. */
+void blkif_free_persistent_gnts(blkif_t *blkif)
+{
+	struct gnttab_unmap_grant_ref unmap[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct page *pages[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	unsigned int i, n = 0;
+	int ret;
+
+	if (!blkif->persistent_pool)
+		return;
+
+	for (i = 0; i < blkif->persistent_gnt_c; i++) {
+		struct blkbk_persistent_gnt *gnt = &blkif->persistent_pool[i];
+
+		gnttab_set_unmap_op(&unmap[n], persistent_gnt_kaddr(gnt),
+				    GNTMAP_host_map, gnt->handle);
+		pages[n++] = gnt->page;
+
+		if (n == ARRAY_SIZE(unmap) || i == blkif->persistent_gnt_c - 1) {
+			ret = gnttab_unmap_refs(unmap, pages, n);
+			BUG_ON(ret);
+			n = 0;
+		}
+	}
+
+	free_empty_pages_and_pagevec(blkif->persistent_pages,
+				     blkif->max_persistent_gnts);
+	kfree(blkif->persistent_pool);
+	blkif->persistent_pages = NULL;
+	blkif->persistent_pool = NULL;
+	blkif->persistent_gnts = RB_ROOT;
+	blkif->persistent_gnt_c = 0;
+	blkif->max_persistent_gnts = 0;
+}
+
+/*
+ * Find the mapping of @gref, mapping it into the next free pool page on
+ * first use.  Entries stay put until the rings are torn down, so only
+ * the walk itself needs persistent_lock.  NULL means the grant has to
+ * be mapped for this request only.
+ */
+static struct blkbk_persistent_gnt *
+__blkif_get_persistent_gnt(blkif_t *blkif, grant_ref_t gref)
+{
+	struct rb_node **p = &blkif->persistent_gnts.rb_node;
+	struct rb_node *parent = NULL;
+	struct blkbk_persistent_gnt *gnt;
+	struct gnttab_map_grant_ref op;
+	int ret;
+
+	while (*p) {
+		parent = *p;
+		gnt = rb_entry(parent, struct blkbk_persistent_gnt, node);
+		if (gref < gnt->gref)
+			p = &parent->rb_left;
+		else if (gref > gnt->gref)
+			p = &parent->rb_right;
+		else
+			return gnt;
+	}
+
+	if (blkif->persistent_gnt_c >= blkif->max_persistent_gnts)
+		return NULL;
+
+	/* Persistent grants are writable, whichever way the data goes. */
+	gnt = &blkif->persistent_pool[blkif->persistent_gnt_c];
+	gnttab_set_map_op(&op, persistent_gnt_kaddr(gnt), GNTMAP_host_map,
+			  gref, blkif->domid);
+	ret = gnttab_map_refs(&op, &gnt->page, 1);
+	BUG_ON(ret);
+	if (unlikely(op.status != GNTST_okay)) {
+		DPRINTK("Bad status %d mapping persistent gref %u.\n",
+			op.status, gref);
+		return NULL;
+	}
+
+	gnt->gref = gref;
+	gnt->handle = op.handle;
+
+	rb_link_node(&gnt->node, parent, p);
+	rb_insert_color(&gnt->node, &blkif->persistent_gnts);
+	blkif->persistent_gnt_c++;
+
+	return gnt;
+}
+
+static struct blkbk_persistent_gnt *
+blkif_get_persistent_gnt(blkif_t *blkif, grant_ref_t gref)
+{
+	struct blkbk_persistent_gnt *gnt;
+
+	spin_lock(&blkif->persistent_lock);
+	gnt = __blkif_get_persistent_gnt(blkif, gref);
+	spin_unlock(&blkif->persistent_lock);
+
+	return gnt;
+}
+
+/* Copy the segment list of an indirect request out of the guest. */
+static int blkif_read_indirect(blkif_t *blkif,
+			       struct blkif_request_indirect *ind_req,
+			       pending_req_t *pending_req)
+{
+	struct gnttab_copy copy[BLKBACK_MAX_INDIRECT_PAGES];
+	unsigned int len = ind_req->nr_segments *
+		sizeof(struct blkif_request_segment);
+	unsigned int i, nr = DIV_ROUND_UP(len, PAGE_SIZE);
+
+	for (i = 0; i < nr; i++) {
+		copy[i].source.u.ref  = ind_req->indirect_grefs[i];
+		copy[i].source.domid  = blkif->domid;
+		copy[i].source.offset = 0;
+		copy[i].dest.u.gmfn   = virt_to_mfn((char *)pending_req->indirect +
+						    i * PAGE_SIZE);
+		copy[i].dest.domid    = DOMID_SELF;
+		copy[i].dest.offset   = 0;
+		copy[i].len           = min_t(unsigned int, len - i * PAGE_SIZE,
+					      PAGE_SIZE);
+		copy[i].flags         = GNTCOPY_source_gref;
+	}
+
+	if (HYPERVISOR_grant_table_op(GNTTABOP_copy, copy, nr))
+		BUG();
+
+	for (i = 0; i < nr; i++) {
+		if (unlikely(copy[i].status != GNTST_okay)) {
+			DPRINTK("invalid indirect segment list\n");
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void dispatch_rw_block_io(struct blkif_worker *w,
 				 struct blkif_request *req,
 				 pending_req_t *pending_req)
 {
+	blkif_t *blkif = w->blkif;
 	struct gnttab_map_grant_ref map[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct page *map_pages[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	int map_seg[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+	struct blkbk_persistent_gnt *gnt;
+	struct blkif_request_indirect *ind_req = NULL;
+	struct blkif_request_segment *segs = req->seg;
 	struct phys_req preq;
-	struct {
-		unsigned long buf; unsigned int nsec;
-	} seg[BLKIF_MAX_SEGMENTS_PER_REQUEST];
-	unsigned int nseg;
+	unsigned int nseg, max_segs = BLKIF_MAX_SEGMENTS_PER_REQUEST;
+	unsigned int op = req->operation;
+	blkif_vdev_t handle = req->handle;
+	u64 id = req->id;
 	struct bio *bio = NULL;
-	int ret, i;
+	int ret = 0, i, j, n;
 	int operation;
 
-	switch (req->operation) {
+	nseg = req->nr_segments;
+	preq.sector_number = req->sector_number;
+
+	if (op == BLKIF_OP_INDIRECT) {
+		ind_req = (struct blkif_request_indirect *)req;
+		op = ind_req->indirect_op;
+		nseg = ind_req->nr_segments;
+		handle = ind_req->handle;
+		id = ind_req->id;
+		preq.sector_number = ind_req->sector_number;
+		max_segs = blkif_max_indirect_segs;
+	}
+
+	switch (op) {
 	case BLKIF_OP_READ:
 		operation = READ;
 		break;
@@ -411,67 +1137,83 @@ static void dispatch_rw_block_io(blkif_t *blkif,
 		operation = WRITE_BARRIER;
 		break;
 	default:
-		operation = 0; /* make gcc happy */
-		BUG();
+		/* Only an indirect request gets here unchecked. */
+		DPRINTK("Bad indirect operation %d\n", op);
+		goto fail_response;
 	}
 
 	/* Check that number of segments is sane. */
-	nseg = req->nr_segments;
 	if (unlikely(nseg == 0 && operation != WRITE_BARRIER) ||
-	    unlikely(nseg > BLKIF_MAX_SEGMENTS_PER_REQUEST)) {
+	    unlikely(nseg > max_segs)) {
 		DPRINTK("Bad number of segments in request (%d)\n", nseg);
 		goto fail_response;
 	}
 
-	preq.dev           = req->handle;
-	preq.sector_number = req->sector_number;
+	if (ind_req) {
+		if (blkif_read_indirect(blkif, ind_req, pending_req))
+			goto fail_response;
+		segs = pending_req->indirect;
+	}
+
+	preq.dev           = handle;
 	preq.nr_sects      = 0;
 
 	pending_req->blkif     = blkif;
-	pending_req->id        = req->id;
-	pending_req->operation = req->operation;
+	pending_req->id        = id;
+	pending_req->operation = op;
 	pending_req->status    = BLKIF_RSP_OKAY;
 	pending_req->nr_pages  = nseg;
 
 	for (i = 0; i < nseg; i++) {
-		uint32_t flags;
-
-		seg[i].nsec = req->seg[i].last_sect -
-			req->seg[i].first_sect + 1;
+		pending_handle(pending_req, i) = BLKBACK_INVALID_HANDLE;
 
-		if ((req->seg[i].last_sect >= (PAGE_SIZE >> 9)) ||
-		    (req->seg[i].last_sect < req->seg[i].first_sect))
+		if ((segs[i].last_sect >= (PAGE_SIZE >> 9)) ||
+		    (segs[i].last_sect < segs[i].first_sect))
 			goto fail_response;
-		preq.nr_sects += seg[i].nsec;
-
-		flags = GNTMAP_host_map;
-		if (operation != READ)
-			flags |= GNTMAP_readonly;
-		gnttab_set_map_op(&map[i], vaddr(pending_req, i), flags,
-				  req->seg[i].gref, blkif->domid);
+		preq.nr_sects += segs[i].last_sect - segs[i].first_sect + 1;
 	}
 
-	ret = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, map, nseg);
-	BUG_ON(ret);
-
-	for (i = 0; i < nseg; i++) {
-		if (unlikely(map[i].status != 0)) {
-			DPRINTK("invalid buffer -- could not remap it\n");
-			map[i].handle = BLKBACK_INVALID_HANDLE;
-			ret |= 1;
-			continue;
+	/*
+	 * Map the segments that are not persistently mapped already, a ring
+	 * slot's worth at a time.
+	 */
+	for (i = 0; i < nseg; ) {
+		for (n = 0; i < nseg && n < ARRAY_SIZE(map); i++) {
+			uint32_t flags = GNTMAP_host_map;
+
+			if (blkif->persistent &&
+			    (gnt = blkif_get_persistent_gnt(blkif, segs[i].gref))) {
+				pending_seg_page(pending_req, i) = gnt->page;
+				continue;
+			}
+			pending_seg_page(pending_req, i) = pending_page(pending_req, i);
+
+			if (operation != READ)
+				flags |= GNTMAP_readonly;
+			gnttab_set_map_op(&map[n], vaddr(pending_req, i),
+					  flags, segs[i].gref, blkif->domid);
+			map_pages[n] = pending_page(pending_req, i);
+			map_seg[n++] = i;
 		}
 
-		set_phys_to_machine(
-			page_to_pfn(pending_page(pending_req, i)),
-			FOREIGN_FRAME(map[i].dev_bus_addr >> PAGE_SHIFT));
-		seg[i].buf  = map[i].dev_bus_addr |
-			(req->seg[i].first_sect << 9);
-		blkback_pagemap_set(vaddr_pagenr(pending_req, i),
-				    pending_page(pending_req, i),
-				    blkif->domid, req->handle,
-				    req->seg[i].gref);
-		pending_handle(pending_req, i) = map[i].handle;
+		if (gnttab_map_refs(map, map_pages, n))
+			BUG();
+
+		for (j = 0; j < n; j++) {
+			int seg = map_seg[j];
+
+			if (unlikely(map[j].status != 0)) {
+				DPRINTK("invalid buffer -- could not remap it\n");
+				ret |= 1;
+				continue;
+			}
+
+			blkback_pagemap_set(vaddr_pagenr(pending_req, seg),
+					    pending_page(pending_req, seg),
+					    blkif->domid, handle,
+					    segs[seg].gref);
+			pending_handle(pending_req, seg) = map[j].handle;
+		}
 	}
 
 	if (ret)
@@ -485,12 +1227,18 @@ static void dispatch_rw_block_io(blkif_t *blkif,
 		goto fail_flush;
 	}
 
-	plug_queue(blkif, preq.bdev);
+	/* Held by dispatch itself; each bio takes one more. */
 	atomic_set(&pending_req->pendcnt, 1);
+	pending_req->merge_bio = NULL;
+	pending_req->nr_merged = 0;
 	blkif_get(blkif);
 
+	bio = blkif_join_bio(w, pending_req, operation, &preq);
+
 	for (i = 0; i < nseg; i++) {
-		if (((int)preq.sector_number|(int)seg[i].nsec) &
+		unsigned int nsec = segs[i].last_sect - segs[i].first_sect + 1;
+
+		if (((int)preq.sector_number|(int)nsec) &
 		    ((bdev_logical_block_size(preq.bdev) >> 9) - 1)) {
 			DPRINTK("Misaligned I/O request from domain %d",
 				blkif->domid);
@@ -499,67 +1247,132 @@ static void dispatch_rw_block_io(blkif_t *blkif,
 
 		while ((bio == NULL) ||
 		       (bio_add_page(bio,
-				     pending_page(pending_req, i),
-				     seg[i].nsec << 9,
-				     seg[i].buf & ~PAGE_MASK) == 0)) {
-			if (bio) {
-				atomic_inc(&pending_req->pendcnt);
+				     pending_seg_page(pending_req, i),
+				     nsec << 9,
+				     segs[i].first_sect << 9) == 0)) {
+			if (bio)
 				submit_bio(operation, bio);
-			}
 
-			bio = bio_alloc(GFP_KERNEL, nseg-i);
+			bio = blkif_alloc_bio(pending_req, &preq, nseg - i);
 			if (unlikely(bio == NULL))
 				goto fail_put_bio;
-
-			bio->bi_bdev    = preq.bdev;
-			bio->bi_private = pending_req;
-			bio->bi_end_io  = end_block_io_op;
-			bio->bi_sector  = preq.sector_number;
 		}
 
-		preq.sector_number += seg[i].nsec;
+		preq.sector_number += nsec;
 	}
 
 	if (!bio) {
 		BUG_ON(operation != WRITE_BARRIER);
-		bio = bio_alloc(GFP_KERNEL, 0);
+		bio = blkif_alloc_bio(pending_req, &preq, 0);
 		if (unlikely(bio == NULL))
 			goto fail_put_bio;
-
-		bio->bi_bdev    = preq.bdev;
-		bio->bi_private = pending_req;
-		bio->bi_end_io  = end_block_io_op;
 		bio->bi_sector  = -1;
 	}
 
-	submit_bio(operation, bio);
+	blkif_stat_submit(blkif, pending_req, op);
+	blkif_trace_submit(blkif, id, op);
+
+	/* Submitted by the next request or at the end of the batch. */
+	w->bio = bio;
+	w->bio_op = operation;
 
 	if (operation == READ)
 		blkif->st_rd_sect += preq.nr_sects;
 	else if (operation == WRITE || operation == WRITE_BARRIER)
 		blkif->st_wr_sect += preq.nr_sects;
 
+	__end_block_io_op(pending_req, 0);
 	return;
 
  fail_flush:
 	fast_flush_area(pending_req);
  fail_response:
-	make_response(blkif, req->id, req->operation, BLKIF_RSP_ERROR);
+	make_response(blkif, id, op, BLKIF_RSP_ERROR);
 	free_req(pending_req);
 	msleep(1); /* back off a bit */
 	return;
 
  fail_put_bio:
+	/* The bio may carry earlier requests of the batch too: send it. */
+	w->bio = bio;
+	w->bio_op = operation;
+	blkif_flush_bio(w);
 	__end_block_io_op(pending_req, -EINVAL);
-	if (bio)
-		bio_put(bio);
-	unplug_queue(blkif);
 	msleep(1); /* back off a bit */
 	return;
 }
 
 
 
+/*
+ * Discards are rare and cheap to describe, so they are simply issued
+ * synchronously from the service thread.
+ */
+static void dispatch_discard_io(blkif_t *blkif,
+				struct blkif_request *req,
+				pending_req_t *pending_req)
+{
+	struct blkif_request_discard *discard =
+		(struct blkif_request_discard *)req;
+	struct phys_req preq;
+	int status = BLKIF_RSP_OKAY;
+	int err;
+
+	preq.dev           = discard->handle;
+	preq.sector_number = discard->sector_number;
+	preq.nr_sects      = discard->nr_sectors;
+
+	if (vbd_translate(&preq, blkif, WRITE) != 0) {
+		DPRINTK("access denied: discard of [%llu,%llu] on dev=%04x\n",
+			preq.sector_number,
+			preq.sector_number + preq.nr_sects, preq.dev);
+		status = BLKIF_RSP_ERROR;
+		goto out;
+	}
+
+	blkif_stat_submit(blkif, pending_req, BLKIF_OP_DISCARD);
+	blkif_trace_submit(blkif, discard->id, BLKIF_OP_DISCARD);
+	err = blkdev_issue_discard(preq.bdev, preq.sector_number,
+				   preq.nr_sects, GFP_KERNEL, DISCARD_FL_WAIT);
+	blkif_stat_complete(blkif, pending_req, BLKIF_OP_DISCARD);
+	if (err == -EOPNOTSUPP)
+		status = BLKIF_RSP_EOPNOTSUPP;
+	else if (err)
+		status = BLKIF_RSP_ERROR;
+
+ out:
+	make_response(blkif, discard->id, BLKIF_OP_DISCARD, status);
+	free_req(pending_req);
+}
+
+/*
+ * The frontend drains its queue around a flush, so unlike a barrier it
+ * need not hold up the other requests here.
+ */
+static void dispatch_flush_io(struct blkif_worker *w,
+			      struct blkif_request *req,
+			      pending_req_t *pending_req)
+{
+	blkif_t *blkif = w->blkif;
+	int status = BLKIF_RSP_OKAY;
+	int err;
+
+	/* Whatever the batch holds back goes out ahead of the flush. */
+	blkif_flush_bio(w);
+
+	blkif_stat_submit(blkif, pending_req, BLKIF_OP_FLUSH_DISKCACHE);
+	blkif_trace_submit(blkif, req->id, BLKIF_OP_FLUSH_DISKCACHE);
+	err = blkdev_issue_flush(blkif->vbd.bdev, NULL);
+	blkif_stat_complete(blkif, pending_req, BLKIF_OP_FLUSH_DISKCACHE);
+	if (err == -EOPNOTSUPP)
+		status = BLKIF_RSP_EOPNOTSUPP;
+	else if (err)
+		status = BLKIF_RSP_ERROR;
+
+	make_response(blkif, req->id, BLKIF_OP_FLUSH_DISKCACHE, status);
+	free_req(pending_req);
+}
+
 /******************************************************************
  * MISCELLANEOUS SETUP / TEARDOWN / DEBUGGING
  */
@@ -578,6 +1391,8 @@ static void make_response(blkif_t *blkif, u64 id,
 	resp.operation = op;
 	resp.status    = st;
 
+	atomic_dec(&blkif->st_inflight);
+
 	spin_lock_irqsave(&blkif->blk_ring_lock, flags);
 	/* Place on the response ring for the relevant domain. */
 	switch (blkif->blk_protocol) {
@@ -612,6 +1427,12 @@ static void make_response(blkif_t *blkif, u64 id,
 
 	spin_unlock_irqrestore(&blkif->blk_ring_lock, flags);
 
+	trace_xen_blkback_response(blkif->domid, blkif->vbd.handle, id, op,
+				   st, notify);
+	blkif_trace_msg(blkif, "blkif dom %u vbd %u id %llu status %d",
+			blkif->domid, blkif->vbd.handle,
+			(unsigned long long)id, st);
+
 	if (more_to_do)
 		blkif_notify_work(blkif);
 	if (notify)
@@ -626,18 +1447,31 @@ static int __init blkif_init(void)
 	if (!xen_pv_domain())
 		return -ENODEV;
 
-	mmap_pages = blkif_reqs * BLKIF_MAX_SEGMENTS_PER_REQUEST;
+	if (blkif_max_ring_order > BLKIF_MAX_RING_PAGE_ORDER)
+		blkif_max_ring_order = BLKIF_MAX_RING_PAGE_ORDER;
+
+	if (blkif_indirect_reqs < 0)
+		blkif_indirect_reqs = 0;
+	if (blkif_indirect_reqs)
+		blkif_max_indirect_segs = BLKBACK_MAX_INDIRECT_SEGMENTS;
 
-	pending_reqs          = kmalloc(sizeof(pending_reqs[0]) *
-					blkif_reqs, GFP_KERNEL);
+	mmap_pages = blkif_reqs * BLKIF_MAX_SEGMENTS_PER_REQUEST +
+		blkif_indirect_reqs * BLKBACK_MAX_INDIRECT_SEGMENTS;
+
+	pending_reqs          = kzalloc(sizeof(pending_reqs[0]) *
+					(blkif_reqs + blkif_indirect_reqs),
+					GFP_KERNEL);
 	pending_grant_handles = kmalloc(sizeof(pending_grant_handles[0]) *
 					mmap_pages, GFP_KERNEL);
 	pending_pages         = alloc_empty_pages_and_pagevec(mmap_pages);
+	pending_seg_pages     = kcalloc(mmap_pages, sizeof(pending_seg_pages[0]),
+					GFP_KERNEL);
 
 	if (blkback_pagemap_init(mmap_pages))
 		goto out_of_memory;
 
-	if (!pending_reqs || !pending_grant_handles || !pending_pages) {
+	if (!pending_reqs || !pending_grant_handles || !pending_pages ||
+	    !pending_seg_pages) {
 		rc = -ENOMEM;
 		goto out_of_memory;
 	}
@@ -649,11 +1483,27 @@ static int __init blkif_init(void)
 	if (rc)
 		goto failed_init;
 
-	memset(pending_reqs, 0, sizeof(pending_reqs));
 	INIT_LIST_HEAD(&pending_free);
+	INIT_LIST_HEAD(&pending_free_indirect);
 
-	for (i = 0; i < blkif_reqs; i++)
+	for (i = 0; i < blkif_reqs; i++) {
+		pending_reqs[i].page_base = i * BLKIF_MAX_SEGMENTS_PER_REQUEST;
 		list_add_tail(&pending_reqs[i].free_list, &pending_free);
+	}
+
+	for (i = blkif_reqs; i < blkif_reqs + blkif_indirect_reqs; i++) {
+		pending_req_t *req = &pending_reqs[i];
+
+		req->page_base = blkif_reqs * BLKIF_MAX_SEGMENTS_PER_REQUEST +
+			(i - blkif_reqs) * BLKBACK_MAX_INDIRECT_SEGMENTS;
+		req->indirect = (void *)__get_free_pages(GFP_KERNEL,
+						BLKBACK_INDIRECT_ORDER);
+		if (!req->indirect) {
+			rc = -ENOMEM;
+			goto out_of_memory;
+		}
+		list_add_tail(&req->free_list, &pending_free_indirect);
+	}
 
 	rc = blkif_xenbus_init();
 	if (rc)
@@ -664,8 +1514,13 @@ static int __init blkif_init(void)
  out_of_memory:
 	printk(KERN_ERR "%s: out of memory\n", __func__);
  failed_init:
+	for (i = blkif_reqs; pending_reqs && i < blkif_reqs + blkif_indirect_reqs; i++)
+		if (pending_reqs[i].indirect)
+			free_pages((unsigned long)pending_reqs[i].indirect,
+				   BLKBACK_INDIRECT_ORDER);
 	kfree(pending_reqs);
 	kfree(pending_grant_handles);
+	kfree(pending_seg_pages);
 	free_empty_pages_and_pagevec(pending_pages, mmap_pages);
 	return rc;
 }
@@ -34,6 +34,9 @@
 #include <linux/blkdev.h>
 #include <linux/vmalloc.h>
 #include <linux/wait.h>
+#include <linux/rbtree.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <asm/io.h>
 #include <asm/setup.h>
 #include <asm/pgalloc.h>
@@ -59,6 +62,56 @@ struct vbd {
 
 struct backend_info;
 
+#define BLKBACK_MAX_WORKERS 8
+
+/* Requests a worker takes off the ring in one go, see do_block_io_op(). */
+#define BLKBACK_BATCH 8
+
+struct pending_req;
+
+struct blkif_batch_req {
+	struct blkif_request   req;
+	struct pending_req    *pending_req;
+	int                    indirect;
+};
+
+/* One of the threads servicing a vbd's ring. */
+struct blkif_worker {
+	struct blkif_st       *blkif;
+	struct task_struct    *task;
+	unsigned int           waiting_indirect; /* stalled on indirect pool */
+	/* Last bio of the batch, held back so the next request can extend it. */
+	struct bio            *bio;
+	int                    bio_op;
+	struct blkif_batch_req batch[BLKBACK_BATCH];
+};
+
+/*
+ * Latency histograms, bucket n counting [2^(n-1), 2^n) microseconds and
+ * the last one everything slower.
+ */
+#define BLKBACK_LAT_BUCKETS 20
+
+enum {
+	BLKIF_STAT_RD,
+	BLKIF_STAT_WR,
+	BLKIF_STAT_DS,
+	BLKIF_NR_STAT_OPS
+};
+
+struct blkif_lat_hist {
+	atomic_t queue[BLKBACK_LAT_BUCKETS];	/* off the ring to submitted */
+	atomic_t device[BLKBACK_LAT_BUCKETS];	/* submitted to completed */
+};
+
+/* A frontend data page that stays mapped for the lifetime of the rings. */
+struct blkbk_persistent_gnt {
+	struct rb_node node;
+	grant_ref_t gref;
+	grant_handle_t handle;
+	struct page *page;
+};
+
 typedef struct blkif_st {
 	/* Unique identifier for this interface. */
 	domid_t           domid;
@@ -78,9 +131,17 @@ typedef struct blkif_st {
 	atomic_t         refcnt;
 
 	wait_queue_head_t   wq;
-	struct task_struct  *xenblkd;
 	unsigned int        waiting_reqs;
-	struct request_queue     *plug;
+	struct blkif_worker workers[BLKBACK_MAX_WORKERS];
+	unsigned int        nr_workers;
+	/* Serialises the workers' consumption of the ring. */
+	struct mutex        ring_mutex;
+	/* Orders barriers against the requests around them, see blkback.c. */
+	struct rw_semaphore barrier_sem;
+	/* Requests set aside for this vbd alone. */
+	struct list_head    pending_free;
+	spinlock_t          pending_lock;
+	unsigned int        nr_reserved_reqs;
 
 	/* statistics */
 	unsigned long       st_print;
@@ -88,19 +149,52 @@ typedef struct blkif_st {
 	int                 st_wr_req;
 	int                 st_oo_req;
 	int                 st_br_req;
+	int                 st_ds_req;
+	int                 st_fl_req;
 	int                 st_rd_sect;
 	int                 st_wr_sect;
+	int                 st_oo_indirect;
+	atomic_t            st_inflight;
+	int                 st_max_inflight;
+	atomic_t            st_merged;
+	struct blkif_lat_hist st_lat[BLKIF_NR_STAT_OPS];
+	int                 st_throttled;
+
+	/*
+	 * Rate limits in requests and bytes per second, 0 for none.  The
+	 * token buckets are only touched under ring_mutex.
+	 */
+	unsigned long       rate_iops;
+	unsigned long       rate_bytes;
+	s64                 iops_tokens;
+	s64                 bytes_tokens;
+	unsigned long       rate_stamp;
+	struct timer_list   rate_timer;
 
 	wait_queue_head_t waiting_to_free;
 
-	grant_handle_t shmem_handle;
-	grant_ref_t    shmem_ref;
+	unsigned int   nr_ring_pages;
+	grant_handle_t shmem_handle[BLKIF_MAX_RING_PAGES];
+	grant_ref_t    shmem_ref[BLKIF_MAX_RING_PAGES];
+
+	/*
+	 * Persistently mapped frontend pages, looked up by grant ref.  They
+	 * are mapped and torn down with the rings.
+	 */
+	int                 persistent;
+	spinlock_t          persistent_lock;
+	struct rb_root      persistent_gnts;
+	unsigned int        persistent_gnt_c;
+	unsigned int        max_persistent_gnts;
+	struct blkbk_persistent_gnt *persistent_pool;
+	struct page       **persistent_pages;
 } blkif_t;
 
 blkif_t *blkif_alloc(domid_t domid);
 void blkif_disconnect(blkif_t *blkif);
 void blkif_free(blkif_t *blkif);
-int blkif_map(blkif_t *blkif, unsigned long shared_page, unsigned int evtchn);
+int blkif_map(blkif_t *blkif, grant_ref_t *ring_ref, unsigned int nr_pages,
+	      unsigned int evtchn);
 void vbd_resize(blkif_t *blkif);
 
 #define blkif_get(_b) (atomic_inc(&(_b)->refcnt))
@@ -118,10 +212,11 @@ void vbd_free(struct vbd *vbd);
 unsigned long long vbd_size(struct vbd *vbd);
 unsigned int vbd_info(struct vbd *vbd);
 unsigned long vbd_secsize(struct vbd *vbd);
+int vbd_rotational(struct vbd *vbd);
 
 struct phys_req {
 	unsigned short       dev;
-	unsigned short       nr_sects;
+	blkif_sector_t       nr_sects;
 	struct block_device *bdev;
 	blkif_sector_t       sector_number;
 };
@@ -130,10 +225,23 @@ int vbd_translate(struct phys_req *req, blkif_t *blkif, int operation);
 
 int blkif_interface_init(void);
 
+extern unsigned int blkif_max_ring_order;
+extern unsigned int blkif_max_indirect_segs;
+extern int blkif_feature_persistent;
+extern unsigned int blkif_nr_workers;
+
+void blkif_reserve_reqs(blkif_t *blkif);
+void blkif_release_reqs(blkif_t *blkif);
+
+void blkif_alloc_persistent_gnts(blkif_t *blkif);
+void blkif_free_persistent_gnts(blkif_t *blkif);
+
 int blkif_xenbus_init(void);
 
 irqreturn_t blkif_be_int(int irq, void *dev_id);
 int blkif_schedule(void *arg);
+void blkif_rate_timer(unsigned long data);
+void blkif_set_rate(blkif_t *blkif, unsigned long iops, unsigned long bytes);
 
 int blkback_barrier(struct xenbus_transaction xbt,
 		    struct backend_info *be, int state);
@@ -48,6 +48,12 @@ blkif_t *blkif_alloc(domid_t domid)
 	memset(blkif, 0, sizeof(*blkif));
 	blkif->domid = domid;
 	spin_lock_init(&blkif->blk_ring_lock);
+	INIT_LIST_HEAD(&blkif->pending_free);
+	spin_lock_init(&blkif->pending_lock);
+	mutex_init(&blkif->ring_mutex);
+	init_rwsem(&blkif->barrier_sem);
+	setup_timer(&blkif->rate_timer, blkif_rate_timer, (unsigned long)blkif);
+	spin_lock_init(&blkif->persistent_lock);
 	atomic_set(&blkif->refcnt, 1);
 	init_waitqueue_head(&blkif->wq);
 	blkif->st_print = jiffies;
@@ -56,75 +62,104 @@ blkif_t *blkif_alloc(domid_t domid)
 	return blkif;
 }
 
-static int map_frontend_page(blkif_t *blkif, unsigned long shared_page)
+static void unmap_frontend_pages(blkif_t *blkif)
 {
-	struct gnttab_map_grant_ref op;
+	struct gnttab_unmap_grant_ref ops[BLKIF_MAX_RING_PAGES];
+	unsigned long addr = (unsigned long)blkif->blk_ring_area->addr;
+	unsigned int i, nr_pages = blkif->nr_ring_pages;
 
-	gnttab_set_map_op(&op, (unsigned long)blkif->blk_ring_area->addr,
-			  GNTMAP_host_map, shared_page, blkif->domid);
+	for (i = 0; i < nr_pages; i++)
+		gnttab_set_unmap_op(&ops[i], addr + i * PAGE_SIZE,
+				    GNTMAP_host_map, blkif->shmem_handle[i]);
 
-	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &op, 1))
+	if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, ops, nr_pages))
 		BUG();
-
-	if (op.status) {
-		DPRINTK(" Grant table operation failure !\n");
-		return op.status;
-	}
-
-	blkif->shmem_ref = shared_page;
-	blkif->shmem_handle = op.handle;
-
-	return 0;
 }
 
-static void unmap_frontend_page(blkif_t *blkif)
+static int map_frontend_pages(blkif_t *blkif, grant_ref_t *ring_ref,
+			      unsigned int nr_pages)
 {
-	struct gnttab_unmap_grant_ref op;
+	struct gnttab_map_grant_ref ops[BLKIF_MAX_RING_PAGES];
+	unsigned long addr = (unsigned long)blkif->blk_ring_area->addr;
+	unsigned int i, nr;
+	int err = 0;
 
-	gnttab_set_unmap_op(&op, (unsigned long)blkif->blk_ring_area->addr,
-			    GNTMAP_host_map, blkif->shmem_handle);
+	for (i = 0; i < nr_pages; i++)
+		gnttab_set_map_op(&ops[i], addr + i * PAGE_SIZE,
+				  GNTMAP_host_map, ring_ref[i], blkif->domid);
 
-	if (HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, &op, 1))
+	if (HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, ops, nr_pages))
 		BUG();
+
+	for (i = 0; i < nr_pages; i++) {
+		if (ops[i].status) {
+			DPRINTK(" Grant table operation failure !\n");
+			err = ops[i].status;
+			continue;
+		}
+		blkif->shmem_ref[i] = ring_ref[i];
+		blkif->shmem_handle[i] = ops[i].handle;
+	}
+
+	if (err) {
+		/* Undo the mappings that did succeed. */
+		struct gnttab_unmap_grant_ref unmap[BLKIF_MAX_RING_PAGES];
+
+		for (i = 0, nr = 0; i < nr_pages; i++)
+			if (!ops[i].status)
+				gnttab_set_unmap_op(&unmap[nr++],
+						    addr + i * PAGE_SIZE,
+						    GNTMAP_host_map,
+						    ops[i].handle);
+		if (nr &&
+		    HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref,
+					      unmap, nr))
+			BUG();
+	}
+
+	return err;
 }
 
-int blkif_map(blkif_t *blkif, unsigned long shared_page, unsigned int evtchn)
+int blkif_map(blkif_t *blkif, grant_ref_t *ring_ref, unsigned int nr_pages,
+	      unsigned int evtchn)
 {
+	unsigned long size = nr_pages * PAGE_SIZE;
 	int err;
 
 	/* Already connected through? */
 	if (blkif->irq)
 		return 0;
 
-	if ( (blkif->blk_ring_area = alloc_vm_area(PAGE_SIZE)) == NULL )
+	if ( (blkif->blk_ring_area = alloc_vm_area(size)) == NULL )
 		return -ENOMEM;
 
-	err = map_frontend_page(blkif, shared_page);
+	err = map_frontend_pages(blkif, ring_ref, nr_pages);
 	if (err) {
 		free_vm_area(blkif->blk_ring_area);
 		return err;
 	}
+	blkif->nr_ring_pages = nr_pages;
 
 	switch (blkif->blk_protocol) {
 	case BLKIF_PROTOCOL_NATIVE:
 	{
 		struct blkif_sring *sring;
 		sring = (struct blkif_sring *)blkif->blk_ring_area->addr;
-		BACK_RING_INIT(&blkif->blk_rings.native, sring, PAGE_SIZE);
+		BACK_RING_INIT(&blkif->blk_rings.native, sring, size);
 		break;
 	}
 	case BLKIF_PROTOCOL_X86_32:
 	{
 		struct blkif_x86_32_sring *sring_x86_32;
 		sring_x86_32 = (struct blkif_x86_32_sring *)blkif->blk_ring_area->addr;
-		BACK_RING_INIT(&blkif->blk_rings.x86_32, sring_x86_32, PAGE_SIZE);
+		BACK_RING_INIT(&blkif->blk_rings.x86_32, sring_x86_32, size);
 		break;
 	}
 	case BLKIF_PROTOCOL_X86_64:
 	{
 		struct blkif_x86_64_sring *sring_x86_64;
 		sring_x86_64 = (struct blkif_x86_64_sring *)blkif->blk_ring_area->addr;
-		BACK_RING_INIT(&blkif->blk_rings.x86_64, sring_x86_64, PAGE_SIZE);
+		BACK_RING_INIT(&blkif->blk_rings.x86_64, sring_x86_64, size);
 		break;
 	}
 	default:
@@ -135,22 +170,35 @@ int blkif_map(blkif_t *blkif, unsigned long shared_page, unsigned int evtchn)
 		blkif->domid, evtchn, blkif_be_int, 0, "blkif-backend", blkif);
 	if (err < 0)
 	{
-		unmap_frontend_page(blkif);
+		unmap_frontend_pages(blkif);
 		free_vm_area(blkif->blk_ring_area);
 		blkif->blk_rings.common.sring = NULL;
 		return err;
 	}
 	blkif->irq = err;
 
+	blkif_reserve_reqs(blkif);
+
+	if (blkif->persistent)
+		blkif_alloc_persistent_gnts(blkif);
+
 	return 0;
 }
 
 void blkif_disconnect(blkif_t *blkif)
 {
-	if (blkif->xenblkd) {
-		kthread_stop(blkif->xenblkd);
-		blkif->xenblkd = NULL;
+	unsigned int i;
+
+	for (i = 0; i < blkif->nr_workers; i++) {
+		struct blkif_worker *w = &blkif->workers[i];
+
+		if (w->task) {
+			kthread_stop(w->task);
+			w->task = NULL;
+		}
 	}
+	blkif->nr_workers = 0;
+	del_timer_sync(&blkif->rate_timer);
 
 	atomic_dec(&blkif->refcnt);
 	wait_event(blkif->waiting_to_free, atomic_read(&blkif->refcnt) == 0);
@@ -162,10 +210,13 @@ void blkif_disconnect(blkif_t *blkif)
 	}
 
 	if (blkif->blk_rings.common.sring) {
-		unmap_frontend_page(blkif);
+		unmap_frontend_pages(blkif);
 		free_vm_area(blkif->blk_ring_area);
 		blkif->blk_rings.common.sring = NULL;
 	}
+
+	blkif_release_reqs(blkif);
+	blkif_free_persistent_gnts(blkif);
 }
 
 void blkif_free(blkif_t *blkif)
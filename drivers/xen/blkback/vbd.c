@@ -50,6 +50,11 @@ unsigned long vbd_secsize(struct vbd *vbd)
 	return bdev_logical_block_size(vbd->bdev);
 }
 
+int vbd_rotational(struct vbd *vbd)
+{
+	return !blk_queue_nonrot(bdev_get_queue(vbd->bdev));
+}
+
 int vbd_create(blkif_t *blkif, blkif_vdev_t handle, unsigned major,
 	       unsigned minor, int readonly, int cdrom)
 {
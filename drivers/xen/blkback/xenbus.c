@@ -32,6 +32,7 @@ struct backend_info
 	struct xenbus_device *dev;
 	blkif_t *blkif;
 	struct xenbus_watch backend_watch;
+	struct xenbus_watch qos_watch;
 	unsigned major;
 	unsigned minor;
 	char *mode;
@@ -41,6 +42,8 @@ static void connect(struct backend_info *);
 static int connect_ring(struct backend_info *);
 static void backend_changed(struct xenbus_watch *, const char **,
 			    unsigned int);
+static void qos_changed(struct xenbus_watch *, const char **,
+			unsigned int);
 
 struct xenbus_device *blkback_xenbus(struct backend_info *be)
 {
@@ -70,6 +73,7 @@ static int blkback_name(blkif_t *blkif, char *buf)
 static void update_blkif_status(blkif_t *blkif)
 {
 	int err;
+	unsigned int i, nr;
 	char name[TASK_COMM_LEN];
 
 	/* Not ready to connect? */
@@ -98,12 +102,26 @@ static void update_blkif_status(blkif_t *blkif)
 	}
 	invalidate_inode_pages2(blkif->vbd.bdev->bd_inode->i_mapping);
 
-	blkif->xenblkd = kthread_run(blkif_schedule, blkif, name);
-	if (IS_ERR(blkif->xenblkd)) {
-		err = PTR_ERR(blkif->xenblkd);
-		blkif->xenblkd = NULL;
-		xenbus_dev_error(blkif->be->dev, err, "start xenblkd");
+	nr = clamp_t(unsigned int, blkif_nr_workers, 1, BLKBACK_MAX_WORKERS);
+
+	for (i = 0; i < nr; i++) {
+		struct blkif_worker *w = &blkif->workers[i];
+
+		w->blkif = blkif;
+		if (i == 0)
+			w->task = kthread_run(blkif_schedule, w, "%s", name);
+		else
+			w->task = kthread_run(blkif_schedule, w, "%s.%u",
+					      name, i);
+		if (IS_ERR(w->task)) {
+			err = PTR_ERR(w->task);
+			w->task = NULL;
+			xenbus_dev_error(blkif->be->dev, err, "start xenblkd");
+			break;
+		}
 	}
+	/* The threads that did start are enough to make progress. */
+	blkif->nr_workers = i;
 }
 
 
@@ -127,16 +145,67 @@ VBD_SHOW(oo_req,  "%d\n", be->blkif->st_oo_req);
 VBD_SHOW(rd_req,  "%d\n", be->blkif->st_rd_req);
 VBD_SHOW(wr_req,  "%d\n", be->blkif->st_wr_req);
 VBD_SHOW(br_req,  "%d\n", be->blkif->st_br_req);
+VBD_SHOW(ds_req,  "%d\n", be->blkif->st_ds_req);
+VBD_SHOW(fl_req,  "%d\n", be->blkif->st_fl_req);
 VBD_SHOW(rd_sect, "%d\n", be->blkif->st_rd_sect);
 VBD_SHOW(wr_sect, "%d\n", be->blkif->st_wr_sect);
+VBD_SHOW(oo_indirect,  "%d\n", be->blkif->st_oo_indirect);
+VBD_SHOW(inflight,     "%d\n", atomic_read(&be->blkif->st_inflight));
+VBD_SHOW(max_inflight, "%d\n", be->blkif->st_max_inflight);
+VBD_SHOW(merged,       "%d\n", atomic_read(&be->blkif->st_merged));
+VBD_SHOW(throttled,    "%d\n", be->blkif->st_throttled);
+
+static ssize_t show_lat_hist(char *buf, atomic_t *hist)
+{
+	ssize_t n = 0;
+	int i;
+
+	for (i = 0; i < BLKBACK_LAT_BUCKETS; i++)
+		n += sprintf(buf + n, "%s%d", i ? " " : "",
+			     atomic_read(&hist[i]));
+	n += sprintf(buf + n, "\n");
+	return n;
+}
+
+#define VBD_SHOW_LAT(name, op, hist)					\
+	static ssize_t show_##name(struct device *_dev,			\
+				   struct device_attribute *attr,	\
+				   char *buf)				\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+									\
+		return show_lat_hist(buf, be->blkif->st_lat[op].hist);	\
+	}								\
+	static DEVICE_ATTR(name, S_IRUGO, show_##name, NULL)
+
+VBD_SHOW_LAT(rd_lat_queue,  BLKIF_STAT_RD, queue);
+VBD_SHOW_LAT(rd_lat_device, BLKIF_STAT_RD, device);
+VBD_SHOW_LAT(wr_lat_queue,  BLKIF_STAT_WR, queue);
+VBD_SHOW_LAT(wr_lat_device, BLKIF_STAT_WR, device);
+VBD_SHOW_LAT(ds_lat_queue,  BLKIF_STAT_DS, queue);
+VBD_SHOW_LAT(ds_lat_device, BLKIF_STAT_DS, device);
 
 static struct attribute *vbdstat_attrs[] = {
 	&dev_attr_oo_req.attr,
 	&dev_attr_rd_req.attr,
 	&dev_attr_wr_req.attr,
 	&dev_attr_br_req.attr,
+	&dev_attr_ds_req.attr,
+	&dev_attr_fl_req.attr,
 	&dev_attr_rd_sect.attr,
 	&dev_attr_wr_sect.attr,
+	&dev_attr_oo_indirect.attr,
+	&dev_attr_inflight.attr,
+	&dev_attr_max_inflight.attr,
+	&dev_attr_merged.attr,
+	&dev_attr_throttled.attr,
+	&dev_attr_rd_lat_queue.attr,
+	&dev_attr_rd_lat_device.attr,
+	&dev_attr_wr_lat_queue.attr,
+	&dev_attr_wr_lat_device.attr,
+	&dev_attr_ds_lat_queue.attr,
+	&dev_attr_ds_lat_device.attr,
 	NULL
 };
 
@@ -145,6 +214,48 @@ static struct attribute_group vbdstat_group = {
 	.attrs = vbdstat_attrs,
 };
 
+/* Rate limits, also settable through the backend's "qos" node. */
+#define VBD_RATE(name, field)						\
+	static ssize_t show_##name(struct device *_dev,			\
+				   struct device_attribute *attr,	\
+				   char *buf)				\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+									\
+		return sprintf(buf, "%lu\n", be->blkif->rate_##field);	\
+	}								\
+	static ssize_t store_##name(struct device *_dev,		\
+				    struct device_attribute *attr,	\
+				    const char *buf, size_t count)	\
+	{								\
+		struct xenbus_device *dev = to_xenbus_device(_dev);	\
+		struct backend_info *be = dev_get_drvdata(&dev->dev);	\
+		blkif_t *blkif = be->blkif;				\
+		unsigned long rate = simple_strtoul(buf, NULL, 10);	\
+		unsigned long iops = blkif->rate_iops;			\
+		unsigned long bytes = blkif->rate_bytes;		\
+									\
+		field = rate;						\
+		blkif_set_rate(blkif, iops, bytes);			\
+		return count;						\
+	}								\
+	static DEVICE_ATTR(name, S_IRUGO | S_IWUSR, show_##name, store_##name)
+
+VBD_RATE(iops, iops);
+VBD_RATE(bytes, bytes);
+
+static struct attribute *vbdqos_attrs[] = {
+	&dev_attr_iops.attr,
+	&dev_attr_bytes.attr,
+	NULL
+};
+
+static struct attribute_group vbdqos_group = {
+	.name = "qos",
+	.attrs = vbdqos_attrs,
+};
+
 VBD_SHOW(physical_device, "%x:%x\n", be->major, be->minor);
 VBD_SHOW(mode, "%s\n", be->mode);
 
@@ -164,16 +275,21 @@ int xenvbd_sysfs_addif(struct xenbus_device *dev)
 	if (error)
 		goto fail3;
 
+	error = sysfs_create_group(&dev->dev.kobj, &vbdqos_group);
+	if (error)
+		goto fail4;
+
 	return 0;
 
-fail3:	sysfs_remove_group(&dev->dev.kobj, &vbdstat_group);
-fail2:	device_remove_file(&dev->dev, &dev_attr_mode);
-fail1:	device_remove_file(&dev->dev, &dev_attr_physical_device);
-	return error;
+fail4:	sysfs_remove_group(&dev->dev.kobj, &vbdstat_group);
+fail3:	device_remove_file(&dev->dev, &dev_attr_mode);
+fail2:	device_remove_file(&dev->dev, &dev_attr_physical_device);
+fail1:	return error;
 }
 
 void xenvbd_sysfs_delif(struct xenbus_device *dev)
 {
+	sysfs_remove_group(&dev->dev.kobj, &vbdqos_group);
 	sysfs_remove_group(&dev->dev.kobj, &vbdstat_group);
 	device_remove_file(&dev->dev, &dev_attr_mode);
 	device_remove_file(&dev->dev, &dev_attr_physical_device);
@@ -194,6 +310,12 @@ static int blkback_remove(struct xenbus_device *dev)
 		be->backend_watch.node = NULL;
 	}
 
+	if (be->qos_watch.node) {
+		unregister_xenbus_watch(&be->qos_watch);
+		kfree(be->qos_watch.node);
+		be->qos_watch.node = NULL;
+	}
+
 	if (be->blkif) {
 		blkif_disconnect(be->blkif);
 		vbd_free(&be->blkif->vbd);
@@ -220,6 +342,24 @@ int blkback_barrier(struct xenbus_transaction xbt,
 	return err;
 }
 
+/* Advertise discard only if the device underneath can do it. */
+static int blkback_discard(struct xenbus_transaction xbt,
+			   struct backend_info *be)
+{
+	struct xenbus_device *dev = be->dev;
+	struct request_queue *q = bdev_get_queue(be->blkif->vbd.bdev);
+	int err;
+
+	if (!q || !blk_queue_discard(q))
+		return 0;
+
+	err = xenbus_printf(xbt, dev->nodename, "feature-discard", "%d", 1);
+	if (err)
+		xenbus_dev_fatal(dev, err, "writing feature-discard");
+
+	return err;
+}
+
 /**
  * Entry point to this code when a new device is created.  Allocate the basic
  * structures, and watch the store waiting for the hotplug scripts to tell us
@@ -255,6 +395,31 @@ static int blkback_probe(struct xenbus_device *dev,
 	if (err)
 		goto fail;
 
+	err = xenbus_watch_pathfmt(dev, &be->qos_watch, qos_changed,
+				   "%s/%s", dev->nodename, "qos");
+	if (err)
+		goto fail;
+
+	/* Must be in place before the frontend sees InitWait. */
+	err = xenbus_printf(XBT_NIL, dev->nodename, "max-ring-page-order",
+			    "%u", blkif_max_ring_order);
+	if (err)
+		DPRINTK("writing max-ring-page-order failed: %d\n", err);
+
+	err = xenbus_printf(XBT_NIL, dev->nodename, "feature-persistent",
+			    "%d", blkif_feature_persistent);
+	if (err)
+		DPRINTK("writing feature-persistent failed: %d\n", err);
+
+	if (blkif_max_indirect_segs) {
+		err = xenbus_printf(XBT_NIL, dev->nodename,
+				    "feature-max-indirect-segments", "%u",
+				    blkif_max_indirect_segs);
+		if (err)
+			DPRINTK("writing feature-max-indirect-segments "
+				"failed: %d\n", err);
+	}
+
 	err = xenbus_switch_state(dev, XenbusStateInitWait);
 	if (err)
 		goto fail;
@@ -268,6 +433,28 @@ fail:
 }
 
 
+/**
+ * Callback received when the toolstack changes the vbd's rate limits,
+ * "qos/iops" and "qos/bytes" per second.  A missing key means no limit.
+ */
+static void qos_changed(struct xenbus_watch *watch,
+			const char **vec, unsigned int len)
+{
+	struct backend_info *be
+		= container_of(watch, struct backend_info, qos_watch);
+	struct xenbus_device *dev = be->dev;
+	unsigned long iops, bytes;
+
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "qos/iops", "%lu",
+			 &iops) != 1)
+		iops = 0;
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "qos/bytes", "%lu",
+			 &bytes) != 1)
+		bytes = 0;
+
+	blkif_set_rate(be->blkif, iops, bytes);
+}
+
 /**
  * Callback received when the hotplug scripts have placed the physical-device
  * node.  Read it and the mode node, and create a vbd.  If the frontend is
@@ -437,6 +624,18 @@ again:
 	if (err)
 		goto abort;
 
+	err = blkback_discard(xbt, be);
+	if (err)
+		goto abort;
+
+	err = xenbus_printf(xbt, dev->nodename, "feature-flush-cache",
+			    "%d", 1);
+	if (err) {
+		xenbus_dev_fatal(dev, err, "writing %s/feature-flush-cache",
+				 dev->nodename);
+		goto abort;
+	}
+
 	err = xenbus_printf(xbt, dev->nodename, "sectors", "%llu",
 			    vbd_size(&be->blkif->vbd));
 	if (err) {
@@ -460,6 +659,14 @@ again:
 				 dev->nodename);
 		goto abort;
 	}
+	/* Lets the frontend's I/O scheduler know whether seeks cost. */
+	err = xenbus_printf(xbt, dev->nodename, "rotational", "%d",
+			    vbd_rotational(&be->blkif->vbd));
+	if (err) {
+		xenbus_dev_fatal(dev, err, "writing %s/rotational",
+				 dev->nodename);
+		goto abort;
+	}
 
 	err = xenbus_transaction_end(xbt, 0);
 	if (err == -EAGAIN)
@@ -481,22 +688,57 @@ again:
 static int connect_ring(struct backend_info *be)
 {
 	struct xenbus_device *dev = be->dev;
-	unsigned long ring_ref;
-	unsigned int evtchn;
+	grant_ref_t ring_ref[BLKIF_MAX_RING_PAGES];
+	unsigned int evtchn, ring_order, nr_pages, i;
 	char protocol[64] = "";
 	int err;
 
 	DPRINTK("%s", dev->otherend);
 
-	err = xenbus_gather(XBT_NIL, dev->otherend, "ring-ref", "%lu", &ring_ref,
-			    "event-channel", "%u", &evtchn, NULL);
-	if (err) {
-		xenbus_dev_fatal(dev, err,
-				 "reading %s/ring-ref and event-channel",
+	err = xenbus_scanf(XBT_NIL, dev->otherend, "event-channel", "%u",
+			   &evtchn);
+	if (err != 1) {
+		err = -EINVAL;
+		xenbus_dev_fatal(dev, err, "reading %s/event-channel",
 				 dev->otherend);
 		return err;
 	}
 
+	err = xenbus_scanf(XBT_NIL, dev->otherend, "ring-page-order", "%u",
+			   &ring_order);
+	if (err != 1) {
+		ring_order = 0;
+		err = xenbus_scanf(XBT_NIL, dev->otherend, "ring-ref", "%u",
+				   &ring_ref[0]);
+		if (err != 1) {
+			err = -EINVAL;
+			xenbus_dev_fatal(dev, err, "reading %s/ring-ref",
+					 dev->otherend);
+			return err;
+		}
+	} else {
+		if (ring_order > blkif_max_ring_order) {
+			err = -EINVAL;
+			xenbus_dev_fatal(dev, err, "%s/ring-page-order %u too big",
+					 dev->otherend, ring_order);
+			return err;
+		}
+		for (i = 0; i < (1U << ring_order); i++) {
+			char node[16];
+
+			snprintf(node, sizeof(node), "ring-ref%u", i);
+			err = xenbus_scanf(XBT_NIL, dev->otherend, node, "%u",
+					   &ring_ref[i]);
+			if (err != 1) {
+				err = -EINVAL;
+				xenbus_dev_fatal(dev, err, "reading %s/%s",
+						 dev->otherend, node);
+				return err;
+			}
+		}
+	}
+	nr_pages = 1U << ring_order;
+
 	be->blkif->blk_protocol = BLKIF_PROTOCOL_NATIVE;
 	err = xenbus_gather(XBT_NIL, dev->otherend, "protocol",
 			    "%63s", protocol, NULL);
@@ -512,15 +754,20 @@ static int connect_ring(struct backend_info *be)
 		xenbus_dev_fatal(dev, err, "unknown fe protocol %s", protocol);
 		return -1;
 	}
+	if (xenbus_scanf(XBT_NIL, dev->otherend, "feature-persistent",
+			 "%d", &be->blkif->persistent) != 1)
+		be->blkif->persistent = 0;
+	be->blkif->persistent &= blkif_feature_persistent;
+
 	printk(KERN_INFO
-	       "blkback: ring-ref %ld, event-channel %d, protocol %d (%s)\n",
-	       ring_ref, evtchn, be->blkif->blk_protocol, protocol);
+	       "blkback: ring-ref %u (%u pages), event-channel %d, protocol %d (%s)\n",
+	       ring_ref[0], nr_pages, evtchn, be->blkif->blk_protocol, protocol);
 
-	/* Map the shared frame, irq etc. */
-	err = blkif_map(be->blkif, ring_ref, evtchn);
+	/* Map the shared frames, irq etc. */
+	err = blkif_map(be->blkif, ring_ref, nr_pages, evtchn);
 	if (err) {
-		xenbus_dev_fatal(dev, err, "mapping ring-ref %lu port %u",
-				 ring_ref, evtchn);
+		xenbus_dev_fatal(dev, err, "mapping ring-ref %u port %u",
+				 ring_ref[0], evtchn);
 		return err;
 	}
 
@@ -6,6 +6,7 @@
 #include <linux/cdev.h>
 #include <linux/init.h>
 #include <linux/scatterlist.h>
+#include <linux/workqueue.h>
 #include <xen/blkif.h>
 
 extern int blktap_debug_level;
@@ -131,6 +132,7 @@ struct blktap_request {
 	struct scatterlist             sg_table[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 	struct page                   *pages[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 	int                            nr_pages;
+	unsigned long                  bounce; /* segments copied via pages[] */
 };
 
 #define blktap_for_each_sg(_sg, _req, _i)	\
@@ -158,6 +160,10 @@ struct blktap_page_pool {
 	spinlock_t                     lock;
 	struct kobject                 kobj;
 	wait_queue_head_t              wait;
+
+	int                            auto_size;
+	atomic_t                       busy; /* pages lent to requests */
+	struct work_struct             grow_work;
 };
 
 extern struct mutex blktap_lock;
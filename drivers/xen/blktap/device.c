@@ -126,6 +126,12 @@ __blktap_end_queued_rq(struct request *rq, int err)
 	__blk_end_request(rq, err, blk_rq_bytes(rq));
 }
 
+static inline void
+__blktap_requeue_rq(struct request *rq)
+{
+	blk_requeue_request(rq->q, rq);
+}
+
 static inline void
 __blktap_end_rq(struct request *rq, int err)
 {
@@ -218,16 +224,24 @@ fail:
 	goto _out;
 }
 
+/* requests taken off the queue per lock round trip. */
+#define BLKTAP_QUEUE_BATCH 32
+
 /*
  * called from tapdisk context
+ *
+ * Requests are dequeued in batches, as many as the ring has room for,
+ * then mapped and put on the ring with the queue lock dropped.  They
+ * are published together when poll pushes the ring.
  */
 void
 blktap_device_run_queue(struct blktap *tap)
 {
 	struct blktap_device *tapdev = &tap->device;
+	struct request *batch[BLKTAP_QUEUE_BATCH];
 	struct request_queue *q;
 	struct request *rq;
-	int err;
+	int i, n, room, err, busy = 0;
 
 	if (!tapdev->gd)
 		return;
@@ -238,31 +252,52 @@ blktap_device_run_queue(struct blktap *tap)
 	queue_flag_clear(QUEUE_FLAG_STOPPED, q);
 
 	do {
-		rq = __blktap_next_queued_rq(q);
-		if (!rq)
-			break;
+		room = min_t(int, RING_FREE_REQUESTS(&tap->ring.ring),
+			     BLKTAP_QUEUE_BATCH);
 
-		if (!blk_fs_request(rq)) {
-			__blktap_end_queued_rq(rq, -EOPNOTSUPP);
-			continue;
+		for (n = 0; n < room; ) {
+			rq = __blktap_next_queued_rq(q);
+			if (!rq)
+				break;
+
+			if (!blk_fs_request(rq)) {
+				__blktap_end_queued_rq(rq, -EOPNOTSUPP);
+				continue;
+			}
+
+			__blktap_dequeue_rq(rq);
+			batch[n++] = rq;
 		}
 
+		if (!n)
+			break;
+
 		spin_unlock_irq(&tapdev->lock);
 
-		err = blktap_device_make_request(tap, rq);
+		for (i = 0; i < n; i++) {
+			err = blktap_device_make_request(tap, batch[i]);
+			if (err == -EBUSY) {
+				busy = 1;
+				break;
+			}
+
+			if (unlikely(err)) {
+				spin_lock_irq(&tapdev->lock);
+				__blktap_end_rq(batch[i], err);
+				spin_unlock_irq(&tapdev->lock);
+			}
+		}
 
 		spin_lock_irq(&tapdev->lock);
 
-		if (err == -EBUSY) {
+		if (busy) {
+			/* back in front of the queue, in order. */
+			for (n--; n >= i; n--)
+				__blktap_requeue_rq(batch[n]);
 			blk_stop_queue(q);
 			break;
 		}
-
-		__blktap_dequeue_rq(rq);
-
-		if (unlikely(err))
-			__blktap_end_rq(rq, err);
-	} while (1);
+	} while (n == room);
 
 	spin_unlock_irq(&tapdev->lock);
 }
@@ -28,6 +28,8 @@ static struct kset *pool_set;
 static struct kmem_cache *request_cache;
 static mempool_t *request_pool;
 
+static void __page_pool_grow(struct blktap_page_pool *pool);
+
 static void
 __page_pool_wake(struct blktap_page_pool *pool)
 {
@@ -56,14 +58,14 @@ blktap_request_get_pages(struct blktap *tap,
 	BUG_ON(nr_pages > POOL_MAX_REQUEST_PAGES);
 
 	if (mem->curr_nr < nr_pages)
-		return -ENOMEM;
+		goto fail;
 
 	/* NB. avoid thundering herds of tapdisks colliding. */
 	spin_lock(&pool->lock);
 
 	if (mem->curr_nr < nr_pages) {
 		spin_unlock(&pool->lock);
-		return -ENOMEM;
+		goto fail;
 	}
 
 	while (request->nr_pages < nr_pages) {
@@ -71,10 +73,15 @@ blktap_request_get_pages(struct blktap *tap,
 		BUG_ON(!page);
 		request->pages[request->nr_pages++] = page;
 	}
+	atomic_add(nr_pages, &pool->busy);
 
 	spin_unlock(&pool->lock);
 
 	return 0;
+
+fail:
+	__page_pool_grow(pool);
+	return -ENOMEM;
 }
 
 static void
@@ -84,6 +91,8 @@ blktap_request_put_pages(struct blktap *tap,
 	struct blktap_page_pool *pool = tap->pool;
 	struct page *page;
 
+	atomic_sub(request->nr_pages, &pool->busy);
+
 	while (request->nr_pages) {
 		page = request->pages[--request->nr_pages];
 		mempool_free(page, pool->bufs);
@@ -232,12 +241,114 @@ static struct pool_attribute blktap_page_pool_attr_free =
 	       blktap_page_pool_show_free,
 	       NULL);
 
+static ssize_t
+blktap_page_pool_show_auto(struct blktap_page_pool *pool,
+			   char *buf)
+{
+	return sprintf(buf, "%d", pool->auto_size);
+}
+
+static ssize_t
+blktap_page_pool_store_auto(struct blktap_page_pool *pool,
+			    const char *buf, size_t size)
+{
+	pool->auto_size = !!simple_strtoul(buf, NULL, 0);
+	return size;
+}
+
+static struct pool_attribute blktap_page_pool_attr_auto =
+	__ATTR(auto, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH,
+	       blktap_page_pool_show_auto,
+	       blktap_page_pool_store_auto);
+
 static struct attribute *blktap_page_pool_attrs[] = {
 	&blktap_page_pool_attr_size.attr,
 	&blktap_page_pool_attr_free.attr,
+	&blktap_page_pool_attr_auto.attr,
 	NULL,
 };
 
+/*
+ * Auto-sized pools grow by half whenever a request finds them short,
+ * up to POOL_MAX_PAGES, and give back what their taps don't have in
+ * flight when the VM asks for memory.  Growth is opportunistic: under
+ * pressure it fails quietly and requests wait for pages to come back.
+ */
+static void
+blktap_page_pool_grow(struct work_struct *work)
+{
+	struct blktap_page_pool *pool =
+		container_of(work, struct blktap_page_pool, grow_work);
+	mempool_t *mem = pool->bufs;
+	int target;
+
+	target = mem->min_nr + max(mem->min_nr / 2, POOL_MAX_REQUEST_PAGES);
+	target = min(target, POOL_MAX_PAGES);
+
+	if (target > mem->min_nr &&
+	    !mempool_resize(mem, target,
+			    GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN))
+		__page_pool_wake(pool);
+
+	kobject_put(&pool->kobj);
+}
+
+static void
+__page_pool_grow(struct blktap_page_pool *pool)
+{
+	if (!pool->auto_size || pool->bufs->min_nr >= POOL_MAX_PAGES)
+		return;
+
+	kobject_get(&pool->kobj);
+	if (!schedule_work(&pool->grow_work))
+		kobject_put(&pool->kobj);
+}
+
+/* Keep what is in flight, plus a full segment set to make progress. */
+static int
+__page_pool_shrinkable(struct blktap_page_pool *pool)
+{
+	int floor = atomic_read(&pool->busy) + POOL_MAX_REQUEST_PAGES;
+
+	if (!pool->auto_size)
+		return 0;
+
+	return max(pool->bufs->min_nr - floor, 0);
+}
+
+static int
+blktap_page_pool_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct kobject *k;
+	int count = 0;
+
+	spin_lock(&pool_set->list_lock);
+	list_for_each_entry(k, &pool_set->list, entry) {
+		struct blktap_page_pool *pool = kobj_to_pool(k);
+		int n = __page_pool_shrinkable(pool);
+
+		if (nr_to_scan && n) {
+			int c = min(n, nr_to_scan);
+
+			/* NB. shrinking a mempool never sleeps. */
+			mempool_resize(pool->bufs, pool->bufs->min_nr - c,
+				       gfp_mask);
+			nr_to_scan -= c;
+			n -= c;
+		}
+
+		count += n;
+	}
+	spin_unlock(&pool_set->list_lock);
+
+	return count;
+}
+
+static struct shrinker blktap_page_pool_shrinker = {
+	.shrink = blktap_page_pool_shrink,
+	.seeks  = DEFAULT_SEEKS,
+};
+
 static inline struct kobject*
 __blktap_kset_find_obj(struct kset *kset, const char *name)
 {
@@ -336,6 +447,9 @@ blktap_page_pool_create(const char *name, int nr_pages)
 
 	spin_lock_init(&pool->lock);
 	init_waitqueue_head(&pool->wait);
+	atomic_set(&pool->busy, 0);
+	INIT_WORK(&pool->grow_work, blktap_page_pool_grow);
+	pool->auto_size = 1;
 
 	pool->bufs = mempool_create(nr_pages,
 				    __mempool_page_alloc, __mempool_page_free,
@@ -394,6 +508,8 @@ blktap_page_pool_init(struct kobject *parent)
 	if (!pool_set)
 		return -ENOMEM;
 
+	register_shrinker(&blktap_page_pool_shrinker);
+
 	return 0;
 }
 
@@ -401,6 +517,8 @@ void
 blktap_page_pool_exit(void)
 {
 	if (pool_set) {
+		unregister_shrinker(&blktap_page_pool_shrinker);
+		flush_scheduled_work();
 		BUG_ON(!list_empty(&pool_set->list));
 		kset_unregister(pool_set);
 		pool_set = NULL;
@@ -4,6 +4,7 @@
 #include <linux/sched.h>
 #include <linux/poll.h>
 #include <linux/blkdev.h>
+#include <asm/xen/page.h>
 
 #include "blktap.h"
 
@@ -69,6 +70,7 @@ blktap_read_ring(struct blktap *tap)
 	struct blktap_ring *ring = &tap->ring;
 	struct blkif_response rsp;
 	RING_IDX rc, rp;
+	int work;
 
 	down_read(&current->mm->mmap_sem);
 	if (!ring->vma) {
@@ -76,6 +78,7 @@ blktap_read_ring(struct blktap *tap)
 		return;
 	}
 
+again:
 	/* for each outstanding message on the ring  */
 	rp = ring->ring.sring->rsp_prod;
 	rmb();
@@ -87,6 +90,15 @@ blktap_read_ring(struct blktap *tap)
 
 	ring->ring.rsp_cons = rc;
 
+	/*
+	 * Ask for a kick on the next response only.  Tapdisk pushing with
+	 * RING_PUSH_RESPONSES_AND_CHECK_NOTIFY can then skip the ioctl for
+	 * every response it adds before we look again.
+	 */
+	RING_FINAL_CHECK_FOR_RESPONSES(&ring->ring, work);
+	if (work)
+		goto again;
+
 	up_read(&current->mm->mmap_sem);
 }
 
@@ -135,16 +147,36 @@ static struct vm_operations_struct blktap_ring_vm_operations = {
 	.fault    = blktap_ring_fault,
 };
 
+/*
+ * Request pages of our own are handed to tapdisk as they are.  Pages
+ * granted by another domain, as blkback's are, must not be: tapdisk's
+ * I/O on them would resolve to the wrong frame.  Neither can pages
+ * vm_insert_page() refuses.  Those are bounced through the pool.
+ */
+static int
+blktap_ring_zerocopy(struct page *page)
+{
+	if (PageForeign(page) || PageAnon(page) ||
+	    PageSlab(page) || PageCompound(page))
+		return 0;
+
+	return !(get_phys_to_machine(page_to_pfn(page)) & FOREIGN_FRAME_BIT);
+}
+
 int
 blktap_ring_map_segment(struct blktap *tap,
 			struct blktap_request *request,
 			int seg)
 {
 	struct blktap_ring *ring = &tap->ring;
+	struct page *page = sg_page(&request->sg_table[seg]);
 	unsigned long uaddr;
 
+	if (request->bounce & (1UL << seg))
+		page = request->pages[seg];
+
 	uaddr = MMAP_VADDR(ring->user_vstart, request->usr_idx, seg);
-	return vm_insert_page(ring->vma, uaddr, request->pages[seg]);
+	return vm_insert_page(ring->vma, uaddr, page);
 }
 
 int
@@ -155,9 +187,13 @@ blktap_ring_map_request(struct blktap *tap,
 	int write;
 
 	write = request->operation == BLKIF_OP_WRITE;
+	request->bounce = 0;
 
 	for (seg = 0; seg < request->nr_pages; seg++) {
-		if (write)
+		if (!blktap_ring_zerocopy(sg_page(&request->sg_table[seg])))
+			request->bounce |= 1UL << seg;
+
+		if (write && (request->bounce & (1UL << seg)))
 			blktap_request_bounce(tap, request, seg, write);
 
 		err = blktap_ring_map_segment(tap, request, seg);
@@ -186,7 +222,8 @@ blktap_ring_unmap_request(struct blktap *tap,
 
 	if (read)
 		for (seg = 0; seg < request->nr_pages; seg++)
-			blktap_request_bounce(tap, request, seg, !read);
+			if (request->bounce & (1UL << seg))
+				blktap_request_bounce(tap, request, seg, !read);
 
 	zap_page_range(ring->vma, uaddr, size, NULL);
 }
@@ -419,6 +456,14 @@ static unsigned int blktap_ring_poll(struct file *filp, poll_table *wait)
 	poll_wait(filp, &tap->pool->wait, wait);
 	poll_wait(filp, &ring->poll_wait, wait);
 
+	/*
+	 * Responses pushed before coming back here need no kick of their
+	 * own: a tapdisk going round its event loop gets them completed,
+	 * and new requests queued, in the one system call.
+	 */
+	if (ring->vma && ring->vma->vm_mm == current->mm)
+		blktap_read_ring(tap);
+
 	down_read(&current->mm->mmap_sem);
 	if (ring->vma && tap->device.gd)
 		blktap_device_run_queue(tap);
@@ -444,6 +489,10 @@ static struct file_operations blktap_ring_file_operations = {
 	.poll     = blktap_ring_poll,
 };
 
+/*
+ * Only wakes a tapdisk asleep in poll; one busy with the ring finds the
+ * new requests on its next pass through poll anyway.
+ */
 void
 blktap_ring_kick_user(struct blktap *tap)
 {
@@ -31,6 +31,13 @@
 #include <linux/pci_regs.h>
 #include <linux/pci.h>
 #include <linux/msi.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kernel_stat.h>
+#include <linux/workqueue.h>
+#include <linux/sort.h>
+#include <linux/cpu.h>
 
 #include <asm/desc.h>
 #include <asm/ptrace.h>
@@ -53,6 +60,7 @@
 #include <xen/page.h>
 
 #include "../pci/msi.h"
+#include "events_internal.h"
 
 /*
  * This lock protects updates to the following mapping and reference-count
@@ -89,8 +97,10 @@ enum xen_irq_type {
 struct irq_info
 {
 	enum xen_irq_type type;	/* type */
-	unsigned short evtchn;	/* event channel */
+	unsigned evtchn;	/* event channel */
 	unsigned short cpu;	/* cpu bound */
+	unsigned char balance;	/* spread over cpus by xen_irq_balance() */
+	unsigned int balance_count; /* kstat_irqs() at the last pass */
 
 	union {
 		unsigned short virq;
@@ -111,7 +121,29 @@ static unsigned long *pirq_needs_eoi_bits;
 
 static struct irq_info *irq_info;
 
-static int *evtchn_to_irq;
+/*
+ * Event channel -> irq table.  The FIFO ABI allows far more ports than
+ * are ever bound, so the table is kept in rows of a page each which
+ * are only allocated once a port in them gets bound.
+ */
+static int **evtchn_to_irq;
+#define EVTCHN_PER_ROW		(PAGE_SIZE / sizeof(**evtchn_to_irq))
+#define EVTCHN_ROW(e)		((e) / EVTCHN_PER_ROW)
+#define EVTCHN_COL(e)		((e) % EVTCHN_PER_ROW)
+
+const struct evtchn_ops *evtchn_ops;
+static const struct evtchn_ops evtchn_ops_2l;
+
+/* Set "xen_nofifo" to keep using the 2-level event channel ABI. */
+static bool fifo_events = true;
+
+static int __init xen_parse_nofifo(char *arg)
+{
+	fifo_events = false;
+	return 1;
+}
+__setup("xen_nofifo", xen_parse_nofifo);
+
 struct cpu_evtchn_s {
 	unsigned long bits[NR_EVENT_CHANNELS/BITS_PER_LONG];
 };
@@ -139,25 +171,25 @@ static struct irq_info mk_unbound_info(void)
 	return (struct irq_info) { .type = IRQT_UNBOUND };
 }
 
-static struct irq_info mk_evtchn_info(unsigned short evtchn)
+static struct irq_info mk_evtchn_info(unsigned evtchn)
 {
 	return (struct irq_info) { .type = IRQT_EVTCHN, .evtchn = evtchn,
 			.cpu = 0 };
 }
 
-static struct irq_info mk_ipi_info(unsigned short evtchn, enum ipi_vector ipi)
+static struct irq_info mk_ipi_info(unsigned evtchn, enum ipi_vector ipi)
 {
 	return (struct irq_info) { .type = IRQT_IPI, .evtchn = evtchn,
 			.cpu = 0, .u.ipi = ipi };
 }
 
-static struct irq_info mk_virq_info(unsigned short evtchn, unsigned short virq)
+static struct irq_info mk_virq_info(unsigned evtchn, unsigned short virq)
 {
 	return (struct irq_info) { .type = IRQT_VIRQ, .evtchn = evtchn,
 			.cpu = 0, .u.virq = virq };
 }
 
-static struct irq_info mk_pirq_info(unsigned short evtchn,
+static struct irq_info mk_pirq_info(unsigned evtchn,
 				    unsigned short gsi, unsigned short vector)
 {
 	return (struct irq_info) { .type = IRQT_PIRQ, .evtchn = evtchn,
@@ -178,12 +210,75 @@ static unsigned int evtchn_from_irq(unsigned irq)
 	return info_for_irq(irq)->evtchn;
 }
 
+int get_evtchn_to_irq(unsigned evtchn)
+{
+	if (evtchn >= evtchn_ops->max_channels())
+		return -1;
+	if (evtchn_to_irq[EVTCHN_ROW(evtchn)] == NULL)
+		return -1;
+	return evtchn_to_irq[EVTCHN_ROW(evtchn)][EVTCHN_COL(evtchn)];
+}
+
+/*
+ * Called under irq_mapping_update_lock, and from startup_pirq() with
+ * interrupts off, hence the atomic allocations.
+ */
+static int set_evtchn_to_irq(unsigned evtchn, int irq)
+{
+	unsigned row = EVTCHN_ROW(evtchn);
+	unsigned col = EVTCHN_COL(evtchn);
+	int i, err;
+
+	if (evtchn >= evtchn_ops->max_channels())
+		return -EINVAL;
+
+	if (evtchn_to_irq[row] == NULL) {
+		/* Unallocated rows read back as -1 anyway. */
+		if (irq == -1)
+			return 0;
+
+		evtchn_to_irq[row] = (int *)get_zeroed_page(GFP_ATOMIC);
+		if (evtchn_to_irq[row] == NULL)
+			return -ENOMEM;
+
+		for (i = 0; i < EVTCHN_PER_ROW; i++)
+			evtchn_to_irq[row][i] = -1;
+	}
+
+	if (irq != -1) {
+		err = xen_evtchn_port_setup(evtchn);
+		if (err)
+			return err;
+	}
+
+	evtchn_to_irq[row][col] = irq;
+	return 0;
+}
+
+static void clear_evtchn_to_irq_all(void)
+{
+	unsigned row, col;
+
+	for (row = 0; row < EVTCHN_ROW(evtchn_ops->max_channels()); row++) {
+		if (evtchn_to_irq[row] == NULL)
+			continue;
+		for (col = 0; col < EVTCHN_PER_ROW; col++)
+			evtchn_to_irq[row][col] = -1;
+	}
+}
+
 unsigned irq_from_evtchn(unsigned int evtchn)
 {
-	return evtchn_to_irq[evtchn];
+	return get_evtchn_to_irq(evtchn);
 }
 EXPORT_SYMBOL_GPL(irq_from_evtchn);
 
+unsigned xen_evtchn_max_channels(void)
+{
+	return evtchn_ops->max_channels();
+}
+EXPORT_SYMBOL_GPL(xen_evtchn_max_channels);
+
 static enum ipi_vector ipi_from_irq(unsigned irq)
 {
 	struct irq_info *info = info_for_irq(irq);
@@ -236,7 +331,7 @@ static unsigned cpu_from_irq(unsigned irq)
 
 static unsigned int cpu_from_evtchn(unsigned int evtchn)
 {
-	int irq = evtchn_to_irq[evtchn];
+	int irq = get_evtchn_to_irq(evtchn);
 	unsigned ret = 0;
 
 	if (irq != -1)
@@ -263,17 +358,23 @@ static inline unsigned long active_evtchns(unsigned int cpu,
 		~sh->evtchn_mask[idx]);
 }
 
+static void evtchn_2l_bind_to_cpu(unsigned port, unsigned cpu,
+				  unsigned old_cpu)
+{
+	clear_bit(port, cpu_evtchn_mask(old_cpu));
+	set_bit(port, cpu_evtchn_mask(cpu));
+}
+
 static void bind_evtchn_to_cpu(unsigned int chn, unsigned int cpu)
 {
-	int irq = evtchn_to_irq[chn];
+	int irq = get_evtchn_to_irq(chn);
 
 	BUG_ON(irq == -1);
 #ifdef CONFIG_SMP
 	cpumask_copy(irq_to_desc(irq)->affinity, cpumask_of(cpu));
 #endif
 
-	clear_bit(chn, cpu_evtchn_mask(cpu_from_irq(irq)));
-	set_bit(chn, cpu_evtchn_mask(cpu));
+	xen_evtchn_port_bind_to_cpu(chn, cpu, cpu_from_irq(irq));
 
 	irq_info[irq].cpu = cpu;
 }
@@ -295,24 +396,35 @@ static void init_evtchn_cpu_bindings(void)
 		       (i == 0) ? ~0 : 0, sizeof(struct cpu_evtchn_s));
 }
 
-static inline void clear_evtchn(int port)
+static unsigned evtchn_2l_max_channels(void)
+{
+	return NR_EVENT_CHANNELS;
+}
+
+static void evtchn_2l_clear_pending(unsigned port)
 {
 	struct shared_info *s = HYPERVISOR_shared_info;
 	sync_clear_bit(port, &s->evtchn_pending[0]);
 }
 
-static inline void set_evtchn(int port)
+static void evtchn_2l_set_pending(unsigned port)
 {
 	struct shared_info *s = HYPERVISOR_shared_info;
 	sync_set_bit(port, &s->evtchn_pending[0]);
 }
 
-static inline int test_evtchn(int port)
+static bool evtchn_2l_is_pending(unsigned port)
 {
 	struct shared_info *s = HYPERVISOR_shared_info;
 	return sync_test_bit(port, &s->evtchn_pending[0]);
 }
 
+static bool evtchn_2l_test_and_set_mask(unsigned port)
+{
+	struct shared_info *s = HYPERVISOR_shared_info;
+	return sync_test_and_set_bit(port, &s->evtchn_mask[0]);
+}
+
 
 /**
  * notify_remote_via_irq - send event to remote end of event channel via irq
@@ -331,7 +443,7 @@ void notify_remote_via_irq(int irq)
 }
 EXPORT_SYMBOL_GPL(notify_remote_via_irq);
 
-static void mask_evtchn(int port)
+static void evtchn_2l_mask(unsigned port)
 {
 	struct shared_info *s = HYPERVISOR_shared_info;
 	sync_set_bit(port, &s->evtchn_mask[0]);
@@ -345,7 +457,7 @@ static void mask_irq(unsigned int irq)
 		mask_evtchn(evtchn);
 }
 
-static void unmask_evtchn(int port)
+static void evtchn_2l_unmask(unsigned port)
 {
 	struct shared_info *s = HYPERVISOR_shared_info;
 	unsigned int cpu = get_cpu();
@@ -508,7 +620,15 @@ static unsigned int startup_pirq(unsigned int irq)
 
 	pirq_query_unmask(irq);
 
-	evtchn_to_irq[evtchn] = irq;
+	rc = set_evtchn_to_irq(evtchn, irq);
+	if (rc) {
+		struct evtchn_close close = { .port = evtchn };
+		printk(KERN_ERR "Failed to set up event channel %d for"
+		       " physical IRQ %d: %d\n", evtchn, irq, rc);
+		if (HYPERVISOR_event_channel_op(EVTCHNOP_close, &close) != 0)
+			BUG();
+		return 0;
+	}
 	bind_evtchn_to_cpu(evtchn, 0);
 	info->evtchn = evtchn;
 
@@ -536,7 +656,7 @@ static void shutdown_pirq(unsigned int irq)
 		BUG();
 
 	bind_evtchn_to_cpu(evtchn, 0);
-	evtchn_to_irq[evtchn] = -1;
+	set_evtchn_to_irq(evtchn, -1);
 	info->evtchn = 0;
 }
 
@@ -726,6 +846,136 @@ out:
 	spin_unlock(&irq_mapping_update_lock);
 	return irq;
 }
+
+/*
+ * Map and bind all of a device's MSI/MSI-X vectors at once: the owner
+ * domain and MSI-X table are looked up a single time, the
+ * PHYSDEVOP_map_pirq calls go to Xen in one multicall and the irqs are
+ * allocated under one hold of the mapping lock.  Bringing up a NIC with
+ * dozens of queues no longer costs a config space read and a hypercall
+ * per vector.
+ */
+int xen_create_msi_irqs(struct pci_dev *dev, int nvec, int type)
+{
+	struct physdev_map_pirq *map_irq;
+	struct multicall_entry *mc;
+	struct msi_desc *msidesc;
+	u64 table_base = 0;
+	domid_t domid;
+	int i, n, rc, irq;
+	int *irqs;
+
+	domid = rc = xen_find_device_domain_owner(dev);
+	if (rc < 0)
+		domid = DOMID_SELF;
+
+	if (type == PCI_CAP_ID_MSIX) {
+		int pos = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+		u32 table_offset;
+
+		pci_read_config_dword(dev, msix_table_offset_reg(pos),
+				      &table_offset);
+		table_base = pci_resource_start(dev,
+				(u8)(table_offset & PCI_MSIX_FLAGS_BIRMASK));
+	}
+
+	n = 0;
+	list_for_each_entry(msidesc, &dev->msi_list, list)
+		n++;
+	if (n == 0)
+		return 0;
+
+	map_irq = kcalloc(n, sizeof(*map_irq), GFP_KERNEL);
+	mc = kcalloc(n, sizeof(*mc), GFP_KERNEL);
+	irqs = kcalloc(n, sizeof(*irqs), GFP_KERNEL);
+	rc = -ENOMEM;
+	if (!map_irq || !mc || !irqs)
+		goto out_free;
+
+	i = 0;
+	list_for_each_entry(msidesc, &dev->msi_list, list) {
+		map_irq[i].domid = domid;
+		map_irq[i].type = MAP_PIRQ_TYPE_MSI;
+		map_irq[i].index = -1;
+		map_irq[i].pirq = -1;
+		map_irq[i].bus = dev->bus->number;
+		map_irq[i].devfn = dev->devfn;
+		if (type == PCI_CAP_ID_MSIX) {
+			map_irq[i].table_base = table_base;
+			map_irq[i].entry_nr = msidesc->msi_attrib.entry_nr;
+		}
+
+		mc[i].op = __HYPERVISOR_physdev_op;
+		mc[i].args[0] = PHYSDEVOP_map_pirq;
+		mc[i].args[1] = (unsigned long)&map_irq[i];
+		i++;
+	}
+
+	if (HYPERVISOR_multicall(mc, n))
+		for (i = 0; i < n; i++)
+			mc[i].result = HYPERVISOR_physdev_op(PHYSDEVOP_map_pirq,
+							     &map_irq[i]);
+
+	rc = 0;
+	spin_lock(&irq_mapping_update_lock);
+	for (i = 0; i < n; i++) {
+		irqs[i] = -1;
+		if ((long)mc[i].result) {
+			printk(KERN_WARNING "xen map irq failed %ld\n",
+			       (long)mc[i].result);
+			rc = -1;
+			continue;
+		}
+		if (rc)
+			continue;
+
+		irq = find_unbound_irq();
+		if (irq == -1) {
+			rc = -1;
+			continue;
+		}
+
+		irq_info[irq] = mk_pirq_info(0, map_irq[i].pirq,
+					     map_irq[i].index);
+		if (domid)
+			irq_info[irq].u.pirq.domid = domid;
+
+		set_irq_chip_and_handler_name(irq, &xen_pirq_chip,
+				handle_fasteoi_irq,
+				(type == PCI_CAP_ID_MSIX) ? "msi-x":"msi");
+		irqs[i] = irq;
+	}
+	spin_unlock(&irq_mapping_update_lock);
+
+	i = 0;
+	list_for_each_entry(msidesc, &dev->msi_list, list) {
+		if (!rc) {
+			rc = set_irq_msi(irqs[i], msidesc);
+			if (!rc) {
+				i++;
+				continue;
+			}
+		}
+
+		/* Undo whatever this vector got that no msi_desc owns */
+		if (irqs[i] != -1)
+			xen_destroy_irq(irqs[i]);
+		else if (!(long)mc[i].result && xen_initial_domain()) {
+			struct physdev_unmap_pirq unmap_irq;
+
+			unmap_irq.pirq = map_irq[i].pirq;
+			unmap_irq.domid = domid;
+			HYPERVISOR_physdev_op(PHYSDEVOP_unmap_pirq, &unmap_irq);
+		}
+		i++;
+	}
+
+out_free:
+	kfree(irqs);
+	kfree(mc);
+	kfree(map_irq);
+	return rc;
+}
 #endif
 #endif
 
@@ -740,24 +990,59 @@ int xen_gsi_from_irq(unsigned irq)
 }
 EXPORT_SYMBOL_GPL(xen_gsi_from_irq);
 
+static int evtchn_set_priority(unsigned evtchn, unsigned priority)
+{
+	struct evtchn_set_priority set_priority;
+
+	set_priority.port = evtchn;
+	set_priority.priority = priority;
+
+	return HYPERVISOR_event_channel_op(EVTCHNOP_set_priority,
+					   &set_priority);
+}
+
+/*
+ * Only the FIFO ABI has priorities; with the 2-level one Xen fails
+ * this with -ENOSYS and all events keep being delivered alike.
+ */
+int xen_set_irq_priority(unsigned irq, unsigned priority)
+{
+	int evtchn = evtchn_from_irq(irq);
+
+	if (!VALID_EVTCHN(evtchn))
+		return -EINVAL;
+
+	return evtchn_set_priority(evtchn, priority);
+}
+EXPORT_SYMBOL_GPL(xen_set_irq_priority);
+
 int bind_evtchn_to_irq(unsigned int evtchn)
 {
 	int irq;
 
 	spin_lock(&irq_mapping_update_lock);
 
-	irq = evtchn_to_irq[evtchn];
+	irq = get_evtchn_to_irq(evtchn);
 
 	if (irq == -1) {
+		int err;
+
 		irq = find_unbound_irq();
 
 		set_irq_chip_and_handler_name(irq, &xen_dynamic_chip,
 					      handle_fasteoi_irq, "event");
 
-		evtchn_to_irq[evtchn] = irq;
+		err = set_evtchn_to_irq(evtchn, irq);
+		if (err) {
+			dynamic_irq_cleanup(irq);
+			irq = err;
+			goto out;
+		}
 		irq_info[irq] = mk_evtchn_info(evtchn);
 	}
 
+ out:
+
 	spin_unlock(&irq_mapping_update_lock);
 
 	return irq;
@@ -787,11 +1072,13 @@ static int bind_ipi_to_irq(unsigned int ipi, unsigned int cpu)
 			BUG();
 		evtchn = bind_ipi.port;
 
-		evtchn_to_irq[evtchn] = irq;
+		if (set_evtchn_to_irq(evtchn, irq) != 0)
+			BUG();
 		irq_info[irq] = mk_ipi_info(evtchn, ipi);
 		per_cpu(ipi_to_irq, cpu)[ipi] = irq;
 
 		bind_evtchn_to_cpu(evtchn, cpu);
+		evtchn_set_priority(evtchn, XEN_IRQ_PRIORITY_MAX);
 	}
 
  out:
@@ -803,15 +1090,22 @@ static int bind_interdomain_evtchn_to_irq(unsigned int remote_domain,
                                           unsigned int remote_port)
 {
         struct evtchn_bind_interdomain bind_interdomain;
-        int err;
+        int err, irq;
 
         bind_interdomain.remote_dom  = remote_domain;
         bind_interdomain.remote_port = remote_port;
 
         err = HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain,
                                           &bind_interdomain);
+        if (err)
+                return err;
 
-        return err ? : bind_evtchn_to_irq(bind_interdomain.local_port);
+        irq = bind_evtchn_to_irq(bind_interdomain.local_port);
+        if (irq >= 0)
+                /* Backend interrupts: let the balancer move them. */
+                info_for_irq(irq)->balance = 1;
+
+        return irq;
 }
 
 
@@ -837,12 +1131,20 @@ int bind_virq_to_irq(unsigned int virq, unsigned int cpu)
 			BUG();
 		evtchn = bind_virq.port;
 
-		evtchn_to_irq[evtchn] = irq;
+		if (set_evtchn_to_irq(evtchn, irq) != 0)
+			BUG();
 		irq_info[irq] = mk_virq_info(evtchn, virq);
 
 		per_cpu(virq_to_irq, cpu)[virq] = irq;
 
 		bind_evtchn_to_cpu(evtchn, cpu);
+
+		/*
+		 * Keep the timer (and IPIs) ahead of any backlog of
+		 * device events, where the ABI supports priorities.
+		 */
+		if (virq == VIRQ_TIMER)
+			evtchn_set_priority(evtchn, XEN_IRQ_PRIORITY_MAX);
 	}
 
 	spin_unlock(&irq_mapping_update_lock);
@@ -878,7 +1180,7 @@ static void unbind_from_irq(unsigned int irq)
 		/* Closed ports are implicitly re-bound to VCPU0. */
 		bind_evtchn_to_cpu(evtchn, 0);
 
-		evtchn_to_irq[evtchn] = -1;
+		set_evtchn_to_irq(evtchn, -1);
 	}
 
 	if (irq_info[irq].type != IRQT_UNBOUND) {
@@ -890,16 +1192,63 @@ static void unbind_from_irq(unsigned int irq)
 	spin_unlock(&irq_mapping_update_lock);
 }
 
+/*
+ * The threaded variants run @thread_fn from an irq thread after @handler
+ * returned IRQ_WAKE_THREAD, or straight away if @handler is NULL.  The
+ * event channel is not kept masked meanwhile: an event that comes in
+ * while the thread runs only makes it run once more.  See
+ * irq_set_thread_priority() for the thread's priority; it follows the
+ * irq to whichever vcpu the event channel is bound to.
+ */
+int bind_evtchn_to_threaded_irqhandler(unsigned int evtchn,
+				       irq_handler_t handler,
+				       irq_handler_t thread_fn,
+				       unsigned long irqflags,
+				       const char *devname, void *dev_id)
+{
+	int irq, retval;
+
+	irq = bind_evtchn_to_irq(evtchn);
+	if (irq < 0)
+		return irq;
+
+	retval = request_threaded_irq(irq, handler, thread_fn, irqflags,
+				      devname, dev_id);
+	if (retval != 0) {
+		unbind_from_irq(irq);
+		return retval;
+	}
+
+	return irq;
+}
+EXPORT_SYMBOL_GPL(bind_evtchn_to_threaded_irqhandler);
+
 int bind_evtchn_to_irqhandler(unsigned int evtchn,
 			      irq_handler_t handler,
 			      unsigned long irqflags,
 			      const char *devname, void *dev_id)
 {
-	unsigned int irq;
-	int retval;
+	return bind_evtchn_to_threaded_irqhandler(evtchn, handler, NULL,
+						  irqflags, devname, dev_id);
+}
+EXPORT_SYMBOL_GPL(bind_evtchn_to_irqhandler);
 
-	irq = bind_evtchn_to_irq(evtchn);
-	retval = request_irq(irq, handler, irqflags, devname, dev_id);
+int bind_interdomain_evtchn_to_threaded_irqhandler(unsigned int remote_domain,
+						   unsigned int remote_port,
+						   irq_handler_t handler,
+						   irq_handler_t thread_fn,
+						   unsigned long irqflags,
+						   const char *devname,
+						   void *dev_id)
+{
+	int irq, retval;
+
+	irq = bind_interdomain_evtchn_to_irq(remote_domain, remote_port);
+	if (irq < 0)
+		return irq;
+
+	retval = request_threaded_irq(irq, handler, thread_fn, irqflags,
+				      devname, dev_id);
 	if (retval != 0) {
 		unbind_from_irq(irq);
 		return retval;
@@ -907,7 +1256,7 @@ int bind_evtchn_to_irqhandler(unsigned int evtchn,
 
 	return irq;
 }
-EXPORT_SYMBOL_GPL(bind_evtchn_to_irqhandler);
+EXPORT_SYMBOL_GPL(bind_interdomain_evtchn_to_threaded_irqhandler);
 
 int bind_interdomain_evtchn_to_irqhandler(unsigned int remote_domain,
 					  unsigned int remote_port,
@@ -916,19 +1265,8 @@ int bind_interdomain_evtchn_to_irqhandler(unsigned int remote_domain,
 					  const char *devname,
 					  void *dev_id)
 {
-        int irq, retval;
-
-        irq = bind_interdomain_evtchn_to_irq(remote_domain, remote_port);
-        if (irq < 0)
-                return irq;
-
-        retval = request_irq(irq, handler, irqflags, devname, dev_id);
-        if (retval != 0) {
-                unbind_from_irq(irq);
-                return retval;
-        }
-
-        return irq;
+	return bind_interdomain_evtchn_to_threaded_irqhandler(remote_domain,
+			remote_port, handler, NULL, irqflags, devname, dev_id);
 }
 EXPORT_SYMBOL_GPL(bind_interdomain_evtchn_to_irqhandler);
 
@@ -1014,6 +1352,17 @@ irqreturn_t xen_debug_interrupt(int irq, void *dev_id)
 	}
 	v = per_cpu(xen_vcpu, cpu);
 
+	if (evtchn_ops != &evtchn_ops_2l) {
+		printk("\npending list:\n");
+		for (i = 0; i < xen_evtchn_nr_channels(); i++) {
+			if (!test_evtchn(i))
+				continue;
+			printk("  %d: event %d -> irq %d\n",
+			       cpu_from_evtchn(i), i, get_evtchn_to_irq(i));
+		}
+		goto out;
+	}
+
 	printk("\npending:\n   ");
 	for (i = ARRAY_SIZE(sh->evtchn_pending)-1; i >= 0; i--)
 		printk("%0*lx%s", (int)sizeof(sh->evtchn_pending[0])*2,
@@ -1053,7 +1402,7 @@ irqreturn_t xen_debug_interrupt(int irq, void *dev_id)
 			int word_idx = i / BITS_PER_LONG;
 			printk("  %d: event %d -> irq %d%s%s%s\n",
 			       cpu_from_evtchn(i), i,
-			       evtchn_to_irq[i],
+			       get_evtchn_to_irq(i),
 			       sync_test_bit(word_idx, &v->evtchn_pending_sel)
 					     ? "" : " l2-clear",
 			       !sync_test_bit(i, sh->evtchn_mask)
@@ -1063,6 +1412,7 @@ irqreturn_t xen_debug_interrupt(int irq, void *dev_id)
 		}
 	}
 
+ out:
 	spin_unlock_irqrestore(&debug_lock, flags);
 
 	return IRQ_HANDLED;
@@ -1072,6 +1422,96 @@ static DEFINE_PER_CPU(unsigned, xed_nesting_count);
 static DEFINE_PER_CPU(unsigned int, current_word_idx);
 static DEFINE_PER_CPU(unsigned int, current_bit_idx);
 
+#ifdef CONFIG_XEN_DEBUG_FS
+/*
+ * Dispatch statistics, to find out which event channel (and so which
+ * frontend or backend) is keeping a vcpu busy.  Xen does not say when
+ * it set an event pending, so dispatch latency is measured from the
+ * start of the upcall pass that found the event.
+ */
+struct evtchn_irq_stats {
+	u64 count;		/* dispatches from the upcall */
+	u64 handler_ns;		/* total time in the handler */
+	u64 latency_ns;		/* total time from upcall pass to handler */
+	u32 handler_max_ns;
+	u32 latency_max_ns;
+};
+
+struct evtchn_upcall_stats {
+	u64 upcalls;		/* upcall passes */
+	u64 nested;		/* upcalls that found one already running */
+	u64 reraised;		/* passes rerun for events raised meanwhile */
+};
+
+static struct evtchn_irq_stats *irq_stats;
+static DEFINE_PER_CPU(struct evtchn_upcall_stats, upcall_stats);
+static DEFINE_PER_CPU(u64, upcall_start);
+
+static u8 zero_stats;
+
+static inline void check_zero(void)
+{
+	if (unlikely(zero_stats)) {
+		int cpu;
+
+		memset(irq_stats, 0, nr_irqs * sizeof(*irq_stats));
+		for_each_possible_cpu(cpu)
+			memset(&per_cpu(upcall_stats, cpu), 0,
+			       sizeof(struct evtchn_upcall_stats));
+		zero_stats = 0;
+	}
+}
+
+#define ADD_UPCALL_STATS(elem, val)				\
+	do { check_zero(); __get_cpu_var(upcall_stats).elem += (val); } while (0)
+
+static inline void upcall_time_start(void)
+{
+	__get_cpu_var(upcall_start) = ktime_to_ns(ktime_get());
+}
+
+static inline u64 irq_time_start(int irq)
+{
+	struct evtchn_irq_stats *st = &irq_stats[irq];
+	u64 now = ktime_to_ns(ktime_get());
+	u32 delta = now - __get_cpu_var(upcall_start);
+
+	check_zero();
+
+	st->count++;
+	st->latency_ns += delta;
+	if (delta > st->latency_max_ns)
+		st->latency_max_ns = delta;
+
+	return now;
+}
+
+static inline void irq_time_accum(int irq, u64 start)
+{
+	struct evtchn_irq_stats *st = &irq_stats[irq];
+	u32 delta = ktime_to_ns(ktime_get()) - start;
+
+	st->handler_ns += delta;
+	if (delta > st->handler_max_ns)
+		st->handler_max_ns = delta;
+}
+#else  /* !CONFIG_XEN_DEBUG_FS */
+#define ADD_UPCALL_STATS(elem, val)	do { (void)(val); } while (0)
+
+static inline void upcall_time_start(void)
+{
+}
+
+static inline u64 irq_time_start(int irq)
+{
+	return 0;
+}
+
+static inline void irq_time_accum(int irq, u64 start)
+{
+}
+#endif  /* CONFIG_XEN_DEBUG_FS */
+
 /*
  * Mask out the i least significant bits of w
  */
@@ -1086,109 +1526,149 @@ static DEFINE_PER_CPU(unsigned int, current_bit_idx);
  * a bitset of words which contain pending event bits.  The second
  * level is a bitset of pending events themselves.
  */
-static void __xen_evtchn_do_upcall(struct pt_regs *regs)
+static void evtchn_2l_handle_events(unsigned cpu)
 {
 	int start_word_idx, start_bit_idx;
 	int word_idx, bit_idx;
 	int i;
-	int cpu = get_cpu();
 	struct shared_info *s = HYPERVISOR_shared_info;
 	struct vcpu_info *vcpu_info = __get_cpu_var(xen_vcpu);
- 	unsigned count;
+	unsigned long pending_words;
 
-	do {
-		unsigned long pending_words;
+#ifndef CONFIG_X86 /* No need for a barrier -- XCHG is a barrier on x86. */
+	/* Clear master flag /before/ clearing selector flag. */
+	wmb();
+#endif
+	pending_words = xchg(&vcpu_info->evtchn_pending_sel, 0);
 
-		vcpu_info->evtchn_upcall_pending = 0;
+	start_word_idx = __get_cpu_var(current_word_idx);
+	start_bit_idx = __get_cpu_var(current_bit_idx);
 
-		if (__get_cpu_var(xed_nesting_count)++)
-			goto out;
+	word_idx = start_word_idx;
 
-#ifndef CONFIG_X86 /* No need for a barrier -- XCHG is a barrier on x86. */
-		/* Clear master flag /before/ clearing selector flag. */
-		wmb();
-#endif
-		pending_words = xchg(&vcpu_info->evtchn_pending_sel, 0);
+	for (i = 0; pending_words != 0; i++) {
+		unsigned long pending_bits;
+		unsigned long words;
 
-		start_word_idx = __get_cpu_var(current_word_idx);
-		start_bit_idx = __get_cpu_var(current_bit_idx);
+		words = MASK_LSBS(pending_words, word_idx);
 
-		word_idx = start_word_idx;
+		/*
+		 * If we masked out all events, wrap to beginning.
+		 */
+		if (words == 0) {
+			word_idx = 0;
+			bit_idx = 0;
+			continue;
+		}
+		word_idx = __ffs(words);
+
+		pending_bits = active_evtchns(cpu, s, word_idx);
+		bit_idx = 0; /* usually scan entire word from start */
+		if (word_idx == start_word_idx) {
+			/* We scan the starting word in two parts */
+			if (i == 0)
+				/* 1st time: start in the middle */
+				bit_idx = start_bit_idx;
+			else
+				/* 2nd time: mask bits done already */
+				bit_idx &= (1UL << start_bit_idx) - 1;
+		}
 
-		for (i = 0; pending_words != 0; i++) {
-			unsigned long pending_bits;
-			unsigned long words;
+		do {
+			unsigned long bits;
+			int port;
 
-			words = MASK_LSBS(pending_words, word_idx);
+			bits = MASK_LSBS(pending_bits, bit_idx);
 
-			/*
-			 * If we masked out all events, wrap to beginning.
-			 */
-			if (words == 0) {
-				word_idx = 0;
-				bit_idx = 0;
-				continue;
-			}
-			word_idx = __ffs(words);
-
-			pending_bits = active_evtchns(cpu, s, word_idx);
-			bit_idx = 0; /* usually scan entire word from start */
-			if (word_idx == start_word_idx) {
-				/* We scan the starting word in two parts */
-				if (i == 0)
-					/* 1st time: start in the middle */
-					bit_idx = start_bit_idx;
-				else
-					/* 2nd time: mask bits done already */
-					bit_idx &= (1UL << start_bit_idx) - 1;
-			}
+			/* If we masked out all events, move on. */
+			if (bits == 0)
+				break;
 
-			do {
-				unsigned long bits;
-				int port, irq;
-				struct irq_desc *desc;
+			bit_idx = __ffs(bits);
 
-				bits = MASK_LSBS(pending_bits, bit_idx);
+			/* Process port. */
+			port = (word_idx * BITS_PER_LONG) + bit_idx;
+			handle_irq_for_port(port);
 
-				/* If we masked out all events, move on. */
-				if (bits == 0)
-					break;
+			bit_idx = (bit_idx + 1) % BITS_PER_LONG;
 
-				bit_idx = __ffs(bits);
+			/* Next caller starts at last processed + 1 */
+			__get_cpu_var(current_word_idx) =
+					 bit_idx ? word_idx :
+					 (word_idx+1) % BITS_PER_LONG;
+			__get_cpu_var(current_bit_idx) = bit_idx;
+		} while (bit_idx != 0);
 
-				/* Process port. */
-				port = (word_idx * BITS_PER_LONG) + bit_idx;
-				irq = evtchn_to_irq[port];
+		/* Scan start_l1i twice; all others once. */
+		if ((word_idx != start_word_idx) || (i != 0))
+			pending_words &= ~(1UL << word_idx);
 
-				mask_evtchn(port);
-				clear_evtchn(port);
+		word_idx = (word_idx + 1) % BITS_PER_LONG;
+	}
+}
 
-				if (irq != -1) {
-					desc = irq_to_desc(irq);
-					if (desc)
-						generic_handle_irq_desc(irq, desc);
-				}
+static const struct evtchn_ops evtchn_ops_2l = {
+	.max_channels      = evtchn_2l_max_channels,
+	.nr_channels       = evtchn_2l_max_channels,
+	.bind_to_cpu       = evtchn_2l_bind_to_cpu,
+	.clear_pending     = evtchn_2l_clear_pending,
+	.set_pending       = evtchn_2l_set_pending,
+	.is_pending        = evtchn_2l_is_pending,
+	.test_and_set_mask = evtchn_2l_test_and_set_mask,
+	.mask              = evtchn_2l_mask,
+	.unmask            = evtchn_2l_unmask,
+	.handle_events     = evtchn_2l_handle_events,
+};
 
-				bit_idx = (bit_idx + 1) % BITS_PER_LONG;
+/*
+ * Mask the port and clear its pending state, then feed the irq it is
+ * bound to into the irq core.  The irq's eoi/ack unmasks it again.
+ */
+void handle_irq_for_port(unsigned port)
+{
+	int irq = get_evtchn_to_irq(port);
+	struct irq_desc *desc;
+
+	mask_evtchn(port);
+	clear_evtchn(port);
+
+	if (irq != -1) {
+		desc = irq_to_desc(irq);
+		if (desc) {
+			u64 start = irq_time_start(irq);
+
+			generic_handle_irq_desc(irq, desc);
+			irq_time_accum(irq, start);
+		}
+	}
+}
 
-				/* Next caller starts at last processed + 1 */
-				__get_cpu_var(current_word_idx) =
-						 bit_idx ? word_idx :
-						 (word_idx+1) % BITS_PER_LONG;
-				__get_cpu_var(current_bit_idx) = bit_idx;
-			} while (bit_idx != 0);
+static void __xen_evtchn_do_upcall(struct pt_regs *regs)
+{
+	int cpu = get_cpu();
+	struct vcpu_info *vcpu_info = __get_cpu_var(xen_vcpu);
+ 	unsigned count;
 
-			/* Scan start_l1i twice; all others once. */
-			if ((word_idx != start_word_idx) || (i != 0))
-				pending_words &= ~(1UL << word_idx);
+	do {
+		vcpu_info->evtchn_upcall_pending = 0;
 
-			word_idx = (word_idx + 1) % BITS_PER_LONG;
+		if (__get_cpu_var(xed_nesting_count)++) {
+			ADD_UPCALL_STATS(nested, 1);
+			goto out;
 		}
 
+		ADD_UPCALL_STATS(upcalls, 1);
+		upcall_time_start();
+
+		xen_evtchn_handle_events(cpu);
+
 		BUG_ON(!irqs_disabled());
 
 		count = __get_cpu_var(xed_nesting_count);
 		__get_cpu_var(xed_nesting_count) = 0;
+
+		if (count != 1 || vcpu_info->evtchn_upcall_pending)
+			ADD_UPCALL_STATS(reraised, 1);
 	} while (count != 1 || vcpu_info->evtchn_upcall_pending);
 
 out:
@@ -1228,12 +1708,13 @@ void rebind_evtchn_irq(int evtchn, int irq)
 	spin_lock(&irq_mapping_update_lock);
 
 	/* After resume the irq<->evtchn mappings are all cleared out */
-	BUG_ON(evtchn_to_irq[evtchn] != -1);
+	BUG_ON(get_evtchn_to_irq(evtchn) != -1);
 	/* Expect irq to have been bound before,
 	   so there should be a proper type */
 	BUG_ON(info->type == IRQT_UNBOUND);
 
-	evtchn_to_irq[evtchn] = irq;
+	if (set_evtchn_to_irq(evtchn, irq) != 0)
+		BUG();
 	irq_info[irq] = mk_evtchn_info(evtchn);
 
 	spin_unlock(&irq_mapping_update_lock);
@@ -1279,16 +1760,156 @@ static int set_affinity_irq(unsigned irq, const struct cpumask *dest)
 	return rebind_irq_to_cpu(irq, tcpu);
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Interdomain (backend) event channels all start out on vcpu 0.  Every
+ * xen_irq_balance_interval seconds, spread the busy ones over the
+ * online vcpus by their interrupt rate over the last interval: busiest
+ * first, each onto the least loaded vcpu unless staying put is about
+ * as good.  Irqs whose affinity was set from userspace are left alone.
+ */
+static unsigned xen_irq_balance_interval = 10;
+
+static int __init xen_parse_irqbalance(char *arg)
+{
+	xen_irq_balance_interval = simple_strtoul(arg, NULL, 0);
+	return 1;
+}
+__setup("xen_irqbalance=", xen_parse_irqbalance);
+
+struct irq_balance_entry {
+	unsigned irq;
+	unsigned rate;
+};
+
+static int irq_balance_cmp(const void *a, const void *b)
+{
+	const struct irq_balance_entry *x = a, *y = b;
+
+	if (x->rate != y->rate)
+		return x->rate > y->rate ? -1 : 1;
+	return x->irq < y->irq ? -1 : x->irq > y->irq;
+}
+
+static bool irq_balance_eligible(unsigned irq)
+{
+	struct irq_info *info = info_for_irq(irq);
+	struct irq_desc *desc;
+
+	if (info->type != IRQT_EVTCHN || !info->balance ||
+	    !VALID_EVTCHN(info->evtchn))
+		return false;
+
+	desc = irq_to_desc(irq);
+	if (!desc || !desc->action)
+		return false;
+
+	return !(desc->status & (IRQ_AFFINITY_SET | IRQ_NO_BALANCING_MASK));
+}
+
+/*
+ * Leaves the move to the irq core, see move_masked_irq(), so that it
+ * happens from ack_dynirq() with the event channel masked.  Unlike
+ * irq_set_affinity() this does not set IRQ_AFFINITY_SET.
+ */
+static void irq_balance_move(unsigned irq, unsigned cpu)
+{
+	struct irq_desc *desc = irq_to_desc(irq);
+	unsigned long flags;
+
+	spin_lock_irqsave(&desc->lock, flags);
+	if (!(desc->status & IRQ_AFFINITY_SET)) {
+#ifdef CONFIG_GENERIC_PENDING_IRQ
+		desc->status |= IRQ_MOVE_PENDING;
+		cpumask_copy(desc->pending_mask, cpumask_of(cpu));
+#else
+		rebind_irq_to_cpu(irq, cpu);
+#endif
+	}
+	spin_unlock_irqrestore(&desc->lock, flags);
+}
+
+static void xen_irq_balance(struct work_struct *work);
+static DECLARE_DELAYED_WORK(xen_irq_balance_work, xen_irq_balance);
+
+static void xen_irq_balance(struct work_struct *work)
+{
+	struct irq_balance_entry *ent;
+	unsigned long *load;
+	unsigned irq, n = 0, i;
+
+	ent = kmalloc(nr_irqs * sizeof(*ent), GFP_KERNEL);
+	load = kcalloc(nr_cpu_ids, sizeof(*load), GFP_KERNEL);
+	if (!ent || !load)
+		goto out;
+
+	spin_lock(&irq_mapping_update_lock);
+	for (irq = 0; irq < nr_irqs; irq++) {
+		struct irq_info *info = info_for_irq(irq);
+		unsigned count;
+
+		if (!irq_balance_eligible(irq))
+			continue;
+
+		count = kstat_irqs(irq);
+		ent[n].irq = irq;
+		ent[n].rate = count - info->balance_count;
+		info->balance_count = count;
+		n++;
+	}
+	spin_unlock(&irq_mapping_update_lock);
+
+	sort(ent, n, sizeof(*ent), irq_balance_cmp, NULL);
+
+	get_online_cpus();
+	for (i = 0; i < n && ent[i].rate; i++) {
+		unsigned cur = cpu_from_irq(ent[i].irq);
+		unsigned best = cur;
+		unsigned cpu;
+
+		for_each_online_cpu(cpu)
+			if (!cpu_online(best) || load[cpu] < load[best])
+				best = cpu;
+
+		if (cpu_online(cur) && load[cur] < load[best] + ent[i].rate)
+			best = cur;
+
+		load[best] += ent[i].rate;
+
+		if (best != cur)
+			irq_balance_move(ent[i].irq, best);
+	}
+	put_online_cpus();
+
+ out:
+	kfree(load);
+	kfree(ent);
+
+	schedule_delayed_work(&xen_irq_balance_work,
+			      round_jiffies_relative(xen_irq_balance_interval * HZ));
+}
+
+static int __init xen_irq_balance_init(void)
+{
+	if (!xen_domain() || !xen_irq_balance_interval)
+		return 0;
+
+	schedule_delayed_work(&xen_irq_balance_work,
+			      round_jiffies_relative(xen_irq_balance_interval * HZ));
+	return 0;
+}
+late_initcall(xen_irq_balance_init);
+#endif /* CONFIG_SMP */
+
 int resend_irq_on_evtchn(unsigned int irq)
 {
 	int masked, evtchn = evtchn_from_irq(irq);
-	struct shared_info *s = HYPERVISOR_shared_info;
 
 	if (!VALID_EVTCHN(evtchn))
 		return 1;
 
-	masked = sync_test_and_set_bit(evtchn, s->evtchn_mask);
-	sync_set_bit(evtchn, s->evtchn_pending);
+	masked = test_and_set_mask(evtchn);
+	set_evtchn(evtchn);
 	if (!masked)
 		unmask_evtchn(evtchn);
 
@@ -1309,14 +1930,13 @@ static void ack_dynirq(unsigned int irq)
 static int retrigger_irq(unsigned int irq)
 {
 	int evtchn = evtchn_from_irq(irq);
-	struct shared_info *sh = HYPERVISOR_shared_info;
 	int ret = 0;
 
 	if (VALID_EVTCHN(evtchn)) {
 		int masked;
 
-		masked = sync_test_and_set_bit(evtchn, sh->evtchn_mask);
-		sync_set_bit(evtchn, sh->evtchn_pending);
+		masked = test_and_set_mask(evtchn);
+		set_evtchn(evtchn);
 		if (!masked)
 			unmask_evtchn(evtchn);
 		ret = 1;
@@ -1345,9 +1965,12 @@ static void restore_cpu_virqs(unsigned int cpu)
 		evtchn = bind_virq.port;
 
 		/* Record the new mapping. */
-		evtchn_to_irq[evtchn] = irq;
+		if (set_evtchn_to_irq(evtchn, irq) != 0)
+			BUG();
 		irq_info[irq] = mk_virq_info(evtchn, virq);
 		bind_evtchn_to_cpu(evtchn, cpu);
+		if (virq == VIRQ_TIMER)
+			evtchn_set_priority(evtchn, XEN_IRQ_PRIORITY_MAX);
 	}
 }
 
@@ -1370,9 +1993,11 @@ static void restore_cpu_ipis(unsigned int cpu)
 		evtchn = bind_ipi.port;
 
 		/* Record the new mapping. */
-		evtchn_to_irq[evtchn] = irq;
+		if (set_evtchn_to_irq(evtchn, irq) != 0)
+			BUG();
 		irq_info[irq] = mk_ipi_info(evtchn, ipi);
 		bind_evtchn_to_cpu(evtchn, cpu);
+		evtchn_set_priority(evtchn, XEN_IRQ_PRIORITY_MAX);
 	}
 }
 
@@ -1447,18 +2072,19 @@ void xen_irq_resume(void)
 	unsigned int cpu, irq, evtchn;
 	struct irq_desc *desc;
 
+	xen_evtchn_resume();
+
 	init_evtchn_cpu_bindings();
 
 	/* New event-channel space is not 'live' yet. */
-	for (evtchn = 0; evtchn < NR_EVENT_CHANNELS; evtchn++)
+	for (evtchn = 0; evtchn < xen_evtchn_nr_channels(); evtchn++)
 		mask_evtchn(evtchn);
 
 	/* No IRQ <-> event-channel mappings. */
 	for (irq = 0; irq < nr_irqs; irq++)
 		irq_info[irq].evtchn = 0; /* zap event-channel binding */
 
-	for (evtchn = 0; evtchn < NR_EVENT_CHANNELS; evtchn++)
-		evtchn_to_irq[evtchn] = -1;
+	clear_evtchn_to_irq_all();
 
 	for_each_possible_cpu(cpu) {
 		restore_cpu_virqs(cpu);
@@ -1579,14 +2205,23 @@ void __init xen_init_IRQ(void)
 	struct physdev_pirq_eoi_gmfn eoi_gmfn;
 	int nr_pirqs = NR_IRQS;
 
+	/* Switches evtchn_ops over if Xen supports the FIFO ABI. */
+	evtchn_ops = &evtchn_ops_2l;
+	if (fifo_events)
+		xen_evtchn_fifo_init();
+
 	cpu_evtchn_mask_p = kcalloc(nr_cpu_ids, sizeof(struct cpu_evtchn_s),
 				    GFP_KERNEL);
 	irq_info = kcalloc(nr_irqs, sizeof(*irq_info), GFP_KERNEL);
 
-	evtchn_to_irq = kcalloc(NR_EVENT_CHANNELS, sizeof(*evtchn_to_irq),
-				GFP_KERNEL);
-	for(i = 0; i < NR_EVENT_CHANNELS; i++)
-		evtchn_to_irq[i] = -1;
+	evtchn_to_irq = kcalloc(EVTCHN_ROW(evtchn_ops->max_channels()),
+				sizeof(*evtchn_to_irq), GFP_KERNEL);
+	BUG_ON(!evtchn_to_irq);
+
+#ifdef CONFIG_XEN_DEBUG_FS
+	irq_stats = kcalloc(nr_irqs, sizeof(*irq_stats), GFP_KERNEL);
+	BUG_ON(!irq_stats);
+#endif
 
 	i = get_order(sizeof(unsigned long) * BITS_TO_LONGS(nr_pirqs));
 	pirq_needs_eoi_bits = (void *)__get_free_pages(GFP_KERNEL|__GFP_ZERO, i);
@@ -1598,7 +2233,7 @@ void __init xen_init_IRQ(void)
 	init_evtchn_cpu_bindings();
 
 	/* No event channels are 'live' right now. */
-	for (i = 0; i < NR_EVENT_CHANNELS; i++)
+	for (i = 0; i < xen_evtchn_nr_channels(); i++)
 		mask_evtchn(i);
 
 	if (xen_hvm_domain()) {
@@ -1609,3 +2244,88 @@ void __init xen_init_IRQ(void)
 		xen_setup_pirqs();
 	}
 }
+
+#ifdef CONFIG_XEN_DEBUG_FS
+
+static const char *irq_type_name[] = {
+	[IRQT_UNBOUND]	= "unbound",
+	[IRQT_PIRQ]	= "pirq",
+	[IRQT_VIRQ]	= "virq",
+	[IRQT_IPI]	= "ipi",
+	[IRQT_EVTCHN]	= "evtchn",
+};
+
+static int evtchn_stats_show(struct seq_file *m, void *v)
+{
+	int cpu, irq;
+
+	seq_printf(m, "cpu %20s %20s %20s\n", "upcalls", "nested", "reraised");
+	for_each_online_cpu(cpu) {
+		struct evtchn_upcall_stats *st = &per_cpu(upcall_stats, cpu);
+
+		seq_printf(m, "%3d %20llu %20llu %20llu\n", cpu,
+			   st->upcalls, st->nested, st->reraised);
+	}
+
+	seq_printf(m, "\n%4s %6s %3s %-7s %12s %14s %11s %11s %11s  %s\n",
+		   "irq", "evtchn", "cpu", "type", "count", "handler_ns",
+		   "handler_max", "latency_avg", "latency_max", "name");
+	for (irq = 0; irq < nr_irqs; irq++) {
+		struct evtchn_irq_stats *st = &irq_stats[irq];
+		struct irq_info *info = info_for_irq(irq);
+		struct irq_desc *desc;
+		const char *name = "-";
+
+		if (!st->count)
+			continue;
+
+		desc = irq_to_desc(irq);
+		if (desc && desc->action && desc->action->name)
+			name = desc->action->name;
+
+		seq_printf(m, "%4d %6u %3u %-7s %12llu %14llu %11u %11llu %11u  %s\n",
+			   irq, info->evtchn, info->cpu, irq_type_name[info->type],
+			   st->count, st->handler_ns, st->handler_max_ns,
+			   div64_u64(st->latency_ns, st->count),
+			   st->latency_max_ns, name);
+	}
+
+	return 0;
+}
+
+static int evtchn_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, evtchn_stats_show, NULL);
+}
+
+static const struct file_operations evtchn_stats_fops = {
+	.open		= evtchn_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *d_evtchn_debug;
+
+static int __init xen_evtchn_debugfs(void)
+{
+	struct dentry *d_xen;
+
+	if (!xen_domain())
+		return 0;
+
+	d_xen = xen_init_debugfs();
+	if (d_xen == NULL)
+		return -ENOMEM;
+
+	d_evtchn_debug = debugfs_create_dir("events", d_xen);
+
+	debugfs_create_u8("zero_stats", 0644, d_evtchn_debug, &zero_stats);
+	debugfs_create_file("stats", 0444, d_evtchn_debug, NULL,
+			    &evtchn_stats_fops);
+
+	return 0;
+}
+fs_initcall(xen_evtchn_debugfs);
+
+#endif	/* CONFIG_XEN_DEBUG_FS */
@@ -0,0 +1,99 @@
+/*
+ * Xen event channels (internal header)
+ *
+ * The event channel ABI in use -- the original 2-level bitmap or the
+ * FIFO-based one -- is hidden behind a set of port operations.  The
+ * irq bookkeeping in events.c only ever goes through these.
+ */
+#ifndef __EVENTS_INTERNAL_H__
+#define __EVENTS_INTERNAL_H__
+
+struct evtchn_ops {
+	unsigned (*max_channels)(void);
+	unsigned (*nr_channels)(void);
+
+	int (*setup)(unsigned port);
+	void (*bind_to_cpu)(unsigned port, unsigned cpu, unsigned old_cpu);
+
+	void (*clear_pending)(unsigned port);
+	void (*set_pending)(unsigned port);
+	bool (*is_pending)(unsigned port);
+	bool (*test_and_set_mask)(unsigned port);
+	void (*mask)(unsigned port);
+	void (*unmask)(unsigned port);
+
+	void (*handle_events)(unsigned cpu);
+	void (*resume)(void);
+};
+
+extern const struct evtchn_ops *evtchn_ops;
+
+int get_evtchn_to_irq(unsigned port);
+void handle_irq_for_port(unsigned port);
+
+int xen_evtchn_fifo_init(void);
+
+static inline unsigned xen_evtchn_nr_channels(void)
+{
+	return evtchn_ops->nr_channels();
+}
+
+/*
+ * Do any ABI specific setup for a bound event channel before it can
+ * be unmasked and used.
+ */
+static inline int xen_evtchn_port_setup(unsigned port)
+{
+	if (evtchn_ops->setup)
+		return evtchn_ops->setup(port);
+	return 0;
+}
+
+static inline void xen_evtchn_port_bind_to_cpu(unsigned port, unsigned cpu,
+					       unsigned old_cpu)
+{
+	evtchn_ops->bind_to_cpu(port, cpu, old_cpu);
+}
+
+static inline void clear_evtchn(unsigned port)
+{
+	evtchn_ops->clear_pending(port);
+}
+
+static inline void set_evtchn(unsigned port)
+{
+	evtchn_ops->set_pending(port);
+}
+
+static inline bool test_evtchn(unsigned port)
+{
+	return evtchn_ops->is_pending(port);
+}
+
+static inline bool test_and_set_mask(unsigned port)
+{
+	return evtchn_ops->test_and_set_mask(port);
+}
+
+static inline void mask_evtchn(unsigned port)
+{
+	evtchn_ops->mask(port);
+}
+
+static inline void unmask_evtchn(unsigned port)
+{
+	evtchn_ops->unmask(port);
+}
+
+static inline void xen_evtchn_handle_events(unsigned cpu)
+{
+	evtchn_ops->handle_events(cpu);
+}
+
+static inline void xen_evtchn_resume(void)
+{
+	if (evtchn_ops->resume)
+		evtchn_ops->resume();
+}
+
+#endif /* __EVENTS_INTERNAL_H__ */
@@ -29,6 +29,7 @@
 #include <linux/uaccess.h>
 #include <linux/sched.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 
 #include <xen/xen.h>
 #include <xen/grant_table.h>
@@ -47,8 +48,17 @@ module_param(debug, int, 0644);
 static int limit = 1024;
 module_param(limit, int, 0644);
 
+/*
+ * Maps are kept on a list in index order (for finding a free index
+ * range) and in two rbtrees: by index for the ioctls and mmap, and,
+ * while mmapped, by start address for the vaddr ioctl and the MMU
+ * notifier.  VMAs of one mm do not overlap, so address order is
+ * also end order and a range is found with one descent.
+ */
 struct gntdev_priv {
 	struct list_head maps;
+	struct rb_root maps_by_index;
+	struct rb_root maps_by_vaddr;
 	uint32_t used;
 	uint32_t limit;
 	spinlock_t lock;
@@ -58,8 +68,13 @@ struct gntdev_priv {
 
 struct grant_map {
 	struct list_head next;
+	struct rb_node index_node;
+	struct rb_node vaddr_node;
 	struct gntdev_priv *priv;
 	struct vm_area_struct *vma;
+	/* The vma's range when it was mapped: the vaddr tree key. */
+	unsigned long vstart;
+	unsigned long vend;
 	int index;
 	int count;
 	int flags;
@@ -117,6 +132,70 @@ err:
 	return NULL;
 }
 
+static void gntdev_insert_index(struct gntdev_priv *priv,
+				struct grant_map *add)
+{
+	struct rb_node **p = &priv->maps_by_index.rb_node;
+	struct rb_node *parent = NULL;
+	struct grant_map *map;
+
+	while (*p) {
+		parent = *p;
+		map = rb_entry(parent, struct grant_map, index_node);
+		if (add->index < map->index)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&add->index_node, parent, p);
+	rb_insert_color(&add->index_node, &priv->maps_by_index);
+}
+
+static void gntdev_insert_vaddr(struct gntdev_priv *priv,
+				struct grant_map *add)
+{
+	struct rb_node **p = &priv->maps_by_vaddr.rb_node;
+	struct rb_node *parent = NULL;
+	struct grant_map *map;
+
+	while (*p) {
+		parent = *p;
+		map = rb_entry(parent, struct grant_map, vaddr_node);
+		if (add->vstart < map->vstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&add->vaddr_node, parent, p);
+	rb_insert_color(&add->vaddr_node, &priv->maps_by_vaddr);
+}
+
+/* The first mmapped map ending above @vaddr, or NULL. */
+static struct grant_map *gntdev_first_map_above(struct gntdev_priv *priv,
+						unsigned long vaddr)
+{
+	struct rb_node *n = priv->maps_by_vaddr.rb_node;
+	struct grant_map *map, *found = NULL;
+
+	while (n) {
+		map = rb_entry(n, struct grant_map, vaddr_node);
+		if (vaddr < map->vend) {
+			found = map;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+	return found;
+}
+
+static struct grant_map *gntdev_next_map_vaddr(struct grant_map *map)
+{
+	struct rb_node *n = rb_next(&map->vaddr_node);
+
+	return n ? rb_entry(n, struct grant_map, vaddr_node) : NULL;
+}
+
 static void gntdev_add_map(struct gntdev_priv *priv, struct grant_map *add)
 {
 	struct grant_map *map;
@@ -131,6 +210,7 @@ static void gntdev_add_map(struct gntdev_priv *priv, struct grant_map *add)
 	list_add_tail(&add->next, &priv->maps);
 
 done:
+	gntdev_insert_index(priv, add);
 	priv->used += add->count;
 	if (debug)
 		gntdev_print_maps(priv, "[new]", add->index);
@@ -139,14 +219,17 @@ done:
 static struct grant_map *gntdev_find_map_index(struct gntdev_priv *priv, int index,
 					       int count)
 {
+	struct rb_node *n = priv->maps_by_index.rb_node;
 	struct grant_map *map;
 
-	list_for_each_entry(map, &priv->maps, next) {
-		if (map->index != index)
-			continue;
-		if (map->count != count)
-			continue;
-		return map;
+	while (n) {
+		map = rb_entry(n, struct grant_map, index_node);
+		if (index < map->index)
+			n = n->rb_left;
+		else if (index > map->index)
+			n = n->rb_right;
+		else
+			return map->count == count ? map : NULL;
 	}
 	return NULL;
 }
@@ -156,15 +239,9 @@ static struct grant_map *gntdev_find_map_vaddr(struct gntdev_priv *priv,
 {
 	struct grant_map *map;
 
-	list_for_each_entry(map, &priv->maps, next) {
-		if (!map->vma)
-			continue;
-		if (vaddr < map->vma->vm_start)
-			continue;
-		if (vaddr >= map->vma->vm_end)
-			continue;
+	map = gntdev_first_map_above(priv, vaddr);
+	if (map && vaddr >= map->vstart)
 		return map;
-	}
 	return NULL;
 }
 
@@ -180,6 +257,7 @@ static int gntdev_del_map(struct grant_map *map)
 
 	map->priv->used -= map->count;
 	list_del(&map->next);
+	rb_erase(&map->index_node, &map->priv->maps_by_index);
 	return 0;
 }
 
@@ -256,11 +334,15 @@ static int unmap_grant_pages(struct grant_map *map, int offset, int pages)
 static void gntdev_vma_close(struct vm_area_struct *vma)
 {
 	struct grant_map *map = vma->vm_private_data;
+	struct gntdev_priv *priv = map->priv;
 
 	if (debug)
 		printk("%s\n", __FUNCTION__);
+	spin_lock(&priv->lock);
+	rb_erase(&map->vaddr_node, &priv->maps_by_vaddr);
 	map->is_mapped = 0;
 	map->vma = NULL;
+	spin_unlock(&priv->lock);
 	vma->vm_private_data = NULL;
 }
 
@@ -290,15 +372,11 @@ static void mn_invl_range_start(struct mmu_notifier *mn,
 	int err;
 
 	spin_lock(&priv->lock);
-	list_for_each_entry(map, &priv->maps, next) {
-		if (!map->vma)
-			continue;
+	for (map = gntdev_first_map_above(priv, start);
+	     map && map->vstart < end;
+	     map = gntdev_next_map_vaddr(map)) {
 		if (!map->is_mapped)
 			continue;
-		if (map->vma->vm_start >= end)
-			continue;
-		if (map->vma->vm_end <= start)
-			continue;
 		mstart = max(start, map->vma->vm_start);
 		mend   = min(end,   map->vma->vm_end);
 		if (debug)
@@ -359,6 +437,8 @@ static int gntdev_open(struct inode *inode, struct file *flip)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&priv->maps);
+	priv->maps_by_index = RB_ROOT;
+	priv->maps_by_vaddr = RB_ROOT;
 	spin_lock_init(&priv->lock);
 	priv->limit = limit;
 
@@ -402,6 +482,44 @@ static int gntdev_release(struct inode *inode, struct file *flip)
 	return 0;
 }
 
+/* Insert @count grants read from @refs; the map is returned in @mapp. */
+static int gntdev_insert_grants(struct gntdev_priv *priv, uint32_t count,
+				struct ioctl_gntdev_grant_ref __user *refs,
+				struct grant_map **mapp)
+{
+	struct grant_map *map;
+
+	if (unlikely(count <= 0))
+		return -EINVAL;
+	if (unlikely(count > priv->limit))
+		return -EINVAL;
+
+	map = gntdev_alloc_map(priv, count);
+	if (!map)
+		return -ENOMEM;
+	if (copy_from_user(map->grants, refs,
+			   sizeof(map->grants[0]) * count) != 0) {
+		gntdev_free_map(map);
+		return -ENOMEM;
+	}
+
+	spin_lock(&priv->lock);
+	gntdev_add_map(priv, map);
+	spin_unlock(&priv->lock);
+
+	*mapp = map;
+	return 0;
+}
+
+static void gntdev_remove_grants(struct gntdev_priv *priv,
+				 struct grant_map *map)
+{
+	spin_lock(&priv->lock);
+	gntdev_del_map(map);
+	spin_unlock(&priv->lock);
+	gntdev_free_map(map);
+}
+
 static long gntdev_ioctl_map_grant_ref(struct gntdev_priv *priv,
 				       struct ioctl_gntdev_map_grant_ref __user *u)
 {
@@ -414,36 +532,70 @@ static long gntdev_ioctl_map_grant_ref(struct gntdev_priv *priv,
 	if (debug)
 		printk("%s: priv %p, add %d\n", __FUNCTION__, priv,
 		       op.count);
-	if (unlikely(op.count <= 0))
-		return -EINVAL;
-	if (unlikely(op.count > priv->limit))
-		return -EINVAL;
 
-	err = -ENOMEM;
-	map = gntdev_alloc_map(priv, op.count);
-	if (!map)
-		return err;
-	if (copy_from_user(map->grants, &u->refs,
-			   sizeof(map->grants[0]) * op.count) != 0) {
-		gntdev_free_map(map);
+	err = gntdev_insert_grants(priv, op.count, u->refs, &map);
+	if (err)
 		return err;
-	}
 
-	spin_lock(&priv->lock);
-	gntdev_add_map(priv, map);
 	op.index = map->index << PAGE_SHIFT;
-	spin_unlock(&priv->lock);
-
 	if (copy_to_user(u, &op, sizeof(op)) != 0) {
-		spin_lock(&priv->lock);
-		gntdev_del_map(map);
-		spin_unlock(&priv->lock);
-		gntdev_free_map(map);
-		return err;
+		gntdev_remove_grants(priv, map);
+		return -ENOMEM;
 	}
 	return 0;
 }
 
+static long gntdev_ioctl_map_grant_ref_batch(struct gntdev_priv *priv,
+				struct ioctl_gntdev_map_grant_ref_batch __user *u)
+{
+	struct ioctl_gntdev_map_grant_ref_batch op;
+	struct ioctl_gntdev_map_range __user *ranges;
+	struct ioctl_gntdev_map_range range;
+	struct grant_map **maps;
+	uint32_t i;
+	int err = 0;
+
+	if (copy_from_user(&op, u, sizeof(op)) != 0)
+		return -EFAULT;
+	if (debug)
+		printk("%s: priv %p, add %d ranges\n", __FUNCTION__, priv,
+		       op.count);
+	/* Every range holds at least one grant. */
+	if (unlikely(op.count == 0 || op.count > priv->limit))
+		return -EINVAL;
+
+	maps = kcalloc(op.count, sizeof(maps[0]), GFP_KERNEL);
+	if (!maps)
+		return -ENOMEM;
+
+	ranges = (void __user *)(unsigned long)op.ranges;
+	for (i = 0; i < op.count; i++) {
+		if (copy_from_user(&range, &ranges[i], sizeof(range)) != 0) {
+			err = -EFAULT;
+			break;
+		}
+		err = gntdev_insert_grants(priv, range.count,
+				(void __user *)(unsigned long)range.refs,
+				&maps[i]);
+		if (err)
+			break;
+		range.index = maps[i]->index << PAGE_SHIFT;
+		if (put_user(range.index, &ranges[i].index)) {
+			err = -EFAULT;
+			i++;
+			break;
+		}
+	}
+
+	if (err) {
+		while (i-- > 0)
+			gntdev_remove_grants(priv, maps[i]);
+	}
+
+	kfree(maps);
+	return err;
+}
+
 static long gntdev_ioctl_unmap_grant_ref(struct gntdev_priv *priv,
 					 struct ioctl_gntdev_unmap_grant_ref __user *u)
 {
@@ -495,6 +647,218 @@ static long gntdev_ioctl_get_offset_for_vaddr(struct gntdev_priv *priv,
 	return 0;
 }
 
+/*
+ * Grant copy: up to GNTDEV_COPY_BATCH ops go to Xen per hypercall.
+ * A local buffer is pinned page by page, so a segment is split at the
+ * local page boundaries and each op has at most one pinned page.
+ */
+#define GNTDEV_COPY_BATCH 16
+
+struct gntdev_copy_batch {
+	struct gnttab_copy ops[GNTDEV_COPY_BATCH];
+	struct page *pages[GNTDEV_COPY_BATCH];
+	bool dirty[GNTDEV_COPY_BATCH];
+	int16_t __user *status[GNTDEV_COPY_BATCH];
+	unsigned int nr_ops;
+	unsigned int nr_pages;
+};
+
+static int gntdev_get_page(struct gntdev_copy_batch *batch,
+			   unsigned long virt, bool writeable,
+			   unsigned long *gmfn)
+{
+	struct page *page;
+	int ret;
+
+	ret = get_user_pages_fast(virt, 1, writeable, &page);
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
+		return -EFAULT;
+
+	batch->pages[batch->nr_pages] = page;
+	batch->dirty[batch->nr_pages] = writeable;
+	batch->nr_pages++;
+
+	*gmfn = pfn_to_mfn(page_to_pfn(page));
+	return 0;
+}
+
+static void gntdev_put_pages(struct gntdev_copy_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->nr_pages; i++) {
+		if (batch->dirty[i])
+			set_page_dirty_lock(batch->pages[i]);
+		put_page(batch->pages[i]);
+	}
+	batch->nr_pages = 0;
+}
+
+static int gntdev_copy(struct gntdev_copy_batch *batch)
+{
+	unsigned int i;
+	int ret;
+
+	ret = HYPERVISOR_grant_table_op(GNTTABOP_copy, batch->ops,
+					batch->nr_ops);
+	gntdev_put_pages(batch);
+	if (WARN_ON(ret))
+		return ret;
+
+	/*
+	 * A segment may span several ops: report the first failure and
+	 * do not let later successes overwrite it.
+	 */
+	for (i = 0; i < batch->nr_ops; i++) {
+		int16_t status = batch->ops[i].status;
+		int16_t old_status;
+
+		if (status == GNTST_okay)
+			continue;
+		if (__get_user(old_status, batch->status[i]))
+			return -EFAULT;
+		if (old_status != GNTST_okay)
+			continue;
+		if (__put_user(status, batch->status[i]))
+			return -EFAULT;
+	}
+
+	batch->nr_ops = 0;
+	return 0;
+}
+
+static int gntdev_grant_copy_seg(struct gntdev_copy_batch *batch,
+				 struct gntdev_grant_copy_segment *seg,
+				 int16_t __user *status)
+{
+	uint16_t copied = 0;
+
+	/* Local to local is a memcpy; it has no business here. */
+	if (!(seg->flags & (GNTCOPY_source_gref | GNTCOPY_dest_gref)))
+		return -EINVAL;
+	if (seg->flags & ~(GNTCOPY_source_gref | GNTCOPY_dest_gref))
+		return -EINVAL;
+
+	/* A grant side cannot cross a page. */
+	if ((seg->flags & GNTCOPY_source_gref) &&
+	    seg->source.foreign.offset + seg->len > PAGE_SIZE)
+		return -EINVAL;
+	if ((seg->flags & GNTCOPY_dest_gref) &&
+	    seg->dest.foreign.offset + seg->len > PAGE_SIZE)
+		return -EINVAL;
+
+	if (put_user(GNTST_okay, status))
+		return -EFAULT;
+
+	while (copied < seg->len) {
+		struct gnttab_copy *op;
+		unsigned long virt, gmfn;
+		unsigned int len, off;
+		int ret;
+
+		if (batch->nr_ops >= GNTDEV_COPY_BATCH) {
+			ret = gntdev_copy(batch);
+			if (ret < 0)
+				return ret;
+		}
+
+		len = seg->len - copied;
+
+		op = &batch->ops[batch->nr_ops];
+		op->flags = 0;
+
+		if (seg->flags & GNTCOPY_source_gref) {
+			op->source.u.ref = seg->source.foreign.ref;
+			op->source.domid = seg->source.foreign.domid;
+			op->source.offset = seg->source.foreign.offset + copied;
+			op->flags |= GNTCOPY_source_gref;
+		} else {
+			virt = seg->source.virt + copied;
+			off = virt & ~PAGE_MASK;
+			len = min_t(unsigned int, len, PAGE_SIZE - off);
+
+			ret = gntdev_get_page(batch, virt, false, &gmfn);
+			if (ret < 0)
+				return ret;
+
+			op->source.u.gmfn = gmfn;
+			op->source.domid = DOMID_SELF;
+			op->source.offset = off;
+		}
+
+		if (seg->flags & GNTCOPY_dest_gref) {
+			op->dest.u.ref = seg->dest.foreign.ref;
+			op->dest.domid = seg->dest.foreign.domid;
+			op->dest.offset = seg->dest.foreign.offset + copied;
+			op->flags |= GNTCOPY_dest_gref;
+		} else {
+			virt = seg->dest.virt + copied;
+			off = virt & ~PAGE_MASK;
+			len = min_t(unsigned int, len, PAGE_SIZE - off);
+
+			ret = gntdev_get_page(batch, virt, true, &gmfn);
+			if (ret < 0)
+				return ret;
+
+			op->dest.u.gmfn = gmfn;
+			op->dest.domid = DOMID_SELF;
+			op->dest.offset = off;
+		}
+
+		op->len = len;
+		copied += len;
+
+		batch->status[batch->nr_ops] = status;
+		batch->nr_ops++;
+	}
+
+	return 0;
+}
+
+static long gntdev_ioctl_grant_copy(struct gntdev_priv *priv,
+				    struct ioctl_gntdev_grant_copy __user *u)
+{
+	struct ioctl_gntdev_grant_copy copy;
+	struct gntdev_grant_copy_segment __user *segments;
+	struct gntdev_copy_batch batch;
+	unsigned int i;
+	int ret = 0;
+
+	if (copy_from_user(&copy, u, sizeof(copy)) != 0)
+		return -EFAULT;
+	if (debug)
+		printk("%s: priv %p, copy %d segments\n", __FUNCTION__, priv,
+		       copy.count);
+
+	segments = (void __user *)(unsigned long)copy.segments;
+	batch.nr_ops = 0;
+	batch.nr_pages = 0;
+
+	for (i = 0; i < copy.count; i++) {
+		struct gntdev_grant_copy_segment seg;
+
+		if (copy_from_user(&seg, &segments[i], sizeof(seg)) != 0) {
+			ret = -EFAULT;
+			goto out;
+		}
+
+		ret = gntdev_grant_copy_seg(&batch, &seg, &segments[i].status);
+		if (ret < 0)
+			goto out;
+
+		cond_resched();
+	}
+	if (batch.nr_ops)
+		ret = gntdev_copy(&batch);
+	return ret;
+
+ out:
+	gntdev_put_pages(&batch);
+	return ret;
+}
+
 static long gntdev_ioctl_set_max_grants(struct gntdev_priv *priv,
 					struct ioctl_gntdev_set_max_grants __user *u)
 {
@@ -532,6 +896,12 @@ static long gntdev_ioctl(struct file *flip,
 	case IOCTL_GNTDEV_SET_MAX_GRANTS:
 		return gntdev_ioctl_set_max_grants(priv, ptr);
 
+	case IOCTL_GNTDEV_MAP_GRANT_REF_BATCH:
+		return gntdev_ioctl_map_grant_ref_batch(priv, ptr);
+
+	case IOCTL_GNTDEV_GRANT_COPY:
+		return gntdev_ioctl_grant_copy(priv, ptr);
+
 	default:
 		if (debug)
 			printk("%s: priv %p, unknown cmd %x\n",
@@ -576,6 +946,9 @@ static int gntdev_mmap(struct file *flip, struct vm_area_struct *vma)
 
 	vma->vm_private_data = map;
 	map->vma = vma;
+	map->vstart = vma->vm_start;
+	map->vend = vma->vm_end;
+	gntdev_insert_vaddr(priv, map);
 
 	map->flags = GNTMAP_host_map | GNTMAP_application_map | GNTMAP_contains_pte;
 	if (!(vma->vm_flags & VM_WRITE))
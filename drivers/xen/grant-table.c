@@ -37,6 +37,8 @@
 #include <linux/vmalloc.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
 
 #include <xen/xen.h>
 #include <xen/interface/xen.h>
@@ -52,10 +54,10 @@
 /* External tools reserve first few grant table entries. */
 #define NR_RESERVED_ENTRIES 8
 #define GNTTAB_LIST_END 0xffffffff
-#define GREFS_PER_GRANT_FRAME (PAGE_SIZE / sizeof(struct grant_entry))
 
 static grant_ref_t **gnttab_list;
 static unsigned int nr_grant_frames;
+static unsigned int grefs_per_grant_frame;
 static unsigned int boot_max_nr_grant_frames;
 static int gnttab_free_count;
 static grant_ref_t gnttab_free_head;
@@ -63,13 +65,59 @@ static DEFINE_SPINLOCK(gnttab_list_lock);
 unsigned long xen_hvm_resume_frames;
 EXPORT_SYMBOL_GPL(xen_hvm_resume_frames);
 
-static struct grant_entry *shared;
+/*
+ * The layout of the shared table depends on the grant table version
+ * negotiated with Xen; everything that touches an entry goes through
+ * gnttab_interface.
+ */
+struct gnttab_ops {
+	/* Map the shared (and, for v2, status) frames of the table. */
+	int (*map_frames)(unsigned long *frames, unsigned int nr_gframes);
+	void (*unmap_frames)(void);
+	/* Fill in a full page entry (access or transfer), flags last. */
+	void (*update_entry)(grant_ref_t ref, domid_t domid,
+			     unsigned long frame, unsigned flags);
+	/* Return 1 if access was ended, 0 if the entry is still in use. */
+	int (*end_foreign_access_ref)(grant_ref_t ref, int readonly);
+	unsigned long (*end_foreign_transfer_ref)(grant_ref_t ref);
+	int (*query_foreign_access)(grant_ref_t ref);
+	/* v2 only, NULL on a v1 table. */
+	void (*update_subpage_entry)(grant_ref_t ref, domid_t domid,
+				     unsigned long frame, int flags,
+				     unsigned page_off, unsigned length);
+	void (*update_trans_entry)(grant_ref_t ref, domid_t domid,
+				   int flags, domid_t trans_domid,
+				   grant_ref_t trans_gref);
+};
+
+static union {
+	struct grant_entry *v1;
+	union grant_entry_v2 *v2;
+	void *addr;
+} gnttab_shared;
+
+/* v2 only: GTF_reading/GTF_writing of each entry, written by Xen. */
+static grant_status_t *grstatus;
+
+static const struct gnttab_ops *gnttab_interface;
+static int grant_table_version;
+
+/* Set "gnttab_v1" to keep the version 1 table even if Xen has v2. */
+static bool gnttab_v2_allowed = true;
+
+static int __init gnttab_parse_v1(char *arg)
+{
+	gnttab_v2_allowed = false;
+	return 1;
+}
+__setup("gnttab_v1", gnttab_parse_v1);
 
 static struct gnttab_free_callback *gnttab_free_callback_list;
 
 static int gnttab_expand(unsigned int req_entries);
 
 #define RPP (PAGE_SIZE / sizeof(grant_ref_t))
+#define SPP (PAGE_SIZE / sizeof(grant_status_t))
 
 static inline grant_ref_t *__gnttab_entry(grant_ref_t entry)
 {
@@ -78,19 +126,34 @@ static inline grant_ref_t *__gnttab_entry(grant_ref_t entry)
 /* This can be used as an l-value */
 #define gnttab_entry(entry) (*__gnttab_entry(entry))
 
-static int get_free_entries(unsigned count)
+/*
+ * Single references -- the grant/end pair around every granted page
+ * on the frontend I/O paths -- come out of a small per-cpu cache in
+ * front of the global free list, so they do not bounce
+ * gnttab_list_lock between vcpus.  The cache is refilled from and
+ * spilled back to the global list GNTTAB_CACHE_BATCH references at a
+ * time.  Only the global list counts towards gnttab_free_count; while
+ * anyone waits in gnttab_request_free_callback() freed references skip
+ * the cache so the waiter sees them.
+ */
+#define GNTTAB_CACHE_SIZE	64
+#define GNTTAB_CACHE_BATCH	32
+
+struct gnttab_ref_cache {
+	unsigned int count;
+	grant_ref_t refs[GNTTAB_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct gnttab_ref_cache, gnttab_ref_cache);
+
+static int get_free_entries_locked(unsigned count)
 {
-	unsigned long flags;
 	int ref, rc;
 	grant_ref_t head;
 
-	spin_lock_irqsave(&gnttab_list_lock, flags);
-
 	if ((gnttab_free_count < count) &&
-	    ((rc = gnttab_expand(count - gnttab_free_count)) < 0)) {
-		spin_unlock_irqrestore(&gnttab_list_lock, flags);
+	    ((rc = gnttab_expand(count - gnttab_free_count)) < 0))
 		return rc;
-	}
 
 	ref = head = gnttab_free_head;
 	gnttab_free_count -= count;
@@ -99,6 +162,60 @@ static int get_free_entries(unsigned count)
 	gnttab_free_head = gnttab_entry(head);
 	gnttab_entry(head) = GNTTAB_LIST_END;
 
+	return ref;
+}
+
+/* Called with interrupts disabled. */
+static int gnttab_cache_refill(struct gnttab_ref_cache *cache)
+{
+	unsigned int n;
+	int rc;
+
+	spin_lock(&gnttab_list_lock);
+
+	if (gnttab_free_count == 0 && (rc = gnttab_expand(1)) < 0) {
+		spin_unlock(&gnttab_list_lock);
+		return rc;
+	}
+
+	/* Do not hoard references somebody is waiting for. */
+	n = gnttab_free_callback_list ? 1 :
+		min_t(unsigned int, gnttab_free_count, GNTTAB_CACHE_BATCH);
+
+	gnttab_free_count -= n;
+	while (n--) {
+		cache->refs[cache->count++] = gnttab_free_head;
+		gnttab_free_head = gnttab_entry(gnttab_free_head);
+	}
+
+	spin_unlock(&gnttab_list_lock);
+
+	return 0;
+}
+
+static int get_free_entries(unsigned count)
+{
+	struct gnttab_ref_cache *cache;
+	unsigned long flags;
+	int ref, rc;
+
+	if (count == 1) {
+		local_irq_save(flags);
+		cache = &__get_cpu_var(gnttab_ref_cache);
+		if (cache->count == 0 &&
+		    (rc = gnttab_cache_refill(cache)) < 0) {
+			local_irq_restore(flags);
+			return rc;
+		}
+		ref = cache->refs[--cache->count];
+		local_irq_restore(flags);
+
+		gnttab_entry(ref) = GNTTAB_LIST_END;
+		return ref;
+	}
+
+	spin_lock_irqsave(&gnttab_list_lock, flags);
+	ref = get_free_entries_locked(count);
 	spin_unlock_irqrestore(&gnttab_list_lock, flags);
 
 	return ref;
@@ -130,19 +247,51 @@ static inline void check_free_callbacks(void)
 		do_free_callbacks();
 }
 
+/*
+ * Return the @n most recently cached references of @cache to the
+ * global list.  Called with gnttab_list_lock held and interrupts
+ * disabled, or for the cache of a dead cpu.
+ */
+static void __gnttab_cache_spill(struct gnttab_ref_cache *cache,
+				 unsigned int n)
+{
+	grant_ref_t ref;
+
+	gnttab_free_count += n;
+	while (n--) {
+		ref = cache->refs[--cache->count];
+		gnttab_entry(ref) = gnttab_free_head;
+		gnttab_free_head = ref;
+	}
+	check_free_callbacks();
+}
+
+static void gnttab_cache_spill(struct gnttab_ref_cache *cache,
+			       unsigned int n)
+{
+	spin_lock(&gnttab_list_lock);
+	__gnttab_cache_spill(cache, n);
+	spin_unlock(&gnttab_list_lock);
+}
+
 static void put_free_entry(grant_ref_t ref)
 {
+	struct gnttab_ref_cache *cache;
 	unsigned long flags;
-	spin_lock_irqsave(&gnttab_list_lock, flags);
-	gnttab_entry(ref) = gnttab_free_head;
-	gnttab_free_head = ref;
-	gnttab_free_count++;
-	check_free_callbacks();
-	spin_unlock_irqrestore(&gnttab_list_lock, flags);
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(gnttab_ref_cache);
+	cache->refs[cache->count++] = ref;
+	/* Unlocked peek: a waiter also drains its own cache, see below. */
+	if (unlikely(gnttab_free_callback_list))
+		gnttab_cache_spill(cache, cache->count);
+	else if (cache->count == GNTTAB_CACHE_SIZE)
+		gnttab_cache_spill(cache, GNTTAB_CACHE_BATCH);
+	local_irq_restore(flags);
 }
 
-static void update_grant_entry(grant_ref_t ref, domid_t domid,
-			       unsigned long frame, unsigned flags)
+static void gnttab_update_entry_v1(grant_ref_t ref, domid_t domid,
+				   unsigned long frame, unsigned flags)
 {
 	/*
 	 * Introducing a valid entry into the grant table:
@@ -154,10 +303,19 @@ static void update_grant_entry(grant_ref_t ref, domid_t domid,
 	 *  3. Write memory barrier (WMB).
 	 *  4. Write ent->flags, inc. valid type.
 	 */
-	shared[ref].frame = frame;
-	shared[ref].domid = domid;
+	gnttab_shared.v1[ref].frame = frame;
+	gnttab_shared.v1[ref].domid = domid;
 	wmb();
-	shared[ref].flags = flags;
+	gnttab_shared.v1[ref].flags = flags;
+}
+
+static void gnttab_update_entry_v2(grant_ref_t ref, domid_t domid,
+				   unsigned long frame, unsigned flags)
+{
+	gnttab_shared.v2[ref].hdr.domid = domid;
+	gnttab_shared.v2[ref].full_page.frame = frame;
+	wmb();
+	gnttab_shared.v2[ref].hdr.flags = flags;
 }
 
 /*
@@ -166,7 +324,7 @@ static void update_grant_entry(grant_ref_t ref, domid_t domid,
 void gnttab_grant_foreign_access_ref(grant_ref_t ref, domid_t domid,
 				     unsigned long frame, int readonly)
 {
-	update_grant_entry(ref, domid, frame,
+	gnttab_interface->update_entry(ref, domid, frame,
 			   GTF_permit_access | (readonly ? GTF_readonly : 0));
 }
 EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access_ref);
@@ -186,31 +344,182 @@ int gnttab_grant_foreign_access(domid_t domid, unsigned long frame,
 }
 EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access);
 
-int gnttab_query_foreign_access(grant_ref_t ref)
+static void gnttab_update_subpage_entry_v2(grant_ref_t ref, domid_t domid,
+					   unsigned long frame, int flags,
+					   unsigned page_off, unsigned length)
+{
+	gnttab_shared.v2[ref].sub_page.frame = frame;
+	gnttab_shared.v2[ref].sub_page.page_off = page_off;
+	gnttab_shared.v2[ref].sub_page.length = length;
+	gnttab_shared.v2[ref].hdr.domid = domid;
+	wmb();
+	gnttab_shared.v2[ref].hdr.flags =
+				GTF_permit_access | GTF_sub_page | flags;
+}
+
+int gnttab_grant_foreign_access_subpage_ref(grant_ref_t ref, domid_t domid,
+					    unsigned long frame, int flags,
+					    unsigned page_off,
+					    unsigned length)
+{
+	if (flags & (GTF_type_mask | GTF_reading | GTF_writing |
+		     GTF_sub_page))
+		return -EPERM;
+	if (page_off >= PAGE_SIZE || length > PAGE_SIZE - page_off)
+		return -EINVAL;
+
+	if (gnttab_interface->update_subpage_entry == NULL)
+		return -ENOSYS;
+
+	gnttab_interface->update_subpage_entry(ref, domid, frame, flags,
+					       page_off, length);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access_subpage_ref);
+
+int gnttab_grant_foreign_access_subpage(domid_t domid, unsigned long frame,
+					int flags, unsigned page_off,
+					unsigned length)
+{
+	int ref, rc;
+
+	ref = get_free_entries(1);
+	if (unlikely(ref < 0))
+		return -ENOSPC;
+
+	rc = gnttab_grant_foreign_access_subpage_ref(ref, domid, frame, flags,
+						     page_off, length);
+	if (rc < 0) {
+		put_free_entry(ref);
+		return rc;
+	}
+
+	return ref;
+}
+EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access_subpage);
+
+bool gnttab_subpage_grants_available(void)
+{
+	return gnttab_interface->update_subpage_entry != NULL;
+}
+EXPORT_SYMBOL_GPL(gnttab_subpage_grants_available);
+
+static void gnttab_update_trans_entry_v2(grant_ref_t ref, domid_t domid,
+					 int flags, domid_t trans_domid,
+					 grant_ref_t trans_gref)
 {
-	u16 nflags;
+	gnttab_shared.v2[ref].transitive.trans_domid = trans_domid;
+	gnttab_shared.v2[ref].transitive.gref = trans_gref;
+	gnttab_shared.v2[ref].hdr.domid = domid;
+	wmb();
+	gnttab_shared.v2[ref].hdr.flags = GTF_transitive | flags;
+}
 
-	nflags = shared[ref].flags;
+int gnttab_grant_foreign_access_trans_ref(grant_ref_t ref, domid_t domid,
+					  int flags, domid_t trans_domid,
+					  grant_ref_t trans_gref)
+{
+	if (flags & (GTF_type_mask | GTF_reading | GTF_writing |
+		     GTF_sub_page))
+		return -EPERM;
+
+	if (gnttab_interface->update_trans_entry == NULL)
+		return -ENOSYS;
 
-	return (nflags & (GTF_reading|GTF_writing));
+	gnttab_interface->update_trans_entry(ref, domid, flags, trans_domid,
+					     trans_gref);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access_trans_ref);
+
+int gnttab_grant_foreign_access_trans(domid_t domid, int flags,
+				      domid_t trans_domid,
+				      grant_ref_t trans_gref)
+{
+	int ref, rc;
+
+	ref = get_free_entries(1);
+	if (unlikely(ref < 0))
+		return -ENOSPC;
+
+	rc = gnttab_grant_foreign_access_trans_ref(ref, domid, flags,
+						   trans_domid, trans_gref);
+	if (rc < 0) {
+		put_free_entry(ref);
+		return rc;
+	}
+
+	return ref;
+}
+EXPORT_SYMBOL_GPL(gnttab_grant_foreign_access_trans);
+
+bool gnttab_trans_grants_available(void)
+{
+	return gnttab_interface->update_trans_entry != NULL;
+}
+EXPORT_SYMBOL_GPL(gnttab_trans_grants_available);
+
+static int gnttab_query_foreign_access_v1(grant_ref_t ref)
+{
+	return gnttab_shared.v1[ref].flags & (GTF_reading|GTF_writing);
+}
+
+static int gnttab_query_foreign_access_v2(grant_ref_t ref)
+{
+	return grstatus[ref] & (GTF_reading|GTF_writing);
+}
+
+int gnttab_query_foreign_access(grant_ref_t ref)
+{
+	return gnttab_interface->query_foreign_access(ref);
 }
 EXPORT_SYMBOL_GPL(gnttab_query_foreign_access);
 
-int gnttab_end_foreign_access_ref(grant_ref_t ref, int readonly)
+static int gnttab_end_foreign_access_ref_v1(grant_ref_t ref, int readonly)
 {
 	u16 flags, nflags;
+	u16 *pflags;
 
-	nflags = shared[ref].flags;
+	pflags = &gnttab_shared.v1[ref].flags;
+	nflags = *pflags;
 	do {
 		flags = nflags;
-		if (flags & (GTF_reading|GTF_writing)) {
-			printk(KERN_ALERT "WARNING: g.e. still in use!\n");
+		if (flags & (GTF_reading|GTF_writing))
 			return 0;
-		}
-	} while ((nflags = sync_cmpxchg(&shared[ref].flags, flags, 0)) != flags);
+	} while ((nflags = sync_cmpxchg(pflags, flags, 0)) != flags);
 
 	return 1;
 }
+
+/*
+ * With v2 the guest owns the flags word outright: invalidate the entry
+ * first, then look at the status Xen keeps separately.  No cmpxchg
+ * race with Xen is possible.
+ */
+static int gnttab_end_foreign_access_ref_v2(grant_ref_t ref, int readonly)
+{
+	gnttab_shared.v2[ref].hdr.flags = 0;
+	mb();
+	if (grstatus[ref] & (GTF_reading|GTF_writing))
+		return 0;
+
+	/*
+	 * The read of grstatus needs acquire semantics before the page
+	 * is reused.
+	 */
+	mb();
+	return 1;
+}
+
+int gnttab_end_foreign_access_ref(grant_ref_t ref, int readonly)
+{
+	if (gnttab_interface->end_foreign_access_ref(ref, readonly))
+		return 1;
+	printk(KERN_ALERT "WARNING: g.e. still in use!\n");
+	return 0;
+}
 EXPORT_SYMBOL_GPL(gnttab_end_foreign_access_ref);
 
 void gnttab_end_foreign_access(grant_ref_t ref, int readonly,
@@ -245,37 +554,72 @@ EXPORT_SYMBOL_GPL(gnttab_grant_foreign_transfer);
 void gnttab_grant_foreign_transfer_ref(grant_ref_t ref, domid_t domid,
 				       unsigned long pfn)
 {
-	update_grant_entry(ref, domid, pfn, GTF_accept_transfer);
+	gnttab_interface->update_entry(ref, domid, pfn, GTF_accept_transfer);
 }
 EXPORT_SYMBOL_GPL(gnttab_grant_foreign_transfer_ref);
 
-unsigned long gnttab_end_foreign_transfer_ref(grant_ref_t ref)
+static unsigned long gnttab_end_foreign_transfer_ref_v1(grant_ref_t ref)
 {
 	unsigned long frame;
 	u16           flags;
+	u16          *pflags;
+
+	pflags = &gnttab_shared.v1[ref].flags;
 
 	/*
 	 * If a transfer is not even yet started, try to reclaim the grant
 	 * reference and return failure (== 0).
 	 */
-	while (!((flags = shared[ref].flags) & GTF_transfer_committed)) {
-		if (sync_cmpxchg(&shared[ref].flags, flags, 0) == flags)
+	while (!((flags = *pflags) & GTF_transfer_committed)) {
+		if (sync_cmpxchg(pflags, flags, 0) == flags)
 			return 0;
 		cpu_relax();
 	}
 
 	/* If a transfer is in progress then wait until it is completed. */
 	while (!(flags & GTF_transfer_completed)) {
-		flags = shared[ref].flags;
+		flags = *pflags;
+		cpu_relax();
+	}
+
+	rmb();	/* Read the frame number /after/ reading completion status. */
+	frame = gnttab_shared.v1[ref].frame;
+	BUG_ON(frame == 0);
+
+	return frame;
+}
+
+static unsigned long gnttab_end_foreign_transfer_ref_v2(grant_ref_t ref)
+{
+	unsigned long frame;
+	u16           flags;
+	u16          *pflags;
+
+	pflags = &gnttab_shared.v2[ref].hdr.flags;
+
+	/* Transfer entries keep their flags in the entry itself. */
+	while (!((flags = *pflags) & GTF_transfer_committed)) {
+		if (sync_cmpxchg(pflags, flags, 0) == flags)
+			return 0;
+		cpu_relax();
+	}
+
+	while (!(flags & GTF_transfer_completed)) {
+		flags = *pflags;
 		cpu_relax();
 	}
 
 	rmb();	/* Read the frame number /after/ reading completion status. */
-	frame = shared[ref].frame;
+	frame = gnttab_shared.v2[ref].full_page.frame;
 	BUG_ON(frame == 0);
 
 	return frame;
 }
+
+unsigned long gnttab_end_foreign_transfer_ref(grant_ref_t ref)
+{
+	return gnttab_interface->end_foreign_transfer_ref(ref);
+}
 EXPORT_SYMBOL_GPL(gnttab_end_foreign_transfer_ref);
 
 unsigned long gnttab_end_foreign_transfer(grant_ref_t ref)
@@ -362,7 +706,9 @@ void gnttab_request_free_callback(struct gnttab_free_callback *callback,
 	callback->count = count;
 	callback->next = gnttab_free_callback_list;
 	gnttab_free_callback_list = callback;
-	check_free_callbacks();
+	/* Our own cached references may be all that is left. */
+	__gnttab_cache_spill(&__get_cpu_var(gnttab_ref_cache),
+			     __get_cpu_var(gnttab_ref_cache).count);
 out:
 	spin_unlock_irqrestore(&gnttab_list_lock, flags);
 }
@@ -390,11 +736,11 @@ static int grow_gnttab_list(unsigned int more_frames)
 	unsigned int nr_glist_frames, new_nr_glist_frames;
 
 	new_nr_grant_frames = nr_grant_frames + more_frames;
-	extra_entries       = more_frames * GREFS_PER_GRANT_FRAME;
+	extra_entries       = more_frames * grefs_per_grant_frame;
 
-	nr_glist_frames = (nr_grant_frames * GREFS_PER_GRANT_FRAME + RPP - 1) / RPP;
+	nr_glist_frames = (nr_grant_frames * grefs_per_grant_frame + RPP - 1) / RPP;
 	new_nr_glist_frames =
-		(new_nr_grant_frames * GREFS_PER_GRANT_FRAME + RPP - 1) / RPP;
+		(new_nr_grant_frames * grefs_per_grant_frame + RPP - 1) / RPP;
 	for (i = nr_glist_frames; i < new_nr_glist_frames; i++) {
 		gnttab_list[i] = (grant_ref_t *)__get_free_page(GFP_ATOMIC);
 		if (!gnttab_list[i])
@@ -402,12 +748,12 @@ static int grow_gnttab_list(unsigned int more_frames)
 	}
 
 
-	for (i = GREFS_PER_GRANT_FRAME * nr_grant_frames;
-	     i < GREFS_PER_GRANT_FRAME * new_nr_grant_frames - 1; i++)
+	for (i = grefs_per_grant_frame * nr_grant_frames;
+	     i < grefs_per_grant_frame * new_nr_grant_frames - 1; i++)
 		gnttab_entry(i) = i + 1;
 
 	gnttab_entry(i) = gnttab_free_head;
-	gnttab_free_head = GREFS_PER_GRANT_FRAME * nr_grant_frames;
+	gnttab_free_head = grefs_per_grant_frame * nr_grant_frames;
 	gnttab_free_count += extra_entries;
 
 	nr_grant_frames = new_nr_grant_frames;
@@ -446,6 +792,127 @@ unsigned int gnttab_max_grant_frames(void)
 }
 EXPORT_SYMBOL_GPL(gnttab_max_grant_frames);
 
+/* Number of status frames backing @nr_grant_frames v2 shared frames. */
+static unsigned int nr_status_frames(unsigned int nr_grant_frames)
+{
+	return (nr_grant_frames * grefs_per_grant_frame + SPP - 1) / SPP;
+}
+
+static int gnttab_map_frames_v1(unsigned long *frames, unsigned int nr_gframes)
+{
+	int rc;
+
+	rc = arch_gnttab_map_shared(frames, nr_gframes,
+				    gnttab_max_grant_frames(),
+				    &gnttab_shared.addr);
+	BUG_ON(rc);
+
+	return 0;
+}
+
+static void gnttab_unmap_frames_v1(void)
+{
+	arch_gnttab_unmap_shared(gnttab_shared.addr, nr_grant_frames);
+}
+
+static int gnttab_map_frames_v2(unsigned long *frames, unsigned int nr_gframes)
+{
+	struct gnttab_get_status_frames getframes;
+	unsigned int nr_sframes;
+	uint64_t *sframes;
+	int rc;
+
+	/* No need for kzalloc as it is initialized in following hypercall. */
+	nr_sframes = nr_status_frames(nr_gframes);
+	sframes = kmalloc(nr_sframes * sizeof(uint64_t), GFP_ATOMIC);
+	if (!sframes)
+		return -ENOMEM;
+
+	getframes.dom        = DOMID_SELF;
+	getframes.nr_frames  = nr_sframes;
+	set_xen_guest_handle(getframes.frame_list, sframes);
+
+	rc = HYPERVISOR_grant_table_op(GNTTABOP_get_status_frames,
+				       &getframes, 1);
+	if (rc == -ENOSYS) {
+		kfree(sframes);
+		return -ENOSYS;
+	}
+
+	BUG_ON(rc || getframes.status);
+
+	rc = arch_gnttab_map_status(sframes, nr_sframes,
+				    nr_status_frames(gnttab_max_grant_frames()),
+				    &grstatus);
+	BUG_ON(rc);
+	kfree(sframes);
+
+	rc = arch_gnttab_map_shared(frames, nr_gframes,
+				    gnttab_max_grant_frames(),
+				    &gnttab_shared.addr);
+	BUG_ON(rc);
+
+	return 0;
+}
+
+static void gnttab_unmap_frames_v2(void)
+{
+	arch_gnttab_unmap_shared(gnttab_shared.addr, nr_grant_frames);
+	arch_gnttab_unmap_status(grstatus, nr_status_frames(nr_grant_frames));
+}
+
+static const struct gnttab_ops gnttab_v1_ops = {
+	.map_frames			= gnttab_map_frames_v1,
+	.unmap_frames			= gnttab_unmap_frames_v1,
+	.update_entry			= gnttab_update_entry_v1,
+	.end_foreign_access_ref		= gnttab_end_foreign_access_ref_v1,
+	.end_foreign_transfer_ref	= gnttab_end_foreign_transfer_ref_v1,
+	.query_foreign_access		= gnttab_query_foreign_access_v1,
+};
+
+static const struct gnttab_ops gnttab_v2_ops = {
+	.map_frames			= gnttab_map_frames_v2,
+	.unmap_frames			= gnttab_unmap_frames_v2,
+	.update_entry			= gnttab_update_entry_v2,
+	.end_foreign_access_ref		= gnttab_end_foreign_access_ref_v2,
+	.end_foreign_transfer_ref	= gnttab_end_foreign_transfer_ref_v2,
+	.query_foreign_access		= gnttab_query_foreign_access_v2,
+	.update_subpage_entry		= gnttab_update_subpage_entry_v2,
+	.update_trans_entry		= gnttab_update_trans_entry_v2,
+};
+
+/*
+ * Pick the table layout.  A PV guest asks for v2; HVM guests keep v1,
+ * whose frames are placed in the platform device's MMIO window.  The
+ * choice made at boot sticks across suspend/resume: a new domain
+ * starts with a v1 table, so v2 has to be requested again.
+ */
+static void gnttab_request_version(void)
+{
+	struct gnttab_set_version gsv;
+	int rc;
+
+	if (grant_table_version == 0 && xen_pv_domain() && gnttab_v2_allowed)
+		grant_table_version = 2;
+
+	if (grant_table_version == 2) {
+		gsv.version = 2;
+		rc = HYPERVISOR_grant_table_op(GNTTABOP_set_version, &gsv, 1);
+		if (rc == 0) {
+			gnttab_interface = &gnttab_v2_ops;
+			grefs_per_grant_frame =
+				PAGE_SIZE / sizeof(union grant_entry_v2);
+			return;
+		}
+		if (gnttab_interface != NULL)
+			panic("xen: grant table version 2 in use, but not available after resume\n");
+	}
+
+	grant_table_version = 1;
+	gnttab_interface = &gnttab_v1_ops;
+	grefs_per_grant_frame = PAGE_SIZE / sizeof(struct grant_entry);
+}
+
 static int gnttab_map(unsigned int start_idx, unsigned int end_idx)
 {
 	struct gnttab_setup_table setup;
@@ -493,13 +960,11 @@ static int gnttab_map(unsigned int start_idx, unsigned int end_idx)
 
 	BUG_ON(rc || setup.status);
 
-	rc = arch_gnttab_map_shared(frames, nr_gframes, gnttab_max_grant_frames(),
-				    &shared);
-	BUG_ON(rc);
+	rc = gnttab_interface->map_frames(frames, nr_gframes);
 
 	kfree(frames);
 
-	return 0;
+	return rc;
 }
 
 static void gnttab_page_free(struct page *page, unsigned int order)
@@ -600,6 +1065,73 @@ void gnttab_reset_grant_page(struct page *page)
 }
 EXPORT_SYMBOL_GPL(gnttab_reset_grant_page);
 
+/*
+ * Map @count grant references with a single hypercall.  Xen then
+ * flushes the TLB once for the whole batch instead of once per op.
+ *
+ * If @pages is given, the p2m entry of each pages[i] whose map
+ * succeeded is pointed at the foreign frame, so the page can be used
+ * for I/O.  Entries whose op failed are left alone.  The status of
+ * each op is in map_ops[i].status.  The return value is the
+ * hypercall's own, and is nonzero only if the batch as a whole was
+ * rejected.
+ */
+int gnttab_map_refs(struct gnttab_map_grant_ref *map_ops,
+		    struct page **pages, unsigned int count)
+{
+	unsigned int i;
+	int ret;
+
+	if (count == 0)
+		return 0;
+
+	ret = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, map_ops, count);
+	if (ret)
+		return ret;
+
+	if (pages == NULL || xen_feature(XENFEAT_auto_translated_physmap))
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(map_ops[i].status != GNTST_okay))
+			continue;
+		set_phys_to_machine(page_to_pfn(pages[i]),
+				    FOREIGN_FRAME(map_ops[i].dev_bus_addr >>
+						  PAGE_SHIFT));
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gnttab_map_refs);
+
+/*
+ * Undo gnttab_map_refs(): one unmap hypercall for the whole batch,
+ * then, if @pages is given, invalidate their p2m entries again.
+ */
+int gnttab_unmap_refs(struct gnttab_unmap_grant_ref *unmap_ops,
+		      struct page **pages, unsigned int count)
+{
+	unsigned int i;
+	int ret;
+
+	if (count == 0)
+		return 0;
+
+	ret = HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, unmap_ops,
+					count);
+	if (ret)
+		return ret;
+
+	if (pages == NULL || xen_feature(XENFEAT_auto_translated_physmap))
+		return 0;
+
+	for (i = 0; i < count; i++)
+		set_phys_to_machine(page_to_pfn(pages[i]), INVALID_P2M_ENTRY);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gnttab_unmap_refs);
+
 int gnttab_resume(void)
 {
 	unsigned int max_nr_gframes;
@@ -608,12 +1140,15 @@ int gnttab_resume(void)
 	if (max_nr_gframes < nr_grant_frames)
 		return -ENOSYS;
 
+	gnttab_request_version();
+
 	if (xen_pv_domain())
 		return gnttab_map(0, nr_grant_frames - 1);
 
-	if (!shared) {
-		shared = ioremap(xen_hvm_resume_frames, PAGE_SIZE * max_nr_gframes);
-		if (shared == NULL) {
+	if (!gnttab_shared.addr) {
+		gnttab_shared.addr = ioremap(xen_hvm_resume_frames,
+					     PAGE_SIZE * max_nr_gframes);
+		if (gnttab_shared.addr == NULL) {
 			printk(KERN_WARNING
 					"Failed to ioremap gnttab share frames!");
 			return -ENOMEM;
@@ -627,7 +1162,7 @@ int gnttab_resume(void)
 
 int gnttab_suspend(void)
 {
-	arch_gnttab_unmap_shared(shared, nr_grant_frames);
+	gnttab_interface->unmap_frames();
 	return 0;
 }
 
@@ -637,8 +1172,8 @@ static int gnttab_expand(unsigned int req_entries)
 	unsigned int cur, extra;
 
 	cur = nr_grant_frames;
-	extra = ((req_entries + (GREFS_PER_GRANT_FRAME-1)) /
-		 GREFS_PER_GRANT_FRAME);
+	extra = ((req_entries + (grefs_per_grant_frame-1)) /
+		 grefs_per_grant_frame);
 	if (cur + extra > gnttab_max_grant_frames())
 		return -ENOSPC;
 
@@ -649,6 +1184,30 @@ static int gnttab_expand(unsigned int req_entries)
 	return rc;
 }
 
+static int gnttab_cpu_notification(struct notifier_block *self,
+				   unsigned long action, void *hcpu)
+{
+	int cpu = (long)hcpu;
+	struct gnttab_ref_cache *cache = &per_cpu(gnttab_ref_cache, cpu);
+	unsigned long flags;
+
+	switch (action) {
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		spin_lock_irqsave(&gnttab_list_lock, flags);
+		__gnttab_cache_spill(cache, cache->count);
+		spin_unlock_irqrestore(&gnttab_list_lock, flags);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block gnttab_cpu_notifier = {
+	.notifier_call	= gnttab_cpu_notification,
+};
+
 int gnttab_init(void)
 {
 	int i;
@@ -658,18 +1217,21 @@ int gnttab_init(void)
 	nr_grant_frames = 1;
 	boot_max_nr_grant_frames = __max_nr_grant_frames();
 
+	/* The entry size, and so the free list size, depends on the version. */
+	gnttab_request_version();
+
 	/* Determine the maximum number of frames required for the
 	 * grant reference free list on the current hypervisor.
 	 */
 	max_nr_glist_frames = (boot_max_nr_grant_frames *
-			       GREFS_PER_GRANT_FRAME / RPP);
+			       grefs_per_grant_frame / RPP);
 
 	gnttab_list = kmalloc(max_nr_glist_frames * sizeof(grant_ref_t *),
 			      GFP_KERNEL);
 	if (gnttab_list == NULL)
 		return -ENOMEM;
 
-	nr_glist_frames = (nr_grant_frames * GREFS_PER_GRANT_FRAME + RPP - 1) / RPP;
+	nr_glist_frames = (nr_grant_frames * grefs_per_grant_frame + RPP - 1) / RPP;
 	for (i = 0; i < nr_glist_frames; i++) {
 		gnttab_list[i] = (grant_ref_t *)__get_free_page(GFP_KERNEL);
 		if (gnttab_list[i] == NULL)
@@ -679,7 +1241,7 @@ int gnttab_init(void)
 	if (gnttab_resume() < 0)
 		return -ENODEV;
 
-	nr_init_grefs = nr_grant_frames * GREFS_PER_GRANT_FRAME;
+	nr_init_grefs = nr_grant_frames * grefs_per_grant_frame;
 
 	for (i = NR_RESERVED_ENTRIES; i < nr_init_grefs - 1; i++)
 		gnttab_entry(i) = i + 1;
@@ -688,7 +1250,9 @@ int gnttab_init(void)
 	gnttab_free_count = nr_init_grefs - NR_RESERVED_ENTRIES;
 	gnttab_free_head  = NR_RESERVED_ENTRIES;
 
-	printk("Grant table initialized\n");
+	register_hotcpu_notifier(&gnttab_cpu_notifier);
+
+	printk("Grant table initialized (version %d)\n", grant_table_version);
 	return 0;
 
  ini_nomem:
@@ -32,6 +32,57 @@ enum shutdown_state {
 /* Ignore multiple shutdown requests. */
 static enum shutdown_state shutting_down = SHUTDOWN_INVALID;
 
+#ifdef CONFIG_HIBERNATION
+/*
+ * Where the time goes in a suspend, so migration downtime can be
+ * attributed: each entry is the end of a phase, reported in
+ * microseconds from the one before once the guest is running again.
+ */
+enum suspend_phase {
+	SP_FREEZE,		/* processes frozen */
+	SP_DEVICES_SUSPEND,	/* dpm_suspend_start, xs_suspend */
+	SP_NOIRQ_SUSPEND,	/* dpm_suspend_noirq */
+	SP_HYPERCALL,		/* stop_machine + SCHEDOP_shutdown */
+	SP_NOIRQ_RESUME,	/* dpm_resume_noirq */
+	SP_XS_RESUME,		/* xen_arch_resume, xs_resume */
+	SP_DEVICES_RESUME,	/* dpm_resume_end */
+	SP_RECONNECT,		/* frontends' backend handshakes */
+	SP_NR
+};
+
+static const char *suspend_phase_name[SP_NR] = {
+	"freeze", "devices", "noirq", "hypercall", "noirq-resume",
+	"xs-resume", "devices-resume", "reconnect",
+};
+
+static ktime_t suspend_phase_end[SP_NR];
+
+static void suspend_phase_done(enum suspend_phase phase)
+{
+	suspend_phase_end[phase] = ktime_get();
+}
+
+static void suspend_phase_report(ktime_t start, int cancelled)
+{
+	char buf[256];
+	ktime_t prev = start;
+	int i, n = 0;
+
+	for (i = 0; i < SP_NR; i++) {
+		if (!suspend_phase_end[i].tv64)
+			continue;
+		n += scnprintf(buf + n, sizeof(buf) - n, " %s %lld",
+			       suspend_phase_name[i],
+			       ktime_us_delta(suspend_phase_end[i], prev));
+		prev = suspend_phase_end[i];
+	}
+
+	printk(KERN_INFO "xen suspend%s: %lldus:%s\n",
+	       cancelled ? " (cancelled)" : "",
+	       ktime_us_delta(prev, start), buf);
+}
+#endif
+
 struct suspend_info {
 	int cancelled;
 	unsigned long arg; /* extra hypercall argument */
@@ -102,9 +153,14 @@ static void do_suspend(void)
 {
 	int err;
 	struct suspend_info si;
+	ktime_t start;
 
 	shutting_down = SHUTDOWN_SUSPEND;
 
+	memset(suspend_phase_end, 0, sizeof(suspend_phase_end));
+	start = ktime_get();
+	si.cancelled = 1;
+
 	err = stop_machine_create();
 	if (err) {
 		printk(KERN_ERR "xen suspend: failed to setup stop_machine %d\n", err);
@@ -120,6 +176,7 @@ static void do_suspend(void)
 		printk(KERN_ERR "xen suspend: freeze failed %d\n", err);
 		goto out_destroy_sm;
 	}
+	suspend_phase_done(SP_FREEZE);
 #endif
 
 	err = dpm_suspend_start(PMSG_FREEZE);
@@ -130,14 +187,14 @@ static void do_suspend(void)
 
 	printk(KERN_DEBUG "suspending xenstore...\n");
 	xs_suspend();
+	suspend_phase_done(SP_DEVICES_SUSPEND);
 
 	err = dpm_suspend_noirq(PMSG_FREEZE);
 	if (err) {
 		printk(KERN_ERR "dpm_suspend_noirq failed: %d\n", err);
 		goto out_resume;
 	}
-
-	si.cancelled = 1;
+	suspend_phase_done(SP_NOIRQ_SUSPEND);
 
 	if (xen_hvm_domain()) {
 		si.arg = 0UL;
@@ -150,8 +207,10 @@ static void do_suspend(void)
 	}
 
 	err = stop_machine(xen_suspend, &si, cpumask_of(0));
+	suspend_phase_done(SP_HYPERCALL);
 
 	dpm_resume_noirq(si.cancelled ? PMSG_THAW : PMSG_RESTORE);
+	suspend_phase_done(SP_NOIRQ_RESUME);
 
 	if (err) {
 		printk(KERN_ERR "failed to start xen_suspend: %d\n", err);
@@ -162,10 +221,18 @@ out_resume:
 	if (!si.cancelled) {
 		xen_arch_resume();
 		xs_resume();
+		suspend_phase_done(SP_XS_RESUME);
+		xenbus_dev_resume_start_async();
 	} else
 		xs_suspend_cancel();
 
 	dpm_resume_end(si.cancelled ? PMSG_THAW : PMSG_RESTORE);
+	suspend_phase_done(SP_DEVICES_RESUME);
+
+	if (!si.cancelled) {
+		xenbus_dev_resume_wait();
+		suspend_phase_done(SP_RECONNECT);
+	}
 
 	/* Make sure timer events get retriggered on all CPUs */
 	clock_was_set();
@@ -178,6 +245,7 @@ out_destroy_sm:
 #endif
 	stop_machine_destroy();
 
+	suspend_phase_report(start, si.cancelled);
 out:
 	shutting_down = SHUTDOWN_INVALID;
 }
@@ -39,6 +39,8 @@
 #include <linux/etherdevice.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/rbtree.h>
+#include <linux/hrtimer.h>
 
 #include <xen/interface/io/netif.h>
 #include <asm/io.h>
@@ -55,12 +57,52 @@
 #define WPRINTK(fmt, args...)				\
 	printk(KERN_WARNING "xen_net: " fmt, ##args)
 
+/* Upper bound on the number of queue pairs a single vif can negotiate. */
+#define NETBK_MAX_QUEUES 8
+
+/* A frontend TX buffer that stays mapped for the lifetime of the rings. */
+struct netbk_persistent_gnt {
+	struct rb_node node;
+	grant_ref_t gref;
+	grant_handle_t handle;
+	struct page *page;
+};
+
+/*
+ * Token bucket: 'rate' bytes per second accrue up to 'burst' bytes, and
+ * rate == 0 leaves the bucket unlimited.  A frame may go once the bucket
+ * holds min(size, burst) bytes and is then charged in full, so frames
+ * bigger than the burst still pass but are paid back before the next.
+ */
+struct netbk_tbf {
+	u64     rate;
+	u64     burst;
+	s64     tokens;
+	ktime_t last;
+};
+
+/* Keeps the refill arithmetic within 64 bits. */
+#define NETBK_MAX_BURST ((u64)UINT_MAX)
+
+void netbk_tbf_init(struct netbk_tbf *tbf, u64 rate, u64 burst);
+
 struct xen_netif {
 	/* Unique identifier for this interface. */
 	domid_t          domid;
 	int              group;
 	unsigned int     handle;
 
+	/*
+	 * Multi-queue support.  Every queue is a complete xen_netif with
+	 * its own rings, event channel and netback group.  Queue 0 lives
+	 * in the net_device private area and owns the device; the queues[]
+	 * table is only valid there.
+	 */
+	unsigned int     queue_index;
+	unsigned int     num_queues;
+	struct xen_netif *queues[NETBK_MAX_QUEUES];
+	char             irq_name[IFNAMSIZ + 4];
+
 	u8               fe_dev_addr[6];
 
 	/* Physical parameters of the comms window. */
@@ -85,27 +127,74 @@ struct xen_netif {
 	u8 gso_prefix:1;
 	u8 csum:1;
 	u8 smart_poll:1;
+	u8 persistent:1;    /* TX buffers are persistently granted */
 
 	/* Internal feature information. */
 	u8 can_queue:1;	    /* can queue packets for receiver? */
+	u8 tx_copy_headers:1; /* grant-copy TX headers instead of mapping? */
+
+	/* TX frames up to this size are grant-copied whole (0: never). */
+	unsigned int tx_copy_threshold;
+
+	/*
+	 * Node the guest's memory lives on, -1 if unknown.  Only queue 0's
+	 * is used: it steers every queue of the vif to groups on that node.
+	 */
+	int numa_node;
+
+	/*
+	 * Entry in the local switching table, keyed by fe_dev_addr.  Only
+	 * queue 0 is hashed, while the vif is connected.
+	 */
+	struct hlist_node switch_node;
+
+	/*
+	 * Persistent grants: TX buffers mapped on first use and looked up
+	 * by grant reference afterwards.  The pool is allocated when the
+	 * rings are mapped and torn down with them.
+	 */
+	struct rb_root persistent_gnts;
+	unsigned int persistent_gnt_c;
+	struct netbk_persistent_gnt *persistent_pool;
+	struct page **persistent_pages;
 
 	/* Allow netif_be_start_xmit() to peek ahead in the rx request
 	 * ring.  This is a prediction of what rx_req_cons will be once
 	 * all queued skbs are put on the ring. */
 	RING_IDX rx_req_cons_peek;
 
-	/* Transmit shaping: allow 'credit_bytes' every 'credit_usec'. */
-	unsigned long   credit_bytes;
-	unsigned long   credit_usec;
-	unsigned long   remaining_credit;
-	struct timer_list credit_timeout;
+	/*
+	 * Shaping of traffic from (tx) and to (rx) the guest, nested
+	 * inside the group's buckets.  The hrtimers restart the vif once
+	 * the buckets have refilled.
+	 */
+	struct netbk_tbf tx_tbf;
+	struct netbk_tbf rx_tbf;
+	struct hrtimer   tx_shaper;
+	struct hrtimer   rx_shaper;
 
-	/* Statistics */
-	int nr_copied_skbs;
-	int rx_gso_checksum_fixup;
+	/*
+	 * Statistics, reported through ethtool -S.  As in net_tx_action
+	 * and net_rx_action, "tx" is traffic from the guest and "rx"
+	 * traffic to it.
+	 */
+	unsigned long nr_copied_skbs;
+	unsigned long rx_gso_checksum_fixup;
+	unsigned long nr_tx_map_ops;
+	unsigned long nr_tx_copy_ops;
+	unsigned long nr_tx_pending_full;
+	unsigned long nr_tx_credit_throttled;	/* held back by a shaper */
+	unsigned long nr_rx_copy_ops;
+	unsigned long nr_rx_copy_skbs;
+	unsigned long nr_rx_ring_full;
+	unsigned long nr_local_switched;	/* bypassed the bridge */
+
+	/* Polls the TX ring when netback runs in NAPI mode. */
+	struct napi_struct napi;
 
 	/* Miscellaneous private stuff. */
 	struct list_head list;  /* scheduling list */
+	struct list_head notify_list; /* vifs net_rx_action will kick */
 	atomic_t         refcnt;
 	struct net_device *dev;
 	struct net_device_stats stats;
@@ -189,13 +278,51 @@ void netif_accel_init(void);
 #define NET_TX_RING_SIZE __RING_SIZE((struct xen_netif_tx_sring *)0, PAGE_SIZE)
 #define NET_RX_RING_SIZE __RING_SIZE((struct xen_netif_rx_sring *)0, PAGE_SIZE)
 
+/* A well-behaved frontend grants at most one buffer per TX ring slot. */
+#define NETBK_MAX_PERSISTENT_GNTS NET_TX_RING_SIZE
+
 void netif_disconnect(struct xen_netif *netif);
 
 void netif_set_features(struct xen_netif *netif);
 struct xen_netif *netif_alloc(struct device *parent, domid_t domid, unsigned int handle);
+int netif_alloc_queues(struct xen_netif *netif, unsigned int num_queues);
 int netif_map(struct xen_netif *netif, unsigned long tx_ring_ref,
 	      unsigned long rx_ring_ref, unsigned int evtchn);
 
+extern unsigned int netbk_max_queues;
+
+/* Largest TX frame netback will grant-copy whole into the linear area. */
+#define NETBK_MAX_TX_COPY_THRESHOLD 2048
+
+void netif_set_tx_copy(struct xen_netif *netif, int copy_headers,
+		       unsigned int threshold);
+
+void netbk_init_shapers(struct xen_netif *netif);
+
+void netbk_switch_add(struct xen_netif *netif);
+void netbk_switch_del(struct xen_netif *netif);
+
+extern int netbk_feature_persistent;
+
+int netbk_alloc_persistent_gnts(struct xen_netif *netif);
+void netbk_free_persistent_gnts(struct xen_netif *netif);
+
+/* The queue an skb queued on a vif's net_device should be delivered to. */
+static inline struct xen_netif *netif_skb_queue(struct sk_buff *skb)
+{
+	struct xen_netif *netif = netdev_priv(skb->dev);
+	u16 index = skb_get_queue_mapping(skb);
+
+	if (unlikely(index >= netif->num_queues))
+		index = 0;
+	return netif->queues[index];
+}
+
+static inline struct netdev_queue *netif_txq(struct xen_netif *netif)
+{
+	return netdev_get_tx_queue(netif->dev, netif->queue_index);
+}
+
 static inline void netif_get(struct xen_netif *netif)
 {
 	atomic_inc(&netif->refcnt);
@@ -213,6 +340,10 @@ int netif_xenbus_init(void);
 	(netif_running((netif)->dev) && netback_carrier_ok(netif))
 
 void netif_schedule_work(struct xen_netif *netif);
+
+extern int netbk_tx_napi;
+int netbk_tx_napi_poll(struct napi_struct *napi, int budget);
+
 void netif_deschedule_work(struct xen_netif *netif);
 
 int netif_be_start_xmit(struct sk_buff *skb, struct net_device *dev);
@@ -248,7 +379,16 @@ struct netbk_tx_pending_inuse {
 	unsigned long alloc_time;
 };
 
-#define MAX_PENDING_REQS 256
+/*
+ * Pending TX slots per group.  A group starts out with
+ * NETBK_MIN_PENDING_REQS slots and grows by that many at a time while
+ * its vifs keep it saturated, up to the max_pending_reqs module
+ * parameter (a power of two no larger than NETBK_MAX_PENDING_REQS).
+ */
+#define NETBK_MIN_PENDING_REQS 256
+#define NETBK_MAX_PENDING_REQS 4096
+#define NETBK_MAX_PENDING_CHUNKS \
+	(NETBK_MAX_PENDING_REQS / NETBK_MIN_PENDING_REQS)
 
 #define MAX_BUFFER_OFFSET PAGE_SIZE
 
@@ -256,7 +396,7 @@ struct netbk_tx_pending_inuse {
 union page_ext {
 	struct {
 #if BITS_PER_LONG < 64
-#define IDX_WIDTH   8
+#define IDX_WIDTH   12
 #define GROUP_WIDTH (BITS_PER_LONG - IDX_WIDTH)
 		unsigned int group:GROUP_WIDTH;
 		unsigned int idx:IDX_WIDTH;
@@ -267,6 +407,26 @@ union page_ext {
 	void *mapping;
 };
 
+/*
+ * Per-group hypercall counters, exported under
+ * <debugfs>/xen-netback/group-N/.  Dividing the ops by the batches
+ * gives the mean hypercall batch size.
+ */
+struct netbk_group_stats {
+	u64 tx_map_batches;
+	u64 tx_map_ops;
+	u64 tx_copy_batches;
+	u64 tx_copy_ops;
+	u64 tx_unmap_batches;
+	u64 tx_unmap_ops;
+	u64 rx_copy_batches;
+	u64 rx_copy_ops;
+	u32 tx_batch_max;
+	u32 rx_batch_max;
+	/* Times TX stopped with vifs waiting and no pending slots free. */
+	u64 pending_exhausted;
+};
+
 struct xen_netbk {
 	union {
 		struct {
@@ -287,6 +447,15 @@ struct xen_netbk {
 	struct timer_list netbk_tx_pending_timer;
 
 	struct page **mmap_pages;
+	struct page **mmap_chunks[NETBK_MAX_PENDING_CHUNKS];
+
+	/* Size of the pending rings and arrays below (a power of two). */
+	unsigned int max_pending_reqs;
+	/* Slots backed by mmap_pages and in circulation. */
+	unsigned int nr_pending_slots;
+	/* Slots set up by pending_grow_work, not yet handed to TX. */
+	unsigned int pending_grow;
+	struct work_struct pending_grow_work;
 
 	pending_ring_idx_t pending_prod;
 	pending_ring_idx_t pending_cons;
@@ -299,16 +468,29 @@ struct xen_netbk {
 	/* Protect the net_schedule_list in netif. */
 	spinlock_t net_schedule_list_lock;
 
-	atomic_t netfront_count;
+	/*
+	 * Serialises TX processing: the pending ring and the op arrays
+	 * are shared by every vif in the group, whose NAPI contexts may
+	 * poll on different CPUs.
+	 */
+	spinlock_t tx_lock;
 
-	struct pending_tx_info pending_tx_info[MAX_PENDING_REQS];
-	struct netbk_tx_pending_inuse pending_inuse[MAX_PENDING_REQS];
-	struct gnttab_unmap_grant_ref tx_unmap_ops[MAX_PENDING_REQS];
-	struct gnttab_map_grant_ref tx_map_ops[MAX_PENDING_REQS];
+	atomic_t netfront_count;
 
-	grant_handle_t grant_tx_handle[MAX_PENDING_REQS];
-	u16 pending_ring[MAX_PENDING_REQS];
-	u16 dealloc_ring[MAX_PENDING_REQS];
+	/* All max_pending_reqs long, allocated with the group. */
+	struct pending_tx_info *pending_tx_info;
+	struct netbk_tx_pending_inuse *pending_inuse;
+	struct gnttab_unmap_grant_ref *tx_unmap_ops;
+	struct gnttab_map_grant_ref *tx_map_ops;
+	/* The slot page behind each of tx_unmap_ops/tx_map_ops. */
+	struct page **tx_unmap_pages;
+	struct page **tx_map_pages;
+	/* Each pending slot needs at most two copies (see netbk_tx_copy_slot). */
+	struct gnttab_copy *tx_copy_ops;
+
+	grant_handle_t *grant_tx_handle;
+	u16 *pending_ring;
+	u16 *dealloc_ring;
 
 	/*
 	 * Each head or fragment can be up to 4096 bytes. Given
@@ -316,9 +498,22 @@ struct xen_netbk {
 	 * head/fragment uses 2 copy operation.
 	 */
 	struct gnttab_copy grant_copy_op[2*NET_RX_RING_SIZE];
-	unsigned char rx_notify[NR_IRQS];
-	u16 notify_list[NET_RX_RING_SIZE];
 	struct netbk_rx_meta meta[2*NET_RX_RING_SIZE];
+
+	struct netbk_group_stats stats;
+	struct dentry *debugfs_dir;
+
+	/*
+	 * Aggregate limits for all vifs of the group.  TX is serialised
+	 * by tx_lock; RX is charged from start_xmit on any CPU, hence
+	 * rx_tbf_lock.
+	 */
+	struct netbk_tbf tx_tbf;
+	struct netbk_tbf rx_tbf;
+	spinlock_t rx_tbf_lock;
+
+	/* NUMA node of the CPU serving this group. */
+	int node;
 };
 
 extern struct xen_netbk *xen_netbk;
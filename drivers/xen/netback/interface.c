@@ -46,21 +46,55 @@
 static unsigned long netbk_queue_length = 32;
 module_param_named(queue_length, netbk_queue_length, ulong, 0644);
 
-static void netbk_add_netif(struct xen_netbk *netbk, int group_nr,
-			   struct xen_netif *netif)
+/*
+ * Module parameters 'tx_copy_headers' and 'tx_copy_threshold':
+ *
+ * Default TX mode for new interfaces.  Headers are grant-copied instead of
+ * mapped, and whole frames up to tx_copy_threshold bytes are copied so that
+ * no grant needs to be unmapped (and no TLB flushed) afterwards.  The
+ * toolstack can override both per vif in the backend directory.
+ */
+static int netbk_tx_copy_headers = 1;
+module_param_named(tx_copy_headers, netbk_tx_copy_headers, bool, 0644);
+MODULE_PARM_DESC(tx_copy_headers, "Grant-copy TX packet headers");
+
+static unsigned int netbk_tx_copy_threshold;
+module_param_named(tx_copy_threshold, netbk_tx_copy_threshold, uint, 0644);
+MODULE_PARM_DESC(tx_copy_threshold,
+		 "Grant-copy TX packets up to this size instead of mapping");
+
+/* The least loaded group on @node (any node if -1), or -1 if none is. */
+static int netbk_least_loaded_group(struct xen_netbk *netbk, int group_nr,
+				    int node)
 {
 	int i;
-	int min_netfront_count;
-	int min_group = 0;
-	min_netfront_count = atomic_read(&netbk[0].netfront_count);
+	int min_netfront_count = INT_MAX;
+	int min_group = -1;
+
 	for (i = 0; i < group_nr; i++) {
 		int netfront_count = atomic_read(&netbk[i].netfront_count);
+		if (node >= 0 && netbk[i].node != node)
+			continue;
 		if (netfront_count < min_netfront_count) {
 			min_group = i;
 			min_netfront_count = netfront_count;
 		}
 	}
 
+	return min_group;
+}
+
+static void netbk_add_netif(struct xen_netbk *netbk, int group_nr,
+			   struct xen_netif *netif)
+{
+	struct xen_netif *vif = netdev_priv(netif->dev);
+	int min_group;
+
+	/* Keep grant copies on the node holding the guest's memory. */
+	min_group = netbk_least_loaded_group(netbk, group_nr, vif->numa_node);
+	if (min_group < 0)
+		min_group = netbk_least_loaded_group(netbk, group_nr, -1);
+
 	netif->group = min_group;
 	atomic_inc(&netbk[netif->group].netfront_count);
 }
@@ -73,6 +107,8 @@ static void netbk_remove_netif(struct xen_netbk *netbk, struct xen_netif *netif)
 static void __netif_up(struct xen_netif *netif)
 {
 	netbk_add_netif(xen_netbk, xen_netbk_group_nr, netif);
+	if (netbk_tx_napi)
+		napi_enable(&netif->napi);
 	enable_irq(netif->irq);
 	netif_schedule_work(netif);
 }
@@ -80,6 +116,8 @@ static void __netif_up(struct xen_netif *netif)
 static void __netif_down(struct xen_netif *netif)
 {
 	disable_irq(netif->irq);
+	if (netbk_tx_napi)
+		napi_disable(&netif->napi);
 	netif_deschedule_work(netif);
 	netbk_remove_netif(xen_netbk, netif);
 }
@@ -87,9 +125,13 @@ static void __netif_down(struct xen_netif *netif)
 static int net_open(struct net_device *dev)
 {
 	struct xen_netif *netif = netdev_priv(dev);
+	unsigned int i;
+
 	if (netback_carrier_ok(netif)) {
-		__netif_up(netif);
-		netif_start_queue(dev);
+		for (i = 0; i < netif->num_queues; i++)
+			if (netback_carrier_ok(netif->queues[i]))
+				__netif_up(netif->queues[i]);
+		netif_tx_start_all_queues(dev);
 	}
 	return 0;
 }
@@ -97,9 +139,12 @@ static int net_open(struct net_device *dev)
 static int net_close(struct net_device *dev)
 {
 	struct xen_netif *netif = netdev_priv(dev);
-	if (netback_carrier_ok(netif))
-		__netif_down(netif);
-	netif_stop_queue(dev);
+	unsigned int i;
+
+	for (i = 0; i < netif->num_queues; i++)
+		if (netback_carrier_ok(netif->queues[i]))
+			__netif_down(netif->queues[i]);
+	netif_tx_stop_all_queues(dev);
 	return 0;
 }
 
@@ -197,6 +242,38 @@ static const struct netif_stat {
 		"rx_gso_checksum_fixup",
 		offsetof(struct xen_netif, rx_gso_checksum_fixup)
 	},
+	{
+		"tx_grant_map_ops",
+		offsetof(struct xen_netif, nr_tx_map_ops)
+	},
+	{
+		"tx_grant_copy_ops",
+		offsetof(struct xen_netif, nr_tx_copy_ops)
+	},
+	{
+		"tx_pending_slots_exhausted",
+		offsetof(struct xen_netif, nr_tx_pending_full)
+	},
+	{
+		"tx_credit_throttled",
+		offsetof(struct xen_netif, nr_tx_credit_throttled)
+	},
+	{
+		"rx_grant_copy_ops",
+		offsetof(struct xen_netif, nr_rx_copy_ops)
+	},
+	{
+		"rx_copy_skb_fallbacks",
+		offsetof(struct xen_netif, nr_rx_copy_skbs)
+	},
+	{
+		"rx_ring_full_drops",
+		offsetof(struct xen_netif, nr_rx_ring_full)
+	},
+	{
+		"tx_local_switched",
+		offsetof(struct xen_netif, nr_local_switched)
+	},
 };
 
 static int netbk_get_sset_count(struct net_device *dev, int string_set)
@@ -212,11 +289,18 @@ static int netbk_get_sset_count(struct net_device *dev, int string_set)
 static void netbk_get_ethtool_stats(struct net_device *dev,
 				   struct ethtool_stats *stats, u64 * data)
 {
-	void *netif = netdev_priv(dev);
+	struct xen_netif *netif = netdev_priv(dev);
+	unsigned int q;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(netbk_stats); i++)
-		data[i] = *(int *)(netif + netbk_stats[i].offset);
+	for (i = 0; i < ARRAY_SIZE(netbk_stats); i++) {
+		data[i] = 0;
+		for (q = 0; q < netif->num_queues; q++) {
+			void *queue = netif->queues[q];
+			data[i] += *(unsigned long *)(queue +
+						      netbk_stats[i].offset);
+		}
+	}
 }
 
 static void netbk_get_strings(struct net_device *dev, u32 stringset, u8 * data)
@@ -258,6 +342,43 @@ static struct net_device_ops netback_ops =
 	.ndo_change_mtu	= netbk_change_mtu,
 };
 
+static void netif_init_queue(struct xen_netif *queue, struct net_device *dev,
+			     domid_t domid, unsigned int handle,
+			     unsigned int index)
+{
+	queue->domid  = domid;
+	queue->group  = -1;
+	queue->handle = handle;
+	queue->queue_index = index;
+	queue->can_sg = 1;
+	queue->csum = 1;
+	atomic_set(&queue->refcnt, 1);
+	init_waitqueue_head(&queue->waiting_to_free);
+	queue->dev = dev;
+	INIT_LIST_HEAD(&queue->list);
+	INIT_LIST_HEAD(&queue->notify_list);
+	INIT_HLIST_NODE(&queue->switch_node);
+	queue->numa_node = -1;
+
+	netback_carrier_off(queue);
+
+	netbk_init_shapers(queue);
+
+	netif_set_tx_copy(queue, netbk_tx_copy_headers,
+			  netbk_tx_copy_threshold);
+
+	if (netbk_tx_napi)
+		netif_napi_add(dev, &queue->napi, netbk_tx_napi_poll, 64);
+}
+
+void netif_set_tx_copy(struct xen_netif *netif, int copy_headers,
+		       unsigned int threshold)
+{
+	netif->tx_copy_headers = !!copy_headers;
+	netif->tx_copy_threshold = min_t(unsigned int, threshold,
+					 NETBK_MAX_TX_COPY_THRESHOLD);
+}
+
 struct xen_netif *netif_alloc(struct device *parent, domid_t domid, unsigned int handle)
 {
 	int err = 0;
@@ -266,7 +387,8 @@ struct xen_netif *netif_alloc(struct device *parent, domid_t domid, unsigned int
 	char name[IFNAMSIZ] = {};
 
 	snprintf(name, IFNAMSIZ - 1, "vif%u.%u", domid, handle);
-	dev = alloc_netdev(sizeof(struct xen_netif), name, ether_setup);
+	dev = alloc_netdev_mq(sizeof(struct xen_netif), name, ether_setup,
+			      NETBK_MAX_QUEUES);
 	if (dev == NULL) {
 		DPRINTK("Could not create netif: out of memory\n");
 		return ERR_PTR(-ENOMEM);
@@ -274,25 +396,14 @@ struct xen_netif *netif_alloc(struct device *parent, domid_t domid, unsigned int
 
 	SET_NETDEV_DEV(dev, parent);
 
+	/* Only one queue until the frontend asks for more. */
+	dev->real_num_tx_queues = 1;
+
 	netif = netdev_priv(dev);
 	memset(netif, 0, sizeof(*netif));
-	netif->domid  = domid;
-	netif->group  = -1;
-	netif->handle = handle;
-	netif->can_sg = 1;
-	netif->csum = 1;
-	atomic_set(&netif->refcnt, 1);
-	init_waitqueue_head(&netif->waiting_to_free);
-	netif->dev = dev;
-	INIT_LIST_HEAD(&netif->list);
-
-	netback_carrier_off(netif);
-
-	netif->credit_bytes = netif->remaining_credit = ~0UL;
-	netif->credit_usec  = 0UL;
-	init_timer(&netif->credit_timeout);
-	/* Initialize 'expires' now: it's used to track the credit window. */
-	netif->credit_timeout.expires = jiffies;
+	netif_init_queue(netif, dev, domid, handle, 0);
+	netif->num_queues = 1;
+	netif->queues[0] = netif;
 
 	dev->netdev_ops	= &netback_ops;
 	netif_set_features(netif);
@@ -323,6 +434,50 @@ struct xen_netif *netif_alloc(struct device *parent, domid_t domid, unsigned int
 	return netif;
 }
 
+/*
+ * Allocate the additional queues negotiated with the frontend.  Queue 0
+ * is always the netif itself.  The queue count is fixed for the
+ * lifetime of the netif: a reconnecting frontend gets a fresh netif.
+ */
+int netif_alloc_queues(struct xen_netif *netif, unsigned int num_queues)
+{
+	unsigned int i;
+
+	BUG_ON(num_queues == 0 || num_queues > NETBK_MAX_QUEUES);
+
+	if (netif->num_queues == num_queues)
+		return 0;
+	if (netif->num_queues != 1)
+		return -EBUSY;
+
+	for (i = 1; i < num_queues; i++) {
+		struct xen_netif *queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+		if (queue == NULL)
+			goto fail;
+		netif_init_queue(queue, netif->dev, netif->domid,
+				 netif->handle, i);
+		netif->queues[i] = queue;
+	}
+
+	rtnl_lock();
+	/* Publish the queue pointers /then/ the count. */
+	smp_wmb();
+	netif->num_queues = num_queues;
+	netif->dev->real_num_tx_queues = num_queues;
+	rtnl_unlock();
+
+	return 0;
+
+ fail:
+	while (--i > 0) {
+		if (netbk_tx_napi)
+			netif_napi_del(&netif->queues[i]->napi);
+		kfree(netif->queues[i]);
+		netif->queues[i] = NULL;
+	}
+	return -ENOMEM;
+}
+
 static int map_frontend_pages(
 	struct xen_netif *netif, grant_ref_t tx_ring_ref, grant_ref_t rx_ring_ref)
 {
@@ -404,9 +559,22 @@ int netif_map(struct xen_netif *netif, unsigned long tx_ring_ref,
 	if (err)
 		goto err_map;
 
+	if (netif->persistent) {
+		err = netbk_alloc_persistent_gnts(netif);
+		if (err)
+			goto err_persistent;
+	}
+
+	if (netif->queue_index)
+		snprintf(netif->irq_name, sizeof(netif->irq_name), "%s-q%u",
+			 netif->dev->name, netif->queue_index);
+	else
+		strlcpy(netif->irq_name, netif->dev->name,
+			sizeof(netif->irq_name));
+
 	err = bind_interdomain_evtchn_to_irqhandler(
 		netif->domid, evtchn, netif_be_int, 0,
-		netif->dev->name, netif);
+		netif->irq_name, netif);
 	if (err < 0)
 		goto err_hypervisor;
 	netif->irq = err;
@@ -431,6 +599,8 @@ int netif_map(struct xen_netif *netif, unsigned long tx_ring_ref,
 
 	return 0;
 err_hypervisor:
+	netbk_free_persistent_gnts(netif);
+err_persistent:
 	unmap_frontend_pages(netif);
 err_map:
 	free_vm_area(netif->rx_comms_area);
@@ -439,7 +609,7 @@ err_rx:
 	return err;
 }
 
-void netif_disconnect(struct xen_netif *netif)
+static void netif_disconnect_queue(struct xen_netif *netif)
 {
 	if (netback_carrier_ok(netif)) {
 		rtnl_lock();
@@ -454,18 +624,41 @@ void netif_disconnect(struct xen_netif *netif)
 	atomic_dec(&netif->refcnt);
 	wait_event(netif->waiting_to_free, atomic_read(&netif->refcnt) == 0);
 
-	del_timer_sync(&netif->credit_timeout);
+	hrtimer_cancel(&netif->tx_shaper);
+	hrtimer_cancel(&netif->rx_shaper);
 
 	if (netif->irq)
 		unbind_from_irqhandler(netif->irq, netif);
+}
 
-	unregister_netdev(netif->dev);
-
+static void netif_unmap_queue(struct xen_netif *netif)
+{
 	if (netif->tx.sring) {
+		netbk_free_persistent_gnts(netif);
 		unmap_frontend_pages(netif);
 		free_vm_area(netif->tx_comms_area);
 		free_vm_area(netif->rx_comms_area);
 	}
+}
+
+void netif_disconnect(struct xen_netif *netif)
+{
+	unsigned int i;
+
+	netbk_switch_del(netif);
+
+	for (i = netif->num_queues; i-- > 0; )
+		netif_disconnect_queue(netif->queues[i]);
+
+	unregister_netdev(netif->dev);
+
+	for (i = netif->num_queues; i-- > 0; ) {
+		netif_unmap_queue(netif->queues[i]);
+		if (netbk_tx_napi)
+			netif_napi_del(&netif->queues[i]->napi);
+		if (i)
+			kfree(netif->queues[i]);
+	}
 
 	free_netdev(netif->dev);
 }
@@ -37,7 +37,12 @@
 #include "common.h"
 
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
 #include <linux/if_vlan.h>
+#include <linux/jhash.h>
+#include <linux/rculist.h>
 #include <linux/udp.h>
 
 #include <net/tcp.h>
@@ -55,6 +60,8 @@ struct xen_netbk *xen_netbk;
 int xen_netbk_group_nr;
 
 static void netif_idx_release(struct xen_netbk *netbk, u16 pending_idx);
+static void netbk_rx_shape(struct xen_netbk *netbk, struct xen_netif *netif,
+			   unsigned int size);
 static void make_tx_response(struct xen_netif *netif,
 			     struct xen_netif_tx_request *txp,
 			     s8       st);
@@ -112,7 +119,7 @@ static inline int netif_get_page_ext(struct page *pg, unsigned int *_group, unsi
 
 	idx = ext.e.idx;
 
-	if ((idx < 0) || (idx >= MAX_PENDING_REQS))
+	if ((idx < 0) || (idx >= netbk->max_pending_reqs))
 		return 0;
 
 	if (netbk->mmap_pages[idx] != pg)
@@ -134,14 +141,25 @@ static inline int netif_get_page_ext(struct page *pg, unsigned int *_group, unsi
 			 sizeof(struct iphdr) + MAX_IPOPTLEN + \
 			 sizeof(struct tcphdr) + MAX_TCP_OPTION_SPACE)
 
-static inline pending_ring_idx_t pending_index(unsigned i)
+/* Per-skb TX state, kept in skb->cb between build and submit. */
+struct netbk_tx_cb {
+	u16 pending_idx;	/* pending slot of the header request */
+	u8 nr_copy_ops;		/* grant copies issued for this skb */
+	u8 full_copy:1;		/* whole frame copied, nothing mapped */
+	u8 head_mapped:1;	/* header slot mapped (else only copied) */
+	u8 persistent:1;	/* memcpy'd out of persistent grants */
+};
+#define NETBK_TX_CB(skb)	((struct netbk_tx_cb *)(skb)->cb)
+
+static inline pending_ring_idx_t pending_index(struct xen_netbk *netbk,
+						unsigned i)
 {
-	return i & (MAX_PENDING_REQS-1);
+	return i & (netbk->max_pending_reqs - 1);
 }
 
 static inline pending_ring_idx_t nr_pending_reqs(struct xen_netbk *netbk)
 {
-	return MAX_PENDING_REQS -
+	return netbk->nr_pending_slots -
 		netbk->pending_prod + netbk->pending_cons;
 }
 
@@ -156,6 +174,61 @@ static int MODPARM_netback_kthread;
 module_param_named(netback_kthread, MODPARM_netback_kthread, bool, 0);
 MODULE_PARM_DESC(netback_kthread, "Use kernel thread to replace tasklet");
 
+/*
+ * In NAPI mode each vif polls its own TX ring with a budget, and the
+ * group tasklet only reclaims pending slots.  Not used with kthreads.
+ */
+static int MODPARM_netback_napi = 1;
+module_param_named(napi, MODPARM_netback_napi, bool, 0);
+MODULE_PARM_DESC(napi, "Poll guest TX rings from per-vif NAPI contexts");
+
+int netbk_tx_napi;
+
+/* 0 means one queue per netback group, bounded by NETBK_MAX_QUEUES. */
+unsigned int netbk_max_queues;
+module_param_named(max_queues, netbk_max_queues, uint, 0644);
+MODULE_PARM_DESC(max_queues,
+		 "Maximum number of queues a frontend may negotiate per vif");
+
+static unsigned int netbk_max_pending_reqs = 4 * NETBK_MIN_PENDING_REQS;
+module_param_named(max_pending_reqs, netbk_max_pending_reqs, uint, 0444);
+MODULE_PARM_DESC(max_pending_reqs,
+		 "Maximum number of in-flight TX requests per netback group");
+
+int netbk_feature_persistent = 1;
+module_param_named(feature_persistent, netbk_feature_persistent, bool, 0644);
+MODULE_PARM_DESC(feature_persistent,
+		 "Offer to keep frontend TX buffers mapped across requests");
+
+/* Aggregate per-group limits in bytes per second, 0 for none. */
+static unsigned int netbk_group_tx_rate;
+module_param_named(group_tx_rate, netbk_group_tx_rate, uint, 0444);
+MODULE_PARM_DESC(group_tx_rate,
+		 "Bytes per second all vifs of a group may send (0: unlimited)");
+
+static unsigned int netbk_group_rx_rate;
+module_param_named(group_rx_rate, netbk_group_rx_rate, uint, 0444);
+MODULE_PARM_DESC(group_rx_rate,
+		 "Bytes per second all vifs of a group may receive (0: unlimited)");
+
+static unsigned int netbk_group_burst = 131072;
+module_param_named(group_burst, netbk_group_burst, uint, 0444);
+MODULE_PARM_DESC(group_burst, "Bucket depth of the group limits in bytes");
+
+/*
+ * Local switching hands unicast frames for another vif on this host
+ * straight to that vif, so bridge filtering and forwarding rules are not
+ * applied to them.  Only enable it when all vifs share a flat bridge.
+ */
+static int netbk_local_switch;
+module_param_named(local_switch, netbk_local_switch, bool, 0644);
+MODULE_PARM_DESC(local_switch,
+		 "Deliver frames between local vifs without the bridge");
+
+#define NETBK_SWITCH_HASH_BITS 8
+static struct hlist_head netbk_switch_hash[1 << NETBK_SWITCH_HASH_BITS];
+static DEFINE_SPINLOCK(netbk_switch_lock);
+
 /*
  * Netback bottom half handler.
  * dir indicates the data direction.
@@ -174,7 +247,7 @@ static inline void xen_netbk_bh_handler(struct xen_netbk *netbk, int dir)
 static inline void maybe_schedule_tx_action(struct xen_netbk *netbk)
 {
 	smp_mb();
-	if ((nr_pending_reqs(netbk) < (MAX_PENDING_REQS/2)) &&
+	if ((nr_pending_reqs(netbk) < (netbk->nr_pending_slots/2)) &&
 	    !list_empty(&netbk->net_schedule_list))
 		xen_netbk_bh_handler(netbk, 0);
 }
@@ -283,12 +356,9 @@ static unsigned count_skb_slots(struct sk_buff *skb, struct xen_netif *netif)
 	unsigned copy_off;
 	unsigned i;
 
-	copy_off = 0;
-	count = 1;
-
-	BUG_ON(offset_in_page(skb->data) + skb_headlen(skb) > MAX_BUFFER_OFFSET);
-
-	copy_off = skb_headlen(skb);
+	/* The head is packed into as few buffers as it fills. */
+	count = max(DIV_ROUND_UP(skb_headlen(skb), MAX_BUFFER_OFFSET), 1UL);
+	copy_off = skb_headlen(skb) - (count - 1) * MAX_BUFFER_OFFSET;
 
 	if (skb_shinfo(skb)->gso_size)
 		count++;
@@ -319,38 +389,50 @@ static unsigned count_skb_slots(struct sk_buff *skb, struct xen_netif *netif)
 
 int netif_be_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
-	struct xen_netif *netif = netdev_priv(dev);
+	struct xen_netif *netif;
 	struct xen_netbk *netbk;
+	unsigned int slots;
 
 	BUG_ON(skb->dev != dev);
 
+	netif = netif_skb_queue(skb);
+
 	if (netif->group == -1)
 		goto drop;
 
 	netbk = &xen_netbk[netif->group];
 
 	/* Drop the packet if the target domain has no receive buffers. */
-	if (unlikely(!netif_schedulable(netif) || netbk_queue_full(netif)))
+	if (unlikely(!netif_schedulable(netif)))
+		goto drop;
+	if (unlikely(netbk_queue_full(netif))) {
+		netif->nr_rx_ring_full++;
 		goto drop;
+	}
 
 	/*
-	 * XXX For now we also copy skbuffs whose head crosses a page
-	 * boundary, because netbk_gop_skb can't handle them.
+	 * netbk_gop_skb copies a head spanning several pages page by page,
+	 * so jumbo frames go straight to the guest.  Only copy frames that
+	 * would need more slots than netbk_queue_full() reserved.
 	 */
-	if ((skb_headlen(skb) + offset_in_page(skb->data)) >= PAGE_SIZE) {
+	slots = count_skb_slots(skb, netif);
+	if (unlikely(slots > netbk_max_required_rx_slots(netif))) {
 		struct sk_buff *nskb = netbk_copy_skb(skb);
 		if ( unlikely(nskb == NULL) )
 			goto drop;
+		netif->nr_rx_copy_skbs++;
 		/* Copy only the header fields we use in this driver. */
 		nskb->dev = skb->dev;
 		nskb->ip_summed = skb->ip_summed;
+		skb_set_queue_mapping(nskb, netif->queue_index);
 		dev_kfree_skb(skb);
 		skb = nskb;
+		slots = count_skb_slots(skb, netif);
 	}
 
 	/* Reserve ring slots for the worst-case number of
 	 * fragments. */
-	netif->rx_req_cons_peek += count_skb_slots(skb, netif);
+	netif->rx_req_cons_peek += slots;
 	netif_get(netif);
 
 	if (netbk_can_queue(dev) && netbk_queue_full(netif)) {
@@ -358,8 +440,10 @@ int netif_be_start_xmit(struct sk_buff *skb, struct net_device *dev)
 			netbk_max_required_rx_slots(netif);
 		mb(); /* request notification /then/ check & stop the queue */
 		if (netbk_queue_full(netif))
-			netif_stop_queue(dev);
+			netif_tx_stop_queue(netif_txq(netif));
 	}
+	netbk_rx_shape(netbk, netif, skb->len);
+
 	skb_queue_tail(&netbk->rx_queue, skb);
 
 	xen_netbk_bh_handler(netbk, 1);
@@ -379,8 +463,43 @@ struct netrx_pending_operations {
 	struct netbk_rx_meta *meta;
 	int copy_off;
 	grant_ref_t copy_gref;
+	unsigned copy_first;	/* first copy op of the current skb */
 };
 
+/*
+ * Fold the copy just set up at copy[copy_prod] into the previous one if
+ * that belongs to the same skb and both its source and destination end
+ * exactly where this one starts.  Contiguous frags of the same page are
+ * then moved by a single GNTTABOP_copy entry.
+ */
+static int netbk_merge_copy(struct netrx_pending_operations *npo,
+			    struct gnttab_copy *gop)
+{
+	struct gnttab_copy *prev = gop - 1;
+
+	if (npo->copy_prod == npo->copy_first)
+		return 0;
+
+	if (prev->flags != gop->flags ||
+	    prev->source.domid != gop->source.domid ||
+	    prev->dest.u.ref != gop->dest.u.ref)
+		return 0;
+
+	if (gop->flags & GNTCOPY_source_gref) {
+		if (prev->source.u.ref != gop->source.u.ref)
+			return 0;
+	} else if (prev->source.u.gmfn != gop->source.u.gmfn) {
+		return 0;
+	}
+
+	if (prev->source.offset + prev->len != gop->source.offset ||
+	    prev->dest.offset + prev->len != gop->dest.offset)
+		return 0;
+
+	prev->len += gop->len;
+	return 1;
+}
+
 /* Set up the grant operations for this fragment.  If it's a flipping
    interface, we also set up the unmap request from here. */
 
@@ -416,7 +535,7 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 		 * the current buffer but only if:
 		 *     (i)   this frag would fit completely in the next buffer
 		 * and (ii)  there is already some data in the current buffer
-		 * and (iii) this is not the head buffer.
+		 * and (iii) this is not part of the head.
 		 *
 		 * Where:
 		 * - (i) stops us splitting a frag into two copies
@@ -426,7 +545,9 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 		 *   empty. Strictly speaking this is already covered
 		 *   by (ii) but is explicitly checked because
 		 *   netfront relies on the first buffer being
-		 *   non-empty and can crash otherwise.
+		 *   non-empty and can crash otherwise.  A head larger
+		 *   than a page fills its buffers completely, one after
+		 *   the other.
 		 *
 		 * This means we will effectively linearise small
 		 * frags but do not needlessly split large buffers
@@ -437,7 +558,6 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 		    || ((npo->copy_off + size > MAX_BUFFER_OFFSET) && (size <= MAX_BUFFER_OFFSET) && npo->copy_off && !head)) {
 			struct xen_netif_rx_request *req;
 
-			BUG_ON(head); /* Netfront requires there to be some data in the head buffer. */
 			/* Overflowed this request, go to the next one */
 			req = RING_GET_REQUEST(&netif->rx, netif->rx.req_cons++);
 			meta = npo->meta + npo->meta_prod++;
@@ -452,7 +572,7 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 		if (npo->copy_off + bytes > MAX_BUFFER_OFFSET)
 			bytes = MAX_BUFFER_OFFSET - npo->copy_off;
 
-		copy_gop = npo->copy + npo->copy_prod++;
+		copy_gop = npo->copy + npo->copy_prod;
 		copy_gop->flags = GNTCOPY_dest_gref;
 		if (foreign) {
 			struct xen_netbk *netbk = &xen_netbk[group];
@@ -474,6 +594,9 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 		copy_gop->dest.u.ref = npo->copy_gref;
 		copy_gop->len = bytes;
 
+		if (!netbk_merge_copy(npo, copy_gop))
+			npo->copy_prod++;
+
 		npo->copy_off += bytes;
 		meta->size += bytes;
 
@@ -485,22 +608,27 @@ static void netbk_gop_frag_copy(struct xen_netif *netif,
 
 /* Prepare an SKB to be transmitted to the frontend.  This is
    responsible for allocating grant operations, meta structures, etc.
-   It returns the number of meta structures consumed.  The number of
+   It returns the number of meta structures consumed, and the number
+   of grant copy operations through @nr_copy_ops.  The number of
    ring slots used is always equal to the number of meta slots used
    plus the number of GSO descriptors used.  Currently, we use either
    zero GSO descriptors (for non-GSO packets) or one descriptor (for
    frontend-side LRO). */
 static int netbk_gop_skb(struct sk_buff *skb,
-			 struct netrx_pending_operations *npo)
+			 struct netrx_pending_operations *npo,
+			 int *nr_copy_ops)
 {
-	struct xen_netif *netif = netdev_priv(skb->dev);
+	struct xen_netif *netif = netif_skb_queue(skb);
 	int nr_frags = skb_shinfo(skb)->nr_frags;
 	int i;
 	struct xen_netif_rx_request *req;
 	struct netbk_rx_meta *meta;
 	int old_meta_prod;
+	unsigned char *data;
+	unsigned int len;
 
 	old_meta_prod = npo->meta_prod;
+	npo->copy_first = npo->copy_prod;
 
 	/* Set up a GSO prefix descriptor, if necessary */
 	if (skb_shinfo(skb)->gso_size && netif->gso_prefix) {
@@ -524,10 +652,20 @@ static int netbk_gop_skb(struct sk_buff *skb,
 	npo->copy_off = 0;
 	npo->copy_gref = req->gref;
 
-	netbk_gop_frag_copy(netif,
-			    npo, virt_to_page(skb->data),
-			    skb_headlen(skb),
-			    offset_in_page(skb->data), 1);
+	/* A linear head may span pages: copy it one page at a time. */
+	data = skb->data;
+	len = skb_headlen(skb);
+	while (len) {
+		unsigned int chunk = min_t(unsigned int, len,
+					   PAGE_SIZE - offset_in_page(data));
+
+		netbk_gop_frag_copy(netif,
+				    npo, virt_to_page(data),
+				    chunk,
+				    offset_in_page(data), 1);
+		data += chunk;
+		len -= chunk;
+	}
 
 	/* Leave a gap for the GSO descriptor. */
 	if (skb_shinfo(skb)->gso_size && !netif->gso_prefix)
@@ -541,6 +679,7 @@ static int netbk_gop_skb(struct sk_buff *skb,
 				    0);
 	}
 
+	*nr_copy_ops = npo->copy_prod - npo->copy_first;
 	return npo->meta_prod - old_meta_prod;
 }
 
@@ -548,14 +687,14 @@ static int netbk_gop_skb(struct sk_buff *skb,
    used to set up the operations on the top of
    netrx_pending_operations, which have since been done.  Check that
    they didn't give any errors and advance over them. */
-static int netbk_check_gop(int nr_meta_slots, domid_t domid,
+static int netbk_check_gop(int nr_copy_ops, domid_t domid,
 			   struct netrx_pending_operations *npo)
 {
 	struct gnttab_copy     *copy_op;
 	int status = NETIF_RSP_OKAY;
 	int i;
 
-	for (i = 0; i < nr_meta_slots; i++) {
+	for (i = 0; i < nr_copy_ops; i++) {
 		copy_op = npo->copy + npo->copy_cons++;
 		if (copy_op->status != GNTST_okay) {
 				DPRINTK("Bad status %d from copy to DOM%d.\n",
@@ -589,6 +728,7 @@ static void netbk_add_frag_responses(struct xen_netif *netif, int status,
 
 struct skb_cb_overlay {
 	int meta_slots_used;
+	int copy_ops_used;
 };
 
 static void net_rx_action(unsigned long data)
@@ -600,10 +740,8 @@ static void net_rx_action(unsigned long data)
 	struct xen_netif_rx_response *resp;
 	struct sk_buff_head rxq;
 	struct sk_buff *skb;
-	int notify_nr = 0;
+	LIST_HEAD(notify);
 	int ret;
-	int nr_frags;
-	int count;
 	unsigned long offset;
 	struct skb_cb_overlay *sco;
 
@@ -614,21 +752,28 @@ static void net_rx_action(unsigned long data)
 
 	skb_queue_head_init(&rxq);
 
-	count = 0;
-
 	while ((skb = skb_dequeue(&netbk->rx_queue)) != NULL) {
-		netif = netdev_priv(skb->dev);
-		nr_frags = skb_shinfo(skb)->nr_frags;
+		netif = netif_skb_queue(skb);
 
 		sco = (struct skb_cb_overlay *)skb->cb;
-		sco->meta_slots_used = netbk_gop_skb(skb, &npo);
-
-		count += nr_frags + 1;
+		sco->meta_slots_used = netbk_gop_skb(skb, &npo,
+						     &sco->copy_ops_used);
+		netif->nr_rx_copy_ops += sco->copy_ops_used;
 
 		__skb_queue_tail(&rxq, skb);
 
-		/* Filled the batch queue? */
-		if (count + MAX_SKB_FRAGS >= NET_RX_RING_SIZE)
+		/*
+		 * Filled the batch?  Account the copy ops and meta slots
+		 * really used instead of one per fragment, so that runs of
+		 * small packets share a hypercall.  Stop only once the
+		 * worst-case skb might not fit any more: every copy ends
+		 * at a source page or buffer boundary, which bounds the
+		 * copies by the head pages and frags plus the slots.
+		 */
+		if (npo.copy_prod + 3 * (MAX_SKB_FRAGS + 2) >
+		    ARRAY_SIZE(netbk->grant_copy_op) ||
+		    npo.meta_prod + MAX_SKB_FRAGS + 2 >
+		    ARRAY_SIZE(netbk->meta))
 			break;
 	}
 
@@ -642,10 +787,15 @@ static void net_rx_action(unsigned long data)
 					npo.copy_prod);
 	BUG_ON(ret != 0);
 
+	netbk->stats.rx_copy_batches++;
+	netbk->stats.rx_copy_ops += npo.copy_prod;
+	if (npo.copy_prod > netbk->stats.rx_batch_max)
+		netbk->stats.rx_batch_max = npo.copy_prod;
+
 	while ((skb = __skb_dequeue(&rxq)) != NULL) {
 		sco = (struct skb_cb_overlay *)skb->cb;
 
-		netif = netdev_priv(skb->dev);
+		netif = netif_skb_queue(skb);
 
 		if (netbk->meta[npo.meta_cons].gso_size && netif->gso_prefix) {
 			resp = RING_GET_RESPONSE(&netif->rx,
@@ -665,7 +815,7 @@ static void net_rx_action(unsigned long data)
 		netif->stats.tx_bytes += skb->len;
 		netif->stats.tx_packets++;
 
-		status = netbk_check_gop(sco->meta_slots_used,
+		status = netbk_check_gop(sco->copy_ops_used,
 					 netif->domid, &npo);
 
 		if (sco->meta_slots_used == 1)
@@ -710,16 +860,18 @@ static void net_rx_action(unsigned long data)
 
 		RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&netif->rx, ret);
 		irq = netif->irq;
-		if (ret && !netbk->rx_notify[irq] &&
+		/* Kick each vif once per pass, after all its responses. */
+		if (ret && list_empty(&netif->notify_list) &&
 				(netif->smart_poll != 1)) {
-			netbk->rx_notify[irq] = 1;
-			netbk->notify_list[notify_nr++] = irq;
+			netif_get(netif);
+			list_add_tail(&netif->notify_list, &notify);
 		}
 
-		if (netif_queue_stopped(netif->dev) &&
+		if (netif_tx_queue_stopped(netif_txq(netif)) &&
 		    netif_schedulable(netif) &&
-		    !netbk_queue_full(netif))
-			netif_wake_queue(netif->dev);
+		    !netbk_queue_full(netif) &&
+		    !hrtimer_active(&netif->rx_shaper))
+			netif_tx_wake_queue(netif_txq(netif));
 
 		/*
 		 * netfront_smartpoll_active indicates whether
@@ -736,10 +888,12 @@ static void net_rx_action(unsigned long data)
 		dev_kfree_skb(skb);
 	}
 
-	while (notify_nr != 0) {
-		irq = netbk->notify_list[--notify_nr];
-		netbk->rx_notify[irq] = 0;
-		notify_remote_via_irq(irq);
+	while (!list_empty(&notify)) {
+		netif = list_first_entry(&notify, struct xen_netif,
+					 notify_list);
+		list_del_init(&netif->notify_list);
+		notify_remote_via_irq(netif->irq);
+		netif_put(netif);
 	}
 
 	/* More work to do? */
@@ -763,7 +917,25 @@ static void netbk_tx_pending_timeout(unsigned long data)
 struct net_device_stats *netif_be_get_stats(struct net_device *dev)
 {
 	struct xen_netif *netif = netdev_priv(dev);
-	return &netif->stats;
+	struct net_device_stats *stats = &dev->stats;
+	unsigned int i;
+
+	/* Each queue keeps its own counters: fold them together. */
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < netif->num_queues; i++) {
+		struct net_device_stats *qstats = &netif->queues[i]->stats;
+
+		stats->rx_packets += qstats->rx_packets;
+		stats->tx_packets += qstats->tx_packets;
+		stats->rx_bytes   += qstats->rx_bytes;
+		stats->tx_bytes   += qstats->tx_bytes;
+		stats->rx_errors  += qstats->rx_errors;
+		stats->tx_errors  += qstats->tx_errors;
+		stats->rx_dropped += qstats->rx_dropped;
+		stats->tx_dropped += qstats->tx_dropped;
+	}
+
+	return stats;
 }
 
 static int __on_net_schedule_list(struct xen_netif *netif)
@@ -825,6 +997,12 @@ void netif_schedule_work(struct xen_netif *netif)
 
 	RING_FINAL_CHECK_FOR_REQUESTS(&netif->tx, more_to_do);
 
+	if (netbk_tx_napi) {
+		if (more_to_do)
+			napi_schedule(&netif->napi);
+		return;
+	}
+
 	if (more_to_do) {
 		add_to_net_schedule_list_tail(netif);
 		maybe_schedule_tx_action(netbk);
@@ -839,32 +1017,159 @@ void netif_deschedule_work(struct xen_netif *netif)
 	spin_unlock_irq(&netbk->net_schedule_list_lock);
 }
 
+void netbk_tbf_init(struct netbk_tbf *tbf, u64 rate, u64 burst)
+{
+	tbf->rate = rate;
+	tbf->burst = min_t(u64, burst, NETBK_MAX_BURST);
+	tbf->tokens = tbf->burst;
+	tbf->last = ktime_get();
+}
 
-static void tx_add_credit(struct xen_netif *netif)
+static void netbk_tbf_refill(struct netbk_tbf *tbf, ktime_t now)
 {
-	unsigned long max_burst, max_credit;
+	u64 elapsed, deficit, add;
+
+	if (tbf->tokens >= (s64)tbf->burst)
+		goto full;
+
+	/* The deficit is below 2 * NETBK_MAX_BURST: no overflow here. */
+	elapsed = ktime_to_ns(ktime_sub(now, tbf->last));
+	deficit = tbf->burst - tbf->tokens;
+	if (elapsed >= div64_u64(deficit * NSEC_PER_SEC, tbf->rate))
+		goto full;
+
+	/* Keep the remainder accruing rather than rounding it away. */
+	add = div64_u64(elapsed * tbf->rate, NSEC_PER_SEC);
+	if (add) {
+		tbf->tokens += add;
+		tbf->last = now;
+	}
+	return;
 
-	/*
-	 * Allow a burst big enough to transmit a jumbo packet of up to 128kB.
-	 * Otherwise the interface can seize up due to insufficient credit.
-	 */
-	max_burst = RING_GET_REQUEST(&netif->tx, netif->tx.req_cons)->size;
-	max_burst = min(max_burst, 131072UL);
-	max_burst = max(max_burst, netif->credit_bytes);
+full:
+	tbf->tokens = tbf->burst;
+	tbf->last = now;
+}
+
+/*
+ * Nanoseconds until @tbf lets a @size byte frame through, 0 if it may
+ * go now.  @size 0 asks for the bucket to be out of debt.
+ */
+static u64 netbk_tbf_delay(struct netbk_tbf *tbf, unsigned int size,
+			   ktime_t now)
+{
+	s64 need;
 
-	/* Take care that adding a new chunk of credit doesn't wrap to zero. */
-	max_credit = netif->remaining_credit + netif->credit_bytes;
-	if (max_credit < netif->remaining_credit)
-		max_credit = ULONG_MAX; /* wrapped: clamp to ULONG_MAX */
+	if (!tbf->rate)
+		return 0;
+
+	netbk_tbf_refill(tbf, now);
+
+	need = min_t(u64, size, tbf->burst);
+	if (tbf->tokens >= need)
+		return 0;
+
+	return div64_u64((need - tbf->tokens) * NSEC_PER_SEC,
+			 tbf->rate) + 1;
+}
+
+static inline void netbk_tbf_charge(struct netbk_tbf *tbf, unsigned int size)
+{
+	if (tbf->rate)
+		tbf->tokens -= size;
+}
+
+/*
+ * May @netif send a @size byte frame?  If its own bucket or the group's
+ * is short, arm the vif's shaper to reschedule it once both refilled.
+ */
+static bool netbk_tx_shaped(struct xen_netbk *netbk, struct xen_netif *netif,
+			    unsigned int size)
+{
+	ktime_t now;
+	u64 delay;
+
+	if (!netif->tx_tbf.rate && !netbk->tx_tbf.rate)
+		return false;
+
+	/* Already waiting for a refill. */
+	if (hrtimer_active(&netif->tx_shaper))
+		return true;
+
+	now = ktime_get();
+	delay = max(netbk_tbf_delay(&netif->tx_tbf, size, now),
+		    netbk_tbf_delay(&netbk->tx_tbf, size, now));
+	if (!delay)
+		return false;
 
-	netif->remaining_credit = min(max_credit, max_burst);
+	hrtimer_start(&netif->tx_shaper, ns_to_ktime(delay),
+		      HRTIMER_MODE_REL);
+	return true;
 }
 
-static void tx_credit_callback(unsigned long data)
+static enum hrtimer_restart netbk_tx_shaper_fn(struct hrtimer *timer)
 {
-	struct xen_netif *netif = (struct xen_netif *)data;
-	tx_add_credit(netif);
+	struct xen_netif *netif = container_of(timer, struct xen_netif,
+					       tx_shaper);
+
 	netif_schedule_work(netif);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Charge a frame queued to @netif to its RX buckets.  Once either is in
+ * debt the queue is stopped until the shaper finds both repaid, so the
+ * excess waits in the qdisc instead of being dropped.
+ */
+static void netbk_rx_shape(struct xen_netbk *netbk, struct xen_netif *netif,
+			   unsigned int size)
+{
+	ktime_t now;
+	u64 delay, group_delay = 0;
+
+	if (!netif->rx_tbf.rate && !netbk->rx_tbf.rate)
+		return;
+
+	now = ktime_get();
+
+	netbk_tbf_charge(&netif->rx_tbf, size);
+	delay = netbk_tbf_delay(&netif->rx_tbf, 0, now);
+
+	if (netbk->rx_tbf.rate) {
+		spin_lock(&netbk->rx_tbf_lock);
+		netbk_tbf_charge(&netbk->rx_tbf, size);
+		group_delay = netbk_tbf_delay(&netbk->rx_tbf, 0, now);
+		spin_unlock(&netbk->rx_tbf_lock);
+	}
+
+	delay = max(delay, group_delay);
+	if (!delay)
+		return;
+
+	netif_tx_stop_queue(netif_txq(netif));
+	hrtimer_start(&netif->rx_shaper, ns_to_ktime(delay),
+		      HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart netbk_rx_shaper_fn(struct hrtimer *timer)
+{
+	struct xen_netif *netif = container_of(timer, struct xen_netif,
+					       rx_shaper);
+
+	if (netif_schedulable(netif) && !netbk_queue_full(netif))
+		netif_tx_wake_queue(netif_txq(netif));
+	return HRTIMER_NORESTART;
+}
+
+void netbk_init_shapers(struct xen_netif *netif)
+{
+	netbk_tbf_init(&netif->tx_tbf, 0, 0);
+	netbk_tbf_init(&netif->rx_tbf, 0, 0);
+
+	hrtimer_init(&netif->tx_shaper, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	netif->tx_shaper.function = netbk_tx_shaper_fn;
+	hrtimer_init(&netif->rx_shaper, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	netif->rx_shaper.function = netbk_rx_shaper_fn;
 }
 
 static inline int copy_pending_req(struct xen_netbk *netbk,
@@ -902,7 +1207,7 @@ static inline void net_tx_action_dealloc(struct xen_netbk *netbk)
 			struct netbk_tx_pending_inuse *pending_inuse =
 					netbk->pending_inuse;
 
-			pending_idx = netbk->dealloc_ring[pending_index(dc++)];
+			pending_idx = netbk->dealloc_ring[pending_index(netbk, dc++)];
 			list_move_tail(&pending_inuse[pending_idx].list, &list);
 
 			pfn = idx_to_pfn(netbk, pending_idx);
@@ -914,6 +1219,8 @@ static inline void net_tx_action_dealloc(struct xen_netbk *netbk)
 					idx_to_kaddr(netbk, pending_idx),
 					GNTMAP_host_map,
 					netbk->grant_tx_handle[pending_idx]);
+			netbk->tx_unmap_pages[gop - netbk->tx_unmap_ops] =
+				netbk->mmap_pages[pending_idx];
 			gop++;
 		}
 
@@ -921,11 +1228,13 @@ static inline void net_tx_action_dealloc(struct xen_netbk *netbk)
 
 	netbk->dealloc_cons = dc;
 
-	ret = HYPERVISOR_grant_table_op(
-		GNTTABOP_unmap_grant_ref, netbk->tx_unmap_ops,
-		gop - netbk->tx_unmap_ops);
+	ret = gnttab_unmap_refs(netbk->tx_unmap_ops, netbk->tx_unmap_pages,
+				gop - netbk->tx_unmap_ops);
 	BUG_ON(ret);
 
+	netbk->stats.tx_unmap_batches++;
+	netbk->stats.tx_unmap_ops += gop - netbk->tx_unmap_ops;
+
 	/*
 	 * Copy any entries that have been pending for too long
 	 */
@@ -973,7 +1282,7 @@ static inline void net_tx_action_dealloc(struct xen_netbk *netbk)
 		/* Ready for next use. */
 		gnttab_reset_grant_page(netbk->mmap_pages[pending_idx]);
 
-		index = pending_index(netbk->pending_prod++);
+		index = pending_index(netbk, netbk->pending_prod++);
 		netbk->pending_ring[index] = pending_idx;
 
 		netif_put(netif);
@@ -1039,6 +1348,10 @@ static int netbk_count_requests(struct xen_netif *netif,
 	return frags;
 }
 
+/*
+ * Claim a pending slot for every fragment request.  If @mop is NULL the
+ * fragments are going to be grant-copied rather than mapped.
+ */
 static struct gnttab_map_grant_ref *netbk_get_requests(struct xen_netbk *netbk,
 						  struct xen_netif *netif,
 						  struct sk_buff *skb,
@@ -1047,7 +1360,7 @@ static struct gnttab_map_grant_ref *netbk_get_requests(struct xen_netbk *netbk,
 {
 	struct skb_shared_info *shinfo = skb_shinfo(skb);
 	skb_frag_t *frags = shinfo->frags;
-	unsigned long pending_idx = *((u16 *)skb->data);
+	unsigned long pending_idx = NETBK_TX_CB(skb)->pending_idx;
 	int i, start;
 
 	/* Skip first skb fragment if it is on same page as header fragment. */
@@ -1058,12 +1371,13 @@ static struct gnttab_map_grant_ref *netbk_get_requests(struct xen_netbk *netbk,
 		struct pending_tx_info *pending_tx_info =
 			netbk->pending_tx_info;
 
-		index = pending_index(netbk->pending_cons++);
+		index = pending_index(netbk, netbk->pending_cons++);
 		pending_idx = netbk->pending_ring[index];
 
-		gnttab_set_map_op(mop++, idx_to_kaddr(netbk, pending_idx),
-				  GNTMAP_host_map | GNTMAP_readonly,
-				  txp->gref, netif->domid);
+		if (mop)
+			gnttab_set_map_op(mop++, idx_to_kaddr(netbk, pending_idx),
+					  GNTMAP_host_map | GNTMAP_readonly,
+					  txp->gref, netif->domid);
 
 		memcpy(&pending_tx_info[pending_idx].req, txp, sizeof(*txp));
 		netif_get(netif);
@@ -1074,12 +1388,262 @@ static struct gnttab_map_grant_ref *netbk_get_requests(struct xen_netbk *netbk,
 	return mop;
 }
 
+/*
+ * Emit grant copies of @len bytes of the guest buffer described by @txp
+ * into the linear area of @skb at @offset.  The source never crosses a
+ * page (netfront guarantees that) but the local destination may, so
+ * split at our own page boundaries.
+ */
+static struct gnttab_copy *netbk_tx_copy_slot(struct xen_netif *netif,
+					      struct sk_buff *skb,
+					      struct gnttab_copy *gop,
+					      struct xen_netif_tx_request *txp,
+					      unsigned int offset,
+					      unsigned int len)
+{
+	unsigned int src_off = txp->offset;
+
+	while (len) {
+		void *dst = skb->data + offset;
+		unsigned int bytes = min_t(unsigned int, len,
+					   PAGE_SIZE - offset_in_page(dst));
+
+		gop->source.u.ref = txp->gref;
+		gop->source.domid = netif->domid;
+		gop->source.offset = src_off;
+
+		gop->dest.u.gmfn = virt_to_mfn(dst);
+		gop->dest.domid = DOMID_SELF;
+		gop->dest.offset = offset_in_page(dst);
+
+		gop->len = bytes;
+		gop->flags = GNTCOPY_source_gref;
+
+		gop++;
+		NETBK_TX_CB(skb)->nr_copy_ops++;
+
+		offset += bytes;
+		src_off += bytes;
+		len -= bytes;
+	}
+
+	return gop;
+}
+
+static inline unsigned long persistent_gnt_kaddr(struct netbk_persistent_gnt *gnt)
+{
+	return (unsigned long)pfn_to_kaddr(page_to_pfn(gnt->page));
+}
+
+int netbk_alloc_persistent_gnts(struct xen_netif *netif)
+{
+	unsigned int i;
+
+	netif->persistent_pool = kcalloc(NETBK_MAX_PERSISTENT_GNTS,
+					 sizeof(*netif->persistent_pool),
+					 GFP_KERNEL);
+	if (!netif->persistent_pool)
+		return -ENOMEM;
+
+	netif->persistent_pages =
+		alloc_empty_pages_and_pagevec(NETBK_MAX_PERSISTENT_GNTS);
+	if (!netif->persistent_pages) {
+		kfree(netif->persistent_pool);
+		netif->persistent_pool = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < NETBK_MAX_PERSISTENT_GNTS; i++)
+		netif->persistent_pool[i].page = netif->persistent_pages[i];
+
+	netif->persistent_gnts = RB_ROOT;
+	netif->persistent_gnt_c = 0;
+	return 0;
+}
+
+/* Called once the rings are quiescent: no TX processing can be running. */
+void netbk_free_persistent_gnts(struct xen_netif *netif)
+{
+	struct gnttab_unmap_grant_ref unmap[32];
+	struct page *pages[32];
+	unsigned int i, n = 0;
+	int ret;
+
+	if (!netif->persistent_pool)
+		return;
+
+	for (i = 0; i < netif->persistent_gnt_c; i++) {
+		struct netbk_persistent_gnt *gnt = &netif->persistent_pool[i];
+
+		gnttab_set_unmap_op(&unmap[n], persistent_gnt_kaddr(gnt),
+				    GNTMAP_host_map, gnt->handle);
+		pages[n++] = gnt->page;
+
+		if (n == ARRAY_SIZE(unmap) || i == netif->persistent_gnt_c - 1) {
+			ret = gnttab_unmap_refs(unmap, pages, n);
+			BUG_ON(ret);
+			n = 0;
+		}
+	}
+
+	free_empty_pages_and_pagevec(netif->persistent_pages,
+				     NETBK_MAX_PERSISTENT_GNTS);
+	kfree(netif->persistent_pool);
+	netif->persistent_pages = NULL;
+	netif->persistent_pool = NULL;
+	netif->persistent_gnts = RB_ROOT;
+	netif->persistent_gnt_c = 0;
+}
+
+/*
+ * Find the mapping of @gref, mapping it into the next free pool page on
+ * first use.  Only the vif's own netback group walks the tree, so no
+ * locking is needed.
+ */
+static struct netbk_persistent_gnt *
+netbk_get_persistent_gnt(struct xen_netif *netif, grant_ref_t gref)
+{
+	struct rb_node **p = &netif->persistent_gnts.rb_node;
+	struct rb_node *parent = NULL;
+	struct netbk_persistent_gnt *gnt;
+	struct gnttab_map_grant_ref op;
+	int ret;
+
+	while (*p) {
+		parent = *p;
+		gnt = rb_entry(parent, struct netbk_persistent_gnt, node);
+		if (gref < gnt->gref)
+			p = &parent->rb_left;
+		else if (gref > gnt->gref)
+			p = &parent->rb_right;
+		else
+			return gnt;
+	}
+
+	if (unlikely(netif->persistent_gnt_c >= NETBK_MAX_PERSISTENT_GNTS)) {
+		DPRINTK("Persistent grant pool exhausted (gref %u).\n", gref);
+		return NULL;
+	}
+
+	gnt = &netif->persistent_pool[netif->persistent_gnt_c];
+	gnttab_set_map_op(&op, persistent_gnt_kaddr(gnt),
+			  GNTMAP_host_map | GNTMAP_readonly,
+			  gref, netif->domid);
+	ret = gnttab_map_refs(&op, &gnt->page, 1);
+	BUG_ON(ret);
+	if (unlikely(op.status != GNTST_okay)) {
+		DPRINTK("Bad status %d mapping persistent gref %u.\n",
+			op.status, gref);
+		return NULL;
+	}
+
+	gnt->gref = gref;
+	gnt->handle = op.handle;
+
+	rb_link_node(&gnt->node, parent, p);
+	rb_insert_color(&gnt->node, &netif->persistent_gnts);
+	netif->persistent_gnt_c++;
+
+	return gnt;
+}
+
+/*
+ * Persistent mode: memcpy a whole frame out of the frontend's mapped
+ * buffers.  The first @data_len bytes land in the linear area, anything
+ * beyond that in freshly allocated fragment pages.
+ */
+static int netbk_tx_copy_persistent(struct xen_netif *netif,
+				    struct sk_buff *skb,
+				    struct xen_netif_tx_request *first,
+				    struct xen_netif_tx_request *txfrags,
+				    int nr_frags, unsigned int data_len)
+{
+	int i;
+
+	for (i = 0; i <= nr_frags; i++) {
+		struct xen_netif_tx_request *txp = i ? &txfrags[i - 1] : first;
+		struct netbk_persistent_gnt *gnt;
+		unsigned int offset = 0;
+		struct page *page;
+		void *src;
+
+		gnt = netbk_get_persistent_gnt(netif, txp->gref);
+		if (unlikely(!gnt))
+			return -EINVAL;
+		src = (void *)(persistent_gnt_kaddr(gnt) + txp->offset);
+
+		if (i == 0) {
+			memcpy(skb->data, src, data_len);
+			offset = data_len;
+		}
+
+		if (offset == txp->size)
+			continue;
+
+		page = alloc_page(GFP_ATOMIC | __GFP_NOWARN);
+		if (unlikely(!page))
+			return -ENOMEM;
+		memcpy(page_address(page), src + offset, txp->size - offset);
+
+		skb_fill_page_desc(skb, skb_shinfo(skb)->nr_frags, page, 0,
+				   txp->size - offset);
+		skb->len += txp->size - offset;
+		skb->data_len += txp->size - offset;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	return 0;
+}
+
+/* Consume the grant copies issued for @skb and return the first error. */
+static int netbk_tx_check_gop(struct sk_buff *skb, struct gnttab_copy **gopp)
+{
+	struct gnttab_copy *gop = *gopp;
+	int i, err = 0;
+
+	for (i = 0; i < NETBK_TX_CB(skb)->nr_copy_ops; i++, gop++) {
+		if (unlikely(gop->status != GNTST_okay)) {
+			DPRINTK("Bad status %d from TX copy.\n", gop->status);
+			if (!err)
+				err = gop->status;
+		}
+	}
+
+	*gopp = gop;
+	return err;
+}
+
+/* Respond to and recycle a pending slot which was copied, not mapped. */
+static void netbk_tx_release_copied(struct xen_netbk *netbk, u16 pending_idx,
+				    s8 status)
+{
+	struct pending_tx_info *pending_tx_info = &netbk->pending_tx_info[pending_idx];
+	struct xen_netif *netif = pending_tx_info->netif;
+	pending_ring_idx_t index;
+
+	make_tx_response(netif, &pending_tx_info->req, status);
+	index = pending_index(netbk, netbk->pending_prod++);
+	netbk->pending_ring[index] = pending_idx;
+	netif_put(netif);
+}
+
+static void netbk_tx_release_head(struct xen_netbk *netbk, struct sk_buff *skb)
+{
+	u16 pending_idx = NETBK_TX_CB(skb)->pending_idx;
+
+	if (NETBK_TX_CB(skb)->head_mapped)
+		netif_idx_release(netbk, pending_idx);
+	else
+		netbk_tx_release_copied(netbk, pending_idx, NETIF_RSP_OKAY);
+}
+
 static int netbk_tx_check_mop(struct xen_netbk *netbk,
 			      struct sk_buff *skb,
-			      struct gnttab_map_grant_ref **mopp)
+			      struct gnttab_map_grant_ref **mopp,
+			      struct gnttab_copy **gopp)
 {
 	struct gnttab_map_grant_ref *mop = *mopp;
-	int pending_idx = *((u16 *)skb->data);
+	int pending_idx = NETBK_TX_CB(skb)->pending_idx;
 	struct pending_tx_info *pending_tx_info = netbk->pending_tx_info;
 	struct xen_netif *netif = pending_tx_info[pending_idx].netif;
 	struct xen_netif_tx_request *txp;
@@ -1087,20 +1651,29 @@ static int netbk_tx_check_mop(struct xen_netbk *netbk,
 	int nr_frags = shinfo->nr_frags;
 	int i, err, start;
 
-	/* Check status of header. */
-	err = mop->status;
-	if (unlikely(err)) {
-		pending_ring_idx_t index;
-		index = pending_index(netbk->pending_prod++);
-		txp = &pending_tx_info[pending_idx].req;
-		make_tx_response(netif, txp, NETIF_RSP_ERROR);
-		netbk->pending_ring[index] = pending_idx;
-		netif_put(netif);
-	} else {
-		set_phys_to_machine(
-			__pa(idx_to_kaddr(netbk, pending_idx)) >> PAGE_SHIFT,
-			FOREIGN_FRAME(mop->dev_bus_addr >> PAGE_SHIFT));
-		netbk->grant_tx_handle[pending_idx] = mop->handle;
+	/* Check status of the copied part of the header. */
+	err = netbk_tx_check_gop(skb, gopp);
+
+	/* Check status of the mapped part of the header. */
+	if (NETBK_TX_CB(skb)->head_mapped) {
+		int newerr = (mop++)->status;
+
+		if (unlikely(newerr)) {
+			pending_ring_idx_t index;
+			index = pending_index(netbk, netbk->pending_prod++);
+			txp = &pending_tx_info[pending_idx].req;
+			make_tx_response(netif, txp, NETIF_RSP_ERROR);
+			netbk->pending_ring[index] = pending_idx;
+			netif_put(netif);
+			err = newerr;
+		} else {
+			netbk->grant_tx_handle[pending_idx] = mop[-1].handle;
+			/* Copied part failed: drop the mapping again. */
+			if (unlikely(err))
+				netif_idx_release(netbk, pending_idx);
+		}
+	} else if (unlikely(err)) {
+		netbk_tx_release_copied(netbk, pending_idx, NETIF_RSP_ERROR);
 	}
 
 	/* Skip first skb fragment if it is on same page as header fragment. */
@@ -1113,14 +1686,9 @@ static int netbk_tx_check_mop(struct xen_netbk *netbk,
 		pending_idx = (unsigned long)shinfo->frags[i].page;
 
 		/* Check error status: if okay then remember grant handle. */
-		newerr = (++mop)->status;
+		newerr = (mop++)->status;
 		if (likely(!newerr)) {
-			unsigned long addr;
-			addr = idx_to_kaddr(netbk, pending_idx);
-			set_phys_to_machine(
-				__pa(addr)>>PAGE_SHIFT,
-				FOREIGN_FRAME(mop->dev_bus_addr>>PAGE_SHIFT));
-			netbk->grant_tx_handle[pending_idx] = mop->handle;
+			netbk->grant_tx_handle[pending_idx] = mop[-1].handle;
 			/* Had a previous error? Invalidate this fragment. */
 			if (unlikely(err))
 				netif_idx_release(netbk, pending_idx);
@@ -1130,7 +1698,7 @@ static int netbk_tx_check_mop(struct xen_netbk *netbk,
 		/* Error on this fragment: respond to client with an error. */
 		txp = &netbk->pending_tx_info[pending_idx].req;
 		make_tx_response(netif, txp, NETIF_RSP_ERROR);
-		index = pending_index(netbk->pending_prod++);
+		index = pending_index(netbk, netbk->pending_prod++);
 		netbk->pending_ring[index] = pending_idx;
 		netif_put(netif);
 
@@ -1139,10 +1707,9 @@ static int netbk_tx_check_mop(struct xen_netbk *netbk,
 			continue;
 
 		/* First error: invalidate header and preceding fragments. */
-		pending_idx = *((u16 *)skb->data);
-		netif_idx_release(netbk, pending_idx);
+		netbk_tx_release_head(netbk, skb);
 		for (j = start; j < i; j++) {
-			pending_idx = (unsigned long)shinfo->frags[i].page;
+			pending_idx = (unsigned long)shinfo->frags[j].page;
 			netif_idx_release(netbk, pending_idx);
 		}
 
@@ -1150,7 +1717,31 @@ static int netbk_tx_check_mop(struct xen_netbk *netbk,
 		err = newerr;
 	}
 
-	*mopp = mop + 1;
+	*mopp = mop;
+	return err;
+}
+
+/*
+ * A packet below the copy threshold was grant-copied in its entirety
+ * into the linear area: check the copies and hand every slot back.
+ */
+static int netbk_tx_check_copied(struct xen_netbk *netbk, struct sk_buff *skb,
+				 struct gnttab_copy **gopp)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	s8 status;
+	int i, err;
+
+	err = netbk_tx_check_gop(skb, gopp);
+	status = err ? NETIF_RSP_ERROR : NETIF_RSP_OKAY;
+
+	netbk_tx_release_copied(netbk, NETBK_TX_CB(skb)->pending_idx, status);
+	for (i = 0; i < shinfo->nr_frags; i++)
+		netbk_tx_release_copied(netbk,
+					(unsigned long)shinfo->frags[i].page,
+					status);
+	shinfo->nr_frags = 0;
+
 	return err;
 }
 
@@ -1303,65 +1894,53 @@ out:
 	return err;
 }
 
-static bool tx_credit_exceeded(struct xen_netif *netif, unsigned size)
-{
-	unsigned long now = jiffies;
-	unsigned long next_credit =
-		netif->credit_timeout.expires +
-		msecs_to_jiffies(netif->credit_usec / 1000);
-
-	/* Timer could already be pending in rare cases. */
-	if (timer_pending(&netif->credit_timeout))
-		return true;
-
-	/* Passed the point where we can replenish credit? */
-	if (time_after_eq(now, next_credit)) {
-		netif->credit_timeout.expires = now;
-		tx_add_credit(netif);
-	}
-
-	/* Still too big to send right now? Set a callback. */
-	if (size > netif->remaining_credit) {
-		netif->credit_timeout.data     =
-			(unsigned long)netif;
-		netif->credit_timeout.function =
-			tx_credit_callback;
-		mod_timer(&netif->credit_timeout,
-			  next_credit);
-
-		return true;
-	}
-
-	return false;
-}
-
-static unsigned net_tx_build_mops(struct xen_netbk *netbk)
+/*
+ * Pull requests off the vifs on the schedule list, or in NAPI mode off
+ * @only until *@budget frames have been taken.
+ */
+static unsigned net_tx_build_mops(struct xen_netbk *netbk,
+				  struct xen_netif *only, int *budget,
+				  unsigned *nr_gops)
 {
 	struct gnttab_map_grant_ref *mop;
+	struct gnttab_copy *gop;
 	struct sk_buff *skb;
 	int ret;
 
 	mop = netbk->tx_map_ops;
-	while (((nr_pending_reqs(netbk) + MAX_SKB_FRAGS) < MAX_PENDING_REQS) &&
-		!list_empty(&netbk->net_schedule_list)) {
+	gop = netbk->tx_copy_ops;
+	while (((nr_pending_reqs(netbk) + MAX_SKB_FRAGS) <
+		netbk->nr_pending_slots) &&
+	       (only ? *budget > 0 :
+		!list_empty(&netbk->net_schedule_list))) {
 		struct xen_netif *netif;
 		struct xen_netif_tx_request txreq;
 		struct xen_netif_tx_request txfrags[MAX_SKB_FRAGS];
 		struct xen_netif_extra_info extras[XEN_NETIF_EXTRA_TYPE_MAX - 1];
+		struct gnttab_map_grant_ref *frame_mop = mop;
+		struct gnttab_copy *frame_gop = gop;
 		u16 pending_idx;
 		RING_IDX idx;
 		int work_to_do;
-		unsigned int data_len;
+		unsigned int data_len, total_size;
 		pending_ring_idx_t index;
+		int full_copy;
 
-		/* Get a netif from the list with work to do. */
-		netif = poll_net_schedule_list(netbk);
-		if (!netif)
-			continue;
+		if (only) {
+			netif = only;
+			netif_get(netif);
+		} else {
+			/* Get a netif from the list with work to do. */
+			netif = poll_net_schedule_list(netbk);
+			if (!netif)
+				continue;
+		}
 
 		RING_FINAL_CHECK_FOR_REQUESTS(&netif->tx, work_to_do);
 		if (!work_to_do) {
 			netif_put(netif);
+			if (only)
+				break;
 			continue;
 		}
 
@@ -1369,14 +1948,19 @@ static unsigned net_tx_build_mops(struct xen_netbk *netbk)
 		rmb(); /* Ensure that we see the request before we copy it. */
 		memcpy(&txreq, RING_GET_REQUEST(&netif->tx, idx), sizeof(txreq));
 
-		/* Credit-based scheduling. */
-		if (txreq.size > netif->remaining_credit &&
-		    tx_credit_exceeded(netif, txreq.size)) {
+		/* Token-bucket shaping, per vif and per group. */
+		if (netbk_tx_shaped(netbk, netif, txreq.size)) {
+			netif->nr_tx_credit_throttled++;
 			netif_put(netif);
+			if (only)
+				break;
 			continue;
 		}
 
-		netif->remaining_credit -= txreq.size;
+		netbk_tbf_charge(&netif->tx_tbf, txreq.size);
+		netbk_tbf_charge(&netbk->tx_tbf, txreq.size);
+		if (only)
+			(*budget)--;
 
 		work_to_do--;
 		netif->tx.req_cons = ++idx;
@@ -1392,6 +1976,9 @@ static unsigned net_tx_build_mops(struct xen_netbk *netbk)
 			}
 		}
 
+		/* Frame length, before the fragment sizes are taken off. */
+		total_size = txreq.size;
+
 		ret = netbk_count_requests(netif, &txreq, txfrags, work_to_do);
 		if (unlikely(ret < 0)) {
 			netbk_tx_err(netif, &txreq, idx - ret);
@@ -1414,12 +2001,19 @@ static unsigned net_tx_build_mops(struct xen_netbk *netbk)
 			continue;
 		}
 
-		index = pending_index(netbk->pending_cons);
+		index = pending_index(netbk, netbk->pending_cons);
 		pending_idx = netbk->pending_ring[index];
 
-		data_len = (txreq.size > PKT_PROT_LEN &&
-			    ret < MAX_SKB_FRAGS) ?
-			PKT_PROT_LEN : txreq.size;
+		/* Small frames are grant-copied whole, nothing is mapped. */
+		full_copy = !netif->persistent &&
+			    total_size <= netif->tx_copy_threshold;
+
+		if (full_copy)
+			data_len = total_size;
+		else
+			data_len = (txreq.size > PKT_PROT_LEN &&
+				    ret < MAX_SKB_FRAGS) ?
+				PKT_PROT_LEN : txreq.size;
 
 		skb = alloc_skb(data_len + NET_SKB_PAD + NET_IP_ALIGN,
 				GFP_ATOMIC | __GFP_NOWARN);
@@ -1443,18 +2037,65 @@ static unsigned net_tx_build_mops(struct xen_netbk *netbk)
 			}
 		}
 
-		gnttab_set_map_op(mop, idx_to_kaddr(netbk, pending_idx),
-				  GNTMAP_host_map | GNTMAP_readonly,
-				  txreq.gref, netif->domid);
-		mop++;
-
 		memcpy(&netbk->pending_tx_info[pending_idx].req,
 		       &txreq, sizeof(txreq));
 		netbk->pending_tx_info[pending_idx].netif = netif;
-		*((u16 *)skb->data) = pending_idx;
+
+		NETBK_TX_CB(skb)->pending_idx = pending_idx;
+		NETBK_TX_CB(skb)->nr_copy_ops = 0;
+		NETBK_TX_CB(skb)->full_copy = full_copy;
+		NETBK_TX_CB(skb)->head_mapped = 0;
+		NETBK_TX_CB(skb)->persistent = netif->persistent;
 
 		__skb_put(skb, data_len);
 
+		/*
+		 * Persistent grants need no hypercalls: copy the frame out
+		 * now and answer the fragment requests straight away.  The
+		 * header slot is kept to hold the netif until submission.
+		 */
+		if (netif->persistent) {
+			int i;
+
+			if (netbk_tx_copy_persistent(netif, skb, &txreq,
+						     txfrags, ret, data_len)) {
+				kfree_skb(skb);
+				netbk_tx_err(netif, &txreq, idx);
+				continue;
+			}
+
+			for (i = 0; i < ret; i++)
+				make_tx_response(netif, &txfrags[i],
+						 NETIF_RSP_OKAY);
+
+			__skb_queue_tail(&netbk->tx_queue, skb);
+			netbk->pending_cons++;
+
+			netif->tx.req_cons = idx;
+			netif_schedule_work(netif);
+			continue;
+		}
+
+		/*
+		 * The header is either grant-copied straight into the
+		 * linear area, or mapped and memcpy'd in net_tx_submit().
+		 * Any payload beyond data_len in the first slot stays
+		 * mapped and is attached as frag 0.
+		 */
+		if (full_copy || netif->tx_copy_headers)
+			gop = netbk_tx_copy_slot(netif, skb, gop, &txreq,
+						 0, min_t(unsigned int, data_len,
+						       txreq.size));
+
+		if (!full_copy &&
+		    (!netif->tx_copy_headers || data_len < txreq.size)) {
+			gnttab_set_map_op(mop, idx_to_kaddr(netbk, pending_idx),
+					  GNTMAP_host_map | GNTMAP_readonly,
+					  txreq.gref, netif->domid);
+			mop++;
+			NETBK_TX_CB(skb)->head_mapped = 1;
+		}
+
 		skb_shinfo(skb)->nr_frags = ret;
 		if (data_len < txreq.size) {
 			skb_shinfo(skb)->nr_frags++;
@@ -1469,36 +2110,154 @@ static unsigned net_tx_build_mops(struct xen_netbk *netbk)
 
 		netbk->pending_cons++;
 
-		mop = netbk_get_requests(netbk, netif, skb, txfrags, mop);
+		if (full_copy) {
+			unsigned int offset = txreq.size;
+			int i;
+
+			netbk_get_requests(netbk, netif, skb, txfrags, NULL);
+			for (i = 0; i < ret; i++) {
+				gop = netbk_tx_copy_slot(netif, skb, gop,
+							 &txfrags[i], offset,
+							 txfrags[i].size);
+				offset += txfrags[i].size;
+			}
+		} else {
+			mop = netbk_get_requests(netbk, netif, skb, txfrags, mop);
+		}
+
+		netif->nr_tx_map_ops += mop - frame_mop;
+		netif->nr_tx_copy_ops += gop - frame_gop;
 
 		netif->tx.req_cons = idx;
 		netif_schedule_work(netif);
 
-		if ((mop - netbk->tx_map_ops) >= ARRAY_SIZE(netbk->tx_map_ops))
+		if ((mop - netbk->tx_map_ops) >= netbk->max_pending_reqs)
+			break;
+
+		/* Worst case a frame splits every slot into two copies. */
+		if ((gop - netbk->tx_copy_ops) + 2 * (MAX_SKB_FRAGS + 1) >
+		    2 * netbk->max_pending_reqs)
 			break;
 	}
 
+	/* Saturated with vifs still waiting: back more slots. */
+	if ((nr_pending_reqs(netbk) + MAX_SKB_FRAGS) >=
+	    netbk->nr_pending_slots &&
+	    (only ? *budget > 0 : !list_empty(&netbk->net_schedule_list))) {
+		netbk->stats.pending_exhausted++;
+		if (netbk->nr_pending_slots < netbk->max_pending_reqs &&
+		    !netbk->pending_grow)
+			schedule_work(&netbk->pending_grow_work);
+	}
+
+	*nr_gops = gop - netbk->tx_copy_ops;
 	return mop - netbk->tx_map_ops;
 }
 
+static inline struct hlist_head *netbk_switch_bucket(const u8 *addr)
+{
+	u32 hash = jhash(addr, ETH_ALEN, 0);
+
+	return &netbk_switch_hash[hash & ((1 << NETBK_SWITCH_HASH_BITS) - 1)];
+}
+
+/* Make a connected vif reachable by the MAC address of its frontend. */
+void netbk_switch_add(struct xen_netif *netif)
+{
+	spin_lock_bh(&netbk_switch_lock);
+	if (hlist_unhashed(&netif->switch_node))
+		hlist_add_head_rcu(&netif->switch_node,
+				   netbk_switch_bucket(netif->fe_dev_addr));
+	spin_unlock_bh(&netbk_switch_lock);
+}
+
+/* Called before the vif's device goes away. */
+void netbk_switch_del(struct xen_netif *netif)
+{
+	if (hlist_unhashed(&netif->switch_node))
+		return;
+
+	spin_lock_bh(&netbk_switch_lock);
+	hlist_del_init_rcu(&netif->switch_node);
+	spin_unlock_bh(&netbk_switch_lock);
+
+	synchronize_rcu();
+}
+
+/*
+ * Queue a unicast frame from a guest directly on the vif of its
+ * destination, if that is another guest on this host.  The frags still
+ * reference the sender's granted pages, so net_rx_action copies them
+ * from grant to grant and the payload never touches dom0 memory.
+ * dev_queue_xmit() takes care of segmentation and checksums the
+ * receiving frontend cannot handle.  Returns 1 if the skb was consumed.
+ */
+static int netbk_switch_local(struct xen_netif *netif, struct sk_buff *skb)
+{
+	const u8 *dest = eth_hdr(skb)->h_dest;
+	struct xen_netif *dst;
+	struct hlist_node *node;
+
+	if (!is_valid_ether_addr(dest))
+		return 0;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(dst, node, netbk_switch_bucket(dest),
+				 switch_node) {
+		if (compare_ether_addr(dst->fe_dev_addr, dest))
+			continue;
+		if (dst->dev == skb->dev || !netif_running(dst->dev))
+			break;
+
+		skb_push(skb, ETH_HLEN);
+		skb->dev = dst->dev;
+		dev_queue_xmit(skb);
+		rcu_read_unlock();
+
+		netif->nr_local_switched++;
+		return 1;
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+/* Called after netfront has transmitted */
 static void net_tx_submit(struct xen_netbk *netbk)
 {
 	struct gnttab_map_grant_ref *mop;
+	struct gnttab_copy *gop;
 	struct sk_buff *skb;
 
 	mop = netbk->tx_map_ops;
+	gop = netbk->tx_copy_ops;
 	while ((skb = __skb_dequeue(&netbk->tx_queue)) != NULL) {
 		struct xen_netif_tx_request *txp;
 		struct xen_netif *netif;
 		u16 pending_idx;
 		unsigned data_len;
 
-		pending_idx = *((u16 *)skb->data);
+		pending_idx = NETBK_TX_CB(skb)->pending_idx;
 		netif = netbk->pending_tx_info[pending_idx].netif;
 		txp = &netbk->pending_tx_info[pending_idx].req;
 
+		if (NETBK_TX_CB(skb)->persistent) {
+			netbk_tx_release_copied(netbk, pending_idx,
+						NETIF_RSP_OKAY);
+			goto copied;
+		}
+
+		if (NETBK_TX_CB(skb)->full_copy) {
+			if (unlikely(netbk_tx_check_copied(netbk, skb, &gop))) {
+				DPRINTK("netback grant copy failed.\n");
+				kfree_skb(skb);
+				continue;
+			}
+			goto copied;
+		}
+
 		/* Check the remap error code. */
-		if (unlikely(netbk_tx_check_mop(netbk, skb, &mop))) {
+		if (unlikely(netbk_tx_check_mop(netbk, skb, &mop, &gop))) {
 			DPRINTK("netback grant failed.\n");
 			skb_shinfo(skb)->nr_frags = 0;
 			kfree_skb(skb);
@@ -1506,25 +2265,27 @@ static void net_tx_submit(struct xen_netbk *netbk)
 		}
 
 		data_len = skb->len;
-		memcpy(skb->data,
-		       (void *)(idx_to_kaddr(netbk, pending_idx)|txp->offset),
-		       data_len);
+		if (!NETBK_TX_CB(skb)->nr_copy_ops)
+			memcpy(skb->data,
+			       (void *)(idx_to_kaddr(netbk, pending_idx)|txp->offset),
+			       data_len);
 		if (data_len < txp->size) {
 			/* Append the packet payload as a fragment. */
 			txp->offset += data_len;
 			txp->size -= data_len;
 		} else {
 			/* Schedule a response immediately. */
-			netif_idx_release(netbk, pending_idx);
+			netbk_tx_release_head(netbk, skb);
 		}
 
+		netbk_fill_frags(netbk, skb);
+
+ copied:
 		if (txp->flags & NETTXF_csum_blank)
 			skb->ip_summed = CHECKSUM_PARTIAL;
 		else if (txp->flags & NETTXF_data_validated)
 			skb->ip_summed = CHECKSUM_UNNECESSARY;
 
-		netbk_fill_frags(netbk, skb);
-
 		/*
 		 * If the initial fragment was < PKT_PROT_LEN then
 		 * pull through some bytes from the other fragments to
@@ -1537,6 +2298,7 @@ static void net_tx_submit(struct xen_netbk *netbk)
 
 		skb->dev      = netif->dev;
 		skb->protocol = eth_type_trans(skb, skb->dev);
+		skb_record_rx_queue(skb, netif->queue_index);
 
 		if (checksum_setup(netif, skb)) {
 			DPRINTK("Can't setup checksum in net_tx_action\n");
@@ -1553,32 +2315,80 @@ static void net_tx_submit(struct xen_netbk *netbk)
 
 		netif->stats.rx_bytes += skb->len;
 		netif->stats.rx_packets++;
-
-		netif_rx_ni(skb);
 		netif->dev->last_rx = jiffies;
+
+		if (netbk_local_switch && netbk_switch_local(netif, skb))
+			continue;
+
+		if (netbk_tx_napi)
+			netif_receive_skb(skb);
+		else
+			netif_rx_ni(skb);
 	}
 }
 
-/* Called after netfront has transmitted */
-static void net_tx_action(unsigned long data)
+/* Put slots set up by netbk_pending_grow_work() into circulation. */
+static void netbk_add_pending_slots(struct xen_netbk *netbk)
 {
-	struct xen_netbk *netbk = (struct xen_netbk *)data;
-	unsigned nr_mops;
+	unsigned int i, nr = netbk->pending_grow;
+	pending_ring_idx_t index;
+
+	if (likely(!nr))
+		return;
+
+	smp_rmb(); /* See the new mmap_pages before using the slots. */
+
+	for (i = 0; i < nr; i++) {
+		index = pending_index(netbk, netbk->pending_prod++);
+		netbk->pending_ring[index] = netbk->nr_pending_slots + i;
+	}
+	netbk->nr_pending_slots += nr;
+
+	smp_wmb(); /* nr_pending_slots is final before pending_grow clears. */
+	netbk->pending_grow = 0;
+}
+
+/* One map/copy batch, from the schedule list or from @only. */
+static void net_tx_do_batch(struct xen_netbk *netbk,
+			    struct xen_netif *only, int *budget)
+{
+	unsigned nr_mops, nr_gops, i;
 	int ret;
 
-	net_tx_action_dealloc(netbk);
+	nr_mops = net_tx_build_mops(netbk, only, budget, &nr_gops);
 
-	nr_mops = net_tx_build_mops(netbk);
+	if (nr_mops == 0 && nr_gops == 0)
+		return;
 
-	if (nr_mops == 0)
-		goto out;
+	if (nr_mops) {
+		/* Every map op targets a slot page in the direct map. */
+		for (i = 0; i < nr_mops; i++)
+			netbk->tx_map_pages[i] =
+				virt_to_page(netbk->tx_map_ops[i].host_addr);
 
-	ret = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref,
-					netbk->tx_map_ops, nr_mops);
-	BUG_ON(ret);
+		ret = gnttab_map_refs(netbk->tx_map_ops, netbk->tx_map_pages,
+				      nr_mops);
+		BUG_ON(ret);
+		netbk->stats.tx_map_batches++;
+		netbk->stats.tx_map_ops += nr_mops;
+	}
+
+	if (nr_gops) {
+		ret = HYPERVISOR_grant_table_op(GNTTABOP_copy,
+						netbk->tx_copy_ops, nr_gops);
+		BUG_ON(ret);
+		netbk->stats.tx_copy_batches++;
+		netbk->stats.tx_copy_ops += nr_gops;
+	}
+
+	if (nr_mops + nr_gops > netbk->stats.tx_batch_max)
+		netbk->stats.tx_batch_max = nr_mops + nr_gops;
 
 	net_tx_submit(netbk);
-out:
+}
+
+static void net_tx_arm_pending_timer(struct xen_netbk *netbk)
+{
 	if (netbk_copy_skb_mode == NETBK_DELAYED_COPY_SKB &&
 	    !list_empty(&netbk->pending_inuse_head)) {
 		struct netbk_tx_pending_inuse *oldest;
@@ -1590,6 +2400,88 @@ out:
 	}
 }
 
+static inline int netbk_tx_slots_exhausted(struct xen_netbk *netbk)
+{
+	return (nr_pending_reqs(netbk) + MAX_SKB_FRAGS) >=
+		netbk->nr_pending_slots;
+}
+
+/* NAPI mode: restart vifs which parked themselves waiting for slots. */
+static void netbk_napi_kick_waiting(struct xen_netbk *netbk)
+{
+	struct xen_netif *netif;
+
+	while (!netbk_tx_slots_exhausted(netbk) &&
+	       (netif = poll_net_schedule_list(netbk)) != NULL) {
+		napi_schedule(&netif->napi);
+		netif_put(netif);
+	}
+}
+
+static void net_tx_action(unsigned long data)
+{
+	struct xen_netbk *netbk = (struct xen_netbk *)data;
+
+	spin_lock_bh(&netbk->tx_lock);
+
+	net_tx_action_dealloc(netbk);
+
+	netbk_add_pending_slots(netbk);
+
+	/* In NAPI mode the vifs pull their own requests. */
+	if (!netbk_tx_napi)
+		net_tx_do_batch(netbk, NULL, NULL);
+
+	net_tx_arm_pending_timer(netbk);
+
+	spin_unlock_bh(&netbk->tx_lock);
+
+	if (netbk_tx_napi)
+		netbk_napi_kick_waiting(netbk);
+}
+
+/*
+ * NAPI poll of one vif's TX ring.  A vif that runs out of credit is
+ * restarted by its shaper; one that runs out of pending slots
+ * waits on the group's schedule list until the tasklet frees some.
+ */
+int netbk_tx_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct xen_netif *netif = container_of(napi, struct xen_netif, napi);
+	struct xen_netbk *netbk = &xen_netbk[netif->group];
+	int left = budget, work_done, more_to_do, waiting;
+
+	spin_lock(&netbk->tx_lock);
+
+	net_tx_action_dealloc(netbk);
+	netbk_add_pending_slots(netbk);
+
+	net_tx_do_batch(netbk, netif, &left);
+	work_done = budget - left;
+
+	waiting = netbk_tx_slots_exhausted(netbk);
+	if (work_done < budget && waiting) {
+		netif->nr_tx_pending_full++;
+		add_to_net_schedule_list_tail(netif);
+	}
+
+	net_tx_arm_pending_timer(netbk);
+
+	spin_unlock(&netbk->tx_lock);
+
+	if (work_done < budget) {
+		napi_complete(napi);
+		if (waiting || hrtimer_active(&netif->tx_shaper))
+			return work_done;
+
+		RING_FINAL_CHECK_FOR_REQUESTS(&netif->tx, more_to_do);
+		if (more_to_do)
+			napi_schedule(napi);
+	}
+
+	return work_done;
+}
+
 static void netif_idx_release(struct xen_netbk *netbk, u16 pending_idx)
 {
 	static DEFINE_SPINLOCK(_lock);
@@ -1597,7 +2489,7 @@ static void netif_idx_release(struct xen_netbk *netbk, u16 pending_idx)
 	pending_ring_idx_t index;
 
 	spin_lock_irqsave(&_lock, flags);
-	index = pending_index(netbk->dealloc_prod);
+	index = pending_index(netbk, netbk->dealloc_prod);
 	netbk->dealloc_ring[index] = pending_idx;
 	/* Sync with net_tx_action_dealloc: insert idx /then/ incr producer. */
 	smp_wmb();
@@ -1628,11 +2520,16 @@ irqreturn_t netif_be_int(int irq, void *dev_id)
 
 	netbk = &xen_netbk[netif->group];
 
-	add_to_net_schedule_list_tail(netif);
-	maybe_schedule_tx_action(netbk);
+	if (netbk_tx_napi) {
+		napi_schedule(&netif->napi);
+	} else {
+		add_to_net_schedule_list_tail(netif);
+		maybe_schedule_tx_action(netbk);
+	}
 
-	if (netif_schedulable(netif) && !netbk_queue_full(netif))
-		netif_wake_queue(netif->dev);
+	if (netif_schedulable(netif) && !netbk_queue_full(netif) &&
+	    !hrtimer_active(&netif->rx_shaper))
+		netif_tx_wake_queue(netif_txq(netif));
 
 	return IRQ_HANDLED;
 }
@@ -1737,6 +2634,70 @@ static irqreturn_t netif_be_dbg(int irq, void *dev_id, struct pt_regs *regs)
 }
 #endif
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *netbk_debugfs_root;
+
+static void netbk_debugfs_init(void)
+{
+	int group;
+
+	netbk_debugfs_root = debugfs_create_dir("xen-netback", NULL);
+	if (!netbk_debugfs_root)
+		return;
+
+	for (group = 0; group < xen_netbk_group_nr; group++) {
+		struct xen_netbk *netbk = &xen_netbk[group];
+		struct netbk_group_stats *stats = &netbk->stats;
+		struct dentry *dir;
+		char name[16];
+
+		snprintf(name, sizeof(name), "group-%d", group);
+		dir = debugfs_create_dir(name, netbk_debugfs_root);
+		if (!dir)
+			continue;
+		netbk->debugfs_dir = dir;
+
+		debugfs_create_u64("tx_map_batches", 0444, dir,
+				   &stats->tx_map_batches);
+		debugfs_create_u64("tx_map_ops", 0444, dir,
+				   &stats->tx_map_ops);
+		debugfs_create_u64("tx_copy_batches", 0444, dir,
+				   &stats->tx_copy_batches);
+		debugfs_create_u64("tx_copy_ops", 0444, dir,
+				   &stats->tx_copy_ops);
+		debugfs_create_u64("tx_unmap_batches", 0444, dir,
+				   &stats->tx_unmap_batches);
+		debugfs_create_u64("tx_unmap_ops", 0444, dir,
+				   &stats->tx_unmap_ops);
+		debugfs_create_u64("rx_copy_batches", 0444, dir,
+				   &stats->rx_copy_batches);
+		debugfs_create_u64("rx_copy_ops", 0444, dir,
+				   &stats->rx_copy_ops);
+		debugfs_create_u32("tx_batch_max", 0444, dir,
+				   &stats->tx_batch_max);
+		debugfs_create_u32("rx_batch_max", 0444, dir,
+				   &stats->rx_batch_max);
+		debugfs_create_u64("pending_exhausted", 0444, dir,
+				   &stats->pending_exhausted);
+		debugfs_create_u32("pending_slots", 0444, dir,
+				   &netbk->nr_pending_slots);
+		debugfs_create_u32("max_pending_reqs", 0444, dir,
+				   &netbk->max_pending_reqs);
+		debugfs_create_u32("netfront_count", 0444, dir,
+				   (u32 *)&netbk->netfront_count.counter);
+	}
+}
+
+static void netbk_debugfs_exit(void)
+{
+	debugfs_remove_recursive(netbk_debugfs_root);
+	netbk_debugfs_root = NULL;
+}
+#else
+static inline void netbk_debugfs_init(void) {}
+static inline void netbk_debugfs_exit(void) {}
+#endif
+
 static inline int rx_work_todo(struct xen_netbk *netbk)
 {
 	return !skb_queue_empty(&netbk->rx_queue);
@@ -1751,10 +2712,14 @@ static inline int tx_work_todo(struct xen_netbk *netbk)
 	    !list_empty(&netbk->pending_inuse_head))
 		return 1;
 
-	if (((nr_pending_reqs(netbk) + MAX_SKB_FRAGS) < MAX_PENDING_REQS) &&
+	if (((nr_pending_reqs(netbk) + MAX_SKB_FRAGS) <
+	     netbk->nr_pending_slots) &&
 			!list_empty(&netbk->net_schedule_list))
 		return 1;
 
+	if (netbk->pending_grow)
+		return 1;
+
 	return 0;
 }
 
@@ -1781,10 +2746,150 @@ static int netbk_action_thread(void *data)
 	return 0;
 }
 
+/* The group's bookkeeping lives on the node of the CPU serving it. */
+static void *netbk_alloc_array(struct xen_netbk *netbk, unsigned int nr,
+			       size_t size)
+{
+	void *p = vmalloc_node(nr * size, netbk->node);
+
+	if (p)
+		memset(p, 0, nr * size);
+	return p;
+}
+
+/* Back pending slots [start, start + NETBK_MIN_PENDING_REQS) with pages. */
+static int netbk_alloc_pending_chunk(struct xen_netbk *netbk,
+				     unsigned int start)
+{
+	unsigned int group = netbk - xen_netbk;
+	struct page **pages;
+	int i;
+
+	pages = alloc_empty_pages_and_pagevec(NETBK_MIN_PENDING_REQS);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < NETBK_MIN_PENDING_REQS; i++) {
+		SetPageForeign(pages[i], netif_page_release);
+		netif_set_page_ext(pages[i], group, start + i);
+		INIT_LIST_HEAD(&netbk->pending_inuse[start + i].list);
+		netbk->mmap_pages[start + i] = pages[i];
+	}
+	netbk->mmap_chunks[start / NETBK_MIN_PENDING_REQS] = pages;
+
+	return 0;
+}
+
+/*
+ * A group whose vifs keep every pending slot busy grows by another
+ * chunk.  The pages are set up here, in process context, and
+ * net_tx_action() puts the new slots into circulation.  Groups never
+ * shrink.
+ */
+static void netbk_pending_grow_work(struct work_struct *work)
+{
+	struct xen_netbk *netbk = container_of(work, struct xen_netbk,
+					       pending_grow_work);
+	unsigned int start;
+
+	if (netbk->pending_grow)
+		return;
+
+	smp_rmb(); /* Pairs with netbk_add_pending_slots(). */
+	start = netbk->nr_pending_slots;
+	if (start >= netbk->max_pending_reqs)
+		return;
+
+	if (netbk_alloc_pending_chunk(netbk, start)) {
+		DPRINTK("Can't grow netback group %ld past %u slots.\n",
+			(long)(netbk - xen_netbk), start);
+		return;
+	}
+
+	smp_wmb(); /* Publish the pages before the slots naming them. */
+	netbk->pending_grow = NETBK_MIN_PENDING_REQS;
+	xen_netbk_bh_handler(netbk, 0);
+}
+
+static void netbk_free_pending(struct xen_netbk *netbk)
+{
+	int i;
+
+	for (i = 0; i < NETBK_MAX_PENDING_CHUNKS; i++) {
+		if (!netbk->mmap_chunks[i])
+			continue;
+		free_empty_pages_and_pagevec(netbk->mmap_chunks[i],
+					     NETBK_MIN_PENDING_REQS);
+		netbk->mmap_chunks[i] = NULL;
+	}
+
+	vfree(netbk->mmap_pages);
+	vfree(netbk->pending_tx_info);
+	vfree(netbk->pending_inuse);
+	vfree(netbk->tx_unmap_ops);
+	vfree(netbk->tx_map_ops);
+	vfree(netbk->tx_unmap_pages);
+	vfree(netbk->tx_map_pages);
+	vfree(netbk->tx_copy_ops);
+	vfree(netbk->grant_tx_handle);
+	vfree(netbk->pending_ring);
+	vfree(netbk->dealloc_ring);
+	netbk->mmap_pages = NULL;
+}
+
+static int netbk_alloc_pending(struct xen_netbk *netbk)
+{
+	unsigned int nr = netbk_max_pending_reqs;
+	int i;
+
+	netbk->max_pending_reqs = nr;
+
+	netbk->mmap_pages = netbk_alloc_array(netbk, nr, sizeof(struct page *));
+	netbk->pending_tx_info =
+		netbk_alloc_array(netbk, nr, sizeof(struct pending_tx_info));
+	netbk->pending_inuse =
+		netbk_alloc_array(netbk, nr, sizeof(struct netbk_tx_pending_inuse));
+	netbk->tx_unmap_ops =
+		netbk_alloc_array(netbk, nr, sizeof(struct gnttab_unmap_grant_ref));
+	netbk->tx_map_ops =
+		netbk_alloc_array(netbk, nr, sizeof(struct gnttab_map_grant_ref));
+	netbk->tx_unmap_pages = netbk_alloc_array(netbk, nr, sizeof(struct page *));
+	netbk->tx_map_pages = netbk_alloc_array(netbk, nr, sizeof(struct page *));
+	netbk->tx_copy_ops =
+		netbk_alloc_array(netbk, 2 * nr, sizeof(struct gnttab_copy));
+	netbk->grant_tx_handle = netbk_alloc_array(netbk, nr, sizeof(grant_handle_t));
+	netbk->pending_ring = netbk_alloc_array(netbk, nr, sizeof(u16));
+	netbk->dealloc_ring = netbk_alloc_array(netbk, nr, sizeof(u16));
+
+	if (!netbk->mmap_pages || !netbk->pending_tx_info ||
+	    !netbk->pending_inuse || !netbk->tx_unmap_ops ||
+	    !netbk->tx_map_ops || !netbk->tx_unmap_pages ||
+	    !netbk->tx_map_pages || !netbk->tx_copy_ops ||
+	    !netbk->grant_tx_handle || !netbk->pending_ring ||
+	    !netbk->dealloc_ring)
+		goto fail;
+
+	if (netbk_alloc_pending_chunk(netbk, 0))
+		goto fail;
+
+	netbk->nr_pending_slots = NETBK_MIN_PENDING_REQS;
+	netbk->pending_cons = 0;
+	netbk->pending_prod = NETBK_MIN_PENDING_REQS;
+	for (i = 0; i < NETBK_MIN_PENDING_REQS; i++)
+		netbk->pending_ring[i] = i;
+
+	INIT_WORK(&netbk->pending_grow_work, netbk_pending_grow_work);
+
+	return 0;
+
+ fail:
+	netbk_free_pending(netbk);
+	return -ENOMEM;
+}
+
 static int __init netback_init(void)
 {
 	int i;
-	struct page *page;
 	int rc = 0;
 	int group;
 
@@ -1792,6 +2897,17 @@ static int __init netback_init(void)
 		return -ENODEV;
 
 	xen_netbk_group_nr = num_online_cpus();
+
+	netbk_tx_napi = MODPARM_netback_napi && !MODPARM_netback_kthread;
+
+	if (netbk_max_queues == 0)
+		netbk_max_queues = xen_netbk_group_nr;
+	netbk_max_queues = min_t(unsigned int, netbk_max_queues,
+				 NETBK_MAX_QUEUES);
+
+	netbk_max_pending_reqs = roundup_pow_of_two(
+		clamp_t(unsigned int, netbk_max_pending_reqs,
+			NETBK_MIN_PENDING_REQS, NETBK_MAX_PENDING_REQS));
 	xen_netbk = vmalloc(sizeof(struct xen_netbk) * xen_netbk_group_nr);
 	if (!xen_netbk) {
 		printk(KERN_ALERT "%s: out of memory\n", __func__);
@@ -1807,6 +2923,9 @@ static int __init netback_init(void)
 		skb_queue_head_init(&netbk->rx_queue);
 		skb_queue_head_init(&netbk->tx_queue);
 
+		/* Group N is served by CPU N, see kthread_bind() below. */
+		netbk->node = cpu_to_node(group);
+
 		init_timer(&netbk->net_timer);
 		netbk->net_timer.data = (unsigned long)netbk;
 		netbk->net_timer.function = net_alarm;
@@ -1816,9 +2935,7 @@ static int __init netback_init(void)
 		netbk->netbk_tx_pending_timer.function =
 			netbk_tx_pending_timeout;
 
-		netbk->mmap_pages =
-			alloc_empty_pages_and_pagevec(MAX_PENDING_REQS);
-		if (!netbk->mmap_pages) {
+		if (netbk_alloc_pending(netbk)) {
 			printk(KERN_ALERT "%s: out of memory\n", __func__);
 			del_timer(&netbk->netbk_tx_pending_timer);
 			del_timer(&netbk->net_timer);
@@ -1826,18 +2943,6 @@ static int __init netback_init(void)
 			goto failed_init;
 		}
 
-		for (i = 0; i < MAX_PENDING_REQS; i++) {
-			page = netbk->mmap_pages[i];
-			SetPageForeign(page, netif_page_release);
-			netif_set_page_ext(page, group, i);
-			INIT_LIST_HEAD(&netbk->pending_inuse[i].list);
-		}
-
-		netbk->pending_cons = 0;
-		netbk->pending_prod = MAX_PENDING_REQS;
-		for (i = 0; i < MAX_PENDING_REQS; i++)
-			netbk->pending_ring[i] = i;
-
 		if (MODPARM_netback_kthread) {
 			init_waitqueue_head(&netbk->kthread.netbk_action_wq);
 			netbk->kthread.task =
@@ -1850,8 +2955,7 @@ static int __init netback_init(void)
 			} else {
 				printk(KERN_ALERT
 					"kthread_run() fails at netback\n");
-				free_empty_pages_and_pagevec(netbk->mmap_pages,
-						MAX_PENDING_REQS);
+				netbk_free_pending(netbk);
 				del_timer(&netbk->netbk_tx_pending_timer);
 				del_timer(&netbk->net_timer);
 				rc = PTR_ERR(netbk->kthread.task);
@@ -1870,6 +2974,13 @@ static int __init netback_init(void)
 		INIT_LIST_HEAD(&netbk->net_schedule_list);
 
 		spin_lock_init(&netbk->net_schedule_list_lock);
+		spin_lock_init(&netbk->tx_lock);
+
+		netbk_tbf_init(&netbk->tx_tbf, netbk_group_tx_rate,
+			       netbk_group_burst);
+		netbk_tbf_init(&netbk->rx_tbf, netbk_group_rx_rate,
+			       netbk_group_burst);
+		spin_lock_init(&netbk->rx_tbf_lock);
 
 		atomic_set(&netbk->netfront_count, 0);
 
@@ -1888,9 +2999,13 @@ static int __init netback_init(void)
 
 	//netif_accel_init();
 
+	netbk_debugfs_init();
+
 	rc = netif_xenbus_init();
-	if (rc)
+	if (rc) {
+		netbk_debugfs_exit();
 		goto failed_init;
+	}
 
 #ifdef NETBE_DEBUG_INTERRUPT
 	(void)bind_virq_to_irqhandler(VIRQ_DEBUG,
@@ -1906,8 +3021,7 @@ static int __init netback_init(void)
 failed_init:
 	for (i = 0; i < group; i++) {
 		struct xen_netbk *netbk = &xen_netbk[i];
-		free_empty_pages_and_pagevec(netbk->mmap_pages,
-				MAX_PENDING_REQS);
+		netbk_free_pending(netbk);
 		del_timer(&netbk->netbk_tx_pending_timer);
 		del_timer(&netbk->net_timer);
 		if (MODPARM_netback_kthread)
@@ -126,6 +126,24 @@ static int netback_probe(struct xenbus_device *dev,
 			goto abort_transaction;
 		}
 
+		/* We can keep TX buffers mapped across requests. */
+		err = xenbus_printf(xbt, dev->nodename,
+				    "feature-persistent", "%d",
+				    netbk_feature_persistent);
+		if (err) {
+			message = "writing feature-persistent";
+			goto abort_transaction;
+		}
+
+		/* Multi-queue support: one ring pair per queue. */
+		err = xenbus_printf(xbt, dev->nodename,
+				    "multi-queue-max-queues", "%u",
+				    netbk_max_queues);
+		if (err) {
+			message = "writing multi-queue-max-queues";
+			goto abort_transaction;
+		}
+
 		err = xenbus_transaction_end(xbt, 0);
 	} while (err == -EAGAIN);
 
@@ -282,18 +300,25 @@ static void frontend_changed(struct xenbus_device *dev,
 }
 
 
-static void xen_net_read_rate(struct xenbus_device *dev,
-			      unsigned long *bytes, unsigned long *usec)
+/*
+ * Read a "bytes,usec" limit from @node, and the bucket depth in bytes
+ * from "@node-burst" if present.  The burst defaults to one window
+ * worth of bytes, which is what the old credit scheme allowed.
+ */
+static void xen_net_read_rate(struct xenbus_device *dev, const char *node,
+			      u64 *rate, u64 *burst)
 {
 	char *s, *e;
 	unsigned long b, u;
+	unsigned long long depth;
 	char *ratestr;
+	char burst_node[32];
 
 	/* Default to unlimited bandwidth. */
-	*bytes = ~0UL;
-	*usec = 0;
+	*rate = 0;
+	*burst = 0;
 
-	ratestr = xenbus_read(XBT_NIL, dev->nodename, "rate", NULL);
+	ratestr = xenbus_read(XBT_NIL, dev->nodename, node, NULL);
 	if (IS_ERR(ratestr))
 		return;
 
@@ -307,10 +332,19 @@ static void xen_net_read_rate(struct xenbus_device *dev,
 	if ((s == e) || (*e != '\0'))
 		goto fail;
 
-	*bytes = b;
-	*usec = u;
-
 	kfree(ratestr);
+
+	if (u == 0)
+		return;
+
+	*burst = min_t(u64, b, NETBK_MAX_BURST);
+	*rate = max_t(u64, div_u64(*burst * USEC_PER_SEC, u), 1);
+
+	snprintf(burst_node, sizeof(burst_node), "%s-burst", node);
+	if (xenbus_scanf(XBT_NIL, dev->nodename, burst_node,
+			 "%llu", &depth) == 1)
+		*burst = depth;
+	*burst = min_t(u64, *burst, NETBK_MAX_BURST);
 	return;
 
  fail:
@@ -318,6 +352,45 @@ static void xen_net_read_rate(struct xenbus_device *dev,
 	kfree(ratestr);
 }
 
+/*
+ * Optional per-vif TX copy mode set by the toolstack: "tx-copy-headers"
+ * and "tx-copy-threshold" override the module defaults.
+ */
+/*
+ * The toolstack may write "numa-node" with the node backing the guest's
+ * memory, so that its vif is served from CPUs on that node.
+ */
+static void xen_net_read_numa_node(struct xenbus_device *dev,
+				   struct xen_netif *netif)
+{
+	int node;
+
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "numa-node",
+			 "%d", &node) != 1 ||
+	    node < 0 || node >= MAX_NUMNODES || !node_online(node))
+		node = -1;
+
+	netif->numa_node = node;
+}
+
+static void xen_net_read_tx_copy(struct xenbus_device *dev,
+				 struct xen_netif *netif)
+{
+	int copy_headers;
+	unsigned int threshold;
+	unsigned int i;
+
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "tx-copy-headers",
+			 "%d", &copy_headers) != 1)
+		copy_headers = netif->tx_copy_headers;
+	if (xenbus_scanf(XBT_NIL, dev->nodename, "tx-copy-threshold",
+			 "%u", &threshold) != 1)
+		threshold = netif->tx_copy_threshold;
+
+	for (i = 0; i < netif->num_queues; i++)
+		netif_set_tx_copy(netif->queues[i], copy_headers, threshold);
+}
+
 static int xen_net_read_mac(struct xenbus_device *dev, u8 mac[])
 {
 	char *s, *e, *macstr;
@@ -373,8 +446,13 @@ static void hotplug_status_changed(struct xenbus_watch *watch,
 static void connect(struct backend_info *be)
 {
 	int err;
+	unsigned int i;
+	u64 tx_rate, tx_burst, rx_rate, rx_burst;
 	struct xenbus_device *dev = be->dev;
 
+	/* Queues pick their groups as the rings connect. */
+	xen_net_read_numa_node(dev, be->netif);
+
 	err = connect_rings(be);
 	if (err)
 		return;
@@ -385,9 +463,20 @@ static void connect(struct backend_info *be)
 		return;
 	}
 
-	xen_net_read_rate(dev, &be->netif->credit_bytes,
-			  &be->netif->credit_usec);
-	be->netif->remaining_credit = be->netif->credit_bytes;
+	xen_net_read_rate(dev, "rate", &tx_rate, &tx_burst);
+	xen_net_read_rate(dev, "rx-rate", &rx_rate, &rx_burst);
+
+	xen_net_read_tx_copy(dev, be->netif);
+
+	netbk_switch_add(be->netif);
+
+	/* Each queue is shaped independently at the configured rate. */
+	for (i = 0; i < be->netif->num_queues; i++) {
+		struct xen_netif *queue = be->netif->queues[i];
+
+		netbk_tbf_init(&queue->tx_tbf, tx_rate, tx_burst);
+		netbk_tbf_init(&queue->rx_tbf, rx_rate, rx_burst);
+	}
 
 	unregister_hotplug_status_watch(be);
 	err = xenbus_watch_pathfmt(dev, &be->hotplug_status_watch,
@@ -400,31 +489,55 @@ static void connect(struct backend_info *be)
 		be->have_hotplug_status_watch = 1;
 	}
 
-	netif_wake_queue(be->netif->dev);
+	netif_tx_wake_all_queues(be->netif->dev);
 }
 
 
-static int connect_rings(struct backend_info *be)
+/*
+ * Map the rings and bind the event channel of one queue.  Single-queue
+ * frontends keep the keys directly in their own directory; with
+ * multi-queue each queue N has its own "queue-N" subdirectory.
+ */
+static int connect_queue(struct backend_info *be, struct xen_netif *queue,
+			 const char *dir)
 {
-	struct xen_netif *netif = be->netif;
 	struct xenbus_device *dev = be->dev;
 	unsigned long tx_ring_ref, rx_ring_ref;
-	unsigned int evtchn, rx_copy;
+	unsigned int evtchn;
 	int err;
-	int val;
 
-	DPRINTK("");
-
-	err = xenbus_gather(XBT_NIL, dev->otherend,
+	err = xenbus_gather(XBT_NIL, dir,
 			    "tx-ring-ref", "%lu", &tx_ring_ref,
 			    "rx-ring-ref", "%lu", &rx_ring_ref,
 			    "event-channel", "%u", &evtchn, NULL);
 	if (err) {
 		xenbus_dev_fatal(dev, err,
 				 "reading %s/ring-ref and event-channel",
-				 dev->otherend);
+				 dir);
+		return err;
+	}
+
+	/* Map the shared frame, irq etc. */
+	err = netif_map(queue, tx_ring_ref, rx_ring_ref, evtchn);
+	if (err) {
+		xenbus_dev_fatal(dev, err,
+				 "mapping shared-frames %lu/%lu port %u",
+				 tx_ring_ref, rx_ring_ref, evtchn);
 		return err;
 	}
+	return 0;
+}
+
+static int connect_rings(struct backend_info *be)
+{
+	struct xen_netif *netif = be->netif;
+	struct xenbus_device *dev = be->dev;
+	unsigned int num_queues, rx_copy;
+	unsigned int i;
+	int err;
+	int val;
+
+	DPRINTK("");
 
 	err = xenbus_scanf(XBT_NIL, dev->otherend, "request-rx-copy", "%u",
 			   &rx_copy);
@@ -440,6 +553,17 @@ static int connect_rings(struct backend_info *be)
 	if (!rx_copy)
 		return -EOPNOTSUPP;
 
+	if (xenbus_scanf(XBT_NIL, dev->otherend, "multi-queue-num-queues",
+			 "%u", &num_queues) < 0)
+		num_queues = 1;
+	if (num_queues == 0 || num_queues > netbk_max_queues) {
+		xenbus_dev_fatal(dev, -EINVAL,
+				 "guest requested %u queues, exceeding the "
+				 "maximum of %u", num_queues,
+				 netbk_max_queues);
+		return -EINVAL;
+	}
+
 	if (netif->dev->tx_queue_len != 0) {
 		if (xenbus_scanf(XBT_NIL, dev->otherend,
 				 "feature-rx-notify", "%d", &val) < 0)
@@ -476,17 +600,48 @@ static int connect_rings(struct backend_info *be)
 		val = 0;
 	netif->smart_poll = !!val;
 
+	if (xenbus_scanf(XBT_NIL, dev->otherend, "feature-persistent",
+			 "%d", &val) < 0)
+		val = 0;
+	netif->persistent = netbk_feature_persistent && val;
+
 	/* Set dev->features */
 	netif_set_features(netif);
 
-	/* Map the shared frame, irq etc. */
-	err = netif_map(netif, tx_ring_ref, rx_ring_ref, evtchn);
+	err = netif_alloc_queues(netif, num_queues);
 	if (err) {
-		xenbus_dev_fatal(dev, err,
-				 "mapping shared-frames %lu/%lu port %u",
-				 tx_ring_ref, rx_ring_ref, evtchn);
+		xenbus_dev_fatal(dev, err, "allocating %u queues",
+				 num_queues);
 		return err;
 	}
+
+	if (num_queues == 1)
+		return connect_queue(be, netif, dev->otherend);
+
+	for (i = 0; i < num_queues; i++) {
+		struct xen_netif *queue = netif->queues[i];
+		char *dir;
+
+		/* Frontend features apply to every queue. */
+		queue->can_queue  = netif->can_queue;
+		queue->can_sg     = netif->can_sg;
+		queue->gso        = netif->gso;
+		queue->gso_prefix = netif->gso_prefix;
+		queue->csum       = netif->csum;
+		queue->smart_poll = netif->smart_poll;
+		queue->persistent = netif->persistent;
+
+		dir = kasprintf(GFP_KERNEL, "%s/queue-%u", dev->otherend, i);
+		if (!dir) {
+			xenbus_dev_fatal(dev, -ENOMEM, "allocating queue path");
+			return -ENOMEM;
+		}
+		err = connect_queue(be, queue, dir);
+		kfree(dir);
+		if (err)
+			return err;
+	}
+
 	return 0;
 }
 
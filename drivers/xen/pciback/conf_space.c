@@ -121,6 +121,46 @@ static inline u32 merge_value(u32 val, u32 new_val, u32 new_val_mask,
 	return val;
 }
 
+/*
+ * Reads of cacheable fields are remembered per byte in the device's
+ * config shadow until the next write, reset or field list change, so
+ * guests polling identity, BAR and capability list registers don't
+ * walk the field list or touch the hardware each time.
+ */
+static inline void cfg_shadow_invalidate(struct pciback_dev_data *dev_data)
+{
+	bitmap_zero(dev_data->cfg_cached, PCIBACK_CFG_SHADOW_SIZE);
+}
+
+static int cfg_shadow_read(struct pciback_dev_data *dev_data, int offset,
+			   int size, u32 *value)
+{
+	int i;
+
+	if (offset + size > PCIBACK_CFG_SHADOW_SIZE)
+		return 0;
+
+	for (i = 0; i < size; i++)
+		if (!test_bit(offset + i, dev_data->cfg_cached))
+			return 0;
+
+	*value = 0;
+	for (i = 0; i < size; i++)
+		*value |= dev_data->cfg_shadow[offset + i] << (i * 8);
+	return 1;
+}
+
+static void cfg_shadow_fill(struct pciback_dev_data *dev_data, int offset,
+			    int size, u32 value)
+{
+	int i;
+
+	for (i = 0; i < size && offset + i < PCIBACK_CFG_SHADOW_SIZE; i++) {
+		dev_data->cfg_shadow[offset + i] = value >> (i * 8);
+		__set_bit(offset + i, dev_data->cfg_cached);
+	}
+}
+
 static int pcibios_err_to_errno(int err)
 {
 	switch (err) {
@@ -148,7 +188,7 @@ int pciback_config_read(struct pci_dev *dev, int offset, int size,
 	int req_start, req_end, field_start, field_end;
 	/* if read fails for any reason, return 0
 	 * (as if device didn't respond) */
-	u32 value = 0, tmp_val;
+	u32 value = 0, tmp_val, covered = 0;
 
 	if (unlikely(verbose_request))
 		printk(KERN_DEBUG "pciback: %s: read %d bytes at 0x%x\n",
@@ -159,18 +199,8 @@ int pciback_config_read(struct pci_dev *dev, int offset, int size,
 		goto out;
 	}
 
-	/* Get the real value first, then modify as appropriate */
-	switch (size) {
-	case 1:
-		err = pci_read_config_byte(dev, offset, (u8 *) &value);
-		break;
-	case 2:
-		err = pci_read_config_word(dev, offset, (u16 *) &value);
-		break;
-	case 4:
-		err = pci_read_config_dword(dev, offset, &value);
-		break;
-	}
+	if (cfg_shadow_read(dev_data, offset, size, &value))
+		goto out;
 
 	list_for_each_entry(cfg_entry, &dev_data->config_fields, list) {
 		field = cfg_entry->field;
@@ -187,10 +217,36 @@ int pciback_config_read(struct pci_dev *dev, int offset, int size,
 			if (err)
 				goto out;
 
+			if (field->cacheable)
+				cfg_shadow_fill(dev_data, field_start,
+						field->size, tmp_val);
+
 			value = merge_value(value, tmp_val,
 					    get_mask(field->size),
 					    field_start - req_start);
+			covered = merge_value(covered, ~0,
+					      get_mask(field->size),
+					      field_start - req_start);
+		}
+	}
+
+	/* Only go to the hardware for bytes no field has supplied */
+	covered &= get_mask(size);
+	if (covered != get_mask(size)) {
+		tmp_val = 0;
+		switch (size) {
+		case 1:
+			err = pci_read_config_byte(dev, offset, (u8 *) &tmp_val);
+			break;
+		case 2:
+			err = pci_read_config_word(dev, offset,
+						   (u16 *) &tmp_val);
+			break;
+		case 4:
+			err = pci_read_config_dword(dev, offset, &tmp_val);
+			break;
 		}
+		value = (tmp_val & ~covered) | (value & covered);
 	}
 
 out:
@@ -287,6 +343,9 @@ int pciback_config_write(struct pci_dev *dev, int offset, int size, u32 value)
 		}
 	}
 
+	/* Dropped last: the field reads above may have refilled it. */
+	cfg_shadow_invalidate(dev_data);
+
 	return pcibios_err_to_errno(err);
 }
 
@@ -301,6 +360,8 @@ void pciback_config_free_dyn_fields(struct pci_dev *dev)
 	if (!dev_data)
 		return;
 
+	cfg_shadow_invalidate(dev_data);
+
 	list_for_each_entry_safe(cfg_entry, t, &dev_data->config_fields, list) {
 		field = cfg_entry->field;
 
@@ -326,6 +387,8 @@ void pciback_config_reset_dev(struct pci_dev *dev)
 	if (!dev_data)
 		return;
 
+	cfg_shadow_invalidate(dev_data);
+
 	list_for_each_entry(cfg_entry, &dev_data->config_fields, list) {
 		field = cfg_entry->field;
 
@@ -344,6 +407,8 @@ void pciback_config_free_dev(struct pci_dev *dev)
 	if (!dev_data)
 		return;
 
+	cfg_shadow_invalidate(dev_data);
+
 	list_for_each_entry_safe(cfg_entry, t, &dev_data->config_fields, list) {
 		list_del(&cfg_entry->list);
 
@@ -394,6 +459,7 @@ int pciback_config_add_field_offset(struct pci_dev *dev,
 	dev_dbg(&dev->dev, "added config field at offset 0x%02x\n",
 		OFFSET(cfg_entry));
 	list_add_tail(&cfg_entry->list, &dev_data->config_fields);
+	cfg_shadow_invalidate(dev_data);
 
 out:
 	if (err)
@@ -414,6 +480,7 @@ int pciback_config_init_dev(struct pci_dev *dev)
 	dev_dbg(&dev->dev, "initializing virtual configuration space\n");
 
 	INIT_LIST_HEAD(&dev_data->config_fields);
+	cfg_shadow_invalidate(dev_data);
 
 	err = pciback_config_header_add_fields(dev);
 	if (err)
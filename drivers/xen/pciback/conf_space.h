@@ -36,6 +36,9 @@ struct config_field {
 	unsigned int offset;
 	unsigned int size;
 	unsigned int mask;
+	/* The read value only changes through writes made via pciback,
+	 * so it may be served from the device's config shadow. */
+	unsigned int cacheable;
 	conf_field_init init;
 	conf_field_reset reset;
 	conf_field_free release;
@@ -17,6 +17,7 @@ static const struct config_field caplist_header[] = {
 	{
 	 .offset    = PCI_CAP_LIST_ID,
 	 .size      = 2, /* encompass PCI_CAP_LIST_ID & PCI_CAP_LIST_NEXT */
+	 .cacheable = 1,
 	 .u.w.read  = pciback_read_config_word,
 	 .u.w.write = NULL,
 	},
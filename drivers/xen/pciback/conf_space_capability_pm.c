@@ -85,6 +85,7 @@ static const struct config_field caplist_pm[] = {
 	{
 		.offset     = PCI_PM_PMC,
 		.size       = 2,
+		.cacheable  = 1,
 		.u.w.read   = pm_caps_read,
 	},
 	{
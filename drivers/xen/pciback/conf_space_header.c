@@ -272,11 +272,13 @@ static const struct config_field header_common[] = {
 	{
 	 .offset    = PCI_VENDOR_ID,
 	 .size      = 2,
+	 .cacheable = 1,
 	 .u.w.read  = pciback_read_vendor,
 	},
 	{
 	 .offset    = PCI_DEVICE_ID,
 	 .size      = 2,
+	 .cacheable = 1,
 	 .u.w.read  = pciback_read_device,
 	},
 	{
@@ -293,6 +295,7 @@ static const struct config_field header_common[] = {
 	{
 	 .offset    = PCI_INTERRUPT_PIN,
 	 .size      = 1,
+	 .cacheable = 1,
 	 .u.b.read  = pciback_read_config_byte,
 	},
 	{
@@ -320,6 +323,7 @@ static const struct config_field header_common[] = {
 	{ 						\
 	 .offset     = reg_offset, 			\
 	 .size       = 4, 				\
+	 .cacheable  = 1, 				\
 	 .init       = bar_init, 			\
 	 .reset      = bar_reset, 			\
 	 .release    = bar_release, 			\
@@ -331,6 +335,7 @@ static const struct config_field header_common[] = {
 	{ 						\
 	 .offset     = reg_offset, 			\
 	 .size       = 4, 				\
+	 .cacheable  = 1, 				\
 	 .init       = rom_init, 			\
 	 .reset      = bar_reset, 			\
 	 .release    = bar_release, 			\
@@ -40,11 +40,20 @@ struct pciback_device {
 
 	unsigned long flags;
 
+	/* Ops of one frontend are serialised by the single shared op slot;
+	 * a queue per frontend keeps frontends from waiting on each other. */
+	struct workqueue_struct *op_wq;
+	char op_wq_name[20];
 	struct work_struct op_work;
 };
 
+#define PCIBACK_CFG_SHADOW_SIZE	256
+
 struct pciback_dev_data {
 	struct list_head config_fields;
+	/* Last values read from cacheable fields, see conf_space.c */
+	DECLARE_BITMAP(cfg_cached, PCIBACK_CFG_SHADOW_SIZE);
+	u8 cfg_shadow[PCIBACK_CFG_SHADOW_SIZE];
 	unsigned int permissive : 1;
 	unsigned int warned_on_write : 1;
 	unsigned int enable_intx : 1;
@@ -57,7 +66,6 @@ struct pciback_dev_data {
 
 /* Used by XenBus and pciback_ops.c */
 extern wait_queue_head_t aer_wait_queue;
-extern struct workqueue_struct *pciback_wq;
 /* Used by pcistub.c and conf_space_quirks.c */
 extern struct list_head pciback_quirks;
 
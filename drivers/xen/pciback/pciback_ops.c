@@ -122,9 +122,11 @@ void pciback_reset_device(struct pci_dev *dev)
 }
 /*
 * Now the same evtchn is used for both pcifront conf_read_write request
-* as well as pcie aer front end ack. We use a new work_queue to schedule
-* pciback conf_read_write service for avoiding confict with aer_core
-* do_recovery job which also use the system default work_queue
+* as well as pcie aer front end ack. We use a work_queue per pciback device
+* to schedule pciback conf_read_write service, both for avoiding confict
+* with aer_core do_recovery job which also use the system default
+* work_queue and so that one frontend's slow ops (device enable, MSI-X
+* setup) don't hold up another's.
 */
 void test_and_schedule_op(struct pciback_device *pdev)
 {
@@ -132,7 +134,7 @@ void test_and_schedule_op(struct pciback_device *pdev)
 	 * already processing a request */
 	if (test_bit(_XEN_PCIF_active, (unsigned long *)&pdev->sh_info->flags)
 	    && !test_and_set_bit(_PDEVF_op_active, &pdev->flags)) {
-		queue_work(pciback_wq, &pdev->op_work);
+		queue_work(pdev->op_wq, &pdev->op_work);
 	}
 	/*_XEN_PCIB_active should have been cleared by pcifront. And also make
 	sure pciback is waiting for ack by checking _PCIB_op_pending*/
@@ -15,7 +15,6 @@
 #include "pciback.h"
 
 #define INVALID_EVTCHN_IRQ  (-1)
-struct workqueue_struct *pciback_wq;
 
 static struct pciback_device *alloc_pdev(struct xenbus_device *xdev)
 {
@@ -37,7 +36,17 @@ static struct pciback_device *alloc_pdev(struct xenbus_device *xdev)
 
 	INIT_WORK(&pdev->op_work, pciback_do_op);
 
+	snprintf(pdev->op_wq_name, sizeof(pdev->op_wq_name), "pciback/%d",
+		 xdev->otherend_id);
+	pdev->op_wq = create_singlethread_workqueue(pdev->op_wq_name);
+	if (!pdev->op_wq) {
+		kfree(pdev);
+		pdev = NULL;
+		goto out;
+	}
+
 	if (pciback_init_devices(pdev)) {
+		destroy_workqueue(pdev->op_wq);
 		kfree(pdev);
 		pdev = NULL;
 	}
@@ -60,7 +69,7 @@ static void pciback_disconnect(struct pciback_device *pdev)
 	 * before releasing the shared memory */
 
 	/* Note, the workqueue does not use spinlocks at all.*/
-	flush_workqueue(pciback_wq);
+	flush_workqueue(pdev->op_wq);
 
 	spin_lock(&pdev->dev_lock);
 	if (pdev->sh_info != NULL) {
@@ -87,6 +96,7 @@ static void free_pdev(struct pciback_device *pdev)
 	dev_set_drvdata(&pdev->xdev->dev, NULL);
 	pdev->xdev = NULL;
 
+	destroy_workqueue(pdev->op_wq);
 	kfree(pdev);
 }
 
@@ -714,17 +724,10 @@ static struct xenbus_driver xenbus_pciback_driver = {
 
 int __init pciback_xenbus_register(void)
 {
-	pciback_wq = create_workqueue("pciback_workqueue");
-	if (!pciback_wq) {
-		printk(KERN_ERR "%s: create"
-			"pciback_workqueue failed\n",__FUNCTION__);
-		return -EFAULT;
-	}
 	return xenbus_register_backend(&xenbus_pciback_driver);
 }
 
 void __exit pciback_xenbus_unregister(void)
 {
-	destroy_workqueue(pciback_wq);
 	xenbus_unregister_driver(&xenbus_pciback_driver);
 }
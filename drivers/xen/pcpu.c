@@ -3,6 +3,8 @@
  */
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
 #include <asm/xen/hypervisor.h>
 #include <asm/xen/hypercall.h>
 #include <linux/cpu.h>
@@ -128,12 +130,49 @@ static ssize_t show_acpiid(struct sys_device *dev,
 static SYSDEV_ATTR(apic_id, 0444, show_apicid, NULL);
 static SYSDEV_ATTR(acpi_id, 0444, show_acpiid, NULL);
 
+static ssize_t show_load(struct sys_device *dev,
+			 struct sysdev_attribute *attr,
+			 char *buf)
+{
+	struct pcpu *cpu = container_of(dev, struct pcpu, sysdev);
+
+	return sprintf(buf, "%u\n", cpu->load);
+}
+
+static ssize_t show_perf_pool(struct sys_device *dev,
+			      struct sysdev_attribute *attr,
+			      char *buf)
+{
+	struct pcpu *cpu = container_of(dev, struct pcpu, sysdev);
+
+	return sprintf(buf, "%d\n", cpu->perf_pool);
+}
+
+static ssize_t store_perf_pool(struct sys_device *dev,
+			       struct sysdev_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct pcpu *cpu = container_of(dev, struct pcpu, sysdev);
+
+	switch (buf[0]) {
+	case '0':
+	case '1':
+		cpu->perf_pool = buf[0] - '0';
+		return count;
+	}
+	return -EINVAL;
+}
+static SYSDEV_ATTR(load, 0444, show_load, NULL);
+static SYSDEV_ATTR(perf_pool, 0644, show_perf_pool, store_perf_pool);
+
 static int xen_pcpu_free(struct pcpu *pcpu)
 {
 	if (!pcpu)
 		return 0;
 
 	sysdev_remove_file(&pcpu->sysdev, &attr_online);
+	sysdev_remove_file(&pcpu->sysdev, &attr_load);
+	sysdev_remove_file(&pcpu->sysdev, &attr_perf_pool);
 	sysdev_unregister(&pcpu->sysdev);
 	list_del(&pcpu->pcpu_list);
 	kfree(pcpu);
@@ -192,6 +231,8 @@ static int pcpu_sysdev_init(struct pcpu *cpu)
 	sysdev_create_file(&cpu->sysdev, &attr_online);
 	sysdev_create_file(&cpu->sysdev, &attr_apic_id);
 	sysdev_create_file(&cpu->sysdev, &attr_acpi_id);
+	sysdev_create_file(&cpu->sysdev, &attr_load);
+	sysdev_create_file(&cpu->sysdev, &attr_perf_pool);
 	return 0;
 }
 
@@ -223,6 +264,7 @@ static struct pcpu *init_pcpu(struct xenpf_pcpuinfo *info)
 	pcpu->apic_id = info->apic_id;
 	pcpu->acpi_id = info->acpi_id;
 	pcpu->flags = info->flags;
+	pcpu->pstate = -1;
 
 	pcpu->sysdev.cls = &xen_pcpu_sysdev_class;
 	pcpu->sysdev.id = info->xen_cpuid;
@@ -415,6 +457,169 @@ int xen_pcpu_hotplug(int type, uint32_t apic_id)
 }
 EXPORT_SYMBOL(xen_pcpu_hotplug);
 
+/*
+ * dom0 pcpu governor, enabled with "xen_pcpu_governor" on the command
+ * line.  Every PCPU_GOV_PERIOD the idle time of all physical cpus is
+ * read with one XENPF_getidletime and turned into each pcpu's load.
+ * If Xen leaves frequency control to dom0 (cpufreq=dom0-kernel), a
+ * pcpu in the performance pool is then held at its fastest allowed
+ * P-state (which is where turbo lives) while the others get the
+ * slowest P-state that still covers their load, so idle pcpus run slow
+ * and reach deep C-states through Xen's own idle governor.
+ */
+#define PCPU_GOV_PERIOD		(HZ / 10)
+#define PCPU_GOV_UP_THRESHOLD	80
+
+struct pcpu_pstates {
+	unsigned int count;
+	unsigned int limit;	/* _PPC: fastest state allowed */
+	uint32_t mhz[0];	/* fastest first */
+};
+
+static struct pcpu_pstates *pcpu_pstates[XEN_MAX_ACPI_ID + 1];
+static int xen_pcpu_gov_enabled;
+static int xen_pcpu_gov_set_freq = 1;
+static uint64_t xen_pcpu_gov_last_now;
+
+static int __init parse_xen_pcpu_governor(char *arg)
+{
+	xen_pcpu_gov_enabled = 1;
+	return 1;
+}
+__setup("xen_pcpu_governor", parse_xen_pcpu_governor);
+
+/*
+ * Called by the ACPI processor driver as it uploads P-state data to
+ * Xen; a count of 0 only updates the platform limit.
+ */
+void xen_pcpu_set_pstates(uint32_t acpi_id, unsigned int count,
+			  const uint32_t *mhz, unsigned int limit)
+{
+	struct pcpu_pstates *ps;
+
+	if (acpi_id > XEN_MAX_ACPI_ID)
+		return;
+
+	get_pcpu_lock();
+	ps = pcpu_pstates[acpi_id];
+	if (count && (!ps || ps->count != count)) {
+		kfree(ps);
+		ps = kmalloc(sizeof(*ps) + count * sizeof(*mhz), GFP_KERNEL);
+		pcpu_pstates[acpi_id] = ps;
+		if (ps)
+			ps->count = count;
+	}
+	if (ps) {
+		if (count)
+			memcpy(ps->mhz, mhz, count * sizeof(*mhz));
+		ps->limit = min(limit, ps->count - 1);
+	}
+	put_pcpu_lock();
+}
+EXPORT_SYMBOL_GPL(xen_pcpu_set_pstates);
+
+static void xen_pcpu_gov_target(struct pcpu *pcpu)
+{
+	struct pcpu_pstates *ps = NULL;
+	xen_platform_op_t op = {
+		.cmd			= XENPF_change_freq,
+		.interface_version	= XENPF_INTERFACE_VERSION,
+	};
+	unsigned int state, target;
+	int ret;
+
+	if (pcpu->acpi_id <= XEN_MAX_ACPI_ID)
+		ps = pcpu_pstates[pcpu->acpi_id];
+	if (!ps || !xen_pcpu_gov_set_freq)
+		return;
+
+	if (pcpu->perf_pool || pcpu->load >= PCPU_GOV_UP_THRESHOLD)
+		state = ps->limit;
+	else {
+		target = ps->mhz[ps->limit] * pcpu->load /
+			 PCPU_GOV_UP_THRESHOLD;
+		state = ps->count - 1;
+		while (state > ps->limit && ps->mhz[state] < target)
+			state--;
+	}
+
+	if (state == pcpu->pstate)
+		return;
+
+	op.u.change_freq.cpu = pcpu->xen_id;
+	op.u.change_freq.freq = (uint64_t)ps->mhz[state] * 1000000;
+	ret = HYPERVISOR_dom0_op(&op);
+	if (ret == -ENOSYS) {
+		printk(KERN_INFO "xen_pcpu_governor: Xen keeps frequency "
+		       "control, only reporting load\n");
+		xen_pcpu_gov_set_freq = 0;
+	} else if (!ret)
+		pcpu->pstate = state;
+}
+
+static void xen_pcpu_gov_sample(struct work_struct *work);
+static DECLARE_DELAYED_WORK(xen_pcpu_gov_work, xen_pcpu_gov_sample);
+
+static void xen_pcpu_gov_sample(struct work_struct *work)
+{
+	xen_platform_op_t op = {
+		.cmd			= XENPF_getidletime,
+		.interface_version	= XENPF_INTERFACE_VERSION,
+	};
+	unsigned long *cpumap = NULL;
+	uint64_t *idle = NULL;
+	uint64_t elapsed, busy;
+	unsigned int nr = 0;
+	struct pcpu *pcpu;
+
+	get_pcpu_lock();
+
+	list_for_each_entry(pcpu, &xen_pcpus.list, pcpu_list)
+		nr = max(nr, pcpu->xen_id + 1);
+	if (!nr)
+		goto out;
+
+	cpumap = kzalloc(BITS_TO_LONGS(nr) * sizeof(long), GFP_KERNEL);
+	idle = kcalloc(nr, sizeof(*idle), GFP_KERNEL);
+	if (!cpumap || !idle)
+		goto out;
+
+	list_for_each_entry(pcpu, &xen_pcpus.list, pcpu_list)
+		if (xen_pcpu_online(pcpu->flags))
+			set_bit(pcpu->xen_id, cpumap);
+
+	set_xen_guest_handle(op.u.getidletime.cpumap_bitmap,
+			     (unsigned char *)cpumap);
+	op.u.getidletime.cpumap_nr_cpus = nr;
+	set_xen_guest_handle(op.u.getidletime.idletime, idle);
+	if (HYPERVISOR_dom0_op(&op))
+		goto out;
+
+	elapsed = op.u.getidletime.now - xen_pcpu_gov_last_now;
+
+	list_for_each_entry(pcpu, &xen_pcpus.list, pcpu_list) {
+		if (!test_bit(pcpu->xen_id, cpumap))
+			continue;
+
+		if (xen_pcpu_gov_last_now && pcpu->last_idle && elapsed) {
+			busy = elapsed - min(elapsed,
+					     idle[pcpu->xen_id] - pcpu->last_idle);
+			pcpu->load = div64_u64(busy * 100, elapsed);
+			xen_pcpu_gov_target(pcpu);
+		}
+		pcpu->last_idle = idle[pcpu->xen_id];
+	}
+
+	xen_pcpu_gov_last_now = op.u.getidletime.now;
+
+out:
+	put_pcpu_lock();
+	kfree(idle);
+	kfree(cpumap);
+
+	schedule_delayed_work(&xen_pcpu_gov_work, PCPU_GOV_PERIOD);
+}
+
 static irqreturn_t xen_pcpu_interrupt(int irq, void *dev_id)
 {
 	schedule_work(&xen_pcpu_work);
@@ -446,6 +651,9 @@ static int __init xen_pcpu_init(void)
 		printk(KERN_WARNING "xen_pcpu_init: "
 			"Failed to bind pcpu_state virq\n"
 			"You will lost latest information! \n");
+
+	if (xen_pcpu_gov_enabled)
+		schedule_delayed_work(&xen_pcpu_gov_work, PCPU_GOV_PERIOD);
 	return err;
 }
 
@@ -0,0 +1,15 @@
+/*
+ * Xen split driver trace points
+ */
+#include <linux/module.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/xen_blkif.h>
+
+/* blkfront and blkback are usually modules */
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkfront_queue);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkfront_push);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkfront_response);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkback_request);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkback_submit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(xen_blkback_response);
@@ -39,6 +39,8 @@
 #include <xen/grant_table.h>
 #include <xen/xenbus.h>
 
+#include "xenbus_probe.h"
+
 const char *xenbus_strstate(enum xenbus_state state)
 {
 	static const char *const name[] = {
@@ -68,7 +70,8 @@ EXPORT_SYMBOL_GPL(xenbus_strstate);
  * success, or -errno on error.  On success, the given @path will be saved as
  * @watch->node, and remains the caller's to free.  On error, @watch->node will
  * be NULL, the device will switch to %XenbusStateClosing, and the error will
- * be saved in the store.
+ * be saved in the store.  Events are delivered in order with all others
+ * concerning @dev, but not necessarily with those of other devices.
  */
 int xenbus_watch_path(struct xenbus_device *dev, const char *path,
 		      struct xenbus_watch *watch,
@@ -79,6 +82,7 @@ int xenbus_watch_path(struct xenbus_device *dev, const char *path,
 
 	watch->node = path;
 	watch->callback = callback;
+	watch->key = xenbus_node_key(dev->nodename, strlen(dev->nodename));
 
 	err = register_xenbus_watch(watch);
 
@@ -46,6 +46,15 @@ static DECLARE_WORK(probe_work, xenbus_probe);
 
 static DECLARE_WAIT_QUEUE_HEAD(xb_waitq);
 
+/*
+ * Ring updates the other end has not been notified of yet.  Requests are
+ * only pushed at xb_flush() (or when waiting for space), so several can
+ * go with one event.  Consumed responses are only announced before the
+ * reader goes to sleep, or at once if the ring had been full.
+ */
+static int xb_req_unnotified;
+static int xb_rsp_unnotified;
+
 static irqreturn_t wake_waiting(int irq, void *unused)
 {
 	if (unlikely(xenstored_ready == 0)) {
@@ -82,11 +91,27 @@ static const void *get_input_chunk(XENSTORE_RING_IDX cons,
 	return buf + MASK_XENSTORE_IDX(cons);
 }
 
+/**
+ * xb_flush - tell xenstored about requests written so far
+ *
+ * Callers serialise with xb_write.
+ */
+void xb_flush(void)
+{
+	if (xb_req_unnotified) {
+		xb_req_unnotified = 0;
+		/* Implies mb(): other side will see the updated producer. */
+		notify_remote_via_evtchn(xen_store_evtchn);
+	}
+}
+
 /**
  * xb_write - low level write
  * @data: buffer to send
  * @len: length of buffer
  *
+ * The data is not necessarily seen by xenstored until xb_flush().
+ *
  * Returns 0 on success, error otherwise.
  */
 int xb_write(const void *data, unsigned len)
@@ -99,6 +124,10 @@ int xb_write(const void *data, unsigned len)
 		void *dst;
 		unsigned int avail;
 
+		/* xenstored must see what is there to make room. */
+		if ((intf->req_prod - intf->req_cons) == XENSTORE_RING_SIZE)
+			xb_flush();
+
 		rc = wait_event_interruptible(
 			xb_waitq,
 			(intf->req_prod - intf->req_cons) !=
@@ -130,9 +159,7 @@ int xb_write(const void *data, unsigned len)
 		/* Other side must not see new producer until data is there. */
 		wmb();
 		intf->req_prod += avail;
-
-		/* Implies mb(): other side will see the updated producer. */
-		notify_remote_via_evtchn(xen_store_evtchn);
+		xb_req_unnotified = 1;
 	}
 
 	return 0;
@@ -144,8 +171,21 @@ int xb_data_to_read(void)
 	return (intf->rsp_cons != intf->rsp_prod);
 }
 
+static void xb_rsp_notify(void)
+{
+	if (xb_rsp_unnotified) {
+		xb_rsp_unnotified = 0;
+		/* Implies mb(): other side will see the updated consumer. */
+		notify_remote_via_evtchn(xen_store_evtchn);
+	}
+}
+
 int xb_wait_for_data_to_read(void)
 {
+	/* Everything available has been drained: hand back the space. */
+	if (!xb_data_to_read())
+		xb_rsp_notify();
+
 	return wait_event_interruptible(xb_waitq, xb_data_to_read());
 }
 
@@ -187,11 +227,13 @@ int xb_read(void *data, unsigned len)
 		/* Other side must not see free space until we've copied out */
 		mb();
 		intf->rsp_cons += avail;
+		xb_rsp_unnotified = 1;
 
 		pr_debug("Finished read of %i bytes (%i to go)\n", avail, len);
 
-		/* Implies mb(): other side will see the updated consumer. */
-		notify_remote_via_evtchn(xen_store_evtchn);
+		/* A full ring may have xenstored waiting for space now. */
+		if (prod - cons == XENSTORE_RING_SIZE)
+			xb_rsp_notify();
 	}
 
 	return 0;
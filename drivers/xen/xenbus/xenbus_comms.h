@@ -36,6 +36,7 @@ int xb_init_comms(void);
 
 /* Low level routines. */
 int xb_write(const void *data, unsigned len);
+void xb_flush(void);
 int xb_read(void *data, unsigned len);
 int xb_data_to_read(void);
 int xb_wait_for_data_to_read(void);
@@ -45,6 +45,7 @@
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/io.h>
+#include <linux/async.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -95,8 +96,19 @@ int xenbus_match(struct device *_dev, struct device_driver *_drv)
 EXPORT_SYMBOL_GPL(xenbus_match);
 
 
+/* Cache reads of the other end's directory; "xenbus_nocache" disables. */
+static bool cache_otherend = true;
+
+static int __init xenbus_parse_nocache(char *arg)
+{
+	cache_otherend = false;
+	return 1;
+}
+__setup("xenbus_nocache", xenbus_parse_nocache);
+
 static void free_otherend_details(struct xenbus_device *dev)
 {
+	xenbus_uncache_subtree(&dev->otherend_cache);
 	kfree(dev->otherend);
 	dev->otherend = NULL;
 }
@@ -115,11 +127,20 @@ static void free_otherend_watch(struct xenbus_device *dev)
 static int talk_to_otherend(struct xenbus_device *dev)
 {
 	struct xenbus_driver *drv = to_xenbus_driver(dev->dev.driver);
+	int err;
 
 	free_otherend_watch(dev);
 	free_otherend_details(dev);
 
-	return drv->read_otherend_details(dev);
+	err = drv->read_otherend_details(dev);
+	if (err)
+		return err;
+
+	/* The driver's probe and connect read the other end's features. */
+	if (cache_otherend)
+		xenbus_cache_subtree(&dev->otherend_cache, dev->otherend);
+
+	return 0;
 }
 
 
@@ -472,6 +493,55 @@ fail:
 }
 EXPORT_SYMBOL_GPL(xenbus_probe_node);
 
+/*
+ * Devices found while enumerating a bus are probed from async threads,
+ * so that their drivers' probe routines and xenstore round trips
+ * overlap.  xenbus_probe_devices waits for all of them.
+ */
+static LIST_HEAD(xenbus_probe_domain);
+
+struct xenbus_probe_work {
+	struct xen_bus_type *bus;
+	char *type;
+	char *nodename;
+};
+
+static void xenbus_probe_node_fn(void *data, async_cookie_t cookie)
+{
+	struct xenbus_probe_work *work = data;
+	int err;
+
+	err = xenbus_probe_node(work->bus, work->type, work->nodename);
+	if (err)
+		printk(KERN_WARNING "XENBUS: failed to probe %s: %d\n",
+		       work->nodename, err);
+
+	kfree(work);
+}
+
+int xenbus_probe_node_async(struct xen_bus_type *bus,
+			    const char *type,
+			    const char *nodename)
+{
+	struct xenbus_probe_work *work;
+
+	work = kmalloc(sizeof(*work) + strlen(type) + 1 +
+		       strlen(nodename) + 1, GFP_KERNEL);
+	if (!work)
+		return -ENOMEM;
+
+	work->bus = bus;
+	work->type = (char *)(work + 1);
+	strcpy(work->type, type);
+	work->nodename = work->type + strlen(type) + 1;
+	strcpy(work->nodename, nodename);
+
+	async_schedule_domain(xenbus_probe_node_fn, work,
+			      &xenbus_probe_domain);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xenbus_probe_node_async);
+
 static int xenbus_probe_device_type(struct xen_bus_type *bus, const char *type)
 {
 	int err = 0;
@@ -509,6 +579,8 @@ int xenbus_probe_devices(struct xen_bus_type *bus)
 			break;
 	}
 
+	async_synchronize_full_domain(&xenbus_probe_domain);
+
 	kfree(dir);
 	return err;
 }
@@ -537,6 +609,23 @@ static int strsep_len(const char *str, char c, unsigned int len)
 	return (len == 0) ? i : -ERANGE;
 }
 
+/*
+ * Key a bus watch event by the device it falls under, so that it is
+ * ordered against that device's own watches.  Changes above device level
+ * (a whole type or domain going away) are ordered against everything.
+ */
+unsigned int xenbus_dev_watch_key(const char *node, struct xen_bus_type *bus)
+{
+	int rootlen;
+
+	rootlen = strsep_len(node, '/', bus->levels);
+	if (rootlen < 0)
+		return 0;
+
+	return xenbus_node_key(node, rootlen);
+}
+EXPORT_SYMBOL_GPL(xenbus_dev_watch_key);
+
 void xenbus_dev_changed(const char *node, struct xen_bus_type *bus)
 {
 	int exists, rootlen;
@@ -595,7 +684,7 @@ int xenbus_dev_suspend(struct device *dev)
 }
 EXPORT_SYMBOL_GPL(xenbus_dev_suspend);
 
-int xenbus_dev_resume(struct device *dev)
+static int __xenbus_dev_resume(struct device *dev)
 {
 	int err;
 	struct xenbus_driver *drv;
@@ -636,8 +725,50 @@ int xenbus_dev_resume(struct device *dev)
 
 	return 0;
 }
+
+/*
+ * On resume from a Xen suspend every frontend reconnects to a new
+ * backend, a string of xenstore round trips per device.  Between
+ * xenbus_dev_resume_start_async() and xenbus_dev_resume_wait() the
+ * devices do that from async threads, overlapping with each other,
+ * instead of one after another from the PM core.
+ */
+static LIST_HEAD(xenbus_resume_domain);
+static bool xenbus_resume_async;
+
+static void xenbus_dev_resume_fn(void *data, async_cookie_t cookie)
+{
+	struct device *dev = data;
+
+	__xenbus_dev_resume(dev);
+	put_device(dev);
+}
+
+int xenbus_dev_resume(struct device *dev)
+{
+	if (!xenbus_resume_async)
+		return __xenbus_dev_resume(dev);
+
+	get_device(dev);
+	async_schedule_domain(xenbus_dev_resume_fn, dev,
+			      &xenbus_resume_domain);
+	return 0;
+}
 EXPORT_SYMBOL_GPL(xenbus_dev_resume);
 
+void xenbus_dev_resume_start_async(void)
+{
+	xenbus_resume_async = true;
+}
+EXPORT_SYMBOL_GPL(xenbus_dev_resume_start_async);
+
+void xenbus_dev_resume_wait(void)
+{
+	xenbus_resume_async = false;
+	async_synchronize_full_domain(&xenbus_resume_domain);
+}
+EXPORT_SYMBOL_GPL(xenbus_dev_resume_wait);
+
 int xenbus_dev_cancel(struct device *dev)
 {
 	/* Do nothing */
@@ -34,6 +34,8 @@
 #ifndef _XENBUS_PROBE_H
 #define _XENBUS_PROBE_H
 
+#include <linux/dcache.h>
+
 #define XEN_BUS_ID_SIZE			20
 
 struct xen_bus_type
@@ -56,9 +58,21 @@ extern int xenbus_register_driver_common(struct xenbus_driver *drv,
 extern int xenbus_probe_node(struct xen_bus_type *bus,
 			     const char *type,
 			     const char *nodename);
+extern int xenbus_probe_node_async(struct xen_bus_type *bus,
+				   const char *type,
+				   const char *nodename);
 extern int xenbus_probe_devices(struct xen_bus_type *bus);
 
 extern void xenbus_dev_changed(const char *node, struct xen_bus_type *bus);
+extern unsigned int xenbus_dev_watch_key(const char *node,
+					 struct xen_bus_type *bus);
+
+/* Watch key shared by all events concerning the device at @nodename. */
+static inline unsigned int xenbus_node_key(const char *nodename,
+					   unsigned int len)
+{
+	return full_name_hash((const unsigned char *)nodename, len) ?: 1;
+}
 
 extern void xenbus_dev_shutdown(struct device *_dev);
 
@@ -141,7 +141,7 @@ static int xenbus_probe_backend_unit(struct xen_bus_type *bus,
 
 	DPRINTK("%s\n", nodename);
 
-	err = xenbus_probe_node(bus, type, nodename);
+	err = xenbus_probe_node_async(bus, type, nodename);
 	kfree(nodename);
 	return err;
 }
@@ -211,9 +211,16 @@ static void backend_changed(struct xenbus_watch *watch,
 	xenbus_dev_changed(vec[XS_WATCH_PATH], &xenbus_backend);
 }
 
+static unsigned int backend_watch_key(struct xenbus_watch *watch,
+				      const char **vec, unsigned int len)
+{
+	return xenbus_dev_watch_key(vec[XS_WATCH_PATH], &xenbus_backend);
+}
+
 static struct xenbus_watch be_watch = {
 	.node = "backend",
 	.callback = backend_changed,
+	.get_key = backend_watch_key,
 };
 
 static int read_frontend_details(struct xenbus_device *xendev)
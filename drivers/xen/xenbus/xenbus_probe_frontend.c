@@ -56,7 +56,7 @@ static int xenbus_probe_frontend(struct xen_bus_type *bus, const char *type, con
 
 	DPRINTK("%s", nodename);
 
-	err = xenbus_probe_node(bus, type, nodename);
+	err = xenbus_probe_node_async(bus, type, nodename);
 	kfree(nodename);
 	return err;
 }
@@ -117,11 +117,18 @@ static void frontend_changed(struct xenbus_watch *watch,
 	xenbus_dev_changed(vec[XS_WATCH_PATH], &xenbus_frontend);
 }
 
+static unsigned int frontend_watch_key(struct xenbus_watch *watch,
+				       const char **vec, unsigned int len)
+{
+	return xenbus_dev_watch_key(vec[XS_WATCH_PATH], &xenbus_frontend);
+}
+
 
 /* We watch for devices appearing and vanishing. */
 static struct xenbus_watch fe_watch = {
 	.node = "device",
 	.callback = frontend_changed,
+	.get_key = frontend_watch_key,
 };
 
 static int read_backend_details(struct xenbus_device *xendev)
@@ -63,12 +63,13 @@ struct xs_stored_msg {
 			struct xenbus_watch *handle;
 			char **vec;
 			unsigned int vec_size;
+			unsigned int key;
 		} watch;
 	} u;
 };
 
 struct xs_handle {
-	/* A list of replies. Currently only one will ever be outstanding. */
+	/* A list of replies, matched to their requests by req_id. */
 	struct list_head reply_list;
 	spinlock_t reply_lock;
 	wait_queue_head_t reply_waitq;
@@ -86,8 +87,18 @@ struct xs_handle {
 	 * reach zero.
 	 */
 
-	/* One request at a time. */
+	/*
+	 * One request at a time onto the ring.  The reply is waited for
+	 * without holding it, so many requests can be outstanding;
+	 * request_count of them, each tagged with a fresh req_id.
+	 * While another writer is queued on the mutex (request_writers),
+	 * the event telling xenstored about a request is left to it.
+	 */
 	struct mutex request_mutex;
+	uint32_t next_req_id;
+	atomic_t request_count;
+	wait_queue_head_t request_wq;
+	atomic_t request_writers;
 
 	/* Protect xenbus reader thread against save/restore. */
 	struct mutex response_mutex;
@@ -112,14 +123,52 @@ static LIST_HEAD(watch_events);
 static DEFINE_SPINLOCK(watch_events_lock);
 
 /*
- * Details of the xenwatch callback kernel thread. The thread waits on the
- * watch_events_waitq for work to do (queued on watch_events list). When it
- * wakes up it acquires the xenwatch_mutex before reading the list and
- * carrying out work.
+ * Details of the xenwatch callback kernel threads. The xenwatch thread waits
+ * on the watch_events_waitq for work to do (queued on watch_events list).
+ * Events with a non-zero key are moved, in order, onto the list of the worker
+ * the key selects, which runs them under its own mutex.  Unkeyed events are
+ * run by xenwatch itself under the xenwatch_mutex, once every worker has gone
+ * idle, so they stay ordered against all other events.
  */
+#define XENWATCH_WORKERS	8
+
+struct xenwatch_worker {
+	/* Protected by watch_events_lock. */
+	struct list_head events;
+	int busy;
+
+	wait_queue_head_t waitq;
+	struct mutex mutex;
+	pid_t pid;
+};
+
 static pid_t xenwatch_pid;
 static DEFINE_MUTEX(xenwatch_mutex);
 static DECLARE_WAIT_QUEUE_HEAD(watch_events_waitq);
+static struct xenwatch_worker xenwatch_workers[XENWATCH_WORKERS];
+static DECLARE_WAIT_QUEUE_HEAD(xenwatch_idle_waitq);
+
+/*
+ * Cached subtrees: XBT_NIL reads under them are answered from a small
+ * per-subtree cache.  Each has a watch on its root so that every change
+ * produces an event.  For each watch event, the reader thread drops
+ * cached entries under the changed path before anything else sees it.
+ * This keeps invalidation in ring order with the replies.  Events of
+ * the caches' own watches go no further.  A read that raced with an invalidation is not
+ * cached: every invalidation gives the cache a new seq.
+ */
+#define XS_CACHE_MAX_ENTRIES	32
+
+struct xs_cache_entry {
+	struct list_head list;
+	char *value;		/* NULL: the node does not exist */
+	unsigned int len;
+	char path[0];
+};
+
+static LIST_HEAD(xs_caches);
+static DEFINE_SPINLOCK(xs_cache_lock);
+static unsigned long xs_cache_seq;
 
 static int get_error(const char *errorstring)
 {
@@ -136,26 +185,58 @@ static int get_error(const char *errorstring)
 	return xsd_errors[i].errnum;
 }
 
-static void *read_reply(enum xsd_sockmsg_type *type, unsigned int *len)
+static void request_lock(void)
+{
+	atomic_inc(&xs_state.request_writers);
+	mutex_lock(&xs_state.request_mutex);
+	atomic_dec(&xs_state.request_writers);
+}
+
+static void request_unlock(void)
+{
+	/* The last of a run of queued writers notifies for all of them. */
+	if (!atomic_read(&xs_state.request_writers))
+		xb_flush();
+	mutex_unlock(&xs_state.request_mutex);
+}
+
+/* Called with request_mutex held, before the request goes out. */
+static uint32_t request_start(void)
+{
+	atomic_inc(&xs_state.request_count);
+	return xs_state.next_req_id++;
+}
+
+static void request_end(void)
+{
+	if (atomic_dec_and_test(&xs_state.request_count))
+		wake_up(&xs_state.request_wq);
+}
+
+static struct xs_stored_msg *get_reply(uint32_t req_id)
 {
 	struct xs_stored_msg *msg;
-	char *body;
 
 	spin_lock(&xs_state.reply_lock);
-
-	while (list_empty(&xs_state.reply_list)) {
-		spin_unlock(&xs_state.reply_lock);
-		/* XXX FIXME: Avoid synchronous wait for response here. */
-		wait_event(xs_state.reply_waitq,
-			   !list_empty(&xs_state.reply_list));
-		spin_lock(&xs_state.reply_lock);
+	list_for_each_entry(msg, &xs_state.reply_list, list) {
+		if (msg->hdr.req_id == req_id) {
+			list_del(&msg->list);
+			spin_unlock(&xs_state.reply_lock);
+			return msg;
+		}
 	}
+	spin_unlock(&xs_state.reply_lock);
 
-	msg = list_entry(xs_state.reply_list.next,
-			 struct xs_stored_msg, list);
-	list_del(&msg->list);
+	return NULL;
+}
 
-	spin_unlock(&xs_state.reply_lock);
+static void *read_reply(uint32_t req_id, enum xsd_sockmsg_type *type,
+			unsigned int *len)
+{
+	struct xs_stored_msg *msg;
+	char *body;
+
+	wait_event(xs_state.reply_waitq, (msg = get_reply(req_id)) != NULL);
 
 	*type = msg->hdr.type;
 	if (len)
@@ -201,16 +282,20 @@ void *xenbus_dev_request_and_reply(struct xsd_sockmsg *msg)
 	if (req_msg.type == XS_TRANSACTION_START)
 		transaction_start();
 
-	mutex_lock(&xs_state.request_mutex);
-
+	/* The caller's req_id is put back into the reply header. */
+	request_lock();
+	msg->req_id = request_start();
 	err = xb_write(msg, sizeof(*msg) + msg->len);
+	request_unlock();
+
 	if (err) {
 		msg->type = XS_ERROR;
 		ret = ERR_PTR(err);
 	} else
-		ret = read_reply(&msg->type, &msg->len);
+		ret = read_reply(msg->req_id, &msg->type, &msg->len);
 
-	mutex_unlock(&xs_state.request_mutex);
+	request_end();
+	msg->req_id = req_msg.req_id;
 
 	if ((msg->type == XS_TRANSACTION_END) ||
 	    ((req_msg.type == XS_TRANSACTION_START) &&
@@ -234,31 +319,27 @@ static void *xs_talkv(struct xenbus_transaction t,
 	int err;
 
 	msg.tx_id = t.id;
-	msg.req_id = 0;
 	msg.type = type;
 	msg.len = 0;
 	for (i = 0; i < num_vecs; i++)
 		msg.len += iovec[i].iov_len;
 
-	mutex_lock(&xs_state.request_mutex);
+	request_lock();
+	msg.req_id = request_start();
 
 	err = xb_write(&msg, sizeof(msg));
+	for (i = 0; !err && i < num_vecs; i++)
+		err = xb_write(iovec[i].iov_base, iovec[i].iov_len);
+
+	request_unlock();
+
 	if (err) {
-		mutex_unlock(&xs_state.request_mutex);
+		request_end();
 		return ERR_PTR(err);
 	}
 
-	for (i = 0; i < num_vecs; i++) {
-		err = xb_write(iovec[i].iov_base, iovec[i].iov_len);
-		if (err) {
-			mutex_unlock(&xs_state.request_mutex);
-			return ERR_PTR(err);
-		}
-	}
-
-	ret = read_reply(&msg.type, len);
-
-	mutex_unlock(&xs_state.request_mutex);
+	ret = read_reply(msg.req_id, &msg.type, len);
+	request_end();
 
 	if (IS_ERR(ret))
 		return ret;
@@ -386,9 +467,219 @@ EXPORT_SYMBOL_GPL(xenbus_exists);
  * Returns a kmalloced value: call free() on it after use.
  * len indicates length in bytes.
  */
+static int path_is_under(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+
+	return !strncmp(path, dir, len) &&
+		(path[len] == '\0' || path[len] == '/');
+}
+
+/* Called with xs_cache_lock held. */
+static struct xenbus_cache *xs_cache_find(const char *path)
+{
+	struct xenbus_cache *cache;
+
+	list_for_each_entry(cache, &xs_caches, list)
+		if (path_is_under(path, cache->watch.node))
+			return cache;
+
+	return NULL;
+}
+
+/* Called with xs_cache_lock held. */
+static void xs_cache_drop(struct xenbus_cache *cache, const char *path)
+{
+	struct xs_cache_entry *entry, *n;
+
+	list_for_each_entry_safe(entry, n, &cache->entries, list) {
+		if (path && !path_is_under(entry->path, path))
+			continue;
+		list_del(&entry->list);
+		cache->nr_entries--;
+		kfree(entry);
+	}
+	cache->seq = ++xs_cache_seq;
+}
+
+/*
+ * Look @path up in the caches.  Returns a kmalloced copy of the value,
+ * ERR_PTR(-ENOENT), or NULL on a miss.  On a miss *seqp is what to hand
+ * to xs_cache_insert, or 0 if @path is not cached at all.
+ */
+static void *xs_cache_lookup(const char *path, unsigned int *len,
+			     unsigned long *seqp)
+{
+	struct xenbus_cache *cache;
+	struct xs_cache_entry *entry;
+	void *ret = NULL;
+
+	*seqp = 0;
+
+	spin_lock(&xs_cache_lock);
+	cache = xs_cache_find(path);
+	if (!cache)
+		goto out;
+
+	*seqp = cache->seq;
+	list_for_each_entry(entry, &cache->entries, list) {
+		if (strcmp(entry->path, path))
+			continue;
+		if (!entry->value) {
+			ret = ERR_PTR(-ENOENT);
+			break;
+		}
+		ret = kmalloc(entry->len + 1, GFP_ATOMIC);
+		if (ret) {
+			memcpy(ret, entry->value, entry->len + 1);
+			if (len)
+				*len = entry->len;
+		}
+		break;
+	}
+ out:
+	spin_unlock(&xs_cache_lock);
+	return ret;
+}
+
+static void xs_cache_insert(const char *path, const char *value,
+			    unsigned int len, unsigned long seq)
+{
+	struct xenbus_cache *cache;
+	struct xs_cache_entry *entry, *old;
+	size_t pathlen = strlen(path) + 1;
+
+	entry = kmalloc(sizeof(*entry) + pathlen + (value ? len + 1 : 0),
+			GFP_NOIO | __GFP_HIGH);
+	if (!entry)
+		return;
+
+	memcpy(entry->path, path, pathlen);
+	entry->len = len;
+	entry->value = NULL;
+	if (value) {
+		entry->value = entry->path + pathlen;
+		memcpy(entry->value, value, len + 1);
+	}
+
+	spin_lock(&xs_cache_lock);
+	cache = xs_cache_find(path);
+	if (!cache || cache->seq != seq) {
+		spin_unlock(&xs_cache_lock);
+		kfree(entry);
+		return;
+	}
+
+	list_for_each_entry(old, &cache->entries, list) {
+		if (!strcmp(old->path, path)) {
+			list_del(&old->list);
+			cache->nr_entries--;
+			kfree(old);
+			break;
+		}
+	}
+
+	list_add(&entry->list, &cache->entries);
+	if (++cache->nr_entries > XS_CACHE_MAX_ENTRIES) {
+		entry = list_entry(cache->entries.prev,
+				   struct xs_cache_entry, list);
+		list_del(&entry->list);
+		cache->nr_entries--;
+		kfree(entry);
+	}
+	spin_unlock(&xs_cache_lock);
+}
+
+/*
+ * Any watch event may be the first news of a change to a cached node:
+ * another watch on it can fire before the cache's own does.
+ */
+static void xs_cache_invalidate(const char *path)
+{
+	struct xenbus_cache *cache;
+
+	spin_lock(&xs_cache_lock);
+	list_for_each_entry(cache, &xs_caches, list)
+		if (path_is_under(path, cache->watch.node) ||
+		    path_is_under(cache->watch.node, path))
+			xs_cache_drop(cache, path);
+	spin_unlock(&xs_cache_lock);
+}
+
+/* Never called: the reader thread consumes these events itself. */
+static void xs_cache_changed(struct xenbus_watch *watch,
+			     const char **vec, unsigned int len)
+{
+}
+
+/**
+ * xenbus_cache_subtree - cache reads of a subtree
+ * @cache: cache to set up, zeroed or previously torn down
+ * @path: root of the subtree
+ *
+ * Until xenbus_uncache_subtree, reads outside transactions of nodes
+ * under @path are answered from @cache where possible.  A watch on @path
+ * keeps it coherent.  Returns 0 or -errno; -errno leaves reads uncached.
+ */
+int xenbus_cache_subtree(struct xenbus_cache *cache, const char *path)
+{
+	int err;
+
+	INIT_LIST_HEAD(&cache->entries);
+	cache->nr_entries = 0;
+
+	cache->watch.node = kstrdup(path, GFP_KERNEL);
+	if (!cache->watch.node)
+		return -ENOMEM;
+	cache->watch.callback = xs_cache_changed;
+
+	err = register_xenbus_watch(&cache->watch);
+	if (err) {
+		kfree(cache->watch.node);
+		cache->watch.node = NULL;
+		return err;
+	}
+
+	spin_lock(&xs_cache_lock);
+	cache->seq = ++xs_cache_seq;
+	list_add(&cache->list, &xs_caches);
+	spin_unlock(&xs_cache_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xenbus_cache_subtree);
+
+void xenbus_uncache_subtree(struct xenbus_cache *cache)
+{
+	if (!cache->watch.node)
+		return;
+
+	spin_lock(&xs_cache_lock);
+	list_del(&cache->list);
+	xs_cache_drop(cache, NULL);
+	spin_unlock(&xs_cache_lock);
+
+	unregister_xenbus_watch(&cache->watch);
+	kfree(cache->watch.node);
+	cache->watch.node = NULL;
+}
+EXPORT_SYMBOL_GPL(xenbus_uncache_subtree);
+
+static void xs_cache_flush(void)
+{
+	struct xenbus_cache *cache;
+
+	spin_lock(&xs_cache_lock);
+	list_for_each_entry(cache, &xs_caches, list)
+		xs_cache_drop(cache, NULL);
+	spin_unlock(&xs_cache_lock);
+}
+
 void *xenbus_read(struct xenbus_transaction t,
 		  const char *dir, const char *node, unsigned int *len)
 {
+	unsigned long seq = 0;
+	unsigned int rlen;
 	char *path;
 	void *ret;
 
@@ -396,7 +687,23 @@ void *xenbus_read(struct xenbus_transaction t,
 	if (IS_ERR(path))
 		return (void *)path;
 
-	ret = xs_single(t, XS_READ, path, len);
+	if (t.id == XBT_NIL.id) {
+		ret = xs_cache_lookup(path, len, &seq);
+		if (ret)
+			goto out;
+	}
+
+	ret = xs_single(t, XS_READ, path, &rlen);
+	if (!IS_ERR(ret) && len)
+		*len = rlen;
+
+	if (seq) {
+		if (!IS_ERR(ret))
+			xs_cache_insert(path, ret, rlen, seq);
+		else if (PTR_ERR(ret) == -ENOENT)
+			xs_cache_insert(path, NULL, 0, seq);
+	}
+ out:
 	kfree(path);
 	return ret;
 }
@@ -651,11 +958,61 @@ int register_xenbus_watch(struct xenbus_watch *watch)
 }
 EXPORT_SYMBOL_GPL(register_xenbus_watch);
 
-void unregister_xenbus_watch(struct xenbus_watch *watch)
+/* @i is a worker index, or -1 for the xenwatch thread itself. */
+static int watch_runs_on(struct xenbus_watch *watch, int i)
+{
+	if (watch->get_key)
+		return 1;
+	if (i < 0)
+		return !watch->key;
+	return watch->key && watch->key % XENWATCH_WORKERS == i;
+}
+
+/* Wait for the callbacks of @watch to finish (unless we are one). */
+static void xenwatch_lock(struct xenbus_watch *watch)
+{
+	int i;
+
+	if (watch_runs_on(watch, -1) && current->pid != xenwatch_pid)
+		mutex_lock(&xenwatch_mutex);
+
+	for (i = 0; i < XENWATCH_WORKERS; i++)
+		if (watch_runs_on(watch, i) &&
+		    current->pid != xenwatch_workers[i].pid)
+			mutex_lock(&xenwatch_workers[i].mutex);
+}
+
+static void xenwatch_unlock(struct xenbus_watch *watch)
+{
+	int i;
+
+	for (i = XENWATCH_WORKERS - 1; i >= 0; i--)
+		if (watch_runs_on(watch, i) &&
+		    current->pid != xenwatch_workers[i].pid)
+			mutex_unlock(&xenwatch_workers[i].mutex);
+
+	if (watch_runs_on(watch, -1) && current->pid != xenwatch_pid)
+		mutex_unlock(&xenwatch_mutex);
+}
+
+static void cancel_watch_events(struct list_head *events,
+				struct xenbus_watch *watch)
 {
 	struct xs_stored_msg *msg, *tmp;
+
+	list_for_each_entry_safe(msg, tmp, events, list) {
+		if (msg->u.watch.handle != watch)
+			continue;
+		list_del(&msg->list);
+		kfree(msg->u.watch.vec);
+		kfree(msg);
+	}
+}
+
+void unregister_xenbus_watch(struct xenbus_watch *watch)
+{
 	char token[sizeof(watch) * 2 + 1];
-	int err;
+	int i, err;
 
 	sprintf(token, "%lX", (long)watch);
 
@@ -676,22 +1033,17 @@ void unregister_xenbus_watch(struct xenbus_watch *watch)
 
 	/* Make sure there are no callbacks running currently (unless
 	   its us) */
-	if (current->pid != xenwatch_pid)
-		mutex_lock(&xenwatch_mutex);
+	xenwatch_lock(watch);
 
 	/* Cancel pending watch events. */
 	spin_lock(&watch_events_lock);
-	list_for_each_entry_safe(msg, tmp, &watch_events, list) {
-		if (msg->u.watch.handle != watch)
-			continue;
-		list_del(&msg->list);
-		kfree(msg->u.watch.vec);
-		kfree(msg);
-	}
+	cancel_watch_events(&watch_events, watch);
+	for (i = 0; i < XENWATCH_WORKERS; i++)
+		cancel_watch_events(&xenwatch_workers[i].events, watch);
 	spin_unlock(&watch_events_lock);
+	wake_up(&xenwatch_idle_waitq);
 
-	if (current->pid != xenwatch_pid)
-		mutex_unlock(&xenwatch_mutex);
+	xenwatch_unlock(watch);
 }
 EXPORT_SYMBOL_GPL(unregister_xenbus_watch);
 
@@ -700,6 +1052,13 @@ void xs_suspend(void)
 	transaction_suspend();
 	down_write(&xs_state.watch_mutex);
 	mutex_lock(&xs_state.request_mutex);
+	/*
+	 * Let the requests already on the ring get their replies.  The
+	 * last writer may have left its event to a writer still queued.
+	 */
+	xb_flush();
+	wait_event(xs_state.request_wq,
+		   atomic_read(&xs_state.request_count) == 0);
 	mutex_lock(&xs_state.response_mutex);
 }
 
@@ -710,6 +1069,9 @@ void xs_resume(void)
 
 	xb_init_comms();
 
+	/* The store may have changed under us without any watch firing. */
+	xs_cache_flush();
+
 	mutex_unlock(&xs_state.response_mutex);
 	mutex_unlock(&xs_state.request_mutex);
 	transaction_resume();
@@ -731,10 +1093,83 @@ void xs_suspend_cancel(void)
 	mutex_unlock(&xs_state.transaction_mutex);
 }
 
+static void run_watch_event(struct xs_stored_msg *msg)
+{
+	msg->u.watch.handle->callback(
+		msg->u.watch.handle,
+		(const char **)msg->u.watch.vec,
+		msg->u.watch.vec_size);
+	kfree(msg->u.watch.vec);
+	kfree(msg);
+}
+
+static struct xs_stored_msg *pop_watch_event(struct list_head *events)
+{
+	struct xs_stored_msg *msg;
+
+	if (list_empty(events))
+		return NULL;
+
+	msg = list_entry(events->next, struct xs_stored_msg, list);
+	list_del(&msg->list);
+	return msg;
+}
+
+static int xenwatch_idle(void)
+{
+	int i, idle = 1;
+
+	spin_lock(&watch_events_lock);
+	for (i = 0; i < XENWATCH_WORKERS; i++)
+		if (xenwatch_workers[i].busy ||
+		    !list_empty(&xenwatch_workers[i].events))
+			idle = 0;
+	spin_unlock(&watch_events_lock);
+
+	return idle;
+}
+
+static int xenwatch_worker_thread(void *data)
+{
+	struct xenwatch_worker *worker = data;
+	struct xs_stored_msg *msg;
+
+	for (;;) {
+		wait_event_interruptible(worker->waitq,
+					 !list_empty(&worker->events) ||
+					 kthread_should_stop());
+
+		if (kthread_should_stop())
+			break;
+
+		mutex_lock(&worker->mutex);
+
+		spin_lock(&watch_events_lock);
+		msg = pop_watch_event(&worker->events);
+		if (msg)
+			worker->busy = 1;
+		spin_unlock(&watch_events_lock);
+
+		if (msg) {
+			run_watch_event(msg);
+
+			spin_lock(&watch_events_lock);
+			worker->busy = 0;
+			spin_unlock(&watch_events_lock);
+			wake_up(&xenwatch_idle_waitq);
+		}
+
+		mutex_unlock(&worker->mutex);
+	}
+
+	return 0;
+}
+
 static int xenwatch_thread(void *unused)
 {
-	struct list_head *ent;
 	struct xs_stored_msg *msg;
+	struct xenwatch_worker *worker;
+	int empty;
 
 	for (;;) {
 		wait_event_interruptible(watch_events_waitq,
@@ -743,23 +1178,43 @@ static int xenwatch_thread(void *unused)
 		if (kthread_should_stop())
 			break;
 
+		/* Pass keyed events on to their workers, up to an unkeyed one. */
+		spin_lock(&watch_events_lock);
+		while (!list_empty(&watch_events)) {
+			msg = list_entry(watch_events.next,
+					 struct xs_stored_msg, list);
+			if (!msg->u.watch.key)
+				break;
+			worker = &xenwatch_workers[msg->u.watch.key %
+						   XENWATCH_WORKERS];
+			list_move_tail(&msg->list, &worker->events);
+			wake_up(&worker->waitq);
+		}
+		empty = list_empty(&watch_events);
+		spin_unlock(&watch_events_lock);
+
+		if (empty)
+			continue;
+
+		/*
+		 * Only we feed the workers, so once they are idle they stay
+		 * so until the unkeyed event has run.  The event may have
+		 * been cancelled meanwhile: look at the head again.
+		 */
+		wait_event(xenwatch_idle_waitq, xenwatch_idle());
+
 		mutex_lock(&xenwatch_mutex);
 
 		spin_lock(&watch_events_lock);
-		ent = watch_events.next;
-		if (ent != &watch_events)
-			list_del(ent);
+		msg = NULL;
+		if (!list_empty(&watch_events) &&
+		    !list_entry(watch_events.next, struct xs_stored_msg,
+				list)->u.watch.key)
+			msg = pop_watch_event(&watch_events);
 		spin_unlock(&watch_events_lock);
 
-		if (ent != &watch_events) {
-			msg = list_entry(ent, struct xs_stored_msg, list);
-			msg->u.watch.handle->callback(
-				msg->u.watch.handle,
-				(const char **)msg->u.watch.vec,
-				msg->u.watch.vec_size);
-			kfree(msg->u.watch.vec);
-			kfree(msg);
-		}
+		if (msg)
+			run_watch_event(msg);
 
 		mutex_unlock(&xenwatch_mutex);
 	}
@@ -834,7 +1289,19 @@ static int process_msg(void)
 		spin_lock(&watches_lock);
 		msg->u.watch.handle = find_watch(
 			msg->u.watch.vec[XS_WATCH_TOKEN]);
-		if (msg->u.watch.handle != NULL) {
+		xs_cache_invalidate(msg->u.watch.vec[XS_WATCH_PATH]);
+		if (msg->u.watch.handle != NULL &&
+		    msg->u.watch.handle->callback == xs_cache_changed) {
+			kfree(msg->u.watch.vec);
+			kfree(msg);
+		} else if (msg->u.watch.handle != NULL) {
+			struct xenbus_watch *watch = msg->u.watch.handle;
+
+			msg->u.watch.key = watch->get_key ?
+				watch->get_key(watch,
+					       (const char **)msg->u.watch.vec,
+					       msg->u.watch.vec_size) :
+				watch->key;
 			spin_lock(&watch_events_lock);
 			list_add_tail(&msg->list, &watch_events);
 			wake_up(&watch_events_waitq);
@@ -875,7 +1342,7 @@ static int xenbus_thread(void *unused)
 
 int xs_init(void)
 {
-	int err;
+	int i, err;
 	struct task_struct *task;
 
 	INIT_LIST_HEAD(&xs_state.reply_list);
@@ -883,6 +1350,9 @@ int xs_init(void)
 	init_waitqueue_head(&xs_state.reply_waitq);
 
 	mutex_init(&xs_state.request_mutex);
+	atomic_set(&xs_state.request_count, 0);
+	atomic_set(&xs_state.request_writers, 0);
+	init_waitqueue_head(&xs_state.request_wq);
 	mutex_init(&xs_state.response_mutex);
 	mutex_init(&xs_state.transaction_mutex);
 	init_rwsem(&xs_state.watch_mutex);
@@ -894,6 +1364,20 @@ int xs_init(void)
 	if (err)
 		return err;
 
+	for (i = 0; i < XENWATCH_WORKERS; i++) {
+		struct xenwatch_worker *worker = &xenwatch_workers[i];
+
+		INIT_LIST_HEAD(&worker->events);
+		init_waitqueue_head(&worker->waitq);
+		mutex_init(&worker->mutex);
+
+		task = kthread_run(xenwatch_worker_thread, worker,
+				   "xenwatch/%d", i);
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		worker->pid = task->pid;
+	}
+
 	task = kthread_run(xenwatch_thread, NULL, "xenwatch");
 	if (IS_ERR(task))
 		return PTR_ERR(task);
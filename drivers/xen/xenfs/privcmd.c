@@ -242,23 +242,44 @@ struct mmap_batch_state {
 	unsigned long va;
 	struct vm_area_struct *vma;
 	int err;
+	int version;
 
 	xen_pfn_t __user *user;
 };
 
-static int mmap_batch_fn(void *data, void *state)
-{
-	xen_pfn_t *mfnp = data;
-	struct mmap_batch_state *st = state;
+#define MMAP_BATCH_PER_PAGE (PAGE_SIZE / sizeof(xen_pfn_t))
 
-	if (xen_remap_domain_mfn_range(st->vma, st->va & PAGE_MASK, *mfnp, 1,
-				       st->vma->vm_page_prot, st->domain) < 0) {
-		*mfnp |= 0xf0000000U;
-		st->err++;
+/*
+ * Map the gathered frames with one xen_remap_domain_mfn_array() call per
+ * page of the list.  Version 1 flags failures in place by setting the
+ * top nibble of the mfn; version 2 replaces the start of each list page
+ * with that page's error codes, ready to be copied out.
+ */
+static void mmap_batch_map(struct list_head *pagelist, unsigned nelem,
+			   struct mmap_batch_state *st, int *errs)
+{
+	struct page *page;
+	unsigned i, nr;
+
+	list_for_each_entry(page, pagelist, lru) {
+		xen_pfn_t *mfns = page_address(page);
+
+		nr = min_t(unsigned, nelem, MMAP_BATCH_PER_PAGE);
+		st->err += xen_remap_domain_mfn_array(st->vma, st->va, mfns,
+						      nr, errs,
+						      st->vma->vm_page_prot,
+						      st->domain);
+
+		if (st->version == 1) {
+			for (i = 0; i < nr; i++)
+				if (errs[i])
+					mfns[i] |= 0xf0000000U;
+		} else
+			memcpy(mfns, errs, nr * sizeof(*errs));
+
+		st->va += (unsigned long)nr << PAGE_SHIFT;
+		nelem -= nr;
 	}
-	st->va += PAGE_SIZE;
-
-	return 0;
 }
 
 static int mmap_return_errors(void *data, void *state)
@@ -273,41 +294,82 @@ static int mmap_return_errors(void *data, void *state)
 
 static struct vm_operations_struct privcmd_vm_ops;
 
-static long privcmd_ioctl_mmap_batch(void __user *udata)
+/*
+ * Version 1 fills a fresh privcmd vma exactly once.  Version 2 may
+ * (re)map any page aligned part of one, as often as it likes: a
+ * migration toolstack keeps a single window open for the whole run and
+ * only replaces the frames it needs for the next round, instead of
+ * tearing down and rebuilding the mapping every time.  Overwritten
+ * foreign PTEs are released by Xen as part of the mmu_update.
+ */
+static int privcmd_batch_range_ok(struct vm_area_struct *vma,
+				  unsigned long addr,
+				  unsigned long nr_pages, int version)
+{
+	if (version == 1)
+		return addr == vma->vm_start &&
+		       addr + (nr_pages << PAGE_SHIFT) == vma->vm_end &&
+		       privcmd_enforce_singleshot_mapping(vma);
+
+	if ((addr & ~PAGE_MASK) || addr < vma->vm_start ||
+	    nr_pages > (vma->vm_end - addr) >> PAGE_SHIFT)
+		return 0;
+
+	/* Keep version 1 from claiming this vma later. */
+	privcmd_enforce_singleshot_mapping(vma);
+	return 1;
+}
+
+static long privcmd_ioctl_mmap_batch(void __user *udata, int version)
 {
 	int ret;
-	struct privcmd_mmapbatch m;
+	struct privcmd_mmapbatch_v2 m;
 	struct mm_struct *mm = current->mm;
 	struct vm_area_struct *vma;
 	unsigned long nr_pages;
 	LIST_HEAD(pagelist);
 	struct mmap_batch_state state;
+	int *errs = NULL;
 
 	if (!xen_initial_domain())
 		return -EPERM;
 
-	if (copy_from_user(&m, udata, sizeof(m)))
+	if (version == 1) {
+		struct privcmd_mmapbatch m1;
+
+		if (copy_from_user(&m1, udata, sizeof(m1)))
+			return -EFAULT;
+		if (m1.num <= 0)
+			return -EINVAL;
+		m.num = m1.num;
+		m.dom = m1.dom;
+		m.addr = m1.addr;
+		m.arr = m1.arr;
+		m.err = NULL;
+	} else if (copy_from_user(&m, udata, sizeof(m)))
 		return -EFAULT;
 
 	nr_pages = m.num;
-	if ((m.num <= 0) || (nr_pages > (LONG_MAX >> PAGE_SHIFT)))
+	if ((m.num == 0) || (nr_pages > (LONG_MAX >> PAGE_SHIFT)))
 		return -EINVAL;
 
 	ret = gather_array(&pagelist, m.num, sizeof(xen_pfn_t),
-			   m.arr);
+			   (void __user *)m.arr);
 
 	if (ret || list_empty(&pagelist))
 		goto out;
 
+	ret = -ENOMEM;
+	errs = kmalloc(MMAP_BATCH_PER_PAGE * sizeof(*errs), GFP_KERNEL);
+	if (!errs)
+		goto out;
+
 	down_write(&mm->mmap_sem);
 
 	vma = find_vma(mm, m.addr);
 	ret = -EINVAL;
-	if (!vma ||
-	    vma->vm_ops != &privcmd_vm_ops ||
-	    (m.addr != vma->vm_start) ||
-	    ((m.addr + (nr_pages << PAGE_SHIFT)) != vma->vm_end) ||
-	    !privcmd_enforce_singleshot_mapping(vma)) {
+	if (!vma || vma->vm_ops != &privcmd_vm_ops ||
+	    !privcmd_batch_range_ok(vma, m.addr, nr_pages, version)) {
 		up_write(&mm->mmap_sem);
 		goto out;
 	}
@@ -316,22 +378,39 @@ static long privcmd_ioctl_mmap_batch(void __user *udata)
 	state.vma = vma;
 	state.va = m.addr;
 	state.err = 0;
+	state.version = version;
 
-	ret = traverse_pages(m.num, sizeof(xen_pfn_t),
-			     &pagelist, mmap_batch_fn, &state);
+	mmap_batch_map(&pagelist, m.num, &state, errs);
 
 	up_write(&mm->mmap_sem);
 
-	if (state.err > 0) {
-		ret = 0;
-
-		state.user = m.arr;
-		traverse_pages(m.num, sizeof(xen_pfn_t),
-			       &pagelist,
-			       mmap_return_errors, &state);
+	ret = 0;
+	if (version == 1) {
+		if (state.err > 0) {
+			state.user = (xen_pfn_t __user *)m.arr;
+			traverse_pages(m.num, sizeof(xen_pfn_t),
+				       &pagelist,
+				       mmap_return_errors, &state);
+		}
+	} else {
+		struct page *page;
+		int __user *uerr = m.err;
+		unsigned nelem = m.num, nr;
+
+		list_for_each_entry(page, &pagelist, lru) {
+			nr = min_t(unsigned, nelem, MMAP_BATCH_PER_PAGE);
+			if (copy_to_user(uerr, page_address(page),
+					 nr * sizeof(*uerr))) {
+				ret = -EFAULT;
+				break;
+			}
+			uerr += nr;
+			nelem -= nr;
+		}
 	}
 
 out:
+	kfree(errs);
 	free_page_list(&pagelist);
 
 	return ret;
@@ -353,7 +432,11 @@ static long privcmd_ioctl(struct file *file,
 		break;
 
 	case IOCTL_PRIVCMD_MMAPBATCH:
-		ret = privcmd_ioctl_mmap_batch(udata);
+		ret = privcmd_ioctl_mmap_batch(udata, 1);
+		break;
+
+	case IOCTL_PRIVCMD_MMAPBATCH_V2:
+		ret = privcmd_ioctl_mmap_batch(udata, 2);
 		break;
 
 	default:
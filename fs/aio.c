@@ -263,7 +263,6 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 
 	atomic_set(&ctx->users, 1);
 	spin_lock_init(&ctx->ctx_lock);
-	spin_lock_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
@@ -698,7 +697,7 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 	ret = retry(iocb);
 
 	if (ret != -EIOCBRETRY && ret != -EIOCBQUEUED) {
-		BUG_ON(!list_empty(&iocb->ki_wait.task_list));
+		BUG_ON(!list_empty(&iocb->ki_wait.wait.task_list));
 		aio_complete(iocb, ret, 0);
 	}
 out:
@@ -857,7 +856,7 @@ static void try_queue_kicked_iocb(struct kiocb *iocb)
 	 * than retry has happened before we could queue the iocb.  This also
 	 * means that the retry could have completed and freed our iocb, no
 	 * good. */
-	BUG_ON((!list_empty(&iocb->ki_wait.task_list)));
+	BUG_ON((!list_empty(&iocb->ki_wait.wait.task_list)));
 
 	spin_lock_irqsave(&ctx->ctx_lock, flags);
 	/* set this inside the lock so that we can't race with aio_run_iocb()
@@ -1000,14 +999,18 @@ EXPORT_SYMBOL(aio_complete);
 /* aio_read_evt
  *	Pull an event off of the ioctx's event ring.  Returns the number of 
  *	events fetched (0 or 1 ;-)
- *	FIXME: make this use cmpxchg.
- *	TODO: make the ringbuffer user mmap()able (requires FIXME).
+ *
+ *	The ring is mapped into the process, which may reap events itself
+ *	without entering the kernel (AIO_RING_COMPAT_USER_REAP): read the
+ *	event at head once tail has moved past it, then advance head with
+ *	a compare-and-swap.  We do just the same, so both can reap at once.
+ *	head is writable by userspace and only trusted modulo the ring size.
  */
 static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 {
 	struct aio_ring_info *info = &ioctx->ring_info;
 	struct aio_ring *ring;
-	unsigned long head;
+	unsigned head;
 	int ret = 0;
 
 	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
@@ -1015,24 +1018,23 @@ static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 		 (unsigned long)ring->head, (unsigned long)ring->tail,
 		 (unsigned long)ring->nr);
 
-	if (ring->head == ring->tail)
-		goto out;
+	do {
+		struct io_event *evp;
 
-	spin_lock(&info->ring_lock);
+		head = ACCESS_ONCE(ring->head);
+		if (head % info->nr == ACCESS_ONCE(info->tail))
+			break;
+		smp_rmb(); /* read the tail before the event it covers */
 
-	head = ring->head % info->nr;
-	if (head != ring->tail) {
-		struct io_event *evp = aio_ring_event(info, head, KM_USER1);
+		evp = aio_ring_event(info, head % info->nr, KM_USER1);
 		*ent = *evp;
-		head = (head + 1) % info->nr;
-		smp_mb(); /* finish reading the event before updatng the head */
-		ring->head = head;
-		ret = 1;
 		put_aio_ring_event(evp, KM_USER1);
-	}
-	spin_unlock(&info->ring_lock);
 
-out:
+		smp_mb(); /* finish reading the event before updating the head */
+		ret = cmpxchg(&ring->head, head,
+			      (head % info->nr + 1) % info->nr) == head;
+	} while (!ret);
+
 	kunmap_atomic(ring, KM_USER0);
 	dprintk("leaving aio_read_evt: %d  h%lu t%lu\n", ret,
 		 (unsigned long)ring->head, (unsigned long)ring->tail);
@@ -1524,7 +1526,19 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb)
 static int aio_wake_function(wait_queue_t *wait, unsigned mode,
 			     int sync, void *key)
 {
-	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait);
+	struct kiocb *iocb = container_of(wait, struct kiocb, ki_wait.wait);
+	struct wait_bit_key *bit_key = key;
+
+	/*
+	 * Page wait queues are hashed and shared by many pages: when we
+	 * wait on a page bit, only a wakeup for that page and bit is ours.
+	 */
+	if (iocb->ki_wait.key.flags) {
+		if (!bit_key || bit_key->flags != iocb->ki_wait.key.flags ||
+		    bit_key->bit_nr != iocb->ki_wait.key.bit_nr)
+			return 0;
+		iocb->ki_wait.key.flags = NULL;
+	}
 
 	list_del_init(&wait->task_list);
 	kick_iocb(iocb);
@@ -1592,8 +1606,9 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_buf = (char __user *)(unsigned long)iocb->aio_buf;
 	req->ki_left = req->ki_nbytes = iocb->aio_nbytes;
 	req->ki_opcode = iocb->aio_lio_opcode;
-	init_waitqueue_func_entry(&req->ki_wait, aio_wake_function);
-	INIT_LIST_HEAD(&req->ki_wait.task_list);
+	init_waitqueue_func_entry(&req->ki_wait.wait, aio_wake_function);
+	INIT_LIST_HEAD(&req->ki_wait.wait.task_list);
+	req->ki_wait.key.flags = NULL;
 
 	ret = aio_setup_iocb(req);
 
@@ -33,6 +33,8 @@
 #include <linux/bootmem.h>
 #include <linux/fs_struct.h>
 #include <linux/hardirq.h>
+#include <linux/workqueue.h>
+#include <linux/percpu_counter.h>
 #include "internal.h"
 
 int sysctl_vfs_cache_pressure __read_mostly = 100;
@@ -67,6 +69,16 @@ struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/* Kept per CPU, outside dcache_lock; see also nr_inodes in inode.c. */
+static struct percpu_counter nr_dentry __cacheline_aligned_in_smp;
+
+int proc_nr_dentry(ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	dentry_stat.nr_dentry = percpu_counter_sum_positive(&nr_dentry);
+	return proc_dointvec(table, write, buffer, lenp, ppos);
+}
+
 static void __d_free(struct dentry *dentry)
 {
 	WARN_ON(!list_empty(&dentry->d_alias));
@@ -82,8 +94,7 @@ static void d_callback(struct rcu_head *head)
 }
 
 /*
- * no dcache_lock, please.  The caller must decrement dentry_stat.nr_dentry
- * inside dcache_lock.
+ * no dcache_lock, please.  The caller must decrement nr_dentry.
  */
 static void d_free(struct dentry *dentry)
 {
@@ -96,6 +107,81 @@ static void d_free(struct dentry *dentry)
 		call_rcu(&dentry->d_u.d_rcu, d_callback);
 }
 
+/*
+ * The lockless path walk in fs/namei.c looks at the inodes of the
+ * directories it crosses without holding a reference on them, so the
+ * last reference a dentry holds on a directory inode is only dropped
+ * once an RCU grace period has passed.  The iput() itself may sleep,
+ * hence the list and the work item behind the RCU callback.
+ */
+struct deferred_iput {
+	struct rcu_head rcu;
+	struct inode *inode;
+	struct list_head list;
+};
+
+static LIST_HEAD(deferred_iputs);
+static DEFINE_SPINLOCK(deferred_iput_lock);
+
+static void deferred_iput_workfn(struct work_struct *work)
+{
+	struct deferred_iput *di;
+
+	spin_lock(&deferred_iput_lock);
+	while (!list_empty(&deferred_iputs)) {
+		di = list_first_entry(&deferred_iputs, struct deferred_iput,
+				      list);
+		list_del(&di->list);
+		spin_unlock(&deferred_iput_lock);
+		iput(di->inode);
+		kfree(di);
+		spin_lock(&deferred_iput_lock);
+	}
+	spin_unlock(&deferred_iput_lock);
+}
+
+static DECLARE_WORK(deferred_iput_work, deferred_iput_workfn);
+
+static void deferred_iput_rcu(struct rcu_head *head)
+{
+	struct deferred_iput *di = container_of(head, struct deferred_iput,
+						rcu);
+
+	spin_lock(&deferred_iput_lock);
+	list_add_tail(&di->list, &deferred_iputs);
+	spin_unlock(&deferred_iput_lock);
+	schedule_work(&deferred_iput_work);
+}
+
+static void dir_iput(struct inode *inode)
+{
+	struct deferred_iput *di;
+
+	/* Not the last reference: nothing gets freed. */
+	if (atomic_add_unless(&inode->i_count, -1, 1))
+		return;
+
+	di = kmalloc(sizeof(*di), GFP_ATOMIC | __GFP_NOWARN);
+	if (!di) {
+		synchronize_rcu();
+		iput(inode);
+		return;
+	}
+	di->inode = inode;
+	call_rcu(&di->rcu, deferred_iput_rcu);
+}
+
+/**
+ * dcache_flush_deferred_iputs - finish the delayed directory iputs
+ *
+ * Called at unmount, before the inodes of the filesystem are evicted.
+ */
+void dcache_flush_deferred_iputs(void)
+{
+	rcu_barrier();
+	flush_work(&deferred_iput_work);
+}
+
 /*
  * Release the dentry's inode, using the filesystem
  * d_iput() operation if defined.
@@ -106,7 +192,9 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
+		write_seqcount_begin(&dentry->d_seq);
 		dentry->d_inode = NULL;
+		write_seqcount_end(&dentry->d_seq);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -114,6 +202,8 @@ static void dentry_iput(struct dentry * dentry)
 			fsnotify_inoderemove(inode);
 		if (dentry->d_op && dentry->d_op->d_iput)
 			dentry->d_op->d_iput(dentry, inode);
+		else if (S_ISDIR(inode->i_mode))
+			dir_iput(inode);
 		else
 			iput(inode);
 	} else {
@@ -172,7 +262,7 @@ static struct dentry *d_kill(struct dentry *dentry)
 	struct dentry *parent;
 
 	list_del(&dentry->d_u.d_child);
-	dentry_stat.nr_dentry--;	/* For d_free, below */
+	percpu_counter_dec(&nr_dentry);	/* For d_free, below */
 	/*drops the locks, at that point nobody can reach this dentry */
 	dentry_iput(dentry);
 	if (IS_ROOT(dentry))
@@ -707,9 +797,7 @@ static void shrink_dcache_for_umount_subtree(struct dentry *dentry)
 	}
 out:
 	/* several dentries were freed, need to correct nr_dentry */
-	spin_lock(&dcache_lock);
-	dentry_stat.nr_dentry -= detached;
-	spin_unlock(&dcache_lock);
+	percpu_counter_sub(&nr_dentry, detached);
 }
 
 /*
@@ -942,6 +1030,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -960,11 +1049,12 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 		INIT_LIST_HEAD(&dentry->d_u.d_child);
 	}
 
-	spin_lock(&dcache_lock);
-	if (parent)
+	if (parent) {
+		spin_lock(&dcache_lock);
 		list_add(&dentry->d_u.d_child, &parent->d_subdirs);
-	dentry_stat.nr_dentry++;
-	spin_unlock(&dcache_lock);
+		spin_unlock(&dcache_lock);
+	}
+	percpu_counter_inc(&nr_dentry);
 
 	return dentry;
 }
@@ -1421,6 +1511,41 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without locking or pinning it
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ *
+ * For the lockless path walk: the caller holds rcu_read_lock(), @parent
+ * has no d_compare() and the result is only a hint, good for as long as
+ * the caller's rename_lock sequence and the dentry's d_seq hold.  No
+ * reference is taken.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		if (dentry->d_name.hash != hash)
+			continue;
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		if (memcmp(dentry->d_name.name, str, len))
+			continue;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -2278,6 +2403,7 @@ static void __init dcache_init(void)
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
 	
 	register_shrinker(&dcache_shrinker);
+	percpu_counter_init(&nr_dentry, 0);
 
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
@@ -88,7 +88,11 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* The events an EPOLLEXCLUSIVE item may ask for */
+#define EPOLLEXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLERR | POLLHUP | \
+				EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -838,10 +842,15 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * EPOLLEXCLUSIVE items sit on the target's wait queue as exclusive
+ * entries, and only count as woken, by returning nonzero, when they had
+ * a waiter to hand the event to.  Otherwise the wakeup moves on to the
+ * next exclusive entry, usually another epoll instance's.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -857,6 +866,16 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
+	/*
+	 * Most wakeups of a busy socket are for an event nobody asked for,
+	 * so filter those before taking ep->lock.  This reads the mask
+	 * racily: an EPOLL_CTL_MOD polls the file itself after changing it,
+	 * and the checks are made again below under the lock.
+	 */
+	if (!(epi->event.events & ~EP_PRIVATE_BITS) ||
+	    (key && !((unsigned long) key & epi->event.events)))
+		goto out;
+
 	spin_lock_irqsave(&ep->lock, flags);
 
 	/*
@@ -899,8 +918,10 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
+	if (waitqueue_active(&ep->wq)) {
+		ewake = 1;
 		wake_up_locked(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
@@ -911,7 +932,11 @@ out_unlock:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+out:
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -928,7 +953,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1572,6 +1600,17 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE is set once, on EPOLL_CTL_ADD, for a plain file and
+	 * a basic event mask.  Epoll files cannot take it, since wakeups
+	 * that reach them through nesting are never exclusive.
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD || is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1632,8 +1671,11 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			/* Its wait queue entries stay exclusive: no changing it */
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds.events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, &epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
@@ -17,6 +17,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/cleancache.h>
 #include <linux/string.h>
 #include <linux/fs.h>
 #include <linux/time.h>
@@ -1307,6 +1308,7 @@ static int ext3_setup_super(struct super_block *sb, struct ext3_super_block *es,
 	} else {
 		printk("internal journal\n");
 	}
+	cleancache_init_fs(sb);
 	return res;
 }
 
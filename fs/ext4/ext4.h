@@ -1809,6 +1809,16 @@ static inline void ext4_lock_group(struct super_block *sb, ext4_group_t group)
 	}
 }
 
+/*
+ * Like ext4_lock_group(), but give up rather than wait if someone else
+ * holds the lock.  Returns true if the lock was taken.
+ */
+static inline int ext4_try_lock_group(struct super_block *sb,
+				      ext4_group_t group)
+{
+	return spin_trylock(ext4_group_lock_ptr(sb, group));
+}
+
 static inline void ext4_unlock_group(struct super_block *sb,
 					ext4_group_t group)
 {
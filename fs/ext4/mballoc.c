@@ -1901,6 +1901,16 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 
 		return 1;
 	case 1:
+		/*
+		 * A free extent that does not contain a buddy of order
+		 * bb_largest_free_order + 1 is shorter than
+		 * 2^(bb_largest_free_order + 2) - 1 blocks, so the cached
+		 * order tells us when no extent is long enough.
+		 */
+		if (grp->bb_largest_free_order >= 0 &&
+		    (2 << (grp->bb_largest_free_order + 1)) - 2 <
+						ac->ac_g_ex.fe_len)
+			return 0;
 		if ((free / fragments) >= ac->ac_g_ex.fe_len)
 			return 1;
 		break;
@@ -2062,7 +2072,11 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	 */
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
+		int trylock = 1, busy;
+
 		ac->ac_criteria = cr;
+again:
+		busy = 0;
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2085,7 +2099,18 @@ repeat:
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
+			/*
+			 * On the first pass, pass over groups someone else
+			 * is allocating from instead of queueing up behind
+			 * them: with many writers the next group is as good.
+			 */
+			if (!trylock)
+				ext4_lock_group(sb, group);
+			else if (!ext4_try_lock_group(sb, group)) {
+				busy = 1;
+				ext4_mb_unload_buddy(&e4b);
+				continue;
+			}
 
 			/*
 			 * We need to check again after locking the
@@ -2112,6 +2137,12 @@ repeat:
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
+
+		/* Go back for the busy groups before lowering the criteria */
+		if (busy && ac->ac_status == AC_STATUS_CONTINUE) {
+			trylock = 0;
+			goto again;
+		}
 	}
 
 	if (ac->ac_b_ex.fe_len > 0 && ac->ac_status != AC_STATUS_FOUND &&
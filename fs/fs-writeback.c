@@ -150,6 +150,23 @@ static void wb_clear_pending(struct bdi_writeback *wb, struct bdi_work *work)
 	}
 }
 
+/*
+ * Kick the flusher thread of a bdi that just got its first dirty inode, or
+ * the forker thread if it has none.  Checked under wb_lock, which the thread
+ * takes to clear wb->task when it exits.
+ */
+static void bdi_wakeup_flusher(struct backing_dev_info *bdi)
+{
+	struct task_struct *forker = default_backing_dev_info.wb.task;
+
+	spin_lock(&bdi->wb_lock);
+	if (bdi->wb.task)
+		wake_up_process(bdi->wb.task);
+	else if (forker)
+		wake_up_process(forker);
+	spin_unlock(&bdi->wb_lock);
+}
+
 static void bdi_queue_work(struct backing_dev_info *bdi, struct bdi_work *work)
 {
 	work->seen = bdi->wb_mask;
@@ -873,7 +890,7 @@ static long wb_check_old_data_flush(struct bdi_writeback *wb)
 	wb->last_old_flush = jiffies;
 	nr_pages = global_page_state(NR_FILE_DIRTY) +
 			global_page_state(NR_UNSTABLE_NFS) +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+			(get_nr_inodes() - inodes_stat.nr_unused);
 
 	if (nr_pages) {
 		struct wb_writeback_args args = {
@@ -932,6 +949,11 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 	return wrote;
 }
 
+static unsigned long bdi_max_idle(unsigned long wait_jiffies)
+{
+	return max(5UL * 60 * HZ, wait_jiffies);
+}
+
 /*
  * Handle writeback of dirty data for the device backed by this bdi. Also
  * wakes up periodically and does kupdated style flushing.
@@ -947,24 +969,39 @@ int bdi_writeback_task(struct bdi_writeback *wb)
 
 		if (pages_written)
 			last_active = jiffies;
-		else if (wait_jiffies != -1UL) {
-			unsigned long max_idle;
-
+		else if (wait_jiffies != -1UL && !wb_has_dirty_io(wb)) {
 			/*
 			 * Longest period of inactivity that we tolerate. If we
 			 * see dirty data again later, the task will get
 			 * recreated automatically.
 			 */
-			max_idle = max(5UL * 60 * HZ, wait_jiffies);
-			if (time_after(jiffies, max_idle + last_active))
+			if (time_after(jiffies, bdi_max_idle(wait_jiffies) +
+					       last_active))
 				break;
 		}
 
-		if (dirty_writeback_interval) {
+		if (dirty_writeback_interval)
 			wait_jiffies = msecs_to_jiffies(dirty_writeback_interval * 10);
-			schedule_timeout_interruptible(wait_jiffies);
-		} else
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!list_empty(&wb->bdi->work_list) || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		/*
+		 * Only wake up for periodic writeback while there is dirty
+		 * data.  A clean bdi sleeps until __mark_inode_dirty() or new
+		 * work wakes us, or until it is time to exit for idleness.
+		 * With hundreds of mostly idle devices this saves each of
+		 * their threads a wakeup every dirty_writeback_interval.
+		 */
+		if (wait_jiffies == -1UL)
 			schedule();
+		else if (wb_has_dirty_io(wb))
+			schedule_timeout(wait_jiffies);
+		else
+			schedule_timeout(bdi_max_idle(wait_jiffies));
 
 		try_to_freeze();
 	}
@@ -1061,6 +1098,7 @@ static noinline void block_dump___mark_inode_dirty(struct inode *inode)
 void __mark_inode_dirty(struct inode *inode, int flags)
 {
 	struct super_block *sb = inode->i_sb;
+	struct backing_dev_info *wakeup_bdi = NULL;
 
 	/*
 	 * Don't do this for I_DIRTY_PAGES - that doesn't actually
@@ -1124,12 +1162,23 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 								bdi->name);
 			}
 
+			/*
+			 * The flusher of a clean bdi sleeps without a
+			 * timeout, so kick it when it gets dirty data.
+			 */
+			if (bdi_cap_writeback_dirty(bdi) &&
+			    !wb_has_dirty_io(wb))
+				wakeup_bdi = bdi;
+
 			inode->dirtied_when = jiffies;
 			list_move(&inode->i_list, &wb->b_dirty);
 		}
 	}
 out:
 	spin_unlock(&inode_lock);
+
+	if (wakeup_bdi)
+		bdi_wakeup_flusher(wakeup_bdi);
 }
 EXPORT_SYMBOL(__mark_inode_dirty);
 
@@ -1216,7 +1265,7 @@ void writeback_inodes_sb(struct super_block *sb)
 	long nr_to_write;
 
 	nr_to_write = nr_dirty + nr_unstable +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+			(get_nr_inodes() - inodes_stat.nr_unused);
 
 	bdi_start_writeback(sb->s_bdi, sb, nr_to_write);
 }
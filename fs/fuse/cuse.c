@@ -467,6 +467,7 @@ static void cuse_fc_release(struct fuse_conn *fc)
  */
 static int cuse_channel_open(struct inode *inode, struct file *file)
 {
+	struct fuse_dev *fud;
 	struct cuse_conn *cc;
 	int rc;
 
@@ -477,6 +478,12 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 
 	fuse_conn_init(&cc->fc);
 
+	fud = fuse_dev_alloc(&cc->fc);
+	if (!fud) {
+		kfree(cc);
+		return -ENOMEM;
+	}
+
 	INIT_LIST_HEAD(&cc->list);
 	cc->fc.release = cuse_fc_release;
 
@@ -484,10 +491,11 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 	cc->fc.blocked = 0;
 	rc = cuse_send_init(cc);
 	if (rc) {
+		fuse_dev_free(fud);
 		fuse_conn_put(&cc->fc);
 		return rc;
 	}
-	file->private_data = &cc->fc;	/* channel owns base reference to cc */
+	file->private_data = fud;	/* channel owns base reference to cc */
 
 	return 0;
 }
@@ -505,7 +513,8 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
  */
 static int cuse_channel_release(struct inode *inode, struct file *file)
 {
-	struct cuse_conn *cc = fc_to_cc(file->private_data);
+	struct fuse_dev *fud = file->private_data;
+	struct cuse_conn *cc = fc_to_cc(fud->fc);
 	int rc;
 
 	/* remove from the conntbl, no more access from this point on */
@@ -523,7 +532,8 @@ static int cuse_channel_release(struct inode *inode, struct file *file)
 
 	/* kill connection and shutdown channel */
 	fuse_conn_kill(&cc->fc);
-	rc = fuse_dev_release(inode, file);	/* puts the base reference */
+	rc = fuse_dev_release(inode, file);
+	fuse_conn_put(&cc->fc);			/* puts the base reference */
 
 	return rc;
 }
@@ -16,20 +16,32 @@
 #include <linux/pagemap.h>
 #include <linux/file.h>
 #include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/swap.h>
+#include <linux/splice.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_dev *fuse_get_dev(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount (or cloning) and is valid until the file
+	 * is released.
 	 */
 	return file->private_data;
 }
 
+static struct fuse_conn *fuse_get_conn(struct file *file)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+
+	return fud ? fud->fc : NULL;
+}
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -225,26 +237,60 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	fc->reqctr += FUSE_REQ_ID_STEP;
 	/* zero is special */
 	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+		fc->reqctr = FUSE_REQ_ID_STEP;
 
 	return fc->reqctr;
 }
 
+static unsigned fuse_req_hash(u64 unique)
+{
+	return hash_long(unique & ~FUSE_INT_REQ_BIT, FUSE_PQ_HASH_BITS);
+}
+
+/*
+ * Wake up a reader of the channel.  If nobody is waiting there, wake
+ * up an idle reader of another channel instead, it will take over the
+ * request.
+ */
+static void fuse_dev_wake_up(struct fuse_conn *fc, struct fuse_dev *fud)
+{
+	struct fuse_dev *other;
+
+	if (!waitqueue_active(&fud->waitq)) {
+		list_for_each_entry(other, &fc->devices, entry) {
+			if (waitqueue_active(&other->waitq)) {
+				fud = other;
+				break;
+			}
+		}
+	}
+	wake_up(&fud->waitq);
+}
+
+/* Queue the request on the channel serving the current CPU */
+static void fuse_dev_queue(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_dev *fud = fc->cpu_dev[smp_processor_id()];
+
+	req->fud = fud;
+	list_add_tail(&req->list, &fud->pending);
+	fuse_dev_wake_up(fc, fud);
+}
+
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
 	req->in.h.unique = fuse_get_unique(fc);
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
+	fuse_dev_queue(fc, req);
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -313,10 +359,14 @@ __acquires(&fc->lock)
 	spin_lock(&fc->lock);
 }
 
+/*
+ * The interrupt has to go through the channel the request was read
+ * from, since only that one can match the reply
+ */
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
+	list_add_tail(&req->intr_entry, &req->fud->interrupts);
+	wake_up(&req->fud->waitq);
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 }
 
@@ -498,6 +548,9 @@ struct fuse_copy_state {
 	int write;
 	struct fuse_req *req;
 	const struct iovec *iov;
+	struct pipe_buffer *pipebufs;
+	struct pipe_buffer *currbuf;
+	struct pipe_inode_info *pipe;
 	unsigned long nr_segs;
 	unsigned long seglen;
 	unsigned long addr;
@@ -522,7 +575,18 @@ static void fuse_copy_init(struct fuse_copy_state *cs, struct fuse_conn *fc,
 /* Unmap and put previous page of userspace buffer */
 static void fuse_copy_finish(struct fuse_copy_state *cs)
 {
-	if (cs->mapaddr) {
+	if (cs->currbuf) {
+		struct pipe_buffer *buf = cs->currbuf;
+
+		if (!cs->write) {
+			buf->ops->unmap(cs->pipe, buf, cs->mapaddr);
+		} else {
+			kunmap_atomic(cs->mapaddr, KM_USER0);
+			buf->len = PAGE_SIZE - cs->len;
+		}
+		cs->currbuf = NULL;
+		cs->mapaddr = NULL;
+	} else if (cs->mapaddr) {
 		kunmap_atomic(cs->mapaddr, KM_USER0);
 		if (cs->write) {
 			flush_dcache_page(cs->pg);
@@ -533,6 +597,16 @@ static void fuse_copy_finish(struct fuse_copy_state *cs)
 	}
 }
 
+/*
+ * Is there room for another buffer in the pipe a request is spliced
+ * into?  Checking this while copying the request means a request too
+ * big for the pipe fails instead of getting lost.
+ */
+static int fuse_pipe_full(struct fuse_copy_state *cs)
+{
+	return cs->pipe->nrbufs + cs->nr_segs >= cs->pipe->buffers;
+}
+
 /*
  * Get another pagefull of userspace buffer, and map it to kernel
  * address space, and lock request
@@ -544,26 +618,66 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 
 	unlock_request(cs->fc, cs->req);
 	fuse_copy_finish(cs);
-	if (!cs->seglen) {
-		BUG_ON(!cs->nr_segs);
-		cs->seglen = cs->iov[0].iov_len;
-		cs->addr = (unsigned long) cs->iov[0].iov_base;
-		cs->iov++;
-		cs->nr_segs--;
+	if (cs->pipebufs) {
+		struct pipe_buffer *buf = cs->pipebufs;
+
+		if (!cs->write) {
+			/* Next buffer of the pipe the reply is spliced from */
+			BUG_ON(!cs->nr_segs);
+			err = buf->ops->confirm(cs->pipe, buf);
+			if (err)
+				return err;
+
+			cs->currbuf = buf;
+			cs->mapaddr = buf->ops->map(cs->pipe, buf, 1);
+			cs->buf = cs->mapaddr + buf->offset;
+			cs->len = buf->len;
+			cs->pipebufs++;
+			cs->nr_segs--;
+		} else {
+			/* New page for the pipe the request is spliced to */
+			struct page *page;
+
+			if (fuse_pipe_full(cs))
+				return -EIO;
+
+			page = alloc_page(GFP_HIGHUSER);
+			if (!page)
+				return -ENOMEM;
+
+			buf->page = page;
+			buf->offset = 0;
+			buf->len = 0;
+
+			cs->currbuf = buf;
+			cs->mapaddr = kmap_atomic(page, KM_USER0);
+			cs->buf = cs->mapaddr;
+			cs->len = PAGE_SIZE;
+			cs->pipebufs++;
+			cs->nr_segs++;
+		}
+	} else {
+		if (!cs->seglen) {
+			BUG_ON(!cs->nr_segs);
+			cs->seglen = cs->iov[0].iov_len;
+			cs->addr = (unsigned long) cs->iov[0].iov_base;
+			cs->iov++;
+			cs->nr_segs--;
+		}
+		down_read(&current->mm->mmap_sem);
+		err = get_user_pages(current, current->mm, cs->addr, 1,
+				     cs->write, 0, &cs->pg, NULL);
+		up_read(&current->mm->mmap_sem);
+		if (err < 0)
+			return err;
+		BUG_ON(err != 1);
+		offset = cs->addr % PAGE_SIZE;
+		cs->mapaddr = kmap_atomic(cs->pg, KM_USER0);
+		cs->buf = cs->mapaddr + offset;
+		cs->len = min(PAGE_SIZE - offset, cs->seglen);
+		cs->seglen -= cs->len;
+		cs->addr += cs->len;
 	}
-	down_read(&current->mm->mmap_sem);
-	err = get_user_pages(current, current->mm, cs->addr, 1, cs->write, 0,
-			     &cs->pg, NULL);
-	up_read(&current->mm->mmap_sem);
-	if (err < 0)
-		return err;
-	BUG_ON(err != 1);
-	offset = cs->addr % PAGE_SIZE;
-	cs->mapaddr = kmap_atomic(cs->pg, KM_USER0);
-	cs->buf = cs->mapaddr + offset;
-	cs->len = min(PAGE_SIZE - offset, cs->seglen);
-	cs->seglen -= cs->len;
-	cs->addr += cs->len;
 
 	return lock_request(cs->fc, cs->req);
 }
@@ -585,6 +699,34 @@ static int fuse_copy_do(struct fuse_copy_state *cs, void **val, unsigned *size)
 	return ncpy;
 }
 
+/*
+ * Instead of copying, pass a reference to a page of the request on to
+ * the pipe the request is spliced to
+ */
+static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
+			 unsigned offset, unsigned count)
+{
+	struct pipe_buffer *buf;
+
+	if (fuse_pipe_full(cs))
+		return -EIO;
+
+	unlock_request(cs->fc, cs->req);
+	fuse_copy_finish(cs);
+
+	buf = cs->pipebufs;
+	page_cache_get(page);
+	buf->page = page;
+	buf->offset = offset;
+	buf->len = count;
+
+	cs->pipebufs++;
+	cs->nr_segs++;
+	cs->len = 0;
+
+	return 0;
+}
+
 /*
  * Copy a page in the request to/from the userspace buffer.  Must be
  * done atomically
@@ -592,6 +734,9 @@ static int fuse_copy_do(struct fuse_copy_state *cs, void **val, unsigned *size)
 static int fuse_copy_page(struct fuse_copy_state *cs, struct page *page,
 			  unsigned offset, unsigned count, int zeroing)
 {
+	if (page && cs->write && cs->pipebufs)
+		return fuse_ref_page(cs, page, offset, count);
+
 	if (page && zeroing && count < PAGE_SIZE) {
 		void *mapaddr = kmap_atomic(page, KM_USER1);
 		memset(mapaddr, 0, PAGE_SIZE);
@@ -670,20 +815,39 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * Find the channel to take the next request from.  Prefer our own,
+ * but rather than sitting idle take over work from another channel.
+ */
+static struct fuse_dev *pending_dev(struct fuse_dev *fud)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts);
+	struct fuse_dev *other;
+
+	if (!list_empty(&fud->pending))
+		return fud;
+
+	list_for_each_entry(other, &fud->fc->devices, entry) {
+		if (!list_empty(&other->pending))
+			return other;
+	}
+	return NULL;
+}
+
+static int request_pending(struct fuse_dev *fud)
+{
+	return !list_empty(&fud->interrupts) || pending_dev(fud);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_dev *fud)
 __releases(&fc->lock)
 __acquires(&fc->lock)
 {
+	struct fuse_conn *fc = fud->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&fud->waitq, &wait);
+	while (fc->connected && !request_pending(fud)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -693,7 +857,7 @@ __acquires(&fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&fud->waitq, &wait);
 }
 
 /*
@@ -704,18 +868,17 @@ __acquires(&fc->lock)
  *
  * Called with fc->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_req *req,
-			       const struct iovec *iov, unsigned long nr_segs)
+static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+			       size_t nbytes, struct fuse_req *req)
 __releases(&fc->lock)
 {
-	struct fuse_copy_state cs;
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
 	unsigned reqsize = sizeof(ih) + sizeof(arg);
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = req->in.h.unique | FUSE_INT_REQ_BIT;
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -724,14 +887,13 @@ __releases(&fc->lock)
 	arg.unique = req->in.h.unique;
 
 	spin_unlock(&fc->lock);
-	if (iov_length(iov, nr_segs) < reqsize)
+	if (nbytes < reqsize)
 		return -EINVAL;
 
-	fuse_copy_init(&cs, fc, 1, NULL, iov, nr_segs);
-	err = fuse_copy_one(&cs, &ih, sizeof(ih));
+	err = fuse_copy_one(cs, &ih, sizeof(ih));
 	if (!err)
-		err = fuse_copy_one(&cs, &arg, sizeof(arg));
-	fuse_copy_finish(&cs);
+		err = fuse_copy_one(cs, &arg, sizeof(arg));
+	fuse_copy_finish(cs);
 
 	return err ? err : reqsize;
 }
@@ -745,48 +907,46 @@ __releases(&fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
-			      unsigned long nr_segs, loff_t pos)
+static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
+				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
-	struct fuse_copy_state cs;
 	unsigned reqsize;
-	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
-		return -EPERM;
+	struct fuse_conn *fc = fud->fc;
 
  restart:
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fud))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fud);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fud))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&fud->interrupts)) {
+		req = list_entry(fud->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, req, iov, nr_segs);
+		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(pending_dev(fud)->pending.next, struct fuse_req,
+			 list);
+	req->fud = fud;
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
 	/* If request is too large, reply with an error and restart the read */
-	if (iov_length(iov, nr_segs) < reqsize) {
+	if (nbytes < reqsize) {
 		req->out.h.error = -EIO;
 		/* SETXATTR is special, since it may contain too large data */
 		if (in->h.opcode == FUSE_SETXATTR)
@@ -795,12 +955,12 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 		goto restart;
 	}
 	spin_unlock(&fc->lock);
-	fuse_copy_init(&cs, fc, 1, req, iov, nr_segs);
-	err = fuse_copy_one(&cs, &in->h, sizeof(in->h));
+	cs->req = req;
+	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
-		err = fuse_copy_args(&cs, in->numargs, in->argpages,
+		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
-	fuse_copy_finish(&cs);
+	fuse_copy_finish(cs);
 	spin_lock(&fc->lock);
 	req->locked = 0;
 	if (req->aborted) {
@@ -816,7 +976,8 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list,
+			       &fud->processing[fuse_req_hash(in->h.unique)]);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -828,6 +989,119 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 	return err;
 }
 
+static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
+			      unsigned long nr_segs, loff_t pos)
+{
+	struct fuse_copy_state cs;
+	struct file *file = iocb->ki_filp;
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (!fud)
+		return -EPERM;
+
+	fuse_copy_init(&cs, fud->fc, 1, NULL, iov, nr_segs);
+
+	return fuse_dev_do_read(fud, file, &cs, iov_length(iov, nr_segs));
+}
+
+static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
+				   struct pipe_buffer *buf)
+{
+	return 1;
+}
+
+static const struct pipe_buf_operations fuse_dev_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = fuse_dev_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+/*
+ * Read a request into a pipe.  The header and arguments are copied
+ * into freshly allocated pages, the data pages of the request (e.g.
+ * the page cache pages of a WRITE) are passed on by reference.
+ *
+ * The whole request has to fit into the free buffers of the pipe,
+ * otherwise the request is failed with -EIO.
+ */
+static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
+				    struct pipe_inode_info *pipe,
+				    size_t len, unsigned int flags)
+{
+	ssize_t ret;
+	int page_nr = 0;
+	int do_wakeup = 0;
+	struct pipe_buffer *bufs;
+	struct fuse_copy_state cs;
+	struct fuse_dev *fud = fuse_get_dev(in);
+	if (!fud)
+		return -EPERM;
+
+	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
+
+	fuse_copy_init(&cs, fud->fc, 1, NULL, NULL, 0);
+	cs.pipebufs = bufs;
+	cs.pipe = pipe;
+	ret = fuse_dev_do_read(fud, in, &cs, len);
+	if (ret < 0)
+		goto out;
+
+	ret = 0;
+	pipe_lock(pipe);
+
+	if (!pipe->readers) {
+		send_sig(SIGPIPE, current, 0);
+		ret = -EPIPE;
+		goto out_unlock;
+	}
+
+	if (pipe->nrbufs + cs.nr_segs > pipe->buffers) {
+		ret = -EIO;
+		goto out_unlock;
+	}
+
+	while (page_nr < cs.nr_segs) {
+		int newbuf = (pipe->curbuf + pipe->nrbufs) &
+			(pipe->buffers - 1);
+		struct pipe_buffer *buf = pipe->bufs + newbuf;
+
+		buf->page = bufs[page_nr].page;
+		buf->offset = bufs[page_nr].offset;
+		buf->len = bufs[page_nr].len;
+		buf->ops = &fuse_dev_pipe_buf_ops;
+		buf->flags = 0;
+
+		pipe->nrbufs++;
+		page_nr++;
+		ret += buf->len;
+
+		if (pipe->inode)
+			do_wakeup = 1;
+	}
+
+ out_unlock:
+	pipe_unlock(pipe);
+
+	if (do_wakeup) {
+		smp_mb();
+		if (waitqueue_active(&pipe->wait))
+			wake_up_interruptible(&pipe->wait);
+		kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
+	}
+
+ out:
+	for (; page_nr < cs.nr_segs; page_nr++)
+		page_cache_release(bufs[page_nr].page);
+
+	kfree(bufs);
+	return ret;
+}
+
 static int fuse_notify_poll(struct fuse_conn *fc, unsigned int size,
 			    struct fuse_copy_state *cs)
 {
@@ -948,14 +1222,14 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_dev *fud, u64 unique)
 {
-	struct list_head *entry;
+	struct fuse_req *req;
 
-	list_for_each(entry, &fc->processing) {
-		struct fuse_req *req;
-		req = list_entry(entry, struct fuse_req, list);
-		if (req->in.h.unique == unique || req->intr_unique == unique)
+	unique &= ~FUSE_INT_REQ_BIT;
+	list_for_each_entry(req, &fud->processing[fuse_req_hash(unique)],
+			    list) {
+		if (req->in.h.unique == unique)
 			return req;
 	}
 	return NULL;
@@ -991,23 +1265,18 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
-			       unsigned long nr_segs, loff_t pos)
+static ssize_t fuse_dev_do_write(struct fuse_dev *fud,
+				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
-	size_t nbytes = iov_length(iov, nr_segs);
 	struct fuse_req *req;
 	struct fuse_out_header oh;
-	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
-		return -EPERM;
+	struct fuse_conn *fc = fud->fc;
 
-	fuse_copy_init(&cs, fc, 0, NULL, iov, nr_segs);
 	if (nbytes < sizeof(struct fuse_out_header))
 		return -EINVAL;
 
-	err = fuse_copy_one(&cs, &oh, sizeof(oh));
+	err = fuse_copy_one(cs, &oh, sizeof(oh));
 	if (err)
 		goto err_finish;
 
@@ -1020,7 +1289,7 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 	 * and error contains notification code.
 	 */
 	if (!oh.unique) {
-		err = fuse_notify(fc, oh.error, nbytes - sizeof(oh), &cs);
+		err = fuse_notify(fc, oh.error, nbytes - sizeof(oh), cs);
 		return err ? err : nbytes;
 	}
 
@@ -1033,19 +1302,19 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fud, oh.unique);
 	if (!req)
 		goto err_unlock;
 
 	if (req->aborted) {
 		spin_unlock(&fc->lock);
-		fuse_copy_finish(&cs);
+		fuse_copy_finish(cs);
 		spin_lock(&fc->lock);
 		request_end(fc, req);
 		return -ENOENT;
 	}
 	/* Is it an interrupt reply? */
-	if (req->intr_unique == oh.unique) {
+	if (oh.unique & FUSE_INT_REQ_BIT) {
 		err = -EINVAL;
 		if (nbytes != sizeof(struct fuse_out_header))
 			goto err_unlock;
@@ -1056,7 +1325,7 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			queue_interrupt(fc, req);
 
 		spin_unlock(&fc->lock);
-		fuse_copy_finish(&cs);
+		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
@@ -1064,11 +1333,11 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 	list_move(&req->list, &fc->io);
 	req->out.h = oh;
 	req->locked = 1;
-	cs.req = req;
+	cs->req = req;
 	spin_unlock(&fc->lock);
 
-	err = copy_out_args(&cs, &req->out, nbytes);
-	fuse_copy_finish(&cs);
+	err = copy_out_args(cs, &req->out, nbytes);
+	fuse_copy_finish(cs);
 
 	spin_lock(&fc->lock);
 	req->locked = 0;
@@ -1084,23 +1353,126 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
  err_unlock:
 	spin_unlock(&fc->lock);
  err_finish:
-	fuse_copy_finish(&cs);
+	fuse_copy_finish(cs);
 	return err;
 }
 
+static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
+			       unsigned long nr_segs, loff_t pos)
+{
+	struct fuse_copy_state cs;
+	struct fuse_dev *fud = fuse_get_dev(iocb->ki_filp);
+	if (!fud)
+		return -EPERM;
+
+	fuse_copy_init(&cs, fud->fc, 0, NULL, iov, nr_segs);
+
+	return fuse_dev_do_write(fud, &cs, iov_length(iov, nr_segs));
+}
+
+/*
+ * Write a reply from a pipe.  The buffers making up the reply are
+ * taken off the pipe and the data is copied from them into the
+ * request, which saves the get_user_pages() of a plain write.  Pages
+ * are never stolen from the pipe, so SPLICE_F_MOVE has no effect.
+ */
+static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
+				     struct file *out, loff_t *ppos,
+				     size_t len, unsigned int flags)
+{
+	unsigned nbuf;
+	unsigned idx;
+	struct pipe_buffer *bufs;
+	struct fuse_copy_state cs;
+	struct fuse_dev *fud;
+	size_t rem;
+	ssize_t ret;
+
+	fud = fuse_get_dev(out);
+	if (!fud)
+		return -EPERM;
+
+	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
+
+	pipe_lock(pipe);
+	nbuf = 0;
+	rem = 0;
+	for (idx = 0; idx < pipe->nrbufs && rem < len; idx++)
+		rem += pipe->bufs[(pipe->curbuf + idx) &
+				  (pipe->buffers - 1)].len;
+
+	ret = -EINVAL;
+	if (rem < len) {
+		pipe_unlock(pipe);
+		goto out;
+	}
+
+	rem = len;
+	while (rem) {
+		struct pipe_buffer *ibuf;
+		struct pipe_buffer *obuf;
+
+		BUG_ON(nbuf >= pipe->buffers);
+		BUG_ON(!pipe->nrbufs);
+		ibuf = &pipe->bufs[pipe->curbuf];
+		obuf = &bufs[nbuf];
+
+		if (rem >= ibuf->len) {
+			*obuf = *ibuf;
+			ibuf->ops = NULL;
+			pipe->curbuf = (pipe->curbuf + 1) & (pipe->buffers - 1);
+			pipe->nrbufs--;
+		} else {
+			ibuf->ops->get(pipe, ibuf);
+			*obuf = *ibuf;
+			obuf->flags &= ~PIPE_BUF_FLAG_GIFT;
+			obuf->len = rem;
+			ibuf->offset += obuf->len;
+			ibuf->len -= obuf->len;
+		}
+		nbuf++;
+		rem -= obuf->len;
+	}
+	pipe_unlock(pipe);
+
+	/* Room was made in the pipe */
+	smp_mb();
+	if (waitqueue_active(&pipe->wait))
+		wake_up_interruptible(&pipe->wait);
+	kill_fasync(&pipe->fasync_writers, SIGIO, POLL_OUT);
+
+	fuse_copy_init(&cs, fud->fc, 0, NULL, NULL, nbuf);
+	cs.pipebufs = bufs;
+	cs.pipe = pipe;
+
+	ret = fuse_dev_do_write(fud, &cs, len);
+
+	for (idx = 0; idx < nbuf; idx++) {
+		struct pipe_buffer *buf = &bufs[idx];
+		buf->ops->release(pipe, buf);
+	}
+ out:
+	kfree(bufs);
+	return ret;
+}
+
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_conn *fc;
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (!fud)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = fud->fc;
+	poll_wait(file, &fud->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fud))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1162,14 +1534,137 @@ __acquires(&fc->lock)
 	}
 }
 
+/*
+ * The requests are gathered on a private list first, since
+ * end_requests() drops fc->lock and channels may go away meanwhile
+ */
 static void end_queued_requests(struct fuse_conn *fc)
+__releases(&fc->lock)
+__acquires(&fc->lock)
 {
+	struct fuse_dev *fud;
+	LIST_HEAD(to_end);
+	unsigned i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	list_for_each_entry(fud, &fc->devices, entry) {
+		list_splice_tail_init(&fud->pending, &to_end);
+		for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+			list_splice_tail_init(&fud->processing[i], &to_end);
+	}
+	end_requests(fc, &to_end);
+}
+
+/* Called with fc->lock held */
+void fuse_dev_wake_up_all(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+
+	list_for_each_entry(fud, &fc->devices, entry)
+		wake_up_all(&fud->waitq);
 }
 
+/*
+ * Spread the CPUs over the channels, so that with as many channels as
+ * CPUs each CPU gets its own request queue.  Called with fc->lock held.
+ */
+static void fuse_dev_remap(struct fuse_conn *fc)
+{
+	struct list_head *entry = &fc->devices;
+	unsigned cpu;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (list_empty(&fc->devices)) {
+			fc->cpu_dev[cpu] = NULL;
+			continue;
+		}
+		entry = entry->next;
+		if (entry == &fc->devices)
+			entry = entry->next;
+		fc->cpu_dev[cpu] = list_entry(entry, struct fuse_dev, entry);
+	}
+}
+
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc)
+{
+	struct fuse_dev *fud;
+	struct fuse_dev **cpu_dev = NULL;
+	unsigned i;
+
+	fud = kzalloc(sizeof(struct fuse_dev), GFP_KERNEL);
+	if (!fud)
+		return NULL;
+
+	if (!fc->cpu_dev) {
+		cpu_dev = kcalloc(nr_cpu_ids, sizeof(*cpu_dev), GFP_KERNEL);
+		if (!cpu_dev) {
+			kfree(fud);
+			return NULL;
+		}
+	}
+
+	fud->fc = fuse_conn_get(fc);
+	init_waitqueue_head(&fud->waitq);
+	INIT_LIST_HEAD(&fud->pending);
+	INIT_LIST_HEAD(&fud->interrupts);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&fud->processing[i]);
+
+	spin_lock(&fc->lock);
+	if (!fc->cpu_dev) {
+		fc->cpu_dev = cpu_dev;
+		cpu_dev = NULL;
+	}
+	list_add_tail(&fud->entry, &fc->devices);
+	fc->num_devices++;
+	fuse_dev_remap(fc);
+	spin_unlock(&fc->lock);
+	kfree(cpu_dev);
+
+	return fud;
+}
+EXPORT_SYMBOL_GPL(fuse_dev_alloc);
+
+/*
+ * Requests not yet read from the channel are moved to the remaining
+ * ones.  Replies to requests read from it can't arrive any more, so
+ * those are aborted.  If it was the last channel, the connection is
+ * released.
+ */
+void fuse_dev_free(struct fuse_dev *fud)
+{
+	struct fuse_conn *fc = fud->fc;
+	LIST_HEAD(to_end);
+	unsigned i;
+
+	spin_lock(&fc->lock);
+	if (fc->num_devices == 1) {
+		fc->connected = 0;
+		fc->blocked = 0;
+		end_queued_requests(fc);
+		wake_up_all(&fc->blocked_waitq);
+	}
+	list_del(&fud->entry);
+	fc->num_devices--;
+	fuse_dev_remap(fc);
+	while (!list_empty(&fud->pending)) {
+		struct fuse_req *req;
+
+		req = list_entry(fud->pending.next, struct fuse_req, list);
+		list_del(&req->list);
+		fuse_dev_queue(fc, req);
+	}
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		list_splice_tail_init(&fud->processing[i], &to_end);
+	end_requests(fc, &to_end);
+	spin_unlock(&fc->lock);
+
+	fuse_conn_put(fc);
+	kfree(fud);
+}
+EXPORT_SYMBOL_GPL(fuse_dev_free);
+
 /*
  * Abort all requests.
  *
@@ -1197,7 +1692,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->blocked = 0;
 		end_io_requests(fc);
 		end_queued_requests(fc);
-		wake_up_all(&fc->waitq);
+		fuse_dev_wake_up_all(fc);
 		wake_up_all(&fc->blocked_waitq);
 		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
@@ -1207,21 +1702,71 @@ EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
-		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		wake_up_all(&fc->blocked_waitq);
-		spin_unlock(&fc->lock);
-		fuse_conn_put(fc);
-	}
+	struct fuse_dev *fud = fuse_get_dev(file);
+	if (fud)
+		fuse_dev_free(fud);
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(fuse_dev_release);
 
+/*
+ * Attach a newly opened device file to the connection of another one,
+ * giving the filesystem daemon one more request queue
+ */
+static int fuse_dev_clone(struct fuse_conn *fc, struct file *new)
+{
+	struct fuse_dev *fud;
+
+	if (new->private_data)
+		return -EINVAL;
+	if (!fc->connected)
+		return -ENODEV;
+
+	fud = fuse_dev_alloc(fc);
+	if (!fud)
+		return -ENOMEM;
+
+	new->private_data = fud;
+	return 0;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_dev *fud;
+	struct file *old;
+	__u32 oldfd;
+	int err;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (__u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	/*
+	 * Only clone plain fuse channels, CUSE channels come with a
+	 * device of their own
+	 */
+	err = -EINVAL;
+	fud = NULL;
+	if (old->f_op == &fuse_dev_operations)
+		fud = fuse_get_dev(old);
+	if (fud) {
+		mutex_lock(&fuse_mutex);
+		err = fuse_dev_clone(fud->fc, file);
+		mutex_unlock(&fuse_mutex);
+	}
+	fput(old);
+
+	return err;
+}
+
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
 	struct fuse_conn *fc = fuse_get_conn(file);
@@ -1239,9 +1784,13 @@ const struct file_operations fuse_dev_operations = {
 	.aio_read	= fuse_dev_read,
 	.write		= do_sync_write,
 	.aio_write	= fuse_dev_write,
+	.splice_read	= fuse_dev_splice_read,
+	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -35,6 +35,18 @@
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
+/** Number of hash bits for the requests being processed on a channel */
+#define FUSE_PQ_HASH_BITS 6
+
+/** Number of buckets for the requests being processed on a channel */
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
+/** Requests get even unique IDs, the ID of their INTERRUPT is odd */
+#define FUSE_INT_REQ_BIT 1ULL
+
+/** Step between the unique IDs of consecutive requests */
+#define FUSE_REQ_ID_STEP (1ULL << 1)
+
 /** If the FUSE_DEFAULT_PERMISSIONS flag is given, the filesystem
     module will check permissions based on the file mode.  Otherwise no
     permission checking is done in the kernel */
@@ -202,10 +214,13 @@ enum fuse_req_state {
  * A request to the client
  */
 struct fuse_req {
-	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	/** This can be on either pending or processing lists in
+	    fuse_dev, or on the io list in fuse_conn */
 	struct list_head list;
 
+	/** The channel the request is queued on or was read from */
+	struct fuse_dev *fud;
+
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
@@ -304,6 +319,35 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A channel of a Fuse connection.
+ *
+ * There's one for each open device file attached to the connection:
+ * the one used for mounting and any cloned with FUSE_DEV_IOC_CLONE.
+ * New requests are spread over the channels by the submitting CPU.
+ * Apart from fc the fields are protected by fc->lock.
+ */
+struct fuse_dev {
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of requests queued on this channel */
+	struct list_head pending;
+
+	/** Pending interrupts of requests read from this channel */
+	struct list_head interrupts;
+
+	/** Requests read from this channel waiting for a reply,
+	    hashed by unique ID */
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
+
+	/** Entry on fc->devices */
+	struct list_head entry;
+};
+
 /**
  * A Fuse connection.
  *
@@ -336,14 +380,14 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** The channels of the connection */
+	struct list_head devices;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Number of channels on the above list */
+	unsigned num_devices;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Channel new requests are queued on, indexed by CPU */
+	struct fuse_dev **cpu_dev;
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -369,9 +413,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Flag indicating if connection is blocked.  This will be
 	    the case before the INIT reply is received, and if there
 	    are too many outstading backgrounds requests */
@@ -675,6 +716,21 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Attach a new channel to a connection
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+
+/**
+ * Detach a channel from its connection and free it
+ */
+void fuse_dev_free(struct fuse_dev *fud);
+
+/**
+ * Wake up the readers of all channels of a connection
+ */
+void fuse_dev_wake_up_all(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -344,7 +344,9 @@ void fuse_conn_kill(struct fuse_conn *fc)
 	spin_unlock(&fc->lock);
 	/* Flush all readers on this fs */
 	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
-	wake_up_all(&fc->waitq);
+	spin_lock(&fc->lock);
+	fuse_dev_wake_up_all(fc);
+	spin_unlock(&fc->lock);
 	wake_up_all(&fc->blocked_waitq);
 	wake_up_all(&fc->reserved_req_waitq);
 	mutex_lock(&fuse_mutex);
@@ -538,13 +540,10 @@ void fuse_conn_init(struct fuse_conn *fc)
 	mutex_init(&fc->inst_mutex);
 	init_rwsem(&fc->killsb);
 	atomic_set(&fc->count, 1);
-	init_waitqueue_head(&fc->waitq);
 	init_waitqueue_head(&fc->blocked_waitq);
 	init_waitqueue_head(&fc->reserved_req_waitq);
-	INIT_LIST_HEAD(&fc->pending);
-	INIT_LIST_HEAD(&fc->processing);
+	INIT_LIST_HEAD(&fc->devices);
 	INIT_LIST_HEAD(&fc->io);
-	INIT_LIST_HEAD(&fc->interrupts);
 	INIT_LIST_HEAD(&fc->bg_queue);
 	INIT_LIST_HEAD(&fc->entry);
 	atomic_set(&fc->num_waiting, 0);
@@ -564,6 +563,7 @@ void fuse_conn_put(struct fuse_conn *fc)
 	if (atomic_dec_and_test(&fc->count)) {
 		if (fc->destroy_req)
 			fuse_request_free(fc->destroy_req);
+		kfree(fc->cpu_dev);
 		mutex_destroy(&fc->inst_mutex);
 		fc->release(fc);
 	}
@@ -926,6 +926,7 @@ static int fuse_bdi_init(struct fuse_conn *fc, struct super_block *sb)
 static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 {
 	struct fuse_conn *fc;
+	struct fuse_dev *fud;
 	struct inode *root;
 	struct fuse_mount_data d;
 	struct file *file;
@@ -1014,6 +1015,10 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 			goto err_free_init_req;
 	}
 
+	fud = fuse_dev_alloc(fc);
+	if (!fud)
+		goto err_free_init_req;
+
 	mutex_lock(&fuse_mutex);
 	err = -EINVAL;
 	if (file->private_data)
@@ -1026,7 +1031,7 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 	list_add_tail(&fc->entry, &fuse_conn_list);
 	sb->s_root = root_dentry;
 	fc->connected = 1;
-	file->private_data = fuse_conn_get(fc);
+	file->private_data = fud;
 	mutex_unlock(&fuse_mutex);
 	/*
 	 * atomic_dec_and_test() in fput() provides the necessary
@@ -1041,6 +1046,7 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 
  err_unlock:
 	mutex_unlock(&fuse_mutex);
+	fuse_dev_free(fud);
  err_free_init_req:
 	fuse_request_free(init_req);
  err_put_root:
@@ -80,6 +80,11 @@ extern void chroot_fs_refs(struct path *, struct path *);
  */
 extern void mark_files_ro(struct super_block *);
 
+/*
+ * dcache.c
+ */
+extern void dcache_flush_deferred_iputs(void);
+
 /*
  * super.c
  */
@@ -358,6 +358,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int err;
 	unsigned long long blocknr;
 	ktime_t start_time;
+	ktime_t record_time;
 	u64 commit_time;
 	char *tagp = NULL;
 	journal_header_t *header;
@@ -684,20 +685,25 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
+
+				lock_buffer(bh);
+				clear_buffer_dirty(bh);
+				set_buffer_uptodate(bh);
+				bh->b_end_io = journal_end_buffer_io_sync;
+				submit_bh(write_op, bh);
+
 				/*
-				 * Compute checksum.
+				 * Compute checksum.  The buffer doesn't
+				 * change under IO and is only freed below
+				 * once the IO has been waited for, so this
+				 * can overlap with the write instead of
+				 * delaying its submission.
 				 */
 				if (JBD2_HAS_COMPAT_FEATURE(journal,
 					JBD2_FEATURE_COMPAT_CHECKSUM)) {
 					crc32_sum =
 					    jbd2_checksum_data(crc32_sum, bh);
 				}
-
-				lock_buffer(bh);
-				clear_buffer_dirty(bh);
-				set_buffer_uptodate(bh);
-				bh->b_end_io = journal_end_buffer_io_sync;
-				submit_bh(write_op, bh);
 			}
 			cond_resched();
 			stats.run.rs_blocks_logged += bufs;
@@ -726,8 +732,6 @@ start_journal_io:
 						 &cbh, crc32_sum);
 		if (err)
 			__jbd2_journal_abort_hard(journal);
-		if (journal->j_flags & JBD2_BARRIER)
-			blkdev_issue_flush(journal->j_dev, NULL);
 	}
 
 	err = journal_finish_inode_data_buffers(journal, commit_transaction);
@@ -849,9 +853,22 @@ wait_for_iobuf:
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
+	record_time = ktime_get();
 	if (!err && !is_journal_aborted(journal))
 		err = journal_wait_on_commit_record(journal, cbh);
 
+	/*
+	 * An asynchronous commit record goes out without a barrier, so
+	 * flush the cache to make the transaction durable.  This must
+	 * come after the commit record has completed, a flush issued
+	 * while it is still queued would not cover it.
+	 */
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT) &&
+	    journal->j_flags & JBD2_BARRIER)
+		blkdev_issue_flush(journal->j_dev, NULL);
+	record_time = ktime_sub(ktime_get(), record_time);
+
 	if (err)
 		jbd2_journal_abort(journal, err);
 
@@ -1036,6 +1053,8 @@ restart_loop:
 				journal->j_average_commit_time*3) / 4;
 	else
 		journal->j_average_commit_time = commit_time;
+	trace_jbd2_commit_latency(journal, commit_transaction, commit_time,
+				  ktime_to_ns(record_time));
 	spin_unlock(&journal->j_state_lock);
 
 	if (commit_transaction->t_checkpoint_list == NULL &&
@@ -839,6 +839,136 @@ static inline int follow_on_final(struct inode *inode, unsigned lookup_flags)
 		((lookup_flags & LOOKUP_FOLLOW) || S_ISDIR(inode->i_mode));
 }
 
+/*
+ * Lockless search permission check for rcu_walk_prefix(): plain DAC
+ * only, anything needing more than that is left to exec_permission_lite().
+ * The inode memory stays valid under rcu_read_lock() because the final
+ * iput() of a directory held by a dentry is deferred; @seq tells whether
+ * it still belongs to @dentry.
+ */
+static int rcu_may_exec(struct dentry *dentry, unsigned seq)
+{
+	struct inode *inode = dentry->d_inode;
+	umode_t mode;
+
+	if (!inode || inode->i_op->permission)
+		return 0;
+
+	mode = inode->i_mode;
+	if (current_fsuid() == inode->i_uid)
+		mode >>= 6;
+	else {
+		if (IS_POSIXACL(inode) && (mode & S_IRWXG))
+			return 0;
+		if (in_group_p(inode->i_gid))
+			mode >>= 3;
+	}
+	if (!(mode & MAY_EXEC))
+		return 0;
+	if (security_inode_permission(inode, MAY_EXEC))
+		return 0;
+	return !read_seqcount_retry(&dentry->d_seq, seq);
+}
+
+/*
+ * Walk the leading components of a path without taking d_lock or a
+ * reference on each dentry.  Only cached, plain directories are crossed:
+ * "." and "..", mount points, symlinks, negative dentries, filesystems
+ * with dentry operations, permission methods and ACLs all end the walk,
+ * as does the last component.  Renames are caught by rename_lock and
+ * a dentry losing its inode by its d_seq; the dentry reached is pinned
+ * only once both check out.
+ *
+ * Returns what is left of @name for __link_path_walk(), with nd->path
+ * moved to the dentry it starts from.  If nothing could be crossed,
+ * @name and nd->path are left as they were.
+ */
+static const char *rcu_walk_prefix(const char *name, struct nameidata *nd)
+{
+	struct dentry *parent = nd->path.dentry;
+	struct dentry *dentry = parent;
+	const char *rest = name;
+	unsigned seq, dseq;
+	int ok;
+
+	rcu_read_lock();
+	seq = read_seqbegin(&rename_lock);
+	dseq = read_seqcount_begin(&dentry->d_seq);
+	for (;;) {
+		const struct inode_operations *iop;
+		struct dentry *child;
+		struct inode *inode;
+		unsigned long hash;
+		struct qstr this;
+		unsigned int c;
+		unsigned cseq;
+		umode_t mode;
+		const char *p = rest;
+
+		this.name = p;
+		c = *(const unsigned char *)p;
+		hash = init_name_hash();
+		do {
+			p++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)p;
+		} while (c && (c != '/'));
+		this.len = p - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		if (!c)
+			break;
+		while (*++p == '/');
+		if (!*p)
+			break;
+		if (this.name[0] == '.' &&
+		    (this.len == 1 || (this.len == 2 && this.name[1] == '.')))
+			break;
+
+		if (dentry->d_op || !rcu_may_exec(dentry, dseq))
+			break;
+		child = __d_lookup_rcu(dentry, &this);
+		if (!child)
+			break;
+		cseq = read_seqcount_begin(&child->d_seq);
+		if (child->d_op || d_mountpoint(child))
+			break;
+		inode = child->d_inode;
+		if (!inode)
+			break;
+		mode = inode->i_mode;
+		iop = inode->i_op;
+		if (read_seqcount_retry(&child->d_seq, cseq))
+			break;
+		if (!S_ISDIR(mode) || iop->follow_link || !iop->lookup)
+			break;
+
+		dentry = child;
+		dseq = cseq;
+		rest = p;
+	}
+
+	if (dentry == parent) {
+		rcu_read_unlock();
+		return name;
+	}
+
+	spin_lock(&dentry->d_lock);
+	ok = !d_unhashed(dentry) &&
+	     !read_seqcount_retry(&dentry->d_seq, dseq) &&
+	     !read_seqretry(&rename_lock, seq);
+	if (ok)
+		atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
+	rcu_read_unlock();
+
+	if (!ok)
+		return name;
+	nd->path.dentry = dentry;
+	dput(parent);
+	return rest;
+}
+
 /*
  * Name resolution.
  * This is the basic name resolution function, turning a pathname into
@@ -859,6 +989,7 @@ static int __link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		goto return_reval;
 
+	name = rcu_walk_prefix(name, nd);
 	inode = nd->path.dentry->d_inode;
 	if (nd->depth)
 		lookup_flags = LOOKUP_FOLLOW | (nd->flags & LOOKUP_CONTINUE);
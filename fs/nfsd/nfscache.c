@@ -1,8 +1,8 @@
 /*
  * linux/fs/nfsd/nfscache.c
  *
- * Request reply cache. This is currently a global cache, but this may
- * change in the future and be a per-client cache.
+ * Request reply cache. This is currently a global cache, hashed on the
+ * XID, but this may change in the future and be a per-client cache.
  *
  * This code is heavily inspired by the 44BSD implementation, although
  * it does things a bit differently.
@@ -16,64 +16,110 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/highmem.h>
 
 #include <linux/sunrpc/svc.h>
 #include <linux/nfsd/nfsd.h>
 #include <linux/nfsd/cache.h>
 
-/* Size of reply cache. Common values are:
- * 4.3BSD:	128
- * 4.4BSD:	256
- * Solaris2:	1024
- * DEC Unix:	512-4096
- */
-#define CACHESIZE		1024
-#define HASHSIZE		64
-
-static struct hlist_head *	cache_hash;
-static struct list_head 	lru_head;
-static int			cache_disabled = 1;
-
 /*
- * Calculate the hash index from an XID.
+ * The reply cache is split into hash buckets, each with its own lock
+ * and LRU list, so that nfsd threads working on different XIDs do not
+ * serialise on a single lock. Entries are allocated on demand as the
+ * client load requires and are freed again once they have expired, up
+ * to a per-bucket limit. The total limit scales with the square root
+ * of the amount of low memory, so that a small machine uses roughly
+ * the classic 1024 entries while a large filer can keep enough
+ * replies around for thousands of clients.
  */
-static inline u32 request_hash(u32 xid)
-{
-	u32 h = xid;
-	h ^= (xid >> 24);
-	return h & (HASHSIZE-1);
-}
+#define TARGET_BUCKET_SIZE	32
+#define MIN_CACHESIZE		1024
+#define MAX_CACHESIZE		(256 * 1024)
+
+/* Entries older than this are never considered a match and can be freed */
+#define RC_EXPIRE		(120 * HZ)
+
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+	unsigned int		num_entries;
+};
+
+static struct kmem_cache	*drc_slab;
+static struct nfsd_drc_bucket	*drc_hashtbl;
+static unsigned int		drc_hashbits;
+static unsigned int		drc_bucket_max;
+static int			cache_disabled = 1;
 
 static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
 
 /*
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, when accessing _prev or _next, the lock of the bucket the
+ * entry's XID hashes to must be held.
  */
-static DEFINE_SPINLOCK(cache_lock);
 
-int nfsd_reply_cache_init(void)
+static unsigned int nfsd_cache_size_limit(void)
+{
+	unsigned int limit;
+	unsigned long low_pages = totalram_pages - totalhigh_pages;
+
+	limit = (16 * int_sqrt(low_pages)) << (PAGE_SHIFT - 10);
+	return clamp_t(unsigned int, limit, MIN_CACHESIZE, MAX_CACHESIZE);
+}
+
+static struct nfsd_drc_bucket *nfsd_cache_bucket_find(__be32 xid)
+{
+	return &drc_hashtbl[hash_32(be32_to_cpu(xid), drc_hashbits)];
+}
+
+static struct svc_cacherep *nfsd_reply_cache_alloc(void)
 {
 	struct svc_cacherep	*rp;
-	int			i;
-
-	INIT_LIST_HEAD(&lru_head);
-	i = CACHESIZE;
-	while (i) {
-		rp = kmalloc(sizeof(*rp), GFP_KERNEL);
-		if (!rp)
-			goto out_nomem;
-		list_add(&rp->c_lru, &lru_head);
+
+	rp = kmem_cache_alloc(drc_slab, GFP_KERNEL);
+	if (rp) {
 		rp->c_state = RC_UNUSED;
 		rp->c_type = RC_NOCACHE;
-		INIT_HLIST_NODE(&rp->c_hash);
-		i--;
+		INIT_LIST_HEAD(&rp->c_lru);
 	}
+	return rp;
+}
 
-	cache_hash = kcalloc (HASHSIZE, sizeof(struct hlist_head), GFP_KERNEL);
-	if (!cache_hash)
+static void nfsd_reply_cache_free_locked(struct nfsd_drc_bucket *b,
+					 struct svc_cacherep *rp)
+{
+	if (rp->c_type == RC_REPLBUFF)
+		kfree(rp->c_replvec.iov_base);
+	list_del(&rp->c_lru);
+	b->num_entries--;
+	kmem_cache_free(drc_slab, rp);
+}
+
+int nfsd_reply_cache_init(void)
+{
+	unsigned int		i, nbuckets;
+
+	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
+				     0, 0, NULL);
+	if (!drc_slab)
+		goto out_nomem;
+
+	nbuckets = roundup_pow_of_two(nfsd_cache_size_limit() /
+				      TARGET_BUCKET_SIZE);
+	drc_hashbits = ilog2(nbuckets);
+	drc_bucket_max = TARGET_BUCKET_SIZE;
+
+	drc_hashtbl = kcalloc(nbuckets, sizeof(*drc_hashtbl), GFP_KERNEL);
+	if (!drc_hashtbl)
 		goto out_nomem;
+	for (i = 0; i < nbuckets; i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
+	}
 
 	cache_disabled = 0;
 	return 0;
@@ -85,56 +131,93 @@ out_nomem:
 
 void nfsd_reply_cache_shutdown(void)
 {
+	struct nfsd_drc_bucket	*b;
 	struct svc_cacherep	*rp;
-
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
-			kfree(rp->c_replvec.iov_base);
-		list_del(&rp->c_lru);
-		kfree(rp);
-	}
+	unsigned int		i;
 
 	cache_disabled = 1;
 
-	kfree (cache_hash);
-	cache_hash = NULL;
+	if (drc_hashtbl) {
+		for (i = 0; i < (1U << drc_hashbits); i++) {
+			b = &drc_hashtbl[i];
+			while (!list_empty(&b->lru_head)) {
+				rp = list_entry(b->lru_head.next,
+						struct svc_cacherep, c_lru);
+				nfsd_reply_cache_free_locked(b, rp);
+			}
+		}
+		kfree(drc_hashtbl);
+		drc_hashtbl = NULL;
+	}
+
+	if (drc_slab) {
+		kmem_cache_destroy(drc_slab);
+		drc_slab = NULL;
+	}
 }
 
 /*
  * Move cache entry to end of LRU list
  */
 static void
-lru_put_end(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
-	list_move_tail(&rp->c_lru, &lru_head);
+	list_move_tail(&rp->c_lru, &b->lru_head);
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Free entries that have expired from the front of the bucket's LRU
+ * list, so the cache shrinks again when the client load goes away.
  */
 static void
-hash_refile(struct svc_cacherep *rp)
+prune_bucket(struct nfsd_drc_bucket *b)
 {
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, cache_hash + request_hash(rp->c_xid));
+	struct svc_cacherep	*rp, *tmp;
+
+	list_for_each_entry_safe(rp, tmp, &b->lru_head, c_lru) {
+		if (rp->c_state == RC_INPROG)
+			continue;
+		if (time_before(jiffies, rp->c_timestamp + RC_EXPIRE))
+			break;
+		nfsd_reply_cache_free_locked(b, rp);
+	}
 }
 
 /*
- * Try to find an entry matching the current call in the cache. When none
- * is found, we grab the oldest unlocked entry off the LRU list.
- * Note that no operation within the loop may sleep.
+ * Search a bucket for an entry matching the current call.
  */
-int
-nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
+static struct svc_cacherep *
+nfsd_cache_search(struct nfsd_drc_bucket *b, struct svc_rqst *rqstp)
 {
-	struct hlist_node	*hn;
-	struct hlist_head 	*rh;
 	struct svc_cacherep	*rp;
 	__be32			xid = rqstp->rq_xid;
 	u32			proto =  rqstp->rq_prot,
 				vers = rqstp->rq_vers,
 				proc = rqstp->rq_proc;
+
+	list_for_each_entry(rp, &b->lru_head, c_lru) {
+		if (rp->c_state != RC_UNUSED &&
+		    xid == rp->c_xid && proc == rp->c_proc &&
+		    proto == rp->c_prot && vers == rp->c_vers &&
+		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE) &&
+		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, sizeof(rp->c_addr))==0)
+			return rp;
+	}
+	return NULL;
+}
+
+/*
+ * Try to find an entry matching the current call in the cache. When none
+ * is found, we allocate a new entry if the bucket is below its limit, or
+ * else grab the oldest unlocked entry off the bucket's LRU list.
+ * Note that no operation within the loop may sleep.
+ */
+int
+nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
+{
+	struct nfsd_drc_bucket	*b;
+	struct svc_cacherep	*rp, *new = NULL;
+	__be32			xid = rqstp->rq_xid;
 	unsigned long		age;
 	int rtn;
 
@@ -144,58 +227,61 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 		return RC_DOIT;
 	}
 
-	spin_lock(&cache_lock);
+	b = nfsd_cache_bucket_find(xid);
+	spin_lock(&b->cache_lock);
 	rtn = RC_DOIT;
 
-	rh = &cache_hash[request_hash(xid)];
-	hlist_for_each_entry(rp, hn, rh, c_hash) {
-		if (rp->c_state != RC_UNUSED &&
-		    xid == rp->c_xid && proc == rp->c_proc &&
-		    proto == rp->c_prot && vers == rp->c_vers &&
-		    time_before(jiffies, rp->c_timestamp + 120*HZ) &&
-		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, sizeof(rp->c_addr))==0) {
-			nfsdstats.rchits++;
+	rp = nfsd_cache_search(b, rqstp);
+	if (rp)
+		goto found_entry;
+
+	prune_bucket(b);
+	if (b->num_entries < drc_bucket_max) {
+		/* Grow the bucket; allocation may sleep, so drop the lock */
+		spin_unlock(&b->cache_lock);
+		new = nfsd_reply_cache_alloc();
+		spin_lock(&b->cache_lock);
+
+		/* Someone may have added the same call while we slept */
+		rp = nfsd_cache_search(b, rqstp);
+		if (rp) {
+			if (new)
+				kmem_cache_free(drc_slab, new);
 			goto found_entry;
 		}
 	}
 	nfsdstats.rcmisses++;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	list_for_each_entry(rp, &lru_head, c_lru) {
-		if (rp->c_state != RC_INPROG)
-			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
-			goto out;
+	if (new) {
+		rp = new;
+		list_add(&rp->c_lru, &b->lru_head);
+		b->num_entries++;
+	} else {
+		/* Recycle the least recently used entry not in progress */
+		list_for_each_entry(rp, &b->lru_head, c_lru) {
+			if (rp->c_state != RC_INPROG)
+				break;
 		}
-	}
-	}
-
-	/* All entries on the LRU are in-progress. This should not happen */
-	if (&rp->c_lru == &lru_head) {
-		static int	complaints;
 
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
+		/* All entries in the bucket are in-progress */
+		if (&rp->c_lru == &b->lru_head) {
+			if (printk_ratelimit())
+				printk(KERN_WARNING
+				       "nfsd: all repcache entries locked!\n");
+			goto out;
 		}
-		goto out;
 	}
 
 	rqstp->rq_cacherep = rp;
 	rp->c_state = RC_INPROG;
 	rp->c_xid = xid;
-	rp->c_proc = proc;
+	rp->c_proc = rqstp->rq_proc;
 	memcpy(&rp->c_addr, svc_addr_in(rqstp), sizeof(rp->c_addr));
-	rp->c_prot = proto;
-	rp->c_vers = vers;
+	rp->c_prot = rqstp->rq_prot;
+	rp->c_vers = rqstp->rq_vers;
 	rp->c_timestamp = jiffies;
 
-	hash_refile(rp);
+	lru_put_end(b, rp);
 
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
@@ -204,14 +290,15 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	}
 	rp->c_type = RC_NOCACHE;
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return rtn;
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
+	nfsdstats.rchits++;
 	age = jiffies - rp->c_timestamp;
 	rp->c_timestamp = jiffies;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -264,12 +351,14 @@ found_entry:
 void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 {
+	struct nfsd_drc_bucket *b;
 	struct svc_cacherep *rp;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
 	int		len;
 
 	if (!(rp = rqstp->rq_cacherep) || cache_disabled)
 		return;
+	b = nfsd_cache_bucket_find(rp->c_xid);
 
 	len = resv->iov_len - ((char*)statp - (char*)resv->iov_base);
 	len >>= 2;
@@ -290,22 +379,22 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 		cachv = &rp->c_replvec;
 		cachv->iov_base = kmalloc(len << 2, GFP_KERNEL);
 		if (!cachv->iov_base) {
-			spin_lock(&cache_lock);
+			spin_lock(&b->cache_lock);
 			rp->c_state = RC_UNUSED;
-			spin_unlock(&cache_lock);
+			spin_unlock(&b->cache_lock);
 			return;
 		}
 		cachv->iov_len = len << 2;
 		memcpy(cachv->iov_base, statp, len << 2);
 		break;
 	}
-	spin_lock(&cache_lock);
-	lru_put_end(rp);
+	spin_lock(&b->cache_lock);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
 	rp->c_timestamp = jiffies;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
@@ -0,0 +1,117 @@
+#include <linux/fanotify.h>
+#include <linux/fsnotify_backend.h>
+#include <linux/init.h>
+#include <linux/mount.h>
+#include <linux/types.h>
+
+#include "fanotify.h"
+
+/*
+ * How far back from the tail of the notification queue we look for an event
+ * to merge a new one into.  Bounds the cost of queueing an event when a
+ * listener has fallen behind on a busy filesystem.
+ */
+#define FANOTIFY_MERGE_DEPTH	128
+
+static bool should_merge(struct fsnotify_event *old, struct fsnotify_event *new)
+{
+	/*
+	 * Only merge into an event nobody but our queue holds a reference to,
+	 * anyone else might be looking at its mask.
+	 */
+	if (atomic_read(&old->refcnt) != 1)
+		return false;
+
+	return old->data_type == FSNOTIFY_EVENT_PATH &&
+	       old->path.mnt == new->path.mnt &&
+	       old->path.dentry == new->path.dentry &&
+	       old->tgid == new->tgid;
+}
+
+/*
+ * Coalesce the new event into a still queued one for the same object and
+ * process, so a process hammering a file shows up once per read() rather
+ * than once per write().  Called with the notification_mutex held.
+ */
+static bool fanotify_merge(struct fsnotify_group *group,
+			   struct fsnotify_event *event)
+{
+	struct fsnotify_event_holder *holder;
+	int depth = 0;
+
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+
+	list_for_each_entry_reverse(holder, &group->notification_list,
+				    event_list) {
+		if (++depth > FANOTIFY_MERGE_DEPTH)
+			break;
+		if (should_merge(holder->event, event)) {
+			holder->event->mask |= event->mask;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int fanotify_handle_event(struct fsnotify_group *group, struct fsnotify_event *event)
+{
+	bool merged;
+	int ret;
+
+	BUILD_BUG_ON(FAN_ACCESS != FS_ACCESS);
+	BUILD_BUG_ON(FAN_MODIFY != FS_MODIFY);
+	BUILD_BUG_ON(FAN_CLOSE_NOWRITE != FS_CLOSE_NOWRITE);
+	BUILD_BUG_ON(FAN_CLOSE_WRITE != FS_CLOSE_WRITE);
+	BUILD_BUG_ON(FAN_OPEN != FS_OPEN);
+	BUILD_BUG_ON(FAN_Q_OVERFLOW != FS_Q_OVERFLOW);
+	BUILD_BUG_ON(FAN_ONDIR != FS_IN_ISDIR);
+
+	mutex_lock(&group->notification_mutex);
+	merged = fanotify_merge(group, event);
+	mutex_unlock(&group->notification_mutex);
+	if (merged)
+		return 0;
+
+	ret = fsnotify_add_notify_event(group, event, NULL);
+	/* -EEXIST means this event was merged with another, not that it was an error */
+	if (ret == -EEXIST)
+		ret = 0;
+
+	return ret;
+}
+
+static bool fanotify_should_send_event(struct fsnotify_group *group, struct inode *to_tell,
+				       struct vfsmount *mnt, __u32 mask)
+{
+	struct fsnotify_fs_mark *mark;
+	__u32 marks_mask = 0;
+
+	/* only events which carry a path can be reported with an fd */
+	if (!mnt)
+		return false;
+
+	/* we have no inode marks, the child reports these events itself */
+	if (mask & FS_EVENT_ON_CHILD)
+		return false;
+
+	mark = fsnotify_find_fs_mark(group, mnt, FSNOTIFY_MARK_MOUNT);
+	if (mark)
+		marks_mask |= mark->mask;
+	mark = fsnotify_find_fs_mark(group, to_tell->i_sb, FSNOTIFY_MARK_SB);
+	if (mark)
+		marks_mask |= mark->mask;
+
+	/* directories are only reported to those who asked for them */
+	if ((mask & FS_IN_ISDIR) && !(marks_mask & FS_IN_ISDIR))
+		return false;
+
+	return marks_mask & mask & FAN_ALL_EVENTS;
+}
+
+const struct fsnotify_ops fanotify_fsnotify_ops = {
+	.handle_event = fanotify_handle_event,
+	.should_send_event = fanotify_should_send_event,
+	.free_group_priv = NULL,
+	.free_event_priv = NULL,
+	.freeing_mark = NULL,
+};
@@ -0,0 +1,4 @@
+#include <linux/fanotify.h>
+#include <linux/fsnotify_backend.h>
+
+extern const struct fsnotify_ops fanotify_fsnotify_ops;
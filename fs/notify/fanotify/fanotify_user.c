@@ -0,0 +1,395 @@
+#include <linux/fanotify.h>
+#include <linux/fcntl.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/fsnotify_backend.h>
+#include <linux/init.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/poll.h>
+#include <linux/security.h>
+#include <linux/syscalls.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+
+#include <asm/ioctls.h>
+
+#include "fanotify.h"
+
+#define FANOTIFY_DEFAULT_MAX_EVENTS	16384
+
+/* open flags userspace may ask event fds to be opened with */
+#define FANOTIFY_EVENT_F_FLAGS	(O_ACCMODE | O_LARGEFILE | O_NONBLOCK | \
+				 O_NOATIME | O_CLOEXEC)
+
+static const struct file_operations fanotify_fops;
+
+/*
+ * When fanotify registers a new group it increments this and uses that
+ * value as an offset to set the fsnotify group "name".
+ */
+static atomic_t fanotify_grp_num;
+
+/*
+ * Get an fsnotify notification event if one exists and is small
+ * enough to fit in "count". Return an error pointer if the count
+ * is not large enough.
+ *
+ * Called with the group->notification_mutex held.
+ */
+static struct fsnotify_event *get_one_event(struct fsnotify_group *group,
+					    size_t count)
+{
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+
+	if (fsnotify_notify_queue_is_empty(group))
+		return NULL;
+
+	if (FAN_EVENT_METADATA_LEN > count)
+		return ERR_PTR(-EINVAL);
+
+	/* held the notification_mutex the whole time, so this is the
+	 * same event we peeked above */
+	return fsnotify_remove_notify_event(group);
+}
+
+/*
+ * Open a new file for the object of the event, which userspace gets as the
+ * fd of the event.  The file must not generate events of its own, or reading
+ * and closing it would feed more events back to the listener.
+ */
+static int create_fd(struct fsnotify_group *group, struct fsnotify_event *event,
+		     struct file **filep)
+{
+	struct file *new_file;
+	int client_fd;
+
+	client_fd = get_unused_fd_flags(group->fanotify_data.f_flags & O_CLOEXEC);
+	if (client_fd < 0)
+		return client_fd;
+
+	/* dentry_open() drops these references if it fails */
+	new_file = dentry_open(dget(event->path.dentry), mntget(event->path.mnt),
+			       group->fanotify_data.f_flags & ~O_CLOEXEC,
+			       current_cred());
+	if (IS_ERR(new_file)) {
+		put_unused_fd(client_fd);
+		return PTR_ERR(new_file);
+	}
+	new_file->f_mode |= FMODE_NONOTIFY;
+
+	*filep = new_file;
+	return client_fd;
+}
+
+/*
+ * Copy an event to user space, returning how much we copied.  The fd is only
+ * installed once the metadata made it to userspace.
+ */
+static ssize_t copy_event_to_user(struct fsnotify_group *group,
+				  struct fsnotify_event *event,
+				  char __user *buf)
+{
+	struct fanotify_event_metadata metadata;
+	struct file *f = NULL;
+	int fd = FAN_NOFD;
+
+	metadata.event_len = FAN_EVENT_METADATA_LEN;
+	metadata.metadata_len = FAN_EVENT_METADATA_LEN;
+	metadata.vers = FANOTIFY_METADATA_VERSION;
+	metadata.reserved = 0;
+	metadata.mask = event->mask & (FAN_ALL_OUTGOING_EVENTS | FAN_ONDIR);
+	metadata.pid = event->tgid ? pid_vnr(event->tgid) : 0;
+
+	if (event->data_type == FSNOTIFY_EVENT_PATH) {
+		fd = create_fd(group, event, &f);
+		if (fd < 0)
+			return fd;
+	}
+	metadata.fd = fd;
+
+	if (copy_to_user(buf, &metadata, FAN_EVENT_METADATA_LEN)) {
+		if (f) {
+			put_unused_fd(fd);
+			fput(f);
+		}
+		return -EFAULT;
+	}
+
+	if (f)
+		fd_install(fd, f);
+
+	return FAN_EVENT_METADATA_LEN;
+}
+
+/* fanotify userspace file descriptor functions */
+static unsigned int fanotify_poll(struct file *file, poll_table *wait)
+{
+	struct fsnotify_group *group = file->private_data;
+	int ret = 0;
+
+	poll_wait(file, &group->notification_waitq, wait);
+	mutex_lock(&group->notification_mutex);
+	if (!fsnotify_notify_queue_is_empty(group))
+		ret = POLLIN | POLLRDNORM;
+	mutex_unlock(&group->notification_mutex);
+
+	return ret;
+}
+
+static ssize_t fanotify_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *pos)
+{
+	struct fsnotify_group *group;
+	struct fsnotify_event *kevent;
+	char __user *start;
+	int ret;
+	DEFINE_WAIT(wait);
+
+	start = buf;
+	group = file->private_data;
+
+	while (1) {
+		prepare_to_wait(&group->notification_waitq, &wait, TASK_INTERRUPTIBLE);
+
+		mutex_lock(&group->notification_mutex);
+		kevent = get_one_event(group, count);
+		mutex_unlock(&group->notification_mutex);
+
+		if (kevent) {
+			ret = PTR_ERR(kevent);
+			if (IS_ERR(kevent))
+				break;
+			ret = copy_event_to_user(group, kevent, buf);
+			fsnotify_put_event(kevent);
+			if (ret < 0)
+				break;
+			buf += ret;
+			count -= ret;
+			continue;
+		}
+
+		ret = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			break;
+		ret = -EINTR;
+		if (signal_pending(current))
+			break;
+
+		if (start != buf)
+			break;
+
+		schedule();
+	}
+
+	finish_wait(&group->notification_waitq, &wait);
+	if (start != buf && ret != -EFAULT)
+		ret = buf - start;
+	return ret;
+}
+
+static int fanotify_release(struct inode *ignored, struct file *file)
+{
+	struct fsnotify_group *group = file->private_data;
+
+	/* matches the fanotify_init->fsnotify_obtain_group */
+	fsnotify_put_group(group);
+
+	return 0;
+}
+
+static long fanotify_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct fsnotify_group *group;
+	void __user *p;
+	int ret = -ENOTTY;
+	size_t send_len = 0;
+
+	group = file->private_data;
+	p = (void __user *) arg;
+
+	switch (cmd) {
+	case FIONREAD:
+		mutex_lock(&group->notification_mutex);
+		send_len = group->q_len * FAN_EVENT_METADATA_LEN;
+		mutex_unlock(&group->notification_mutex);
+		ret = put_user(send_len, (int __user *) p);
+		break;
+	}
+
+	return ret;
+}
+
+static const struct file_operations fanotify_fops = {
+	.poll		= fanotify_poll,
+	.read		= fanotify_read,
+	.release	= fanotify_release,
+	.unlocked_ioctl	= fanotify_ioctl,
+	.compat_ioctl	= fanotify_ioctl,
+};
+
+static int fanotify_find_path(int dfd, const char __user *filename,
+			      struct path *path, unsigned int flags)
+{
+	int ret;
+
+	if (filename == NULL) {
+		struct file *file;
+		int fput_needed;
+
+		ret = -EBADF;
+		file = fget_light(dfd, &fput_needed);
+		if (!file)
+			goto out;
+
+		ret = -ENOTDIR;
+		if ((flags & FAN_MARK_ONLYDIR) &&
+		    !(S_ISDIR(file->f_path.dentry->d_inode->i_mode))) {
+			fput_light(file, fput_needed);
+			goto out;
+		}
+
+		*path = file->f_path;
+		path_get(path);
+		fput_light(file, fput_needed);
+	} else {
+		unsigned int lookup_flags = 0;
+
+		if (!(flags & FAN_MARK_DONT_FOLLOW))
+			lookup_flags |= LOOKUP_FOLLOW;
+		if (flags & FAN_MARK_ONLYDIR)
+			lookup_flags |= LOOKUP_DIRECTORY;
+
+		ret = user_path_at(dfd, filename, lookup_flags, path);
+		if (ret)
+			goto out;
+	}
+
+	/* you can only watch an inode if you have read permissions on it */
+	ret = inode_permission(path->dentry->d_inode, MAY_READ);
+	if (ret)
+		path_put(path);
+out:
+	return ret;
+}
+
+/* fanotify syscalls */
+SYSCALL_DEFINE2(fanotify_init, unsigned int, flags, unsigned int, event_f_flags)
+{
+	struct fsnotify_group *group;
+	unsigned int grp_num;
+	int f_flags, fd;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (flags & ~FAN_ALL_INIT_FLAGS)
+		return -EINVAL;
+
+	if (event_f_flags & ~FANOTIFY_EVENT_F_FLAGS)
+		return -EINVAL;
+
+	f_flags = O_RDWR;
+	if (flags & FAN_CLOEXEC)
+		f_flags |= O_CLOEXEC;
+	if (flags & FAN_NONBLOCK)
+		f_flags |= O_NONBLOCK;
+
+	/* fsnotify_obtain_group took a reference to group, we put this when we kill the file in the end */
+	grp_num = (FANOTIFY_GROUP_NUM - atomic_inc_return(&fanotify_grp_num));
+	group = fsnotify_obtain_group(grp_num, 0, &fanotify_fsnotify_ops);
+	if (IS_ERR(group))
+		return PTR_ERR(group);
+
+	group->fanotify_data.f_flags = event_f_flags;
+	if (flags & FAN_UNLIMITED_QUEUE)
+		group->max_events = UINT_MAX;
+	else
+		group->max_events = FANOTIFY_DEFAULT_MAX_EVENTS;
+
+	fd = anon_inode_getfd("[fanotify]", &fanotify_fops, group, f_flags);
+	if (fd < 0)
+		fsnotify_put_group(group);
+
+	return fd;
+}
+
+SYSCALL_DEFINE5(fanotify_mark, int, fanotify_fd, unsigned int, flags,
+		__u64, mask, int, dfd, const char  __user *, pathname)
+{
+	struct fsnotify_group *group;
+	struct file *filp;
+	struct path path;
+	void *obj;
+	int type, ret, fput_needed;
+
+	if (flags & ~FAN_ALL_MARK_FLAGS)
+		return -EINVAL;
+
+	switch (flags & (FAN_MARK_ADD | FAN_MARK_REMOVE | FAN_MARK_FLUSH)) {
+	case FAN_MARK_ADD:
+	case FAN_MARK_REMOVE:
+		if (!mask)
+			return -EINVAL;
+		break;
+	case FAN_MARK_FLUSH:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (mask & ~(u64)(FAN_ALL_EVENTS | FAN_ONDIR))
+		return -EINVAL;
+
+	/*
+	 * Only whole mount and filesystem marks are supported, per-inode
+	 * watches are what inotify is for.
+	 */
+	switch (flags & (FAN_MARK_MOUNT | FAN_MARK_FILESYSTEM)) {
+	case FAN_MARK_MOUNT:
+		type = FSNOTIFY_MARK_MOUNT;
+		break;
+	case FAN_MARK_FILESYSTEM:
+		type = FSNOTIFY_MARK_SB;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	filp = fget_light(fanotify_fd, &fput_needed);
+	if (unlikely(!filp))
+		return -EBADF;
+
+	/* verify that this is indeed an fanotify instance */
+	ret = -EINVAL;
+	if (unlikely(filp->f_op != &fanotify_fops))
+		goto fput_and_out;
+	group = filp->private_data;
+
+	if (flags & FAN_MARK_FLUSH) {
+		fsnotify_clear_fs_marks_by_group(group, type);
+		ret = 0;
+		goto fput_and_out;
+	}
+
+	ret = fanotify_find_path(dfd, pathname, &path, flags);
+	if (ret)
+		goto fput_and_out;
+
+	/* the path reference keeps both the mount and its sb alive */
+	if (type == FSNOTIFY_MARK_MOUNT)
+		obj = path.mnt;
+	else
+		obj = path.dentry->d_sb;
+
+	if (flags & FAN_MARK_ADD)
+		ret = fsnotify_add_fs_mark(group, obj, type, mask);
+	else
+		ret = fsnotify_remove_fs_mark(group, obj, type, mask);
+
+	path_put(&path);
+fput_and_out:
+	fput_light(filp, fput_needed);
+	return ret;
+}
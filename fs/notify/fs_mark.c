@@ -0,0 +1,268 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * vfsmount and super_block marks.
+ *
+ * Inode marks (inode_mark.c) scale with the number of watched objects, so a
+ * listener interested in a whole tree has to place one on every directory.
+ * A mark attached to a vfsmount or super_block instead matches every event
+ * which happens on that mount or filesystem.
+ *
+ * There are only ever a handful of these marks, so all lists are protected
+ * by the single fs_mark_lock.  The per object lists are walked without the
+ * lock under fsnotify_grp_srcu when events are sent, so marks are unlinked
+ * with the _rcu list primitives and freed after synchronize_srcu().
+ *
+ * A mark does not pin its object.  Instead the vfsmount and super_block
+ * teardown paths call in here to free any marks still attached.  Those paths
+ * do not touch the group: its mask is left as it was, which at worst means
+ * the group is asked about events it no longer has a mark for.
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mount.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/srcu.h>
+
+#include <linux/fsnotify_backend.h>
+#include "fsnotify.h"
+
+static DEFINE_SPINLOCK(fs_mark_lock);
+
+static struct hlist_head *fs_mark_obj_list(void *obj, int type, __u32 **maskp)
+{
+	if (type == FSNOTIFY_MARK_MOUNT) {
+		struct vfsmount *mnt = obj;
+
+		*maskp = &mnt->mnt_fsnotify_mask;
+		return &mnt->mnt_fsnotify_marks;
+	} else {
+		struct super_block *sb = obj;
+
+		BUG_ON(type != FSNOTIFY_MARK_SB);
+		*maskp = &sb->s_fsnotify_mask;
+		return &sb->s_fsnotify_marks;
+	}
+}
+
+/*
+ * Recalculate the mask of events any mark on this object is interested in.
+ * Called with fs_mark_lock held.
+ */
+static void fs_mark_recalc_obj_mask(void *obj, int type)
+{
+	struct fsnotify_fs_mark *mark;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+	__u32 *maskp;
+	__u32 mask = 0;
+
+	assert_spin_locked(&fs_mark_lock);
+
+	head = fs_mark_obj_list(obj, type, &maskp);
+	hlist_for_each_entry(mark, pos, head, o_list)
+		mask |= mark->mask;
+	*maskp = mask;
+}
+
+__u32 fsnotify_fs_marks_mask(struct fsnotify_group *group)
+{
+	struct fsnotify_fs_mark *mark;
+	__u32 mask = 0;
+
+	spin_lock(&fs_mark_lock);
+	list_for_each_entry(mark, &group->fs_marks, g_list)
+		mask |= mark->mask;
+	spin_unlock(&fs_mark_lock);
+
+	return mask;
+}
+
+/*
+ * Find the mark of group on obj.  Either fs_mark_lock or fsnotify_grp_srcu
+ * must be held.
+ */
+struct fsnotify_fs_mark *fsnotify_find_fs_mark(struct fsnotify_group *group,
+					       void *obj, int type)
+{
+	struct fsnotify_fs_mark *mark;
+	struct hlist_node *pos;
+	struct hlist_head *head;
+	__u32 *maskp;
+
+	head = fs_mark_obj_list(obj, type, &maskp);
+	hlist_for_each_entry_rcu(mark, pos, head, o_list) {
+		if (mark->group == group)
+			return mark;
+	}
+	return NULL;
+}
+
+/*
+ * Add mask to the mark of group on obj, creating the mark if there is none
+ * yet.  The caller must hold a reference which keeps obj alive.
+ */
+int fsnotify_add_fs_mark(struct fsnotify_group *group, void *obj, int type,
+			 __u32 mask)
+{
+	struct fsnotify_fs_mark *mark, *new;
+	struct hlist_head *head;
+	__u32 *maskp;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock(&fs_mark_lock);
+	mark = fsnotify_find_fs_mark(group, obj, type);
+	if (mark) {
+		mark->mask |= mask;
+	} else {
+		new->mask = mask;
+		new->type = type;
+		new->obj = obj;
+		new->group = group;
+		head = fs_mark_obj_list(obj, type, &maskp);
+		hlist_add_head_rcu(&new->o_list, head);
+		list_add(&new->g_list, &group->fs_marks);
+		new = NULL;
+	}
+	fs_mark_recalc_obj_mask(obj, type);
+	spin_unlock(&fs_mark_lock);
+
+	kfree(new);
+
+	fsnotify_recalc_group_mask(group);
+	return 0;
+}
+
+/*
+ * Remove mask from the mark of group on obj, and free the mark if that
+ * leaves it without any events.
+ */
+int fsnotify_remove_fs_mark(struct fsnotify_group *group, void *obj, int type,
+			    __u32 mask)
+{
+	struct fsnotify_fs_mark *mark;
+
+	spin_lock(&fs_mark_lock);
+	mark = fsnotify_find_fs_mark(group, obj, type);
+	if (!mark) {
+		spin_unlock(&fs_mark_lock);
+		return -ENOENT;
+	}
+
+	mark->mask &= ~mask;
+	if (!mark->mask) {
+		hlist_del_rcu(&mark->o_list);
+		list_del(&mark->g_list);
+	} else {
+		mark = NULL;
+	}
+	fs_mark_recalc_obj_mask(obj, type);
+	spin_unlock(&fs_mark_lock);
+
+	if (mark) {
+		synchronize_srcu(&fsnotify_grp_srcu);
+		kfree(mark);
+	}
+
+	fsnotify_recalc_group_mask(group);
+	return 0;
+}
+
+static void fs_mark_free_list(struct list_head *free_list)
+{
+	struct fsnotify_fs_mark *mark, *next;
+
+	if (list_empty(free_list))
+		return;
+
+	/* nothing walking an object list may still see these marks */
+	synchronize_srcu(&fsnotify_grp_srcu);
+
+	list_for_each_entry_safe(mark, next, free_list, g_list) {
+		list_del(&mark->g_list);
+		kfree(mark);
+	}
+}
+
+void fsnotify_clear_fs_marks_by_group(struct fsnotify_group *group, int type)
+{
+	struct fsnotify_fs_mark *mark, *next;
+	LIST_HEAD(free_list);
+
+	spin_lock(&fs_mark_lock);
+	list_for_each_entry_safe(mark, next, &group->fs_marks, g_list) {
+		if (type && mark->type != type)
+			continue;
+		hlist_del_rcu(&mark->o_list);
+		list_move(&mark->g_list, &free_list);
+		fs_mark_recalc_obj_mask(mark->obj, mark->type);
+	}
+	spin_unlock(&fs_mark_lock);
+
+	fs_mark_free_list(&free_list);
+
+	fsnotify_recalc_group_mask(group);
+}
+
+static void fsnotify_clear_fs_marks_by_obj(void *obj, int type)
+{
+	struct fsnotify_fs_mark *mark;
+	struct hlist_node *pos, *n;
+	struct hlist_head *head;
+	LIST_HEAD(free_list);
+	__u32 *maskp;
+
+	head = fs_mark_obj_list(obj, type, &maskp);
+	/* unlocked peek: marks are only added by someone holding obj alive */
+	if (hlist_empty(head))
+		return;
+
+	spin_lock(&fs_mark_lock);
+	hlist_for_each_entry_safe(mark, pos, n, head, o_list) {
+		hlist_del_rcu(&mark->o_list);
+		list_move(&mark->g_list, &free_list);
+	}
+	*maskp = 0;
+	spin_unlock(&fs_mark_lock);
+
+	fs_mark_free_list(&free_list);
+}
+
+/*
+ * The last reference to a vfsmount is gone, free all marks on it.
+ */
+void fsnotify_vfsmount_delete(struct vfsmount *mnt)
+{
+	fsnotify_clear_fs_marks_by_obj(mnt, FSNOTIFY_MARK_MOUNT);
+}
+
+/*
+ * A super_block is being shut down, free all marks on it.
+ */
+void fsnotify_sb_delete(struct super_block *sb)
+{
+	fsnotify_clear_fs_marks_by_obj(sb, FSNOTIFY_MARK_SB);
+}
@@ -20,6 +20,7 @@
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/mount.h>
 #include <linux/srcu.h>
 
 #include <linux/fsnotify_backend.h>
@@ -136,6 +137,8 @@ void fsnotify(struct inode *to_tell, __u32 mask, void *data, int data_is, const
 {
 	struct fsnotify_group *group;
 	struct fsnotify_event *event = NULL;
+	struct vfsmount *mnt = NULL;
+	__u32 marks_mask;
 	int idx;
 	/* global tests shouldn't care about events on child only the specific event */
 	__u32 test_mask = (mask & ~FS_EVENT_ON_CHILD);
@@ -146,7 +149,22 @@ void fsnotify(struct inode *to_tell, __u32 mask, void *data, int data_is, const
 	if (!(test_mask & fsnotify_mask))
 		return;
 
-	if (!(test_mask & to_tell->i_fsnotify_mask))
+	if (data_is == FSNOTIFY_EVENT_FILE) {
+		struct file *file = data;
+
+		/* fanotify's own event fds must not generate more events */
+		if (file->f_mode & FMODE_NONOTIFY)
+			return;
+		mnt = file->f_path.mnt;
+	} else if (data_is == FSNOTIFY_EVENT_PATH) {
+		mnt = ((struct path *)data)->mnt;
+	}
+
+	/* does anything attached to the inode, its sb or its mount care? */
+	marks_mask = to_tell->i_fsnotify_mask | to_tell->i_sb->s_fsnotify_mask;
+	if (mnt)
+		marks_mask |= mnt->mnt_fsnotify_mask;
+	if (!(test_mask & marks_mask))
 		return;
 	/*
 	 * SRCU!!  the groups list is very very much read only and the path is
@@ -156,7 +174,7 @@ void fsnotify(struct inode *to_tell, __u32 mask, void *data, int data_is, const
 	idx = srcu_read_lock(&fsnotify_grp_srcu);
 	list_for_each_entry_rcu(group, &fsnotify_groups, group_list) {
 		if (test_mask & group->mask) {
-			if (!group->ops->should_send_event(group, to_tell, mask))
+			if (!group->ops->should_send_event(group, to_tell, mnt, mask))
 				continue;
 			if (!event) {
 				event = fsnotify_create_event(to_tell, mask, data,
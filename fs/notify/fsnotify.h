@@ -19,6 +19,9 @@ extern void fsnotify_flush_notify(struct fsnotify_group *group);
 /* final kfree of a group */
 extern void fsnotify_final_destroy_group(struct fsnotify_group *group);
 
+/* bitwise OR of the masks of all vfsmount and super_block marks of a group */
+extern __u32 fsnotify_fs_marks_mask(struct fsnotify_group *group);
+
 /* run the list of all marks associated with inode and flag them to be freed */
 extern void fsnotify_clear_marks_by_inode(struct inode *inode);
 /*
@@ -71,6 +71,8 @@ void fsnotify_recalc_group_mask(struct fsnotify_group *group)
 		mask |= entry->mask;
 	spin_unlock(&group->mark_lock);
 
+	mask |= fsnotify_fs_marks_mask(group);
+
 	group->mask = mask;
 
 	if (old_mask != mask)
@@ -112,6 +114,8 @@ static void fsnotify_destroy_group(struct fsnotify_group *group)
 {
 	/* clear all inode mark entries for this group */
 	fsnotify_clear_marks_by_group(group);
+	/* and all of its vfsmount and super_block marks */
+	fsnotify_clear_fs_marks_by_group(group, 0);
 
 	/* past the point of no return, matches the initial value of 1 */
 	if (atomic_dec_and_test(&group->num_marks))
@@ -226,6 +230,7 @@ struct fsnotify_group *fsnotify_obtain_group(unsigned int group_num, __u32 mask,
 	spin_lock_init(&group->mark_lock);
 	atomic_set(&group->num_marks, 0);
 	INIT_LIST_HEAD(&group->mark_entries);
+	INIT_LIST_HEAD(&group->fs_marks);
 
 	group->ops = ops;
 
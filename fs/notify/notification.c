@@ -40,6 +40,8 @@
 #include <linux/mutex.h>
 #include <linux/namei.h>
 #include <linux/path.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 
@@ -92,6 +94,7 @@ void fsnotify_put_event(struct fsnotify_event *event)
 
 		BUG_ON(!list_empty(&event->private_data_list));
 
+		put_pid(event->tgid);
 		kfree(event->file_name);
 		kmem_cache_free(fsnotify_event_cachep, event);
 	}
@@ -333,6 +336,7 @@ static void initialize_event(struct fsnotify_event *event)
 	event->name_len = 0;
 
 	event->sync_cookie = 0;
+	event->tgid = NULL;
 }
 
 /*
@@ -370,6 +374,7 @@ struct fsnotify_event *fsnotify_create_event(struct inode *to_tell, __u32 mask,
 
 	event->sync_cookie = cookie;
 	event->to_tell = to_tell;
+	event->tgid = get_pid(task_tgid(current));
 
 	switch (data_type) {
 	case FSNOTIFY_EVENT_FILE: {
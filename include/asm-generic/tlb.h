@@ -72,6 +72,11 @@ tlb_flush_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 		return;
 	tlb->need_flush = 0;
 	tlb_flush(tlb);
+	/*
+	 * In a lazy MMU section (free_pgd_range) the flush, and any page
+	 * table releases, may still be queued: issue them before freeing.
+	 */
+	arch_flush_lazy_mmu_mode();
 	if (!tlb_fast_mode(tlb)) {
 		free_pages_and_swap_cache(tlb->pages, tlb->nr);
 		tlb->nr = 0;
@@ -77,8 +77,9 @@ struct kioctx;
  *
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
- * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
+ * through generic helpers that queue kiocb->ki_wait on a wait queue head,
+ * as buffered reads do on the page they are waiting for; ki_wait.key then
+ * names the page bit, so that only its wakeups kick.  It can also happen
  * with custom tracking and manual calls to kick_iocb(), though that is
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
@@ -102,7 +103,7 @@ struct kiocb {
 	} ki_obj;
 
 	__u64			ki_user_data;	/* user's data for completion */
-	wait_queue_t		ki_wait;
+	struct wait_bit_queue	ki_wait;
 	loff_t			ki_pos;
 
 	void			*private;
@@ -140,11 +141,13 @@ struct kiocb {
 		(x)->ki_dtor = NULL;			\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
-		init_wait((&(x)->ki_wait));             \
+		init_wait((&(x)->ki_wait.wait));        \
+		(x)->ki_wait.key.flags = NULL;          \
 	} while (0)
 
 #define AIO_RING_MAGIC			0xa10a10a1
-#define AIO_RING_COMPAT_FEATURES	1
+#define AIO_RING_COMPAT_USER_REAP	2	/* see aio_read_evt() */
+#define AIO_RING_COMPAT_FEATURES	(1 | AIO_RING_COMPAT_USER_REAP)
 #define AIO_RING_INCOMPAT_FEATURES	0
 struct aio_ring {
 	unsigned	id;	/* kernel internal index number */
@@ -169,7 +172,6 @@ struct aio_ring_info {
 	unsigned long		mmap_size;
 
 	struct page		**ring_pages;
-	spinlock_t		ring_lock;
 	long			nr_pages;
 
 	unsigned		nr, tail;
@@ -223,7 +225,7 @@ struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 #endif /* CONFIG_AIO */
 
-#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait)
+#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait.wait)
 
 static inline struct kiocb *list_kiocb(struct list_head *h)
 {
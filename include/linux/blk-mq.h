@@ -0,0 +1,77 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_ctx;
+
+/*
+ * A hardware dispatch queue.  Requests are preallocated per hardware
+ * queue and identified by their tag, which is their index in ->rqs.
+ */
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* dispatch list, ->queue_rq */
+	struct list_head	dispatch;
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+
+	unsigned int		queue_depth;
+	struct request		*rqs;
+	unsigned long		*tags;		/* bitmap of busy ->rqs */
+	wait_queue_head_t	wait;		/* for a free tag or idle */
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef void (commit_rqs_fn)(struct blk_mq_hw_ctx *);
+
+struct blk_mq_ops {
+	/*
+	 * Hand a started request to the hardware.  Called with irqs off
+	 * and hctx->lock held, so the driver's own lock nests inside it.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Optional: called once after one or more ->queue_rq calls, to
+	 * notify the hardware of the whole batch.
+	 */
+	commit_rqs_fn		*commit_rqs;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* per hardware queue */
+	int			numa_node;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued to hardware */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue, queue is stopped */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end the request with -EIO */
+
+	BLK_MQ_S_STOPPED	= 0,
+};
+
+extern struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+
+extern void blk_mq_end_request(struct request *, int);
+extern void blk_mq_requeue_request(struct request *);
+
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+extern void blk_mq_run_queues(struct request_queue *, bool);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_stop_hw_queues(struct request_queue *);
+extern void blk_mq_start_stopped_hw_queues(struct request_queue *, bool);
+
+static inline struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q,
+						     int cpu)
+{
+	return q->queue_hw_ctx[cpu % q->nr_hw_queues];
+}
+
+#endif
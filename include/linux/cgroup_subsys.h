@@ -60,3 +60,9 @@ SUBSYS(net_cls)
 #endif
 
 /* */
+
+#ifdef CONFIG_BLK_DEV_THROTTLING
+SUBSYS(blkio)
+#endif
+
+/* */
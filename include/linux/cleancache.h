@@ -0,0 +1,102 @@
+#ifndef _LINUX_CLEANCACHE_H
+#define _LINUX_CLEANCACHE_H
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+
+/*
+ * Cleancache is a second chance cache for clean page cache pages: when
+ * reclaim drops an uptodate page that is mapped to disk, a backend (Xen
+ * tmem, a compressed pool, ...) may keep a copy, and a later read of the
+ * same page is satisfied from it instead of from disk.  Pages are
+ * identified by (pool, inode number, index); each filesystem that opts
+ * in gets its own pool, kept in sb->cleancache_poolid.  A put may be
+ * silently dropped, a get returns 0 on a hit.
+ * See Documentation/vm/cleancache.txt.
+ */
+struct cleancache_ops {
+	int (*init_fs)(size_t pagesize);
+	int (*get_page)(int pool, u64 ino, pgoff_t index, struct page *page);
+	void (*put_page)(int pool, u64 ino, pgoff_t index, struct page *page);
+	void (*flush_page)(int pool, u64 ino, pgoff_t index);
+	void (*flush_inode)(int pool, u64 ino);
+	void (*flush_fs)(int pool);
+};
+
+#ifdef CONFIG_CLEANCACHE
+extern int cleancache_enabled;
+extern struct cleancache_ops
+	cleancache_register_ops(struct cleancache_ops *ops);
+
+extern void __cleancache_init_fs(struct super_block *);
+extern int  __cleancache_get_page(struct page *);
+extern void __cleancache_put_page(struct page *);
+extern void __cleancache_flush_page(struct address_space *, struct page *);
+extern void __cleancache_flush_inode(struct address_space *);
+extern void __cleancache_flush_fs(struct super_block *);
+
+static inline int cleancache_fs_enabled(struct address_space *mapping)
+{
+	return mapping->host->i_sb->cleancache_poolid >= 0;
+}
+#else
+#define cleancache_enabled 0
+
+static inline int cleancache_fs_enabled(struct address_space *mapping)
+{
+	return 0;
+}
+
+static inline void __cleancache_init_fs(struct super_block *sb) {}
+static inline int __cleancache_get_page(struct page *page) { return -1; }
+static inline void __cleancache_put_page(struct page *page) {}
+static inline void __cleancache_flush_page(struct address_space *mapping,
+					   struct page *page) {}
+static inline void __cleancache_flush_inode(struct address_space *mapping) {}
+static inline void __cleancache_flush_fs(struct super_block *sb) {}
+#endif
+
+/*
+ * The wrappers below keep the cost to a test of a global when no backend
+ * is registered, and to one more test for filesystems that did not opt in.
+ */
+static inline void cleancache_init_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_init_fs(sb);
+}
+
+static inline int cleancache_get_page(struct page *page)
+{
+	if (cleancache_enabled && cleancache_fs_enabled(page->mapping))
+		return __cleancache_get_page(page);
+	return -1;
+}
+
+static inline void cleancache_put_page(struct page *page)
+{
+	if (cleancache_enabled && cleancache_fs_enabled(page->mapping))
+		__cleancache_put_page(page);
+}
+
+static inline void cleancache_flush_page(struct address_space *mapping,
+					 struct page *page)
+{
+	/* careful... page->mapping is NULL sometimes when this is called */
+	if (cleancache_enabled && cleancache_fs_enabled(mapping))
+		__cleancache_flush_page(mapping, page);
+}
+
+static inline void cleancache_flush_inode(struct address_space *mapping)
+{
+	if (cleancache_enabled && cleancache_fs_enabled(mapping))
+		__cleancache_flush_inode(mapping);
+}
+
+static inline void cleancache_flush_fs(struct super_block *sb)
+{
+	if (cleancache_enabled)
+		__cleancache_flush_fs(sb);
+}
+
+#endif /* _LINUX_CLEANCACHE_H */
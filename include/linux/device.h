@@ -127,6 +127,7 @@ struct device_driver {
 	const char		*mod_name;	/* used for built-in modules */
 
 	bool suppress_bind_attrs;	/* disables bind/unbind via sysfs */
+	bool async_probe;		/* probe from the async threads */
 
 	int (*probe) (struct device *dev);
 	int (*remove) (struct device *dev);
@@ -26,6 +26,12 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Wake only one of the epoll instances that watch the target file
+ * descriptor with this flag, rather than all of them
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -128,10 +128,15 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 #define SKF_LL_OFF    (-0x200000)
 
 #ifdef __KERNEL__
+struct sk_buff;
+struct sock;
+
 struct sk_filter
 {
 	atomic_t		refcnt;
 	unsigned int         	len;	/* Number of filter blocks */
+	unsigned int		(*bpf_func)(const struct sk_buff *skb,
+					    const struct sock_filter *filter);
 	struct rcu_head		rcu;
 	struct sock_filter     	insns[0];
 };
@@ -141,15 +146,33 @@ static inline unsigned int sk_filter_len(const struct sk_filter *fp)
 	return fp->len * sizeof(struct sock_filter) + sizeof(*fp);
 }
 
-struct sk_buff;
-struct sock;
-
 extern int sk_filter(struct sock *sk, struct sk_buff *skb);
 extern unsigned int sk_run_filter(struct sk_buff *skb,
 				  struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+
+#ifdef CONFIG_BPF_JIT
+extern void bpf_jit_compile(struct sk_filter *fp);
+extern void bpf_jit_free(struct sk_filter *fp);
+extern int bpf_jit_enable;
+/* Packet loads the JIT code does not do inline */
+extern s64 sk_filter_load_slow(struct sk_buff *skb, int k, unsigned int size,
+			       u32 A, u32 X);
+#else
+static inline void bpf_jit_compile(struct sk_filter *fp)
+{
+}
+static inline void bpf_jit_free(struct sk_filter *fp)
+{
+}
+#endif
+
+/* Run a filter, compiled to native code if the JIT took it */
+#define SK_RUN_FILTER(FILTER, SKB)					\
+	((FILTER)->bpf_func ? (FILTER)->bpf_func(SKB, (FILTER)->insns) :	\
+	 sk_run_filter(SKB, (FILTER)->insns, (FILTER)->len))
 #endif /* __KERNEL__ */
 
 #endif /* __LINUX_FILTER_H__ */
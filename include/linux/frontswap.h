@@ -0,0 +1,123 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+#include <linux/vmalloc.h>
+
+/*
+ * Frontswap lets a backend (Xen tmem, an in-kernel compressed pool, ...)
+ * absorb swapped out pages synchronously instead of doing disk I/O.
+ * Pages are identified by swap type and offset.  put_page and get_page
+ * return 0 on success; a failed put means the page goes to disk as usual.
+ * See Documentation/vm/frontswap.txt.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*put_page)(unsigned type, pgoff_t offset, struct page *page);
+	int (*get_page)(unsigned type, pgoff_t offset, struct page *page);
+	void (*flush_page)(unsigned type, pgoff_t offset);
+	void (*flush_area)(unsigned type);
+};
+
+#ifdef CONFIG_FRONTSWAP
+extern int frontswap_enabled;
+extern struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops);
+extern unsigned long frontswap_curr_pages(void);
+
+extern void __frontswap_init(unsigned type);
+extern int __frontswap_put_page(struct page *page);
+extern int __frontswap_get_page(struct page *page);
+extern void __frontswap_flush_page(unsigned type, pgoff_t offset);
+extern void __frontswap_flush_area(unsigned type);
+
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return sis->frontswap_map && test_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *p,
+				     unsigned long *map)
+{
+	p->frontswap_map = map;
+	atomic_set(&p->frontswap_pages, 0);
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *p)
+{
+	return p->frontswap_map;
+}
+
+static inline unsigned long *frontswap_map_alloc(unsigned long maxpages)
+{
+	unsigned long size = BITS_TO_LONGS(maxpages) * sizeof(long);
+	unsigned long *map = vmalloc(size);
+
+	if (map)
+		memset(map, 0, size);
+	return map;
+}
+#else
+#define frontswap_enabled 0
+
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return 0;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *p,
+				     unsigned long *map)
+{
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *p)
+{
+	return NULL;
+}
+
+static inline unsigned long *frontswap_map_alloc(unsigned long maxpages)
+{
+	return NULL;
+}
+
+static inline void __frontswap_init(unsigned type) {}
+static inline int __frontswap_put_page(struct page *page) { return -1; }
+static inline int __frontswap_get_page(struct page *page) { return -1; }
+static inline void __frontswap_flush_page(unsigned type, pgoff_t offset) {}
+static inline void __frontswap_flush_area(unsigned type) {}
+#endif
+
+static inline void frontswap_init(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type);
+}
+
+static inline int frontswap_put_page(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_put_page(page);
+	return -1;
+}
+
+static inline int frontswap_get_page(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_get_page(page);
+	return -1;
+}
+
+static inline void frontswap_flush_page(unsigned type, pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_page(type, offset);
+}
+
+static inline void frontswap_flush_area(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_area(type);
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
@@ -61,6 +61,8 @@
 /* listeners that hard code group numbers near the top */
 #define DNOTIFY_GROUP_NUM	UINT_MAX
 #define INOTIFY_GROUP_NUM	(DNOTIFY_GROUP_NUM-1)
+/* fanotify allocates its group numbers downwards from the middle */
+#define FANOTIFY_GROUP_NUM	(DNOTIFY_GROUP_NUM/2)
 
 struct fsnotify_group;
 struct fsnotify_event;
@@ -71,8 +73,10 @@ struct fsnotify_event_private_data;
  * Each group much define these ops.  The fsnotify infrastructure will call
  * these operations for each relevant group.
  *
- * should_send_event - given a group, inode, and mask this function determines
- *		if the group is interested in this event.
+ * should_send_event - given a group, inode, vfsmount and mask this function
+ *		determines if the group is interested in this event.  The
+ *		vfsmount is only known (non-NULL) for events which carry a
+ *		struct file or struct path.
  * handle_event - main call for a group to handle an fs event
  * free_group_priv - called when a group refcnt hits 0 to clean up the private union
  * freeing-mark - this means that a mark has been flagged to die when everything
@@ -80,7 +84,8 @@ struct fsnotify_event_private_data;
  *		valid group and inode to use to clean up.
  */
 struct fsnotify_ops {
-	bool (*should_send_event)(struct fsnotify_group *group, struct inode *inode, __u32 mask);
+	bool (*should_send_event)(struct fsnotify_group *group, struct inode *inode,
+				  struct vfsmount *mnt, __u32 mask);
 	int (*handle_event)(struct fsnotify_group *group, struct fsnotify_event *event);
 	void (*free_group_priv)(struct fsnotify_group *group);
 	void (*freeing_mark)(struct fsnotify_mark_entry *entry, struct fsnotify_group *group);
@@ -137,6 +142,10 @@ struct fsnotify_group {
 					 * a group */
 	struct list_head mark_entries;	/* all inode mark entries for this group */
 
+	/* all vfsmount and super_block marks for this group, protected by a
+	 * global lock in fs_mark.c */
+	struct list_head fs_marks;
+
 	/* prevents double list_del of group_list.  protected by global fsnotify_grp_mutex */
 	bool on_group_list;
 
@@ -151,6 +160,11 @@ struct fsnotify_group {
 			struct fasync_struct    *fa;    /* async notification */
 			struct user_struct      *user;
 		} inotify_data;
+#endif
+#ifdef CONFIG_FANOTIFY
+		struct fanotify_group_private_data {
+			unsigned int	f_flags;	/* open flags for event fds */
+		} fanotify_data;
 #endif
 	};
 };
@@ -216,6 +230,7 @@ struct fsnotify_event {
 	__u32 mask;		/* the type of access, bitwise OR for FS_* event types */
 
 	u32 sync_cookie;	/* used to corrolate events, namely inotify mv events */
+	struct pid *tgid;	/* thread group of the task causing the event */
 	char *file_name;
 	size_t name_len;
 
@@ -247,6 +262,29 @@ struct fsnotify_mark_entry {
 	void (*free_mark)(struct fsnotify_mark_entry *entry); /* called on final put+free */
 };
 
+/*
+ * A mark attached to a whole vfsmount or super_block rather than to a single
+ * inode, so a group can see every event on a mount or filesystem without
+ * setting up an inode mark for each object in it.
+ *
+ * fs marks are linked on the object's list, which is walked under
+ * fsnotify_grp_srcu when events are sent, and on the group's fs_marks list.
+ * Both lists are modified under a global lock, and a removed mark is freed
+ * only after an srcu grace period.  Unlike inode marks they are not
+ * refcounted: whoever unlinks a mark frees it.
+ */
+struct fsnotify_fs_mark {
+	__u32 mask;			/* events this mark is for */
+	int type;			/* FSNOTIFY_MARK_* below */
+	void *obj;			/* vfsmount or super_block */
+	struct fsnotify_group *group;	/* group this mark is for */
+	struct hlist_node o_list;	/* list of marks by object */
+	struct list_head g_list;	/* list of marks by group->fs_marks */
+};
+
+#define FSNOTIFY_MARK_MOUNT	1	/* obj is a struct vfsmount */
+#define FSNOTIFY_MARK_SB	2	/* obj is a struct super_block */
+
 #ifdef CONFIG_FSNOTIFY
 
 /* called from the vfs helpers */
@@ -349,6 +387,24 @@ extern void fsnotify_get_mark(struct fsnotify_mark_entry *entry);
 extern void fsnotify_put_mark(struct fsnotify_mark_entry *entry);
 extern void fsnotify_unmount_inodes(struct list_head *list);
 
+/* functions used to manipulate vfsmount and super_block marks */
+
+/* find the mark of a group on a vfsmount or super_block.  The caller must hold
+ * fsnotify_grp_srcu (i.e. be in ->should_send_event) */
+extern struct fsnotify_fs_mark *fsnotify_find_fs_mark(struct fsnotify_group *group,
+						      void *obj, int type);
+/* add mask to (creating if needed) the group's mark on obj */
+extern int fsnotify_add_fs_mark(struct fsnotify_group *group, void *obj, int type,
+				__u32 mask);
+/* clear mask from the group's mark on obj, freeing it once it is empty */
+extern int fsnotify_remove_fs_mark(struct fsnotify_group *group, void *obj, int type,
+				   __u32 mask);
+/* free all marks of a group of the given type, or of any type if type is 0 */
+extern void fsnotify_clear_fs_marks_by_group(struct fsnotify_group *group, int type);
+/* called when a vfsmount or super_block goes away to free its marks */
+extern void fsnotify_vfsmount_delete(struct vfsmount *mnt);
+extern void fsnotify_sb_delete(struct super_block *sb);
+
 /* put here because inotify does some weird stuff when destroying watches */
 extern struct fsnotify_event *fsnotify_create_event(struct inode *to_tell, __u32 mask,
 						    void *data, int data_is, const char *name,
@@ -380,6 +436,12 @@ static inline u32 fsnotify_get_cookie(void)
 static inline void fsnotify_unmount_inodes(struct list_head *list)
 {}
 
+static inline void fsnotify_vfsmount_delete(struct vfsmount *mnt)
+{}
+
+static inline void fsnotify_sb_delete(struct super_block *sb)
+{}
+
 #endif	/* CONFIG_FSNOTIFY */
 
 #endif	/* __KERNEL __ */
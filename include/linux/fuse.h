@@ -40,6 +40,7 @@
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -565,4 +566,14 @@ struct fuse_notify_inval_entry_out {
 	__u32	padding;
 };
 
+/*
+ * Device ioctls
+ *
+ * FUSE_DEV_IOC_CLONE: attach a newly opened /dev/fuse to the connection
+ * of the device file whose descriptor is passed in, giving the
+ * daemon another channel with its own request queue
+ */
+#define FUSE_DEV_IOC_MAGIC	229
+#define FUSE_DEV_IOC_CLONE	_IOR(FUSE_DEV_IOC_MAGIC, 0, __u32)
+
 #endif /* _LINUX_FUSE_H */
@@ -185,6 +185,24 @@ static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
 #endif
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+extern int futex_private_hash_set(unsigned long slots);
+extern int futex_private_hash_get(void);
+extern void exit_futex_private_hash(struct mm_struct *mm);
+#else
+static inline int futex_private_hash_set(unsigned long slots)
+{
+	return -EINVAL;
+}
+static inline int futex_private_hash_get(void)
+{
+	return -EINVAL;
+}
+static inline void exit_futex_private_hash(struct mm_struct *mm)
+{
+}
+#endif
 #endif /* __KERNEL__ */
 
 #define FUTEX_OP_SET		0	/* *(int *)UADDR2 = OPARG; */
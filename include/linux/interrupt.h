@@ -129,6 +129,8 @@ request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
 	return request_threaded_irq(irq, handler, NULL, flags, name, dev);
 }
 
+extern int irq_set_thread_priority(unsigned int irq, void *dev_id, int prio);
+
 extern void exit_irq_thread(void);
 #else
 
@@ -150,6 +152,12 @@ request_threaded_irq(unsigned int irq, irq_handler_t handler,
 	return request_irq(irq, handler, flags, name, dev);
 }
 
+static inline int irq_set_thread_priority(unsigned int irq, void *dev_id,
+					  int prio)
+{
+	return -EINVAL;
+}
+
 static inline void exit_irq_thread(void) { }
 #endif
 
@@ -25,6 +25,12 @@ struct page_cgroup;
 struct page;
 struct mm_struct;
 
+/* Per-cgroup page state updated from the page cache and writeback code */
+enum mem_cgroup_page_stat_item {
+	MEMCG_NR_FILE_DIRTY,	/* # of dirty pages in page cache */
+	MEMCG_NR_WRITEBACK,	/* # of pages under writeback */
+};
+
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 /*
  * All "charge" functions with gfp_mask should use GFP_KERNEL or
@@ -67,6 +73,8 @@ extern unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 					int active, int file);
 extern void mem_cgroup_out_of_memory(struct mem_cgroup *mem, gfp_t gfp_mask);
 int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem);
+int mem_cgroup_scan_tasks(struct mem_cgroup *mem,
+			  int (*fn)(struct task_struct *, void *), void *arg);
 
 extern struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p);
 
@@ -118,6 +126,10 @@ static inline bool mem_cgroup_disabled(void)
 
 extern bool mem_cgroup_oom_called(struct task_struct *task);
 void mem_cgroup_update_mapped_file_stat(struct page *page, int val);
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item item, bool set);
+bool mem_cgroup_dirty_info(unsigned long dirtyable, unsigned long *thresh,
+			   unsigned long *nr_dirty);
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask, int nid,
 						int zid);
@@ -200,6 +212,12 @@ static inline int task_in_mem_cgroup(struct task_struct *task,
 	return 1;
 }
 
+static inline int mem_cgroup_scan_tasks(struct mem_cgroup *mem,
+			int (*fn)(struct task_struct *, void *), void *arg)
+{
+	return 0;
+}
+
 static inline int
 mem_cgroup_prepare_migration(struct page *page, struct mem_cgroup **ptr)
 {
@@ -279,6 +297,18 @@ static inline void mem_cgroup_update_mapped_file_stat(struct page *page,
 {
 }
 
+static inline void mem_cgroup_update_page_stat(struct page *page,
+				enum mem_cgroup_page_stat_item item, bool set)
+{
+}
+
+static inline bool mem_cgroup_dirty_info(unsigned long dirtyable,
+					 unsigned long *thresh,
+					 unsigned long *nr_dirty)
+{
+	return false;
+}
+
 static inline
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 					    gfp_t gfp_mask, int nid, int zid)
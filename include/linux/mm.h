@@ -29,6 +29,9 @@ extern unsigned long totalram_pages;
 extern void * high_memory;
 extern int page_cluster;
 
+#define ANON_FAULT_CLUSTER_MAX	4	/* log2, 16 pages */
+extern int sysctl_anon_fault_cluster;
+
 #ifdef CONFIG_SYSCTL
 extern int sysctl_legacy_va_layout;
 #else
@@ -830,6 +833,58 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Writers hold mmap_sem for writing (or the anon_vma lock, for stack
+ * expansion) around these; a speculative fault samples the counts
+ * without mmap_sem and backs off if they moved.
+ */
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+
+static inline void mm_rb_write_begin(struct mm_struct *mm)
+{
+	write_seqcount_begin(&mm->mm_rb_seq);
+}
+
+static inline void mm_rb_write_end(struct mm_struct *mm)
+{
+	write_seqcount_end(&mm->mm_rb_seq);
+}
+
+static inline void mm_init_speculative(struct mm_struct *mm)
+{
+	seqcount_init(&mm->mm_rb_seq);
+	atomic_set(&mm->spf_inflight[0], 0);
+	atomic_set(&mm->spf_inflight[1], 0);
+	mm->spf_idx = 0;
+}
+
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags);
+extern void wait_speculative_faults(struct mm_struct *mm);
+#else
+static inline void vma_write_begin(struct vm_area_struct *vma) {}
+static inline void vma_write_end(struct vm_area_struct *vma) {}
+static inline void mm_rb_write_begin(struct mm_struct *mm) {}
+static inline void mm_rb_write_end(struct mm_struct *mm) {}
+static inline void mm_init_speculative(struct mm_struct *mm) {}
+
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags)
+{
+	return 0;
+}
+static inline void wait_speculative_faults(struct mm_struct *mm) {}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 
@@ -10,6 +10,8 @@
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
 #include <linux/completion.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
 #include <asm/page.h>
@@ -186,6 +188,11 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t vm_sequence;		/* Bumped around changes to the fields
+					   a speculative fault relies on */
+	struct rcu_head vm_rcu;		/* Lockless lookups free it via RCU */
+#endif
 };
 
 struct core_thread {
@@ -265,6 +272,9 @@ struct mm_struct {
 	spinlock_t		ioctx_lock;
 	struct hlist_head	ioctx_list;
 #endif
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	struct futex_private_hash *futex_phash;
+#endif
 #ifdef CONFIG_MM_OWNER
 	/*
 	 * "owner" points to a task that is regarded as the canonical
@@ -287,6 +297,16 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t mm_rb_seq;		/* Bumped around changes to mm_rb */
+	/*
+	 * Speculative faults walking the page tables, counted in one of
+	 * two slots so that unmap_region can wait for the slot it flipped
+	 * away from to drain before freeing page tables.
+	 */
+	atomic_t spf_inflight[2];
+	int spf_idx;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
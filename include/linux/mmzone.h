@@ -171,6 +171,14 @@ struct per_cpu_pages {
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
+	/*
+	 * A cpu that keeps going to the buddy lists moves batch << factor
+	 * pages per trip, and may hold up to high << alloc_factor pages.
+	 * Both factors decay once a second, see decay_zone_pages().
+	 */
+	u8 alloc_factor;
+	u8 free_factor;
+
 	/* Lists of pages, one per migrate type stored on the pcp-lists */
 	struct list_head lists[MIGRATE_PCPTYPES];
 };
@@ -623,6 +631,10 @@ extern struct page *mem_map;
  * per-zone basis.
  */
 struct bootmem_data;
+
+/* Upper limit of vm.kswapd_threads, the reclaim threads per node */
+#define MAX_KSWAPD_THREADS	16
+
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
 	struct zonelist node_zonelists[MAX_ZONELISTS];
@@ -650,7 +662,8 @@ typedef struct pglist_data {
 					     range, including holes */
 	int node_id;
 	wait_queue_head_t kswapd_wait;
-	struct task_struct *kswapd;
+	wait_queue_head_t pfmemalloc_wait;	/* throttled direct reclaimers */
+	struct task_struct *kswapd[MAX_KSWAPD_THREADS];
 	int kswapd_max_order;
 } pg_data_t;
 
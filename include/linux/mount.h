@@ -56,6 +56,10 @@ struct vfsmount {
 	struct mnt_namespace *mnt_ns;	/* containing namespace */
 	int mnt_id;			/* mount identifier */
 	int mnt_group_id;		/* peer group identifier */
+#ifdef CONFIG_FSNOTIFY
+	__u32 mnt_fsnotify_mask;	/* events wanted by mount marks */
+	struct hlist_head mnt_fsnotify_marks;	/* fsnotify fs marks */
+#endif
 	/*
 	 * We put mnt_count & mnt_expiry_mark at the end of struct vfsmount
 	 * to let these frequently modified fields in a separate cache line
@@ -43,6 +43,7 @@
 #include <linux/rculist.h>
 #include <linux/dmaengine.h>
 #include <linux/workqueue.h>
+#include <linux/dynamic_queue_limits.h>
 
 #include <linux/ethtool.h>
 #include <net/net_namespace.h>
@@ -186,6 +187,7 @@ struct netif_rx_stats
 	unsigned dropped;
 	unsigned time_squeeze;
 	unsigned cpu_collision;
+	unsigned received_rps;
 };
 
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
@@ -340,6 +342,10 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+	struct hlist_node	napi_hash_node;
+#endif
 };
 
 enum
@@ -460,9 +466,97 @@ static inline void napi_synchronize(const struct napi_struct *n)
 
 enum netdev_queue_state_t
 {
-	__QUEUE_STATE_XOFF,
+	__QUEUE_STATE_XOFF,		/* stopped by the driver */
 	__QUEUE_STATE_FROZEN,
+	__QUEUE_STATE_STACK_XOFF,	/* stopped by byte queue limits */
+};
+
+/*
+ * This structure holds an RPS map which can be of variable length.  The
+ * map is an array of CPUs.
+ */
+struct rps_map {
+	unsigned int len;
+	struct rcu_head rcu;
+	u16 cpus[0];
+};
+#define RPS_MAP_SIZE(_num) (sizeof(struct rps_map) + (_num * sizeof(u16)))
+
+/*
+ * The rps_dev_flow structure contains the mapping of a flow to a CPU and
+ * the tail pointer for that CPU's input queue at the time of last enqueue.
+ */
+struct rps_dev_flow {
+	u16 cpu;
+	u16 fill;
+	unsigned int last_qtail;
+};
+
+/*
+ * The rps_dev_flow_table structure contains a table of flow mappings.
+ */
+struct rps_dev_flow_table {
+	unsigned int mask;
+	struct rps_dev_flow flows[0];
+};
+#define RPS_DEV_FLOW_TABLE_SIZE(_num) (sizeof(struct rps_dev_flow_table) + \
+    (_num * sizeof(struct rps_dev_flow)))
+
+/*
+ * The rps_sock_flow_table contains mappings of flows to the last CPU
+ * on which they were processed by the application (set in recvmsg).
+ */
+struct rps_sock_flow_table {
+	unsigned int mask;
+	u16 ents[0];
+};
+#define RPS_SOCK_FLOW_TABLE_SIZE(_num) (sizeof(struct rps_sock_flow_table) + \
+    (_num * sizeof(u16)))
+
+#define RPS_NO_CPU 0xffff
+
+static inline void rps_record_sock_flow(struct rps_sock_flow_table *table,
+					u32 hash)
+{
+	if (table && hash) {
+		unsigned int cpu, index = hash & table->mask;
+
+		/* We only give a hint, preemption can change cpu under us */
+		cpu = raw_smp_processor_id();
+
+		if (table->ents[index] != cpu)
+			table->ents[index] = cpu;
+	}
+}
+
+static inline void rps_reset_sock_flow(struct rps_sock_flow_table *table,
+				       u32 hash)
+{
+	if (table && hash)
+		table->ents[hash & table->mask] = RPS_NO_CPU;
+}
+
+extern struct rps_sock_flow_table *rps_sock_flow_table;
+
+/*
+ * This structure holds an XPS map which can be of variable length.  The
+ * map is an array of queues.
+ */
+struct xps_map {
+	unsigned int len;
+	u16 queues[0];
+};
+#define XPS_MAP_SIZE(_num) (sizeof(struct xps_map) + (_num * sizeof(u16)))
+
+/*
+ * This structure holds all XPS maps for device.  Maps are indexed by CPU.
+ */
+struct xps_dev_maps {
+	struct rcu_head rcu;
+	struct xps_map *cpu_map[0];
 };
+#define XPS_DEV_MAPS_SIZE (sizeof(struct xps_dev_maps) +		\
+    (nr_cpu_ids * sizeof(struct xps_map *)))
 
 struct netdev_queue {
 /*
@@ -484,6 +578,9 @@ struct netdev_queue {
 	unsigned long		tx_bytes;
 	unsigned long		tx_packets;
 	unsigned long		tx_dropped;
+#ifdef CONFIG_BQL
+	struct dql		dql;
+#endif
 } ____cacheline_aligned_in_smp;
 
 
@@ -735,6 +832,7 @@ struct net_device
 #define NETIF_F_TSO_ECN		(SKB_GSO_TCP_ECN << NETIF_F_GSO_SHIFT)
 #define NETIF_F_TSO6		(SKB_GSO_TCPV6 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_FSO		(SKB_GSO_FCOE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_UDP_L4	(SKB_GSO_UDP_L4 << NETIF_F_GSO_SHIFT)
 
 	/* List of features with software fallbacks. */
 #define NETIF_F_GSO_SOFTWARE	(NETIF_F_TSO | NETIF_F_TSO_ECN | NETIF_F_TSO6)
@@ -841,6 +939,12 @@ struct net_device
 
 	struct netdev_queue	rx_queue;
 
+#ifdef CONFIG_RPS
+	/* CPUs received packets are steered to, see get_rps_cpu() */
+	struct rps_map		*rps_map;
+	struct rps_dev_flow_table *rps_flow_table;
+#endif
+
 	struct netdev_queue	*_tx ____cacheline_aligned_in_smp;
 
 	/* Number of TX queues allocated at alloc_netdev_mq() time  */
@@ -849,6 +953,11 @@ struct net_device
 	/* Number of TX queues currently active in device  */
 	unsigned int		real_num_tx_queues;
 
+#ifdef CONFIG_XPS
+	/* TX queues each CPU transmits on, see get_xps_queue() */
+	struct xps_dev_maps	*xps_maps;
+#endif
+
 	/* root qdisc from userspace point of view */
 	struct Qdisc		*qdisc;
 
@@ -1042,6 +1151,36 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
  */
 void netif_napi_del(struct napi_struct *napi);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ *	napi_hash_add - let sockets busy poll a napi context
+ *	@napi: napi context
+ *
+ * Gives @napi an id that is recorded in the packets it receives, so that
+ * their sockets can find it again and run its poll routine themselves
+ * (see include/net/busy_poll.h).  Called after netif_napi_add().
+ */
+void napi_hash_add(struct napi_struct *napi);
+
+/**
+ *	napi_hash_del - stop busy polling a napi context
+ *	@napi: napi context
+ *
+ * Busy pollers may still be running @napi->poll when this returns; the
+ * caller must let an RCU grace period pass, synchronize_net(), before
+ * netif_napi_del() and freeing @napi.
+ */
+void napi_hash_del(struct napi_struct *napi);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif
+
 struct napi_gro_cb {
 	/* Virtual address of skb_shinfo(skb)->frags[0].page + offset. */
 	void *frag0;
@@ -1063,6 +1202,9 @@ struct napi_gro_cb {
 
 	/* Free the skb? */
 	int free;
+
+	/* Set once a tunnel header has been parsed; tunnels do not nest. */
+	int encap_mark;
 };
 
 #define NAPI_GRO_CB(skb) ((struct napi_gro_cb *)(skb)->cb)
@@ -1240,6 +1382,18 @@ struct softnet_data
 	struct sk_buff		*completion_queue;
 
 	struct napi_struct	backlog;
+
+#ifdef CONFIG_RPS
+	/* Backlogs of other CPUs this CPU has to kick with an IPI */
+	struct softnet_data	*rps_ipi_list;
+
+	/* Elements below can be accessed between CPUs for RPS */
+	struct call_single_data	csd ____cacheline_aligned_in_smp;
+	struct softnet_data	*rps_ipi_next;
+	unsigned int		cpu;
+	/* Packets dequeued from input_pkt_queue so far, for RFS */
+	unsigned int		input_queue_head;
+#endif
 };
 
 DECLARE_PER_CPU(struct softnet_data,softnet_data);
@@ -1248,9 +1402,20 @@ DECLARE_PER_CPU(struct softnet_data,softnet_data);
 
 extern void __netif_schedule(struct Qdisc *q);
 
+/*
+ * Whether the stack may hand the queue more packets: stopped by the
+ * driver or by byte queue limits.  Drivers keep using
+ * netif_tx_queue_stopped() for their own flow control.
+ */
+static inline int netif_xmit_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & ((1 << __QUEUE_STATE_XOFF) |
+				   (1 << __QUEUE_STATE_STACK_XOFF));
+}
+
 static inline void netif_schedule_queue(struct netdev_queue *txq)
 {
-	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+	if (!netif_xmit_stopped(txq))
 		__netif_schedule(txq->qdisc);
 }
 
@@ -1370,6 +1535,101 @@ static inline int netif_tx_queue_frozen(const struct netdev_queue *dev_queue)
 	return test_bit(__QUEUE_STATE_FROZEN, &dev_queue->state);
 }
 
+/**
+ *	netdev_tx_sent_queue - account bytes handed to the hardware
+ *	@dev_queue: transmit queue
+ *	@bytes: bytes just queued to the ring
+ *
+ *	Byte queue limits: called by drivers from their xmit routine for
+ *	every packet put on a ring that reports its completions through
+ *	netdev_tx_completed_queue().  Stops the queue once more is in
+ *	flight than the current limit.
+ */
+static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue,
+					unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	dql_queued(&dev_queue->dql, bytes);
+	if (likely(dql_avail(&dev_queue->dql) >= 0))
+		return;
+
+	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+
+	/*
+	 * The XOFF flag must be set before checking the dql_avail below,
+	 * because in netdev_tx_completed_queue we update the dql_completed
+	 * before checking the XOFF flag.
+	 */
+	smp_mb();
+
+	/* check again in case another CPU has just made room avail */
+	if (unlikely(dql_avail(&dev_queue->dql) >= 0))
+		clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+#endif
+}
+
+static inline void netdev_sent_queue(struct net_device *dev,
+				     unsigned int bytes)
+{
+	netdev_tx_sent_queue(netdev_get_tx_queue(dev, 0), bytes);
+}
+
+/**
+ *	netdev_tx_completed_queue - account bytes the hardware is done with
+ *	@dev_queue: transmit queue
+ *	@pkts: packets completed
+ *	@bytes: bytes completed
+ *
+ *	Called by drivers from their tx completion routine; recomputes the
+ *	limit from the completion rate and restarts a queue stopped by
+ *	netdev_tx_sent_queue() once it is back under it.
+ */
+static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue,
+					     unsigned int pkts,
+					     unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	if (unlikely(!bytes))
+		return;
+
+	dql_completed(&dev_queue->dql, bytes);
+
+	/*
+	 * Without the memory barrier there is a small possibility that
+	 * netdev_tx_sent_queue will miss the update and cause the queue to
+	 * be stopped forever
+	 */
+	smp_mb();
+
+	if (dql_avail(&dev_queue->dql) < 0)
+		return;
+
+	if (test_and_clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state))
+		netif_schedule_queue(dev_queue);
+#endif
+}
+
+static inline void netdev_completed_queue(struct net_device *dev,
+					  unsigned int pkts,
+					  unsigned int bytes)
+{
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, 0), pkts, bytes);
+}
+
+/* Forget all in-flight bytes, for drivers freeing their rings */
+static inline void netdev_tx_reset_queue(struct netdev_queue *q)
+{
+#ifdef CONFIG_BQL
+	clear_bit(__QUEUE_STATE_STACK_XOFF, &q->state);
+	dql_reset(&q->dql);
+#endif
+}
+
+static inline void netdev_reset_queue(struct net_device *dev_queue)
+{
+	netdev_tx_reset_queue(netdev_get_tx_queue(dev_queue, 0));
+}
+
 /**
  *	netif_running - test if up
  *	@dev: network device
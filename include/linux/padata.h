@@ -0,0 +1,95 @@
+/*
+ * padata.h - header for the padata parallelization interface
+ *
+ * padata runs the parallel part of a stream of objects on all cpus of
+ * an instance, then hands the objects to their serial callback in the
+ * order they were submitted in.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef PADATA_H
+#define PADATA_H
+
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/wait.h>
+
+/**
+ * struct padata_priv - embedded in the objects submitted to padata
+ *
+ * @list: list entry, used by padata while it has the object
+ * @pd: internal, the parallel_data the object was submitted to
+ * @cb_cpu: cpu the serial callback is run on
+ * @cpu: internal, cpu the parallel callback is run on
+ * @seq_nr: internal, submission order
+ * @info: free for the user, pcrypt keeps the crypto return code here
+ * @parallel: run on some cpu of the instance, must end in a call to
+ *            padata_do_serial(), possibly asynchronously
+ * @serial: run on @cb_cpu, in submission order
+ */
+struct padata_priv {
+	struct list_head	list;
+	struct parallel_data	*pd;
+	int			cb_cpu;
+	int			cpu;
+	unsigned int		seq_nr;
+	int			info;
+	void			(*parallel)(struct padata_priv *padata);
+	void			(*serial)(struct padata_priv *padata);
+};
+
+/*
+ * Per cpu queues of a parallel_data: objects waiting to be run in
+ * parallel, objects done in parallel waiting for their turn (sorted by
+ * seq_nr), and objects whose serial callback is due on this cpu.
+ */
+struct padata_queue {
+	spinlock_t		lock;
+	struct list_head	parallel;
+	struct list_head	reorder;
+	struct list_head	serial;
+	struct work_struct	pwork;
+	struct work_struct	swork;
+	struct parallel_data	*pd;
+};
+
+/*
+ * The set of cpus an instance currently runs on.  It is replaced as a
+ * whole when cpus come and go, the old one lives on until every object
+ * submitted to it got serialized.
+ */
+struct parallel_data {
+	struct padata_instance	*pinst;
+	struct padata_queue	*queue;
+	atomic_t		seq_nr;
+	atomic_t		refcnt;
+	spinlock_t		lock;		/* serializes reordering */
+	unsigned int		processed;	/* next seq_nr to serialize */
+	cpumask_var_t		cpumask;
+	int			num_cpus;
+	int			cpu_map[0];	/* index into cpumask -> cpu */
+};
+
+struct padata_instance {
+	struct notifier_block	cpu_notifier;
+	struct workqueue_struct	*wq;
+	struct parallel_data	*pd;
+	cpumask_var_t		cpumask;
+	struct mutex		lock;
+	wait_queue_head_t	drain;
+};
+
+extern struct padata_instance *padata_alloc(const struct cpumask *cpumask,
+					    struct workqueue_struct *wq);
+extern void padata_free(struct padata_instance *pinst);
+extern int padata_do_parallel(struct padata_instance *pinst,
+			      struct padata_priv *padata, int cb_cpu);
+extern void padata_do_serial(struct padata_priv *padata);
+#endif
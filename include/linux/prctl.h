@@ -102,4 +102,12 @@
 
 #define PR_MCE_KILL_GET 34
 
+/*
+ * Give the process's private futexes a hash table of arg2 buckets, a
+ * power of two; only while single threaded.  GET returns the size, or 0
+ * when the global hash is used.
+ */
+#define PR_SET_FUTEX_HASH 35
+#define PR_GET_FUTEX_HASH 36
+
 #endif /* _LINUX_PRCTL_H */
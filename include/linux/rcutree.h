@@ -93,6 +93,7 @@ extern long rcu_batches_completed_sched(void);
 #ifdef CONFIG_NO_HZ
 void rcu_enter_nohz(void);
 void rcu_exit_nohz(void);
+int rcu_cpu_in_dynticks_idle(int cpu);
 #else /* CONFIG_NO_HZ */
 static inline void rcu_enter_nohz(void)
 {
@@ -100,6 +101,10 @@ static inline void rcu_enter_nohz(void)
 static inline void rcu_exit_nohz(void)
 {
 }
+static inline int rcu_cpu_in_dynticks_idle(int cpu)
+{
+	return 0;
+}
 #endif /* CONFIG_NO_HZ */
 
 /* A context switch is a grace period for RCU-sched and RCU-bh. */
@@ -86,6 +86,8 @@ struct task_struct;
 struct sem {
 	int	semval;		/* current value */
 	int	sempid;		/* pid of last operation */
+	spinlock_t	lock;	/* for single semaphore semops, see sem.c */
+	struct list_head sem_pending; /* pending single semaphore semops */
 };
 
 /* One sem_array data structure for each set of semaphores in the system. */
@@ -94,8 +96,10 @@ struct sem_array {
 	time_t			sem_otime;	/* last semop time */
 	time_t			sem_ctime;	/* last change time */
 	struct sem		*sem_base;	/* ptr to first semaphore in array */
-	struct list_head	sem_pending;	/* pending operations to be processed */
+	struct list_head	sem_pending;	/* pending complex operations */
 	struct list_head	list_id;	/* undo requests on this array */
+	int			complex_count;	/* entries in sem_pending */
+	int			use_global_lock; /* see ipc/sem.c */
 	unsigned long		sem_nsems;	/* no. of semaphores in array */
 };
 
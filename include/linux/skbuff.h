@@ -243,6 +243,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* A train of equal sized UDP datagrams merged by GRO. */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -307,6 +310,9 @@ typedef unsigned char *sk_buff_data_t;
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
+ *	@rxhash: the packet's flow hash, set by receive packet steering
+ *	@napi_id: id of the napi context that received the packet, for busy
+ *		polling
  *	@vlan_tci: vlan tag control information
  */
 
@@ -392,6 +398,11 @@ struct sk_buff {
 
 	__u32			mark;
 
+	__u32			rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
+
 	__u16			vlan_tci;
 
 	sk_buff_data_t		transport_header;
@@ -2051,6 +2062,16 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+
+/* The flow hash of a received packet, computed on first use. */
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+	return skb->rxhash;
+}
+
 #ifdef CONFIG_XFRM
 static inline struct sec_path *skb_sec_path(struct sk_buff *skb)
 {
@@ -32,18 +32,24 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	CPU_PARTIAL_ALLOC,	/* Cpu slab acquired from cpu partial list */
+	CPU_PARTIAL_FREE,	/* Freeing moves slab to cpu partial list */
+	CPU_PARTIAL_DRAIN,	/* Cpu partial list moved to node lists */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to first free per cpu object */
+	unsigned long tid;	/* Bumped on every change, see slab_alloc() */
 	struct page *page;	/* The slab from which we are allocating */
 	int node;		/* The node of the page (or -1 for debug) */
 	unsigned int offset;	/* Freepointer offset (in word units) */
 	unsigned int objsize;	/* Size of an object (from kmem_cache) */
+	struct list_head partial;	/* Frozen partial slabs of this cpu */
+	unsigned int nr_partial;
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
-};
+} __attribute__((aligned(2 * sizeof(void *))));	/* cmpxchg_double_local */
 
 struct kmem_cache_node {
 	spinlock_t list_lock;	/* Protect partial list and nr_partial */
@@ -91,6 +97,7 @@ struct kmem_cache {
 	int inuse;		/* Offset to metadata */
 	int align;		/* Alignment */
 	unsigned long min_partial;
+	unsigned int cpu_partial;	/* Max slabs on each cpu partial list */
 	const char *name;	/* Name (only for display!) */
 	struct list_head list;	/* List of slab caches */
 #ifdef CONFIG_SLUB_DEBUG
@@ -17,6 +17,7 @@ void		cleanup_socket_xprt(void);
  */
 extern unsigned int xprt_udp_slot_table_entries;
 extern unsigned int xprt_tcp_slot_table_entries;
+extern unsigned int xprt_max_tcp_slot_table_entries;
 
 /*
  * Parameters for choosing a free port
@@ -155,10 +155,20 @@ enum {
 #define SWAP_MAP_BAD	0x7fff
 #define SWAP_HAS_CACHE  0x8000		/* There is a swap cache of entry. */
 #define SWAP_COUNT_MASK (~SWAP_HAS_CACHE)
+/*
+ * Where allocation goes on sequentially, and how many slots are left
+ * before scan_swap_map() looks for a new free cluster.
+ */
+struct swap_cluster {
+	unsigned int next;
+	unsigned int nr;
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
 struct swap_info_struct {
+	spinlock_t lock;		/* protects the slots, see swapfile.c */
 	unsigned long flags;
 	int prio;			/* swap priority */
 	int next;			/* next entry on swap list */
@@ -171,12 +181,16 @@ struct swap_info_struct {
 	unsigned int highest_bit;
 	unsigned int lowest_alloc;	/* while preparing discard cluster */
 	unsigned int highest_alloc;	/* while preparing discard cluster */
-	unsigned int cluster_next;
-	unsigned int cluster_nr;
+	struct swap_cluster cluster;
+	struct swap_cluster *percpu_cluster;	/* SSDs: one per cpu */
 	unsigned int pages;
 	unsigned int max;
 	unsigned int inuse_pages;
 	unsigned int old_block_size;
+#ifdef CONFIG_FRONTSWAP
+	unsigned long *frontswap_map;	/* offsets held by frontswap */
+	atomic_t frontswap_pages;	/* bits set in frontswap_map */
+#endif
 };
 
 struct swap_list_t {
@@ -185,7 +199,7 @@ struct swap_list_t {
 };
 
 /* Swap 50% full? Release swapcache more aggressively.. */
-#define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
+#define vm_swap_full() (get_nr_swap_pages()*2 < total_swap_pages)
 
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
@@ -234,6 +248,11 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						unsigned int swappiness,
 						struct zone *zone,
 						int nid);
+
+/* LRU Isolation modes. */
+#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
+#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
+#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
@@ -263,6 +282,9 @@ extern int scan_unevictable_register_node(struct node *node);
 extern void scan_unevictable_unregister_node(struct node *node);
 
 extern int kswapd_run(int nid);
+extern int kswapd_threads;
+extern int kswapd_threads_sysctl_handler(struct ctl_table *, int,
+					 void __user *, size_t *, loff_t *);
 
 #ifdef CONFIG_MMU
 /* linux/mm/shmem.c */
@@ -294,8 +316,14 @@ extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
 /* linux/mm/swapfile.c */
-extern long nr_swap_pages;
+extern atomic_long_t nr_swap_pages;
 extern long total_swap_pages;
+
+static inline long get_nr_swap_pages(void)
+{
+	return atomic_long_read(&nr_swap_pages);
+}
+
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
 extern swp_entry_t get_swap_page_of_type(int);
@@ -354,7 +382,7 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 
 #else /* CONFIG_SWAP */
 
-#define nr_swap_pages				0L
+#define get_nr_swap_pages()			0L
 #define total_swap_pages			0L
 #define total_swapcache_pages			0UL
 
@@ -96,6 +96,7 @@ enum {
 #define TCP_QUICKACK		12	/* Block/reenable quick acks */
 #define TCP_CONGESTION		13	/* Congestion control algorithm */
 #define TCP_MD5SIG		14	/* TCP MD5 Signature (RFC2385) */
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -237,6 +238,10 @@ struct tcp_request_sock {
 #endif
 	u32			 	rcv_isn;
 	u32			 	snt_isn;
+	u32				rcv_nxt; /* ack_seq of the SYN-ACK */
+	u8				tfo_cookie : 1, /* SYN-ACK hands out a cookie */
+					tfo_exp : 1;	/* ... in the experimental option */
+	struct sock			*listener; /* fastopen: owning listener */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -399,6 +404,11 @@ struct tcp_sock {
 		u32		  probe_seq_end;
 	} mtu_probe;
 
+/* TCP Fast Open */
+	struct request_sock	*fastopen_rsk;	/* passive child, until ESTABLISHED */
+	int			fastopen_max_qlen; /* listener: TCP_FASTOPEN limit */
+	atomic_t		fastopen_qlen;	/* listener: children in SYN_RECV */
+
 #ifdef CONFIG_TCP_MD5SIG
 /* TCP AF-Specific parts; only used by MD5 Signature support so far */
 	const struct tcp_sock_af_ops	*af_specific;
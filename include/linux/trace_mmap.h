@@ -0,0 +1,57 @@
+#ifndef _LINUX_TRACE_MMAP_H
+#define _LINUX_TRACE_MMAP_H
+
+#include <linux/types.h>
+
+/*
+ * Memory mapping of the per cpu trace_pipe_raw files.
+ *
+ * The first page of the mapping is the meta page described below, the
+ * ring buffer pages follow, page @id of the buffer at offset
+ * (1 + @id) * page size.  Each of those pages starts with the header
+ * described in events/header_page, followed by the events in the format
+ * of events/header_event.  The mapping is read only: the kernel keeps
+ * writing to the pages while they are mapped, and only the reader page
+ * is left alone by the writers.
+ *
+ * TRACE_MMAP_IOCTL_GET_READER tells the kernel that everything on the
+ * current reader page up to its commit has been consumed and makes it
+ * pick the next page, if there is any data.  The meta page is only
+ * updated by that ioctl.  When reader.id changes, events are read from
+ * reader.read up to the commit of the new page; when it did not change,
+ * from where the previous pass left off up to the (possibly grown)
+ * commit.
+ */
+
+/**
+ * struct trace_buffer_meta - ring buffer meta page
+ * @meta_page_size:	size of this page
+ * @meta_struct_len:	size of this structure
+ * @subbuf_size:	size of each ring buffer page, header included
+ * @nr_subbufs:		number of ring buffer pages in the mapping
+ * @reader.id:		page of the mapping that is the reader page
+ * @reader.read:	offset in the reader page's data already consumed
+ * @entries:		events written into this buffer
+ * @overrun:		events lost to the writer wrapping around
+ * @read:		events consumed
+ */
+struct trace_buffer_meta {
+	__u32		meta_page_size;
+	__u32		meta_struct_len;
+
+	__u32		subbuf_size;
+	__u32		nr_subbufs;
+
+	struct {
+		__u32	id;
+		__u32	read;
+	} reader;
+
+	__u64		entries;
+	__u64		overrun;
+	__u64		read;
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER		_IO('R', 0x20)
+
+#endif /* _LINUX_TRACE_MMAP_H */
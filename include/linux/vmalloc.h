@@ -44,6 +44,7 @@ extern void *vm_map_ram(struct page **pages, unsigned int count,
 extern void vm_unmap_aliases(void);
 
 #ifdef CONFIG_MMU
+extern unsigned int vmap_lazy_scale;
 extern void __init vmalloc_init(void);
 #else
 static inline void vmalloc_init(void)
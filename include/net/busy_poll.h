@@ -0,0 +1,102 @@
+/*
+ * Busy polling of the device queue a socket receives from.
+ *
+ * A reader that would sleep waiting for a packet can instead run the NAPI
+ * poll routine of the queue the socket's last packet arrived on, and pick
+ * up the next one without waiting for the interrupt, softirq and wakeup.
+ * This trades cpu time for latency, so it is off unless net.core.busy_read
+ * (or SO_BUSY_POLL) and net.core.busy_poll give it a time budget in usecs,
+ * and only works with drivers that register their NAPI contexts with
+ * napi_hash_add().
+ */
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+extern bool __sk_busy_loop(struct sock *sk, unsigned int usecs);
+
+static inline bool sk_busy_loop_allowed(struct sock *sk)
+{
+	return sk->sk_napi_id && !need_resched() && !signal_pending(current);
+}
+
+/* May a blocking read of @sk busy poll for its data? */
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_ll_usec && sk_busy_loop_allowed(sk);
+}
+
+/* Likewise for the first pass of a blocking poll() or select() */
+static inline bool sk_can_busy_poll(struct sock *sk)
+{
+	return sysctl_net_busy_poll && sk_busy_loop_allowed(sk);
+}
+
+/*
+ * Poll the device queue until something is on @sk's receive queue, for
+ * at most SO_BUSY_POLL usecs, or once if @nonblock.  Returns true if
+ * there is something to receive.
+ */
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return __sk_busy_loop(sk, nonblock ? 0 : sk->sk_ll_usec);
+}
+
+static inline void sk_busy_poll(struct sock *sk)
+{
+	__sk_busy_loop(sk, sysctl_net_busy_poll);
+}
+
+/* Called by the drivers for each packet received from @napi */
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+/* Called by the protocols once @skb has found its socket */
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return false;
+}
+
+static inline bool sk_can_busy_poll(struct sock *sk)
+{
+	return false;
+}
+
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return false;
+}
+
+static inline void sk_busy_poll(struct sock *sk)
+{
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
@@ -9,6 +9,7 @@ extern const struct proto_ops		inet_dgram_ops;
  */
 
 struct msghdr;
+struct sk_buff;
 struct sock;
 struct sockaddr;
 struct socket;
@@ -45,6 +46,10 @@ extern int			inet_ctl_sock_create(struct sock **sk,
 						     unsigned char protocol,
 						     struct net *net);
 
+extern struct sk_buff		**inet_gro_receive(struct sk_buff **head,
+						  struct sk_buff *skb);
+extern int			inet_gro_complete(struct sk_buff *skb);
+
 static inline void inet_ctl_sock_destroy(struct sock *sk)
 {
 	sk_release_kernel(sk);
@@ -64,6 +64,12 @@ struct inet_hashinfo;
 
 #define INET_TWDR_TWKILL_QUOTA 100
 
+/*
+ * Expired buckets are unlinked from the death row in batches of this
+ * many and killed after death_lock has been dropped.
+ */
+#define INET_TWDR_REAP_BATCH	32
+
 struct inet_timewait_death_row {
 	/* Short-time timewait calendar */
 	int			twcal_hand;
@@ -110,6 +116,7 @@ struct inet_timewait_sock {
 #define tw_family		__tw_common.skc_family
 #define tw_state		__tw_common.skc_state
 #define tw_reuse		__tw_common.skc_reuse
+#define tw_reuseport		__tw_common.skc_reuseport
 #define tw_bound_dev_if		__tw_common.skc_bound_dev_if
 #define tw_node			__tw_common.skc_nulls_node
 #define tw_bind_node		__tw_common.skc_bind_node
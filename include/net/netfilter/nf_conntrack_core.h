@@ -75,4 +75,14 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 
 extern spinlock_t nf_conntrack_lock ;
 
+/* The hash chains are guarded by an array of spinlocks, chain i by
+ * nf_conntrack_locks[i % CONNTRACK_LOCKS].  They nest inside
+ * nf_conntrack_lock, never the other way round; take them with
+ * nf_conntrack_lock_bucket() and BHs disabled.
+ */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock_bucket(spinlock_t *lock);
+
 #endif /* _NF_CONNTRACK_CORE_H */
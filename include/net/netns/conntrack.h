@@ -3,19 +3,28 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Unconfirmed conntracks, kept on the cpu that created them. */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
 	unsigned int		htable_size;
 	struct kmem_cache	*nf_conntrack_cachep;
+	seqcount_t		generation;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
+	struct ct_pcpu		*pcpu_lists;
 	struct hlist_nulls_head	dying;
 	struct ip_conntrack_stat *stat;
 	int			sysctl_events;
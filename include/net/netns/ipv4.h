@@ -53,6 +53,10 @@ struct netns_ipv4 {
 	int sysctl_rt_cache_rebuild_count;
 	int current_rt_cache_rebuild_count;
 
+	/* TIME_WAIT sockets of this namespace, and their limit (0: none) */
+	atomic_t tw_count;
+	int sysctl_tw_max_buckets;
+
 	struct timer_list rt_secret_timer;
 	atomic_t rt_genid;
 
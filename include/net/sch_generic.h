@@ -47,6 +47,7 @@ struct Qdisc
 #define TCQ_F_INGRESS		4
 #define TCQ_F_CAN_BYPASS	8
 #define TCQ_F_MQROOT		16
+#define TCQ_F_NOLOCK		32
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
@@ -259,6 +260,7 @@ static inline void sch_tree_unlock(struct Qdisc *q)
 extern struct Qdisc noop_qdisc;
 extern struct Qdisc_ops noop_qdisc_ops;
 extern struct Qdisc_ops pfifo_fast_ops;
+extern struct Qdisc_ops pfifo_fast_nolock_ops;
 extern struct Qdisc_ops mq_qdisc_ops;
 
 struct Qdisc_class_common
@@ -167,6 +167,12 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOPT_SACK             5       /* SACK Block */
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 #define TCPOPT_MD5SIG		19	/* MD5 Signature (RFC2385) */
+#define TCPOPT_FASTOPEN		34	/* Fast open (RFC7413) */
+#define TCPOPT_EXP		254	/* Experimental */
+/* Magic number to be after the option value for sharing TCP
+ * experimental options. See draft-ietf-tcpm-experimental-options-00.txt
+ */
+#define TCPOPT_FASTOPEN_MAGIC	0xF989
 
 /*
  *     TCP option lengths
@@ -177,6 +183,8 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_SACK_PERM      2
 #define TCPOLEN_TIMESTAMP      10
 #define TCPOLEN_MD5SIG         18
+#define TCPOLEN_FASTOPEN_BASE  2
+#define TCPOLEN_EXP_FASTOPEN_BASE  4
 
 /* But this is what stacks really send out. */
 #define TCPOLEN_TSTAMP_ALIGNED		12
@@ -188,6 +196,21 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_MD5SIG_ALIGNED		20
 #define TCPOLEN_MSS_ALIGNED		4
 
+/* Fast open cookie as carried in the TCPOPT_FASTOPEN option */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+struct tcp_fastopen_cookie {
+	s8	len;	/* -1 if the SYN had no fast open option */
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+	bool	exp;	/* in the experimental option format */
+};
+
+/* Bits in sysctl_tcp_fastopen */
+#define TFO_SERVER_ENABLE	2	/* accept data in SYN on TCP_FASTOPEN listeners */
+#define TFO_SERVER_COOKIE_NOT_REQD 0x200 /* ... even without a cookie */
+
 /* Flags in tp->nonagle */
 #define TCP_NAGLE_OFF		1	/* Nagle's algo is disabled */
 #define TCP_NAGLE_CORK		2	/* Socket is corked	    */
@@ -237,6 +260,7 @@ extern int sysctl_tcp_base_mss;
 extern int sysctl_tcp_workaround_signed_windows;
 extern int sysctl_tcp_slow_start_after_idle;
 extern int sysctl_tcp_max_ssthresh;
+extern int sysctl_tcp_fastopen;
 
 extern atomic_t tcp_memory_allocated;
 extern struct percpu_counter tcp_sockets_allocated;
@@ -419,7 +443,8 @@ extern int			tcp_recvmsg(struct kiocb *iocb, struct sock *sk,
 
 extern void			tcp_parse_options(struct sk_buff *skb,
 						  struct tcp_options_received *opt_rx,
-						  int estab);
+						  int estab,
+						  struct tcp_fastopen_cookie *foc);
 
 extern u8			*tcp_parse_md5sig_option(struct tcphdr *th);
 
@@ -541,6 +566,8 @@ extern int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 			 sk_read_actor_t recv_actor);
 
 extern void tcp_initialize_rcv_mss(struct sock *sk);
+extern void tcp_init_buffer_space(struct sock *sk);
+extern void tcp_init_metrics(struct sock *sk);
 
 extern int tcp_mtu_to_mss(struct sock *sk, int pmtu);
 extern int tcp_mss_to_mtu(struct sock *sk, int mss);
@@ -1026,6 +1053,10 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
+	tcp_rsk(req)->tfo_cookie = 0;
+	tcp_rsk(req)->tfo_exp = 0;
+	tcp_rsk(req)->listener = NULL;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1510,6 +1541,23 @@ struct tcp_request_sock_ops {
 #endif
 };
 
+/* From tcp_fastopen.c */
+extern void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+				    struct tcp_fastopen_cookie *foc);
+extern bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			       struct request_sock *req,
+			       struct tcp_fastopen_cookie *foc);
+extern bool tcp_fastopen_create_child(struct sock *sk, struct sk_buff *skb,
+				      struct request_sock *req);
+extern void tcp_fastopen_release(struct sock *sk);
+
+/* A passive fast open child that has not seen the handshake's ACK yet. */
+static inline bool tcp_passive_fastopen(const struct sock *sk)
+{
+	return sk->sk_state == TCP_SYN_RECV &&
+	       tcp_sk(sk)->fastopen_rsk != NULL;
+}
+
 extern void tcp_v4_init(void);
 extern void tcp_init(void);
 
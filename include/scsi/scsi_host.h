@@ -342,6 +342,18 @@ struct scsi_host_template {
 	 */
 	enum blk_eh_timer_return (*eh_timed_out)(struct scsi_cmnd *);
 
+	/*
+	 * This is an optional routine that reaps whatever commands have
+	 * completed without waiting for the interrupt, so that tasks
+	 * waiting on their own I/O can spin on the host.  It is called
+	 * in process context with bottom halves disabled and must not
+	 * race with the interrupt path.  Returns the number of commands
+	 * completed.
+	 *
+	 * Status: OPTIONAL
+	 */
+	int (* poll)(struct Scsi_Host *);
+
 	/*
 	 * Name of proc directory
 	 */
@@ -146,6 +146,39 @@ TRACE_EVENT(jbd2_end_commit,
 		  __entry->sync_commit, __entry->head)
 );
 
+TRACE_EVENT(jbd2_commit_latency,
+	TP_PROTO(journal_t *journal, transaction_t *commit_transaction,
+		 u64 commit_time, u64 record_time),
+
+	TP_ARGS(journal, commit_transaction, commit_time, record_time),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,	dev			)
+		__field(	char,	sync_commit		)
+		__field(	int,	transaction		)
+		__field(	u64,	commit_time		)
+		__field(	u64,	record_time		)
+		__field(	u64,	average_time		)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= journal->j_fs_dev->bd_dev;
+		__entry->sync_commit = commit_transaction->t_synchronous_commit;
+		__entry->transaction	= commit_transaction->t_tid;
+		__entry->commit_time	= commit_time;
+		__entry->record_time	= record_time;
+		__entry->average_time	= journal->j_average_commit_time;
+	),
+
+	TP_printk("dev %s transaction %d sync %d commit %lluus "
+		  "commit record %lluus average %lluus",
+		  jbd2_dev_to_name(__entry->dev), __entry->transaction,
+		  __entry->sync_commit,
+		  (unsigned long long) div_u64(__entry->commit_time, 1000),
+		  (unsigned long long) div_u64(__entry->record_time, 1000),
+		  (unsigned long long) div_u64(__entry->average_time, 1000))
+);
+
 TRACE_EVENT(jbd2_submit_inode_data,
 	TP_PROTO(struct inode *inode),
 
@@ -0,0 +1,170 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xen
+
+#if !defined(_TRACE_XEN_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_XEN_H
+
+#include <linux/tracepoint.h>
+#include <xen/interface/xen.h>
+
+#define hypercall_name(op) { __HYPERVISOR_##op, #op }
+#define show_hypercall_name(val)			\
+	__print_symbolic(val,				\
+			 hypercall_name(mmu_update),	\
+			 hypercall_name(multicall),	\
+			 hypercall_name(grant_table_op),\
+			 hypercall_name(mmuext_op),	\
+			 hypercall_name(sched_op),	\
+			 hypercall_name(event_channel_op))
+
+/**
+ * xen_hypercall_entry - called right before entering the hypervisor
+ * @op: hypercall number, __HYPERVISOR_*
+ * @cmd: sub-command for the multiplexed hypercalls, 0 otherwise
+ * @count: number of operations in the batch, 1 if it is not batched
+ *
+ * Together with xen_hypercall_exit on the same cpu this gives the time
+ * spent in the hypervisor.  Any hypercall issued in between from an
+ * interrupt nests inside.
+ */
+TRACE_EVENT(xen_hypercall_entry,
+
+	TP_PROTO(unsigned int op, unsigned int cmd, unsigned int count),
+
+	TP_ARGS(op, cmd, count),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	op		)
+		__field(	unsigned int,	cmd		)
+		__field(	unsigned int,	count		)
+	),
+
+	TP_fast_assign(
+		__entry->op	= op;
+		__entry->cmd	= cmd;
+		__entry->count	= count;
+	),
+
+	TP_printk("%s cmd=%u count=%u", show_hypercall_name(__entry->op),
+		  __entry->cmd, __entry->count)
+);
+
+/**
+ * xen_hypercall_exit - called right after returning from the hypervisor
+ * @op: hypercall number, __HYPERVISOR_*
+ * @cmd: sub-command, as in xen_hypercall_entry
+ * @ret: return value of the hypercall
+ */
+TRACE_EVENT(xen_hypercall_exit,
+
+	TP_PROTO(unsigned int op, unsigned int cmd, long ret),
+
+	TP_ARGS(op, cmd, ret),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	op		)
+		__field(	unsigned int,	cmd		)
+		__field(	long,		ret		)
+	),
+
+	TP_fast_assign(
+		__entry->op	= op;
+		__entry->cmd	= cmd;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("%s cmd=%u ret=%ld", show_hypercall_name(__entry->op),
+		  __entry->cmd, __entry->ret)
+);
+
+/**
+ * xen_mc_flush - called when the multicall batch of this cpu is issued
+ * @mcidx: number of calls in the batch
+ * @argidx: bytes of argument space used by them
+ * @cbidx: number of completion callbacks queued
+ */
+TRACE_EVENT(xen_mc_flush,
+
+	TP_PROTO(unsigned int mcidx, unsigned int argidx, unsigned int cbidx),
+
+	TP_ARGS(mcidx, argidx, cbidx),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	mcidx		)
+		__field(	unsigned int,	argidx		)
+		__field(	unsigned int,	cbidx		)
+	),
+
+	TP_fast_assign(
+		__entry->mcidx	= mcidx;
+		__entry->argidx	= argidx;
+		__entry->cbidx	= cbidx;
+	),
+
+	TP_printk("flushing %u hypercalls, %u arg bytes, %u callbacks",
+		  __entry->mcidx, __entry->argidx, __entry->cbidx)
+);
+
+/**
+ * xen_mmu_update - called for each page table update request to Xen
+ * @ptr: machine address of the first entry to update, plus the command
+ * @val: value of the first entry
+ * @count: number of entries in the request
+ * @domid: domain owning the page tables
+ * @batched: queued as part of a multicall rather than issued directly
+ */
+TRACE_EVENT(xen_mmu_update,
+
+	TP_PROTO(u64 ptr, u64 val, unsigned int count, domid_t domid,
+		 int batched),
+
+	TP_ARGS(ptr, val, count, domid, batched),
+
+	TP_STRUCT__entry(
+		__field(	u64,		ptr		)
+		__field(	u64,		val		)
+		__field(	unsigned int,	count		)
+		__field(	domid_t,	domid		)
+		__field(	int,		batched		)
+	),
+
+	TP_fast_assign(
+		__entry->ptr	= ptr;
+		__entry->val	= val;
+		__entry->count	= count;
+		__entry->domid	= domid;
+		__entry->batched = batched;
+	),
+
+	TP_printk("ptr=%llx val=%llx count=%u dom=%u%s",
+		  (unsigned long long)__entry->ptr,
+		  (unsigned long long)__entry->val,
+		  __entry->count, __entry->domid,
+		  __entry->batched ? " batched" : "")
+);
+
+/**
+ * xen_evtchn_send - called when notifying the remote end of a channel
+ * @port: local port of the event channel
+ */
+TRACE_EVENT(xen_evtchn_send,
+
+	TP_PROTO(int port),
+
+	TP_ARGS(port),
+
+	TP_STRUCT__entry(
+		__field(	int,	port	)
+	),
+
+	TP_fast_assign(
+		__entry->port	= port;
+	),
+
+	TP_printk("port=%d", __entry->port)
+);
+
+#endif /*  _TRACE_XEN_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
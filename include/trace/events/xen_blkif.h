@@ -0,0 +1,244 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xen_blkif
+
+#if !defined(_TRACE_XEN_BLKIF_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_XEN_BLKIF_H
+
+/*
+ * The life of a request on the blkif ring, on both ends.
+ *
+ * A request is known by the virtual device handle and the id the frontend
+ * gave it, plus the guest's domain id on the backend side.  The guest's
+ * xen_blkfront_queue to xen_blkfront_response is the whole latency it
+ * sees; dom0's xen_blkback_request to xen_blkback_response is the part
+ * spent in the backend, of which xen_blkback_submit to the response is
+ * the device's; what is left over is the ring and its notifications.
+ * The same points also go to blktrace as messages (see blkparse), on the
+ * guest's virtual disk and on the dom0 device the vbd maps to.
+ */
+
+#include <linux/tracepoint.h>
+#include <xen/interface/io/blkif.h>
+
+#define blkif_op_name(op) { BLKIF_OP_##op, #op }
+#define show_blkif_op(val)				\
+	__print_symbolic(val,				\
+			 blkif_op_name(READ),		\
+			 blkif_op_name(WRITE),		\
+			 blkif_op_name(WRITE_BARRIER),	\
+			 blkif_op_name(FLUSH_DISKCACHE),\
+			 blkif_op_name(DISCARD),	\
+			 blkif_op_name(INDIRECT))
+
+/**
+ * xen_blkfront_queue - a request was put on the ring, not yet pushed
+ * @handle: virtual device handle
+ * @id: request id, echoed by the response
+ * @op: BLKIF_OP_*, the one carried inside for indirect requests
+ * @sector: first sector
+ * @nr_segs: number of data segments
+ */
+TRACE_EVENT(xen_blkfront_queue,
+
+	TP_PROTO(unsigned int handle, u64 id, unsigned int op, u64 sector,
+		 unsigned int nr_segs),
+
+	TP_ARGS(handle, id, op, sector, nr_segs),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	handle		)
+		__field(	u64,		id		)
+		__field(	unsigned int,	op		)
+		__field(	u64,		sector		)
+		__field(	unsigned int,	nr_segs		)
+	),
+
+	TP_fast_assign(
+		__entry->handle		= handle;
+		__entry->id		= id;
+		__entry->op		= op;
+		__entry->sector		= sector;
+		__entry->nr_segs	= nr_segs;
+	),
+
+	TP_printk("vbd=%u id=%llu %s sector=%llu segs=%u", __entry->handle,
+		  (unsigned long long)__entry->id, show_blkif_op(__entry->op),
+		  (unsigned long long)__entry->sector, __entry->nr_segs)
+);
+
+/**
+ * xen_blkfront_push - the queued requests were made visible to the backend
+ * @handle: virtual device handle
+ * @req_prod: new request producer index
+ * @notify: whether the backend had to be sent an event
+ */
+TRACE_EVENT(xen_blkfront_push,
+
+	TP_PROTO(unsigned int handle, unsigned int req_prod, int notify),
+
+	TP_ARGS(handle, req_prod, notify),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	handle		)
+		__field(	unsigned int,	req_prod	)
+		__field(	int,		notify		)
+	),
+
+	TP_fast_assign(
+		__entry->handle		= handle;
+		__entry->req_prod	= req_prod;
+		__entry->notify		= notify;
+	),
+
+	TP_printk("vbd=%u req_prod=%u%s", __entry->handle, __entry->req_prod,
+		  __entry->notify ? " notify" : "")
+);
+
+/**
+ * xen_blkfront_response - the response to a request was taken off the ring
+ * @handle: virtual device handle
+ * @id: request id
+ * @op: BLKIF_OP_*
+ * @status: BLKIF_RSP_*
+ */
+TRACE_EVENT(xen_blkfront_response,
+
+	TP_PROTO(unsigned int handle, u64 id, unsigned int op, int status),
+
+	TP_ARGS(handle, id, op, status),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	handle		)
+		__field(	u64,		id		)
+		__field(	unsigned int,	op		)
+		__field(	int,		status		)
+	),
+
+	TP_fast_assign(
+		__entry->handle		= handle;
+		__entry->id		= id;
+		__entry->op		= op;
+		__entry->status		= status;
+	),
+
+	TP_printk("vbd=%u id=%llu %s status=%d", __entry->handle,
+		  (unsigned long long)__entry->id, show_blkif_op(__entry->op),
+		  __entry->status)
+);
+
+/**
+ * xen_blkback_request - a request was taken off a guest's ring
+ * @domid: the guest
+ * @handle: virtual device handle
+ * @id: request id
+ * @op: BLKIF_OP_*, the one carried inside for indirect requests
+ * @sector: first sector, in the guest's view of the vbd
+ * @nr_segs: number of data segments
+ */
+TRACE_EVENT(xen_blkback_request,
+
+	TP_PROTO(unsigned int domid, unsigned int handle, u64 id,
+		 unsigned int op, u64 sector, unsigned int nr_segs),
+
+	TP_ARGS(domid, handle, id, op, sector, nr_segs),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	domid		)
+		__field(	unsigned int,	handle		)
+		__field(	u64,		id		)
+		__field(	unsigned int,	op		)
+		__field(	u64,		sector		)
+		__field(	unsigned int,	nr_segs		)
+	),
+
+	TP_fast_assign(
+		__entry->domid		= domid;
+		__entry->handle		= handle;
+		__entry->id		= id;
+		__entry->op		= op;
+		__entry->sector		= sector;
+		__entry->nr_segs	= nr_segs;
+	),
+
+	TP_printk("dom=%u vbd=%u id=%llu %s sector=%llu segs=%u",
+		  __entry->domid, __entry->handle,
+		  (unsigned long long)__entry->id, show_blkif_op(__entry->op),
+		  (unsigned long long)__entry->sector, __entry->nr_segs)
+);
+
+/**
+ * xen_blkback_submit - the bios of a request were built for the device
+ * @domid: the guest
+ * @handle: virtual device handle
+ * @id: request id
+ * @op: BLKIF_OP_*
+ */
+TRACE_EVENT(xen_blkback_submit,
+
+	TP_PROTO(unsigned int domid, unsigned int handle, u64 id,
+		 unsigned int op),
+
+	TP_ARGS(domid, handle, id, op),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	domid		)
+		__field(	unsigned int,	handle		)
+		__field(	u64,		id		)
+		__field(	unsigned int,	op		)
+	),
+
+	TP_fast_assign(
+		__entry->domid		= domid;
+		__entry->handle		= handle;
+		__entry->id		= id;
+		__entry->op		= op;
+	),
+
+	TP_printk("dom=%u vbd=%u id=%llu %s", __entry->domid, __entry->handle,
+		  (unsigned long long)__entry->id, show_blkif_op(__entry->op))
+);
+
+/**
+ * xen_blkback_response - the response to a request was put on the ring
+ * @domid: the guest
+ * @handle: virtual device handle
+ * @id: request id
+ * @op: BLKIF_OP_*
+ * @status: BLKIF_RSP_*
+ * @notify: whether the guest had to be sent an event
+ */
+TRACE_EVENT(xen_blkback_response,
+
+	TP_PROTO(unsigned int domid, unsigned int handle, u64 id,
+		 unsigned int op, int status, int notify),
+
+	TP_ARGS(domid, handle, id, op, status, notify),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	domid		)
+		__field(	unsigned int,	handle		)
+		__field(	u64,		id		)
+		__field(	unsigned int,	op		)
+		__field(	int,		status		)
+		__field(	int,		notify		)
+	),
+
+	TP_fast_assign(
+		__entry->domid		= domid;
+		__entry->handle		= handle;
+		__entry->id		= id;
+		__entry->op		= op;
+		__entry->status		= status;
+		__entry->notify		= notify;
+	),
+
+	TP_printk("dom=%u vbd=%u id=%llu %s status=%d%s", __entry->domid,
+		  __entry->handle, (unsigned long long)__entry->id,
+		  show_blkif_op(__entry->op), __entry->status,
+		  __entry->notify ? " notify" : "")
+);
+
+#endif /* _TRACE_XEN_BLKIF_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
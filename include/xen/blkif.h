@@ -93,6 +93,15 @@ enum blkif_protocol {
 static void inline blkif_get_x86_32_req(struct blkif_request *dst, struct blkif_x86_32_request *src)
 {
 	int i, n = BLKIF_MAX_SEGMENTS_PER_REQUEST;
+	if (src->operation == BLKIF_OP_INDIRECT) {
+		/* Laid out the same way on every ABI. */
+		memcpy(dst, src, sizeof(struct blkif_request_indirect));
+		return;
+	}
+	if (src->operation == BLKIF_OP_DISCARD) {
+		memcpy(dst, src, sizeof(struct blkif_request_discard));
+		return;
+	}
 	dst->operation = src->operation;
 	dst->nr_segments = src->nr_segments;
 	dst->handle = src->handle;
@@ -108,6 +117,15 @@ static void inline blkif_get_x86_32_req(struct blkif_request *dst, struct blkif_
 static void inline blkif_get_x86_64_req(struct blkif_request *dst, struct blkif_x86_64_request *src)
 {
 	int i, n = BLKIF_MAX_SEGMENTS_PER_REQUEST;
+	if (src->operation == BLKIF_OP_INDIRECT) {
+		/* Laid out the same way on every ABI. */
+		memcpy(dst, src, sizeof(struct blkif_request_indirect));
+		return;
+	}
+	if (src->operation == BLKIF_OP_DISCARD) {
+		memcpy(dst, src, sizeof(struct blkif_request_discard));
+		return;
+	}
 	dst->operation = src->operation;
 	dst->nr_segments = src->nr_segments;
 	dst->handle = src->handle;
@@ -12,6 +12,11 @@ int bind_evtchn_to_irqhandler(unsigned int evtchn,
 			      irq_handler_t handler,
 			      unsigned long irqflags, const char *devname,
 			      void *dev_id);
+int bind_evtchn_to_threaded_irqhandler(unsigned int evtchn,
+				       irq_handler_t handler,
+				       irq_handler_t thread_fn,
+				       unsigned long irqflags,
+				       const char *devname, void *dev_id);
 int bind_virq_to_irq(unsigned int virq, unsigned int cpu);
 
 int bind_virq_to_irqhandler(unsigned int virq, unsigned int cpu,
@@ -30,6 +35,13 @@ int bind_interdomain_evtchn_to_irqhandler(unsigned int remote_domain,
 					  unsigned long irqflags,
 					  const char *devname,
 					  void *dev_id);
+int bind_interdomain_evtchn_to_threaded_irqhandler(unsigned int remote_domain,
+						   unsigned int remote_port,
+						   irq_handler_t handler,
+						   irq_handler_t thread_fn,
+						   unsigned long irqflags,
+						   const char *devname,
+						   void *dev_id);
 
 /*
  * Common unbind function for all event sources. Takes IRQ to unbind from.
@@ -45,6 +57,8 @@ void rebind_evtchn_irq(int evtchn, int irq);
 static inline void notify_remote_via_evtchn(int port)
 {
 	struct evtchn_send send = { .port = port };
+
+	trace_xen_evtchn_send(port);
 	(void)HYPERVISOR_event_channel_op(EVTCHNOP_send, &send);
 }
 
@@ -68,6 +82,19 @@ void xen_poll_irq_timeout(int irq, u64 timeout);
 /* Determine the IRQ which is bound to an event channel */
 unsigned irq_from_evtchn(unsigned int evtchn);
 
+/* Number of ports the event channel ABI in use can address. */
+unsigned xen_evtchn_max_channels(void);
+
+/*
+ * Priority of the queue an irq's events are delivered on, with the
+ * FIFO-based ABI.  Lower values preempt higher ones.
+ */
+#define XEN_IRQ_PRIORITY_MAX     EVTCHN_FIFO_PRIORITY_MAX
+#define XEN_IRQ_PRIORITY_DEFAULT EVTCHN_FIFO_PRIORITY_DEFAULT
+#define XEN_IRQ_PRIORITY_MIN     EVTCHN_FIFO_PRIORITY_MIN
+
+int xen_set_irq_priority(unsigned irq, unsigned priority);
+
 /* Allocate an irq for a physical interrupt, given a gsi.  "Legacy"
    GSIs are identity mapped; others are dynamically allocated as
    usual. */
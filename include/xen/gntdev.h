@@ -116,4 +116,74 @@ struct ioctl_gntdev_set_max_grants {
 	uint32_t count;
 };
 
+/*
+ * Inserts several ranges of grant references into the mapping table in
+ * one call, as if IOCTL_GNTDEV_MAP_GRANT_REF had been issued for each.
+ * Each range gets its own @index for mmap() and unmap.  Either all
+ * ranges are inserted or, on error, none are.
+ */
+#define IOCTL_GNTDEV_MAP_GRANT_REF_BATCH \
+_IOC(_IOC_NONE, 'G', 4, sizeof(struct ioctl_gntdev_map_grant_ref_batch))
+struct ioctl_gntdev_map_range {
+	/* IN parameters */
+	/* The number of grants in @refs. */
+	uint32_t count;
+	uint32_t pad;
+	/* Address of an array of @count struct ioctl_gntdev_grant_ref. */
+	uint64_t refs;
+	/* OUT parameters */
+	/* The offset to be used on a subsequent call to mmap(). */
+	uint64_t index;
+};
+
+struct ioctl_gntdev_map_grant_ref_batch {
+	/* IN parameters */
+	/* The number of ranges in @ranges. */
+	uint32_t count;
+	uint32_t pad;
+	/* Address of an array of @count struct ioctl_gntdev_map_range. */
+	uint64_t ranges;
+};
+
+/*
+ * Copies between grant references and local buffers with
+ * GNTTABOP_copy, without mapping anything.
+ *
+ * Each segment copies @len bytes from @source to @dest.  A side with
+ * its GNTCOPY_*_gref bit set in @flags is a grant (@foreign), the
+ * other is an address in the caller (@virt).  At least one side must
+ * be a grant, and a grant side must not cross a page.
+ *
+ * @status of each segment is set to the GNTST_* result of its copy.
+ * The ioctl itself only fails if the arguments are bad; a failed copy
+ * is reported in @status alone.
+ */
+#define IOCTL_GNTDEV_GRANT_COPY \
+_IOC(_IOC_NONE, 'G', 5, sizeof(struct ioctl_gntdev_grant_copy))
+struct gntdev_grant_copy_segment {
+	union {
+		/* Local buffer. */
+		uint64_t virt;
+		struct {
+			uint32_t ref;
+			uint16_t offset;
+			uint16_t domid;
+		} foreign;
+	} source, dest;
+	uint16_t len;
+	uint16_t flags;  /* GNTCOPY_* */
+	/* OUT parameters */
+	int16_t status;  /* GNTST_* */
+	uint16_t pad;
+};
+
+struct ioctl_gntdev_grant_copy {
+	/* IN parameters */
+	/* The number of segments in @segments. */
+	uint32_t count;
+	uint32_t pad;
+	/* Address of an array of @count struct gntdev_grant_copy_segment. */
+	uint64_t segments;
+};
+
 #endif /* __LINUX_PUBLIC_GNTDEV_H__ */
@@ -66,6 +66,25 @@ int gnttab_resume(void);
 int gnttab_grant_foreign_access(domid_t domid, unsigned long frame,
 				int readonly);
 
+/*
+ * Sub-page and transitive grants need a version 2 grant table; they
+ * return -ENOSYS on a version 1 table.  @flags may only carry
+ * GTF_readonly and the cache attribute bits.  Returns the new
+ * reference, or a negative error.
+ */
+int gnttab_grant_foreign_access_subpage(domid_t domid, unsigned long frame,
+					int flags, unsigned page_off,
+					unsigned length);
+int gnttab_grant_foreign_access_trans(domid_t domid, int flags,
+				      domid_t trans_domid,
+				      grant_ref_t trans_gref);
+
+/*
+ * Are sub-page and transitive grants available on this version of Xen?
+ */
+bool gnttab_subpage_grants_available(void);
+bool gnttab_trans_grants_available(void);
+
 /*
  * End access through the given grant reference, iff the grant entry is no
  * longer in use.  Return 1 if the grant entry was freed, 0 if it is still in
@@ -91,6 +110,15 @@ int gnttab_query_foreign_access(grant_ref_t ref);
 
 int gnttab_copy_grant_page(grant_ref_t ref, struct page **pagep);
 
+/*
+ * Batched map/unmap for backends: one hypercall per batch, with the p2m
+ * of @pages (may be NULL) updated to match.
+ */
+int gnttab_map_refs(struct gnttab_map_grant_ref *map_ops,
+		    struct page **pages, unsigned int count);
+int gnttab_unmap_refs(struct gnttab_unmap_grant_ref *unmap_ops,
+		      struct page **pages, unsigned int count);
+
 /*
  * operations on reserved batches of grant references
  */
@@ -113,6 +141,13 @@ void gnttab_cancel_free_callback(struct gnttab_free_callback *callback);
 
 void gnttab_grant_foreign_access_ref(grant_ref_t ref, domid_t domid,
 				     unsigned long frame, int readonly);
+int gnttab_grant_foreign_access_subpage_ref(grant_ref_t ref, domid_t domid,
+					    unsigned long frame, int flags,
+					    unsigned page_off,
+					    unsigned length);
+int gnttab_grant_foreign_access_trans_ref(grant_ref_t ref, domid_t domid,
+					  int flags, domid_t trans_domid,
+					  grant_ref_t trans_gref);
 
 void gnttab_grant_foreign_transfer_ref(grant_ref_t, domid_t domid,
 				       unsigned long pfn);
@@ -150,8 +185,12 @@ gnttab_set_unmap_op(struct gnttab_unmap_grant_ref *unmap, phys_addr_t addr,
 
 int arch_gnttab_map_shared(unsigned long *frames, unsigned long nr_gframes,
 			   unsigned long max_nr_gframes,
-			   struct grant_entry **__shared);
-void arch_gnttab_unmap_shared(struct grant_entry *shared,
+			   void **__shared);
+int arch_gnttab_map_status(uint64_t *frames, unsigned long nr_gframes,
+			   unsigned long max_nr_gframes,
+			   grant_status_t **__shared);
+void arch_gnttab_unmap_shared(void *shared, unsigned long nr_gframes);
+void arch_gnttab_unmap_status(grant_status_t *shared,
 			      unsigned long nr_gframes);
 
 extern unsigned long xen_hvm_resume_frames;
@@ -24,6 +24,27 @@
  * rsp_event appropriately (e.g., using RING_FINAL_CHECK_FOR_RESPONSES()).
  */
 
+/*
+ * Multi-page rings:
+ * A backend that can map a ring spread over several pages writes
+ * "max-ring-page-order", the log2 of the largest number of pages it
+ * accepts.  A frontend that uses more than one page writes the order it
+ * chose as "ring-page-order" and the grant references of the pages, in
+ * ring order, as "ring-ref0" .. "ring-ref(2^order - 1)" instead of
+ * "ring-ref".
+ */
+#define BLKIF_MAX_RING_PAGE_ORDER 3
+#define BLKIF_MAX_RING_PAGES      (1U << BLKIF_MAX_RING_PAGE_ORDER)
+
+/*
+ * Persistent grants:
+ * A backend that can keep data pages mapped across requests writes
+ * "feature-persistent" = 1.  A frontend writing "feature-persistent" = 1
+ * in return promises to do I/O only through pages it keeps granted,
+ * writable, until the rings are torn down, copying data in and out of
+ * them.  The backend may keep any of them mapped from first use on.
+ */
+
 typedef uint16_t blkif_vdev_t;
 typedef uint64_t blkif_sector_t;
 
@@ -43,6 +64,32 @@ typedef uint64_t blkif_sector_t;
  * create the "feature-barrier" node!
  */
 #define BLKIF_OP_WRITE_BARRIER     2
+/*
+ * Recognised only if "feature-flush-cache" is present in backend xenbus
+ * info.  The request carries no segments: the backend has everything it
+ * completed before the flush made durable before answering.  Ordering
+ * against requests still in flight is the frontend's business, which
+ * spares the backend the full drain a barrier implies.  A device without
+ * a cache to flush may fail it with BLKIF_RSP_EOPNOTSUPP.
+ */
+#define BLKIF_OP_FLUSH_DISKCACHE   3
+/*
+ * Recognised only if "feature-max-indirect-segments" is present in backend
+ * xenbus info.  The value is the largest number of segments the backend
+ * accepts in a single indirect request.  The request slot holds a struct
+ * blkif_request_indirect naming the real operation and the granted pages
+ * that hold the segment list, BLKIF_SEGS_PER_INDIRECT_FRAME segments per
+ * page.  The response echoes the real operation.
+ */
+#define BLKIF_OP_INDIRECT          6
+/*
+ * Recognised only if "feature-discard" is present in backend xenbus info.
+ * The request slot holds a struct blkif_request_discard: the backend may
+ * throw away the contents of the sectors named, which read back as
+ * undefined afterwards.  A device that turns out not to support it fails
+ * the request with BLKIF_RSP_EOPNOTSUPP.
+ */
+#define BLKIF_OP_DISCARD           5
 
 /*
  * Maximum scatter/gather segments per request.
@@ -65,6 +112,37 @@ struct blkif_request {
 	} seg[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 };
 
+/*
+ * Laid out identically for all ABIs, and no larger than the smallest
+ * struct blkif_request, so it needs no translation in the backend.
+ */
+#define BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST 8
+#define BLKIF_SEGS_PER_INDIRECT_FRAME \
+	(PAGE_SIZE / sizeof(struct blkif_request_segment))
+
+struct blkif_request_indirect {
+	uint8_t        operation;    /* BLKIF_OP_INDIRECT                    */
+	uint8_t        indirect_op;  /* BLKIF_OP_{READ,WRITE,WRITE_BARRIER}  */
+	uint16_t       nr_segments;  /* number of segments in the pages      */
+	uint32_t       _pad1;
+	uint64_t       id;           /* private guest value, echoed in resp  */
+	blkif_sector_t sector_number;/* start sector idx on disk             */
+	blkif_vdev_t   handle;
+	uint16_t       _pad2[3];
+	grant_ref_t    indirect_grefs[BLKIF_MAX_INDIRECT_PAGES_PER_REQUEST];
+};
+
+/* Laid out the same way on every ABI, like blkif_request_indirect. */
+struct blkif_request_discard {
+	uint8_t        operation;    /* BLKIF_OP_DISCARD                     */
+	uint8_t        _pad1;
+	blkif_vdev_t   handle;
+	uint32_t       _pad2;
+	uint64_t       id;           /* private guest value, echoed in resp  */
+	blkif_sector_t sector_number;/* start sector idx on disk             */
+	uint64_t       nr_sectors;   /* number of sectors to discard         */
+};
+
 struct blkif_response {
 	uint64_t        id;              /* copied from request */
 	uint8_t         operation;       /* copied from request */
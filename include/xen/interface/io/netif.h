@@ -20,6 +20,32 @@
  * that it cannot safely queue packets (as it may not be kicked to send them).
  */
 
+/*
+ * Multiple transmit and receive queues:
+ * If supported, the backend will write the key "multi-queue-max-queues" to
+ * the directory for that vif, and set its value to the maximum supported
+ * number of queues.
+ * Frontends that are aware of this feature and wish to use it can write the
+ * key "multi-queue-num-queues", set to the number they wish to use, which
+ * must be greater than zero, and no more than the value reported by the
+ * backend in "multi-queue-max-queues".
+ *
+ * Queues replicate the shared rings and event channels: with more than one
+ * queue "tx-ring-ref", "rx-ring-ref" and "event-channel" are written under
+ * "queue-0" .. "queue-(N-1)" subdirectories of the frontend's directory
+ * instead of the frontend's directory itself.
+ */
+
+/*
+ * Persistent grants:
+ * A backend that can keep transmit buffers mapped across requests writes
+ * "feature-persistent" = 1.  A frontend writing "feature-persistent" = 1
+ * in return promises to transmit only out of a fixed pool of granted
+ * pages, at most one per tx ring slot, which stay granted until the rings
+ * are torn down.  The backend maps each of them on first use and copies
+ * packet data out of the mapping from then on.
+ */
+
 /*
  * This is the 'wire' format for packets:
  *  Request 1: netif_tx_request -- NETTXF_* (any flags)
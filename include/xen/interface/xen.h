@@ -58,6 +58,8 @@
 #define __HYPERVISOR_event_channel_op     32
 #define __HYPERVISOR_physdev_op           33
 #define __HYPERVISOR_hvm_op               34
+#define __HYPERVISOR_tmem_op              38
+#define __HYPERVISOR_xenpmu_op            40
 
 /* Architecture-specific hypercall definitions. */
 #define __HYPERVISOR_arch_0               48
@@ -80,6 +82,7 @@
 #define VIRQ_DOM_EXC    3  /* (DOM0) Exceptional event for some domain.   */
 #define VIRQ_DEBUGGER   6  /* (DOM0) A domain has paused for debugging.   */
 #define VIRQ_PCPU_STATE 9  /* (DOM0) PCPU state changed                   */
+#define VIRQ_XENPMU     13 /* PMC interrupt                               */
 
 /* Architecture-specific VIRQ definitions. */
 #define VIRQ_ARCH_0    16
@@ -312,9 +315,13 @@ struct vcpu_time_info {
 	 */
 	uint32_t tsc_to_system_mul;
 	int8_t   tsc_shift;
-	int8_t   pad1[3];
+	uint8_t  flags;
+	int8_t   pad1[2];
 }; /* 32 bytes */
 
+/* The TSC is synchronised across vcpus, so system time is as well. */
+#define XEN_PVCLOCK_TSC_STABLE_BIT	(1 << 0)
+
 struct vcpu_info {
 	/*
 	 * 'evtchn_upcall_pending' is written non-zero by Xen to indicate
@@ -17,6 +17,12 @@ struct pcpu {
 	uint32_t apic_id;
 	uint32_t acpi_id;
 	uint32_t flags;
+
+	/* dom0 pcpu governor state, see pcpu.c */
+	uint64_t last_idle;
+	uint32_t load;		/* percent busy over the last sample */
+	int perf_pool;		/* latency sensitive: keep at top speed */
+	int pstate;		/* P-state last requested, -1 if none */
 };
 
 static inline int xen_pcpu_online(uint32_t flags)
@@ -29,4 +35,7 @@ extern int register_xen_pcpu_notifier(struct notifier_block *nb);
 extern void unregister_xen_pcpu_notifier(struct notifier_block *nb);
 
 extern int xen_pcpu_index(uint32_t acpi_id, int is_acpiid);
+
+extern void xen_pcpu_set_pstates(uint32_t acpi_id, unsigned int count,
+				 const uint32_t *mhz, unsigned int limit);
 #endif
@@ -19,6 +19,10 @@ int xen_remap_domain_mfn_range(struct vm_area_struct *vma,
 			       unsigned long addr,
 			       unsigned long mfn, int nr,
 			       pgprot_t prot, unsigned domid);
+int xen_remap_domain_mfn_array(struct vm_area_struct *vma,
+			       unsigned long addr,
+			       unsigned long *mfn, int nr, int *err,
+			       pgprot_t prot, unsigned domid);
 
 extern unsigned long *xen_contiguous_bitmap;
 int xen_create_contiguous_region(unsigned long vstart, unsigned int order,
@@ -27,4 +31,9 @@ int xen_create_contiguous_region(unsigned long vstart, unsigned int order,
 void xen_destroy_contiguous_region(unsigned long vstart, unsigned int order);
 int xen_setup_shutdown_event(void);
 
+#ifdef CONFIG_XEN_DEBUG_FS
+/* The "xen" debugfs directory, created on first use. */
+struct dentry *xen_init_debugfs(void);
+#endif
+
 #endif /* INCLUDE_XEN_OPS_H */
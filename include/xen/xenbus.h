@@ -55,16 +55,36 @@ struct xenbus_watch
 	/* Callback (executed in a process context with no locks held). */
 	void (*callback)(struct xenbus_watch *,
 			 const char **vec, unsigned int len);
+
+	/*
+	 * Events with the same non-zero key are run in order, but may run
+	 * concurrently with those of other keys.  Key 0 (the default) keeps
+	 * an event ordered against all others.  get_key, if set, picks the
+	 * key of each event instead.
+	 */
+	unsigned int key;
+	unsigned int (*get_key)(struct xenbus_watch *,
+				const char **vec, unsigned int len);
 };
 
 
 /* A xenbus device. */
+/* A cached xenstore subtree, see xenbus_cache_subtree(). */
+struct xenbus_cache {
+	struct xenbus_watch watch;
+	struct list_head list;
+	struct list_head entries;
+	unsigned int nr_entries;
+	unsigned long seq;
+};
+
 struct xenbus_device {
 	const char *devicetype;
 	const char *nodename;
 	const char *otherend;
 	int otherend_id;
 	struct xenbus_watch otherend_watch;
+	struct xenbus_cache otherend_cache;
 	struct device dev;
 	enum xenbus_state state;
 	struct completion down;
@@ -170,9 +190,13 @@ void unregister_xenstore_notifier(struct notifier_block *nb);
 
 int register_xenbus_watch(struct xenbus_watch *watch);
 void unregister_xenbus_watch(struct xenbus_watch *watch);
+int xenbus_cache_subtree(struct xenbus_cache *cache, const char *path);
+void xenbus_uncache_subtree(struct xenbus_cache *cache);
 void xs_suspend(void);
 void xs_resume(void);
 void xs_suspend_cancel(void);
+void xenbus_dev_resume_start_async(void);
+void xenbus_dev_resume_wait(void);
 
 /* Used by xenbus_dev to borrow kernel's store connection. */
 void *xenbus_dev_request_and_reply(struct xsd_sockmsg *msg);
@@ -89,7 +89,6 @@
 
 #define sem_ids(ns)	((ns)->ids[IPC_SEM_IDS])
 
-#define sem_unlock(sma)		ipc_unlock(&(sma)->sem_perm)
 #define sem_checkid(sma, semid)	ipc_checkid(&sma->sem_perm, semid)
 
 static int newary(struct ipc_namespace *, struct ipc_params *);
@@ -106,10 +105,27 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *	sem_undo.id_next,
  *	sem_array.sem_pending{,last},
  *	sem_array.sem_undo: sem_lock() for read/write
+ *	sem.sem_pending: sem.lock, or sem_lock()
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
  *	
  */
 
+/*
+ * Locking of the semaphore values:
+ * A semop on a single semaphore only takes that semaphore's lock, so
+ * that semops on different semaphores of one array run in parallel.
+ * Everything else - semops on several semaphores, semctl, exit_sem and
+ * IPC_RMID - takes sem_perm.lock and then waits until no single
+ * semaphore semop is running, by taking and dropping each semaphore's
+ * lock once sma->use_global_lock is set.  While it is set, single
+ * semaphore semops take sem_perm.lock as well.  It stays set while
+ * operations on several semaphores are queued, since those have to see
+ * every update, and for USE_GLOBAL_LOCK_HYSTERESIS more sem_unlock()s
+ * after that, so that mixed workloads do not wait for all the locks on
+ * every call.
+ */
+#define USE_GLOBAL_LOCK_HYSTERESIS	10
+
 #define sc_semmsl	sem_ctls[0]
 #define sc_semmns	sem_ctls[1]
 #define sc_semopm	sem_ctls[2]
@@ -141,41 +157,88 @@ void __init sem_init (void)
 				IPC_SEM_IDS, sysvipc_sem_proc_show);
 }
 
+/*
+ * Called with sem_perm.lock held: make the single semaphore semops take
+ * it too, and wait for those already running.
+ */
+static void sem_wait_array(struct sem_array *sma)
+{
+	int i;
+
+	if (sma->use_global_lock) {
+		sma->use_global_lock = USE_GLOBAL_LOCK_HYSTERESIS;
+		return;
+	}
+	sma->use_global_lock = USE_GLOBAL_LOCK_HYSTERESIS;
+
+	for (i = 0; i < sma->sem_nsems; i++) {
+		spin_lock(&sma->sem_base[i].lock);
+		spin_unlock(&sma->sem_base[i].lock);
+	}
+}
+
+/* Called with sem_perm.lock held, before dropping it */
+static void sem_try_leave_array(struct sem_array *sma)
+{
+	if (sma->complex_count || !sma->use_global_lock)
+		return;
+
+	if (sma->use_global_lock == 1) {
+		/* everything written under sem_perm.lock before the clear */
+		smp_mb();
+		sma->use_global_lock = 0;
+	} else
+		sma->use_global_lock--;
+}
+
 /*
  * sem_lock_(check_) routines are called in the paths where the rw_mutex
- * is not held.
+ * is not held.  They lock the whole array.
  */
 static inline struct sem_array *sem_lock(struct ipc_namespace *ns, int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock(&sem_ids(ns), id);
+	struct sem_array *sma;
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
 
-	return container_of(ipcp, struct sem_array, sem_perm);
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
 }
 
 static inline struct sem_array *sem_lock_check(struct ipc_namespace *ns,
 						int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock_check(&sem_ids(ns), id);
+	struct sem_array *sma;
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
 
-	return container_of(ipcp, struct sem_array, sem_perm);
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
+}
+
+static inline void sem_unlock(struct sem_array *sma)
+{
+	sem_try_leave_array(sma);
+	ipc_unlock(&sma->sem_perm);
 }
 
 static inline void sem_lock_and_putref(struct sem_array *sma)
 {
 	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_wait_array(sma);
 	ipc_rcu_putref(sma);
 }
 
 static inline void sem_getref_and_unlock(struct sem_array *sma)
 {
 	ipc_rcu_getref(sma);
-	ipc_unlock(&(sma)->sem_perm);
+	sem_unlock(sma);
 }
 
 static inline void sem_putref(struct sem_array *sma)
@@ -185,6 +248,69 @@ static inline void sem_putref(struct sem_array *sma)
 	ipc_unlock(&(sma)->sem_perm);
 }
 
+/*
+ * Look up a semaphore array for semtimedop.  Called inside an rcu read
+ * side critical section, the array is not locked.
+ */
+static inline struct sem_array *sem_obtain_object_check(
+					struct ipc_namespace *ns, int id)
+{
+	struct kern_ipc_perm *ipcp;
+
+	ipcp = ipc_obtain_object_check(&sem_ids(ns), id);
+	if (IS_ERR(ipcp))
+		return (struct sem_array *)ipcp;
+
+	return container_of(ipcp, struct sem_array, sem_perm);
+}
+
+/*
+ * Lock what the semops @sops need: the one semaphore's lock if there is
+ * only one and no operation needs the whole array, else sem_perm.lock.
+ * Returns the number of the semaphore locked, or -1 for the array; the
+ * caller holds the rcu read lock that keeps @sma around.
+ */
+static int sem_lock_ops(struct sem_array *sma, struct sembuf *sops, int nsops)
+{
+	struct sem *sem;
+
+	if (nsops == 1) {
+		sem = sma->sem_base + sops->sem_num;
+
+		if (!ACCESS_ONCE(sma->use_global_lock)) {
+			spin_lock(&sem->lock);
+			/* pairs with the smp_mb() in sem_try_leave_array() */
+			if (!ACCESS_ONCE(sma->use_global_lock)) {
+				smp_rmb();
+				return sops->sem_num;
+			}
+			spin_unlock(&sem->lock);
+		}
+
+		spin_lock(&sma->sem_perm.lock);
+		if (!sma->use_global_lock) {
+			/* the array users went away while we waited */
+			spin_lock(&sem->lock);
+			spin_unlock(&sma->sem_perm.lock);
+			return sops->sem_num;
+		}
+		return -1;
+	}
+
+	spin_lock(&sma->sem_perm.lock);
+	sem_wait_array(sma);
+	return -1;
+}
+
+static void sem_unlock_ops(struct sem_array *sma, int locknum)
+{
+	if (locknum == -1) {
+		sem_try_leave_array(sma);
+		spin_unlock(&sma->sem_perm.lock);
+	} else
+		spin_unlock(&sma->sem_base[locknum].lock);
+}
+
 static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
 {
 	ipc_rmid(&sem_ids(ns), &s->sem_perm);
@@ -195,7 +321,7 @@ static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
  * Without the check/retry algorithm a lockless wakeup is possible:
  * - queue.status is initialized to -EINTR before blocking.
  * - wakeup is performed by
- *	* unlinking the queue entry from sma->sem_pending
+ *	* unlinking the queue entry from its pending list
  *	* setting queue.status to IN_WAKEUP
  *	  This is the notification for the blocked thread that a
  *	  result value is imminent.
@@ -241,6 +367,7 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 	key_t key = params->key;
 	int nsems = params->u.nsems;
 	int semflg = params->flg;
+	int i;
 
 	if (!nsems)
 		return -EINVAL;
@@ -264,6 +391,17 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 		return retval;
 	}
 
+	/* semtimedop finds the array without sem_perm.lock */
+	sma->sem_base = (struct sem *) &sma[1];
+	for (i = 0; i < nsems; i++) {
+		spin_lock_init(&sma->sem_base[i].lock);
+		INIT_LIST_HEAD(&sma->sem_base[i].sem_pending);
+	}
+	INIT_LIST_HEAD(&sma->sem_pending);
+	INIT_LIST_HEAD(&sma->list_id);
+	sma->sem_nsems = nsems;
+	sma->sem_ctime = get_seconds();
+
 	id = ipc_addid(&sem_ids(ns), &sma->sem_perm, ns->sc_semmni);
 	if (id < 0) {
 		security_sem_free(sma);
@@ -272,11 +410,6 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 	}
 	ns->used_sems += nsems;
 
-	sma->sem_base = (struct sem *) &sma[1];
-	INIT_LIST_HEAD(&sma->sem_pending);
-	INIT_LIST_HEAD(&sma->list_id);
-	sma->sem_nsems = nsems;
-	sma->sem_ctime = get_seconds();
 	sem_unlock(sma);
 
 	return sma->sem_perm.id;
@@ -398,16 +531,25 @@ undo:
 	return result;
 }
 
-/* Go through the pending queue for the indicated semaphore
- * looking for tasks that can be completed.
+/* Go through the pending queue for the indicated semaphore, or the one
+ * of the operations on several semaphores for semnum -1, looking for
+ * tasks that can be completed.  Returns whether any of them altered
+ * the array.
  */
-static void update_queue (struct sem_array * sma)
+static int update_queue(struct sem_array *sma, int semnum)
 {
 	int error;
+	int semop_completed = 0;
+	struct list_head *pending;
 	struct sem_queue * q;
 
-	q = list_entry(sma->sem_pending.next, struct sem_queue, list);
-	while (&q->list != &sma->sem_pending) {
+	if (semnum == -1)
+		pending = &sma->sem_pending;
+	else
+		pending = &sma->sem_base[semnum].sem_pending;
+
+	q = list_entry(pending->next, struct sem_queue, list);
+	while (&q->list != pending) {
 		error = try_atomic_semop(sma, q->sops, q->nsops,
 					 q->undo, q->pid);
 
@@ -428,19 +570,23 @@ static void update_queue (struct sem_array * sma)
 			 * The order of list_del() and reading ->next
 			 * is crucial: In the former case, the list_del()
 			 * must be done first [because we might be the
-			 * first entry in ->sem_pending], in the latter
+			 * first entry in the list], in the latter
 			 * case the list_del() must be done last
 			 * [because the list is invalid after the list_del()]
 			 */
 			if (q->alter) {
 				list_del(&q->list);
-				n = list_entry(sma->sem_pending.next,
+				n = list_entry(pending->next,
 						struct sem_queue, list);
+				if (!error)
+					semop_completed = 1;
 			} else {
 				n = list_entry(q->list.next, struct sem_queue,
 						list);
 				list_del(&q->list);
 			}
+			if (q->nsops > 1)
+				sma->complex_count--;
 
 			/* wake up the waiting thread */
 			q->status = IN_WAKEUP;
@@ -456,6 +602,67 @@ static void update_queue (struct sem_array * sma)
 			q = list_entry(q->list.next, struct sem_queue, list);
 		}
 	}
+	return semop_completed;
+}
+
+/*
+ * Wake up whatever the semops @sops made possible, or, for @sops NULL,
+ * whatever a change anywhere in the array did.  Without operations on
+ * several semaphores queued, only the queues of the semaphores that
+ * were altered need a look; with them, completing one waiter can allow
+ * another on any semaphore, so go over everything until nothing moves.
+ */
+static void do_smart_update(struct sem_array *sma, struct sembuf *sops,
+			    int nsops)
+{
+	int i, progress;
+
+	if (sma->complex_count || !sops) {
+		do {
+			progress = update_queue(sma, -1);
+			for (i = 0; i < sma->sem_nsems; i++)
+				progress |= update_queue(sma, i);
+		} while (progress && sma->complex_count);
+		return;
+	}
+
+	for (i = 0; i < nsops; i++) {
+		if (sops[i].sem_op)
+			update_queue(sma, sops[i].sem_num);
+	}
+}
+
+/* Add the per semaphore and the array queue's waiters matching @match */
+static int count_sem_waiters(struct sem_array *sma, ushort semnum,
+			     int (*match)(struct sembuf *sop))
+{
+	struct list_head *pending[2];
+	struct sem_queue *q;
+	int i, j, count = 0;
+
+	pending[0] = &sma->sem_base[semnum].sem_pending;
+	pending[1] = &sma->sem_pending;
+
+	for (j = 0; j < 2; j++) {
+		list_for_each_entry(q, pending[j], list) {
+			for (i = 0; i < q->nsops; i++)
+				if (q->sops[i].sem_num == semnum
+				    && match(&q->sops[i])
+				    && !(q->sops[i].sem_flg & IPC_NOWAIT))
+					count++;
+		}
+	}
+	return count;
+}
+
+static int sem_waits_nonzero(struct sembuf *sop)
+{
+	return sop->sem_op < 0;
+}
+
+static int sem_waits_zero(struct sembuf *sop)
+{
+	return sop->sem_op == 0;
 }
 
 /* The following counts are associated to each semaphore:
@@ -469,40 +676,21 @@ static void update_queue (struct sem_array * sma)
  */
 static int count_semncnt (struct sem_array * sma, ushort semnum)
 {
-	int semncnt;
-	struct sem_queue * q;
-
-	semncnt = 0;
-	list_for_each_entry(q, &sma->sem_pending, list) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
-		int i;
-		for (i = 0; i < nsops; i++)
-			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op < 0)
-			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semncnt++;
-	}
-	return semncnt;
+	return count_sem_waiters(sma, semnum, sem_waits_nonzero);
 }
 
 static int count_semzcnt (struct sem_array * sma, ushort semnum)
 {
-	int semzcnt;
-	struct sem_queue * q;
+	return count_sem_waiters(sma, semnum, sem_waits_zero);
+}
 
-	semzcnt = 0;
-	list_for_each_entry(q, &sma->sem_pending, list) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
-		int i;
-		for (i = 0; i < nsops; i++)
-			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op == 0)
-			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semzcnt++;
-	}
-	return semzcnt;
+/* Let a waiter removed from its list fail with @status */
+static void wake_up_sem_queue(struct sem_queue *q, int status)
+{
+	q->status = IN_WAKEUP;
+	wake_up_process(q->sleeper); /* doesn't sleep */
+	smp_wmb();
+	q->status = status;	/* hands-off q */
 }
 
 static void free_un(struct rcu_head *head)
@@ -520,9 +708,11 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	struct sem_undo *un, *tu;
 	struct sem_queue *q, *tq;
 	struct sem_array *sma = container_of(ipcp, struct sem_array, sem_perm);
+	int i;
 
 	/* Free the existing undo structures for this semaphore set.  */
 	assert_spin_locked(&sma->sem_perm.lock);
+	sem_wait_array(sma);
 	list_for_each_entry_safe(un, tu, &sma->list_id, list_id) {
 		list_del(&un->list_id);
 		spin_lock(&un->ulp->lock);
@@ -535,16 +725,23 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	/* Wake up all pending processes and let them fail with EIDRM. */
 	list_for_each_entry_safe(q, tq, &sma->sem_pending, list) {
 		list_del(&q->list);
+		wake_up_sem_queue(q, -EIDRM);
+	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		struct sem *sem = sma->sem_base + i;
 
-		q->status = IN_WAKEUP;
-		wake_up_process(q->sleeper); /* doesn't sleep */
-		smp_wmb();
-		q->status = -EIDRM;	/* hands-off q */
+		list_for_each_entry_safe(q, tq, &sem->sem_pending, list) {
+			list_del(&q->list);
+			wake_up_sem_queue(q, -EIDRM);
+		}
 	}
 
-	/* Remove the semaphore set from the IDR */
+	/*
+	 * Remove the semaphore set from the IDR.  use_global_lock stays
+	 * set, so semops still spinning on the array see ->deleted.
+	 */
 	sem_rmid(ns, sma);
-	sem_unlock(sma);
+	ipc_unlock(&sma->sem_perm);
 
 	ns->used_sems -= sma->sem_nsems;
 	security_sem_free(sma);
@@ -762,7 +959,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		}
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -804,7 +1001,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		curr->sempid = task_tgid_vnr(current);
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -1066,8 +1263,9 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf* sops = fast_sops, *sop;
 	struct sem_undo *un;
-	int undos = 0, alter = 0, max;
+	int undos = 0, alter = 0, max, locknum;
 	struct sem_queue queue;
+	struct list_head *pending;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
 
@@ -1115,17 +1313,33 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 			error = PTR_ERR(un);
 			goto out_free;
 		}
-	} else
+	} else {
 		un = NULL;
+		/* find_alloc_undo returns inside an rcu read side section */
+		rcu_read_lock();
+	}
 
-	sma = sem_lock_check(ns, semid);
+	sma = sem_obtain_object_check(ns, semid);
 	if (IS_ERR(sma)) {
-		if (un)
-			rcu_read_unlock();
+		rcu_read_unlock();
 		error = PTR_ERR(sma);
 		goto out_free;
 	}
 
+	/* needed before locking, sem_nsems does not change */
+	error = -EFBIG;
+	if (max >= sma->sem_nsems) {
+		rcu_read_unlock();
+		goto out_free;
+	}
+
+	locknum = sem_lock_ops(sma, sops, nsops);
+
+	/* freeary() may have run while sem_lock_ops() was spinning */
+	error = -EIDRM;
+	if (sma->sem_perm.deleted)
+		goto out_unlock_free;
+
 	/*
 	 * semid identifiers are not unique - find_alloc_undo may have
 	 * allocated an undo structure, it was invalidated by an RMID
@@ -1134,25 +1348,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	 * "un" itself is guaranteed by rcu.
 	 */
 	error = -EIDRM;
-	if (un) {
-		if (un->semid == -1) {
-			rcu_read_unlock();
-			goto out_unlock_free;
-		} else {
-			/*
-			 * rcu lock can be released, "un" cannot disappear:
-			 * - sem_lock is acquired, thus IPC_RMID is
-			 *   impossible.
-			 * - exit_sem is impossible, it always operates on
-			 *   current (or a dead task).
-			 */
-
-			rcu_read_unlock();
-		}
-	}
-
-	error = -EFBIG;
-	if (max >= sma->sem_nsems)
+	if (un && un->semid == -1)
 		goto out_unlock_free;
 
 	error = -EACCES;
@@ -1166,7 +1362,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	error = try_atomic_semop (sma, sops, nsops, un, task_tgid_vnr(current));
 	if (error <= 0) {
 		if (alter && error == 0)
-			update_queue (sma);
+			do_smart_update(sma, sops, nsops);
 		goto out_unlock_free;
 	}
 
@@ -1179,15 +1375,22 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
+	if (nsops == 1) {
+		pending = &sma->sem_base[sops->sem_num].sem_pending;
+	} else {
+		pending = &sma->sem_pending;
+		sma->complex_count++;
+	}
 	if (alter)
-		list_add_tail(&queue.list, &sma->sem_pending);
+		list_add_tail(&queue.list, pending);
 	else
-		list_add(&queue.list, &sma->sem_pending);
+		list_add(&queue.list, pending);
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
 	current->state = TASK_INTERRUPTIBLE;
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
+	rcu_read_unlock();
 
 	if (timeout)
 		jiffies_left = schedule_timeout(jiffies_left);
@@ -1206,11 +1409,22 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		goto out_free;
 	}
 
-	sma = sem_lock(ns, semid);
+	/*
+	 * The array is the same if the id still matches: the sequence
+	 * number changes when a new array takes its place.
+	 */
+	rcu_read_lock();
+	sma = sem_obtain_object_check(ns, semid);
 	if (IS_ERR(sma)) {
+		rcu_read_unlock();
 		error = -EIDRM;
 		goto out_free;
 	}
+	locknum = sem_lock_ops(sma, sops, nsops);
+	if (sma->sem_perm.deleted) {
+		error = -EIDRM;
+		goto out_unlock_free;
+	}
 
 	/*
 	 * If queue.status != -EINTR we are woken up by another process
@@ -1226,9 +1440,12 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	if (timeout && jiffies_left == 0)
 		error = -EAGAIN;
 	list_del(&queue.list);
+	if (nsops > 1)
+		sma->complex_count--;
 
 out_unlock_free:
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
+	rcu_read_unlock();
 out_free:
 	if(sops != fast_sops)
 		kfree(sops);
@@ -1354,7 +1571,7 @@ void exit_sem(struct task_struct *tsk)
 		}
 		sma->sem_otime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		sem_unlock(sma);
 
 		call_rcu(&un->rcu, free_un);
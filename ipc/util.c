@@ -715,6 +715,30 @@ struct kern_ipc_perm *ipc_lock(struct ipc_ids *ids, int id)
 	return out;
 }
 
+/**
+ * ipc_obtain_object_check - Look up an ipc structure without locking it
+ * @ids: IPC identifier set
+ * @id: ipc id to look for
+ *
+ * Must be called inside an rcu read side critical section, which keeps
+ * the object around.  It is not locked and may be deleted at any time:
+ * callers check ->deleted once they hold whatever lock they need.
+ */
+struct kern_ipc_perm *ipc_obtain_object_check(struct ipc_ids *ids, int id)
+{
+	struct kern_ipc_perm *out;
+	int lid = ipcid_to_idx(id);
+
+	out = idr_find(&ids->ipcs_idr, lid);
+	if (out == NULL)
+		return ERR_PTR(-EINVAL);
+
+	if (ipc_checkid(out, id))
+		return ERR_PTR(-EIDRM);
+
+	return out;
+}
+
 struct kern_ipc_perm *ipc_lock_check(struct ipc_ids *ids, int id)
 {
 	struct kern_ipc_perm *out;
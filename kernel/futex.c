@@ -59,6 +59,9 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +69,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Priority Inheritance state:
  */
@@ -132,7 +133,25 @@ struct futex_hash_bucket {
 	struct plist_head chain;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global hash is sized at boot for the number of possible cpus, and
+ * spread over the nodes like the other large system hashes.
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashsize __read_mostly;
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * A process may ask for a hash of its own, through PR_SET_FUTEX_HASH.
+ * Its private futexes then no longer share buckets with anybody else's.
+ */
+struct futex_private_hash {
+	unsigned long			mask;
+	struct futex_hash_bucket	queues[0];
+};
+
+#define FUTEX_PRIVATE_HASH_MAX	(1UL << 16)
+#endif
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -142,7 +161,15 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct futex_private_hash *fph = key->private.mm->futex_phash;
+
+		if (fph)
+			return &fph->queues[hash & fph->mask];
+	}
+#endif
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -2681,10 +2708,84 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+static void futex_private_hash_free(struct futex_private_hash *fph)
+{
+	if (is_vmalloc_addr(fph))
+		vfree(fph);
+	else
+		kfree(fph);
+}
+
+/*
+ * Switch the private futexes of current's process over to a hash of
+ * @slots buckets.  Waiters queued in the old buckets would not be found
+ * any more, so this only works while the process is single threaded,
+ * typically right at startup, and only once.
+ */
+int futex_private_hash_set(unsigned long slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *fph;
+	size_t size;
+	unsigned long i;
+	int ret = 0;
+
+	if (!mm)
+		return -EINVAL;
+	if (slots < 2 || slots > FUTEX_PRIVATE_HASH_MAX || !is_power_of_2(slots))
+		return -EINVAL;
+
+	size = sizeof(*fph) + slots * sizeof(fph->queues[0]);
+	if (size > PAGE_SIZE)
+		fph = vmalloc(size);
+	else
+		fph = kmalloc(size, GFP_KERNEL);
+	if (!fph)
+		return -ENOMEM;
+
+	fph->mask = slots - 1;
+	for (i = 0; i < slots; i++) {
+		plist_head_init(&fph->queues[i].chain, &fph->queues[i].lock);
+		spin_lock_init(&fph->queues[i].lock);
+	}
+
+	down_write(&mm->mmap_sem);
+	if (mm->futex_phash || atomic_read(&mm->mm_users) != 1)
+		ret = -EBUSY;
+	else
+		mm->futex_phash = fph;
+	up_write(&mm->mmap_sem);
+
+	if (ret)
+		futex_private_hash_free(fph);
+	return ret;
+}
+
+int futex_private_hash_get(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	if (!mm || !mm->futex_phash)
+		return 0;
+	return mm->futex_phash->mask + 1;
+}
+
+/* Called when the last user of @mm is gone, no futex can be queued */
+void exit_futex_private_hash(struct mm_struct *mm)
+{
+	if (mm->futex_phash) {
+		futex_private_hash_free(mm->futex_phash);
+		mm->futex_phash = NULL;
+	}
+}
+#endif
+
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
+	unsigned long i;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2700,7 +2801,18 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+
+	for (i = 0; i < futex_hashsize; i++) {
 		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
 		spin_lock_init(&futex_queues[i].lock);
 	}
@@ -546,12 +546,10 @@ irq_thread_check_affinity(struct irq_desc *desc, struct irqaction *action) { }
  */
 static int irq_thread(void *data)
 {
-	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO/2, };
 	struct irqaction *action = data;
 	struct irq_desc *desc = irq_to_desc(action->irq);
 	int wake, oneshot = desc->status & IRQ_ONESHOT;
 
-	sched_setscheduler(current, SCHED_FIFO, &param);
 	current->irqaction = action;
 
 	while (!irq_wait_for_interrupt(action)) {
@@ -660,12 +658,24 @@ __setup_irq(unsigned int irq, struct irq_desc *desc, struct irqaction *new)
 	 * thread.
 	 */
 	if (new->thread_fn && !nested) {
+		struct sched_param param = {
+			.sched_priority = MAX_USER_RT_PRIO/2,
+		};
 		struct task_struct *t;
 
 		t = kthread_create(irq_thread, new, "irq/%d-%s", irq,
 				   new->name);
 		if (IS_ERR(t))
 			return PTR_ERR(t);
+
+		/*
+		 * Set the priority here rather than from the thread, so
+		 * that irq_set_thread_priority() right after the request
+		 * is not undone when the thread first runs.  And start
+		 * it out on the cpus the interrupt is delivered to.
+		 */
+		sched_setscheduler_nocheck(t, SCHED_FIFO, &param);
+		set_bit(IRQTF_AFFINITY, &new->thread_flags);
 		/*
 		 * We keep the reference to the task struct even if
 		 * the thread dies to avoid that the interrupt code
@@ -1096,3 +1106,47 @@ int request_threaded_irq(unsigned int irq, irq_handler_t handler,
 	return retval;
 }
 EXPORT_SYMBOL(request_threaded_irq);
+
+/**
+ *	irq_set_thread_priority - change the priority of a handler thread
+ *	@irq: Interrupt line
+ *	@dev_id: The cookie the threaded handler was requested with
+ *	@prio: SCHED_FIFO priority, or 0 for SCHED_NORMAL
+ *
+ *	Handler threads start out at SCHED_FIFO MAX_USER_RT_PRIO/2, above
+ *	all user space.  A driver whose threaded handler does bulk work
+ *	can lower it, or raise it above the others for latency.  The
+ *	thread follows the interrupt's affinity by itself.
+ */
+int irq_set_thread_priority(unsigned int irq, void *dev_id, int prio)
+{
+	struct sched_param param = { .sched_priority = prio, };
+	struct irq_desc *desc = irq_to_desc(irq);
+	struct task_struct *t = NULL;
+	struct irqaction *action;
+	unsigned long flags;
+	int ret;
+
+	if (!desc)
+		return -EINVAL;
+
+	spin_lock_irqsave(&desc->lock, flags);
+	for (action = desc->action; action; action = action->next) {
+		if (action->dev_id == dev_id) {
+			t = action->thread;
+			if (t)
+				get_task_struct(t);
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&desc->lock, flags);
+
+	if (!t)
+		return -EINVAL;
+
+	ret = sched_setscheduler_nocheck(t, prio ? SCHED_FIFO : SCHED_NORMAL,
+					 &param);
+	put_task_struct(t);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(irq_set_thread_priority);
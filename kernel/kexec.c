@@ -55,6 +55,42 @@ struct resource crashk_res = {
 	.flags = IORESOURCE_BUSY | IORESOURCE_MEM
 };
 
+/*
+ * RAM given with kexec_preserve=size@start is kept out of the allocator
+ * by every kernel booted with it, and kexec loads nothing over it, so
+ * what one kernel leaves there is found by the next after a kexec
+ * reboot.  start == end == 0 means there is none.
+ */
+struct resource kexec_preserve_res = {
+	.name  = "Kexec preserved memory",
+	.start = 0,
+	.end   = 0,
+	.flags = IORESOURCE_BUSY | IORESOURCE_MEM
+};
+EXPORT_SYMBOL_GPL(kexec_preserve_res);
+
+static int __init parse_kexec_preserve(char *arg)
+{
+	unsigned long long size, start;
+	char *cur = arg;
+
+	if (!arg)
+		return -EINVAL;
+
+	size = memparse(arg, &cur);
+	if (cur == arg || *cur != '@')
+		return -EINVAL;
+	arg = cur + 1;
+	start = memparse(arg, &cur);
+	if (cur == arg || !size || (size & ~PAGE_MASK) || (start & ~PAGE_MASK))
+		return -EINVAL;
+
+	kexec_preserve_res.start = start;
+	kexec_preserve_res.end = start + size - 1;
+	return 0;
+}
+early_param("kexec_preserve", parse_kexec_preserve);
+
 int kexec_should_crash(struct task_struct *p)
 {
 	if (in_interrupt() || !p->pid || is_global_init(p) || panic_on_oops)
@@ -175,6 +211,11 @@ static int do_kimage_alloc(struct kimage **rimage, unsigned long entry,
 			goto out;
 		if (mend >= KEXEC_DESTINATION_MEMORY_LIMIT)
 			goto out;
+		/* and it is not what we promised to hand over untouched */
+		if (kexec_preserve_res.end &&
+		    mend > kexec_preserve_res.start &&
+		    mstart <= kexec_preserve_res.end)
+			goto out;
 	}
 
 	/* Verify our destination addresses do not overlap.
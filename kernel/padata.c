@@ -0,0 +1,419 @@
+/*
+ * padata.c - generic interface to process data streams in parallel
+ *
+ * Objects submitted to a padata instance get their parallel callback
+ * run on the cpus of the instance in turn, and once that is done their
+ * serial callback run in the order they were submitted in.  This lets
+ * users like IPsec spread the crypto work of one stream over all cpus
+ * without reordering its packets.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/cpumask.h>
+#include <linux/cpu.h>
+#include <linux/err.h>
+#include <linux/padata.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+/* objects in flight per instance before padata_do_parallel() says -EBUSY */
+#define MAX_OBJ_NUM 1000
+
+static void padata_parallel_worker(struct work_struct *work)
+{
+	struct padata_queue *queue;
+	struct padata_priv *padata;
+	LIST_HEAD(local);
+
+	queue = container_of(work, struct padata_queue, pwork);
+
+	local_bh_disable();
+	spin_lock(&queue->lock);
+	list_splice_init(&queue->parallel, &local);
+	spin_unlock(&queue->lock);
+
+	while (!list_empty(&local)) {
+		padata = list_entry(local.next, struct padata_priv, list);
+		list_del_init(&padata->list);
+		padata->parallel(padata);
+	}
+	local_bh_enable();
+}
+
+/**
+ * padata_do_parallel - submit an object for parallel processing
+ *
+ * @pinst: padata instance
+ * @padata: object to be processed
+ * @cb_cpu: cpu the serial callback should run on.  If it is not one of
+ *          the cpus the instance currently uses, one of those is picked
+ *          deterministically instead, so that the objects of a stream
+ *          keep ending up on the same cpu.
+ *
+ * Returns 0 if the object was queued, -EBUSY if too many objects are in
+ * flight already and -EINVAL if the instance has no cpu to run on.
+ */
+int padata_do_parallel(struct padata_instance *pinst,
+		       struct padata_priv *padata, int cb_cpu)
+{
+	struct parallel_data *pd;
+	struct padata_queue *queue;
+	int err;
+
+	rcu_read_lock_bh();
+
+	pd = rcu_dereference(pinst->pd);
+	err = -EINVAL;
+	if (!pd)
+		goto out;
+
+	err = -EBUSY;
+	if (atomic_read(&pd->refcnt) >= MAX_OBJ_NUM)
+		goto out;
+
+	err = 0;
+	atomic_inc(&pd->refcnt);
+
+	if (cb_cpu < 0 || !cpumask_test_cpu(cb_cpu, pd->cpumask))
+		cb_cpu = pd->cpu_map[(unsigned int)cb_cpu % pd->num_cpus];
+
+	padata->pd = pd;
+	padata->cb_cpu = cb_cpu;
+	padata->seq_nr = atomic_inc_return(&pd->seq_nr) - 1;
+	padata->cpu = pd->cpu_map[padata->seq_nr % pd->num_cpus];
+
+	queue = per_cpu_ptr(pd->queue, padata->cpu);
+	spin_lock(&queue->lock);
+	list_add_tail(&padata->list, &queue->parallel);
+	spin_unlock(&queue->lock);
+
+	queue_work_on(padata->cpu, pinst->wq, &queue->pwork);
+out:
+	rcu_read_unlock_bh();
+	return err;
+}
+EXPORT_SYMBOL(padata_do_parallel);
+
+/*
+ * Objects are handed out to the cpus round robin by seq_nr, so the next
+ * one to serialize has to be at the head of its cpu's reorder list.
+ * Returns it if it got there already, taking it off the list if remove
+ * is set.
+ */
+static struct padata_priv *padata_get_next(struct parallel_data *pd,
+					   int remove)
+{
+	struct padata_queue *queue;
+	struct padata_priv *padata = NULL;
+	unsigned int seq_nr = pd->processed;
+
+	queue = per_cpu_ptr(pd->queue, pd->cpu_map[seq_nr % pd->num_cpus]);
+
+	spin_lock_bh(&queue->lock);
+	if (!list_empty(&queue->reorder)) {
+		padata = list_entry(queue->reorder.next,
+				    struct padata_priv, list);
+		if (padata->seq_nr != seq_nr)
+			padata = NULL;
+		else if (remove)
+			list_del_init(&padata->list);
+	}
+	spin_unlock_bh(&queue->lock);
+
+	return padata;
+}
+
+static void padata_reorder(struct parallel_data *pd)
+{
+	struct padata_instance *pinst = pd->pinst;
+	struct padata_queue *squeue;
+	struct padata_priv *padata;
+
+	do {
+		/*
+		 * Whoever holds the lock serializes our object as well, or
+		 * notices it in the check below once it dropped the lock.
+		 */
+		if (!spin_trylock_bh(&pd->lock))
+			return;
+
+		while ((padata = padata_get_next(pd, 1))) {
+			pd->processed++;
+
+			squeue = per_cpu_ptr(pd->queue, padata->cb_cpu);
+			spin_lock_bh(&squeue->lock);
+			list_add_tail(&padata->list, &squeue->serial);
+			spin_unlock_bh(&squeue->lock);
+
+			queue_work_on(padata->cb_cpu, pinst->wq, &squeue->swork);
+		}
+
+		spin_unlock_bh(&pd->lock);
+		smp_mb();
+	} while (padata_get_next(pd, 0));
+}
+
+static void padata_serial_worker(struct work_struct *work)
+{
+	struct padata_queue *queue;
+	struct parallel_data *pd;
+	struct padata_priv *padata;
+	LIST_HEAD(local);
+
+	queue = container_of(work, struct padata_queue, swork);
+	pd = queue->pd;
+
+	local_bh_disable();
+	spin_lock(&queue->lock);
+	list_splice_init(&queue->serial, &local);
+	spin_unlock(&queue->lock);
+
+	while (!list_empty(&local)) {
+		padata = list_entry(local.next, struct padata_priv, list);
+		list_del_init(&padata->list);
+
+		/* the callback usually frees the object */
+		padata->serial(padata);
+		if (atomic_dec_and_test(&pd->refcnt))
+			wake_up(&pd->pinst->drain);
+	}
+	local_bh_enable();
+}
+
+/**
+ * padata_do_serial - an object is done with its parallel processing
+ *
+ * @padata: object to be serialized
+ *
+ * Called from, or on behalf of, the parallel callback.  The serial
+ * callback of the object runs once all objects submitted before it
+ * got theirs.
+ */
+void padata_do_serial(struct padata_priv *padata)
+{
+	struct parallel_data *pd = padata->pd;
+	struct padata_queue *queue;
+	struct padata_priv *cur;
+
+	queue = per_cpu_ptr(pd->queue, padata->cpu);
+
+	spin_lock_bh(&queue->lock);
+	/* asynchronous completions may overtake each other, keep it sorted */
+	list_for_each_entry_reverse(cur, &queue->reorder, list)
+		if ((int)(cur->seq_nr - padata->seq_nr) < 0)
+			break;
+	list_add(&padata->list, &cur->list);
+	spin_unlock_bh(&queue->lock);
+
+	padata_reorder(pd);
+}
+EXPORT_SYMBOL(padata_do_serial);
+
+static struct parallel_data *padata_alloc_pd(struct padata_instance *pinst,
+					     const struct cpumask *cpumask)
+{
+	struct parallel_data *pd;
+	struct padata_queue *queue;
+	int cpu, num_cpus, i = 0;
+
+	num_cpus = cpumask_weight(cpumask);
+	pd = kzalloc(sizeof(*pd) + num_cpus * sizeof(int), GFP_KERNEL);
+	if (!pd)
+		goto err;
+
+	pd->queue = alloc_percpu(struct padata_queue);
+	if (!pd->queue)
+		goto err_free_pd;
+
+	if (!alloc_cpumask_var(&pd->cpumask, GFP_KERNEL))
+		goto err_free_queue;
+	cpumask_copy(pd->cpumask, cpumask);
+
+	for_each_cpu(cpu, cpumask)
+		pd->cpu_map[i++] = cpu;
+	pd->num_cpus = num_cpus;
+
+	for_each_possible_cpu(cpu) {
+		queue = per_cpu_ptr(pd->queue, cpu);
+		spin_lock_init(&queue->lock);
+		INIT_LIST_HEAD(&queue->parallel);
+		INIT_LIST_HEAD(&queue->reorder);
+		INIT_LIST_HEAD(&queue->serial);
+		INIT_WORK(&queue->pwork, padata_parallel_worker);
+		INIT_WORK(&queue->swork, padata_serial_worker);
+		queue->pd = pd;
+	}
+
+	pd->pinst = pinst;
+	atomic_set(&pd->seq_nr, 0);
+	atomic_set(&pd->refcnt, 0);
+	spin_lock_init(&pd->lock);
+
+	return pd;
+
+err_free_queue:
+	free_percpu(pd->queue);
+err_free_pd:
+	kfree(pd);
+err:
+	return NULL;
+}
+
+static void padata_free_pd(struct parallel_data *pd)
+{
+	free_cpumask_var(pd->cpumask);
+	free_percpu(pd->queue);
+	kfree(pd);
+}
+
+/*
+ * Switch the instance over to the cpus in cpumask, none if it is empty.
+ * Objects still in flight on the old cpus are waited for.  Called with
+ * pinst->lock held.
+ */
+static int padata_replace(struct padata_instance *pinst,
+			  const struct cpumask *cpumask)
+{
+	struct parallel_data *pd = NULL, *old;
+
+	if (!cpumask_empty(cpumask)) {
+		pd = padata_alloc_pd(pinst, cpumask);
+		if (!pd)
+			return -ENOMEM;
+	}
+
+	old = pinst->pd;
+	rcu_assign_pointer(pinst->pd, pd);
+	synchronize_rcu_bh();
+
+	if (old) {
+		wait_event(pinst->drain, !atomic_read(&old->refcnt));
+		/* a worker may still be pending on the old queues */
+		flush_workqueue(pinst->wq);
+		padata_free_pd(old);
+	}
+
+	return 0;
+}
+
+/* use the online cpus of the instance's cpumask, except for down_cpu */
+static int padata_update_cpus(struct padata_instance *pinst, int down_cpu)
+{
+	cpumask_var_t cpumask;
+	int err;
+
+	if (!alloc_cpumask_var(&cpumask, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpumask_and(cpumask, pinst->cpumask, cpu_online_mask);
+	if (down_cpu >= 0)
+		cpumask_clear_cpu(down_cpu, cpumask);
+
+	mutex_lock(&pinst->lock);
+	err = padata_replace(pinst, cpumask);
+	mutex_unlock(&pinst->lock);
+
+	free_cpumask_var(cpumask);
+	return err;
+}
+
+static int padata_cpu_callback(struct notifier_block *nfb,
+			       unsigned long action, void *hcpu)
+{
+	struct padata_instance *pinst;
+	int cpu = (unsigned long)hcpu;
+
+	pinst = container_of(nfb, struct padata_instance, cpu_notifier);
+	if (!cpumask_test_cpu(cpu, pinst->cpumask))
+		return NOTIFY_OK;
+
+	switch (action) {
+	case CPU_ONLINE:
+	case CPU_ONLINE_FROZEN:
+	case CPU_DOWN_FAILED:
+	case CPU_DOWN_FAILED_FROZEN:
+		padata_update_cpus(pinst, -1);
+		break;
+
+	case CPU_DOWN_PREPARE:
+	case CPU_DOWN_PREPARE_FROZEN:
+		if (padata_update_cpus(pinst, cpu))
+			return NOTIFY_BAD;
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+/**
+ * padata_alloc - allocate a padata instance
+ *
+ * @cpumask: cpus the instance may use, only the online ones are used
+ * @wq: workqueue to run the callbacks on, created with create_workqueue()
+ */
+struct padata_instance *padata_alloc(const struct cpumask *cpumask,
+				     struct workqueue_struct *wq)
+{
+	struct padata_instance *pinst;
+	int err;
+
+	pinst = kzalloc(sizeof(*pinst), GFP_KERNEL);
+	if (!pinst)
+		goto err;
+
+	if (!alloc_cpumask_var(&pinst->cpumask, GFP_KERNEL))
+		goto err_free_inst;
+	cpumask_copy(pinst->cpumask, cpumask);
+
+	pinst->wq = wq;
+	mutex_init(&pinst->lock);
+	init_waitqueue_head(&pinst->drain);
+
+	pinst->cpu_notifier.notifier_call = padata_cpu_callback;
+	pinst->cpu_notifier.priority = 0;
+	err = register_hotcpu_notifier(&pinst->cpu_notifier);
+	if (err)
+		goto err_free_mask;
+
+	get_online_cpus();
+	err = padata_update_cpus(pinst, -1);
+	put_online_cpus();
+	if (err)
+		goto err_unregister;
+
+	return pinst;
+
+err_unregister:
+	unregister_hotcpu_notifier(&pinst->cpu_notifier);
+err_free_mask:
+	free_cpumask_var(pinst->cpumask);
+err_free_inst:
+	kfree(pinst);
+err:
+	return NULL;
+}
+EXPORT_SYMBOL(padata_alloc);
+
+/**
+ * padata_free - free a padata instance
+ *
+ * @pinst: padata instance to free, waits for the objects still in flight
+ */
+void padata_free(struct padata_instance *pinst)
+{
+	unregister_hotcpu_notifier(&pinst->cpu_notifier);
+
+	mutex_lock(&pinst->lock);
+	padata_replace(pinst, cpu_none_mask);
+	mutex_unlock(&pinst->lock);
+
+	free_cpumask_var(pinst->cpumask);
+	kfree(pinst);
+}
+EXPORT_SYMBOL(padata_free);
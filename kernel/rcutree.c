@@ -46,6 +46,9 @@
 #include <linux/cpu.h>
 #include <linux/mutex.h>
 #include <linux/time.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/bootmem.h>
 
 #include "rcutree.h"
 
@@ -124,10 +127,12 @@ DEFINE_PER_CPU(struct rcu_dynticks, rcu_dynticks) = {
 static int blimit = 10;		/* Maximum callbacks per softirq. */
 static int qhimark = 10000;	/* If this many pending, ignore blimit. */
 static int qlowmark = 100;	/* Once only this many pending, use blimit. */
+static int rcu_divisor = 7;	/* Batch at least 1/2^rcu_divisor of qlen. */
 
 module_param(blimit, int, 0);
 module_param(qhimark, int, 0);
 module_param(qlowmark, int, 0);
+module_param(rcu_divisor, int, 0);
 
 static void force_quiescent_state(struct rcu_state *rsp, int relaxed);
 static int rcu_pending(int cpu);
@@ -224,6 +229,16 @@ static int rcu_implicit_offline_qs(struct rcu_data *rdp)
 	if (rdp->preemptable)
 		return 0;
 
+	/*
+	 * A vCPU its hypervisor has blocked will report the quiescent
+	 * state from its next tick, waking it up now would only cost a
+	 * hypervisor round trip.
+	 */
+	if (vcpu_is_blocked(rdp->cpu)) {
+		rdp->blocked_fqs++;
+		return 0;
+	}
+
 	/* The CPU is online, so send it a reschedule IPI. */
 	if (rdp->cpu != smp_processor_id())
 		smp_send_reschedule(rdp->cpu);
@@ -355,6 +370,27 @@ void rcu_irq_exit(void)
 		set_need_resched();
 }
 
+/**
+ * rcu_cpu_in_dynticks_idle - is a CPU in an extended quiescent state?
+ * @cpu: the CPU in question
+ *
+ * Return 1 if the specified CPU is in dynticks idle mode with no irq
+ * or NMI handler running, so that it cannot be in any RCU read-side
+ * critical section.  Full memory barriers on both sides order the
+ * check against the caller's update and against what it does next.
+ */
+int rcu_cpu_in_dynticks_idle(int cpu)
+{
+	struct rcu_dynticks *rdtp = &per_cpu(rcu_dynticks, cpu);
+	int ret;
+
+	smp_mb(); /* Order prior updates before the check. */
+	ret = (ACCESS_ONCE(rdtp->dynticks) & 0x1) == 0 &&
+	      (ACCESS_ONCE(rdtp->dynticks_nmi) & 0x1) == 0;
+	smp_mb(); /* Order the check before subsequent actions. */
+	return ret;
+}
+
 #ifdef CONFIG_SMP
 
 /*
@@ -1010,15 +1046,160 @@ static void rcu_offline_cpu(int cpu)
 
 #endif /* #else #ifdef CONFIG_HOTPLUG_CPU */
 
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Callback offloading.  The CPUs given by "rcu_nocbs=" still take part
+ * in grace periods, but hand their ready callbacks to a per-CPU "rcuo"
+ * kthread instead of invoking them from softirq.  The kthreads are not
+ * bound, so they can be moved off CPUs dedicated to latency-sensitive
+ * work.
+ */
+struct rcu_nocb {
+	spinlock_t lock;		/* Protects the list. */
+	struct rcu_head *head;		/* CBs waiting for the kthread. */
+	struct rcu_head **tail;
+	wait_queue_head_t wq;		/* The kthread waits here. */
+};
+
+static DEFINE_PER_CPU(struct rcu_nocb, rcu_nocb);
+static cpumask_var_t rcu_nocb_mask;
+static bool have_rcu_nocb_mask;
+
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/* Are the callbacks of the specified CPU offloaded? */
+static bool is_nocb_cpu(int cpu)
+{
+	return have_rcu_nocb_mask && cpumask_test_cpu(cpu, rcu_nocb_mask);
+}
+
+/*
+ * Hand the ready callbacks from list through *tail over to the rcuo
+ * kthread of the specified CPU.
+ */
+static void rcu_nocb_enqueue(int cpu, struct rcu_head *list,
+			     struct rcu_head **tail)
+{
+	struct rcu_nocb *nocb = &per_cpu(rcu_nocb, cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&nocb->lock, flags);
+	*nocb->tail = list;
+	nocb->tail = tail;
+	spin_unlock_irqrestore(&nocb->lock, flags);
+	wake_up(&nocb->wq);
+}
+
+/*
+ * Invoke the callbacks offloaded from one CPU, for all flavors of RCU,
+ * in the order they were handed over.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	struct rcu_nocb *nocb = arg;
+	struct rcu_head *list, *next;
+
+	for (;;) {
+		wait_event_interruptible(nocb->wq, ACCESS_ONCE(nocb->head));
+
+		spin_lock_irq(&nocb->lock);
+		list = nocb->head;
+		nocb->head = NULL;
+		nocb->tail = &nocb->head;
+		spin_unlock_irq(&nocb->lock);
+
+		while (list) {
+			next = list->next;
+			/* Callbacks may rely on running with bh disabled. */
+			local_bh_disable();
+			list->func(list);
+			local_bh_enable();
+			list = next;
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static void __init rcu_init_nocb(void)
+{
+	char buf[64];
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rcu_nocb *nocb = &per_cpu(rcu_nocb, cpu);
+
+		spin_lock_init(&nocb->lock);
+		nocb->head = NULL;
+		nocb->tail = &nocb->head;
+		init_waitqueue_head(&nocb->wq);
+	}
+	if (have_rcu_nocb_mask) {
+		cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+		printk(KERN_INFO "RCU callbacks offloaded from CPUs: %s.\n",
+		       buf);
+	}
+}
+
+/*
+ * Callbacks handed over before the kthreads exist simply wait for
+ * them on the per-CPU lists.
+ */
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	struct task_struct *t;
+	int cpu;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	for_each_possible_cpu(cpu) {
+		if (!is_nocb_cpu(cpu))
+			continue;
+		t = kthread_run(rcu_nocb_kthread, &per_cpu(rcu_nocb, cpu),
+				"rcuo/%d", cpu);
+		BUG_ON(IS_ERR(t));
+	}
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool is_nocb_cpu(int cpu)
+{
+	return false;
+}
+
+static void rcu_nocb_enqueue(int cpu, struct rcu_head *list,
+			     struct rcu_head **tail)
+{
+}
+
+static void __init rcu_init_nocb(void)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
+
 /*
  * Invoke any RCU callbacks that have made it to the end of their grace
- * period.  Thottle as specified by rdp->blimit.
+ * period.  Thottle as specified by rdp->blimit, raised in proportion to
+ * the backlog so that a long queue drains in a bounded number of
+ * batches.  CPUs with offloaded callbacks just hand them over.
  */
 static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 {
 	unsigned long flags;
 	struct rcu_head *next, *list, **tail;
-	int count;
+	long bl, count;
 
 	/* If no callbacks are ready, just return.*/
 	if (!cpu_has_callbacks_ready_to_invoke(rdp))
@@ -1036,16 +1217,26 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	for (count = RCU_NEXT_SIZE - 1; count >= 0; count--)
 		if (rdp->nxttail[count] == rdp->nxttail[RCU_DONE_TAIL])
 			rdp->nxttail[count] = &rdp->nxtlist;
+	bl = max(rdp->blimit,
+		 rdp->qlen >> clamp(rcu_divisor, 0, BITS_PER_LONG - 1));
 	local_irq_restore(flags);
 
-	/* Invoke callbacks. */
 	count = 0;
+	if (is_nocb_cpu(rdp->cpu)) {
+		/* Offloaded: count the callbacks and hand them over. */
+		for (next = list; next; next = next->next)
+			count++;
+		rcu_nocb_enqueue(rdp->cpu, list, tail);
+		list = NULL;
+	}
+
+	/* Invoke callbacks. */
 	while (list) {
 		next = list->next;
 		prefetch(next);
 		list->func(list);
 		list = next;
-		if (++count >= rdp->blimit)
+		if (++count >= bl)
 			break;
 	}
 
@@ -1792,6 +1983,7 @@ void __init __rcu_init(void)
 	RCU_INIT_FLAVOR(&rcu_bh_state, rcu_bh_data);
 	__rcu_init_preempt();
 	open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
+	rcu_init_nocb();
 }
 
 #include "rcutree_plugin.h"
@@ -189,6 +189,7 @@ struct rcu_data {
 #endif /* #ifdef CONFIG_NO_HZ */
 	unsigned long offline_fqs;	/* Kicked due to being offline. */
 	unsigned long resched_ipi;	/* Sent a resched IPI. */
+	unsigned long blocked_fqs;	/* Skipped IPI, vCPU was blocked. */
 
 	/* 5) __rcu_pending() statistics. */
 	long n_rcu_pending;		/* rcu_pending() calls since boot. */
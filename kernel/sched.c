@@ -71,11 +71,16 @@
 #include <linux/debugfs.h>
 #include <linux/ctype.h>
 #include <linux/ftrace.h>
+#include <linux/kref.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
+#ifdef CONFIG_PARAVIRT
+#include <asm/paravirt.h>
+#endif
 
 #include "sched_cpupri.h"
+#include "workqueue_sched.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -241,6 +246,27 @@ struct cfs_rq;
 
 static LIST_HEAD(task_groups);
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/*
+ * A group's cpu.cfs_quota_us worth of runtime, refilled every period by
+ * period_timer and handed out to the group's cfs_rqs a slice at a time.
+ */
+struct cfs_bandwidth {
+	spinlock_t		lock;
+	ktime_t			period;
+	u64			quota;		/* RUNTIME_INF: unconstrained */
+	u64			runtime;	/* left in this period */
+
+	int			idle, timer_active;
+	struct hrtimer		period_timer;
+	struct list_head	throttled_cfs_rq;
+
+	/* statistics */
+	int			nr_periods, nr_throttled;
+	u64			throttled_time;
+};
+#endif
+
 /* task group related information */
 struct task_group {
 	struct cgroup_subsys_state css;
@@ -251,6 +277,9 @@ struct task_group {
 	/* runqueue "owned" by this group on each cpu */
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
+#ifdef CONFIG_CFS_BANDWIDTH
+	struct cfs_bandwidth cfs_bandwidth;
+#endif
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -266,6 +295,10 @@ struct task_group {
 	struct task_group *parent;
 	struct list_head siblings;
 	struct list_head children;
+
+#ifdef CONFIG_SCHED_AUTOGROUP
+	struct autogroup *autogroup;
+#endif
 };
 
 #define root_task_group init_task_group
@@ -305,6 +338,8 @@ static int init_task_group_load = INIT_TASK_GROUP_LOAD;
  */
 struct task_group init_task_group;
 
+#include "sched_autogroup.h"
+
 /* return group to which a task belongs */
 static inline struct task_group *task_group(struct task_struct *p)
 {
@@ -313,6 +348,7 @@ static inline struct task_group *task_group(struct task_struct *p)
 #ifdef CONFIG_CGROUP_SCHED
 	tg = container_of(task_subsys_state(p, cpu_cgroup_subsys_id),
 				struct task_group, css);
+	tg = autogroup_task_group(p, tg);
 #else
 	tg = &init_task_group;
 #endif
@@ -403,6 +439,20 @@ struct cfs_rq {
 	 */
 	unsigned long rq_weight;
 #endif
+
+#ifdef CONFIG_CFS_BANDWIDTH
+	/*
+	 * runtime_remaining is this cpu's slice of tg->cfs_bandwidth; once
+	 * it and the group's pool run dry the cfs_rq is throttled: its group
+	 * entity is taken off the parent until the next period refill.
+	 */
+	int runtime_enabled;
+	s64 runtime_remaining;
+
+	u64 throttled_timestamp;
+	int throttled;
+	struct list_head throttled_list;
+#endif
 #endif
 };
 
@@ -558,6 +608,9 @@ struct rq {
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
 	u64 prev_irq_time;
 #endif
+#ifdef CONFIG_PARAVIRT_TIME_ACCOUNTING
+	u64 prev_steal_time;
+#endif
 
 	/* calc_load related fields */
 	unsigned long calc_load_update;
@@ -625,6 +678,7 @@ static inline int cpu_of(struct rq *rq)
 
 static u64 irq_time_cpu(int cpu);
 static void sched_irq_time_avg_update(struct rq *rq, u64 irq_time);
+static void sched_steal_time_avg_update(struct rq *rq);
 
 inline void update_rq_clock(struct rq *rq)
 {
@@ -637,6 +691,7 @@ inline void update_rq_clock(struct rq *rq)
 		rq->clock_task = rq->clock - irq_time;
 
 	sched_irq_time_avg_update(rq, irq_time);
+	sched_steal_time_avg_update(rq);
 }
 
 /*
@@ -1894,10 +1949,49 @@ static void sched_irq_time_avg_update(struct rq *rq, u64 curr_irq_time) { }
 
 #endif
 
+#ifdef CONFIG_PARAVIRT_TIME_ACCOUNTING
+
+/*
+ * Time the hypervisor kept this cpu from running is taken out of its
+ * cpu_power the same way irq time is, so the load balancer moves work
+ * off starved vcpus.  The steal clock is only read for the local cpu;
+ * the update_rq_clock() from every tick keeps it current.
+ */
+static void sched_steal_time_avg_update(struct rq *rq)
+{
+	u64 steal, delta;
+
+	if (!paravirt_steal_enabled || !sched_feat(STEAL_POWER))
+		return;
+
+	if (cpu_of(rq) != smp_processor_id())
+		return;
+
+	steal = paravirt_steal_clock(cpu_of(rq));
+	delta = steal - rq->prev_steal_time;
+	rq->prev_steal_time = steal;
+
+	if ((s64)delta <= 0)
+		return;
+
+	/*
+	 * The first sample on a cpu that has just come online can carry
+	 * all the time its vcpu spent offline.
+	 */
+	sched_rt_avg_update(rq, min_t(u64, delta, sched_avg_period()));
+}
+
+#else
+
+static void sched_steal_time_avg_update(struct rq *rq) { }
+
+#endif
+
 #include "sched_stats.h"
 #include "sched_idletask.c"
 #include "sched_fair.c"
 #include "sched_rt.c"
+#include "sched_autogroup.c"
 #ifdef CONFIG_SCHED_DEBUG
 # include "sched_debug.c"
 #endif
@@ -2562,6 +2656,10 @@ out_activate:
 	activate_task(rq, p, 1);
 	success = 1;
 
+	/* if a worker is waking up, notify workqueue */
+	if (p->flags & PF_WQ_WORKER)
+		wq_worker_waking_up(p, cpu);
+
 	/*
 	 * Only attribute actual wakeups done by this task.
 	 */
@@ -2605,6 +2703,44 @@ out:
 	return success;
 }
 
+/**
+ * try_to_wake_up_local - try to wake up a local task with rq lock held
+ * @p: the thread to be awakened
+ *
+ * Put @p on the run-queue if it's not already there.  The caller must
+ * ensure that this_rq() is locked, @p is not the current task and that
+ * @p is bound to this_rq(); a task found on another runqueue is left
+ * alone.  this_rq() stays locked over invocation.
+ */
+static void try_to_wake_up_local(struct task_struct *p)
+{
+	struct rq *rq = task_rq(p);
+
+	BUG_ON(p == current);
+
+	if (!(p->state & TASK_NORMAL))
+		return;
+
+	if (unlikely(rq != this_rq()))
+		return;
+
+	if (!p->se.on_rq) {
+		if (task_contributes_to_load(p))
+			rq->nr_uninterruptible--;
+		schedstat_inc(rq, ttwu_count);
+		schedstat_inc(rq, ttwu_local);
+		activate_task(rq, p, 1);
+	}
+
+	trace_sched_wakeup(rq, p, 1);
+	check_preempt_curr(rq, p, 0);
+	p->state = TASK_RUNNING;
+#ifdef CONFIG_SMP
+	if (p->sched_class->task_woken)
+		p->sched_class->task_woken(rq, p);
+#endif
+}
+
 /**
  * wake_up_process - Wake up a specific process
  * @p: The process to be woken up.
@@ -4661,6 +4797,7 @@ static void idle_balance(int this_cpu, struct rq *this_rq)
 	struct sched_domain *sd;
 	int pulled_task = 0;
 	unsigned long next_balance = jiffies + HZ;
+	u64 curr_cost = 0;
 
 	this_rq->idle_stamp = this_rq->clock;
 
@@ -4673,10 +4810,27 @@ static void idle_balance(int this_cpu, struct rq *this_rq)
 		if (!(sd->flags & SD_LOAD_BALANCE))
 			continue;
 
-		if (sd->flags & SD_BALANCE_NEWIDLE)
+		/*
+		 * Balancing a domain costs what it cost last time, at worst.
+		 * Once that would eat the idle time we expect to have, stop:
+		 * wider domains only cost more, and on a guest whose vcpus
+		 * share no caches a pulled task gains nothing to pay for it.
+		 */
+		if (this_rq->avg_idle < curr_cost + sd->max_newidle_lb_cost)
+			break;
+
+		if (sd->flags & SD_BALANCE_NEWIDLE) {
+			u64 t0, domain_cost;
+
+			t0 = sched_clock_cpu(this_cpu);
 			/* If we've pulled tasks over stop searching: */
 			pulled_task = load_balance_newidle(this_cpu, this_rq,
 							   sd);
+			domain_cost = sched_clock_cpu(this_cpu) - t0;
+			if (domain_cost > sd->max_newidle_lb_cost)
+				sd->max_newidle_lb_cost = domain_cost;
+			curr_cost += domain_cost;
+		}
 
 		interval = msecs_to_jiffies(sd->balance_interval);
 		if (time_after(next_balance, sd->last_balance + interval))
@@ -4981,6 +5135,16 @@ static void rebalance_domains(int cpu, enum cpu_idle_type idle)
 	int need_serialize;
 
 	for_each_domain(cpu, sd) {
+		/*
+		 * Let a one-off slow idle balance be forgotten, by about
+		 * 1% a second, so it does not block idle balancing forever.
+		 */
+		if (time_after(jiffies, sd->next_decay_max_lb_cost)) {
+			sd->max_newidle_lb_cost =
+				(sd->max_newidle_lb_cost * 253) / 256;
+			sd->next_decay_max_lb_cost = jiffies + HZ;
+		}
+
 		if (!(sd->flags & SD_LOAD_BALANCE))
 			continue;
 
@@ -5635,7 +5799,8 @@ static inline void schedule_debug(struct task_struct *prev)
 #endif
 }
 
-static void put_prev_task(struct rq *rq, struct task_struct *p)
+/* Update the running/overlap averages of a task being descheduled */
+static void put_prev_task_avg(struct task_struct *p)
 {
 	u64 runtime = p->se.sum_exec_runtime - p->se.prev_sum_exec_runtime;
 
@@ -5656,6 +5821,11 @@ static void put_prev_task(struct rq *rq, struct task_struct *p)
 	} else {
 		update_avg(&p->se.avg_running, 0);
 	}
+}
+
+static void put_prev_task(struct rq *rq, struct task_struct *p)
+{
+	put_prev_task_avg(p);
 	p->sched_class->put_prev_task(rq, p);
 }
 
@@ -5691,6 +5861,19 @@ pick_next_task(struct rq *rq)
 	}
 }
 
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	/* Preempted, the task may be in the middle of adding to its plug. */
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	/*
+	 * If we are going to sleep and we have plugged IO queued,
+	 * make sure to submit it to avoid deadlocks.
+	 */
+	if (blk_needs_flush_plug(tsk))
+		blk_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -5701,6 +5884,7 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -5722,10 +5906,24 @@ need_resched_nonpreemptible:
 	clear_tsk_need_resched(prev);
 
 	if (prev->state && !(preempt_count() & PREEMPT_ACTIVE)) {
-		if (unlikely(signal_pending_state(prev->state, prev)))
+		if (unlikely(signal_pending_state(prev->state, prev))) {
 			prev->state = TASK_RUNNING;
-		else
+		} else {
+			/*
+			 * If a worker is going to sleep, notify and
+			 * ask workqueue whether it wants to wake up a
+			 * task to maintain concurrency.  If so, wake
+			 * up the task.
+			 */
+			if (prev->flags & PF_WQ_WORKER) {
+				struct task_struct *to_wakeup;
+
+				to_wakeup = wq_worker_sleeping(prev, cpu);
+				if (to_wakeup)
+					try_to_wake_up_local(to_wakeup);
+			}
 			deactivate_task(rq, prev, 1);
+		}
 		switch_count = &prev->nvcsw;
 	}
 
@@ -5734,8 +5932,20 @@ need_resched_nonpreemptible:
 	if (unlikely(!rq->nr_running))
 		idle_balance(cpu, rq);
 
-	put_prev_task(rq, prev);
-	next = pick_next_task(rq);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	if (likely(prev->sched_class == &fair_sched_class &&
+		   rq->cfs.nr_running && !rq->rt.rt_nr_running)) {
+		put_prev_task_avg(prev);
+		next = pick_next_task_fair_prev(rq, prev);
+		/* all of it throttled */
+		if (unlikely(!next))
+			next = pick_next_task(rq);
+	} else
+#endif
+	{
+		put_prev_task(rq, prev);
+		next = pick_next_task(rq);
+	}
 
 	if (likely(prev != next)) {
 		sched_info_switch(prev, next);
@@ -6438,6 +6648,19 @@ int idle_cpu(int cpu)
 	return cpu_curr(cpu) == cpu_rq(cpu)->idle;
 }
 
+/**
+ * vcpu_is_blocked - has the hypervisor descheduled a cpu until an event?
+ * @cpu: the processor in question.
+ *
+ * A blocked virtual cpu is not necessarily idle, it may be waiting for
+ * a contended lock, but interrupting it just to have it look around is
+ * wasted work.  Hypervisor backends override this.
+ */
+bool __weak vcpu_is_blocked(int cpu)
+{
+	return false;
+}
+
 /**
  * idle_task - return the idle task for a given cpu.
  * @cpu: the processor in question.
@@ -7671,6 +7894,9 @@ static void migrate_dead_tasks(unsigned int dead_cpu)
 	struct rq *rq = cpu_rq(dead_cpu);
 	struct task_struct *next;
 
+	/* throttled tasks are invisible to pick_next_task() */
+	unthrottle_offline_cfs_rqs(rq);
+
 	for ( ; ; ) {
 		if (!rq->nr_running)
 			break;
@@ -7758,7 +7984,7 @@ set_table_entry(struct ctl_table *entry,
 static struct ctl_table *
 sd_alloc_ctl_domain_table(struct sched_domain *sd)
 {
-	struct ctl_table *table = sd_alloc_ctl_entry(13);
+	struct ctl_table *table = sd_alloc_ctl_entry(14);
 
 	if (table == NULL)
 		return NULL;
@@ -7788,7 +8014,10 @@ sd_alloc_ctl_domain_table(struct sched_domain *sd)
 		sizeof(int), 0644, proc_dointvec_minmax);
 	set_table_entry(&table[11], "name", sd->name,
 		CORENAME_MAX_SIZE, 0444, proc_dostring);
-	/* &table[12] is terminator */
+	set_table_entry(&table[12], "max_newidle_lb_cost",
+		&sd->max_newidle_lb_cost,
+		sizeof(long), 0644, proc_doulongvec_minmax);
+	/* &table[13] is terminator */
 
 	return table;
 }
@@ -9555,6 +9784,7 @@ static void init_cfs_rq(struct cfs_rq *cfs_rq, struct rq *rq)
 	INIT_LIST_HEAD(&cfs_rq->tasks);
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	cfs_rq->rq = rq;
+	init_cfs_rq_runtime(cfs_rq);
 #endif
 	cfs_rq->min_vruntime = (u64)(-(1LL << 20));
 }
@@ -9710,11 +9940,14 @@ void __init sched_init(void)
 	init_rt_bandwidth(&init_task_group.rt_bandwidth,
 			global_rt_period(), global_rt_runtime());
 #endif /* CONFIG_RT_GROUP_SCHED */
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	init_cfs_bandwidth(tg_cfs_bandwidth(&init_task_group));
+#endif
 
 #ifdef CONFIG_CGROUP_SCHED
 	list_add(&init_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&init_task_group.children);
-
+	autogroup_init(&init_task);
 #endif /* CONFIG_CGROUP_SCHED */
 
 #if defined CONFIG_FAIR_GROUP_SCHED && defined CONFIG_SMP
@@ -9993,6 +10226,8 @@ static void free_fair_sched_group(struct task_group *tg)
 {
 	int i;
 
+	destroy_cfs_bandwidth(tg_cfs_bandwidth(tg));
+
 	for_each_possible_cpu(i) {
 		if (tg->cfs_rq)
 			kfree(tg->cfs_rq[i]);
@@ -10012,6 +10247,9 @@ int alloc_fair_sched_group(struct task_group *tg, struct task_group *parent)
 	struct rq *rq;
 	int i;
 
+	/* before any failure: free_fair_sched_group() cancels its timer */
+	init_cfs_bandwidth(tg_cfs_bandwidth(tg));
+
 	tg->cfs_rq = kzalloc(sizeof(cfs_rq) * nr_cpu_ids, GFP_KERNEL);
 	if (!tg->cfs_rq)
 		goto err;
@@ -10166,6 +10404,7 @@ static void free_sched_group(struct task_group *tg)
 {
 	free_fair_sched_group(tg);
 	free_rt_sched_group(tg);
+	autogroup_free(tg);
 	kfree(tg);
 }
 
@@ -10735,6 +10974,138 @@ static u64 cpu_shares_read_u64(struct cgroup *cgrp, struct cftype *cft)
 
 	return (u64) tg->shares;
 }
+
+#ifdef CONFIG_CFS_BANDWIDTH
+static DEFINE_MUTEX(cfs_constraints_mutex);
+
+static const u64 max_cfs_quota_period = 1 * NSEC_PER_SEC; /* 1s */
+static const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
+
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+{
+	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(tg);
+	int i, runtime_enabled;
+
+	if (tg == &root_task_group)
+		return -EINVAL;
+
+	/*
+	 * Every period must bring some runtime, or a group throttled deep
+	 * into arrears would have to sit out a long stretch of periods.
+	 */
+	if (quota < min_cfs_quota_period || period < min_cfs_quota_period)
+		return -EINVAL;
+
+	if (period > max_cfs_quota_period)
+		return -EINVAL;
+
+	mutex_lock(&cfs_constraints_mutex);
+	runtime_enabled = quota != RUNTIME_INF;
+
+	spin_lock_irq(&cfs_b->lock);
+	cfs_b->period = ns_to_ktime(period);
+	cfs_b->quota = quota;
+	cfs_b->runtime = quota;
+	spin_unlock_irq(&cfs_b->lock);
+
+	for_each_possible_cpu(i) {
+		struct cfs_rq *cfs_rq = tg->cfs_rq[i];
+		struct rq *rq = rq_of(cfs_rq);
+
+		spin_lock_irq(&rq->lock);
+		cfs_rq->runtime_enabled = runtime_enabled;
+		cfs_rq->runtime_remaining = 0;
+		if (cfs_rq_throttled(cfs_rq)) {
+			update_rq_clock(rq);
+			unthrottle_cfs_rq(cfs_rq);
+		}
+		spin_unlock_irq(&rq->lock);
+	}
+	mutex_unlock(&cfs_constraints_mutex);
+
+	return 0;
+}
+
+static int tg_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
+{
+	u64 quota, period;
+
+	period = ktime_to_ns(tg_cfs_bandwidth(tg)->period);
+	if (cfs_quota_us < 0)
+		quota = RUNTIME_INF;
+	else
+		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
+
+	return tg_set_cfs_bandwidth(tg, period, quota);
+}
+
+static long tg_get_cfs_quota(struct task_group *tg)
+{
+	u64 quota_us;
+
+	if (tg_cfs_bandwidth(tg)->quota == RUNTIME_INF)
+		return -1;
+
+	quota_us = tg_cfs_bandwidth(tg)->quota;
+	do_div(quota_us, NSEC_PER_USEC);
+
+	return quota_us;
+}
+
+static int tg_set_cfs_period(struct task_group *tg, u64 cfs_period_us)
+{
+	u64 quota, period;
+
+	period = cfs_period_us * NSEC_PER_USEC;
+	quota = tg_cfs_bandwidth(tg)->quota;
+
+	return tg_set_cfs_bandwidth(tg, period, quota);
+}
+
+static u64 tg_get_cfs_period(struct task_group *tg)
+{
+	u64 cfs_period_us;
+
+	cfs_period_us = ktime_to_ns(tg_cfs_bandwidth(tg)->period);
+	do_div(cfs_period_us, NSEC_PER_USEC);
+
+	return cfs_period_us;
+}
+
+static s64 cpu_cfs_quota_read_s64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_quota(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_quota_write_s64(struct cgroup *cgrp, struct cftype *cftype,
+				   s64 cfs_quota_us)
+{
+	return tg_set_cfs_quota(cgroup_tg(cgrp), cfs_quota_us);
+}
+
+static u64 cpu_cfs_period_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return tg_get_cfs_period(cgroup_tg(cgrp));
+}
+
+static int cpu_cfs_period_write_u64(struct cgroup *cgrp, struct cftype *cftype,
+				    u64 cfs_period_us)
+{
+	return tg_set_cfs_period(cgroup_tg(cgrp), cfs_period_us);
+}
+
+static int cpu_stats_show(struct cgroup *cgrp, struct cftype *cft,
+			  struct cgroup_map_cb *cb)
+{
+	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cgroup_tg(cgrp));
+
+	cb->fill(cb, "nr_periods", cfs_b->nr_periods);
+	cb->fill(cb, "nr_throttled", cfs_b->nr_throttled);
+	cb->fill(cb, "throttled_time", cfs_b->throttled_time);
+
+	return 0;
+}
+#endif /* CONFIG_CFS_BANDWIDTH */
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -10769,6 +11140,22 @@ static struct cftype cpu_files[] = {
 		.write_u64 = cpu_shares_write_u64,
 	},
 #endif
+#ifdef CONFIG_CFS_BANDWIDTH
+	{
+		.name = "cfs_quota_us",
+		.read_s64 = cpu_cfs_quota_read_s64,
+		.write_s64 = cpu_cfs_quota_write_s64,
+	},
+	{
+		.name = "cfs_period_us",
+		.read_u64 = cpu_cfs_period_read_u64,
+		.write_u64 = cpu_cfs_period_write_u64,
+	},
+	{
+		.name = "stat",
+		.read_map = cpu_stats_show,
+	},
+#endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	{
 		.name = "rt_runtime_us",
@@ -11161,6 +11548,16 @@ void synchronize_sched_expedited(void)
 		req = &per_cpu(rcu_migration_req, cpu);
 		init_completion(&req->done);
 		req->task = NULL;
+		/*
+		 * A cpu in dynticks idle cannot be in a read-side critical
+		 * section, leave it sleeping.  A vcpu that is merely
+		 * blocked in the hypervisor might be, so it gets woken.
+		 */
+		if (rcu_cpu_in_dynticks_idle(cpu)) {
+			req->dest_cpu = RCU_MIGRATION_GOT_QS;
+			complete(&req->done);
+			continue;
+		}
 		req->dest_cpu = RCU_MIGRATION_NEED_QS;
 		spin_lock_irqsave(&rq->lock, flags);
 		list_add(&req->list, &rq->migration_queue);
@@ -0,0 +1,50 @@
+#ifdef CONFIG_SCHED_AUTOGROUP
+
+/*
+ * A task group created for each session by setsid(), so that the tasks
+ * of one session compete for cpu with other sessions as a whole.
+ */
+struct autogroup {
+	struct kref		kref;
+	struct task_group	*tg;
+	unsigned long		id;
+};
+
+static inline bool task_group_is_autogroup(struct task_group *tg)
+{
+	return !!tg->autogroup;
+}
+
+/*
+ * Tasks left in the root group by the cpu cgroup controller run in their
+ * session's autogroup instead.  Explicit cgroup placement always wins.
+ */
+static inline struct task_group *
+autogroup_task_group(struct task_struct *p, struct task_group *tg)
+{
+	if (!ACCESS_ONCE(sysctl_sched_autogroup_enabled))
+		return tg;
+	if (tg != &root_task_group)
+		return tg;
+	/*
+	 * The autogroup can only be relied on to stay around while
+	 * autogroup_move_group() can still find us on the thread list.
+	 */
+	if (p->flags & PF_EXITING)
+		return tg;
+
+	return p->signal->autogroup->tg;
+}
+
+#else /* !CONFIG_SCHED_AUTOGROUP */
+
+static inline void autogroup_init(struct task_struct *init_task) { }
+static inline void autogroup_free(struct task_group *tg) { }
+
+static inline struct task_group *
+autogroup_task_group(struct task_struct *p, struct task_group *tg)
+{
+	return tg;
+}
+
+#endif /* CONFIG_SCHED_AUTOGROUP */
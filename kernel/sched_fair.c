@@ -76,6 +76,16 @@ unsigned int normalized_sysctl_sched_wakeup_granularity = 1000000UL;
 
 const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/*
+ * Amount of runtime a cfs_rq takes from its group's quota at a time.
+ * A smaller slice leaves less unused runtime stranded on other cpus at
+ * the cost of more trips to the global pool.
+ * default: 5 msec, units: microseconds
+ */
+unsigned int sysctl_sched_cfs_bandwidth_slice = 5000UL;
+#endif
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -493,6 +503,9 @@ __update_curr(struct cfs_rq *cfs_rq, struct sched_entity *curr,
 	update_min_vruntime(cfs_rq);
 }
 
+static __always_inline void
+account_cfs_rq_runtime(struct cfs_rq *cfs_rq, unsigned long delta_exec);
+
 static void update_curr(struct cfs_rq *cfs_rq)
 {
 	struct sched_entity *curr = cfs_rq->curr;
@@ -521,6 +534,8 @@ static void update_curr(struct cfs_rq *cfs_rq)
 		cpuacct_charge(curtask, delta_exec);
 		account_group_exec_runtime(curtask, delta_exec);
 	}
+
+	account_cfs_rq_runtime(cfs_rq, delta_exec);
 }
 
 static inline void
@@ -922,6 +937,8 @@ static struct sched_entity *pick_next_entity(struct cfs_rq *cfs_rq)
 	return se;
 }
 
+static void check_cfs_rq_runtime(struct cfs_rq *cfs_rq);
+
 static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 {
 	/*
@@ -931,6 +948,9 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 	if (prev->on_rq)
 		update_curr(cfs_rq);
 
+	/* throttle cfs_rqs exceeding runtime */
+	check_cfs_rq_runtime(cfs_rq);
+
 	check_spread(cfs_rq, prev);
 	if (prev->on_rq) {
 		update_stats_wait_start(cfs_rq, prev);
@@ -969,6 +989,405 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 		check_preempt_tick(cfs_rq, curr);
 }
 
+/**************************************************
+ * CFS bandwidth control machinery
+ */
+
+#ifdef CONFIG_CFS_BANDWIDTH
+/*
+ * default period for cfs group bandwidth.
+ * default: 0.1s, units: nanoseconds
+ */
+static inline u64 default_cfs_period(void)
+{
+	return 100000000ULL;
+}
+
+static inline u64 sched_cfs_bandwidth_slice(void)
+{
+	return (u64)sysctl_sched_cfs_bandwidth_slice * NSEC_PER_USEC;
+}
+
+static inline struct cfs_bandwidth *tg_cfs_bandwidth(struct task_group *tg)
+{
+	return &tg->cfs_bandwidth;
+}
+
+static inline int cfs_rq_throttled(struct cfs_rq *cfs_rq)
+{
+	return cfs_rq->throttled;
+}
+
+/* is this cfs_rq, or any group above it, throttled? */
+static int throttled_hierarchy(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *se = cfs_rq->tg->se[cpu_of(rq_of(cfs_rq))];
+
+	if (cfs_rq_throttled(cfs_rq))
+		return 1;
+
+	for_each_sched_entity(se) {
+		if (cfs_rq_throttled(cfs_rq_of(se)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* can a task of this group be moved between the two cpus? */
+static inline int throttled_lb_pair(struct cfs_rq *cfs_rq, int dest_cpu)
+{
+	return throttled_hierarchy(cfs_rq) ||
+	       throttled_hierarchy(cfs_rq->tg->cfs_rq[dest_cpu]);
+}
+
+/* does @se sit below a group with a quota on this cpu? */
+static int entity_bandwidth_enabled(struct sched_entity *se)
+{
+	for_each_sched_entity(se) {
+		if (cfs_rq_of(se)->runtime_enabled)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* requires cfs_b->lock */
+static void start_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	ktime_t now, soft, hard;
+	unsigned long delta;
+
+	if (cfs_b->timer_active)
+		return;
+
+	cfs_b->timer_active = 1;
+	now = hrtimer_cb_get_time(&cfs_b->period_timer);
+	hrtimer_forward(&cfs_b->period_timer, now, cfs_b->period);
+
+	soft = hrtimer_get_softexpires(&cfs_b->period_timer);
+	hard = hrtimer_get_expires(&cfs_b->period_timer);
+	delta = ktime_to_ns(ktime_sub(hard, soft));
+	/* we may hold rq->lock: don't let the hrtimer code wake softirqd */
+	__hrtimer_start_range_ns(&cfs_b->period_timer, soft, delta,
+			HRTIMER_MODE_ABS_PINNED, 0);
+}
+
+/*
+ * Top up cfs_rq's local runtime with up to a slice from the group's pool;
+ * returns 0 if the pool was dry and cfs_rq is still out of runtime.
+ */
+static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
+{
+	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
+	u64 amount = 0, min_amount;
+
+	/* runtime_remaining <= 0 here, so this is at least a slice */
+	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
+
+	spin_lock(&cfs_b->lock);
+	if (cfs_b->quota == RUNTIME_INF)
+		amount = min_amount;
+	else {
+		start_cfs_bandwidth(cfs_b);
+
+		if (cfs_b->runtime > 0) {
+			amount = min(cfs_b->runtime, min_amount);
+			cfs_b->runtime -= amount;
+			cfs_b->idle = 0;
+		}
+	}
+	spin_unlock(&cfs_b->lock);
+
+	cfs_rq->runtime_remaining += amount;
+
+	return cfs_rq->runtime_remaining > 0;
+}
+
+static void
+__account_cfs_rq_runtime(struct cfs_rq *cfs_rq, unsigned long delta_exec)
+{
+	cfs_rq->runtime_remaining -= delta_exec;
+	if (likely(cfs_rq->runtime_remaining > 0))
+		return;
+
+	/*
+	 * Out of runtime: if no more can be had, reschedule so that
+	 * put_prev_entity() throttles us.
+	 */
+	if (!assign_cfs_rq_runtime(cfs_rq) && likely(cfs_rq->curr))
+		resched_task(rq_of(cfs_rq)->curr);
+}
+
+static __always_inline void
+account_cfs_rq_runtime(struct cfs_rq *cfs_rq, unsigned long delta_exec)
+{
+	if (!cfs_rq->runtime_enabled)
+		return;
+
+	__account_cfs_rq_runtime(cfs_rq, delta_exec);
+}
+
+static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
+	struct sched_entity *se = cfs_rq->tg->se[cpu_of(rq)];
+
+	/* take the group off its parents, as if it went to sleep */
+	for_each_sched_entity(se) {
+		struct cfs_rq *qcfs_rq = cfs_rq_of(se);
+
+		if (!se->on_rq)
+			break;
+		dequeue_entity(qcfs_rq, se, 1);
+		if (qcfs_rq->load.weight)
+			break;
+	}
+
+	cfs_rq->throttled = 1;
+	cfs_rq->throttled_timestamp = rq->clock;
+
+	spin_lock(&cfs_b->lock);
+	list_add_tail_rcu(&cfs_rq->throttled_list, &cfs_b->throttled_cfs_rq);
+	start_cfs_bandwidth(cfs_b);
+	spin_unlock(&cfs_b->lock);
+}
+
+static void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
+	struct sched_entity *se = cfs_rq->tg->se[cpu_of(rq)];
+
+	cfs_rq->throttled = 0;
+
+	spin_lock(&cfs_b->lock);
+	cfs_b->throttled_time += rq->clock - cfs_rq->throttled_timestamp;
+	list_del_rcu(&cfs_rq->throttled_list);
+	spin_unlock(&cfs_b->lock);
+
+	if (!cfs_rq->load.weight)
+		return;
+
+	for_each_sched_entity(se) {
+		if (se->on_rq)
+			break;
+		cfs_rq = cfs_rq_of(se);
+		enqueue_entity(cfs_rq, se, ENQUEUE_WAKEUP);
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+	}
+
+	/* the cpu may have gone idle with everything throttled */
+	if (rq->curr == rq->idle && rq->cfs.nr_running)
+		resched_task(rq->curr);
+}
+
+/* throttle a cfs_rq that ran out of runtime while it was running */
+static void check_cfs_rq_runtime(struct cfs_rq *cfs_rq)
+{
+	if (likely(!cfs_rq->runtime_enabled || cfs_rq->runtime_remaining > 0))
+		return;
+
+	if (cfs_rq_throttled(cfs_rq))
+		return;
+
+	throttle_cfs_rq(cfs_rq);
+}
+
+/*
+ * Hand @remaining runtime out to the throttled cfs_rqs in order, and let
+ * each one that is back in credit run again.  Returns what was used.
+ */
+static u64 distribute_cfs_runtime(struct cfs_bandwidth *cfs_b, u64 remaining)
+{
+	struct cfs_rq *cfs_rq;
+	u64 runtime, starting = remaining;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cfs_rq, &cfs_b->throttled_cfs_rq,
+				throttled_list) {
+		struct rq *rq = rq_of(cfs_rq);
+
+		spin_lock(&rq->lock);
+		if (!cfs_rq_throttled(cfs_rq))
+			goto next;
+
+		runtime = -cfs_rq->runtime_remaining + 1;
+		if (runtime > remaining)
+			runtime = remaining;
+		remaining -= runtime;
+
+		cfs_rq->runtime_remaining += runtime;
+		if (cfs_rq->runtime_remaining > 0) {
+			update_rq_clock(rq);
+			unthrottle_cfs_rq(cfs_rq);
+		}
+next:
+		spin_unlock(&rq->lock);
+
+		if (!remaining)
+			break;
+	}
+	rcu_read_unlock();
+
+	return starting - remaining;
+}
+
+/*
+ * Refill the group's pool for the new period and unthrottle what it can
+ * pay for.  Returns 1 once a whole period went by unused, which stops
+ * the timer until assign_cfs_rq_runtime() needs it again.
+ */
+static int do_sched_cfs_period_timer(struct cfs_bandwidth *cfs_b, int overrun)
+{
+	u64 runtime;
+	int idle = 1, throttled;
+
+	spin_lock(&cfs_b->lock);
+	if (cfs_b->quota == RUNTIME_INF)
+		goto out_unlock;
+
+	throttled = !list_empty(&cfs_b->throttled_cfs_rq);
+	idle = cfs_b->idle && !throttled;
+	cfs_b->nr_periods += overrun;
+
+	if (idle)
+		goto out_unlock;
+
+	cfs_b->runtime = cfs_b->quota;
+	/* assign_cfs_rq_runtime() clears this if the period gets used */
+	cfs_b->idle = 1;
+
+	if (!throttled)
+		goto out_unlock;
+
+	cfs_b->nr_throttled += overrun;
+	runtime = cfs_b->runtime;
+
+	/* distribute takes the rq locks, which nest outside cfs_b->lock */
+	spin_unlock(&cfs_b->lock);
+	runtime = distribute_cfs_runtime(cfs_b, runtime);
+	spin_lock(&cfs_b->lock);
+
+	cfs_b->runtime -= min(runtime, cfs_b->runtime);
+	cfs_b->idle = 0;
+
+out_unlock:
+	if (idle)
+		cfs_b->timer_active = 0;
+	spin_unlock(&cfs_b->lock);
+
+	return idle;
+}
+
+static enum hrtimer_restart sched_cfs_period_timer(struct hrtimer *timer)
+{
+	struct cfs_bandwidth *cfs_b =
+		container_of(timer, struct cfs_bandwidth, period_timer);
+	ktime_t now;
+	int overrun;
+	int idle = 0;
+
+	for (;;) {
+		now = hrtimer_cb_get_time(timer);
+		overrun = hrtimer_forward(timer, now, cfs_b->period);
+
+		if (!overrun)
+			break;
+
+		idle = do_sched_cfs_period_timer(cfs_b, overrun);
+		/* timer_active is clear: it may be restarted under us */
+		if (idle)
+			break;
+	}
+
+	return idle ? HRTIMER_NORESTART : HRTIMER_RESTART;
+}
+
+static void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	spin_lock_init(&cfs_b->lock);
+	cfs_b->runtime = 0;
+	cfs_b->quota = RUNTIME_INF;
+	cfs_b->period = ns_to_ktime(default_cfs_period());
+
+	INIT_LIST_HEAD(&cfs_b->throttled_cfs_rq);
+	hrtimer_init(&cfs_b->period_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	cfs_b->period_timer.function = sched_cfs_period_timer;
+}
+
+static void init_cfs_rq_runtime(struct cfs_rq *cfs_rq)
+{
+	cfs_rq->runtime_enabled = 0;
+	INIT_LIST_HEAD(&cfs_rq->throttled_list);
+}
+
+static void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	hrtimer_cancel(&cfs_b->period_timer);
+}
+
+/*
+ * A dying cpu's throttled tasks must still be migrated off it; give its
+ * cfs_rqs a token of runtime so that they can be picked.
+ */
+#ifdef CONFIG_HOTPLUG_CPU
+static void unthrottle_offline_cfs_rqs(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq;
+
+	for_each_leaf_cfs_rq(rq, cfs_rq) {
+		if (!cfs_rq->runtime_enabled)
+			continue;
+
+		cfs_rq->runtime_remaining = 1;
+		if (cfs_rq_throttled(cfs_rq))
+			unthrottle_cfs_rq(cfs_rq);
+	}
+}
+#endif
+#else /* !CONFIG_CFS_BANDWIDTH */
+struct cfs_bandwidth;
+
+static __always_inline void
+account_cfs_rq_runtime(struct cfs_rq *cfs_rq, unsigned long delta_exec) {}
+static inline void check_cfs_rq_runtime(struct cfs_rq *cfs_rq) {}
+
+static inline int cfs_rq_throttled(struct cfs_rq *cfs_rq)
+{
+	return 0;
+}
+
+static inline int throttled_hierarchy(struct cfs_rq *cfs_rq)
+{
+	return 0;
+}
+
+static inline int throttled_lb_pair(struct cfs_rq *cfs_rq, int dest_cpu)
+{
+	return 0;
+}
+
+static inline int entity_bandwidth_enabled(struct sched_entity *se)
+{
+	return 0;
+}
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+static inline struct cfs_bandwidth *tg_cfs_bandwidth(struct task_group *tg)
+{
+	return NULL;
+}
+#endif
+
+static inline void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b) {}
+static inline void init_cfs_rq_runtime(struct cfs_rq *cfs_rq) {}
+static inline void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b) {}
+static inline void unthrottle_offline_cfs_rqs(struct rq *rq) {}
+#endif /* CONFIG_CFS_BANDWIDTH */
+
 /**************************************************
  * CFS operations on tasks:
  */
@@ -1051,6 +1470,9 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int wakeup, bool head)
 			break;
 		cfs_rq = cfs_rq_of(se);
 		enqueue_entity(cfs_rq, se, flags);
+		/* unthrottle_cfs_rq() puts a throttled group back later */
+		if (cfs_rq_throttled(cfs_rq))
+			break;
 		flags = ENQUEUE_WAKEUP;
 	}
 
@@ -1070,6 +1492,9 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		dequeue_entity(cfs_rq, se, sleep);
+		/* a throttled group is already off its parent */
+		if (cfs_rq_throttled(cfs_rq))
+			break;
 		/* Don't dequeue parent if it has other entities besides us */
 		if (cfs_rq->load.weight)
 			break;
@@ -1720,6 +2145,10 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 	if (unlikely(se == pse))
 		return;
 
+	/* a throttled task can't run, and mustn't become anyone's buddy */
+	if (unlikely(throttled_hierarchy(cfs_rq_of(pse))))
+		return;
+
 	if (sched_feat(NEXT_BUDDY) && scale && !(wake_flags & WF_FORK))
 		set_next_buddy(pse);
 
@@ -1819,6 +2248,104 @@ static void put_prev_task_fair(struct rq *rq, struct task_struct *prev)
 	}
 }
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * pick_next_entity() as if the runnable current entity @curr had been
+ * put back into the tree first.
+ */
+static struct sched_entity *
+pick_next_entity_curr(struct cfs_rq *cfs_rq, struct sched_entity *curr)
+{
+	struct sched_entity *left = __pick_next_entity(cfs_rq);
+	struct sched_entity *se;
+
+	/* __enqueue_entity() would have put curr right of equal keys */
+	if (!left || (curr &&
+		      entity_key(cfs_rq, curr) < entity_key(cfs_rq, left)))
+		left = curr;
+	se = left;
+
+	if (cfs_rq->next && wakeup_preempt_entity(cfs_rq->next, left) < 1)
+		se = cfs_rq->next;
+
+	if (cfs_rq->last && wakeup_preempt_entity(cfs_rq->last, left) < 1)
+		se = cfs_rq->last;
+
+	clear_buddies(cfs_rq, se);
+
+	return se;
+}
+
+/*
+ * put_prev_task_fair() followed by pick_next_task_fair(), for a fair
+ * @prev when only fair tasks are runnable.  Instead of putting every level
+ * of prev's hierarchy back into the trees and taking the next task's
+ * hierarchy out again, pick with prev's entities still current and only
+ * switch entities below the level where the two paths part.  Switching
+ * between tasks of one group then costs the same at any group depth.
+ */
+static struct task_struct *
+pick_next_task_fair_prev(struct rq *rq, struct task_struct *prev)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se, *pse;
+	struct task_struct *p;
+	int se_depth, pse_depth;
+
+	/*
+	 * Putting prev back may throttle one of its groups, which changes
+	 * the hierarchy we would be picking from: do it the long way.
+	 */
+	if (unlikely(entity_bandwidth_enabled(&prev->se))) {
+		put_prev_task_fair(rq, prev);
+		return pick_next_task_fair(rq);
+	}
+
+	do {
+		struct sched_entity *curr = cfs_rq->curr;
+
+		if (curr && curr->on_rq)
+			update_curr(cfs_rq);
+		else
+			curr = NULL;
+
+		se = pick_next_entity_curr(cfs_rq, curr);
+		/* staying current: start a new slice, as set_next would */
+		if (se == curr)
+			se->prev_sum_exec_runtime = se->sum_exec_runtime;
+		cfs_rq = group_cfs_rq(se);
+	} while (cfs_rq);
+
+	p = task_of(se);
+	if (p == prev)
+		goto out;
+
+	pse = &prev->se;
+	se_depth = depth_se(se);
+	pse_depth = depth_se(pse);
+	while (!is_same_group(se, pse)) {
+		int sd = se_depth, pd = pse_depth;
+
+		if (sd <= pd) {
+			put_prev_entity(cfs_rq_of(pse), pse);
+			pse = parent_entity(pse);
+			pse_depth--;
+		}
+		if (sd >= pd) {
+			set_next_entity(cfs_rq_of(se), se);
+			se = parent_entity(se);
+			se_depth--;
+		}
+	}
+	put_prev_entity(cfs_rq_of(pse), pse);
+	set_next_entity(cfs_rq_of(se), se);
+out:
+	hrtick_start_fair(rq, p);
+
+	return p;
+}
+#endif
+
 #ifdef CONFIG_SMP
 /**************************************************
  * Fair scheduling class load-balancing methods:
@@ -1904,6 +2431,9 @@ load_balance_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 		if (!busiest_cfs_rq->task_weight)
 			continue;
 
+		if (throttled_lb_pair(busiest_cfs_rq, this_cpu))
+			continue;
+
 		rem_load = (u64)rem_load_move * busiest_weight;
 		rem_load = div_u64(rem_load, busiest_h_load + 1);
 
@@ -1949,6 +2479,8 @@ move_one_task_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 	cfs_rq_iterator.next = load_balance_next_fair;
 
 	for_each_leaf_cfs_rq(busiest, busy_cfs_rq) {
+		if (throttled_lb_pair(busy_cfs_rq, this_cpu))
+			continue;
 		/*
 		 * pass busy_cfs_rq argument into
 		 * load_balance_[start|next]_fair iterators
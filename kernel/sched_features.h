@@ -126,3 +126,8 @@ SCHED_FEAT(OWNER_SPIN, 1)
  * Decrement CPU power based on irq activity
  */
 SCHED_FEAT(NONIRQ_POWER, 1)
+
+/*
+ * Decrement CPU power based on time stolen by the hypervisor
+ */
+SCHED_FEAT(STEAL_POWER, 1)
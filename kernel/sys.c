@@ -36,6 +36,7 @@
 #include <linux/cpu.h>
 #include <linux/ptrace.h>
 #include <linux/fs_struct.h>
+#include <linux/futex.h>
 
 #include <linux/compat.h>
 #include <linux/syscalls.h>
@@ -1107,8 +1108,10 @@ SYSCALL_DEFINE0(setsid)
 	err = session;
 out:
 	write_unlock_irq(&tasklist_lock);
-	if (err > 0)
+	if (err > 0) {
 		proc_sid_connector(group_leader);
+		sched_autogroup_create_attach(group_leader);
+	}
 	return err;
 }
 
@@ -1575,6 +1578,16 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			else
 				error = PR_MCE_KILL_DEFAULT;
 			break;
+		case PR_SET_FUTEX_HASH:
+			if (arg3 | arg4 | arg5)
+				return -EINVAL;
+			error = futex_private_hash_set(arg2);
+			break;
+		case PR_GET_FUTEX_HASH:
+			if (arg2 | arg3 | arg4 | arg5)
+				return -EINVAL;
+			error = futex_private_hash_get();
+			break;
 		default:
 			error = -EINVAL;
 			break;
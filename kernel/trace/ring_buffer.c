@@ -5,6 +5,7 @@
  */
 #include <linux/ring_buffer.h>
 #include <linux/trace_clock.h>
+#include <linux/trace_mmap.h>
 #include <linux/ftrace_irq.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
@@ -328,6 +329,7 @@ struct buffer_page {
 	local_t		 write;		/* index for next write */
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
+	unsigned	 id;		/* page index in a user mapping */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -436,6 +438,10 @@ struct ring_buffer_per_cpu {
 	u64				write_stamp;
 	u64				read_stamp;
 	atomic_t			record_disabled;
+	/* user space mapping, see ring_buffer_map() */
+	int				mapped;
+	struct trace_buffer_meta	*meta_page;
+	unsigned long			*subbuf_ids;
 };
 
 struct ring_buffer {
@@ -1258,7 +1264,7 @@ rb_insert_pages(struct ring_buffer_per_cpu *cpu_buffer,
  *
  * Minimum size is 2 * BUF_PAGE_SIZE.
  *
- * Returns -1 on failure.
+ * Returns -1 on failure, -EBUSY if a cpu buffer is mapped to user space.
  */
 int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 {
@@ -1290,6 +1296,15 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	mutex_lock(&buffer->mutex);
 	get_online_cpus();
 
+	/* the user mapping covers the pages the buffer has now */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			put_online_cpus();
+			mutex_unlock(&buffer->mutex);
+			return -EBUSY;
+		}
+	}
+
 	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
 
 	if (size < buffer_size) {
@@ -2931,6 +2946,17 @@ rb_get_reader_page(struct ring_buffer_per_cpu *cpu_buffer)
 	return reader;
 }
 
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = cpu_buffer->reader_page->read;
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+}
+
 static void rb_advance_reader(struct ring_buffer_per_cpu *cpu_buffer)
 {
 	struct ring_buffer_event *event;
@@ -3416,6 +3442,9 @@ void ring_buffer_reset_cpu(struct ring_buffer *buffer, int cpu)
 
 	__raw_spin_unlock(&cpu_buffer->lock);
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
+
  out:
 	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
 
@@ -3545,6 +3574,10 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	/* user space holds on to the pages of a mapped buffer */
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	/*
 	 * We can't do a synchronize_sched here because this
 	 * function can be called in atomic context.
@@ -3689,6 +3722,10 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 
 	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
 
+	/* the data pages must stay where the user mapping has them */
+	if (cpu_buffer->mapped)
+		goto out_unlock;
+
 	reader = rb_get_reader_page(cpu_buffer);
 	if (!reader)
 		goto out_unlock;
@@ -3769,6 +3806,233 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/**
+ * ring_buffer_map - prepare a cpu buffer to be mapped to user space
+ * @buffer: the buffer to map
+ * @cpu: the cpu buffer to map
+ *
+ * Numbers the reader page and the pages of the ring for the mapping
+ * described in <linux/trace_mmap.h> and allocates its meta page.  The
+ * pages themselves are looked up with ring_buffer_map_to_page().
+ *
+ * While the cpu buffer is mapped it can not be resized or swapped, and
+ * ring_buffer_read_page() refuses to swap its pages out.  Consuming
+ * reads keep working, they just show up in the meta page.
+ *
+ * Returns 0 on success, -EBUSY if the cpu buffer is already mapped.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *bpage, *head;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+	unsigned id;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!meta) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* the reader page plus the ring */
+	subbuf_ids = kcalloc(buffer->pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!subbuf_ids) {
+		free_page((unsigned long)meta);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	/*
+	 * Writers move around the ring but never add or remove pages,
+	 * and only readers swap the reader page in, so the reader lock
+	 * is enough to walk them.
+	 */
+	bpage = cpu_buffer->reader_page;
+	bpage->id = 0;
+	subbuf_ids[0] = (unsigned long)bpage->page;
+
+	id = 1;
+	head = bpage = rb_set_head_page(cpu_buffer);
+	do {
+		if (RB_WARN_ON(cpu_buffer, !bpage || id > buffer->pages)) {
+			spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+			kfree(subbuf_ids);
+			free_page((unsigned long)meta);
+			ret = -EIO;
+			goto out;
+		}
+		bpage->id = id;
+		subbuf_ids[id++] = (unsigned long)bpage->page;
+		rb_inc_page(cpu_buffer, &bpage);
+	} while (bpage != head);
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = id;
+
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	cpu_buffer->mapped = 1;
+	rb_update_meta_page(cpu_buffer);
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - undo ring_buffer_map()
+ * @buffer: the buffer that was mapped
+ * @cpu: the cpu buffer that was mapped
+ *
+ * Must only be called once the user space mapping is gone.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (!cpu_buffer->mapped) {
+		mutex_unlock(&buffer->mutex);
+		return -ENODEV;
+	}
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	cpu_buffer->mapped = 0;
+	meta = cpu_buffer->meta_page;
+	subbuf_ids = cpu_buffer->subbuf_ids;
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	kfree(subbuf_ids);
+	free_page((unsigned long)meta);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_to_page - page backing an offset of the user mapping
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ * @pgoff: page offset in the mapping
+ *
+ * Returns the meta page for @pgoff 0 and the ring buffer pages after
+ * it, or NULL if @pgoff is outside the mapping.  To be used from the
+ * fault handler of the mapping set up after ring_buffer_map().
+ */
+struct page *ring_buffer_map_to_page(struct ring_buffer *buffer, int cpu,
+				     unsigned long pgoff)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+	if (!cpu_buffer->mapped)
+		return NULL;
+
+	if (!pgoff)
+		return virt_to_page(cpu_buffer->meta_page);
+
+	if (pgoff > cpu_buffer->meta_page->nr_subbufs)
+		return NULL;
+
+	return virt_to_page((void *)cpu_buffer->subbuf_ids[pgoff - 1]);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_to_page);
+
+/**
+ * ring_buffer_map_get_reader - hand the next reader page to user space
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * User space is done with what is on the current reader page.  If the
+ * writer added to that page since, user space is assumed to read that
+ * too and the page stays; otherwise the next page with data, if any,
+ * is swapped in as the reader page.  This is the only lock the mmapped
+ * consumer takes, once per page, and the result is in the meta page.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	unsigned size;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (rb_per_cpu_empty(cpu_buffer))
+		goto update;
+
+	reader = cpu_buffer->reader_page;
+	size = rb_page_size(reader);
+
+	if (reader->read < size) {
+		/* account for what user space is going to read from it */
+		while (reader->read < size)
+			rb_advance_reader(cpu_buffer);
+		goto update;
+	}
+
+	rb_get_reader_page(cpu_buffer);
+
+ update:
+	rb_update_meta_page(cpu_buffer);
+ out:
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
@@ -12,6 +12,7 @@
  *  Copyright (C) 2004 William Lee Irwin III
  */
 #include <linux/ring_buffer.h>
+#include <linux/trace_mmap.h>
 #include <linux/utsrelease.h>
 #include <linux/stacktrace.h>
 #include <linux/writeback.h>
@@ -241,6 +242,14 @@ static struct tracer		*trace_types __read_mostly;
 /* current_trace points to the tracer that is currently active */
 static struct tracer		*current_trace __read_mostly;
 
+/*
+ * Number of per cpu buffers mapped to user space. The latency tracers
+ * swap the whole buffer with max_tr which would leave the mappings
+ * behind, so they can't be used while this is set. Protected by
+ * trace_types_lock.
+ */
+static int			tracing_buffers_mapped;
+
 /*
  * trace_types_lock is used to protect the trace_types list.
  * This lock is also used to keep user access serialized.
@@ -2737,6 +2746,10 @@ static int tracing_set_tracer(const char *buf)
 	}
 	if (t == current_trace)
 		goto out;
+	if (t->print_max && tracing_buffers_mapped) {
+		ret = -EBUSY;
+		goto out;
+	}
 
 	trace_branch_disable();
 	if (current_trace && current_trace->reset)
@@ -3177,13 +3190,14 @@ static ssize_t tracing_splice_read_pipe(struct file *filp,
 					size_t len,
 					unsigned int flags)
 {
-	struct page *pages[PIPE_BUFFERS];
-	struct partial_page partial[PIPE_BUFFERS];
+	struct page *pages_def[PIPE_DEF_BUFFERS];
+	struct partial_page partial_def[PIPE_DEF_BUFFERS];
 	struct trace_iterator *iter = filp->private_data;
 	struct splice_pipe_desc spd = {
-		.pages		= pages,
-		.partial	= partial,
+		.pages		= pages_def,
+		.partial	= partial_def,
 		.nr_pages	= 0, /* This gets updated below. */
+		.nr_pages_max	= PIPE_DEF_BUFFERS,
 		.flags		= flags,
 		.ops		= &tracing_pipe_buf_ops,
 		.spd_release	= tracing_spd_release_pipe,
@@ -3193,6 +3207,9 @@ static ssize_t tracing_splice_read_pipe(struct file *filp,
 	size_t rem;
 	unsigned int i;
 
+	if (splice_grow_spd(pipe, &spd))
+		return -ENOMEM;
+
 	/* copy the tracer to avoid using a global lock all around */
 	mutex_lock(&trace_types_lock);
 	if (unlikely(old_tracer != current_trace && current_trace)) {
@@ -3222,23 +3239,23 @@ static ssize_t tracing_splice_read_pipe(struct file *filp,
 	trace_event_read_lock();
 
 	/* Fill as many pages as possible. */
-	for (i = 0, rem = len; i < PIPE_BUFFERS && rem; i++) {
-		pages[i] = alloc_page(GFP_KERNEL);
-		if (!pages[i])
+	for (i = 0, rem = len; i < spd.nr_pages_max && rem; i++) {
+		spd.pages[i] = alloc_page(GFP_KERNEL);
+		if (!spd.pages[i])
 			break;
 
 		rem = tracing_fill_pipe_page(rem, iter);
 
 		/* Copy the data into the page, so we can start over. */
 		ret = trace_seq_to_buffer(&iter->seq,
-					  page_address(pages[i]),
+					  page_address(spd.pages[i]),
 					  iter->seq.len);
 		if (ret < 0) {
-			__free_page(pages[i]);
+			__free_page(spd.pages[i]);
 			break;
 		}
-		partial[i].offset = 0;
-		partial[i].len = iter->seq.len;
+		spd.partial[i].offset = 0;
+		spd.partial[i].len = iter->seq.len;
 
 		trace_seq_init(&iter->seq);
 	}
@@ -3248,12 +3265,14 @@ static ssize_t tracing_splice_read_pipe(struct file *filp,
 
 	spd.nr_pages = i;
 
-	return splice_to_pipe(pipe, &spd);
+	ret = splice_to_pipe(pipe, &spd);
+out:
+	splice_shrink_spd(&spd);
+	return ret;
 
 out_err:
 	mutex_unlock(&iter->mutex);
-
-	return ret;
+	goto out;
 }
 
 static ssize_t
@@ -3492,6 +3511,7 @@ struct ftrace_buffer_info {
 	void			*spare;
 	int			cpu;
 	unsigned int		read;
+	atomic_t		mmap_count;
 };
 
 static int tracing_buffers_open(struct inode *inode, struct file *filp)
@@ -3646,11 +3666,12 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 			    unsigned int flags)
 {
 	struct ftrace_buffer_info *info = file->private_data;
-	struct partial_page partial[PIPE_BUFFERS];
-	struct page *pages[PIPE_BUFFERS];
+	struct partial_page partial_def[PIPE_DEF_BUFFERS];
+	struct page *pages_def[PIPE_DEF_BUFFERS];
 	struct splice_pipe_desc spd = {
-		.pages		= pages,
-		.partial	= partial,
+		.pages		= pages_def,
+		.partial	= partial_def,
+		.nr_pages_max	= PIPE_DEF_BUFFERS,
 		.flags		= flags,
 		.ops		= &buffer_pipe_buf_ops,
 		.spd_release	= buffer_spd_release,
@@ -3659,21 +3680,27 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	int entries, size, i;
 	size_t ret;
 
+	if (splice_grow_spd(pipe, &spd))
+		return -ENOMEM;
+
 	if (*ppos & (PAGE_SIZE - 1)) {
 		WARN_ONCE(1, "Ftrace: previous read must page-align\n");
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
 	if (len & (PAGE_SIZE - 1)) {
 		WARN_ONCE(1, "Ftrace: splice_read should page-align\n");
-		if (len < PAGE_SIZE)
-			return -EINVAL;
+		if (len < PAGE_SIZE) {
+			ret = -EINVAL;
+			goto out;
+		}
 		len &= PAGE_MASK;
 	}
 
 	entries = ring_buffer_entries_cpu(info->tr->buffer, info->cpu);
 
-	for (i = 0; i < PIPE_BUFFERS && len && entries; i++, len -= PAGE_SIZE) {
+	for (i = 0; i < spd.nr_pages_max && len && entries; i++, len -= PAGE_SIZE) {
 		struct page *page;
 		int r;
 
@@ -3727,10 +3754,105 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 		else
 			ret = 0;
 		/* TODO: block */
-		return ret;
+		goto out;
 	}
 
 	ret = splice_to_pipe(pipe, &spd);
+	splice_shrink_spd(&spd);
+out:
+	return ret;
+}
+
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!atomic_read(&info->mmap_count))
+		return -EINVAL;
+
+	return ring_buffer_map_get_reader(info->tr->buffer, info->cpu);
+}
+
+static int tracing_buffers_mmap_fault(struct vm_area_struct *vma,
+				      struct vm_fault *vmf)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	vmf->page = ring_buffer_map_to_page(info->tr->buffer, info->cpu,
+					    vmf->pgoff);
+	if (!vmf->page)
+		return VM_FAULT_SIGBUS;
+
+	get_page(vmf->page);
+
+	return 0;
+}
+
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	atomic_inc(&info->mmap_count);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	if (!atomic_dec_and_mutex_lock(&info->mmap_count, &trace_types_lock))
+		return;
+
+	ring_buffer_unmap(info->tr->buffer, info->cpu);
+	tracing_buffers_mapped--;
+
+	mutex_unlock(&trace_types_lock);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+	.fault		= tracing_buffers_mmap_fault,
+};
+
+/*
+ * Map the meta page and the pages of the cpu buffer, read only.  The
+ * layout and the protocol are described in <linux/trace_mmap.h>.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	int ret = 0;
+
+	if (vma->vm_pgoff || !(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & VM_WRITE))
+		return -EINVAL;
+
+	mutex_lock(&trace_types_lock);
+
+	if (!atomic_inc_not_zero(&info->mmap_count)) {
+		if (current_trace && current_trace->print_max) {
+			ret = -EBUSY;
+			goto out;
+		}
+
+		ret = ring_buffer_map(info->tr->buffer, info->cpu);
+		if (ret)
+			goto out;
+
+		atomic_set(&info->mmap_count, 1);
+		tracing_buffers_mapped++;
+	}
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_RESERVED;
+	vma->vm_ops = &tracing_buffers_vmops;
+
+ out:
+	mutex_unlock(&trace_types_lock);
 
 	return ret;
 }
@@ -3740,6 +3862,8 @@ static const struct file_operations tracing_buffers_fops = {
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
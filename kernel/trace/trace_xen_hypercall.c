@@ -0,0 +1,373 @@
+/*
+ * Xen hypercall latency tracer
+ *
+ * Times every hypercall that goes through the xen_hypercall_entry and
+ * xen_hypercall_exit trace points, and keeps the number of calls, total
+ * and worst time per hypercall and sub-command in
+ * trace_stat/xen_hypercalls.  As with the other latency tracers, calls
+ * slower than tracing_thresh, or than tracing_max_latency when no
+ * threshold is set, are logged to the trace buffer with their stack.
+ *
+ *  echo xen_hypercall > current_tracer
+ *  cat trace_stat/xen_hypercalls
+ *
+ * Note that this is wall time: a SCHEDOP_block includes the time the
+ * vcpu was idle, and preemption of the vcpu shows up in whatever call
+ * it happened during.
+ */
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/trace_clock.h>
+#include <trace/events/xen.h>
+#include <xen/xen.h>
+
+#include "trace_stat.h"
+#include "trace.h"
+
+/* Hypercalls issued from interrupts nest inside the interrupted one */
+#define HCALL_DEPTH	4
+/* Distinct hypercall and sub-command pairs kept per cpu */
+#define HCALL_SLOTS	64
+
+struct hcall_frame {
+	struct task_struct	*task;
+	unsigned int		op;
+	unsigned int		cmd;
+	u64			start;
+};
+
+struct hcall_stat {
+	unsigned int		op;
+	unsigned int		cmd;
+	unsigned long		count;
+	u64			total;
+	u64			max;
+};
+
+struct hcall_cpu {
+	int			depth;
+	struct hcall_frame	frames[HCALL_DEPTH];
+	struct hcall_stat	stats[HCALL_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct hcall_cpu, hcall_cpu);
+
+static struct trace_array *hcall_trace;
+static int __read_mostly tracer_enabled;
+
+static const char *hcall_names[] = {
+	[__HYPERVISOR_mmu_update]	= "mmu_update",
+	[__HYPERVISOR_multicall]	= "multicall",
+	[__HYPERVISOR_grant_table_op]	= "grant_table_op",
+	[__HYPERVISOR_mmuext_op]	= "mmuext_op",
+	[__HYPERVISOR_sched_op]		= "sched_op",
+	[__HYPERVISOR_event_channel_op]	= "event_channel_op",
+};
+
+static const char *hcall_name(unsigned int op)
+{
+	if (op < ARRAY_SIZE(hcall_names) && hcall_names[op])
+		return hcall_names[op];
+	return "unknown";
+}
+
+/*
+ * Should this new latency be reported/recorded?
+ */
+static int report_latency(u64 delta)
+{
+	if (tracing_thresh) {
+		if (delta < tracing_thresh)
+			return 0;
+	} else {
+		if (delta <= tracing_max_latency)
+			return 0;
+	}
+	return 1;
+}
+
+static struct hcall_stat *
+hcall_find_stat(struct hcall_cpu *hc, unsigned int op, unsigned int cmd)
+{
+	unsigned int i, slot = (op * 31 + cmd) % HCALL_SLOTS;
+	struct hcall_stat *stat;
+
+	for (i = 0; i < HCALL_SLOTS; i++) {
+		stat = &hc->stats[(slot + i) % HCALL_SLOTS];
+		if (!stat->count) {
+			stat->op = op;
+			stat->cmd = cmd;
+			return stat;
+		}
+		if (stat->op == op && stat->cmd == cmd)
+			return stat;
+	}
+
+	return NULL;
+}
+
+static void notrace
+probe_hypercall_entry(unsigned int op, unsigned int cmd, unsigned int count)
+{
+	struct hcall_frame *frame;
+	struct hcall_cpu *hc;
+	unsigned long flags;
+
+	if (unlikely(!tracer_enabled))
+		return;
+
+	local_irq_save(flags);
+	hc = &__get_cpu_var(hcall_cpu);
+
+	/*
+	 * Outside interrupts nothing can be in flight here; frames left
+	 * behind by a task that migrated in the middle of a call go.
+	 */
+	if (!in_interrupt())
+		hc->depth = 0;
+
+	if (hc->depth < HCALL_DEPTH) {
+		frame = &hc->frames[hc->depth];
+		frame->task = current;
+		frame->op = op;
+		frame->cmd = cmd;
+		frame->start = trace_clock_local();
+	}
+	hc->depth++;
+
+	local_irq_restore(flags);
+}
+
+static void notrace
+probe_hypercall_exit(unsigned int op, unsigned int cmd, long ret)
+{
+	struct hcall_frame *frame;
+	struct hcall_stat *stat;
+	struct hcall_cpu *hc;
+	unsigned long flags;
+	u64 delta;
+	int pc;
+
+	if (unlikely(!tracer_enabled))
+		return;
+
+	pc = preempt_count();
+	local_irq_save(flags);
+	hc = &__get_cpu_var(hcall_cpu);
+
+	if (!hc->depth)
+		goto out;
+	if (--hc->depth >= HCALL_DEPTH)
+		goto out;
+
+	frame = &hc->frames[hc->depth];
+	if (frame->task != current || frame->op != op || frame->cmd != cmd) {
+		/* started on another cpu, the timestamps don't compare */
+		hc->depth = 0;
+		goto out;
+	}
+
+	delta = trace_clock_local() - frame->start;
+
+	stat = hcall_find_stat(hc, op, cmd);
+	if (stat) {
+		stat->count++;
+		stat->total += delta;
+		if (delta > stat->max)
+			stat->max = delta;
+	}
+
+	if (!report_latency(delta) || is_tracing_stopped())
+		goto out;
+
+	if (!tracing_thresh)
+		tracing_max_latency = delta;
+
+	trace_array_printk(hcall_trace, _THIS_IP_,
+			   "%s cmd=%u ret=%ld: %llu ns\n", hcall_name(op),
+			   cmd, ret, (unsigned long long)delta);
+	__trace_stack(hcall_trace, flags, 3, pc);
+out:
+	local_irq_restore(flags);
+}
+
+static void hcall_reset_stats(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(hcall_cpu, cpu), 0, sizeof(struct hcall_cpu));
+}
+
+static int hcall_tracer_init(struct trace_array *tr)
+{
+	int ret;
+
+	hcall_trace = tr;
+	tracing_max_latency = 0;
+	tracing_reset_online_cpus(tr);
+	hcall_reset_stats();
+
+	ret = register_trace_xen_hypercall_entry(probe_hypercall_entry);
+	if (ret) {
+		pr_info("xen_hypercall trace: Couldn't activate tracepoint"
+			" probe to xen_hypercall_entry\n");
+		return ret;
+	}
+
+	ret = register_trace_xen_hypercall_exit(probe_hypercall_exit);
+	if (ret) {
+		pr_info("xen_hypercall trace: Couldn't activate tracepoint"
+			" probe to xen_hypercall_exit\n");
+		unregister_trace_xen_hypercall_entry(probe_hypercall_entry);
+		return ret;
+	}
+
+	tracer_enabled = 1;
+	return 0;
+}
+
+static void hcall_tracer_reset(struct trace_array *tr)
+{
+	tracer_enabled = 0;
+	unregister_trace_xen_hypercall_exit(probe_hypercall_exit);
+	unregister_trace_xen_hypercall_entry(probe_hypercall_entry);
+	tracepoint_synchronize_unregister();
+}
+
+static void hcall_tracer_start(struct trace_array *tr)
+{
+	tracer_enabled = 1;
+}
+
+static void hcall_tracer_stop(struct trace_array *tr)
+{
+	tracer_enabled = 0;
+}
+
+static struct tracer xen_hypercall_tracer __read_mostly =
+{
+	.name		= "xen_hypercall",
+	.init		= hcall_tracer_init,
+	.reset		= hcall_tracer_reset,
+	.start		= hcall_tracer_start,
+	.stop		= hcall_tracer_stop,
+};
+
+/*
+ * The stat file sums up the per cpu slots when it is opened; the
+ * sessions of trace_stat are serialized, so one copy is enough.
+ */
+static struct hcall_stat hcall_summary[HCALL_SLOTS];
+static int hcall_summary_nr;
+
+static void hcall_add_summary(struct hcall_stat *stat)
+{
+	struct hcall_stat *sum;
+	int i;
+
+	for (i = 0; i < hcall_summary_nr; i++) {
+		sum = &hcall_summary[i];
+		if (sum->op == stat->op && sum->cmd == stat->cmd)
+			goto found;
+	}
+	if (hcall_summary_nr == HCALL_SLOTS)
+		return;
+
+	sum = &hcall_summary[hcall_summary_nr++];
+	sum->op = stat->op;
+	sum->cmd = stat->cmd;
+found:
+	sum->count += stat->count;
+	sum->total += stat->total;
+	if (stat->max > sum->max)
+		sum->max = stat->max;
+}
+
+static void *hcall_stat_start(struct tracer_stat *trace)
+{
+	struct hcall_stat *stat;
+	int cpu, i;
+
+	memset(hcall_summary, 0, sizeof(hcall_summary));
+	hcall_summary_nr = 0;
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < HCALL_SLOTS; i++) {
+			stat = &per_cpu(hcall_cpu, cpu).stats[i];
+			if (stat->count)
+				hcall_add_summary(stat);
+		}
+	}
+
+	return hcall_summary_nr ? &hcall_summary[0] : NULL;
+}
+
+static void *hcall_stat_next(void *prev, int idx)
+{
+	if (idx >= hcall_summary_nr)
+		return NULL;
+
+	return &hcall_summary[idx];
+}
+
+/* Most time spent first */
+static int hcall_stat_cmp(void *p1, void *p2)
+{
+	struct hcall_stat *a = p1, *b = p2;
+
+	if (a->total > b->total)
+		return 1;
+	if (a->total < b->total)
+		return -1;
+	return 0;
+}
+
+static int hcall_stat_headers(struct seq_file *s)
+{
+	seq_printf(s, "# HYPERCALL          CMD      CALLS   TOTAL(us)"
+		   "    AVG(ns)    MAX(ns)\n");
+	seq_printf(s, "#    |                |          |          |"
+		   "          |          |\n");
+	return 0;
+}
+
+static int hcall_stat_show(struct seq_file *s, void *p)
+{
+	struct hcall_stat *stat = p;
+
+	seq_printf(s, "  %-16s %5u %10lu %11llu %10llu %10llu\n",
+		   hcall_name(stat->op), stat->cmd, stat->count,
+		   (unsigned long long)div_u64(stat->total, NSEC_PER_USEC),
+		   (unsigned long long)div_u64(stat->total, stat->count),
+		   (unsigned long long)stat->max);
+	return 0;
+}
+
+static struct tracer_stat hcall_stats __read_mostly = {
+	.name		= "xen_hypercalls",
+	.stat_start	= hcall_stat_start,
+	.stat_next	= hcall_stat_next,
+	.stat_cmp	= hcall_stat_cmp,
+	.stat_headers	= hcall_stat_headers,
+	.stat_show	= hcall_stat_show,
+};
+
+static __init int init_xen_hypercall_tracer(void)
+{
+	int ret;
+
+	if (!xen_domain())
+		return 0;
+
+	ret = register_tracer(&xen_hypercall_tracer);
+	if (ret)
+		return ret;
+
+	if (register_stat_tracer(&hcall_stats))
+		pr_warning("Unable to register xen hypercall stat tracer\n");
+
+	return 0;
+}
+device_initcall(init_xen_hypercall_tracer);
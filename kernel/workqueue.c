@@ -33,23 +33,102 @@
 #include <linux/kallsyms.h>
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
+#include <linux/idr.h>
 #define CREATE_TRACE_POINTS
 #include <trace/events/workqueue.h>
 
+#include "workqueue_sched.h"
+
 /*
- * The per-CPU workqueue (if single thread, we always use the first
- * possible cpu).
+ * Workqueues don't own threads any more.  Every cpu has a pair of
+ * worker pools, one for normal and one for rt workqueues, and the
+ * workers of a pool serve the matching cpu_workqueue_structs of all
+ * workqueues.  The scheduler tells the pool when one of its workers
+ * blocks or wakes up (see wq_worker_sleeping() and friends), so that
+ * there is normally exactly one worker running per pool while work is
+ * pending: a new one is woken up, or created, only when the running
+ * worker goes to sleep.
+ *
+ * Locking:
+ *
+ * L: pool->lock.  Protects the pool, its workers and the worklists of
+ *    all cwqs served by the pool.  Irq-safe.
+ * I: modified only by the worker itself or under L, read unlocked by
+ *    the scheduler hooks on the pool's cpu.
+ * W: workqueue_lock.
  */
-struct cpu_workqueue_struct {
 
-	spinlock_t lock;
+enum {
+	/* pool flags */
+	POOL_MANAGE_WORKERS	= 1 << 0,	/* need to manage workers */
+	POOL_MANAGING_WORKERS	= 1 << 1,	/* managing workers */
+	POOL_DISASSOCIATED	= 1 << 2,	/* cpu is not online */
+
+	/* worker flags */
+	WORKER_DIE		= 1 << 0,	/* die die die */
+	WORKER_IDLE		= 1 << 1,	/* is idle */
+	WORKER_PREP		= 1 << 2,	/* preparing to run works */
+	WORKER_ROGUE		= 1 << 3,	/* not bound to any cpu */
+
+	WORKER_NOT_RUNNING	= WORKER_IDLE | WORKER_PREP | WORKER_ROGUE,
+
+	NR_WORKER_POOLS		= 2,		/* normal and rt */
 
-	struct list_head worklist;
-	wait_queue_head_t more_work;
-	struct work_struct *current_work;
+	MAX_IDLE_WORKERS_RATIO	= 4,		/* 1/4 of busy can be idle */
+	IDLE_WORKER_TIMEOUT	= 300 * HZ,	/* keep idle ones for 5 mins */
+	CREATE_COOLDOWN		= HZ,		/* time to breath after fail */
+
+	NR_INITIAL_WORKERS	= 2,		/* one to work, one to spare */
+
+	WQ_DFL_ACTIVE		= 256,		/* max_active of keventd */
+};
+
+struct worker_pool {
+	spinlock_t		lock;
+	struct list_head	cwq_list;	/* L: cwqs with runnable works */
+	unsigned int		cpu;		/* I: the associated cpu */
+	unsigned int		flags;		/* L: POOL_* flags */
+	int			rt;		/* I: workers are SCHED_FIFO */
+
+	int			nr_workers;	/* L: total number of workers */
+	int			nr_idle;	/* L: currently idle ones */
+
+	struct list_head	idle_list;	/* I: idle workers, LIFO */
+	struct list_head	busy_list;	/* L: workers running a work */
+	struct list_head	workers;	/* L: all workers */
+	struct timer_list	idle_timer;	/* L: worker idle timeout */
+	wait_queue_head_t	done_wait;	/* L: a work finished */
+	struct ida		worker_ida;	/* L: for worker IDs */
+
+	/* I: workers running and not blocked, local cpu only */
+	atomic_t		nr_running ____cacheline_aligned_in_smp;
+} ____cacheline_aligned_in_smp;
+
+struct worker {
+	/* on idle list while idle, on busy list while running a work */
+	struct list_head	entry;		/* L: idle or busy list */
+	struct list_head	node;		/* L: pool->workers */
+	struct work_struct	*current_work;	/* L: work being processed */
+	struct cpu_workqueue_struct *current_cwq; /* L: its cwq */
+	struct task_struct	*task;		/* I: worker task */
+	struct worker_pool	*pool;		/* I: the associated pool */
+	unsigned long		last_active;	/* L: last active timestamp */
+	unsigned int		flags;		/* L: WORKER_* flags */
+	int			id;		/* I: worker id */
+};
+
+/*
+ * The per-CPU workqueue (if single thread, we always use the first
+ * possible cpu).  It is served by the workers of its cpu's pool.
+ */
+struct cpu_workqueue_struct {
+	struct worker_pool *pool;		/* I: the associated pool */
+	struct list_head worklist;		/* L: pending works */
+	struct list_head pool_entry;		/* L: on pool->cwq_list */
+	int nr_active;				/* L: works being processed */
+	int max_active;				/* L: max concurrent works */
 
 	struct workqueue_struct *wq;
-	struct task_struct *thread;
 } ____cacheline_aligned;
 
 /*
@@ -58,11 +137,12 @@ struct cpu_workqueue_struct {
  */
 struct workqueue_struct {
 	struct cpu_workqueue_struct *cpu_wq;
-	struct list_head list;
+	struct list_head list;			/* W: list of all workqueues */
 	const char *name;
 	int singlethread;
-	int freezeable;		/* Freeze threads during suspend */
+	int freezeable;		/* Freeze works during suspend */
 	int rt;
+	int saved_max_active;	/* W: max_active while not frozen */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
 #endif
@@ -71,28 +151,29 @@ struct workqueue_struct {
 /* Serializes the accesses to the list of workqueues. */
 static DEFINE_SPINLOCK(workqueue_lock);
 static LIST_HEAD(workqueues);
+static bool workqueue_freezing;		/* W: have wqs begun freezing? */
+
+static DEFINE_PER_CPU(struct worker_pool [NR_WORKER_POOLS], worker_pools);
 
 static int singlethread_cpu __read_mostly;
 static const struct cpumask *cpu_singlethread_map __read_mostly;
-/*
- * _cpu_down() first removes CPU from cpu_online_map, then CPU_DEAD
- * flushes cwq->worklist. This means that flush_workqueue/wait_on_work
- * which comes in between can't use for_each_online_cpu(). We could
- * use cpu_possible_map, the cpumask below is more a documentation
- * than optimization.
- */
-static cpumask_var_t cpu_populated_map __read_mostly;
 
-/* If it's single threaded, it isn't in the list of workqueues. */
+static struct worker *create_worker(struct worker_pool *pool);
+static void start_worker(struct worker *worker);
+
 static inline int is_wq_single_threaded(struct workqueue_struct *wq)
 {
 	return wq->singlethread;
 }
 
+/*
+ * Works can stay on the cwqs of an offline cpu, its pool keeps
+ * serving them unbound, so flushing has to look at every possible cpu.
+ */
 static const struct cpumask *wq_cpu_map(struct workqueue_struct *wq)
 {
 	return is_wq_single_threaded(wq)
-		? cpu_singlethread_map : cpu_populated_map;
+		? cpu_singlethread_map : cpu_possible_mask;
 }
 
 static
@@ -103,6 +184,11 @@ struct cpu_workqueue_struct *wq_per_cpu(struct workqueue_struct *wq, int cpu)
 	return per_cpu_ptr(wq->cpu_wq, cpu);
 }
 
+static struct worker_pool *get_pool(unsigned int cpu, int rt)
+{
+	return &per_cpu(worker_pools, cpu)[rt ? 1 : 0];
+}
+
 /*
  * Set the workqueue on which a work item is to be run
  * - Must *only* be called if the pending flag is set
@@ -125,10 +211,228 @@ struct cpu_workqueue_struct *get_wq_data(struct work_struct *work)
 	return (void *) (atomic_long_read(&work->data) & WORK_STRUCT_WQ_DATA_MASK);
 }
 
+/*
+ * Policy functions.  These define the policies on how the worker
+ * pools are managed.  Unless noted otherwise, these functions assume
+ * that they're being called with pool->lock held.
+ */
+
+/*
+ * Need to wake up a worker?  Called from anything but currently
+ * running workers.
+ */
+static bool need_more_worker(struct worker_pool *pool)
+{
+	return !list_empty(&pool->cwq_list) && !atomic_read(&pool->nr_running);
+}
+
+/* Can I start working?  Called from busy but !running workers. */
+static bool may_start_working(struct worker_pool *pool)
+{
+	return pool->nr_idle;
+}
+
+/* Do I need to keep working?  Called from currently running workers. */
+static bool keep_working(struct worker_pool *pool)
+{
+	return !list_empty(&pool->cwq_list) &&
+		atomic_read(&pool->nr_running) <= 1;
+}
+
+/* Do we need a new worker?  Called from manager. */
+static bool need_to_create_worker(struct worker_pool *pool)
+{
+	return need_more_worker(pool) && !may_start_working(pool);
+}
+
+/* Do I need to be the manager? */
+static bool need_to_manage_workers(struct worker_pool *pool)
+{
+	return need_to_create_worker(pool) ||
+		(pool->flags & POOL_MANAGE_WORKERS);
+}
+
+/* Do we have too many workers and should some go away? */
+static bool too_many_workers(struct worker_pool *pool)
+{
+	bool managing = pool->flags & POOL_MANAGING_WORKERS;
+	int nr_idle = pool->nr_idle + managing; /* manager is considered idle */
+	int nr_busy = pool->nr_workers - nr_idle;
+
+	return nr_idle > 2 && (nr_idle - 2) * MAX_IDLE_WORKERS_RATIO >= nr_busy;
+}
+
+/* Return the first idle worker.  Safe with preemption disabled. */
+static struct worker *first_worker(struct worker_pool *pool)
+{
+	if (unlikely(list_empty(&pool->idle_list)))
+		return NULL;
+
+	return list_first_entry(&pool->idle_list, struct worker, entry);
+}
+
+/*
+ * Wake up the first idle worker of @pool.
+ */
+static void wake_up_worker(struct worker_pool *pool)
+{
+	struct worker *worker = first_worker(pool);
+
+	if (likely(worker))
+		wake_up_process(worker->task);
+}
+
+/**
+ * wq_worker_waking_up - a worker is waking up
+ * @task: task waking up
+ * @cpu: CPU @task is waking up to
+ *
+ * This function is called during try_to_wake_up() when a worker is
+ * being awoken.
+ *
+ * CONTEXT:
+ * spin_lock_irq(rq->lock)
+ */
+void wq_worker_waking_up(struct task_struct *task, unsigned int cpu)
+{
+	struct worker *worker = kthread_data(task);
+
+	if (likely(!(worker->flags & WORKER_NOT_RUNNING)))
+		atomic_inc(&worker->pool->nr_running);
+}
+
+/**
+ * wq_worker_sleeping - a worker is going to sleep
+ * @task: task going to sleep
+ * @cpu: CPU in question, must be the current CPU number
+ *
+ * This function is called during schedule() when a busy worker is
+ * going to sleep.  A worker on the same cpu can be woken up by
+ * returning pointer to its task.
+ *
+ * CONTEXT:
+ * spin_lock_irq(rq->lock)
+ *
+ * RETURNS:
+ * Worker task on @cpu to wake up, %NULL if none.
+ */
+struct task_struct *wq_worker_sleeping(struct task_struct *task,
+				       unsigned int cpu)
+{
+	struct worker *worker = kthread_data(task), *to_wakeup = NULL;
+	struct worker_pool *pool = worker->pool;
+
+	if (unlikely(worker->flags & WORKER_NOT_RUNNING))
+		return NULL;
+
+	/*
+	 * The counterparts of the following dec_and_test, implied mb,
+	 * cwq_list not empty test and idle_list access are
+	 * insert_work()->smp_mb() and worker_enter_idle().  Only bound
+	 * workers, which run on this cpu, touch the idle list of an
+	 * associated pool, and they can't do so while this cpu is
+	 * inside the scheduler with irqs disabled.
+	 */
+	if (atomic_dec_and_test(&pool->nr_running) &&
+	    !list_empty(&pool->cwq_list))
+		to_wakeup = first_worker(pool);
+	return to_wakeup ? to_wakeup->task : NULL;
+}
+
+/**
+ * worker_set_flags - set worker flags and adjust nr_running accordingly
+ * @worker: worker to set flags for
+ * @flags: flags to set
+ * @wakeup: wakeup an idle worker if necessary
+ *
+ * Set @flags in @worker->flags and adjust nr_running accordingly.  If
+ * nr_running becomes zero and @wakeup is %true, an idle worker is
+ * woken up.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock)
+ */
+static void worker_set_flags(struct worker *worker, unsigned int flags,
+			     bool wakeup)
+{
+	struct worker_pool *pool = worker->pool;
+
+	/*
+	 * If transitioning into NOT_RUNNING, adjust nr_running and
+	 * wake up an idle worker as necessary if requested by
+	 * @wakeup.
+	 */
+	if ((flags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING)) {
+		if (wakeup) {
+			if (atomic_dec_and_test(&pool->nr_running) &&
+			    !list_empty(&pool->cwq_list))
+				wake_up_worker(pool);
+		} else
+			atomic_dec(&pool->nr_running);
+	}
+
+	worker->flags |= flags;
+}
+
+/**
+ * worker_clr_flags - clear worker flags and adjust nr_running accordingly
+ * @worker: worker to clear flags for
+ * @flags: flags to clear
+ *
+ * Clear @flags in @worker->flags and adjust nr_running accordingly.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock)
+ */
+static void worker_clr_flags(struct worker *worker, unsigned int flags)
+{
+	unsigned int oflags = worker->flags;
+
+	worker->flags &= ~flags;
+
+	/* if transitioning out of NOT_RUNNING, increment nr_running */
+	if ((flags & WORKER_NOT_RUNNING) && (oflags & WORKER_NOT_RUNNING))
+		if (!(worker->flags & WORKER_NOT_RUNNING))
+			atomic_inc(&worker->pool->nr_running);
+}
+
+static void wq_barrier_func(struct work_struct *work);
+
+/*
+ * Can the first work of @cwq be started?  A flush barrier at the head
+ * of the worklist has to wait for everything in front of it, which
+ * has already been started, to finish.
+ */
+static bool cwq_runnable(struct cpu_workqueue_struct *cwq)
+{
+	struct work_struct *work;
+
+	if (list_empty(&cwq->worklist) || cwq->nr_active >= cwq->max_active)
+		return false;
+
+	work = list_first_entry(&cwq->worklist, struct work_struct, entry);
+	return work->func != wq_barrier_func || !cwq->nr_active;
+}
+
+/*
+ * Put @cwq on or take it off its pool's list of cwqs with runnable
+ * works after its worklist, nr_active or max_active changed.
+ */
+static void cwq_update_runnable(struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = cwq->pool;
+
+	if (!cwq_runnable(cwq))
+		list_del_init(&cwq->pool_entry);
+	else if (list_empty(&cwq->pool_entry))
+		list_add_tail(&cwq->pool_entry, &pool->cwq_list);
+}
+
 static void insert_work(struct cpu_workqueue_struct *cwq,
 			struct work_struct *work, struct list_head *head)
 {
-	trace_workqueue_insertion(cwq->thread, work);
+	struct worker_pool *pool = cwq->pool;
 
 	set_wq_data(work, cwq);
 	/*
@@ -137,17 +441,28 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	 */
 	smp_wmb();
 	list_add_tail(&work->entry, head);
-	wake_up(&cwq->more_work);
+	cwq_update_runnable(cwq);
+
+	/*
+	 * Ensure either wq_worker_sleeping() sees the above
+	 * list_add_tail() or we see zero nr_running to avoid workers
+	 * lying around lazily while there are works to be processed.
+	 */
+	smp_mb();
+
+	if (need_more_worker(pool))
+		wake_up_worker(pool);
 }
 
 static void __queue_work(struct cpu_workqueue_struct *cwq,
 			 struct work_struct *work)
 {
+	struct worker_pool *pool = cwq->pool;
 	unsigned long flags;
 
-	spin_lock_irqsave(&cwq->lock, flags);
+	spin_lock_irqsave(&pool->lock, flags);
 	insert_work(cwq, work, &cwq->worklist);
-	spin_unlock_irqrestore(&cwq->lock, flags);
+	spin_unlock_irqrestore(&pool->lock, flags);
 }
 
 /**
@@ -261,78 +576,545 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 }
 EXPORT_SYMBOL_GPL(queue_delayed_work_on);
 
-static void run_workqueue(struct cpu_workqueue_struct *cwq)
+/**
+ * worker_enter_idle - enter idle state
+ * @worker: worker which is entering idle state
+ *
+ * @worker is entering idle state.  Update stats and idle timer if
+ * necessary.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	BUG_ON(worker->flags & WORKER_IDLE);
+	BUG_ON(!list_empty(&worker->entry));
+
+	/* can't use worker_set_flags(), also called from start_worker() */
+	worker->flags |= WORKER_IDLE;
+	pool->nr_idle++;
+	worker->last_active = jiffies;
+
+	/* idle_list is LIFO */
+	list_add(&worker->entry, &pool->idle_list);
+
+	if (too_many_workers(pool) && !timer_pending(&pool->idle_timer))
+		mod_timer(&pool->idle_timer,
+			  jiffies + IDLE_WORKER_TIMEOUT);
+}
+
+/**
+ * worker_leave_idle - leave idle state
+ * @worker: worker which is leaving idle state
+ *
+ * @worker is leaving idle state.  Update stats.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static void worker_leave_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	BUG_ON(!(worker->flags & WORKER_IDLE));
+	worker_clr_flags(worker, WORKER_IDLE);
+	pool->nr_idle--;
+	list_del_init(&worker->entry);
+}
+
+/*
+ * A worker of an associated pool that isn't bound to the pool's cpu
+ * yet has to bind itself before it may touch the idle list, see
+ * wq_worker_sleeping().
+ */
+static bool worker_needs_rebind(struct worker *worker)
+{
+	return (worker->flags & WORKER_ROGUE) &&
+		!(worker->pool->flags & POOL_DISASSOCIATED);
+}
+
+/**
+ * worker_rebind - bind the current worker to the cpu of its pool
+ * @worker: self
+ *
+ * Called from workers which are new or were left running unbound
+ * while the cpu was down.  If the cpu is being taken down again
+ * binding fails and the worker stays rogue.
+ *
+ * CONTEXT:
+ * Might sleep.  Called without any lock held.
+ */
+static void worker_rebind(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (set_cpus_allowed_ptr(current, cpumask_of(pool->cpu)) < 0) {
+		/* going down, wait for the pool to be disassociated */
+		schedule_timeout_uninterruptible(1);
+		return;
+	}
+	current->flags |= PF_THREAD_BOUND;
+
+	spin_lock_irq(&pool->lock);
+	if (!(pool->flags & POOL_DISASSOCIATED))
+		worker_clr_flags(worker, WORKER_ROGUE);
+	spin_unlock_irq(&pool->lock);
+}
+
+static void idle_worker_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (void *)__pool;
+
+	spin_lock_irq(&pool->lock);
+
+	if (too_many_workers(pool)) {
+		struct worker *worker;
+		unsigned long expires;
+
+		/* idle_list is kept in LIFO order, check the last one */
+		worker = list_entry(pool->idle_list.prev, struct worker, entry);
+		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+		if (time_before(jiffies, expires))
+			mod_timer(&pool->idle_timer, expires);
+		else {
+			/* it's been idle for too long, wake up manager */
+			pool->flags |= POOL_MANAGE_WORKERS;
+			wake_up_worker(pool);
+		}
+	}
+
+	spin_unlock_irq(&pool->lock);
+}
+
+/**
+ * destroy_worker - destroy a workqueue worker
+ * @worker: worker to be destroyed
+ *
+ * Destroy @worker and adjust @pool stats accordingly.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which is released and regrabbed.
+ */
+static void destroy_worker(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+	int id = worker->id;
+
+	/* sanity check frenzy */
+	BUG_ON(worker->current_work);
+
+	if (worker->flags & WORKER_IDLE)
+		pool->nr_idle--;
+	pool->nr_workers--;
+
+	list_del_init(&worker->entry);
+	list_del(&worker->node);
+	worker->flags |= WORKER_DIE;
+
+	spin_unlock_irq(&pool->lock);
+
+	trace_workqueue_destruction(worker->task);
+	kthread_stop(worker->task);
+	kfree(worker);
+
+	spin_lock_irq(&pool->lock);
+	ida_remove(&pool->worker_ida, id);
+}
+
+/**
+ * maybe_create_worker - create a new worker if necessary
+ * @pool: pool to create a new worker for
+ *
+ * Create a new worker for @pool if necessary.  @pool is guaranteed to
+ * have at least one idle worker on return from this function.  If
+ * creating a new worker fails, this function retries after
+ * CREATE_COOLDOWN; workqueues have no rescuers, so this can only
+ * stall while memory or kthreadd are short.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which may be released and regrabbed
+ * multiple times.  Called only from manager.
+ *
+ * RETURNS:
+ * false if no action was taken and pool->lock stayed locked, true
+ * otherwise.
+ */
+static bool maybe_create_worker(struct worker_pool *pool)
+{
+	if (!need_to_create_worker(pool))
+		return false;
+
+	while (true) {
+		struct worker *worker;
+
+		spin_unlock_irq(&pool->lock);
+		worker = create_worker(pool);
+		spin_lock_irq(&pool->lock);
+		if (worker) {
+			start_worker(worker);
+			return true;
+		}
+
+		if (!need_to_create_worker(pool))
+			break;
+
+		spin_unlock_irq(&pool->lock);
+		schedule_timeout_interruptible(CREATE_COOLDOWN);
+		spin_lock_irq(&pool->lock);
+		if (!need_to_create_worker(pool))
+			break;
+	}
+	return true;
+}
+
+/**
+ * maybe_destroy_workers - destroy workers which have been idle for a while
+ * @pool: pool to destroy workers for
+ *
+ * Destroy @pool workers which have been idle for longer than
+ * IDLE_WORKER_TIMEOUT.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which may be released and regrabbed
+ * multiple times.  Called only from manager.
+ *
+ * RETURNS:
+ * false if no action was taken and pool->lock stayed locked, true
+ * otherwise.
+ */
+static bool maybe_destroy_workers(struct worker_pool *pool)
+{
+	bool ret = false;
+
+	while (too_many_workers(pool)) {
+		struct worker *worker;
+		unsigned long expires;
+
+		worker = list_entry(pool->idle_list.prev, struct worker, entry);
+		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+		if (time_before(jiffies, expires)) {
+			mod_timer(&pool->idle_timer, expires);
+			break;
+		}
+
+		destroy_worker(worker);
+		ret = true;
+	}
+
+	return ret;
+}
+
+/**
+ * manage_workers - manage worker pool
+ * @worker: self
+ *
+ * Assume the manager role and manage the pool @worker belongs to.
+ * At any given time, there can be only zero or one manager per pool.
+ * Rogue workers of an associated pool don't manage, they rebind
+ * first.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which may be released and regrabbed
+ * multiple times.  Does GFP_KERNEL allocations.
+ *
+ * RETURNS:
+ * false if no action was taken and pool->lock stayed locked, true if
+ * some action was taken.
+ */
+static bool manage_workers(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+	bool ret = false;
+
+	if (pool->flags & POOL_MANAGING_WORKERS || worker_needs_rebind(worker))
+		return ret;
+
+	pool->flags &= ~POOL_MANAGE_WORKERS;
+	pool->flags |= POOL_MANAGING_WORKERS;
+
+	/*
+	 * Destroy and then create so that may_start_working() is true
+	 * on return.
+	 */
+	ret |= maybe_destroy_workers(pool);
+	ret |= maybe_create_worker(pool);
+
+	pool->flags &= ~POOL_MANAGING_WORKERS;
+
+	return ret;
+}
+
+/**
+ * process_one_work - process the first work of a cwq
+ * @worker: self
+ * @cwq: cwq whose first work is to be processed
+ *
+ * Process the first work of @cwq.  The cwq is rotated to the tail of
+ * the pool's cwq_list so that the workqueues sharing the pool take
+ * turns.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock) which is released and regrabbed.
+ */
+static void process_one_work(struct worker *worker,
+			     struct cpu_workqueue_struct *cwq)
 {
-	spin_lock_irq(&cwq->lock);
-	while (!list_empty(&cwq->worklist)) {
-		struct work_struct *work = list_entry(cwq->worklist.next,
+	struct worker_pool *pool = worker->pool;
+	struct work_struct *work = list_first_entry(&cwq->worklist,
 						struct work_struct, entry);
-		work_func_t f = work->func;
+	work_func_t f = work->func;
 #ifdef CONFIG_LOCKDEP
-		/*
-		 * It is permissible to free the struct work_struct
-		 * from inside the function that is called from it,
-		 * this we need to take into account for lockdep too.
-		 * To avoid bogus "held lock freed" warnings as well
-		 * as problems when looking into work->lockdep_map,
-		 * make a copy and use that here.
-		 */
-		struct lockdep_map lockdep_map = work->lockdep_map;
+	/*
+	 * It is permissible to free the struct work_struct
+	 * from inside the function that is called from it,
+	 * this we need to take into account for lockdep too.
+	 * To avoid bogus "held lock freed" warnings as well
+	 * as problems when looking into work->lockdep_map,
+	 * make a copy and use that here.
+	 */
+	struct lockdep_map lockdep_map = work->lockdep_map;
 #endif
-		trace_workqueue_execution(cwq->thread, work);
-		cwq->current_work = work;
-		list_del_init(cwq->worklist.next);
-		spin_unlock_irq(&cwq->lock);
-
-		BUG_ON(get_wq_data(work) != cwq);
-		work_clear_pending(work);
-		lock_map_acquire(&cwq->wq->lockdep_map);
-		lock_map_acquire(&lockdep_map);
-		f(work);
-		lock_map_release(&lockdep_map);
-		lock_map_release(&cwq->wq->lockdep_map);
-
-		if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
-			printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
-					"%s/0x%08x/%d\n",
-					current->comm, preempt_count(),
-				       	task_pid_nr(current));
-			printk(KERN_ERR "    last function: ");
-			print_symbol("%s\n", (unsigned long)f);
-			debug_show_held_locks(current);
-			dump_stack();
-		}
+	/* works are tied to a worker only when one picks them up */
+	trace_workqueue_insertion(worker->task, work);
+	trace_workqueue_execution(worker->task, work);
+
+	list_del_init(&work->entry);
+	cwq->nr_active++;
+	list_del_init(&cwq->pool_entry);
+	cwq_update_runnable(cwq);
 
-		spin_lock_irq(&cwq->lock);
-		cwq->current_work = NULL;
+	worker->current_work = work;
+	worker->current_cwq = cwq;
+	list_add(&worker->entry, &pool->busy_list);
+	spin_unlock_irq(&pool->lock);
+
+	BUG_ON(get_wq_data(work) != cwq);
+	work_clear_pending(work);
+	lock_map_acquire(&cwq->wq->lockdep_map);
+	lock_map_acquire(&lockdep_map);
+	f(work);
+	lock_map_release(&lockdep_map);
+	lock_map_release(&cwq->wq->lockdep_map);
+
+	if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
+		printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
+				"%s/0x%08x/%d\n",
+				current->comm, preempt_count(),
+				task_pid_nr(current));
+		printk(KERN_ERR "    last function: ");
+		print_symbol("%s\n", (unsigned long)f);
+		debug_show_held_locks(current);
+		dump_stack();
 	}
-	spin_unlock_irq(&cwq->lock);
+
+	spin_lock_irq(&pool->lock);
+	list_del_init(&worker->entry);
+	worker->current_work = NULL;
+	worker->current_cwq = NULL;
+	cwq->nr_active--;
+	cwq_update_runnable(cwq);
+
+	if (waitqueue_active(&pool->done_wait))
+		wake_up_all(&pool->done_wait);
 }
 
-static int worker_thread(void *__cwq)
+/**
+ * worker_thread - the worker thread function
+ * @__worker: self
+ *
+ * The pool's workers share the cwqs of all workqueues on the cpu.
+ * Only one of them is normally running at any time; when it blocks,
+ * the scheduler lets the pool wake up an idle one to keep the
+ * remaining works going, and the last idle worker creates another
+ * before starting to work so that this stays possible.
+ */
+static int worker_thread(void *__worker)
 {
-	struct cpu_workqueue_struct *cwq = __cwq;
-	DEFINE_WAIT(wait);
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
+
+	/* tell the scheduler that this is a workqueue worker */
+	current->flags |= PF_WQ_WORKER;
+woke_up:
+	spin_lock_irq(&pool->lock);
+
+	/* DIE can be set only while we're idle, checking here is enough */
+	if (worker->flags & WORKER_DIE) {
+		spin_unlock_irq(&pool->lock);
+		current->flags &= ~PF_WQ_WORKER;
+		return 0;
+	}
 
-	if (cwq->wq->freezeable)
-		set_freezable();
+	if (unlikely(worker_needs_rebind(worker))) {
+		spin_unlock_irq(&pool->lock);
+		worker_rebind(worker);
+		goto woke_up;
+	}
 
-	for (;;) {
-		prepare_to_wait(&cwq->more_work, &wait, TASK_INTERRUPTIBLE);
-		if (!freezing(current) &&
-		    !kthread_should_stop() &&
-		    list_empty(&cwq->worklist))
-			schedule();
-		finish_wait(&cwq->more_work, &wait);
+	worker_leave_idle(worker);
+recheck:
+	/* no more worker necessary? */
+	if (!need_more_worker(pool))
+		goto sleep;
 
-		try_to_freeze();
+	/* do we need to manage? */
+	if (unlikely(!may_start_working(pool)) && manage_workers(worker))
+		goto recheck;
 
-		if (kthread_should_stop())
-			break;
+	/*
+	 * Finish PREP stage.  We're guaranteed to have at least one idle
+	 * worker or that someone else has already assumed the manager
+	 * role.
+	 */
+	worker_clr_flags(worker, WORKER_PREP);
+
+	do {
+		struct cpu_workqueue_struct *cwq =
+			list_first_entry(&pool->cwq_list,
+					 struct cpu_workqueue_struct,
+					 pool_entry);
+
+		process_one_work(worker, cwq);
+	} while (keep_working(pool));
+
+	worker_set_flags(worker, WORKER_PREP, false);
+sleep:
+	if (unlikely(need_to_manage_workers(pool)) && manage_workers(worker))
+		goto recheck;
+
+	if (unlikely(worker_needs_rebind(worker))) {
+		spin_unlock_irq(&pool->lock);
+		worker_rebind(worker);
+		spin_lock_irq(&pool->lock);
+		goto recheck;
+	}
+
+	/*
+	 * pool->lock is held and there's no work to process and no
+	 * need to manage, sleep.  Workers are woken up only while
+	 * holding pool->lock or from local cpu, so setting the
+	 * current state before releasing pool->lock is enough to
+	 * prevent losing any event.
+	 */
+	worker_enter_idle(worker);
+	__set_current_state(TASK_INTERRUPTIBLE);
+	spin_unlock_irq(&pool->lock);
+	schedule();
+	goto woke_up;
+}
 
-		run_workqueue(cwq);
+/**
+ * create_worker - create a new workqueue worker
+ * @pool: pool the new worker will belong to
+ *
+ * Create a new worker which serves @pool.  The worker starts out
+ * rogue and binds itself to the pool's cpu once it runs, unless the
+ * cpu is down by then.
+ *
+ * CONTEXT:
+ * Might sleep.  Does GFP_KERNEL allocations.
+ *
+ * RETURNS:
+ * Pointer to the newly created worker.
+ */
+static struct worker *create_worker(struct worker_pool *pool)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	struct worker *worker = NULL;
+	int id = -1;
+
+	spin_lock_irq(&pool->lock);
+	while (ida_get_new(&pool->worker_ida, &id)) {
+		spin_unlock_irq(&pool->lock);
+		if (!ida_pre_get(&pool->worker_ida, GFP_KERNEL))
+			goto fail;
+		spin_lock_irq(&pool->lock);
+	}
+	spin_unlock_irq(&pool->lock);
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		goto fail;
+
+	INIT_LIST_HEAD(&worker->entry);
+	INIT_LIST_HEAD(&worker->node);
+	worker->pool = pool;
+	worker->id = id;
+	worker->flags = WORKER_PREP | WORKER_ROGUE;
+
+	worker->task = kthread_create(worker_thread, worker, "kworker/%u:%d%s",
+				      pool->cpu, id, pool->rt ? "H" : "");
+	if (IS_ERR(worker->task))
+		goto fail;
+
+	if (pool->rt)
+		sched_setscheduler_nocheck(worker->task, SCHED_FIFO, &param);
+
+	trace_workqueue_creation(worker->task, pool->cpu);
+
+	return worker;
+fail:
+	if (id >= 0) {
+		spin_lock_irq(&pool->lock);
+		ida_remove(&pool->worker_ida, id);
+		spin_unlock_irq(&pool->lock);
 	}
+	kfree(worker);
+	return NULL;
+}
 
+/**
+ * start_worker - start a newly created worker
+ * @worker: worker to start
+ *
+ * Make the pool aware of @worker and start it.
+ *
+ * CONTEXT:
+ * spin_lock_irq(pool->lock).
+ */
+static void start_worker(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	pool->nr_workers++;
+	list_add_tail(&worker->node, &pool->workers);
+	worker_enter_idle(worker);
+	wake_up_process(worker->task);
+}
+
+/**
+ * create_initial_workers - populate a pool which has no workers yet
+ * @pool: pool to populate
+ *
+ * A pool starts out with a spare idle worker besides the one which
+ * picks up the first work, so that the first work doesn't have to
+ * wait for a worker to be created.  stop_machine() depends on this:
+ * kthreadd can't run while the other cpus are spinning in it.
+ *
+ * CONTEXT:
+ * Might sleep.  Does GFP_KERNEL allocations.
+ *
+ * RETURNS:
+ * 0 on success, -ENOMEM otherwise.
+ */
+static int create_initial_workers(struct worker_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < NR_INITIAL_WORKERS; i++) {
+		struct worker *worker = create_worker(pool);
+
+		if (!worker)
+			return -ENOMEM;
+		spin_lock_irq(&pool->lock);
+		start_worker(worker);
+		spin_unlock_irq(&pool->lock);
+	}
 	return 0;
 }
 
@@ -358,19 +1140,32 @@ static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
 	insert_work(cwq, &barr->work, head);
 }
 
+/* The cwq whose work the current task is running, if it is a worker. */
+static struct cpu_workqueue_struct *current_worker_cwq(void)
+{
+	struct worker *worker;
+
+	if (!(current->flags & PF_WQ_WORKER))
+		return NULL;
+
+	worker = kthread_data(current);
+	return worker->current_cwq;
+}
+
 static int flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
 {
+	struct worker_pool *pool = cwq->pool;
 	int active = 0;
 	struct wq_barrier barr;
 
-	WARN_ON(cwq->thread == current);
+	WARN_ON(current_worker_cwq() == cwq);
 
-	spin_lock_irq(&cwq->lock);
-	if (!list_empty(&cwq->worklist) || cwq->current_work != NULL) {
+	spin_lock_irq(&pool->lock);
+	if (!list_empty(&cwq->worklist) || cwq->nr_active) {
 		insert_wq_barrier(cwq, &barr, &cwq->worklist);
 		active = 1;
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(&pool->lock);
 
 	if (active)
 		wait_for_completion(&barr.done);
@@ -404,6 +1199,62 @@ void flush_workqueue(struct workqueue_struct *wq)
 }
 EXPORT_SYMBOL_GPL(flush_workqueue);
 
+/* Is a worker of @pool running @work for @cwq?  Called with pool->lock. */
+static bool work_executing(struct worker_pool *pool,
+			   struct cpu_workqueue_struct *cwq,
+			   struct work_struct *work)
+{
+	struct worker *worker;
+
+	list_for_each_entry(worker, &pool->busy_list, entry)
+		if (worker->current_work == work &&
+		    worker->current_cwq == cwq)
+			return true;
+	return false;
+}
+
+/* Is @work queued on @cwq?  Called with pool->lock. */
+static bool work_queued(struct cpu_workqueue_struct *cwq,
+			struct work_struct *work)
+{
+	if (list_empty(&work->entry))
+		return false;
+	/*
+	 * See the comment near try_to_grab_pending()->smp_rmb().
+	 * If it was re-queued under us we are not going to wait.
+	 */
+	smp_rmb();
+	return cwq == get_wq_data(work);
+}
+
+/*
+ * Wait until @work is no longer executing on @cwq and, if @queued is
+ * set, no longer queued there either.  Other works of the cwq may run
+ * alongside, so this waits for @work itself instead of queueing a
+ * barrier behind it.  Returns true if there was something to wait for.
+ */
+static bool wait_on_cwq_work(struct cpu_workqueue_struct *cwq,
+			     struct work_struct *work, bool queued)
+{
+	struct worker_pool *pool = cwq->pool;
+	bool waited = false;
+	DEFINE_WAIT(wait);
+
+	spin_lock_irq(&pool->lock);
+	while ((queued && work_queued(cwq, work)) ||
+	       work_executing(pool, cwq, work)) {
+		prepare_to_wait(&pool->done_wait, &wait, TASK_UNINTERRUPTIBLE);
+		spin_unlock_irq(&pool->lock);
+		schedule();
+		finish_wait(&pool->done_wait, &wait);
+		spin_lock_irq(&pool->lock);
+		waited = true;
+	}
+	spin_unlock_irq(&pool->lock);
+
+	return waited;
+}
+
 /**
  * flush_work - block until a work_struct's callback has terminated
  * @work: the work which is to be flushed
@@ -417,8 +1268,6 @@ EXPORT_SYMBOL_GPL(flush_workqueue);
 int flush_work(struct work_struct *work)
 {
 	struct cpu_workqueue_struct *cwq;
-	struct list_head *prev;
-	struct wq_barrier barr;
 
 	might_sleep();
 	cwq = get_wq_data(work);
@@ -428,30 +1277,7 @@ int flush_work(struct work_struct *work)
 	lock_map_acquire(&cwq->wq->lockdep_map);
 	lock_map_release(&cwq->wq->lockdep_map);
 
-	prev = NULL;
-	spin_lock_irq(&cwq->lock);
-	if (!list_empty(&work->entry)) {
-		/*
-		 * See the comment near try_to_grab_pending()->smp_rmb().
-		 * If it was re-queued under us we are not going to wait.
-		 */
-		smp_rmb();
-		if (unlikely(cwq != get_wq_data(work)))
-			goto out;
-		prev = &work->entry;
-	} else {
-		if (cwq->current_work != work)
-			goto out;
-		prev = &cwq->worklist;
-	}
-	insert_wq_barrier(cwq, &barr, prev->next);
-out:
-	spin_unlock_irq(&cwq->lock);
-	if (!prev)
-		return 0;
-
-	wait_for_completion(&barr.done);
-	return 1;
+	return wait_on_cwq_work(cwq, work, true);
 }
 EXPORT_SYMBOL_GPL(flush_work);
 
@@ -462,6 +1288,7 @@ EXPORT_SYMBOL_GPL(flush_work);
 static int try_to_grab_pending(struct work_struct *work)
 {
 	struct cpu_workqueue_struct *cwq;
+	struct worker_pool *pool;
 	int ret = -1;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING, work_data_bits(work)))
@@ -476,7 +1303,8 @@ static int try_to_grab_pending(struct work_struct *work)
 	if (!cwq)
 		return ret;
 
-	spin_lock_irq(&cwq->lock);
+	pool = cwq->pool;
+	spin_lock_irq(&pool->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * This work is queued, but perhaps we locked the wrong cwq.
@@ -486,31 +1314,17 @@ static int try_to_grab_pending(struct work_struct *work)
 		smp_rmb();
 		if (cwq == get_wq_data(work)) {
 			list_del_init(&work->entry);
+			cwq_update_runnable(cwq);
+			if (waitqueue_active(&pool->done_wait))
+				wake_up_all(&pool->done_wait);
 			ret = 1;
 		}
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(&pool->lock);
 
 	return ret;
 }
 
-static void wait_on_cpu_work(struct cpu_workqueue_struct *cwq,
-				struct work_struct *work)
-{
-	struct wq_barrier barr;
-	int running = 0;
-
-	spin_lock_irq(&cwq->lock);
-	if (unlikely(cwq->current_work == work)) {
-		insert_wq_barrier(cwq, &barr, cwq->worklist.next);
-		running = 1;
-	}
-	spin_unlock_irq(&cwq->lock);
-
-	if (unlikely(running))
-		wait_for_completion(&barr.done);
-}
-
 static void wait_on_work(struct work_struct *work)
 {
 	struct cpu_workqueue_struct *cwq;
@@ -531,7 +1345,7 @@ static void wait_on_work(struct work_struct *work)
 	cpu_map = wq_cpu_map(wq);
 
 	for_each_cpu(cpu, cpu_map)
-		wait_on_cpu_work(per_cpu_ptr(wq->cpu_wq, cpu), work);
+		wait_on_cwq_work(per_cpu_ptr(wq->cpu_wq, cpu), work, false);
 }
 
 static int __cancel_work_timer(struct work_struct *work,
@@ -760,69 +1574,25 @@ int keventd_up(void)
 int current_is_keventd(void)
 {
 	struct cpu_workqueue_struct *cwq;
-	int cpu = raw_smp_processor_id(); /* preempt-safe: keventd is per-cpu */
-	int ret = 0;
 
 	BUG_ON(!keventd_wq);
 
-	cwq = per_cpu_ptr(keventd_wq->cpu_wq, cpu);
-	if (current == cwq->thread)
-		ret = 1;
-
-	return ret;
-
+	cwq = current_worker_cwq();
+	return cwq && cwq->wq == keventd_wq;
 }
 EXPORT_SYMBOL_GPL(current_is_keventd);
 
-static struct cpu_workqueue_struct *
-init_cpu_workqueue(struct workqueue_struct *wq, int cpu)
+static void init_cpu_workqueue(struct workqueue_struct *wq, int cpu)
 {
 	struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
 
 	cwq->wq = wq;
-	spin_lock_init(&cwq->lock);
+	cwq->pool = get_pool(cpu, wq->rt);
 	INIT_LIST_HEAD(&cwq->worklist);
-	init_waitqueue_head(&cwq->more_work);
-
-	return cwq;
-}
-
-static int create_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
-{
-	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
-	struct workqueue_struct *wq = cwq->wq;
-	const char *fmt = is_wq_single_threaded(wq) ? "%s" : "%s/%d";
-	struct task_struct *p;
-
-	p = kthread_create(worker_thread, cwq, fmt, wq->name, cpu);
-	/*
-	 * Nobody can add the work_struct to this cwq,
-	 *	if (caller is __create_workqueue)
-	 *		nobody should see this wq
-	 *	else // caller is CPU_UP_PREPARE
-	 *		cpu is not on cpu_online_map
-	 * so we can abort safely.
-	 */
-	if (IS_ERR(p))
-		return PTR_ERR(p);
-	if (cwq->wq->rt)
-		sched_setscheduler_nocheck(p, SCHED_FIFO, &param);
-	cwq->thread = p;
-
-	trace_workqueue_creation(cwq->thread, cpu);
-
-	return 0;
-}
-
-static void start_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
-{
-	struct task_struct *p = cwq->thread;
-
-	if (p != NULL) {
-		if (cpu >= 0)
-			kthread_bind(p, cpu);
-		wake_up_process(p);
-	}
+	INIT_LIST_HEAD(&cwq->pool_entry);
+	/* a frozen workqueue starts nothing until it is thawed */
+	cwq->max_active = workqueue_freezing && wq->freezeable ?
+		0 : wq->saved_max_active;
 }
 
 struct workqueue_struct *__create_workqueue_key(const char *name,
@@ -833,8 +1603,7 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 						const char *lock_name)
 {
 	struct workqueue_struct *wq;
-	struct cpu_workqueue_struct *cwq;
-	int err = 0, cpu;
+	int cpu;
 
 	wq = kzalloc(sizeof(*wq), GFP_KERNEL);
 	if (!wq)
@@ -851,74 +1620,28 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 	wq->singlethread = singlethread;
 	wq->freezeable = freezeable;
 	wq->rt = rt;
-	INIT_LIST_HEAD(&wq->list);
-
-	if (singlethread) {
-		cwq = init_cpu_workqueue(wq, singlethread_cpu);
-		err = create_workqueue_thread(cwq, singlethread_cpu);
-		start_workqueue_thread(cwq, -1);
-	} else {
-		cpu_maps_update_begin();
-		/*
-		 * We must place this wq on list even if the code below fails.
-		 * cpu_down(cpu) can remove cpu from cpu_populated_map before
-		 * destroy_workqueue() takes the lock, in that case we leak
-		 * cwq[cpu]->thread.
-		 */
-		spin_lock(&workqueue_lock);
-		list_add(&wq->list, &workqueues);
-		spin_unlock(&workqueue_lock);
-		/*
-		 * We must initialize cwqs for each possible cpu even if we
-		 * are going to call destroy_workqueue() finally. Otherwise
-		 * cpu_up() can hit the uninitialized cwq once we drop the
-		 * lock.
-		 */
-		for_each_possible_cpu(cpu) {
-			cwq = init_cpu_workqueue(wq, cpu);
-			if (err || !cpu_online(cpu))
-				continue;
-			err = create_workqueue_thread(cwq, cpu);
-			start_workqueue_thread(cwq, cpu);
-		}
-		cpu_maps_update_done();
-	}
-
-	if (err) {
-		destroy_workqueue(wq);
-		wq = NULL;
-	}
-	return wq;
-}
-EXPORT_SYMBOL_GPL(__create_workqueue_key);
-
-static void cleanup_workqueue_thread(struct cpu_workqueue_struct *cwq)
-{
 	/*
-	 * Our caller is either destroy_workqueue() or CPU_POST_DEAD,
-	 * cpu_add_remove_lock protects cwq->thread.
+	 * Callers rely on the works of one cpu_workqueue_struct being
+	 * run one at a time and in order, as they were by the single
+	 * thread each of them used to have.  Only keventd, which has
+	 * always been shared by unrelated users, is made concurrent.
 	 */
-	if (cwq->thread == NULL)
-		return;
-
-	lock_map_acquire(&cwq->wq->lockdep_map);
-	lock_map_release(&cwq->wq->lockdep_map);
+	wq->saved_max_active = 1;
+	INIT_LIST_HEAD(&wq->list);
 
-	flush_cpu_workqueue(cwq);
 	/*
-	 * If the caller is CPU_POST_DEAD and cwq->worklist was not empty,
-	 * a concurrent flush_workqueue() can insert a barrier after us.
-	 * However, in that case run_workqueue() won't return and check
-	 * kthread_should_stop() until it flushes all work_struct's.
-	 * When ->worklist becomes empty it is safe to exit because no
-	 * more work_structs can be queued on this cwq: flush_workqueue
-	 * checks list_empty(), and a "normal" queue_work() can't use
-	 * a dead CPU.
+	 * The workers are shared, a workqueue only needs its cwqs
+	 * installed.  All of them go on the list for the freezer.
 	 */
-	trace_workqueue_destruction(cwq->thread);
-	kthread_stop(cwq->thread);
-	cwq->thread = NULL;
+	spin_lock(&workqueue_lock);
+	for_each_possible_cpu(cpu)
+		init_cpu_workqueue(wq, cpu);
+	list_add(&wq->list, &workqueues);
+	spin_unlock(&workqueue_lock);
+
+	return wq;
 }
+EXPORT_SYMBOL_GPL(__create_workqueue_key);
 
 /**
  * destroy_workqueue - safely terminate a workqueue
@@ -931,70 +1654,242 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	const struct cpumask *cpu_map = wq_cpu_map(wq);
 	int cpu;
 
-	cpu_maps_update_begin();
 	spin_lock(&workqueue_lock);
 	list_del(&wq->list);
 	spin_unlock(&workqueue_lock);
 
-	for_each_cpu(cpu, cpu_map)
-		cleanup_workqueue_thread(per_cpu_ptr(wq->cpu_wq, cpu));
- 	cpu_maps_update_done();
+	lock_map_acquire(&wq->lockdep_map);
+	lock_map_release(&wq->lockdep_map);
+
+	for_each_cpu(cpu, cpu_map) {
+		struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
+		struct worker_pool *pool = cwq->pool;
+
+		flush_cpu_workqueue(cwq);
+
+		/*
+		 * The worker which ran the barrier still has to drop
+		 * its reference to the cwq, wait for that.  After this
+		 * the worklist can only be non-empty if a work kept
+		 * requeueing itself, which is a bug.
+		 */
+		spin_lock_irq(&pool->lock);
+		while (cwq->nr_active) {
+			DEFINE_WAIT(wait);
+
+			prepare_to_wait(&pool->done_wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+			spin_unlock_irq(&pool->lock);
+			schedule();
+			finish_wait(&pool->done_wait, &wait);
+			spin_lock_irq(&pool->lock);
+		}
+		WARN_ON(!list_empty(&cwq->worklist));
+		list_del_init(&cwq->pool_entry);
+		spin_unlock_irq(&pool->lock);
+	}
 
 	free_percpu(wq->cpu_wq);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
 
+/*
+ * CPU hotplug.
+ *
+ * The workers of a pool keep living across cpu down and up.  While
+ * the cpu is down they are rogue: not bound, not counted in
+ * nr_running, so every queued work wakes one of them up and works
+ * left on the dead cpu's cwqs are finished elsewhere.  When the cpu
+ * comes back, each worker binds itself again the next time it goes
+ * through the idle path, see worker_rebind().
+ */
 static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 						unsigned long action,
 						void *hcpu)
 {
 	unsigned int cpu = (unsigned long)hcpu;
-	struct cpu_workqueue_struct *cwq;
-	struct workqueue_struct *wq;
-	int ret = NOTIFY_OK;
+	struct worker_pool *pool;
+	struct worker *worker;
+	int i;
 
 	action &= ~CPU_TASKS_FROZEN;
 
-	switch (action) {
-	case CPU_UP_PREPARE:
-		cpumask_set_cpu(cpu, cpu_populated_map);
-	}
-undo:
-	list_for_each_entry(wq, &workqueues, list) {
-		cwq = per_cpu_ptr(wq->cpu_wq, cpu);
+	for (i = 0; i < NR_WORKER_POOLS; i++) {
+		pool = &per_cpu(worker_pools, cpu)[i];
 
 		switch (action) {
 		case CPU_UP_PREPARE:
-			if (!create_workqueue_thread(cwq, cpu))
+			/* a pool which has been up before still has workers */
+			if (pool->nr_workers)
 				break;
-			printk(KERN_ERR "workqueue [%s] for %i failed\n",
-				wq->name, cpu);
-			action = CPU_UP_CANCELED;
-			ret = NOTIFY_BAD;
-			goto undo;
+			if (create_initial_workers(pool)) {
+				printk(KERN_ERR "workqueue: failed to create "
+				       "workers for cpu %u\n", cpu);
+				return NOTIFY_BAD;
+			}
+			break;
 
 		case CPU_ONLINE:
-			start_workqueue_thread(cwq, cpu);
+			spin_lock_irq(&pool->lock);
+			pool->flags &= ~POOL_DISASSOCIATED;
+			/* idle workers rebind themselves once woken up */
+			list_for_each_entry(worker, &pool->idle_list, entry)
+				wake_up_process(worker->task);
+			spin_unlock_irq(&pool->lock);
+			break;
+
+		case CPU_DYING:
+			/*
+			 * Runs on the dying cpu under stop_machine, so no
+			 * worker is running on it: cut the pool loose.
+			 */
+			spin_lock(&pool->lock);
+			pool->flags |= POOL_DISASSOCIATED;
+			list_for_each_entry(worker, &pool->workers, node)
+				worker->flags |= WORKER_ROGUE;
+			atomic_set(&pool->nr_running, 0);
+			spin_unlock(&pool->lock);
 			break;
 
-		case CPU_UP_CANCELED:
-			start_workqueue_thread(cwq, -1);
 		case CPU_POST_DEAD:
-			cleanup_workqueue_thread(cwq);
+			/* nobody runs the leftover works unless woken up */
+			spin_lock_irq(&pool->lock);
+			if (need_more_worker(pool))
+				wake_up_worker(pool);
+			spin_unlock_irq(&pool->lock);
 			break;
 		}
 	}
 
-	switch (action) {
-	case CPU_UP_CANCELED:
-	case CPU_POST_DEAD:
-		cpumask_clear_cpu(cpu, cpu_populated_map);
+	return NOTIFY_OK;
+}
+
+#ifdef CONFIG_FREEZER
+
+/**
+ * freeze_workqueues_begin - begin freezing workqueues
+ *
+ * Start freezing workqueues.  After this function returns, all
+ * freezeable workqueues will queue new works but not start them
+ * until thaw_workqueues() is called.
+ *
+ * CONTEXT:
+ * Grabs and releases workqueue_lock and pool->lock's.
+ */
+void freeze_workqueues_begin(void)
+{
+	struct workqueue_struct *wq;
+	int cpu;
+
+	spin_lock(&workqueue_lock);
+
+	BUG_ON(workqueue_freezing);
+	workqueue_freezing = true;
+
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!wq->freezeable)
+			continue;
+
+		for_each_cpu(cpu, wq_cpu_map(wq)) {
+			struct cpu_workqueue_struct *cwq =
+				per_cpu_ptr(wq->cpu_wq, cpu);
+
+			spin_lock_irq(&cwq->pool->lock);
+			cwq->max_active = 0;
+			cwq_update_runnable(cwq);
+			spin_unlock_irq(&cwq->pool->lock);
+		}
+	}
+
+	spin_unlock(&workqueue_lock);
+}
+
+/**
+ * freeze_workqueues_busy - are freezeable workqueues still busy?
+ *
+ * Check whether freezing is complete.  This function must be called
+ * between freeze_workqueues_begin() and thaw_workqueues().
+ *
+ * CONTEXT:
+ * Grabs and releases workqueue_lock.
+ *
+ * RETURNS:
+ * %true if some freezeable workqueues are still busy.  %false if
+ * freezing is complete.
+ */
+bool freeze_workqueues_busy(void)
+{
+	struct workqueue_struct *wq;
+	bool busy = false;
+	int cpu;
+
+	spin_lock(&workqueue_lock);
+
+	BUG_ON(!workqueue_freezing);
+
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!wq->freezeable)
+			continue;
+
+		for_each_cpu(cpu, wq_cpu_map(wq)) {
+			/* nr_active is monotonically decreasing, no lock */
+			if (per_cpu_ptr(wq->cpu_wq, cpu)->nr_active) {
+				busy = true;
+				goto out_unlock;
+			}
+		}
+	}
+out_unlock:
+	spin_unlock(&workqueue_lock);
+	return busy;
+}
+
+/**
+ * thaw_workqueues - thaw workqueues
+ *
+ * Thaw workqueues.  Normal queueing is restored and all collected
+ * frozen works are started.  Does nothing if workqueues aren't
+ * frozen.
+ *
+ * CONTEXT:
+ * Grabs and releases workqueue_lock and pool->lock's.
+ */
+void thaw_workqueues(void)
+{
+	struct workqueue_struct *wq;
+	int cpu;
+
+	spin_lock(&workqueue_lock);
+
+	if (!workqueue_freezing)
+		goto out_unlock;
+
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!wq->freezeable)
+			continue;
+
+		for_each_cpu(cpu, wq_cpu_map(wq)) {
+			struct cpu_workqueue_struct *cwq =
+				per_cpu_ptr(wq->cpu_wq, cpu);
+			struct worker_pool *pool = cwq->pool;
+
+			spin_lock_irq(&pool->lock);
+			cwq->max_active = wq->saved_max_active;
+			cwq_update_runnable(cwq);
+			if (need_more_worker(pool))
+				wake_up_worker(pool);
+			spin_unlock_irq(&pool->lock);
+		}
 	}
 
-	return ret;
+	workqueue_freezing = false;
+out_unlock:
+	spin_unlock(&workqueue_lock);
 }
 
+#endif /* CONFIG_FREEZER */
+
 #ifdef CONFIG_SMP
 
 struct work_for_cpu {
@@ -1044,12 +1939,41 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
 
 void __init init_workqueues(void)
 {
-	alloc_cpumask_var(&cpu_populated_map, GFP_KERNEL);
+	int cpu, i;
 
-	cpumask_copy(cpu_populated_map, cpu_online_mask);
 	singlethread_cpu = cpumask_first(cpu_possible_mask);
 	cpu_singlethread_map = cpumask_of(singlethread_cpu);
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < NR_WORKER_POOLS; i++) {
+			struct worker_pool *pool = get_pool(cpu, i);
+
+			spin_lock_init(&pool->lock);
+			INIT_LIST_HEAD(&pool->cwq_list);
+			pool->cpu = cpu;
+			pool->rt = i;
+			pool->flags = cpu_online(cpu) ? 0 : POOL_DISASSOCIATED;
+			INIT_LIST_HEAD(&pool->idle_list);
+			INIT_LIST_HEAD(&pool->busy_list);
+			INIT_LIST_HEAD(&pool->workers);
+			setup_timer(&pool->idle_timer, idle_worker_timeout,
+				    (unsigned long)pool);
+			init_waitqueue_head(&pool->done_wait);
+			ida_init(&pool->worker_ida);
+			atomic_set(&pool->nr_running, 0);
+		}
+	}
+
+	/* create the initial workers of the online cpus */
+	for_each_online_cpu(cpu)
+		for (i = 0; i < NR_WORKER_POOLS; i++)
+			BUG_ON(create_initial_workers(get_pool(cpu, i)));
+
 	hotcpu_notifier(workqueue_cpu_callback, 0);
 	keventd_wq = create_workqueue("events");
 	BUG_ON(!keventd_wq);
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(keventd_wq->cpu_wq, cpu)->max_active =
+			WQ_DFL_ACTIVE;
+	keventd_wq->saved_max_active = WQ_DFL_ACTIVE;
 }
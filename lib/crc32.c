@@ -29,27 +29,105 @@
 #include <linux/init.h>
 #include <asm/atomic.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
-#define tole(x) __constant_cpu_to_le32(x)
-#define tobe(x) __constant_cpu_to_be32(x)
+#if CRC_LE_BITS >= 8
+# define tole(x) __constant_cpu_to_le32(x)
 #else
-#define tole(x) (x)
-#define tobe(x) (x)
+# define tole(x) (x)
+#endif
+#if CRC_BE_BITS >= 8
+# define tobe(x) __constant_cpu_to_be32(x)
+#else
+# define tobe(x) (x)
 #endif
 #include "crc32table.h"
 
+#ifdef CONFIG_CRC32_PCLMUL
+#include <asm/cpufeature.h>
+#include <asm/i387.h>
+#include <asm/crc32.h>
+
+/* Below this, saving and restoring the FPU costs more than folding wins */
+#define CRC32_PCLMUL_BREAKEVEN	512
+#endif
+
 MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
 MODULE_DESCRIPTION("Ethernet CRC32 calculations");
 MODULE_LICENSE("GPL");
 
-/**
- * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
- * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
- *	other uses, or the previous crc32 value if computing incrementally.
- * @p: pointer to buffer over which CRC is run
- * @len: length of buffer @p
+#if CRC_LE_BITS >= 8 || CRC_BE_BITS >= 8
+/*
+ * The table driven loop shared by both directions: the crc and the
+ * tables are kept in the byte order of the direction, so a 32 bit load
+ * of the data lines up with the crc either way.  With @bits of 32 or 64
+ * the crc of a whole word or of two is looked up at once in four or
+ * eight tables ("slicing"), a modern cpu can overlap those loads.
  */
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len);
+static inline u32
+crc32_body(u32 crc, unsigned char const *buf, size_t len,
+	   const u32 (*tab)[256], int bits)
+{
+# ifdef __LITTLE_ENDIAN
+#  define DO_CRC(x) crc = tab[0][(crc ^ (x)) & 255] ^ (crc >> 8)
+#  define DO_CRC4 (tab[3][(q) & 255] ^ tab[2][(q >> 8) & 255] ^ \
+		   tab[1][(q >> 16) & 255] ^ tab[0][(q >> 24) & 255])
+#  define DO_CRC8 (tab[7][(q) & 255] ^ tab[6][(q >> 8) & 255] ^ \
+		   tab[5][(q >> 16) & 255] ^ tab[4][(q >> 24) & 255])
+# else
+#  define DO_CRC(x) crc = tab[0][((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+#  define DO_CRC4 (tab[0][(q) & 255] ^ tab[1][(q >> 8) & 255] ^ \
+		   tab[2][(q >> 16) & 255] ^ tab[3][(q >> 24) & 255])
+#  define DO_CRC8 (tab[4][(q) & 255] ^ tab[5][(q >> 8) & 255] ^ \
+		   tab[6][(q >> 16) & 255] ^ tab[7][(q >> 24) & 255])
+# endif
+	const u32 *b;
+	size_t rem_len;
+	u32 q;
+
+	/* Align it */
+	if (unlikely((long)buf & 3 && len)) {
+		do {
+			DO_CRC(*buf++);
+		} while ((--len) && ((long)buf) & 3);
+	}
+
+	if (bits == 64) {
+		rem_len = len & 7;
+		len = len >> 3;
+	} else {
+		rem_len = len & 3;
+		len = len >> 2;
+	}
+
+	/* load data 32 bits wide, xor data 32 bits wide. */
+	b = (const u32 *)buf;
+	for (; len; len--) {
+		q = crc ^ *b++;
+		if (bits == 64) {
+			crc = DO_CRC8;
+			q = *b++;
+			crc ^= DO_CRC4;
+		} else if (bits == 32) {
+			crc = DO_CRC4;
+		} else {
+			crc = q;
+			DO_CRC(0);
+			DO_CRC(0);
+			DO_CRC(0);
+			DO_CRC(0);
+		}
+	}
+
+	/* And the last few bytes */
+	buf = (const unsigned char *)b;
+	while (rem_len--)
+		DO_CRC(*buf++);
+
+	return crc;
+#undef DO_CRC
+#undef DO_CRC4
+#undef DO_CRC8
+}
+#endif
 
 #if CRC_LE_BITS == 1
 /*
@@ -57,7 +135,7 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len);
  * simplified by inlining the table in ?: form.
  */
 
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+static u32 __pure crc32_le_generic(u32 crc, unsigned char const *p, size_t len)
 {
 	int i;
 	while (len--) {
@@ -69,91 +147,39 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 }
 #else				/* Table-based approach */
 
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+static u32 __pure crc32_le_generic(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_LE_BITS == 8
-	const u32      *b =(u32 *)p;
-	const u32      *tab = crc32table_le;
-
-# ifdef __LITTLE_ENDIAN
-#  define DO_CRC(x) crc = tab[ (crc ^ (x)) & 255 ] ^ (crc>>8)
-# else
-#  define DO_CRC(x) crc = tab[ ((crc >> 24) ^ (x)) & 255] ^ (crc<<8)
-# endif
-
+# if CRC_LE_BITS >= 8
 	crc = __cpu_to_le32(crc);
-	/* Align it */
-	if(unlikely(((long)b)&3 && len)){
-		do {
-			u8 *p = (u8 *)b;
-			DO_CRC(*p++);
-			b = (void *)p;
-		} while ((--len) && ((long)b)&3 );
-	}
-	if(likely(len >= 4)){
-		/* load data 32 bits wide, xor data 32 bits wide. */
-		size_t save_len = len & 3;
-	        len = len >> 2;
-		--b; /* use pre increment below(*++b) for speed */
-		do {
-			crc ^= *++b;
-			DO_CRC(0);
-			DO_CRC(0);
-			DO_CRC(0);
-			DO_CRC(0);
-		} while (--len);
-		b++; /* point to next byte(s) */
-		len = save_len;
-	}
-	/* And the last few bytes */
-	if(len){
-		do {
-			u8 *p = (u8 *)b;
-			DO_CRC(*p++);
-			b = (void *)p;
-		} while (--len);
-	}
-
+	crc = crc32_body(crc, p, len, crc32table_le, CRC_LE_BITS);
 	return __le32_to_cpu(crc);
-#undef ENDIAN_SHIFT
-#undef DO_CRC
-
 # elif CRC_LE_BITS == 4
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
 	}
 	return crc;
 # elif CRC_LE_BITS == 2
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
 	}
 	return crc;
 # endif
 }
 #endif
 
-/**
- * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
- * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
- *	other uses, or the previous crc32 value if computing incrementally.
- * @p: pointer to buffer over which CRC is run
- * @len: length of buffer @p
- */
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len);
-
 #if CRC_BE_BITS == 1
 /*
  * In fact, the table-based code will work in this case, but it can be
  * simplified by inlining the table in ?: form.
  */
 
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+static u32 __pure crc32_be_generic(u32 crc, unsigned char const *p, size_t len)
 {
 	int i;
 	while (len--) {
@@ -167,74 +193,93 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 }
 
 #else				/* Table-based approach */
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+static u32 __pure crc32_be_generic(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_BE_BITS == 8
-	const u32      *b =(u32 *)p;
-	const u32      *tab = crc32table_be;
-
-# ifdef __LITTLE_ENDIAN
-#  define DO_CRC(x) crc = tab[ (crc ^ (x)) & 255 ] ^ (crc>>8)
-# else
-#  define DO_CRC(x) crc = tab[ ((crc >> 24) ^ (x)) & 255] ^ (crc<<8)
-# endif
-
+# if CRC_BE_BITS >= 8
 	crc = __cpu_to_be32(crc);
-	/* Align it */
-	if(unlikely(((long)b)&3 && len)){
-		do {
-			u8 *p = (u8 *)b;
-			DO_CRC(*p++);
-			b = (u32 *)p;
-		} while ((--len) && ((long)b)&3 );
-	}
-	if(likely(len >= 4)){
-		/* load data 32 bits wide, xor data 32 bits wide. */
-		size_t save_len = len & 3;
-	        len = len >> 2;
-		--b; /* use pre increment below(*++b) for speed */
-		do {
-			crc ^= *++b;
-			DO_CRC(0);
-			DO_CRC(0);
-			DO_CRC(0);
-			DO_CRC(0);
-		} while (--len);
-		b++; /* point to next byte(s) */
-		len = save_len;
-	}
-	/* And the last few bytes */
-	if(len){
-		do {
-			u8 *p = (u8 *)b;
-			DO_CRC(*p++);
-			b = (void *)p;
-		} while (--len);
-	}
+	crc = crc32_body(crc, p, len, crc32table_be, CRC_BE_BITS);
 	return __be32_to_cpu(crc);
-#undef ENDIAN_SHIFT
-#undef DO_CRC
-
 # elif CRC_BE_BITS == 4
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
 	}
 	return crc;
 # elif CRC_BE_BITS == 2
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
 	}
 	return crc;
 # endif
 }
 #endif
 
+#ifdef CONFIG_CRC32_PCLMUL
+/*
+ * Fold the bulk of the buffer with carry-less multiplications, then
+ * checksum the folded 16 bytes and the tail with the tables.
+ */
+static u32 crc32_pclmul(u32 crc, unsigned char const *p, size_t len,
+			void (*fold)(u8 *, const u8 *, size_t, u32),
+			u32 (*generic)(u32, unsigned char const *, size_t))
+{
+	size_t bulk = len & ~(size_t)15;
+	u8 folded[16];
+
+	kernel_fpu_begin();
+	fold(folded, p, bulk, crc);
+	kernel_fpu_end();
+
+	crc = generic(0, folded, sizeof(folded));
+	return generic(crc, p + bulk, len - bulk);
+}
+
+static inline int crc32_use_pclmul(size_t len)
+{
+	return len >= CRC32_PCLMUL_BREAKEVEN && cpu_has_pclmulqdq &&
+		irq_fpu_usable();
+}
+#endif
+
+/**
+ * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
+ * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
+ *	other uses, or the previous crc32 value if computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ */
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+#ifdef CONFIG_CRC32_PCLMUL
+	if (crc32_use_pclmul(len))
+		return crc32_pclmul(crc, p, len, crc32_pclmul_le_fold,
+				    crc32_le_generic);
+#endif
+	return crc32_le_generic(crc, p, len);
+}
+
+/**
+ * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
+ * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
+ *	other uses, or the previous crc32 value if computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ */
+u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+{
+#ifdef CONFIG_CRC32_PCLMUL
+	if (crc32_use_pclmul(len))
+		return crc32_pclmul(crc, p, len, crc32_pclmul_be_fold,
+				    crc32_be_generic);
+#endif
+	return crc32_be_generic(crc, p, len);
+}
+
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(crc32_be);
 
@@ -75,7 +75,6 @@ void *io_tlb_overflow_buffer;
  * each index
  */
 static unsigned int *io_tlb_list;
-static unsigned int io_tlb_index;
 
 /*
  * We need to save away the original address corresponding to a mapped entry
@@ -84,9 +83,40 @@ static unsigned int io_tlb_index;
 static phys_addr_t *io_tlb_orig_addr;
 
 /*
- * Protect the above data structures in the map and unmap calls
+ * The slabs are split into up to IO_TLB_MAX_AREAS areas of whole
+ * segments, each with its own lock and search index, so cpus mapping
+ * at the same time mostly search and lock different parts of the
+ * pool.  A cpu starts in its own area and moves on to the others only
+ * if that is full.  An area's lock protects its part of io_tlb_list.
  */
-static DEFINE_SPINLOCK(io_tlb_lock);
+#define IO_TLB_MAX_AREAS	16
+
+static struct io_tlb_area {
+	spinlock_t lock;
+	unsigned int index;
+} ____cacheline_aligned_in_smp io_tlb_areas[IO_TLB_MAX_AREAS];
+
+static unsigned int io_tlb_nareas = 1;
+static unsigned long io_tlb_area_nslabs;
+
+static void swiotlb_init_areas(void)
+{
+	unsigned int i, nareas = 1;
+
+	while (nareas * 2 <= min_t(unsigned int, num_possible_cpus(),
+				   IO_TLB_MAX_AREAS))
+		nareas *= 2;
+	while (nareas > 1 && io_tlb_nslabs % (nareas * IO_TLB_SEGSIZE))
+		nareas /= 2;
+
+	io_tlb_nareas = nareas;
+	io_tlb_area_nslabs = io_tlb_nslabs / nareas;
+
+	for (i = 0; i < nareas; i++) {
+		spin_lock_init(&io_tlb_areas[i].lock);
+		io_tlb_areas[i].index = i * io_tlb_area_nslabs;
+	}
+}
 
 static int late_alloc;
 
@@ -185,7 +215,7 @@ swiotlb_init_early(size_t default_size, int verbose)
 	io_tlb_list = alloc_bootmem(io_tlb_nslabs * sizeof(int));
 	for (i = 0; i < io_tlb_nslabs; i++)
 		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-	io_tlb_index = 0;
+	swiotlb_init_areas();
 	io_tlb_orig_addr = alloc_bootmem(io_tlb_nslabs * sizeof(phys_addr_t));
 
 	/*
@@ -259,7 +289,7 @@ swiotlb_init_late(size_t default_size)
 
 	for (i = 0; i < io_tlb_nslabs; i++)
 		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-	io_tlb_index = 0;
+	swiotlb_init_areas();
 
 	io_tlb_orig_addr = (phys_addr_t *) __get_free_pages(GFP_KERNEL,
 				get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
@@ -373,59 +403,37 @@ void swiotlb_bounce(phys_addr_t phys, char *dma_addr, size_t size,
 }
 
 /*
- * Allocates bounce buffer and returns its kernel virtual address.
+ * Find and take nslots slots in area a, returning the first slot's index
+ * or -1.
  */
-void *
-do_map_single(struct device *hwdev, phys_addr_t phys,
-	       unsigned long start_dma_addr, size_t size, int dir)
+static int
+swiotlb_area_find_slots(unsigned int a, unsigned int nslots,
+			unsigned int stride, unsigned long offset_slots,
+			unsigned long max_slots)
 {
+	struct io_tlb_area *area = &io_tlb_areas[a];
+	unsigned long start = a * io_tlb_area_nslabs;
+	unsigned long end = start + io_tlb_area_nslabs;
 	unsigned long flags;
-	char *dma_addr;
-	unsigned int nslots, stride, index, wrap;
+	unsigned int index, wrap;
 	int i;
-	unsigned long mask;
-	unsigned long offset_slots;
-	unsigned long max_slots;
-
-	mask = dma_get_seg_boundary(hwdev);
-	start_dma_addr = start_dma_addr & mask;
-	offset_slots = ALIGN(start_dma_addr, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
-
-	/*
-	 * Carefully handle integer overflow which can occur when mask == ~0UL.
-	 */
-	max_slots = mask + 1
-		    ? ALIGN(mask + 1, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT
-		    : 1UL << (BITS_PER_LONG - IO_TLB_SHIFT);
-
-	/*
-	 * For mappings greater than a page, we limit the stride (and
-	 * hence alignment) to a page size.
-	 */
-	nslots = ALIGN(size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
-	if (size > PAGE_SIZE)
-		stride = (1 << (PAGE_SHIFT - IO_TLB_SHIFT));
-	else
-		stride = 1;
-
-	BUG_ON(!nslots);
 
 	/*
 	 * Find suitable number of IO TLB entries size that will fit this
 	 * request and allocate a buffer from that IO TLB pool.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
-	index = ALIGN(io_tlb_index, stride);
-	if (index >= io_tlb_nslabs)
-		index = 0;
+	spin_lock_irqsave(&area->lock, flags);
+	index = ALIGN(area->index, stride);
+	if (index >= end)
+		index = start;
 	wrap = index;
 
 	do {
 		while (iommu_is_span_boundary(index, nslots, offset_slots,
 					      max_slots)) {
 			index += stride;
-			if (index >= io_tlb_nslabs)
-				index = 0;
+			if (index >= end)
+				index = start;
 			if (index == wrap)
 				goto not_found;
 		}
@@ -443,27 +451,77 @@ do_map_single(struct device *hwdev, phys_addr_t phys,
 			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE)
 				!= IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
 				io_tlb_list[i] = ++count;
-			dma_addr = io_tlb_start + (index << IO_TLB_SHIFT);
 
 			/*
 			 * Update the indices to avoid searching in the next
 			 * round.
 			 */
-			io_tlb_index = ((index + nslots) < io_tlb_nslabs
-					? (index + nslots) : 0);
+			area->index = ((index + nslots) < end
+				       ? (index + nslots) : start);
 
-			goto found;
+			spin_unlock_irqrestore(&area->lock, flags);
+			return index;
 		}
 		index += stride;
-		if (index >= io_tlb_nslabs)
-			index = 0;
+		if (index >= end)
+			index = start;
 	} while (index != wrap);
 
 not_found:
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&area->lock, flags);
+	return -1;
+}
+
+/*
+ * Allocates bounce buffer and returns its kernel virtual address.
+ */
+void *
+do_map_single(struct device *hwdev, phys_addr_t phys,
+	       unsigned long start_dma_addr, size_t size, int dir)
+{
+	char *dma_addr;
+	unsigned int nslots, stride, a, first;
+	int i, index;
+	unsigned long mask;
+	unsigned long offset_slots;
+	unsigned long max_slots;
+
+	mask = dma_get_seg_boundary(hwdev);
+	start_dma_addr = start_dma_addr & mask;
+	offset_slots = ALIGN(start_dma_addr, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
+
+	/*
+	 * Carefully handle integer overflow which can occur when mask == ~0UL.
+	 */
+	max_slots = mask + 1
+		    ? ALIGN(mask + 1, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT
+		    : 1UL << (BITS_PER_LONG - IO_TLB_SHIFT);
+
+	/*
+	 * For mappings greater than a page, we limit the stride (and
+	 * hence alignment) to a page size.
+	 */
+	nslots = ALIGN(size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
+	if (size > PAGE_SIZE)
+		stride = (1 << (PAGE_SHIFT - IO_TLB_SHIFT));
+	else
+		stride = 1;
+
+	BUG_ON(!nslots);
+
+	first = raw_smp_processor_id() & (io_tlb_nareas - 1);
+	a = first;
+	do {
+		index = swiotlb_area_find_slots(a, nslots, stride,
+						offset_slots, max_slots);
+		if (index >= 0)
+			goto found;
+		a = (a + 1) & (io_tlb_nareas - 1);
+	} while (a != first);
+
 	return NULL;
 found:
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	dma_addr = io_tlb_start + (index << IO_TLB_SHIFT);
 
 	/*
 	 * Save away the mapping from the original address to the DMA address.
@@ -487,6 +545,7 @@ do_unmap_single(struct device *hwdev, char *dma_addr, size_t size, int dir)
 	unsigned long flags;
 	int i, count, nslots = ALIGN(size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
 	int index = (dma_addr - io_tlb_start) >> IO_TLB_SHIFT;
+	struct io_tlb_area *area = &io_tlb_areas[index / io_tlb_area_nslabs];
 	phys_addr_t phys = io_tlb_orig_addr[index];
 
 	/*
@@ -501,7 +560,7 @@ do_unmap_single(struct device *hwdev, char *dma_addr, size_t size, int dir)
 	 * While returning the entries to the free list, we merge the entries
 	 * with slots below and above the pool being returned.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
+	spin_lock_irqsave(&area->lock, flags);
 	{
 		count = ((index + nslots) < ALIGN(index + 1, IO_TLB_SEGSIZE) ?
 			 io_tlb_list[index + nslots] : 0);
@@ -519,7 +578,7 @@ do_unmap_single(struct device *hwdev, char *dma_addr, size_t size, int dir)
 				IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
 			io_tlb_list[i] = ++count;
 	}
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&area->lock, flags);
 }
 
 void
@@ -6,6 +6,7 @@
 #include <linux/io.h>
 #include <asm/dma.h>
 #include <linux/scatterlist.h>
+#include <linux/spinlock.h>
 #include <xen/interface/xen.h>
 #include <xen/grant_table.h>
 
@@ -82,6 +83,66 @@ static int is_xen_swiotlb_buffer(dma_addr_t dma_addr)
 
 	return 0;
 }
+
+/*
+ * Each coherent allocation is exchanged with Xen for machine-contiguous
+ * memory under the device's mask, and handed back on free: a couple of
+ * hypercalls and a TLB flush each way.  Drivers that allocate and free
+ * coherent buffers at run time pay that every time, so a few freed
+ * regions of the small orders are kept, still exchanged, for reuse by
+ * any device whose mask they fit.
+ */
+#define COHERENT_CACHE_ORDERS	4
+#define COHERENT_CACHE_DEPTH	16
+
+static struct coherent_cache {
+	spinlock_t lock;
+	unsigned int nr;
+	unsigned long vstart[COHERENT_CACHE_DEPTH];
+} coherent_cache[COHERENT_CACHE_ORDERS] = {
+	[0 ... COHERENT_CACHE_ORDERS - 1] = {
+		.lock = __SPIN_LOCK_UNLOCKED(coherent_cache.lock),
+	},
+};
+
+static unsigned long coherent_cache_get(int order, u64 dma_mask)
+{
+	struct coherent_cache *cc = &coherent_cache[order];
+	unsigned long vstart = 0, flags;
+	int i;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	for (i = cc->nr - 1; i >= 0; i--) {
+		dma_addr_t end = virt_to_machine((void *)cc->vstart[i]).maddr +
+			(PAGE_SIZE << order) - 1;
+
+		if (end <= dma_mask) {
+			vstart = cc->vstart[i];
+			cc->vstart[i] = cc->vstart[--cc->nr];
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	return vstart;
+}
+
+static int coherent_cache_put(int order, unsigned long vstart)
+{
+	struct coherent_cache *cc = &coherent_cache[order];
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&cc->lock, flags);
+	if (cc->nr < COHERENT_CACHE_DEPTH) {
+		cc->vstart[cc->nr++] = vstart;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	return ret;
+}
+
 void *
 xen_swiotlb_alloc_coherent(struct device *hwdev, size_t size,
 		       dma_addr_t *dma_handle, gfp_t flags)
@@ -102,12 +163,22 @@ xen_swiotlb_alloc_coherent(struct device *hwdev, size_t size,
 	if (dma_alloc_from_coherent(hwdev, size, dma_handle, &ret))
 		return ret;
 
-	vstart = __get_free_pages(flags, order);
-	ret = (void *)vstart;
-
 	if (hwdev && hwdev->coherent_dma_mask)
 		dma_mask = dma_alloc_coherent_mask(hwdev, flags);
 
+	if (order < COHERENT_CACHE_ORDERS) {
+		vstart = coherent_cache_get(order, dma_mask);
+		if (vstart) {
+			ret = (void *)vstart;
+			memset(ret, 0, size);
+			*dma_handle = virt_to_machine(ret).maddr;
+			return ret;
+		}
+	}
+
+	vstart = __get_free_pages(flags, order);
+	ret = (void *)vstart;
+
 	if (ret) {
 		if (xen_create_contiguous_region(vstart, order,
 						 fls64(dma_mask)) != 0) {
@@ -130,6 +201,10 @@ xen_swiotlb_free_coherent(struct device *hwdev, size_t size, void *vaddr,
 	if (dma_release_from_coherent(hwdev, order, vaddr))
 		return;
 
+	if (order < COHERENT_CACHE_ORDERS &&
+	    coherent_cache_put(order, (unsigned long)vaddr))
+		return;
+
 	xen_destroy_contiguous_region((unsigned long)vaddr, order);
 	free_pages((unsigned long)vaddr, order);
 }
@@ -318,7 +318,17 @@ static int bdi_start_fn(void *ptr)
 	if (!list_empty(&bdi->work_list))
 		wb_do_writeback(wb, 1);
 
+	/*
+	 * __mark_inode_dirty() only wakes the forker for a bdi without a
+	 * thread, so if an inode got dirtied after we last looked, hand
+	 * it over now.
+	 */
+	spin_lock(&bdi->wb_lock);
 	wb->task = NULL;
+	spin_unlock(&bdi->wb_lock);
+	if (wb_has_dirty_io(wb))
+		wake_up_process(default_backing_dev_info.wb.task);
+
 	return ret;
 }
 
@@ -397,6 +407,11 @@ static int bdi_forker_task(void *ptr)
 		if (wb_has_dirty_io(me) || !list_empty(&me->bdi->work_list))
 			wb_do_writeback(me, 0);
 
+		/*
+		 * Set our state before scanning, so that an inode dirtied on
+		 * a thread-less bdi after the scan still wakes us up.
+		 */
+		set_current_state(TASK_INTERRUPTIBLE);
 		spin_lock_bh(&bdi_lock);
 
 		/*
@@ -413,14 +428,16 @@ static int bdi_forker_task(void *ptr)
 			bdi_add_default_flusher_task(bdi);
 		}
 
-		set_current_state(TASK_INTERRUPTIBLE);
-
 		if (list_empty(&bdi_pending_list)) {
 			unsigned long wait;
 
 			spin_unlock_bh(&bdi_lock);
+			/*
+			 * Bdis getting dirty data or work wake us up, so we
+			 * only need a timeout to flush our own dirty data.
+			 */
 			wait = msecs_to_jiffies(dirty_writeback_interval * 10);
-			if (wait)
+			if (wait && wb_has_dirty_io(me))
 				schedule_timeout(wait);
 			else
 				schedule();
@@ -0,0 +1,168 @@
+/*
+ * Cleancache frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of cleancache.  See
+ * Documentation/vm/cleancache.txt for more information.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/cleancache.h>
+
+/*
+ * cleancache_ops is set by cleancache_register_ops to contain the pointers
+ * to the cleancache "backend" implementation functions.
+ */
+static struct cleancache_ops cleancache_ops __read_mostly;
+
+/*
+ * Global enablement flag: lets the hooks in the page cache cost a single
+ * test of a global when no backend is registered.
+ */
+int cleancache_enabled __read_mostly;
+EXPORT_SYMBOL(cleancache_enabled);
+
+/*
+ * Counters available via /sys/kernel/debug/cleancache (if debugfs is
+ * properly configured).  These are for information only so are not
+ * protected against increment races.
+ */
+static u64 cleancache_succ_gets;
+static u64 cleancache_failed_gets;
+static u64 cleancache_puts;
+static u64 cleancache_flushes;
+
+/*
+ * Register operations for cleancache, returning previous thus allowing
+ * detection of multiple backends and possible nesting.  Filesystems
+ * mounted before registration bypass cleancache, so backends register
+ * at boot.
+ */
+struct cleancache_ops cleancache_register_ops(struct cleancache_ops *ops)
+{
+	struct cleancache_ops old = cleancache_ops;
+
+	cleancache_ops = *ops;
+	cleancache_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(cleancache_register_ops);
+
+/*
+ * Called by a cleancache-enabled filesystem at mount time.  Also called
+ * on remount, when the existing pool is kept.
+ */
+void __cleancache_init_fs(struct super_block *sb)
+{
+	if (sb->cleancache_poolid < 0)
+		sb->cleancache_poolid = (*cleancache_ops.init_fs)(PAGE_SIZE);
+}
+EXPORT_SYMBOL(__cleancache_init_fs);
+
+/*
+ * "Get" data from cleancache associated with the poolid/inode/index
+ * that were specified when the data was put to cleancache and, if
+ * successful, use it to fill the specified page with data and return 0.
+ * The pageframe is unchanged and returns -1 if the get fails.
+ * Page must be locked by caller.
+ */
+int __cleancache_get_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	int ret;
+
+	VM_BUG_ON(!PageLocked(page));
+	ret = (*cleancache_ops.get_page)(inode->i_sb->cleancache_poolid,
+					 inode->i_ino, page->index, page);
+	if (ret == 0)
+		cleancache_succ_gets++;
+	else
+		cleancache_failed_gets++;
+	return ret;
+}
+EXPORT_SYMBOL(__cleancache_get_page);
+
+/*
+ * "Put" data from a page to cleancache and associate it with the
+ * (previously-obtained per-filesystem) poolid and the page's
+ * inode and page index.  Page must be locked.  Note that a put_page
+ * always "succeeds", though a subsequent get_page may succeed or fail.
+ */
+void __cleancache_put_page(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+
+	VM_BUG_ON(!PageLocked(page));
+	(*cleancache_ops.put_page)(inode->i_sb->cleancache_poolid,
+				   inode->i_ino, page->index, page);
+	cleancache_puts++;
+}
+EXPORT_SYMBOL(__cleancache_put_page);
+
+/*
+ * Flush any data from cleancache associated with the poolid and the
+ * page's inode and page index so that a subsequent "get" will fail.
+ */
+void __cleancache_flush_page(struct address_space *mapping, struct page *page)
+{
+	struct inode *inode = mapping->host;
+
+	VM_BUG_ON(!PageLocked(page));
+	(*cleancache_ops.flush_page)(inode->i_sb->cleancache_poolid,
+				     inode->i_ino, page->index);
+	cleancache_flushes++;
+}
+EXPORT_SYMBOL(__cleancache_flush_page);
+
+/*
+ * Flush all data from cleancache associated with the poolid and the
+ * mappings's inode so that all subsequent gets to this poolid/inode
+ * will fail.
+ */
+void __cleancache_flush_inode(struct address_space *mapping)
+{
+	struct inode *inode = mapping->host;
+
+	(*cleancache_ops.flush_inode)(inode->i_sb->cleancache_poolid,
+				      inode->i_ino);
+}
+EXPORT_SYMBOL(__cleancache_flush_inode);
+
+/*
+ * Called by any cleancache-enabled filesystem at time of unmount;
+ * note that pool_id is surrendered and may be returned by a subsequent
+ * cleancache_init_fs.
+ */
+void __cleancache_flush_fs(struct super_block *sb)
+{
+	int pool_id = sb->cleancache_poolid;
+
+	if (pool_id >= 0) {
+		sb->cleancache_poolid = -1;
+		(*cleancache_ops.flush_fs)(pool_id);
+	}
+}
+EXPORT_SYMBOL(__cleancache_flush_fs);
+
+static int __init init_cleancache(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *root = debugfs_create_dir("cleancache", NULL);
+
+	if (root == NULL)
+		return -ENXIO;
+	debugfs_create_u64("succ_gets", S_IRUGO, root, &cleancache_succ_gets);
+	debugfs_create_u64("failed_gets", S_IRUGO,
+				root, &cleancache_failed_gets);
+	debugfs_create_u64("puts", S_IRUGO, root, &cleancache_puts);
+	debugfs_create_u64("flushes", S_IRUGO, root, &cleancache_flushes);
+#endif
+	return 0;
+}
+
+module_init(init_cleancache);
@@ -10,6 +10,7 @@
  * the NFS filesystem used to do this differently, for example)
  */
 #include <linux/module.h>
+#include <linux/cleancache.h>
 #include <linux/slab.h>
 #include <linux/compiler.h>
 #include <linux/fs.h>
@@ -60,7 +61,7 @@
  *
  *  ->i_mmap_lock		(truncate_pagecache)
  *    ->private_lock		(__free_pte->__set_page_dirty_buffers)
- *      ->swap_lock		(exclusive_swap_page, others)
+ *      ->swap_info_struct->lock (exclusive_swap_page, others)
  *        ->mapping->tree_lock
  *
  *  ->i_mutex
@@ -91,7 +92,7 @@
  *    ->page_table_lock or pte_lock	(anon_vma_prepare and various)
  *
  *  ->page_table_lock or pte_lock
- *    ->swap_lock		(try_to_unmap_one)
+ *    ->swap_info_struct->lock (try_to_unmap_one)
  *    ->private_lock		(try_to_unmap_one)
  *    ->tree_lock		(try_to_unmap_one)
  *    ->zone.lru_lock		(follow_page->mark_page_accessed)
@@ -119,6 +120,16 @@ void __remove_from_page_cache(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 
+	/*
+	 * if we're uptodate, flush out into the cleancache, otherwise
+	 * invalidate any existing cleancache entries.  We can't leave
+	 * stale data around in the cleancache once our page is gone
+	 */
+	if (PageUptodate(page) && PageMappedToDisk(page))
+		cleancache_put_page(page);
+	else
+		cleancache_flush_page(mapping, page);
+
 	radix_tree_delete(&mapping->page_tree, page->index);
 	page->mapping = NULL;
 	mapping->nrpages--;
@@ -137,6 +148,7 @@ void __remove_from_page_cache(struct page *page)
 	if (PageDirty(page) && mapping_cap_account_dirty(mapping)) {
 		dec_zone_page_state(page, NR_FILE_DIRTY);
 		dec_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
+		mem_cgroup_update_page_stat(page, MEMCG_NR_FILE_DIRTY, false);
 	}
 }
 
@@ -612,6 +624,64 @@ int __lock_page_killable(struct page *page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+/*
+ * Lock @page without sleeping on behalf of an async kiocb.  If the page
+ * is locked, the kiocb's wait entry is queued on it instead, so that
+ * unlocking the page kicks a retry.  Returns 0 with the page locked, or
+ * -EIOCBRETRY.
+ */
+static int lock_page_async(struct page *page, struct kiocb *iocb)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	struct address_space *mapping;
+	unsigned long flags;
+	int ret = 0;
+
+	if (trylock_page(page))
+		return 0;
+
+	/* Still queued from an earlier pass of this retry on the page. */
+	if (!list_empty(&wait->wait.task_list))
+		return -EIOCBRETRY;
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	/*
+	 * As with the sleeping waiters: queue first, then test, so that
+	 * an unlock in between is certain to find us.
+	 */
+	spin_lock_irqsave(&q->lock, flags);
+	__add_wait_queue(q, &wait->wait);
+	if (trylock_page(page)) {
+		list_del_init(&wait->wait.task_list);
+		wait->key.flags = NULL;
+	} else
+		ret = -EIOCBRETRY;
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	/* Unplug as a sleeping waiter would, see sync_page(). */
+	if (ret) {
+		smp_mb();
+		mapping = page_mapping(page);
+		if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
+			mapping->a_ops->sync_page(page);
+	}
+	return ret;
+}
+
+/*
+ * do_generic_file_read() sleeps for the page lock only for synchronous
+ * callers.
+ */
+static int lock_page_for_read(struct page *page, struct kiocb *iocb)
+{
+	if (iocb && !is_sync_kiocb(iocb))
+		return lock_page_async(page, iocb);
+	return lock_page_killable(page);
+}
+
 /**
  * __lock_page_nosync - get a lock on the page, without calling sync_page()
  * @page: the page to lock
@@ -976,15 +1046,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @iocb:	the kiocb, or %NULL
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * For an async @iocb it does not wait for a page to be read in, but
+ * stops there with -EIOCBRETRY in desc->error, and the page's unlock
+ * kicks the retry.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor,
+		struct kiocb *iocb)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1104,7 +1180,7 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		error = lock_page_for_read(page, iocb);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1141,7 +1217,7 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			error = lock_page_for_read(page, iocb);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1338,7 +1414,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		if (desc.count == 0)
 			continue;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor, iocb);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
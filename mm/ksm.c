@@ -115,6 +115,7 @@ struct ksm_scan {
  * @node: rb_node of this rmap_item in either unstable or stable tree
  * @next: next rmap_item hanging off the same node of the stable tree
  * @prev: previous rmap_item hanging off the same node of the stable tree
+ * @nid: NUMA node id of the stable or unstable tree this item is in
  */
 struct rmap_item {
 	struct list_head link;
@@ -128,15 +129,25 @@ struct rmap_item {
 		struct rb_node node;			/* when tree node */
 		struct rmap_item *prev;			/* in stable list */
 	};
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 #define SEQNR_MASK	0x0ff	/* low bits of unstable tree seqnr */
 #define NODE_FLAG	0x100	/* is a node of unstable or stable tree */
 #define STABLE_FLAG	0x200	/* is a node or list item of stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/*
+ * The stable and unstable tree heads: only the first pair is used unless
+ * merging across nodes is disabled, then there is one pair per node.
+ */
+static struct rb_root root_stable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
+static struct rb_root root_unstable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
 
 #define MM_SLOTS_HASH_HEADS 1024
 static struct hlist_head *mm_slots_hash;
@@ -172,6 +183,9 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Zero to merge only pages that are on the same NUMA node */
+static unsigned int ksm_merge_across_nodes = 1;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -280,6 +294,33 @@ static void insert_to_mm_slots_hash(struct mm_struct *mm,
 	hlist_add_head(&mm_slot->link, bucket);
 }
 
+/* The node whose trees a page is looked up in and inserted into */
+static inline int tree_nid(struct page *page)
+{
+	return ksm_merge_across_nodes ? 0 : page_to_nid(page);
+}
+
+#ifdef CONFIG_NUMA
+static inline int rmap_item_nid(struct rmap_item *rmap_item)
+{
+	return rmap_item->nid;
+}
+
+static inline void set_rmap_item_nid(struct rmap_item *rmap_item, int nid)
+{
+	rmap_item->nid = nid;
+}
+#else
+static inline int rmap_item_nid(struct rmap_item *rmap_item)
+{
+	return 0;
+}
+
+static inline void set_rmap_item_nid(struct rmap_item *rmap_item, int nid)
+{
+}
+#endif
+
 static inline int in_stable_tree(struct rmap_item *rmap_item)
 {
 	return rmap_item->address & STABLE_FLAG;
@@ -431,14 +472,16 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		struct rmap_item *next_item = rmap_item->next;
 
 		if (rmap_item->address & NODE_FLAG) {
+			struct rb_root *root;
+
+			root = &root_stable_tree[rmap_item_nid(rmap_item)];
 			if (next_item) {
 				rb_replace_node(&rmap_item->node,
-						&next_item->node,
-						&root_stable_tree);
+						&next_item->node, root);
 				next_item->address |= NODE_FLAG;
 				ksm_pages_sharing--;
 			} else {
-				rb_erase(&rmap_item->node, &root_stable_tree);
+				rb_erase(&rmap_item->node, root);
 				ksm_pages_shared--;
 			}
 		} else {
@@ -467,7 +510,8 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 &root_unstable_tree[rmap_item_nid(rmap_item)]);
 		ksm_pages_unshared--;
 	}
 
@@ -885,7 +929,7 @@ static struct rmap_item *stable_tree_search(struct page *page,
 					    struct page **page2,
 					    struct rmap_item *rmap_item)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node = root_stable_tree[tree_nid(page)].rb_node;
 
 	while (node) {
 		struct rmap_item *tree_rmap_item, *next_rmap_item;
@@ -934,7 +978,8 @@ static struct rmap_item *stable_tree_search(struct page *page,
 static struct rmap_item *stable_tree_insert(struct page *page,
 					    struct rmap_item *rmap_item)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = tree_nid(page);
+	struct rb_node **new = &root_stable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -976,8 +1021,9 @@ static struct rmap_item *stable_tree_insert(struct page *page,
 
 	rmap_item->address |= NODE_FLAG | STABLE_FLAG;
 	rmap_item->next = NULL;
+	set_rmap_item_nid(rmap_item, nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_stable_tree);
+	rb_insert_color(&rmap_item->node, &root_stable_tree[nid]);
 
 	ksm_pages_shared++;
 	return rmap_item;
@@ -990,11 +1036,16 @@ static struct rmap_item *stable_tree_insert(struct page *page,
  *	  into the unstable tree
  * @page2: pointer into identical page that was found inside the unstable tree
  * @rmap_item: the reverse mapping item of page
+ * @checksum: checksum of page, equal to rmap_item->oldchecksum
  *
  * This function searches for a page in the unstable tree identical to the
  * page currently being scanned; and if no identical page is found in the
  * tree, we insert rmap_item as a new object into the unstable tree.
  *
+ * The tree is ordered by checksum first, and only nodes with the same
+ * checksum are ordered by content: so most of the walk costs neither a
+ * page table lookup nor a memcmp.
+ *
  * This function returns pointer to rmap_item found to be identical
  * to the currently scanned page, NULL otherwise.
  *
@@ -1003,9 +1054,11 @@ static struct rmap_item *stable_tree_insert(struct page *page,
  */
 static struct rmap_item *unstable_tree_search_insert(struct page *page,
 						struct page **page2,
-						struct rmap_item *rmap_item)
+						struct rmap_item *rmap_item,
+						unsigned int checksum)
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	int nid = tree_nid(page);
+	struct rb_node **new = &root_unstable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1014,6 +1067,15 @@ static struct rmap_item *unstable_tree_search_insert(struct page *page,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		if (checksum != tree_rmap_item->oldchecksum) {
+			parent = *new;
+			if (checksum < tree_rmap_item->oldchecksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		page2[0] = get_mergeable_page(tree_rmap_item);
 		if (!page2[0])
 			return NULL;
@@ -1043,8 +1105,9 @@ static struct rmap_item *unstable_tree_search_insert(struct page *page,
 
 	rmap_item->address |= NODE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	set_rmap_item_nid(rmap_item, nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &root_unstable_tree[nid]);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1066,6 +1129,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 
 	tree_rmap_item->next = rmap_item;
 	rmap_item->address |= STABLE_FLAG;
+	set_rmap_item_nid(rmap_item, rmap_item_nid(tree_rmap_item));
 
 	ksm_pages_sharing++;
 }
@@ -1131,7 +1195,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
-	tree_rmap_item = unstable_tree_search_insert(page, page2, rmap_item);
+	tree_rmap_item = unstable_tree_search_insert(page, page2, rmap_item,
+						     checksum);
 	if (tree_rmap_item) {
 		err = try_to_merge_two_pages(rmap_item->mm,
 					     rmap_item->address, page,
@@ -1143,7 +1208,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 * tree, and insert it instead as new node in the stable tree.
 		 */
 		if (!err) {
-			rb_erase(&tree_rmap_item->node, &root_unstable_tree);
+			rb_erase(&tree_rmap_item->node,
+			    &root_unstable_tree[rmap_item_nid(tree_rmap_item)]);
 			tree_rmap_item->address &= ~NODE_FLAG;
 			ksm_pages_unshared--;
 
@@ -1209,7 +1275,10 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 
 	slot = ksm_scan.mm_slot;
 	if (slot == &ksm_mm_head) {
-		root_unstable_tree = RB_ROOT;
+		int nid;
+
+		for (nid = 0; nid < nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1606,6 +1675,44 @@ static ssize_t max_kernel_pages_show(struct kobject *kobj,
 }
 KSM_ATTR(max_kernel_pages);
 
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	/*
+	 * Pages already merged would sit in the wrong trees: they must be
+	 * unmerged ("echo 2 > run") before switching.
+	 */
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		if (ksm_pages_shared)
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1656,6 +1763,9 @@ static struct attribute *ksm_attrs[] = {
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
 	&max_kernel_pages_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
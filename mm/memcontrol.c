@@ -38,6 +38,8 @@
 #include <linux/vmalloc.h>
 #include <linux/mm_inline.h>
 #include <linux/page_cgroup.h>
+#include <linux/writeback.h>
+#include <linux/cpu.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -67,6 +69,8 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_CACHE, 	   /* # of pages charged as cache */
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_MAPPED_FILE,  /* # of pages charged as file rss */
+	MEM_CGROUP_STAT_FILE_DIRTY,   /* # of dirty pages in page cache */
+	MEM_CGROUP_STAT_WRITEBACK,    /* # of pages under writeback */
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
 	MEM_CGROUP_STAT_EVENTS,	/* sum of pagein + pageout for internal use */
@@ -221,6 +225,8 @@ struct mem_cgroup {
 	atomic_t	refcnt;
 
 	unsigned int	swappiness;
+	/* percentage of the limit that may be dirty or under writeback */
+	unsigned int	dirty_ratio;
 
 	/* set when res.limit == memsw.limit */
 	bool		memsw_is_minimum;
@@ -772,6 +778,48 @@ int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem)
 	return ret;
 }
 
+struct mem_cgroup_scan_arg {
+	int (*fn)(struct task_struct *, void *);
+	void *arg;
+};
+
+static int mem_cgroup_scan_tasks_cb(struct mem_cgroup *mem, void *data)
+{
+	struct mem_cgroup_scan_arg *scan = data;
+	struct cgroup *cgrp = mem->css.cgroup;
+	struct cgroup_iter it;
+	struct task_struct *p;
+	int ret = 0;
+
+	cgroup_iter_start(cgrp, &it);
+	while (!ret && (p = cgroup_iter_next(cgrp, &it))) {
+		int owner;
+
+		/* The owner is what charges an mm to us: visit each mm once */
+		task_lock(p);
+		owner = p->mm && p->mm->owner == p;
+		task_unlock(p);
+		if (owner)
+			ret = scan->fn(p, scan->arg);
+	}
+	cgroup_iter_end(cgrp, &it);
+	return ret;
+}
+
+/*
+ * Call @fn on the owner of every mm charged to @mem or, under hierarchy,
+ * to one of its descendants.  Only those cgroups' task lists are walked,
+ * not every task in the system.  Stops at and returns the first nonzero
+ * value from @fn.
+ */
+int mem_cgroup_scan_tasks(struct mem_cgroup *mem,
+			  int (*fn)(struct task_struct *, void *), void *arg)
+{
+	struct mem_cgroup_scan_arg scan = { .fn = fn, .arg = arg };
+
+	return mem_cgroup_walk_tree(mem, &scan, mem_cgroup_scan_tasks_cb);
+}
+
 /*
  * prev_priority control...this will be used in memory reclaim path.
  */
@@ -986,6 +1034,22 @@ static unsigned int get_swappiness(struct mem_cgroup *memcg)
 	return swappiness;
 }
 
+static unsigned int get_dirty_ratio(struct mem_cgroup *memcg)
+{
+	struct cgroup *cgrp = memcg->css.cgroup;
+	unsigned int dirty_ratio;
+
+	/* root ? */
+	if (cgrp->parent == NULL)
+		return vm_dirty_ratio;
+
+	spin_lock(&memcg->reclaim_param_lock);
+	dirty_ratio = memcg->dirty_ratio;
+	spin_unlock(&memcg->reclaim_param_lock);
+
+	return dirty_ratio;
+}
+
 static int mem_cgroup_count_children_cb(struct mem_cgroup *mem, void *data)
 {
 	int *val = data;
@@ -1264,10 +1328,294 @@ done:
 	unlock_page_cgroup(pc);
 }
 
+/*
+ * Dirty and writeback accounting.  These are updated under the mapping's
+ * tree_lock and from I/O completion, where spinning on lock_page_cgroup
+ * could deadlock against a holder interrupted on this cpu; so it is only
+ * tried.  A flag in the page_cgroup records whether the page is counted,
+ * so that a failed trylock costs at most a missed count, and uncharge
+ * and move_account know what to settle.
+ */
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item item, bool set)
+{
+	struct mem_cgroup *mem;
+	struct mem_cgroup_stat_cpu *cpustat;
+	struct page_cgroup *pc;
+	unsigned long flags;
+	int idx, counted;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	pc = lookup_page_cgroup(page);
+	if (unlikely(!pc) || !PageCgroupUsed(pc))
+		return;
+
+	local_irq_save(flags);
+	if (!trylock_page_cgroup(pc))
+		goto out;
+
+	mem = pc->mem_cgroup;
+	if (!mem || !PageCgroupUsed(pc))
+		goto unlock;
+
+	switch (item) {
+	case MEMCG_NR_FILE_DIRTY:
+		idx = MEM_CGROUP_STAT_FILE_DIRTY;
+		if (set)
+			counted = TestSetPageCgroupFileDirty(pc);
+		else
+			counted = !TestClearPageCgroupFileDirty(pc);
+		break;
+	case MEMCG_NR_WRITEBACK:
+		idx = MEM_CGROUP_STAT_WRITEBACK;
+		if (set)
+			counted = TestSetPageCgroupWriteback(pc);
+		else
+			counted = !TestClearPageCgroupWriteback(pc);
+		break;
+	default:
+		BUG();
+	}
+
+	if (!counted) {
+		cpustat = &mem->stat.cpustat[smp_processor_id()];
+		__mem_cgroup_stat_add_safe(cpustat, idx, set ? 1 : -1);
+	}
+unlock:
+	unlock_page_cgroup(pc);
+out:
+	local_irq_restore(flags);
+}
+
+/*
+ * Move the dirty and writeback counts of @pc, whose lock is held, from
+ * @from to @to; with a NULL @to, drop them along with the flags.
+ */
+static void mem_cgroup_move_page_stat(struct page_cgroup *pc,
+		struct mem_cgroup *from, struct mem_cgroup *to)
+{
+	struct mem_cgroup_stat_cpu *cpustat;
+	unsigned long flags;
+	int cpu;
+
+	if (!PageCgroupFileDirty(pc) && !PageCgroupWriteback(pc))
+		return;
+
+	/* I/O completion updates the same counters from irq context */
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	if (PageCgroupFileDirty(pc)) {
+		cpustat = &from->stat.cpustat[cpu];
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_FILE_DIRTY, -1);
+		if (to) {
+			cpustat = &to->stat.cpustat[cpu];
+			__mem_cgroup_stat_add_safe(cpustat,
+					MEM_CGROUP_STAT_FILE_DIRTY, 1);
+		} else
+			ClearPageCgroupFileDirty(pc);
+	}
+	if (PageCgroupWriteback(pc)) {
+		cpustat = &from->stat.cpustat[cpu];
+		__mem_cgroup_stat_add_safe(cpustat,
+				MEM_CGROUP_STAT_WRITEBACK, -1);
+		if (to) {
+			cpustat = &to->stat.cpustat[cpu];
+			__mem_cgroup_stat_add_safe(cpustat,
+					MEM_CGROUP_STAT_WRITEBACK, 1);
+		} else
+			ClearPageCgroupWriteback(pc);
+	}
+	local_irq_restore(flags);
+}
+
+/**
+ * mem_cgroup_dirty_info - dirty limit of the current task's cgroup
+ * @dirtyable: the global amount of dirtyable memory, in pages
+ * @thresh: set to the cgroup's dirty threshold, in pages
+ * @nr_dirty: set to the cgroup's dirty and writeback pages
+ *
+ * The threshold is memory.dirty_ratio of the cgroup's limit, or of
+ * @dirtyable if that is smaller.  Returns false, leaving the global
+ * limits to apply alone, for the root cgroup, an unlimited cgroup or a
+ * dirty_ratio of 0.
+ */
+bool mem_cgroup_dirty_info(unsigned long dirtyable, unsigned long *thresh,
+			   unsigned long *nr_dirty)
+{
+	struct mem_cgroup *mem;
+	unsigned int ratio;
+	u64 limit;
+	s64 dirty;
+	bool ret = false;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(current);
+	if (mem_cgroup_is_root(mem))
+		goto out;
+
+	ratio = get_dirty_ratio(mem);
+	limit = res_counter_read_u64(&mem->res, RES_LIMIT);
+	if (!ratio || limit == RESOURCE_MAX)
+		goto out;
+
+	limit >>= PAGE_SHIFT;
+	if (limit > dirtyable)
+		limit = dirtyable;
+	*thresh = (unsigned long)limit * ratio / 100;
+
+	dirty = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_FILE_DIRTY) +
+		mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_WRITEBACK);
+	*nr_dirty = dirty > 0 ? dirty : 0;
+	ret = true;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /*
  * Unlike exported interface, "oom" parameter is added. if oom==true,
  * oom-killer can be invoked.
  */
+/*
+ * Size of a bulk charge taken from the res_counters when the per-cpu stock
+ * is empty.  Every page charged out of the stock saves a walk up the
+ * hierarchy under each ancestor's res_counter lock.
+ */
+#define CHARGE_SIZE	(64 * PAGE_SIZE)
+
+struct memcg_stock_pcp {
+	struct mem_cgroup *cached;	/* never the root cgroup */
+	int charge;
+	struct work_struct work;
+};
+static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
+static atomic_t memcg_drain_count;
+
+/*
+ * Try to take one page worth of charge from this cpu's stock.  Returns
+ * false if the stock is empty or caches another cgroup.
+ */
+static bool consume_stock(struct mem_cgroup *mem)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = true;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (mem == stock->cached && stock->charge)
+		stock->charge -= PAGE_SIZE;
+	else
+		ret = false;
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
+/*
+ * Return the charge cached in a stock to its res_counters.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	struct mem_cgroup *old = stock->cached;
+
+	if (stock->charge) {
+		res_counter_uncharge(&old->res, stock->charge);
+		if (do_swap_account)
+			res_counter_uncharge(&old->memsw, stock->charge);
+	}
+	stock->cached = NULL;
+	stock->charge = 0;
+}
+
+static void drain_local_stock(struct work_struct *dummy)
+{
+	struct memcg_stock_pcp *stock = &__get_cpu_var(memcg_stock);
+
+	drain_stock(stock);
+}
+
+/*
+ * Cache the charge left over from a bulk charge in this cpu's stock.  A
+ * stock holds charge for one cgroup only; switching drains the old one.
+ */
+static void refill_stock(struct mem_cgroup *mem, int val)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+
+	if (stock->cached != mem) {
+		drain_stock(stock);
+		stock->cached = mem;
+	}
+	stock->charge += val;
+	put_cpu_var(memcg_stock);
+}
+
+/*
+ * Ask every cpu to give its stock back, without waiting.  Used before
+ * reclaim, where charge sitting in other cpus' stocks may be all that
+ * keeps a cgroup over its limit.  One caller at a time is enough.
+ */
+static void drain_all_stock_async(void)
+{
+	int cpu;
+
+	if (atomic_read(&memcg_drain_count))
+		return;
+	atomic_inc(&memcg_drain_count);
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
+		schedule_work_on(cpu, &stock->work);
+	}
+	put_online_cpus();
+	atomic_dec(&memcg_drain_count);
+}
+
+/* Drain every cpu's stock and wait for it; used by force_empty. */
+static void drain_all_stock_sync(void)
+{
+	atomic_inc(&memcg_drain_count);
+	schedule_on_each_cpu(drain_local_stock);
+	atomic_dec(&memcg_drain_count);
+}
+
+static int __cpuinit memcg_stock_cpu_callback(struct notifier_block *nb,
+					unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_stock(&per_cpu(memcg_stock, cpu));
+	return NOTIFY_OK;
+}
+
+/*
+ * How much to charge when the stock is empty.  Only batch while the
+ * cgroup has room for a full stock on every online cpu: a small or nearly
+ * full cgroup would otherwise be pushed into reclaim by charge that is
+ * merely parked in other cpus' stocks.
+ */
+static int mem_cgroup_charge_size(struct mem_cgroup *mem)
+{
+	u64 limit = res_counter_read_u64(&mem->res, RES_LIMIT);
+	u64 usage = res_counter_read_u64(&mem->res, RES_USAGE);
+	u64 batch = (u64)CHARGE_SIZE * num_online_cpus();
+
+	if (usage + batch > limit)
+		return PAGE_SIZE;
+	if (do_swap_account) {
+		limit = res_counter_read_u64(&mem->memsw, RES_LIMIT);
+		usage = res_counter_read_u64(&mem->memsw, RES_USAGE);
+		if (usage + batch > limit)
+			return PAGE_SIZE;
+	}
+	return CHARGE_SIZE;
+}
+
 static int __mem_cgroup_try_charge(struct mm_struct *mm,
 			gfp_t gfp_mask, struct mem_cgroup **memcg,
 			bool oom, struct page *page)
@@ -1275,6 +1623,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 	struct mem_cgroup *mem, *mem_over_limit;
 	int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct res_counter *fail_res;
+	int csize;
 
 	if (unlikely(test_thread_flag(TIF_MEMDIE))) {
 		/* Don't account this! */
@@ -1299,23 +1648,25 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 		return 0;
 
 	VM_BUG_ON(css_is_removed(&mem->css));
+	if (mem_cgroup_is_root(mem))
+		goto done;
+	if (consume_stock(mem))
+		goto charged;
 
+	csize = mem_cgroup_charge_size(mem);
 	while (1) {
 		int ret = 0;
 		unsigned long flags = 0;
 
-		if (mem_cgroup_is_root(mem))
-			goto done;
-		ret = res_counter_charge(&mem->res, PAGE_SIZE, &fail_res);
+		ret = res_counter_charge(&mem->res, csize, &fail_res);
 		if (likely(!ret)) {
 			if (!do_swap_account)
 				break;
-			ret = res_counter_charge(&mem->memsw, PAGE_SIZE,
-							&fail_res);
+			ret = res_counter_charge(&mem->memsw, csize, &fail_res);
 			if (likely(!ret))
 				break;
 			/* mem+swap counter fails */
-			res_counter_uncharge(&mem->res, PAGE_SIZE);
+			res_counter_uncharge(&mem->res, csize);
 			flags |= MEM_CGROUP_RECLAIM_NOSWAP;
 			mem_over_limit = mem_cgroup_from_res_counter(fail_res,
 									memsw);
@@ -1324,9 +1675,15 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 			mem_over_limit = mem_cgroup_from_res_counter(fail_res,
 									res);
 
+		/* An ancestor may be short of room: give up batching first */
+		if (csize > PAGE_SIZE) {
+			csize = PAGE_SIZE;
+			continue;
+		}
 		if (!(gfp_mask & __GFP_WAIT))
 			goto nomem;
 
+		drain_all_stock_async();
 		ret = mem_cgroup_hierarchical_reclaim(mem_over_limit, NULL,
 						gfp_mask, flags);
 		if (ret)
@@ -1353,6 +1710,9 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 			goto nomem;
 		}
 	}
+	if (csize > PAGE_SIZE)
+		refill_stock(mem, csize - PAGE_SIZE);
+charged:
 	/*
 	 * Insert ancestor (and ancestor's ancestors), to softlimit RB-tree.
 	 * if they exceeds softlimit.
@@ -1532,6 +1892,7 @@ static int mem_cgroup_move_account(struct page_cgroup *pc,
 		__mem_cgroup_stat_add_safe(cpustat, MEM_CGROUP_STAT_MAPPED_FILE,
 						1);
 	}
+	mem_cgroup_move_page_stat(pc, from, to);
 
 	if (do_swap_account && !mem_cgroup_is_root(from))
 		res_counter_uncharge(&from->memsw, PAGE_SIZE);
@@ -1889,6 +2250,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	if (ctype == MEM_CGROUP_CHARGE_TYPE_SWAPOUT)
 		mem_cgroup_swap_statistics(mem, true);
 	mem_cgroup_charge_statistics(mem, pc, false);
+	mem_cgroup_move_page_stat(pc, mem, NULL);
 
 	ClearPageCgroupUsed(pc);
 	/*
@@ -2390,6 +2752,8 @@ move_account:
 			goto out;
 		/* This is for making all *used* pages to be on LRU. */
 		lru_add_drain_all();
+		/* Charge parked in per-cpu stocks is not on any LRU. */
+		drain_all_stock_sync();
 		ret = 0;
 		for_each_node_state(node, N_HIGH_MEMORY) {
 			for (zid = 0; !ret && zid < MAX_NR_ZONES; zid++) {
@@ -2665,6 +3029,8 @@ enum {
 	MCS_CACHE,
 	MCS_RSS,
 	MCS_MAPPED_FILE,
+	MCS_FILE_DIRTY,
+	MCS_WRITEBACK,
 	MCS_PGPGIN,
 	MCS_PGPGOUT,
 	MCS_SWAP,
@@ -2687,6 +3053,8 @@ struct {
 	{"cache", "total_cache"},
 	{"rss", "total_rss"},
 	{"mapped_file", "total_mapped_file"},
+	{"dirty", "total_dirty"},
+	{"writeback", "total_writeback"},
 	{"pgpgin", "total_pgpgin"},
 	{"pgpgout", "total_pgpgout"},
 	{"swap", "total_swap"},
@@ -2710,6 +3078,10 @@ static int mem_cgroup_get_local_stat(struct mem_cgroup *mem, void *data)
 	s->stat[MCS_RSS] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_MAPPED_FILE);
 	s->stat[MCS_MAPPED_FILE] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_FILE_DIRTY);
+	s->stat[MCS_FILE_DIRTY] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_WRITEBACK);
+	s->stat[MCS_WRITEBACK] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_PGPGIN_COUNT);
 	s->stat[MCS_PGPGIN] += val;
 	val = mem_cgroup_read_stat(&mem->stat, MEM_CGROUP_STAT_PGPGOUT_COUNT);
@@ -2843,6 +3215,32 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_dirty_ratio_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	return get_dirty_ratio(memcg);
+}
+
+static int mem_cgroup_dirty_ratio_write(struct cgroup *cgrp, struct cftype *cft,
+				       u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	if (val > 100)
+		return -EINVAL;
+
+	/* the root cgroup follows /proc/sys/vm/dirty_ratio */
+	if (cgrp->parent == NULL)
+		return -EINVAL;
+
+	spin_lock(&memcg->reclaim_param_lock);
+	memcg->dirty_ratio = val;
+	spin_unlock(&memcg->reclaim_param_lock);
+
+	return 0;
+}
+
 
 static struct cftype mem_cgroup_files[] = {
 	{
@@ -2892,6 +3290,11 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "dirty_ratio",
+		.read_u64 = mem_cgroup_dirty_ratio_read,
+		.write_u64 = mem_cgroup_dirty_ratio_write,
+	},
 };
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -3089,7 +3492,7 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 {
 	struct mem_cgroup *mem, *parent;
 	long error = -ENOMEM;
-	int node;
+	int node, cpu;
 
 	mem = mem_cgroup_alloc();
 	if (!mem)
@@ -3106,7 +3509,12 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 		root_mem_cgroup = mem;
 		if (mem_cgroup_soft_limit_tree_init())
 			goto free_out;
-
+		for_each_possible_cpu(cpu) {
+			struct memcg_stock_pcp *stock =
+					&per_cpu(memcg_stock, cpu);
+			INIT_WORK(&stock->work, drain_local_stock);
+		}
+		hotcpu_notifier(memcg_stock_cpu_callback, 0);
 	} else {
 		parent = mem_cgroup_from_cont(cont->parent);
 		mem->use_hierarchy = parent->use_hierarchy;
@@ -3129,8 +3537,10 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	spin_lock_init(&mem->reclaim_param_lock);
 
-	if (parent)
+	if (parent) {
 		mem->swappiness = get_swappiness(parent);
+		mem->dirty_ratio = get_dirty_ratio(parent);
+	}
 	atomic_set(&mem->refcnt, 1);
 	return &mem->css;
 free_out:
@@ -108,6 +108,12 @@ static int __init disable_randmaps(char *s)
 }
 __setup("norandmaps", disable_randmaps);
 
+/*
+ * log2 of the number of pages a write fault on private anonymous memory
+ * populates at once, 0 to only map the faulting page.
+ */
+int sysctl_anon_fault_cluster __read_mostly;
+
 unsigned long zero_pfn __read_mostly;
 unsigned long highest_memmap_pfn __read_mostly;
 
@@ -281,12 +287,18 @@ void free_pgd_range(struct mmu_gather *tlb,
 
 	start = addr;
 	pgd = pgd_offset(tlb->mm, addr);
+	/*
+	 * Let a paravirt backend batch up the release of the page table
+	 * pages: the mmu_gather keeps us on this cpu throughout.
+	 */
+	arch_enter_lazy_mmu_mode();
 	do {
 		next = pgd_addr_end(addr, end);
 		if (pgd_none_or_clear_bad(pgd))
 			continue;
 		free_pud_range(tlb, pgd, addr, next, floor, ceiling);
 	} while (pgd++, addr = next, addr != end);
+	arch_leave_lazy_mmu_mode();
 }
 
 void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *vma,
@@ -1067,19 +1079,24 @@ unsigned long unmap_vmas(struct mmu_gather **tlbp,
 				break;
 			}
 
-			tlb_finish_mmu(*tlbp, tlb_start, start);
-
+			/*
+			 * Only finish the mmu_gather when we have to break
+			 * out: a large unmap otherwise pays for a TLB flush
+			 * every ZAP_BLOCK_SIZE, which is expensive when every
+			 * flush is a hypercall.  The gather still flushes
+			 * itself whenever its page array fills up.
+			 */
 			if (need_resched() ||
 				(i_mmap_lock && spin_needbreak(i_mmap_lock))) {
+				tlb_finish_mmu(*tlbp, tlb_start, start);
 				if (i_mmap_lock) {
 					*tlbp = NULL;
 					goto out;
 				}
 				cond_resched();
+				*tlbp = tlb_gather_mmu(vma->vm_mm, fullmm);
+				tlb_start_valid = 0;
 			}
-
-			*tlbp = tlb_gather_mmu(vma->vm_mm, fullmm);
-			tlb_start_valid = 0;
 			zap_work = ZAP_BLOCK_SIZE;
 		}
 	}
@@ -2703,6 +2720,88 @@ static inline int check_stack_guard_page(struct vm_area_struct *vma, unsigned lo
 	return 0;
 }
 
+/*
+ * Write fault on anonymous memory with sysctl_anon_fault_cluster set:
+ * map the whole naturally aligned cluster around the faulting address,
+ * so that a region being filled in takes one fault (one trap and, under
+ * a paravirtualized MMU, one batch of page table updates) per cluster
+ * rather than per page.  Only the faulting page is required; the others
+ * are allocated without retrying reclaim and simply skipped if that or
+ * the memcg charge fails, or if their pte got populated meanwhile.
+ *
+ * Same locking as do_anonymous_page(), anon_vma already prepared.
+ */
+static int do_anonymous_cluster(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address, pmd_t *pmd)
+{
+	struct page *pages[1 << ANON_FAULT_CLUSTER_MAX];
+	unsigned long size, start, end, addr;
+	spinlock_t *ptl;
+	pte_t *pte;
+	int i, nr, ret = 0;
+
+	size = PAGE_SIZE << min(sysctl_anon_fault_cluster,
+				ANON_FAULT_CLUSTER_MAX);
+	start = max(address & ~(size - 1), vma->vm_start);
+	end = min((address & ~(size - 1)) + size, vma->vm_end);
+	nr = (end - start) >> PAGE_SHIFT;
+
+	for (i = 0, addr = start; i < nr; i++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (addr == (address & PAGE_MASK))
+			page = alloc_zeroed_user_highpage_movable(vma, addr);
+		else
+			page = __alloc_zeroed_user_highpage(__GFP_MOVABLE |
+					__GFP_NORETRY | __GFP_NOWARN, vma, addr);
+		if (page && mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			page = NULL;
+		}
+		if (!page && addr == (address & PAGE_MASK)) {
+			ret = VM_FAULT_OOM;
+			nr = i;
+			goto release;
+		}
+		if (page)
+			__SetPageUptodate(page);
+		pages[i] = page;
+	}
+
+	pte = pte_offset_map_lock(mm, pmd, start, &ptl);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0, addr = start; i < nr; i++, addr += PAGE_SIZE) {
+		struct page *page = pages[i];
+		pte_t entry;
+
+		if (!page || !pte_none(pte[i]))
+			continue;
+
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+
+		inc_mm_counter(mm, anon_rss);
+		page_add_new_anon_rmap(page, vma, addr);
+		set_pte_at(mm, addr, pte + i, entry);
+
+		/* No need to invalidate - it was non-present before */
+		update_mmu_cache(vma, addr, entry);
+		pages[i] = NULL;
+	}
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(pte, ptl);
+
+release:
+	for (i = 0; i < nr; i++) {
+		if (!pages[i])
+			continue;
+		mem_cgroup_uncharge_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	return ret;
+}
+
 /*
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
@@ -2735,6 +2834,9 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* Allocate our own private page. */
 	if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
+	if (sysctl_anon_fault_cluster &&
+	    !(vma->vm_flags & (VM_GROWSDOWN | VM_GROWSUP)))
+		return do_anonymous_cluster(mm, vma, address, pmd);
 	page = alloc_zeroed_user_highpage_movable(vma, address);
 	if (!page)
 		goto oom;
@@ -3103,6 +3205,254 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults.
+ *
+ * Installing the first page of a private anonymous mapping only needs
+ * the vma to stay what it was while the pte is set, and the vma's
+ * sequence count can tell us that without mmap_sem: sample it, do the
+ * work, and check it again under the pte lock before committing.  Every
+ * writer that matters to us bumps the count before it takes the pte
+ * locks for the range.  vmas are freed by RCU, and unmap_region waits
+ * for any speculative fault that may be walking the page tables before
+ * freeing them: see wait_speculative_faults().  Anything unusual is
+ * left to the regular path under mmap_sem.
+ */
+
+/* A walk deeper than this means we raced with a rebalance */
+#define SPF_MAX_DEPTH	64
+
+static int spf_begin(struct mm_struct *mm)
+{
+	int idx;
+
+	preempt_disable();
+	rcu_read_lock();
+	idx = ACCESS_ONCE(mm->spf_idx) & 1;
+	atomic_inc(&mm->spf_inflight[idx]);
+	smp_mb__after_atomic_inc();
+	return idx;
+}
+
+static void spf_end(struct mm_struct *mm, int idx)
+{
+	smp_mb__before_atomic_dec();
+	atomic_dec(&mm->spf_inflight[idx]);
+	rcu_read_unlock();
+	preempt_enable();
+}
+
+/*
+ * Called with mmap_sem held for writing, after the vmas being unmapped
+ * have been detached (which leaves their sequence counts odd) and before
+ * their page tables are freed.  A speculative fault which increments the
+ * old slot after we have seen it drain must see those counts odd, and
+ * backs off before touching the page tables.
+ */
+void wait_speculative_faults(struct mm_struct *mm)
+{
+	int idx = mm->spf_idx & 1;
+
+	smp_mb();
+	mm->spf_idx = idx ^ 1;
+	smp_mb();
+	while (atomic_read(&mm->spf_inflight[idx]))
+		cpu_relax();
+}
+
+/*
+ * Look up the vma containing @address without mmap_sem.  The result is
+ * only good once its own sequence count has been sampled and rechecked.
+ */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long address)
+{
+	struct vm_area_struct *vma = NULL;
+	struct rb_node *rb_node;
+	unsigned seq;
+	int depth = 0;
+
+	seq = ACCESS_ONCE(mm->mm_rb_seq.sequence);
+	smp_rmb();
+	if (seq & 1)
+		return NULL;
+
+	rb_node = ACCESS_ONCE(mm->mm_rb.rb_node);
+	while (rb_node) {
+		struct vm_area_struct *tmp;
+
+		if (++depth > SPF_MAX_DEPTH)
+			return NULL;
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (tmp->vm_end > address) {
+			vma = tmp;
+			if (tmp->vm_start <= address)
+				break;
+			rb_node = ACCESS_ONCE(rb_node->rb_left);
+		} else
+			rb_node = ACCESS_ONCE(rb_node->rb_right);
+	}
+
+	if (read_seqcount_retry(&mm->mm_rb_seq, seq))
+		return NULL;
+	return vma;
+}
+
+/*
+ * Sample @vma's sequence count into *@seqp and check that this is a
+ * fault we know how to handle: a not-present pte in a private anonymous
+ * vma whose page tables already exist.  Returns the pmd to install the
+ * pte under, or NULL to fall back.
+ */
+static pmd_t *spf_prepare(struct mm_struct *mm, struct vm_area_struct *vma,
+			  unsigned long address, unsigned int flags,
+			  unsigned *seqp)
+{
+	unsigned long vm_flags;
+	unsigned seq;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if (seq & 1)
+		return NULL;
+
+	vm_flags = ACCESS_ONCE(vma->vm_flags);
+	if (vma->vm_mm != mm || address < vma->vm_start ||
+	    address >= vma->vm_end)
+		return NULL;
+	if (vma->vm_ops || vma->vm_file || !vma->anon_vma)
+		return NULL;
+	if (vm_flags & (VM_SHARED | VM_GROWSDOWN | VM_GROWSUP | VM_HUGETLB |
+			VM_IO | VM_PFNMAP | VM_MIXEDMAP | VM_NONLINEAR))
+		return NULL;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vm_flags & VM_WRITE))
+			return NULL;
+	} else if (!(vm_flags & (VM_READ | VM_WRITE)))
+		return NULL;
+#ifdef CONFIG_NUMA
+	/* The page is allocated by task policy, see handle_speculative_fault */
+	if (vma->vm_policy)
+		return NULL;
+#endif
+
+	/* Page tables are never allocated here */
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	if (pmd_none(pmdval) || unlikely(pmd_bad(pmdval)))
+		return NULL;
+	pte = pte_offset_map(pmd, address);
+	entry = *pte;
+	pte_unmap(pte);
+	if (!pte_none(entry))
+		return NULL;
+
+	*seqp = seq;
+	return pmd;
+}
+
+/**
+ * handle_speculative_fault - try to resolve a user fault without mmap_sem
+ * @mm: the faulting mm, which must be current->mm
+ * @address: the faulting address
+ * @flags: FAULT_FLAG_WRITE for a write fault
+ *
+ * Handles the first touch of a private anonymous page whose page tables
+ * are already populated, in the manner of do_anonymous_page().  Returns
+ * 1 if the fault was resolved, or 0 if the caller must take mmap_sem
+ * and go through handle_mm_fault() as usual; a refused fault has no
+ * side effects, so the regular path will report any error.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	pmd_t *pmd;
+	unsigned seq;
+	int idx, ret = 0;
+
+	/* Find out if the fault is ours before allocating anything */
+	idx = spf_begin(mm);
+	vma = spf_find_vma(mm, address);
+	pmd = vma ? spf_prepare(mm, vma, address, flags, &seq) : NULL;
+	spf_end(mm, idx);
+	if (!pmd)
+		return 0;
+
+	if (flags & FAULT_FLAG_WRITE) {
+		/*
+		 * The vma cannot be used outside the critical section, so
+		 * allocate to the task's policy: spf_prepare() refused vmas
+		 * with a policy of their own.
+		 */
+		page = alloc_zeroed_user_highpage_movable(NULL, address);
+		if (!page)
+			return 0;
+		__SetPageUptodate(page);
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return 0;
+		}
+	}
+
+	/* Anything may have changed meanwhile: start again, for real */
+	idx = spf_begin(mm);
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto out;
+	pmd = spf_prepare(mm, vma, address, flags, &seq);
+	if (!pmd)
+		goto out;
+
+	if (page) {
+		entry = mk_pte(page, vma->vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	} else
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      vma->vm_page_prot));
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_none(*pte) || read_seqcount_retry(&vma->vm_sequence, seq))
+		goto unlock;
+
+	if (page) {
+		inc_mm_counter(mm, anon_rss);
+		page_add_new_anon_rmap(page, vma, address);
+		page = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+	ret = 1;
+unlock:
+	pte_unmap_unlock(pte, ptl);
+out:
+	spf_end(mm, idx);
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+	if (ret)
+		count_vm_event(PGFAULT);
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
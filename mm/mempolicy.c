@@ -560,7 +560,9 @@ static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 		err = vma->vm_ops->set_policy(vma, new);
 	if (!err) {
 		mpol_get(new);
+		vma_write_begin(vma);
 		vma->vm_policy = new;
+		vma_write_end(vma);
 		mpol_put(old);
 	}
 	return err;
@@ -328,7 +328,9 @@ void munlock_vma_pages_range(struct vm_area_struct *vma,
 	unsigned long addr;
 
 	lru_add_drain();
+	vma_write_begin(vma);
 	vma->vm_flags &= ~VM_LOCKED;
+	vma_write_end(vma);
 
 	for (addr = start; addr < end; addr += PAGE_SIZE) {
 		struct page *page;
@@ -423,7 +425,9 @@ success:
 	 */
 
 	if (lock) {
+		vma_write_begin(vma);
 		vma->vm_flags = newflags;
+		vma_write_end(vma);
 		ret = __mlock_vma_pages_range(vma, start, end);
 		if (ret < 0)
 			ret = __mlock_posix_error_return(ret);
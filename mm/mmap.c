@@ -120,7 +120,7 @@ int __vm_enough_memory(struct mm_struct *mm, long pages, int cap_sys_admin)
 		unsigned long n;
 
 		free = global_page_state(NR_FILE_PAGES);
-		free += nr_swap_pages;
+		free += get_nr_swap_pages();
 
 		/*
 		 * Any slabs which are created with the
@@ -223,6 +223,28 @@ void unlink_file_vma(struct vm_area_struct *vma)
 	}
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void free_vma_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(vm_area_cachep,
+			container_of(head, struct vm_area_struct, vm_rcu));
+}
+
+/*
+ * handle_speculative_fault() may still be looking at a vma which was
+ * in the rbtree, so defer the free until it has backed off.
+ */
+static void free_vma(struct vm_area_struct *vma)
+{
+	call_rcu(&vma->vm_rcu, free_vma_rcu);
+}
+#else
+static inline void free_vma(struct vm_area_struct *vma)
+{
+	kmem_cache_free(vm_area_cachep, vma);
+}
+#endif
+
 /*
  * Close a vm structure and free it, returning the next.
  */
@@ -239,7 +261,7 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 			removed_exe_file_vma(vma->vm_mm);
 	}
 	mpol_put(vma_policy(vma));
-	kmem_cache_free(vm_area_cachep, vma);
+	free_vma(vma);
 	return next;
 }
 
@@ -411,8 +433,10 @@ __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma,
 void __vma_link_rb(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct rb_node **rb_link, struct rb_node *rb_parent)
 {
+	mm_rb_write_begin(mm);
 	rb_link_node(&vma->vm_rb, rb_parent, rb_link);
 	rb_insert_color(&vma->vm_rb, &mm->mm_rb);
+	mm_rb_write_end(mm);
 }
 
 static void __vma_link_file(struct vm_area_struct *vma)
@@ -498,7 +522,9 @@ __vma_unlink(struct mm_struct *mm, struct vm_area_struct *vma,
 	prev->vm_next = next;
 	if (next)
 		next->vm_prev = prev;
+	mm_rb_write_begin(mm);
 	rb_erase(&vma->vm_rb, &mm->mm_rb);
+	mm_rb_write_end(mm);
 	if (mm->mmap_cache == vma)
 		mm->mmap_cache = prev;
 }
@@ -523,6 +549,7 @@ void vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	long adjust_next = 0;
 	int remove_next = 0;
 
+	vma_write_begin(vma);
 	if (next && !insert) {
 		if (end >= next->vm_end) {
 			/*
@@ -552,6 +579,9 @@ again:			remove_next = 1 + (end > next->vm_end);
 			importer = next;
 		}
 	}
+	/* A removed next is left odd: it is about to be freed */
+	if (remove_next || adjust_next)
+		vma_write_begin(next);
 
 	if (file) {
 		mapping = file->f_mapping;
@@ -651,7 +681,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 		}
 		mm->map_count--;
 		mpol_put(vma_policy(next));
-		kmem_cache_free(vm_area_cachep, next);
+		free_vma(next);
 		/*
 		 * In mprotect's case 6 (see comments on vma_merge),
 		 * we must remove another next too. It would clutter
@@ -662,6 +692,9 @@ again:			remove_next = 1 + (end > next->vm_end);
 			goto again;
 		}
 	}
+	if (adjust_next)
+		vma_write_end(next);
+	vma_write_end(vma);
 
 	validate_mm(mm);
 }
@@ -1793,6 +1826,7 @@ static void unmap_region(struct mm_struct *mm,
 	update_hiwater_rss(mm);
 	unmap_vmas(&tlb, vma, start, end, &nr_accounted, NULL);
 	vm_unacct_memory(nr_accounted);
+	wait_speculative_faults(mm);
 	free_pgtables(tlb, vma, prev? prev->vm_end: FIRST_USER_ADDRESS,
 				 next? next->vm_start: 0);
 	tlb_finish_mmu(tlb, start, end);
@@ -1812,12 +1846,16 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 	vma->vm_prev = NULL;
+	mm_rb_write_begin(mm);
 	do {
+		/* Left odd, so that speculative faults on it back off */
+		vma_write_begin(vma);
 		rb_erase(&vma->vm_rb, &mm->mm_rb);
 		mm->map_count--;
 		tail_vma = vma;
 		vma = vma->vm_next;
 	} while (vma && vma->vm_start < end);
+	mm_rb_write_end(mm);
 	*insertion_point = vma;
 	if (vma)
 		vma->vm_prev = prev;
@@ -193,8 +193,10 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 success:
 	/*
 	 * vm_flags and vm_page_prot are protected by the mmap_sem
-	 * held in write mode.
+	 * held in write mode; the vma sequence count tells a speculative
+	 * fault that they changed under it.
 	 */
+	vma_write_begin(vma);
 	vma->vm_flags = newflags;
 	vma->vm_page_prot = pgprot_modify(vma->vm_page_prot,
 					  vm_get_page_prot(newflags));
@@ -210,6 +212,7 @@ success:
 	else
 		change_protection(vma, start, end, vma->vm_page_prot, dirty_accountable);
 	mmu_notifier_invalidate_range_end(mm, start, end);
+	vma_write_end(vma);
 	vm_stat_account(mm, oldflags, vma->vm_file, -nrpages);
 	vm_stat_account(mm, newflags, vma->vm_file, nrpages);
 	perf_event_mmap(vma);
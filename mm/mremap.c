@@ -199,7 +199,10 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/* Keep speculative faults from repopulating the old range */
+	vma_write_begin(vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len);
+	vma_write_end(vma);
 	if (moved_len < old_len) {
 		/*
 		 * On error, move entries back from new area to old,
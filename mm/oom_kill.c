@@ -91,9 +91,10 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 	}
 
 	/*
-	 * The memory size of the process is the basis for the badness.
+	 * The memory the process actually holds is the basis for the
+	 * badness: a large but sparse address space frees little.
 	 */
-	points = mm->total_vm;
+	points = get_mm_rss(mm);
 
 	/*
 	 * After this unlock we can no longer dereference local variable `mm'
@@ -108,7 +109,7 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 
 	/*
 	 * Processes which fork a lot of child processes are likely
-	 * a good choice. We add half the vmsize of the children if they
+	 * a good choice. We add half the rss of the children if they
 	 * have an own mm. This prevents forking servers to flood the
 	 * machine with an endless amount of children. In case a single
 	 * child is eating the vast majority of memory, adding only half
@@ -117,7 +118,7 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 	list_for_each_entry(child, &p->children, sibling) {
 		task_lock(child);
 		if (child->mm != mm && child->mm)
-			points += child->mm->total_vm/2 + 1;
+			points += get_mm_rss(child->mm)/2 + 1;
 		task_unlock(child);
 	}
 
@@ -218,77 +219,101 @@ static inline enum oom_constraint constrained_alloc(struct zonelist *zonelist,
 	return CONSTRAINT_NONE;
 }
 
+struct oom_scan {
+	struct task_struct *chosen;
+	unsigned long points;
+	unsigned long uptime;
+};
+
+/*
+ * Weigh @p as a victim.  Returns nonzero if no victim should be chosen
+ * at all, because a task is already on its way out.
+ */
+static int oom_evaluate_task(struct task_struct *p, void *data)
+{
+	struct oom_scan *scan = data;
+	unsigned long points;
+
+	/*
+	 * skip kernel threads and tasks which have already released
+	 * their mm.
+	 */
+	if (!p->mm)
+		return 0;
+	/* skip the init task */
+	if (is_global_init(p))
+		return 0;
+
+	/*
+	 * This task already has access to memory reserves and is
+	 * being killed. Don't allow any other task access to the
+	 * memory reserve.
+	 *
+	 * Note: this may have a chance of deadlock if it gets
+	 * blocked waiting for another task which itself is waiting
+	 * for memory. Is there a better alternative?
+	 */
+	if (test_tsk_thread_flag(p, TIF_MEMDIE))
+		return 1;
+
+	/*
+	 * This is in the process of releasing memory so wait for it
+	 * to finish before killing some other task by mistake.
+	 *
+	 * However, if p is the current task, we allow the 'kill' to
+	 * go ahead if it is exiting: this will simply set TIF_MEMDIE,
+	 * which will allow it to gain access to memory reserves in
+	 * the process of exiting and releasing its resources.
+	 * Otherwise we could get an easy OOM deadlock.
+	 */
+	if (p->flags & PF_EXITING) {
+		if (p != current)
+			return 1;
+
+		scan->chosen = p;
+		scan->points = ULONG_MAX;
+	}
+
+	if (p->signal->oom_adj == OOM_DISABLE)
+		return 0;
+
+	points = badness(p, scan->uptime);
+	if (points > scan->points || !scan->chosen) {
+		scan->chosen = p;
+		scan->points = points;
+	}
+	return 0;
+}
+
 /*
  * Simple selection loop. We chose the process with the highest
  * number of 'points'. We expect the caller will lock the tasklist.
  *
+ * A memory cgroup OOM only looks at the tasks charging that cgroup
+ * rather than walking every process in the system.
+ *
  * (not docbooked, we don't want this one cluttering up the manual)
  */
 static struct task_struct *select_bad_process(unsigned long *ppoints,
 						struct mem_cgroup *mem)
 {
 	struct task_struct *p;
-	struct task_struct *chosen = NULL;
 	struct timespec uptime;
-	*ppoints = 0;
+	struct oom_scan scan = { .chosen = NULL, .points = 0 };
 
 	do_posix_clock_monotonic_gettime(&uptime);
-	for_each_process(p) {
-		unsigned long points;
-
-		/*
-		 * skip kernel threads and tasks which have already released
-		 * their mm.
-		 */
-		if (!p->mm)
-			continue;
-		/* skip the init task */
-		if (is_global_init(p))
-			continue;
-		if (mem && !task_in_mem_cgroup(p, mem))
-			continue;
-
-		/*
-		 * This task already has access to memory reserves and is
-		 * being killed. Don't allow any other task access to the
-		 * memory reserve.
-		 *
-		 * Note: this may have a chance of deadlock if it gets
-		 * blocked waiting for another task which itself is waiting
-		 * for memory. Is there a better alternative?
-		 */
-		if (test_tsk_thread_flag(p, TIF_MEMDIE))
+	scan.uptime = uptime.tv_sec;
+	if (mem) {
+		if (mem_cgroup_scan_tasks(mem, oom_evaluate_task, &scan))
 			return ERR_PTR(-1UL);
-
-		/*
-		 * This is in the process of releasing memory so wait for it
-		 * to finish before killing some other task by mistake.
-		 *
-		 * However, if p is the current task, we allow the 'kill' to
-		 * go ahead if it is exiting: this will simply set TIF_MEMDIE,
-		 * which will allow it to gain access to memory reserves in
-		 * the process of exiting and releasing its resources.
-		 * Otherwise we could get an easy OOM deadlock.
-		 */
-		if (p->flags & PF_EXITING) {
-			if (p != current)
+	} else {
+		for_each_process(p)
+			if (oom_evaluate_task(p, &scan))
 				return ERR_PTR(-1UL);
-
-			chosen = p;
-			*ppoints = ULONG_MAX;
-		}
-
-		if (p->signal->oom_adj == OOM_DISABLE)
-			continue;
-
-		points = badness(p, uptime.tv_sec);
-		if (points > *ppoints || !chosen) {
-			chosen = p;
-			*ppoints = points;
-		}
 	}
 
-	return chosen;
+	*ppoints = scan.points;
+	return scan.chosen;
 }
 
 /**
@@ -34,6 +34,7 @@
 #include <linux/syscalls.h>
 #include <linux/buffer_head.h>
 #include <linux/pagevec.h>
+#include <linux/memcontrol.h>
 
 /*
  * After a CPU has dirtied this many pages, balance_dirty_pages_ratelimited
@@ -480,6 +481,45 @@ get_dirty_limits(unsigned long *pbackground, unsigned long *pdirty,
  * If we're over `background_thresh' then the writeback threads are woken to
  * perform some writeout.
  */
+/*
+ * A memory cgroup can be over its own dirty limit while the system as a
+ * whole is not, and its dirty pages then stall reclaim for everyone else
+ * in it.  Throttle its dirtier the way balance_dirty_pages does: write
+ * back a chunk of this bdi and pause, until the cgroup is back under its
+ * limit or we have written our share.
+ */
+static void balance_dirty_pages_memcg(struct backing_dev_info *bdi,
+				      unsigned long write_chunk)
+{
+	unsigned long thresh, nr_dirty;
+	unsigned long pages_written = 0;
+	unsigned long pause = 1;
+
+	while (mem_cgroup_dirty_info(determine_dirtyable_memory(),
+				     &thresh, &nr_dirty) &&
+	       nr_dirty > thresh) {
+		struct writeback_control wbc = {
+			.bdi		= bdi,
+			.sync_mode	= WB_SYNC_NONE,
+			.older_than_this = NULL,
+			.nr_to_write	= write_chunk,
+			.range_cyclic	= 1,
+		};
+
+		writeback_inodes_wbc(&wbc);
+		pages_written += write_chunk - wbc.nr_to_write;
+		if (pages_written >= write_chunk)
+			break;		/* We've done our duty */
+
+		__set_current_state(TASK_INTERRUPTIBLE);
+		io_schedule_timeout(pause);
+
+		pause <<= 1;
+		if (pause > HZ / 10)
+			pause = HZ / 10;
+	}
+}
+
 static void balance_dirty_pages(struct address_space *mapping,
 				unsigned long write_chunk)
 {
@@ -493,6 +533,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 
+	balance_dirty_pages_memcg(bdi, write_chunk);
+
 	for (;;) {
 		struct writeback_control wbc = {
 			.bdi		= bdi,
@@ -1024,14 +1066,17 @@ EXPORT_SYMBOL(generic_writepages);
 
 int do_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
+	struct blk_plug plug;
 	int ret;
 
 	if (wbc->nr_to_write <= 0)
 		return 0;
+	blk_start_plug(&plug);
 	if (mapping->a_ops->writepages)
 		ret = mapping->a_ops->writepages(mapping, wbc);
 	else
 		ret = generic_writepages(mapping, wbc);
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -1093,6 +1138,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 	if (mapping_cap_account_dirty(mapping)) {
 		__inc_zone_page_state(page, NR_FILE_DIRTY);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
+		mem_cgroup_update_page_stat(page, MEMCG_NR_FILE_DIRTY, true);
 		task_dirty_inc(current);
 		task_io_account_write(PAGE_CACHE_SIZE);
 	}
@@ -1269,6 +1315,8 @@ int clear_page_dirty_for_io(struct page *page)
 			dec_zone_page_state(page, NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
+			mem_cgroup_update_page_stat(page, MEMCG_NR_FILE_DIRTY,
+						    false);
 			return 1;
 		}
 		return 0;
@@ -1295,6 +1343,8 @@ int test_clear_page_writeback(struct page *page)
 			if (bdi_cap_account_writeback(bdi)) {
 				__dec_bdi_stat(bdi, BDI_WRITEBACK);
 				__bdi_writeout_inc(bdi);
+				mem_cgroup_update_page_stat(page,
+						MEMCG_NR_WRITEBACK, false);
 			}
 		}
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
@@ -1321,8 +1371,11 @@ int test_set_page_writeback(struct page *page)
 			radix_tree_tag_set(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
-			if (bdi_cap_account_writeback(bdi))
+			if (bdi_cap_account_writeback(bdi)) {
 				__inc_bdi_stat(bdi, BDI_WRITEBACK);
+				mem_cgroup_update_page_stat(page,
+						MEMCG_NR_WRITEBACK, true);
+			}
 		}
 		if (!PageDirty(page))
 			radix_tree_tag_clear(&mapping->page_tree,
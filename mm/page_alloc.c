@@ -48,6 +48,7 @@
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
 #include <linux/kmemleak.h>
+#include <linux/compaction.h>
 #include <trace/events/kmem.h>
 
 #include <asm/tlbflush.h>
@@ -1004,6 +1005,57 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 }
 #endif
 
+/*
+ * Bound on the per-cpu batch scaling.  A cpu that keeps refilling or
+ * flushing its pagelist (a NIC allocating receive buffers on one cpu and
+ * completions freeing them on another) moves up to 4 batches per trip
+ * under zone->lock instead of one.
+ */
+#define PCP_MAX_FACTOR	2
+
+static inline int pcp_high(struct per_cpu_pages *pcp)
+{
+	return pcp->high << pcp->alloc_factor;
+}
+
+/*
+ * Number of pages to refill an empty pagelist with.  Each refill scales
+ * the next one up, as long as the zone has the pages to spare.
+ */
+static int pcp_refill_batch(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	int batch = pcp->batch << pcp->alloc_factor;
+
+	if (pcp->alloc_factor < PCP_MAX_FACTOR &&
+	    zone_page_state(zone, NR_FREE_PAGES) >
+			high_wmark_pages(zone) + (pcp->high << PCP_MAX_FACTOR))
+		pcp->alloc_factor++;
+	return batch;
+}
+
+/*
+ * Called once a second for each pageset by refresh_cpu_vm_stats(): let
+ * the batch scaling of a cpu that has quietened down fall back a step,
+ * and return whatever the pagelist holds above its new high mark.
+ */
+void decay_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+	int to_drain;
+
+	local_irq_save(flags);
+	if (pcp->alloc_factor)
+		pcp->alloc_factor--;
+	if (pcp->free_factor)
+		pcp->free_factor--;
+	to_drain = pcp->count - pcp_high(pcp);
+	if (to_drain > 0) {
+		free_pcppages_bulk(zone, to_drain, pcp);
+		pcp->count -= to_drain;
+	}
+	local_irq_restore(flags);
+}
+
 /*
  * Drain pages of the indicated processor.
  *
@@ -1142,9 +1194,13 @@ static void free_hot_cold_page(struct page *page, int cold)
 	else
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
+	if (pcp->count >= pcp_high(pcp)) {
+		int to_free = min(pcp->count, pcp->batch << pcp->free_factor);
+
+		free_pcppages_bulk(zone, to_free, pcp);
+		pcp->count -= to_free;
+		if (pcp->free_factor < PCP_MAX_FACTOR)
+			pcp->free_factor++;
 	}
 
 out:
@@ -1186,6 +1242,51 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free. As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * As this is called with interrupts disabled, the caller is responsible
+ * for calling arch_alloc_page() and kernel_map_page() after interrupts
+ * are enabled.
+ *
+ * Note: this is probably too low level an operation for use in drivers.
+ * Please consult with lkml before using this in your driver.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = low_wmark_pages(zone) + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1212,7 +1313,7 @@ again:
 		local_irq_save(flags);
 		if (list_empty(list)) {
 			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
+					pcp_refill_batch(zone, pcp), list,
 					migratetype, cold);
 			if (unlikely(list_empty(list)))
 				goto failed;
@@ -1686,6 +1787,61 @@ out:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype)
+{
+	struct page *page;
+	unsigned long compact_result;
+
+	if (!order)
+		return NULL;
+
+	current->flags |= PF_MEMALLOC;
+	compact_result = try_to_compact_pages(zonelist, order, gfp_mask,
+						nodemask);
+	current->flags &= ~PF_MEMALLOC;
+	if (compact_result == COMPACT_SKIPPED)
+		return NULL;
+
+	/* Page migration frees to the PCP lists but we want merging */
+	drain_pages(get_cpu());
+	put_cpu();
+
+	page = get_page_from_freelist(gfp_mask, nodemask,
+			order, zonelist, high_zoneidx,
+			alloc_flags, preferred_zone,
+			migratetype);
+	if (page) {
+		count_vm_event(COMPACTSUCCESS);
+		return page;
+	}
+
+	/*
+	 * It's bad if compaction run occurs and fails.
+	 * The most likely reason is that pages exist,
+	 * but not enough to satisfy watermarks.
+	 */
+	count_vm_event(COMPACTFAIL);
+	cond_resched();
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /* The really slow allocator path where we enter direct reclaim */
 static inline struct page *
 __alloc_pages_direct_reclaim(gfp_t gfp_mask, unsigned int order,
@@ -1884,6 +2040,18 @@ rebalance:
 	if (test_thread_flag(TIF_MEMDIE) && !(gfp_mask & __GFP_NOFAIL))
 		goto nopage;
 
+	/*
+	 * Try direct compaction: moving pages around rather than freeing
+	 * them keeps the caches reclaim would throw away.
+	 */
+	page = __alloc_pages_direct_compact(gfp_mask, order,
+					zonelist, high_zoneidx,
+					nodemask,
+					alloc_flags, preferred_zone,
+					migratetype);
+	if (page)
+		goto got_pg;
+
 	/* Try direct reclaim and then allocating */
 	page = __alloc_pages_direct_reclaim(gfp_mask, order,
 					zonelist, high_zoneidx,
@@ -3811,6 +3979,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+	init_waitqueue_head(&pgdat->pfmemalloc_wait);
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
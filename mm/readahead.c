@@ -108,9 +108,12 @@ EXPORT_SYMBOL(read_cache_pages);
 static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
+	struct blk_plug plug;
 	unsigned page_idx;
 	int ret;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		/* Clean up the remaining pages */
@@ -129,6 +132,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	ret = 0;
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -382,6 +386,52 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * stride based read-ahead
+ *
+ * A reader that misses every @stride pages (a column of fixed-size records,
+ * a B-tree leaf scan, ...) leaves no history pages behind and looks random.
+ * Once two misses in a row are the same distance apart, read the current
+ * request and the ones at the next strides, as many as fit in the window.
+ * stride_prev then points at the last of them, so the miss that follows
+ * it continues the pattern.
+ */
+static unsigned long try_stride_readahead(struct address_space *mapping,
+					  struct file_ra_state *ra,
+					  struct file *filp,
+					  pgoff_t offset,
+					  unsigned long req_size,
+					  unsigned long max)
+{
+	pgoff_t prev = ra->stride_prev;
+	unsigned long stride, nr, i;
+	unsigned long actual = 0;
+
+	ra->stride_prev = offset;
+	if (offset <= prev)
+		goto reset;
+	stride = offset - prev;
+	if (stride <= req_size)
+		goto reset;
+	if (stride != ra->stride) {
+		ra->stride = stride;
+		return 0;
+	}
+
+	nr = max / req_size;
+	if (nr < 2)
+		return 0;
+	for (i = 0; i < nr; i++)
+		actual += __do_page_cache_readahead(mapping, filp,
+					offset + i * stride, req_size, 0);
+	ra->stride_prev = offset + (nr - 1) * stride;
+	return actual;
+
+reset:
+	ra->stride = 0;
+	return 0;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -392,6 +442,7 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long actual;
 
 	/*
 	 * start of file
@@ -454,6 +505,14 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	/*
+	 * Misses spaced by a constant stride: read the next strides too.
+	 * This leaves the sequential readahead state alone.
+	 */
+	actual = try_stride_readahead(mapping, ra, filp, offset, req_size, max);
+	if (actual)
+		return actual;
+
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
@@ -28,6 +28,7 @@
 #include <linux/memory.h>
 #include <linux/math64.h>
 #include <linux/fault-inject.h>
+#include <linux/uaccess.h>
 
 /*
  * Lock order:
@@ -1460,6 +1461,69 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 	}
 }
 
+/*
+ * Per cpu partial slabs.
+ *
+ * A slab that gets its first free object back is not put on the node
+ * partial list but kept frozen on the partial list of the freeing cpu,
+ * which takes it as its next cpu slab without touching n->list_lock.
+ * Frees to it from elsewhere only take the slab lock, as for any frozen
+ * slab.  Once a cpu holds more than s->cpu_partial of them they all go
+ * back to the node lists.
+ *
+ * Interrupts are disabled.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page, *next;
+
+	if (!c->nr_partial)
+		return;
+
+	stat(c, CPU_PARTIAL_DRAIN);
+	list_for_each_entry_safe(page, next, &c->partial, lru) {
+		list_del(&page->lru);
+		slab_lock(page);
+		unfreeze_slab(s, page, 1);
+	}
+	c->nr_partial = 0;
+}
+
+/*
+ * Called with the slab lock held for a slab that just got its first
+ * free object back.  Returns false if the slab should go to the node
+ * partial list instead.
+ */
+static int put_cpu_partial(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			   struct page *page)
+{
+	if (!s->cpu_partial || (SLABDEBUG && PageSlubDebug(page)))
+		return 0;
+
+	__SetPageSlubFrozen(page);
+	list_add(&page->lru, &c->partial);
+	c->nr_partial++;
+	stat(c, CPU_PARTIAL_FREE);
+	return 1;
+}
+
+static struct page *get_cpu_partial(struct kmem_cache_cpu *c, int node)
+{
+	struct page *page;
+
+	if (!c->nr_partial)
+		return NULL;
+
+	page = list_first_entry(&c->partial, struct page, lru);
+	if (node != -1 && page_to_nid(page) != node)
+		return NULL;
+
+	list_del(&page->lru);
+	c->nr_partial--;
+	stat(c, CPU_PARTIAL_ALLOC);
+	return page;
+}
+
 /*
  * Remove the cpu slab
  */
@@ -1490,6 +1554,7 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 		page->inuse--;
 	}
 	c->page = NULL;
+	c->tid++;
 	unfreeze_slab(s, page, tail);
 }
 
@@ -1509,8 +1574,12 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+
+	if (c->page)
 		flush_slab(s, c);
+	unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1649,6 +1718,7 @@ load_freelist:
 	c->page->freelist = NULL;
 	c->node = page_to_nid(c->page);
 unlock_out:
+	c->tid++;
 	slab_unlock(c->page);
 	stat(c, ALLOC_SLOWPATH);
 	return object;
@@ -1657,6 +1727,13 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	new = get_cpu_partial(c, node);
+	if (new) {
+		slab_lock(new);
+		c->page = new;
+		goto load_freelist;
+	}
+
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1695,6 +1772,114 @@ debug:
 	goto unlock_out;
 }
 
+#ifdef __HAVE_ARCH_CMPXCHG_DOUBLE
+/*
+ * Lockless fastpaths.
+ *
+ * With preemption disabled we stay on this cpu's kmem_cache_cpu, and every
+ * change to its freelist, page or node (always done with interrupts off)
+ * bumps c->tid. Exchanging freelist and tid together therefore fails if an
+ * interrupt touched the cpu slab in between, and no interrupt disabling is
+ * needed at all - which is expensive when paravirtualized.
+ */
+static int slub_lockless __read_mostly;
+
+static inline int lockless_cpu_slab(struct kmem_cache_cpu *c)
+{
+	return !((unsigned long)c & (2 * sizeof(void *) - 1));
+}
+
+/*
+ * The object may have been allocated and its page freed by an interrupt
+ * since we read the freelist. The value is discarded by the failing
+ * cmpxchg then, but with DEBUG_PAGEALLOC the read itself could fault.
+ */
+static inline void *get_freepointer_safe(void **object, unsigned int offset)
+{
+	void *p;
+
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	probe_kernel_read(&p, object + offset, sizeof(p));
+#else
+	p = object[offset];
+#endif
+	return p;
+}
+
+static __always_inline void *slab_alloc_lockless(struct kmem_cache *s,
+						 int node)
+{
+	struct kmem_cache_cpu *c;
+	void **object;
+	unsigned long tid;
+
+	if (!slub_lockless)
+		return NULL;
+
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+	if (unlikely(!lockless_cpu_slab(c)))
+		goto fail;
+redo:
+	tid = c->tid;
+	barrier();
+	object = c->freelist;
+	if (unlikely(!object || !node_match(c, node)))
+		goto fail;
+	if (unlikely(!cmpxchg_double_local(&c->freelist, &c->tid, object, tid,
+			get_freepointer_safe(object, c->offset), tid + 1)))
+		goto redo;
+	stat(c, ALLOC_FASTPATH);
+	preempt_enable();
+	return object;
+fail:
+	preempt_enable();
+	return NULL;
+}
+
+static __always_inline int slab_free_lockless(struct kmem_cache *s,
+					struct page *page, void **object)
+{
+	struct kmem_cache_cpu *c;
+	void **freelist;
+	unsigned long tid;
+
+	if (!slub_lockless)
+		return 0;
+
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+	if (unlikely(!lockless_cpu_slab(c)))
+		goto fail;
+	do {
+		tid = c->tid;
+		barrier();
+		if (unlikely(page != c->page || c->node < 0))
+			goto fail;
+		freelist = c->freelist;
+		object[c->offset] = freelist;
+	} while (unlikely(!cmpxchg_double_local(&c->freelist, &c->tid,
+					freelist, tid, object, tid + 1)));
+	stat(c, FREE_FASTPATH);
+	preempt_enable();
+	return 1;
+fail:
+	preempt_enable();
+	return 0;
+}
+#else
+static inline void *slab_alloc_lockless(struct kmem_cache *s, int node)
+{
+	return NULL;
+}
+
+static inline int slab_free_lockless(struct kmem_cache *s,
+					struct page *page, void **object)
+{
+	return 0;
+}
+#endif
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -1703,7 +1888,8 @@ debug:
  * The fastpath works by first checking if the lockless freelist can be used.
  * If not then __slab_alloc is called for slow processing.
  *
- * Otherwise we can simply pick the next object from the lockless free list.
+ * Otherwise we can simply pick the next object from the lockless free list,
+ * without disabling interrupts if the cpu supports cmpxchg_double_local().
  */
 static __always_inline void *slab_alloc(struct kmem_cache *s,
 		gfp_t gfpflags, int node, unsigned long addr)
@@ -1721,9 +1907,13 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (should_failslab(s->objsize, gfpflags))
 		return NULL;
 
+	objsize = s->objsize;
+	object = slab_alloc_lockless(s, node);
+	if (likely(object))
+		goto out;
+
 	local_irq_save(flags);
 	c = get_cpu_slab(s, smp_processor_id());
-	objsize = c->objsize;
 	if (unlikely(!c->freelist || !node_match(c, node)))
 
 		object = __slab_alloc(s, gfpflags, node, addr, c);
@@ -1731,14 +1921,15 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	else {
 		object = c->freelist;
 		c->freelist = object[c->offset];
+		c->tid++;
 		stat(c, ALLOC_FASTPATH);
 	}
 	local_irq_restore(flags);
-
+out:
 	if (unlikely((gfpflags & __GFP_ZERO) && object))
 		memset(object, 0, objsize);
 
-	kmemcheck_slab_alloc(s, gfpflags, object, c->objsize);
+	kmemcheck_slab_alloc(s, gfpflags, object, objsize);
 	kmemleak_alloc_recursive(object, objsize, 1, s->flags, gfpflags);
 
 	return object;
@@ -1821,10 +2012,16 @@ checks_ok:
 		goto slab_empty;
 
 	/*
-	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * Objects left in the slab. If it was not on a partial list before
+	 * then add it, preferably to our own.
 	 */
 	if (unlikely(!prior)) {
+		if (put_cpu_partial(s, c, page)) {
+			slab_unlock(page);
+			if (c->nr_partial > s->cpu_partial)
+				unfreeze_partials(s, c);
+			return;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(c, FREE_ADD_PARTIAL);
 	}
@@ -1871,15 +2068,19 @@ static __always_inline void slab_free(struct kmem_cache *s,
 	unsigned long flags;
 
 	kmemleak_free_recursive(x, s->flags);
+	kmemcheck_slab_free(s, object, s->objsize);
+	debug_check_no_locks_freed(object, s->objsize);
+	if (!(s->flags & SLAB_DEBUG_OBJECTS))
+		debug_check_no_obj_freed(object, s->objsize);
+	if (likely(slab_free_lockless(s, page, object)))
+		return;
+
 	local_irq_save(flags);
 	c = get_cpu_slab(s, smp_processor_id());
-	kmemcheck_slab_free(s, object, c->objsize);
-	debug_check_no_locks_freed(object, c->objsize);
-	if (!(s->flags & SLAB_DEBUG_OBJECTS))
-		debug_check_no_obj_freed(object, c->objsize);
 	if (likely(page == c->page && c->node >= 0)) {
 		object[c->offset] = c->freelist;
 		c->freelist = object;
+		c->tid++;
 		stat(c, FREE_FASTPATH);
 	} else
 		__slab_free(s, page, x, addr, c->offset);
@@ -2074,9 +2275,12 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 {
 	c->page = NULL;
 	c->freelist = NULL;
+	c->tid = 0;
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	INIT_LIST_HEAD(&c->partial);
+	c->nr_partial = 0;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2493,6 +2697,23 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+
+	/*
+	 * Keep a few partial slabs per cpu, fewer for large objects as
+	 * those slabs tie up more memory.  Debugging needs every free to
+	 * go through the node lists.
+	 */
+	if (s->flags & (SLAB_DEBUG_FREE | SLAB_RED_ZONE | SLAB_POISON |
+			SLAB_STORE_USER | SLAB_TRACE))
+		s->cpu_partial = 0;
+	else if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 4;
+	else if (s->size >= 256)
+		s->cpu_partial = 8;
+	else
+		s->cpu_partial = 16;
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -3176,6 +3397,9 @@ void __init kmem_cache_init(void)
 	int i;
 	int caches = 0;
 
+#ifdef __HAVE_ARCH_CMPXCHG_DOUBLE
+	slub_lockless = system_has_cmpxchg_double();
+#endif
 	init_alloc_cpu();
 
 #ifdef CONFIG_NUMA
@@ -4088,6 +4312,30 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long nr;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err)
+		return err;
+	if (nr && (s->flags & (SLAB_DEBUG_FREE | SLAB_RED_ZONE |
+				SLAB_POISON | SLAB_STORE_USER | SLAB_TRACE)))
+		return -EINVAL;
+
+	s->cpu_partial = nr;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4396,6 +4644,9 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4404,6 +4655,7 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4450,6 +4702,9 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_drain_attr.attr,
 #endif
 	NULL
 };
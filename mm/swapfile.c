@@ -34,10 +34,17 @@
 #include <asm/tlbflush.h>
 #include <linux/swapops.h>
 #include <linux/page_cgroup.h>
+#include <linux/frontswap.h>
 
+/*
+ * swap_lock protects swap_list, nr_swapfiles, the priorities and the
+ * swapon and swapoff transitions.  The slots of each device, its
+ * swap_map, inuse_pages, bits and clusters, are under that device's
+ * own si->lock, which nests inside swap_lock.
+ */
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
-long nr_swap_pages;
+atomic_long_t nr_swap_pages;
 long total_swap_pages;
 static int swap_overflow;
 static int least_priority;
@@ -230,6 +237,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	unsigned long last_in_cluster = 0;
 	int latency_ration = LATENCY_LIMIT;
 	int found_free_cluster = 0;
+	struct swap_cluster *cluster = &si->cluster;
 
 	/*
 	 * We try to cluster swap pages by allocating them sequentially
@@ -240,22 +248,29 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
 	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * On an SSD each cpu fills a cluster of its own, so that swap-out
+	 * on several cpus does not interleave in one.  Which cpu's cluster
+	 * we end up with after sleeping in the scans below does not matter,
+	 * they are all under si->lock.
 	 */
 
+	if (si->percpu_cluster)
+		cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+
 	si->flags += SWP_SCANNING;
-	scan_base = offset = si->cluster_next;
+	scan_base = offset = cluster->next;
 
-	if (unlikely(!si->cluster_nr--)) {
+	if (unlikely(!cluster->nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
-			si->cluster_nr = SWAPFILE_CLUSTER - 1;
+			cluster->nr = SWAPFILE_CLUSTER - 1;
 			goto checks;
 		}
 		if (si->flags & SWP_DISCARDABLE) {
 			/*
 			 * Start range check on racing allocations, in case
 			 * they overlap the cluster we eventually decide on
-			 * (we scan without swap_lock to allow preemption).
-			 * It's hardly conceivable that cluster_nr could be
+			 * (we scan without si->lock to allow preemption).
+			 * It's hardly conceivable that cluster->nr could be
 			 * wrapped during our scan, but don't depend on it.
 			 */
 			if (si->lowest_alloc)
@@ -263,7 +278,7 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			si->lowest_alloc = si->max;
 			si->highest_alloc = 0;
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 
 		/*
 		 * If seek is expensive, start searching for new cluster from
@@ -282,10 +297,10 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				spin_lock(&si->lock);
 				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
+				cluster->next = offset;
+				cluster->nr = SWAPFILE_CLUSTER - 1;
 				found_free_cluster = 1;
 				goto checks;
 			}
@@ -303,10 +318,10 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				spin_lock(&si->lock);
 				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
+				cluster->next = offset;
+				cluster->nr = SWAPFILE_CLUSTER - 1;
 				found_free_cluster = 1;
 				goto checks;
 			}
@@ -317,8 +332,8 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 		}
 
 		offset = scan_base;
-		spin_lock(&swap_lock);
-		si->cluster_nr = SWAPFILE_CLUSTER - 1;
+		spin_lock(&si->lock);
+		cluster->nr = SWAPFILE_CLUSTER - 1;
 		si->lowest_alloc = 0;
 	}
 
@@ -335,9 +350,9 @@ checks:
 		&& cache == SWAP_CACHE
 		&& si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		swap_was_freed = __try_to_reclaim_swap(si, offset);
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		/* entry was freed successfully, try to use this again */
 		if (swap_was_freed)
 			goto checks;
@@ -360,7 +375,7 @@ checks:
 		si->swap_map[offset] = encode_swapmap(0, true);
 	else /* at suspend */
 		si->swap_map[offset] = encode_swapmap(1, false);
-	si->cluster_next = offset + 1;
+	cluster->next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
 	if (si->lowest_alloc) {
@@ -380,13 +395,13 @@ checks:
 			    si->lowest_alloc <= last_in_cluster)
 				last_in_cluster = si->lowest_alloc - 1;
 			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 
 			if (offset < last_in_cluster)
 				discard_swap_cluster(si, offset,
 					last_in_cluster - offset + 1);
 
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			si->lowest_alloc = 0;
 			si->flags &= ~SWP_DISCARDING;
 
@@ -400,10 +415,10 @@ checks:
 			 * could defer that delay until swap_writepage,
 			 * but it's easier to keep this self-contained.
 			 */
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
 				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 		} else {
 			/*
 			 * Note pages allocated by racing tasks while
@@ -419,14 +434,14 @@ checks:
 	return offset;
 
 scan:
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	while (++offset <= si->highest_bit) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -437,11 +452,11 @@ scan:
 	offset = si->lowest_bit;
 	while (++offset < scan_base) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -449,7 +464,7 @@ scan:
 			latency_ration = LATENCY_LIMIT;
 		}
 	}
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 
 no_page:
 	si->flags -= SWP_SCANNING;
@@ -464,9 +479,9 @@ swp_entry_t get_swap_page(void)
 	int wrapped = 0;
 
 	spin_lock(&swap_lock);
-	if (nr_swap_pages <= 0)
+	if (atomic_long_read(&nr_swap_pages) <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	atomic_long_dec(&nr_swap_pages);
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info + type;
@@ -477,22 +492,25 @@ swp_entry_t get_swap_page(void)
 			wrapped++;
 		}
 
-		if (!si->highest_bit)
-			continue;
-		if (!(si->flags & SWP_WRITEOK))
+		spin_lock(&si->lock);
+		if (!si->highest_bit || !(si->flags & SWP_WRITEOK)) {
+			spin_unlock(&si->lock);
 			continue;
+		}
 
+		/* the scan only needs the device, let others pick theirs */
 		swap_list.next = next;
+		spin_unlock(&swap_lock);
 		/* This is called for allocating swap entry for cache */
 		offset = scan_swap_map(si, SWAP_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
+		if (offset)
 			return swp_entry(type, offset);
-		}
+		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	atomic_long_inc(&nr_swap_pages);
 noswap:
 	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
@@ -504,19 +522,19 @@ swp_entry_t get_swap_page_of_type(int type)
 	struct swap_info_struct *si;
 	pgoff_t offset;
 
-	spin_lock(&swap_lock);
 	si = swap_info + type;
+	spin_lock(&si->lock);
 	if (si->flags & SWP_WRITEOK) {
-		nr_swap_pages--;
+		atomic_long_dec(&nr_swap_pages);
 		/* This is called for allocating swap entry, not cache */
 		offset = scan_swap_map(si, SWAP_MAP);
 		if (offset) {
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			return swp_entry(type, offset);
 		}
-		nr_swap_pages++;
+		atomic_long_inc(&nr_swap_pages);
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	return (swp_entry_t) {0};
 }
 
@@ -538,7 +556,7 @@ static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -579,14 +597,23 @@ static int swap_entry_free(struct swap_info_struct *p,
 	count = p->swap_map[offset];
 	/* free if no reference */
 	if (!count) {
+		int next = ACCESS_ONCE(swap_list.next);
+
 		if (offset < p->lowest_bit)
 			p->lowest_bit = offset;
 		if (offset > p->highest_bit)
 			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
+		/*
+		 * swap_list.next is only a hint, moved here without
+		 * swap_lock.  swapoff clears SWP_WRITEOK under p->lock
+		 * before it takes p off the list, so p is still on it.
+		 */
+		if ((p->flags & SWP_WRITEOK) &&
+		    (next < 0 || p->prio > swap_info[next].prio))
 			swap_list.next = p - swap_info;
-		nr_swap_pages++;
+		atomic_long_inc(&nr_swap_pages);
 		p->inuse_pages--;
+		frontswap_flush_page(p - swap_info, offset);
 	}
 	if (!swap_count(count))
 		mem_cgroup_uncharge_swap(ent);
@@ -604,7 +631,7 @@ void swap_free(swp_entry_t entry)
 	p = swap_info_get(entry);
 	if (p) {
 		swap_entry_free(p, entry, SWAP_MAP);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 }
 
@@ -627,7 +654,7 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 				swapout = false; /* no more swap users! */
 			mem_cgroup_uncharge_swapcache(page, entry, swapout);
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return;
 }
@@ -645,7 +672,7 @@ static inline int page_swapcount(struct page *page)
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return count;
 }
@@ -713,7 +740,7 @@ int free_swap_and_cache(swp_entry_t entry)
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	if (page) {
 		/*
@@ -993,10 +1020,10 @@ static unsigned int find_next_to_unuse(struct swap_info_struct *si,
 	int count;
 
 	/*
-	 * No need for swap_lock here: we're just looking
+	 * No need for si->lock here: we're just looking
 	 * for whether an entry is in use, not modifying it; false
 	 * hits are okay, and sys_swapoff() has already prevented new
-	 * allocations from this area (while holding swap_lock).
+	 * allocations from this area (while holding si->lock).
 	 */
 	for (;;) {
 		if (++i >= max) {
@@ -1197,9 +1224,9 @@ static int try_to_unuse(unsigned int type)
 			goto retry;
 
 		if (swap_count(*swap_map) == SWAP_MAP_MAX) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			*swap_map = encode_swapmap(0, true);
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			reset_overflow = 1;
 		}
 
@@ -1513,6 +1540,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	unsigned long *frontswap_map;
+	struct swap_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1557,6 +1586,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		spin_unlock(&swap_lock);
 		goto out_dput;
 	}
+	spin_lock(&p->lock);
+	p->flags &= ~SWP_WRITEOK;
+	spin_unlock(&p->lock);
 	if (prev < 0) {
 		swap_list.head = p->next;
 	} else {
@@ -1571,9 +1603,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_info[i].prio = p->prio--;
 		least_priority++;
 	}
-	nr_swap_pages -= p->pages;
+	atomic_long_sub(p->pages, &nr_swap_pages);
 	total_swap_pages -= p->pages;
-	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
 	current->flags |= PF_OOM_ORIGIN;
@@ -1596,9 +1627,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_list.head = swap_list.next = p - swap_info;
 		else
 			swap_info[prev].next = p - swap_info;
-		nr_swap_pages += p->pages;
+		atomic_long_add(p->pages, &nr_swap_pages);
 		total_swap_pages += p->pages;
+		spin_lock(&p->lock);
 		p->flags |= SWP_WRITEOK;
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		goto out_dput;
 	}
@@ -1608,16 +1641,20 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	up_write(&swap_unplug_sem);
 
 	destroy_swap_extents(p);
+	frontswap_flush_area(type);
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	drain_mmlist();
 
 	/* wait for anyone still in scan_swap_map */
 	p->highest_bit = 0;		/* cuts scans short */
 	while (p->flags >= SWP_SCANNING) {
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		schedule_timeout_uninterruptible(1);
 		spin_lock(&swap_lock);
+		spin_lock(&p->lock);
 	}
 
 	swap_file = p->swap_file;
@@ -1625,10 +1662,17 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	frontswap_map = frontswap_map_get(p);
+	frontswap_map_set(p, NULL);
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(frontswap_map);
+	free_percpu(percpu_cluster);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1782,6 +1826,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages = 1;
 	unsigned long swapfilepages;
 	unsigned short *swap_map = NULL;
+	unsigned long *frontswap_map = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1801,6 +1846,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (type >= nr_swapfiles)
 		nr_swapfiles = type+1;
 	memset(p, 0, sizeof(*p));
+	spin_lock_init(&p->lock);
 	INIT_LIST_HEAD(&p->extent_list);
 	p->flags = SWP_USED;
 	p->next = -1;
@@ -1898,7 +1944,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	}
 
 	p->lowest_bit  = 1;
-	p->cluster_next = 1;
+	p->cluster.next = 1;
 
 	/*
 	 * Find out how many pages are allowed for a single swap
@@ -1950,6 +1996,14 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		swap_map[page_nr] = SWAP_MAP_BAD;
 	}
 
+	if (frontswap_enabled) {
+		frontswap_map = frontswap_map_alloc(maxpages);
+		if (!frontswap_map) {
+			error = -ENOMEM;
+			goto bad_swap;
+		}
+	}
+
 	error = swap_cgroup_swapon(type, maxpages);
 	if (error)
 		goto bad_swap;
@@ -1978,7 +2032,14 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (p->bdev) {
 		if (blk_queue_nonrot(bdev_get_queue(p->bdev))) {
 			p->flags |= SWP_SOLIDSTATE;
-			p->cluster_next = 1 + (random32() % p->highest_bit);
+			p->cluster.next = 1 + (random32() % p->highest_bit);
+			/* without them the cpus share p->cluster */
+			p->percpu_cluster = alloc_percpu(struct swap_cluster);
+			if (p->percpu_cluster) {
+				for_each_possible_cpu(i)
+					per_cpu_ptr(p->percpu_cluster, i)->next =
+					    1 + (random32() % p->highest_bit);
+			}
 		}
 		if (discard_swap(p) == 0)
 			p->flags |= SWP_DISCARDABLE;
@@ -1992,8 +2053,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	frontswap_map_set(p, frontswap_map);
 	p->flags |= SWP_WRITEOK;
-	nr_swap_pages += nr_good_pages;
+	atomic_long_add(nr_good_pages, &nr_swap_pages);
 	total_swap_pages += nr_good_pages;
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
@@ -2019,6 +2081,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	}
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
+	frontswap_init(type);
 	error = 0;
 	goto out;
 bad_swap:
@@ -2029,11 +2092,14 @@ bad_swap:
 	destroy_swap_extents(p);
 	swap_cgroup_swapoff(type);
 bad_swap_2:
+	free_percpu(p->percpu_cluster);
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(frontswap_map);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2063,7 +2129,7 @@ void si_swapinfo(struct sysinfo *val)
 			continue;
 		nr_to_be_unused += swap_info[i].inuse_pages;
 	}
-	val->freeswap = nr_swap_pages + nr_to_be_unused;
+	val->freeswap = atomic_long_read(&nr_swap_pages) + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
 	spin_unlock(&swap_lock);
 }
@@ -2097,7 +2163,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	p = type + swap_info;
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
@@ -2132,7 +2198,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	} else
 		result = -ENOENT; /* unused swap entry */
 unlock_out:
-	spin_unlock(&swap_lock);
+	spin_unlock(&p->lock);
 out:
 	return result;
 
@@ -2169,7 +2235,7 @@ get_swap_info_struct(unsigned type)
 }
 
 /*
- * swap_lock prevents swap_map being freed. Don't grab an extra
+ * si->lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
 int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
@@ -2190,7 +2256,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (!base)		/* first page is swap header */
 		base++;
 
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
@@ -2210,7 +2276,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 
 	/*
 	 * Indicate starting offset, and return number of pages to get:
@@ -265,6 +265,10 @@ static struct rb_root vmap_area_root = RB_ROOT;
 static LIST_HEAD(vmap_area_list);
 static unsigned long vmap_area_pcpu_hole;
 
+/* Areas freed lazily and not yet purged, linked by ->purge_list */
+static DEFINE_SPINLOCK(vmap_purge_lock);
+static LIST_HEAD(vmap_purge_list);
+
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
 	struct rb_node *n = vmap_area_root.rb_node;
@@ -497,13 +501,20 @@ static void vmap_debug_free_range(unsigned long start, unsigned long end)
  * code, and it will be simple to change the scale factor if we find that it
  * becomes a problem on bigger systems.
  */
+/*
+ * Where a kernel TLB flush is much dearer than usual, e.g. a hypercall
+ * flushing every vcpu under Xen PV, the platform raises vmap_lazy_scale at
+ * boot to gather up correspondingly more before each purge.
+ */
+unsigned int vmap_lazy_scale __read_mostly = 1;
+
 static unsigned long lazy_max_pages(void)
 {
 	unsigned int log;
 
 	log = fls(num_online_cpus());
 
-	return log * (32UL * 1024 * 1024 / PAGE_SIZE);
+	return log * vmap_lazy_scale * (32UL * 1024 * 1024 / PAGE_SIZE);
 }
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
@@ -553,20 +564,19 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	spin_lock(&vmap_purge_lock);
+	list_splice_init(&vmap_purge_list, &valist);
+	spin_unlock(&vmap_purge_lock);
+
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
 	if (nr) {
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -612,7 +622,10 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	spin_lock(&vmap_purge_lock);
 	va->flags |= VM_LAZY_FREE;
+	list_add_tail(&va->purge_list, &vmap_purge_list);
+	spin_unlock(&vmap_purge_lock);
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
@@ -128,6 +128,11 @@ struct scan_control {
  * From 0 .. 100.  Higher means more swappy.
  */
 int vm_swappiness = 60;
+
+/* Number of kswapd threads per node, see vm.kswapd_threads */
+int kswapd_threads = 1;
+/* Protects kswapd_threads and pgdat->kswapd[] against concurrent changes */
+static DEFINE_MUTEX(kswapd_threads_lock);
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
 static LIST_HEAD(shrinker_list);
@@ -804,11 +809,6 @@ keep:
 	return nr_reclaimed;
 }
 
-/* LRU Isolation modes. */
-#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
-#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
-#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
-
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -955,7 +955,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			 * anon page which don't already have a swap slot is
 			 * pointless.
 			 */
-			if (nr_swap_pages <= 0 && PageAnon(cursor_page) &&
+			if (get_nr_swap_pages() <= 0 && PageAnon(cursor_page) &&
 					!PageSwapCache(cursor_page))
 				continue;
 
@@ -1642,7 +1642,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	int noswap = 0;
 
 	/* If we have no swap space, do not bother scanning anon pages. */
-	if (!sc->may_swap || (nr_swap_pages <= 0)) {
+	if (!sc->may_swap || (get_nr_swap_pages() <= 0)) {
 		noswap = 1;
 		percent[0] = 0;
 		percent[1] = 100;
@@ -1693,7 +1693,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (inactive_anon_is_low(zone, sc) && nr_swap_pages > 0)
+	if (inactive_anon_is_low(zone, sc) && get_nr_swap_pages() > 0)
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
 	throttle_vm_writeout(sc->gfp_mask);
@@ -1868,6 +1868,101 @@ out:
 	return ret;
 }
 
+/*
+ * Are the free pages of the node's lowmem zones above half their min
+ * watermarks?  Below that, direct reclaimers are throttled so that kswapd
+ * can catch up, rather than all of them piling into reclaim at once.
+ * Zones that are unreclaimable don't count, or nobody could ever wake
+ * the throttled tasks.
+ */
+static bool pfmemalloc_watermark_ok(pg_data_t *pgdat)
+{
+	unsigned long pfmemalloc_reserve = 0;
+	unsigned long free_pages = 0;
+	bool wmark_ok;
+	int i;
+
+	for (i = 0; i <= ZONE_NORMAL && i < pgdat->nr_zones; i++) {
+		struct zone *zone = &pgdat->node_zones[i];
+
+		if (!populated_zone(zone) || zone_is_all_unreclaimable(zone))
+			continue;
+		pfmemalloc_reserve += min_wmark_pages(zone);
+		free_pages += zone_page_state(zone, NR_FREE_PAGES);
+	}
+
+	/* If there are no reserves (unexpected config) then do not throttle */
+	if (!pfmemalloc_reserve)
+		return true;
+
+	wmark_ok = free_pages > pfmemalloc_reserve / 2;
+
+	/* kswapd must be awake if processes are being throttled */
+	if (!wmark_ok && waitqueue_active(&pgdat->kswapd_wait))
+		wake_up_interruptible(&pgdat->kswapd_wait);
+
+	return wmark_ok;
+}
+
+/*
+ * Throttle direct reclaimers if the reserves of the preferred node are
+ * getting dangerously depleted, to bound the number of tasks reclaiming
+ * at once and with it the allocation latency.  kswapd will continue to
+ * make progress and wake the processes as soon as enough is free again.
+ *
+ * Returns true if a fatal signal was delivered during throttling. If this
+ * happens, the page allocator should not consider triggering the OOM killer.
+ */
+static bool throttle_direct_reclaim(gfp_t gfp_mask, struct zonelist *zonelist,
+				    nodemask_t *nodemask)
+{
+	struct zone *zone;
+	pg_data_t *pgdat;
+
+	/*
+	 * Kernel threads should not be throttled as they may be indirectly
+	 * responsible for cleaning pages necessary for reclaim to make forward
+	 * progress. kjournald for example may enter direct reclaim while
+	 * committing a transaction where throttling it could forcing other
+	 * processes to block on log_wait_commit().
+	 */
+	if (current->flags & PF_KTHREAD)
+		return false;
+
+	/*
+	 * If a fatal signal is pending, this process should not throttle.
+	 * It should return quickly so it can exit and free its memory
+	 */
+	if (fatal_signal_pending(current))
+		return false;
+
+	first_zones_zonelist(zonelist, gfp_zone(gfp_mask), nodemask, &zone);
+	if (!zone)
+		return false;
+	pgdat = zone->zone_pgdat;
+	if (pfmemalloc_watermark_ok(pgdat))
+		return false;
+
+	count_vm_event(PGSCAN_DIRECT_THROTTLE);
+
+	/*
+	 * If the caller cannot enter the filesystem, it's possible that it
+	 * is due to the caller holding an FS lock or performing a journal
+	 * transaction in the case of a filesystem like ext[3|4]. In this case,
+	 * it is not safe to block on pfmemalloc_wait as kswapd could be
+	 * blocked waiting on the same lock. Instead, throttle for up to a
+	 * second before continuing.
+	 */
+	if (!(gfp_mask & __GFP_FS))
+		wait_event_interruptible_timeout(pgdat->pfmemalloc_wait,
+					pfmemalloc_watermark_ok(pgdat), HZ);
+	else
+		wait_event_killable(pgdat->pfmemalloc_wait,
+				    pfmemalloc_watermark_ok(pgdat));
+
+	return fatal_signal_pending(current);
+}
+
 unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 				gfp_t gfp_mask, nodemask_t *nodemask)
 {
@@ -1884,6 +1979,13 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.nodemask = nodemask,
 	};
 
+	/*
+	 * Don't reclaim if a fatal signal arrived while we were throttled:
+	 * returning 1 keeps the page allocator from OOM killing for it.
+	 */
+	if (throttle_direct_reclaim(gfp_mask, zonelist, nodemask))
+		return 1;
+
 	return do_try_to_free_pages(zonelist, &sc);
 }
 
@@ -2111,6 +2213,15 @@ loop_again:
 			    total_scanned > sc.nr_reclaimed + sc.nr_reclaimed / 2)
 				sc.may_writepage = 1;
 		}
+
+		/*
+		 * Direct reclaimers throttled on pfmemalloc_wait can make
+		 * progress again once enough is free: let them go.
+		 */
+		if (waitqueue_active(&pgdat->pfmemalloc_wait) &&
+		    pfmemalloc_watermark_ok(pgdat))
+			wake_up(&pgdat->pfmemalloc_wait);
+
 		if (all_zones_ok)
 			break;		/* kswapd: all done */
 		/*
@@ -2227,13 +2338,19 @@ static int kswapd(void *p)
 			 */
 			order = new_order;
 		} else {
-			if (!freezing(current))
+			/* Nothing left to wait for once kswapd sleeps */
+			if (waitqueue_active(&pgdat->pfmemalloc_wait))
+				wake_up(&pgdat->pfmemalloc_wait);
+			if (!freezing(current) && !kthread_should_stop())
 				schedule();
 
 			order = pgdat->kswapd_max_order;
 		}
 		finish_wait(&pgdat->kswapd_wait, &wait);
 
+		if (kthread_should_stop())
+			break;
+
 		if (!try_to_freeze()) {
 			/* We can speed up thawing tasks if we don't call
 			 * balance_pgdat after returning from the refrigerator
@@ -2282,7 +2399,7 @@ unsigned long global_reclaimable_pages(void)
 	nr = global_page_state(NR_ACTIVE_FILE) +
 	     global_page_state(NR_INACTIVE_FILE);
 
-	if (nr_swap_pages > 0)
+	if (get_nr_swap_pages() > 0)
 		nr += global_page_state(NR_ACTIVE_ANON) +
 		      global_page_state(NR_INACTIVE_ANON);
 
@@ -2296,7 +2413,7 @@ unsigned long zone_reclaimable_pages(struct zone *zone)
 	nr = zone_page_state(zone, NR_ACTIVE_FILE) +
 	     zone_page_state(zone, NR_INACTIVE_FILE);
 
-	if (nr_swap_pages > 0)
+	if (get_nr_swap_pages() > 0)
 		nr += zone_page_state(zone, NR_ACTIVE_ANON) +
 		      zone_page_state(zone, NR_INACTIVE_ANON);
 
@@ -2466,14 +2583,37 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids) {
+				int i;
+
 				/* One of our CPUs online: restore mask */
-				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+				mutex_lock(&kswapd_threads_lock);
+				for (i = 0; i < MAX_KSWAPD_THREADS; i++)
+					if (pgdat->kswapd[i])
+						set_cpus_allowed_ptr(
+							pgdat->kswapd[i], mask);
+				mutex_unlock(&kswapd_threads_lock);
+			}
 		}
 	}
 	return NOTIFY_OK;
 }
 
+static int kswapd_start_one(pg_data_t *pgdat, int i)
+{
+	struct task_struct *tsk;
+
+	if (i == 0)
+		tsk = kthread_run(kswapd, pgdat, "kswapd%d", pgdat->node_id);
+	else
+		tsk = kthread_run(kswapd, pgdat, "kswapd%d:%d",
+				  pgdat->node_id, i);
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	pgdat->kswapd[i] = tsk;
+	return 0;
+}
+
 /*
  * This kswapd start function will be called by init and node-hot-add.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
@@ -2481,18 +2621,59 @@ static int __devinit cpu_callback(struct notifier_block *nfb,
 int kswapd_run(int nid)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
-	int ret = 0;
+	int i, ret = 0;
 
-	if (pgdat->kswapd)
-		return 0;
+	mutex_lock(&kswapd_threads_lock);
+	for (i = 0; i < kswapd_threads; i++) {
+		if (pgdat->kswapd[i])
+			continue;
+		if (kswapd_start_one(pgdat, i)) {
+			/* failure at boot is fatal */
+			BUG_ON(system_state == SYSTEM_BOOTING);
+			printk("Failed to start kswapd on node %d\n",nid);
+			ret = -1;
+			break;
+		}
+	}
+	mutex_unlock(&kswapd_threads_lock);
+	return ret;
+}
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
-		/* failure at boot is fatal */
-		BUG_ON(system_state == SYSTEM_BOOTING);
-		printk("Failed to start kswapd on node %d\n",nid);
-		ret = -1;
+/*
+ * vm.kswapd_threads: start or stop the extra threads on every node.
+ * The threads all balance the same node; the LRU lists are shared and
+ * each one isolates its own batches under zone->lru_lock, so the work is
+ * split as it goes without partitioning it up front.
+ */
+int kswapd_threads_sysctl_handler(struct ctl_table *table, int write,
+				  void __user *buffer, size_t *length,
+				  loff_t *ppos)
+{
+	int old, ret, nid, i;
+
+	mutex_lock(&kswapd_threads_lock);
+	old = kswapd_threads;
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write || kswapd_threads == old)
+		goto out;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (i = kswapd_threads; i < old; i++) {
+			if (pgdat->kswapd[i]) {
+				kthread_stop(pgdat->kswapd[i]);
+				pgdat->kswapd[i] = NULL;
+			}
+		}
+		for (i = old; i < kswapd_threads; i++) {
+			if (!pgdat->kswapd[i] && kswapd_start_one(pgdat, i))
+				printk(KERN_WARNING "Failed to start kswapd "
+				       "thread %d on node %d\n", i, nid);
+		}
 	}
+out:
+	mutex_unlock(&kswapd_threads_lock);
 	return ret;
 }
 
@@ -145,6 +145,30 @@ static inline struct net_device *bridge_parent(const struct net_device *dev)
 	return port ? port->br->dev : NULL;
 }
 
+/* Frames from a port in nf_bypass mode, or to one when the destination
+ * is known, never go to iptables or conntrack: the administrator has no
+ * rules for that port (typically a guest's vif).  Without an nf_bridge
+ * the later bridge hooks leave the frame alone as well, so it is
+ * forwarded by the bridge alone.
+ */
+static inline int br_nf_bypass(const struct sk_buff *skb,
+			       const struct net_device *in)
+{
+	struct net_bridge_port *port = rcu_dereference(in->br_port);
+	const unsigned char *dest = eth_hdr(skb)->h_dest;
+	struct net_bridge_fdb_entry *fdb;
+
+	if (!port)
+		return 0;
+	if (port->flags & BR_NF_BYPASS)
+		return 1;
+	if (!port->br->nf_bypass_ports || is_multicast_ether_addr(dest))
+		return 0;
+
+	fdb = __br_fdb_get(port->br, dest);
+	return fdb && !fdb->is_local && (fdb->dst->flags & BR_NF_BYPASS);
+}
+
 static inline struct nf_bridge_info *nf_bridge_alloc(struct sk_buff *skb)
 {
 	skb->nf_bridge = kzalloc(sizeof(struct nf_bridge_info), GFP_ATOMIC);
@@ -557,6 +581,9 @@ static unsigned int br_nf_pre_routing(unsigned int hook, struct sk_buff *skb,
 	struct iphdr *iph;
 	__u32 len = nf_bridge_encap_header_len(skb);
 
+	if (br_nf_bypass(skb, in))
+		return NF_ACCEPT;
+
 	if (unlikely(!pskb_may_pull(skb, len)))
 		goto out;
 
@@ -728,6 +755,9 @@ static unsigned int br_nf_forward_arp(unsigned int hook, struct sk_buff *skb,
 		return NF_ACCEPT;
 #endif
 
+	if ((in->br_port->flags | out->br_port->flags) & BR_NF_BYPASS)
+		return NF_ACCEPT;
+
 	if (skb->protocol != htons(ETH_P_ARP)) {
 		if (!IS_VLAN_ARP(skb))
 			return NF_ACCEPT;
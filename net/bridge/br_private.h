@@ -85,6 +85,7 @@ struct net_bridge_port
 
 	unsigned long 			flags;
 #define BR_HAIRPIN_MODE		0x00000001
+#define BR_NF_BYPASS		0x00000002
 };
 
 struct net_bridge
@@ -98,6 +99,8 @@ struct net_bridge
 	unsigned long			feature_mask;
 #ifdef CONFIG_BRIDGE_NETFILTER
 	struct rtable 			fake_rtable;
+	/* ports with BR_NF_BYPASS set */
+	unsigned int			nf_bypass_ports;
 #endif
 	unsigned long			flags;
 #define BR_SET_MAC_ADDR		0x00000001
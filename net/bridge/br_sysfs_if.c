@@ -159,6 +159,27 @@ static ssize_t store_hairpin_mode(struct net_bridge_port *p, unsigned long v)
 static BRPORT_ATTR(hairpin_mode, S_IRUGO | S_IWUSR,
 		   show_hairpin_mode, store_hairpin_mode);
 
+#ifdef CONFIG_BRIDGE_NETFILTER
+static ssize_t show_nf_bypass(struct net_bridge_port *p, char *buf)
+{
+	int nf_bypass = (p->flags & BR_NF_BYPASS) ? 1 : 0;
+	return sprintf(buf, "%d\n", nf_bypass);
+}
+static ssize_t store_nf_bypass(struct net_bridge_port *p, unsigned long v)
+{
+	if (v && !(p->flags & BR_NF_BYPASS)) {
+		p->flags |= BR_NF_BYPASS;
+		p->br->nf_bypass_ports++;
+	} else if (!v && (p->flags & BR_NF_BYPASS)) {
+		p->flags &= ~BR_NF_BYPASS;
+		p->br->nf_bypass_ports--;
+	}
+	return 0;
+}
+static BRPORT_ATTR(nf_bypass, S_IRUGO | S_IWUSR,
+		   show_nf_bypass, store_nf_bypass);
+#endif
+
 static struct brport_attribute *brport_attrs[] = {
 	&brport_attr_path_cost,
 	&brport_attr_priority,
@@ -176,6 +197,9 @@ static struct brport_attribute *brport_attrs[] = {
 	&brport_attr_hold_timer,
 	&brport_attr_flush,
 	&brport_attr_hairpin_mode,
+#ifdef CONFIG_BRIDGE_NETFILTER
+	&brport_attr_nf_bypass,
+#endif
 	NULL
 };
 
@@ -126,7 +126,9 @@
 #include <linux/in.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/vmalloc.h>
 #include <trace/events/napi.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -1774,7 +1776,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -1809,16 +1811,75 @@ u16 skb_tx_hash(const struct net_device *dev, const struct sk_buff *skb)
 }
 EXPORT_SYMBOL(skb_tx_hash);
 
+/*
+ * Pick a queue from the transmitting CPU's XPS map, spreading flows by
+ * hash when it holds several.  Returns -1 if the CPU has no map.
+ */
+static inline int get_xps_queue(struct net_device *dev, struct sk_buff *skb)
+{
+#ifdef CONFIG_XPS
+	struct xps_dev_maps *dev_maps;
+	struct xps_map *map;
+	int queue_index = -1;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		map = rcu_dereference(
+		    dev_maps->cpu_map[raw_smp_processor_id()]);
+		if (map) {
+			if (map->len == 1)
+				queue_index = map->queues[0];
+			else {
+				u32 hash;
+
+				if (skb->sk && skb->sk->sk_hash)
+					hash = skb->sk->sk_hash;
+				else
+					hash = (__force u16) skb->protocol ^
+					    skb->rxhash;
+				hash = jhash_1word(hash, skb_tx_hashrnd);
+				queue_index = map->queues[
+				    ((u64)hash * map->len) >> 32];
+			}
+			if (unlikely(queue_index >= dev->real_num_tx_queues))
+				queue_index = -1;
+		}
+	}
+	rcu_read_unlock();
+
+	return queue_index;
+#else
+	return -1;
+#endif
+}
+
 static struct netdev_queue *dev_pick_tx(struct net_device *dev,
 					struct sk_buff *skb)
 {
 	const struct net_device_ops *ops = dev->netdev_ops;
-	u16 queue_index = 0;
+	int queue_index = 0;
 
 	if (ops->ndo_select_queue)
 		queue_index = ops->ndo_select_queue(dev, skb);
-	else if (dev->real_num_tx_queues > 1)
-		queue_index = skb_tx_hash(dev, skb);
+	else if (dev->real_num_tx_queues > 1) {
+		struct sock *sk = skb->sk;
+
+		/*
+		 * A socket keeps the queue picked for its route, so all
+		 * its packets share one queue lock.
+		 */
+		queue_index = sk_tx_queue_get(sk);
+		if (queue_index < 0 ||
+		    queue_index >= dev->real_num_tx_queues) {
+			queue_index = get_xps_queue(dev, skb);
+			if (queue_index < 0)
+				queue_index = skb_tx_hash(dev, skb);
+
+			if (sk && sk->sk_dst_cache == skb_dst(skb))
+				sk_tx_queue_set(sk, queue_index);
+		}
+	}
 
 	skb_set_queue_mapping(skb, queue_index);
 	return netdev_get_tx_queue(dev, queue_index);
@@ -1831,6 +1892,25 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 	spinlock_t *root_lock = qdisc_lock(q);
 	int rc;
 
+	/*
+	 * A lockless qdisc is filled without the root lock; only the CPU
+	 * that wins __QDISC_STATE_RUNNING takes it, to drain the queue.
+	 */
+	if (q->flags & TCQ_F_NOLOCK) {
+		if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
+			kfree_skb(skb);
+			return NET_XMIT_DROP;
+		}
+
+		rc = qdisc_enqueue_root(skb, q);
+		if (!test_and_set_bit(__QDISC_STATE_RUNNING, &q->state)) {
+			spin_lock(root_lock);
+			__qdisc_run(q);
+			spin_unlock(root_lock);
+		}
+		return rc;
+	}
+
 	spin_lock(root_lock);
 	if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
 		kfree_skb(skb);
@@ -1954,7 +2034,7 @@ gso:
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				rc = NET_XMIT_SUCCESS;
 				if (!dev_hard_start_xmit(skb, dev, txq)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -1997,60 +2077,351 @@ int weight_p __read_mostly = 64;            /* old backlog weight */
 
 DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
+static u32 hashrnd __read_mostly;
 
-/**
- *	netif_rx	-	post buffer to the network code
- *	@skb: buffer to post
- *
- *	This function receives a packet from a device driver and queues it for
- *	the upper (protocol) levels to process.  It always succeeds. The buffer
- *	may be dropped during processing for congestion control or by the
- *	protocol layers.
- *
- *	return values:
- *	NET_RX_SUCCESS	(no congestion)
- *	NET_RX_DROP     (packet was dropped)
+/*
+ * Flow hash over the addresses and, for unfragmented packets, the ports
+ * of an IPv4 or IPv6 packet whose network header is at skb->data.
+ * Returns 0 for anything else.
+ */
+__u32 __skb_get_rxhash(struct sk_buff *skb)
+{
+	struct ipv6hdr *ip6;
+	struct iphdr *ip;
+	u8 ip_proto;
+	u32 addr1, addr2, ihl, hash;
+	union {
+		u32 v32;
+		u16 v16[2];
+	} ports;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+		if (!pskb_may_pull(skb, sizeof(*ip)))
+			return 0;
+
+		ip = (struct iphdr *) skb->data;
+		ip_proto = ip->protocol;
+		addr1 = (__force u32) ip->saddr;
+		addr2 = (__force u32) ip->daddr;
+		ihl = ip->ihl;
+		if (ip->frag_off & htons(IP_MF | IP_OFFSET))
+			ip_proto = 0;
+		break;
+	case __constant_htons(ETH_P_IPV6):
+		if (!pskb_may_pull(skb, sizeof(*ip6)))
+			return 0;
+
+		ip6 = (struct ipv6hdr *) skb->data;
+		ip_proto = ip6->nexthdr;
+		addr1 = (__force u32) ip6->saddr.s6_addr32[3];
+		addr2 = (__force u32) ip6->daddr.s6_addr32[3];
+		ihl = (40 >> 2);
+		break;
+	default:
+		return 0;
+	}
+
+	ports.v32 = 0;
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_ESP:
+	case IPPROTO_AH:
+	case IPPROTO_SCTP:
+	case IPPROTO_UDPLITE:
+		if (pskb_may_pull(skb, (ihl * 4) + 4))
+			ports.v32 = *(__force u32 *) (skb->data + (ihl * 4));
+		break;
+	default:
+		break;
+	}
+
+	hash = jhash_3words(addr1, addr2, ports.v32, hashrnd);
+	return hash ? : 1;
+}
+EXPORT_SYMBOL(__skb_get_rxhash);
+
+#ifdef CONFIG_RPS
+/* One global table for all flow-based rules */
+struct rps_sock_flow_table *rps_sock_flow_table __read_mostly;
+EXPORT_SYMBOL(rps_sock_flow_table);
+
+/*
+ * get_rps_cpu is called from netif_receive_skb and netif_rx and returns
+ * the target CPU, or -1 to process the packet where it is.
  *
+ * The flow hash (see __skb_get_rxhash) is kept in skb->rxhash.  If the flow has been read by an application
+ * (rps_sock_flow_table) it goes to the CPU that application last ran
+ * on.  Otherwise the hash indexes the device's RPS map, so a flow
+ * always lands on one CPU.  Must be called under rcu_read_lock.
  */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
+		       struct rps_dev_flow **rflowp)
+{
+	struct rps_map *map;
+	struct rps_dev_flow_table *flow_table;
+	struct rps_sock_flow_table *sock_flow_table;
+	int cpu = -1;
+	u16 tcpu;
+
+	map = rcu_dereference(dev->rps_map);
+	flow_table = rcu_dereference(dev->rps_flow_table);
+	if (!map && !flow_table)
+		goto done;
+
+	if (map && map->len == 1 && !flow_table) {
+		tcpu = map->cpus[0];
+		if (cpu_online(tcpu))
+			cpu = tcpu;
+		goto done;
+	}
 
-int netif_rx(struct sk_buff *skb)
+	if (!skb_get_rxhash(skb))
+		goto done;
+
+	sock_flow_table = rcu_dereference(rps_sock_flow_table);
+	if (flow_table && sock_flow_table) {
+		struct rps_dev_flow *rflow;
+		u16 next_cpu;
+
+		rflow = &flow_table->flows[skb->rxhash & flow_table->mask];
+		tcpu = rflow->cpu;
+
+		next_cpu = sock_flow_table->ents[skb->rxhash &
+		    sock_flow_table->mask];
+
+		/*
+		 * If the desired CPU (where last recvmsg was done) is
+		 * different from current CPU (one in the rx-queue flow
+		 * table entry), switch if one of the following holds:
+		 *   - Current CPU is unset (equal to RPS_NO_CPU).
+		 *   - Current CPU is offline.
+		 *   - The current CPU's queue tail has advanced beyond the
+		 *     last packet that was enqueued using this table entry.
+		 *     This guarantees that all previous packets for the flow
+		 *     have been dequeued, thus preserving in order delivery.
+		 */
+		if (unlikely(tcpu != next_cpu) &&
+		    (tcpu == RPS_NO_CPU || !cpu_online(tcpu) ||
+		     ((int)(per_cpu(softnet_data, tcpu).input_queue_head -
+		      rflow->last_qtail)) >= 0)) {
+			tcpu = rflow->cpu = next_cpu;
+			if (tcpu != RPS_NO_CPU)
+				rflow->last_qtail = per_cpu(softnet_data,
+				    tcpu).input_queue_head;
+		}
+		if (tcpu != RPS_NO_CPU && cpu_online(tcpu)) {
+			*rflowp = rflow;
+			cpu = tcpu;
+			goto done;
+		}
+	}
+
+	if (map) {
+		tcpu = map->cpus[((u64) skb->rxhash * map->len) >> 32];
+		if (cpu_online(tcpu))
+			cpu = tcpu;
+	}
+
+done:
+	return cpu;
+}
+
+/*
+ * The input queue lock also orders a remote enqueue against the owning
+ * CPU completing its backlog NAPI.
+ */
+static inline void rps_lock(struct softnet_data *queue)
+{
+	spin_lock(&queue->input_pkt_queue.lock);
+}
+
+static inline void rps_unlock(struct softnet_data *queue)
+{
+	spin_unlock(&queue->input_pkt_queue.lock);
+}
+
+static inline void input_queue_head_incr(struct softnet_data *queue)
+{
+	queue->input_queue_head++;
+}
+
+static inline unsigned int input_queue_tail(struct softnet_data *queue)
+{
+	return queue->input_queue_head + queue->input_pkt_queue.qlen;
+}
+
+/* Called from hardirq (IPI) context on the target CPU */
+static void rps_trigger_softirq(void *data)
+{
+	struct softnet_data *queue = data;
+
+	__napi_schedule(&queue->backlog);
+	__get_cpu_var(netdev_rx_stat).received_rps++;
+}
+
+/*
+ * Schedule the backlog of @queue.  A remote one is only queued for an
+ * IPI here; net_rx_action sends them once per softirq run, so a burst
+ * steered to one CPU costs a single interrupt there.
+ */
+static void rps_schedule_backlog(struct softnet_data *queue)
+{
+	struct softnet_data *mysd = &__get_cpu_var(softnet_data);
+
+	if (queue != mysd) {
+		queue->rps_ipi_next = mysd->rps_ipi_list;
+		mysd->rps_ipi_list = queue;
+		__raise_softirq_irqoff(NET_RX_SOFTIRQ);
+	} else
+		__napi_schedule(&queue->backlog);
+}
+
+/*
+ * Send the pending RPS IPIs of this CPU and re-enable interrupts.
+ */
+static void net_rps_action_and_irq_enable(struct softnet_data *sd)
+{
+	struct softnet_data *remsd = sd->rps_ipi_list;
+
+	if (remsd) {
+		sd->rps_ipi_list = NULL;
+
+		local_irq_enable();
+
+		while (remsd) {
+			struct softnet_data *next = remsd->rps_ipi_next;
+
+			if (cpu_online(remsd->cpu))
+				__smp_call_function_single(remsd->cpu,
+							   &remsd->csd, 0);
+			remsd = next;
+		}
+	} else
+		local_irq_enable();
+}
+#else
+static inline int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
+			      struct rps_dev_flow **rflowp)
+{
+	return -1;
+}
+
+static inline void rps_lock(struct softnet_data *queue)
+{
+}
+
+static inline void rps_unlock(struct softnet_data *queue)
+{
+}
+
+static inline void input_queue_head_incr(struct softnet_data *queue)
+{
+}
+
+static inline unsigned int input_queue_tail(struct softnet_data *queue)
+{
+	return 0;
+}
+
+static inline void rps_schedule_backlog(struct softnet_data *queue)
+{
+	__napi_schedule(&queue->backlog);
+}
+
+static inline void net_rps_action_and_irq_enable(struct softnet_data *sd)
+{
+	local_irq_enable();
+}
+#endif
+
+/*
+ * enqueue_to_backlog is called to queue an skb to the backlog of @cpu,
+ * which need not be the current one.  The queue's tail index after the
+ * enqueue is returned in @qtail.
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu,
+			      unsigned int *qtail)
 {
 	struct softnet_data *queue;
 	unsigned long flags;
 
-	/* if netpoll wants it, pretend we never saw it */
-	if (netpoll_rx(skb))
-		return NET_RX_DROP;
-
-	if (!skb->tstamp.tv64)
-		net_timestamp(skb);
+	queue = &per_cpu(softnet_data, cpu);
 
 	/*
 	 * The code is rearranged so that the path is the most
 	 * short when CPU is congested, but is still operating.
 	 */
 	local_irq_save(flags);
-	queue = &__get_cpu_var(softnet_data);
-
 	__get_cpu_var(netdev_rx_stat).total++;
+
+	rps_lock(queue);
 	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
 		if (queue->input_pkt_queue.qlen) {
 enqueue:
 			__skb_queue_tail(&queue->input_pkt_queue, skb);
+			*qtail = input_queue_tail(queue);
+			rps_unlock(queue);
 			local_irq_restore(flags);
 			return NET_RX_SUCCESS;
 		}
 
-		napi_schedule(&queue->backlog);
+		if (napi_schedule_prep(&queue->backlog))
+			rps_schedule_backlog(queue);
 		goto enqueue;
 	}
 
+	rps_unlock(queue);
 	__get_cpu_var(netdev_rx_stat).dropped++;
 	local_irq_restore(flags);
 
 	kfree_skb(skb);
 	return NET_RX_DROP;
 }
+
+/**
+ *	netif_rx	-	post buffer to the network code
+ *	@skb: buffer to post
+ *
+ *	This function receives a packet from a device driver and queues it for
+ *	the upper (protocol) levels to process.  It always succeeds. The buffer
+ *	may be dropped during processing for congestion control or by the
+ *	protocol layers.
+ *
+ *	return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_DROP     (packet was dropped)
+ *
+ */
+
+int netif_rx(struct sk_buff *skb)
+{
+	struct rps_dev_flow voidflow, *rflow = &voidflow;
+	int cpu, ret;
+
+	/* if netpoll wants it, pretend we never saw it */
+	if (netpoll_rx(skb))
+		return NET_RX_DROP;
+
+	if (!skb->tstamp.tv64)
+		net_timestamp(skb);
+
+	preempt_disable();
+	rcu_read_lock();
+
+	cpu = get_rps_cpu(skb->dev, skb, &rflow);
+	if (cpu < 0)
+		cpu = smp_processor_id();
+
+	ret = enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
+
+	rcu_read_unlock();
+	preempt_enable();
+
+	return ret;
+}
 EXPORT_SYMBOL(netif_rx);
 
 int netif_rx_ni(struct sk_buff *skb)
@@ -2286,22 +2657,7 @@ void netif_nit_deliver(struct sk_buff *skb)
 	rcu_read_unlock();
 }
 
-/**
- *	netif_receive_skb - process receive buffer from network
- *	@skb: buffer to process
- *
- *	netif_receive_skb() is the main receive data processing function.
- *	It always succeeds. The buffer may be dropped during processing
- *	for congestion control or by the protocol layers.
- *
- *	This function may only be called from softirq context and interrupts
- *	should be enabled.
- *
- *	Return values (usually ignored):
- *	NET_RX_SUCCESS: no congestion
- *	NET_RX_DROP: packet was dropped
- */
-int netif_receive_skb(struct sk_buff *skb)
+static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
 	struct net_device *orig_dev;
@@ -2397,6 +2753,46 @@ out:
 	rcu_read_unlock();
 	return ret;
 }
+
+/**
+ *	netif_receive_skb - process receive buffer from network
+ *	@skb: buffer to process
+ *
+ *	netif_receive_skb() is the main receive data processing function.
+ *	It always succeeds. The buffer may be dropped during processing
+ *	for congestion control or by the protocol layers.
+ *
+ *	If the device has an RPS map the packet is queued to the backlog of
+ *	the CPU its flow hashes to and processed there instead.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ *
+ *	Return values (usually ignored):
+ *	NET_RX_SUCCESS: no congestion
+ *	NET_RX_DROP: packet was dropped
+ */
+int netif_receive_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_RPS
+	struct rps_dev_flow voidflow, *rflow = &voidflow;
+	int cpu;
+
+	if (!skb->tstamp.tv64)
+		net_timestamp(skb);
+
+	rcu_read_lock();
+	cpu = get_rps_cpu(skb->dev, skb, &rflow);
+	if (cpu >= 0 && cpu != smp_processor_id()) {
+		int ret = enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
+
+		rcu_read_unlock();
+		return ret;
+	}
+	rcu_read_unlock();
+#endif
+	return __netif_receive_skb(skb);
+}
 EXPORT_SYMBOL(netif_receive_skb);
 
 /* Network device is going away, flush any packets still pending  */
@@ -2406,11 +2802,14 @@ static void flush_backlog(void *arg)
 	struct softnet_data *queue = &__get_cpu_var(softnet_data);
 	struct sk_buff *skb, *tmp;
 
+	rps_lock(queue);
 	skb_queue_walk_safe(&queue->input_pkt_queue, skb, tmp)
 		if (skb->dev == dev) {
 			__skb_unlink(skb, &queue->input_pkt_queue);
 			kfree_skb(skb);
+			input_queue_head_incr(queue);
 		}
+	rps_unlock(queue);
 }
 
 static int napi_gro_complete(struct sk_buff *skb)
@@ -2487,6 +2886,7 @@ int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encap_mark = 0;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -2725,7 +3125,8 @@ EXPORT_SYMBOL(napi_gro_frags);
 static int process_backlog(struct napi_struct *napi, int quota)
 {
 	int work = 0;
-	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+	struct softnet_data *queue = container_of(napi, struct softnet_data,
+						  backlog);
 	unsigned long start_time = jiffies;
 
 	napi->weight = weight_p;
@@ -2733,15 +3134,19 @@ static int process_backlog(struct napi_struct *napi, int quota)
 		struct sk_buff *skb;
 
 		local_irq_disable();
+		rps_lock(queue);
 		skb = __skb_dequeue(&queue->input_pkt_queue);
 		if (!skb) {
 			__napi_complete(napi);
+			rps_unlock(queue);
 			local_irq_enable();
 			break;
 		}
+		input_queue_head_incr(queue);
+		rps_unlock(queue);
 		local_irq_enable();
 
-		netif_receive_skb(skb);
+		__netif_receive_skb(skb);
 	} while (++work < quota && jiffies == start_time);
 
 	return work;
@@ -2807,6 +3212,9 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 #ifdef CONFIG_NETPOLL
 	spin_lock_init(&napi->poll_lock);
 	napi->poll_owner = -1;
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	napi->napi_id = 0;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
 }
@@ -2830,10 +3238,143 @@ void netif_napi_del(struct napi_struct *napi)
 }
 EXPORT_SYMBOL(netif_napi_del);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+
+/* Keeps each busy poll short, a busy queue is left to the softirq */
+#define BUSY_POLL_BUDGET	8
+
+#define NAPI_HASH_BITS		8
+#define NAPI_HASH_SIZE		(1 << NAPI_HASH_BITS)
+
+static struct hlist_head napi_hash[NAPI_HASH_SIZE];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+static struct hlist_head *napi_hash_bucket(unsigned int napi_id)
+{
+	return &napi_hash[napi_id & (NAPI_HASH_SIZE - 1)];
+}
+
+/* Called under rcu_read_lock() or napi_hash_lock */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node, napi_hash_bucket(napi_id),
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+
+void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	/* 0 means no napi context to the sockets and packets */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+
+	napi->napi_id = napi_gen_id;
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   napi_hash_bucket(napi->napi_id));
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+void napi_hash_del(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	if (napi->napi_id) {
+		hlist_del_rcu(&napi->napi_hash_node);
+		napi->napi_id = 0;
+	}
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
+
+static inline u64 busy_loop_us_clock(void)
+{
+	return sched_clock() >> 10;
+}
+
+/*
+ * Run @napi's poll routine once from process context, as net_rx_action()
+ * would.  The napi context is only taken when nobody else owns it: not
+ * scheduled for the softirq, being disabled or polled by netpoll.
+ */
+static void napi_busy_poll_once(struct napi_struct *napi)
+{
+	LIST_HEAD(owner);
+	void *have;
+
+	local_bh_disable();
+
+	if (test_bit(NAPI_STATE_DISABLE, &napi->state) ||
+	    test_and_set_bit(NAPI_STATE_SCHED, &napi->state))
+		goto out;
+
+	have = netpoll_poll_lock(napi);
+
+	/* napi_complete() takes the context off whatever list it is on */
+	list_add(&napi->poll_list, &owner);
+	napi->poll(napi, BUSY_POLL_BUDGET);
+	trace_napi_poll(napi);
+
+	/* Still ours: there is more to do, leave it to the softirq */
+	if (!list_empty(&owner)) {
+		list_del(&napi->poll_list);
+		__napi_schedule(napi);
+	}
+
+	netpoll_poll_unlock(have);
+out:
+	local_bh_enable();
+}
+
+bool __sk_busy_loop(struct sock *sk, unsigned int usecs)
+{
+	u64 end_time = busy_loop_us_clock() + usecs;
+	struct napi_struct *napi;
+	bool rc = false;
+
+	rcu_read_lock();
+
+	napi = napi_by_id(sk->sk_napi_id);
+	if (!napi)
+		goto out;
+
+	for (;;) {
+		napi_busy_poll_once(napi);
+
+		rc = !skb_queue_empty(&sk->sk_receive_queue);
+		if (rc || !usecs || busy_loop_us_clock() >= end_time ||
+		    need_resched() || signal_pending(current))
+			break;
+
+		cpu_relax();
+	}
+out:
+	rcu_read_unlock();
+	return rc;
+}
+EXPORT_SYMBOL(__sk_busy_loop);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 
 static void net_rx_action(struct softirq_action *h)
 {
-	struct list_head *list = &__get_cpu_var(softnet_data).poll_list;
+	struct softnet_data *sd = &__get_cpu_var(softnet_data);
+	struct list_head *list = &sd->poll_list;
 	unsigned long time_limit = jiffies + 2;
 	int budget = netdev_budget;
 	void *have;
@@ -2899,7 +3440,7 @@ static void net_rx_action(struct softirq_action *h)
 		netpoll_poll_unlock(have);
 	}
 out:
-	local_irq_enable();
+	net_rps_action_and_irq_enable(sd);
 
 #ifdef CONFIG_NET_DMA
 	/*
@@ -3143,10 +3684,10 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct netif_rx_stats *s = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
 		   s->total, s->dropped, s->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   s->cpu_collision);
+		   s->cpu_collision, s->received_rps);
 	return 0;
 }
 
@@ -5133,6 +5674,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 				  void *_unused)
 {
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static void netdev_init_queues(struct net_device *dev)
@@ -5233,6 +5777,19 @@ void free_netdev(struct net_device *dev)
 	release_net(dev_net(dev));
 
 	kfree(dev->_tx);
+#ifdef CONFIG_RPS
+	kfree(dev->rps_map);
+	vfree(dev->rps_flow_table);
+#endif
+#ifdef CONFIG_XPS
+	if (dev->xps_maps) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			kfree(dev->xps_maps->cpu_map[cpu]);
+		kfree(dev->xps_maps);
+	}
+#endif
 
 	/* Flush device addresses */
 	dev_addr_flush(dev);
@@ -5447,6 +6004,7 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 {
 	struct sk_buff **list_skb;
 	struct Qdisc **list_net;
+	struct sk_buff_head backlog;
 	struct sk_buff *skb;
 	unsigned int cpu, oldcpu = (unsigned long)ocpu;
 	struct softnet_data *sd, *oldsd;
@@ -5475,11 +6033,34 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 	*list_net = oldsd->output_queue;
 	oldsd->output_queue = NULL;
 
+	/*
+	 * Take over the offline CPU's NAPI poll list.  Its backlog is
+	 * drained below, just forget it was scheduled.
+	 */
+	while (!list_empty(&oldsd->poll_list)) {
+		struct napi_struct *napi = list_first_entry(&oldsd->poll_list,
+							    struct napi_struct,
+							    poll_list);
+
+		list_del_init(&napi->poll_list);
+		if (napi == &oldsd->backlog)
+			clear_bit(NAPI_STATE_SCHED, &napi->state);
+		else
+			list_add_tail(&napi->poll_list, &sd->poll_list);
+	}
+
+	/* Steal the offline CPU's input_pkt_queue */
+	__skb_queue_head_init(&backlog);
+	rps_lock(oldsd);
+	skb_queue_splice_init(&oldsd->input_pkt_queue, &backlog);
+	rps_unlock(oldsd);
+
 	raise_softirq_irqoff(NET_TX_SOFTIRQ);
+	raise_softirq_irqoff(NET_RX_SOFTIRQ);
 	local_irq_enable();
 
 	/* Process offline CPU's input_pkt_queue */
-	while ((skb = __skb_dequeue(&oldsd->input_pkt_queue)))
+	while ((skb = __skb_dequeue(&backlog)))
 		netif_rx(skb);
 
 	return NOTIFY_OK;
@@ -5686,6 +6267,15 @@ static int __init net_dev_init(void)
 		queue->backlog.weight = weight_p;
 		queue->backlog.gro_list = NULL;
 		queue->backlog.gro_count = 0;
+		INIT_LIST_HEAD(&queue->backlog.poll_list);
+
+#ifdef CONFIG_RPS
+		queue->csd.func = rps_trigger_softirq;
+		queue->csd.info = queue;
+		queue->csd.flags = 0;
+		queue->rps_ipi_list = NULL;
+		queue->cpu = i;
+#endif
 	}
 
 	dev_boot_phase = 0;
@@ -5721,6 +6311,7 @@ subsys_initcall(net_dev_init);
 static int __init initialize_hashrnd(void)
 {
 	get_random_bytes(&skb_tx_hashrnd, sizeof(skb_tx_hashrnd));
+	get_random_bytes(&hashrnd, sizeof(hashrnd));
 	return 0;
 }
 
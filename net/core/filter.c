@@ -64,6 +64,90 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/*
+ * Ancillary data, which are impossible (or very difficult) to get
+ * parsing packet contents.  Returns -1 for an unknown offset or a
+ * malformed attribute, the filter then returns 0.
+ */
+static int load_ancillary(struct sk_buff *skb, int k, u32 A, u32 X, u32 *res)
+{
+	struct nlattr *nla;
+
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*res = ntohs(skb->protocol);
+		return 0;
+	case SKF_AD_PKTTYPE:
+		*res = skb->pkt_type;
+		return 0;
+	case SKF_AD_IFINDEX:
+		*res = skb->dev->ifindex;
+		return 0;
+	case SKF_AD_NLATTR:
+		if (skb_is_nonlinear(skb))
+			return -1;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -1;
+
+		nla = nla_find((struct nlattr *)&skb->data[A],
+			       skb->len - A, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	case SKF_AD_NLATTR_NEST:
+		if (skb_is_nonlinear(skb))
+			return -1;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -1;
+
+		nla = (struct nlattr *)&skb->data[A];
+		if (nla->nla_len > A - skb->len)
+			return -1;
+
+		nla = nla_find_nested(nla, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+#ifdef CONFIG_BPF_JIT
+/*
+ * Load for JIT compiled filters when the data is not in the linear
+ * part of the skb or @k is negative: the value loaded, or -1 if the
+ * filter is to return 0.  @size 0 is the byte load of
+ * BPF_LDX|BPF_B|BPF_MSH, which does not see ancillary data.
+ */
+s64 sk_filter_load_slow(struct sk_buff *skb, int k, unsigned int size,
+			u32 A, u32 X)
+{
+	void *ptr;
+	u32 tmp;
+
+	ptr = load_pointer(skb, k, size ? size : 1, &tmp);
+	if (ptr != NULL) {
+		switch (size) {
+		case 4:
+			return get_unaligned_be32(ptr);
+		case 2:
+			return get_unaligned_be16(ptr);
+		default:
+			return *(u8 *)ptr;
+		}
+	}
+
+	if (!size || load_ancillary(skb, k, A, X, &tmp))
+		return -1;
+	return tmp;
+}
+#endif
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +172,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -297,58 +380,10 @@ load_b:
 			return 0;
 		}
 
-		/*
-		 * Handle ancillary data, which are impossible
-		 * (or very difficult) to get parsing packet contents.
-		 */
-		switch (k-SKF_AD_OFF) {
-		case SKF_AD_PROTOCOL:
-			A = ntohs(skb->protocol);
-			continue;
-		case SKF_AD_PKTTYPE:
-			A = skb->pkt_type;
-			continue;
-		case SKF_AD_IFINDEX:
-			A = skb->dev->ifindex;
-			continue;
-		case SKF_AD_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		case SKF_AD_NLATTR_NEST: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
-				return 0;
-
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		default:
+		/* The load failed, it may be of ancillary data */
+		if (load_ancillary(skb, k, A, X, &tmp))
 			return 0;
-		}
+		A = tmp;
 	}
 
 	return 0;
@@ -515,6 +550,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -522,6 +558,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
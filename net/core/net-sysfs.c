@@ -10,12 +10,14 @@
  */
 
 #include <linux/capability.h>
+#include <linux/ctype.h>
 #include <linux/kernel.h>
 #include <linux/netdevice.h>
 #include <linux/if_arp.h>
 #include <net/sock.h>
 #include <linux/rtnetlink.h>
 #include <linux/wireless.h>
+#include <linux/vmalloc.h>
 #include <net/wext.h>
 
 #include "net-sysfs.h"
@@ -247,6 +249,420 @@ static ssize_t show_ifalias(struct device *dev,
 	return ret;
 }
 
+#ifdef CONFIG_RPS
+static ssize_t show_rps_cpus(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *map;
+	cpumask_var_t mask;
+	size_t len;
+	int i;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	rcu_read_lock();
+	map = rcu_dereference(net->rps_map);
+	if (map)
+		for (i = 0; i < map->len; i++)
+			cpumask_set_cpu(map->cpus[i], mask);
+	rcu_read_unlock();
+
+	len = cpumask_scnprintf(buf, PAGE_SIZE - 1, mask);
+	len += sprintf(buf + len, "\n");
+	free_cpumask_var(mask);
+	return len;
+}
+
+static void rps_map_release(struct rcu_head *rcu)
+{
+	struct rps_map *map = container_of(rcu, struct rps_map, rcu);
+
+	kfree(map);
+}
+
+/* Only the online CPUs of the written mask make it into the map */
+static ssize_t store_rps_cpus(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *old_map, *map;
+	cpumask_var_t mask;
+	int err, cpu, i;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = bitmap_parse(buf, len, cpumask_bits(mask), nr_cpumask_bits);
+	if (err) {
+		free_cpumask_var(mask);
+		return err;
+	}
+
+	map = kzalloc(max_t(unsigned, RPS_MAP_SIZE(cpumask_weight(mask)),
+			    L1_CACHE_BYTES), GFP_KERNEL);
+	if (!map) {
+		free_cpumask_var(mask);
+		return -ENOMEM;
+	}
+
+	i = 0;
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		map->cpus[i++] = cpu;
+
+	if (i)
+		map->len = i;
+	else {
+		kfree(map);
+		map = NULL;
+	}
+	free_cpumask_var(mask);
+
+	if (!rtnl_trylock()) {
+		kfree(map);
+		return restart_syscall();
+	}
+	old_map = net->rps_map;
+	rcu_assign_pointer(net->rps_map, map);
+	rtnl_unlock();
+
+	if (old_map)
+		call_rcu(&old_map->rcu, rps_map_release);
+
+	return len;
+}
+
+static ssize_t show_rps_flow_cnt(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_dev_flow_table *flow_table;
+	unsigned int val = 0;
+
+	rcu_read_lock();
+	flow_table = rcu_dereference(net->rps_flow_table);
+	if (flow_table)
+		val = flow_table->mask + 1;
+	rcu_read_unlock();
+
+	return sprintf(buf, "%u\n", val);
+}
+
+/* The count is rounded up to a power of two, 0 disables flow steering */
+static ssize_t store_rps_flow_cnt(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_dev_flow_table *table, *old_table;
+	unsigned long count, i;
+	char *endp;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	count = simple_strtoul(buf, &endp, 0);
+	if (endp == buf)
+		return -EINVAL;
+
+	if (count) {
+		if (count > 1 << 30) {
+			/* Enforce a limit to prevent overflow */
+			return -EINVAL;
+		}
+		count = roundup_pow_of_two(count);
+		table = vmalloc(RPS_DEV_FLOW_TABLE_SIZE(count));
+		if (!table)
+			return -ENOMEM;
+
+		table->mask = count - 1;
+		for (i = 0; i < count; i++)
+			table->flows[i].cpu = RPS_NO_CPU;
+	} else
+		table = NULL;
+
+	if (!rtnl_trylock()) {
+		vfree(table);
+		return restart_syscall();
+	}
+	old_table = net->rps_flow_table;
+	rcu_assign_pointer(net->rps_flow_table, table);
+	rtnl_unlock();
+
+	if (old_table) {
+		synchronize_rcu();
+		vfree(old_table);
+	}
+
+	return len;
+}
+#endif
+
+#ifdef CONFIG_XPS
+/*
+ * 2.6.32 has no per-queue kobjects, so all of a device's XPS maps live
+ * in one attribute: one "<queue> <cpumask>" line per tx queue is shown,
+ * and writing such a line sets the CPUs of that queue.
+ */
+static ssize_t show_xps_cpus(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct xps_dev_maps *dev_maps;
+	cpumask_var_t mask;
+	unsigned int index;
+	size_t len = 0;
+	int i, cpu;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(net->xps_maps);
+	for (index = 0; index < net->real_num_tx_queues; index++) {
+		cpumask_clear(mask);
+		if (dev_maps) {
+			for_each_possible_cpu(cpu) {
+				struct xps_map *map;
+
+				map = rcu_dereference(dev_maps->cpu_map[cpu]);
+				if (!map)
+					continue;
+				for (i = map->len; i--;) {
+					if (map->queues[i] == index) {
+						cpumask_set_cpu(cpu, mask);
+						break;
+					}
+				}
+			}
+		}
+
+		if (PAGE_SIZE - len < 16)
+			break;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u ", index);
+		len += cpumask_scnprintf(buf + len, PAGE_SIZE - len - 1, mask);
+		len += sprintf(buf + len, "\n");
+	}
+	rcu_read_unlock();
+
+	free_cpumask_var(mask);
+	return len;
+}
+
+static void xps_dev_maps_release(struct rcu_head *rcu)
+{
+	struct xps_dev_maps *dev_maps =
+	    container_of(rcu, struct xps_dev_maps, rcu);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(dev_maps->cpu_map[cpu]);
+	kfree(dev_maps);
+}
+
+static ssize_t store_xps_cpus(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct xps_dev_maps *dev_maps, *new_dev_maps;
+	struct xps_map *map, *new_map;
+	unsigned long index;
+	cpumask_var_t mask;
+	bool nonempty = false;
+	char *endp;
+	int err, cpu, i, pos, nr;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	index = simple_strtoul(buf, &endp, 0);
+	if (endp == buf || !isspace(*endp))
+		return -EINVAL;
+	while (isspace(*endp))
+		endp++;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	err = bitmap_parse(endp, len - (endp - buf), cpumask_bits(mask),
+			   nr_cpumask_bits);
+	if (err)
+		goto out_free_mask;
+
+	new_dev_maps = kzalloc(max_t(unsigned, XPS_DEV_MAPS_SIZE,
+				     L1_CACHE_BYTES), GFP_KERNEL);
+	if (!new_dev_maps) {
+		err = -ENOMEM;
+		goto out_free_mask;
+	}
+
+	if (!rtnl_trylock()) {
+		kfree(new_dev_maps);
+		free_cpumask_var(mask);
+		return restart_syscall();
+	}
+
+	err = -EINVAL;
+	if (index >= net->num_tx_queues)
+		goto out_unlock;
+
+	/* Rebuild every CPU's map with @index in it exactly where asked */
+	dev_maps = net->xps_maps;
+	for_each_possible_cpu(cpu) {
+		map = dev_maps ? dev_maps->cpu_map[cpu] : NULL;
+
+		nr = map ? map->len : 0;
+		new_map = kzalloc(XPS_MAP_SIZE(nr + 1), GFP_KERNEL);
+		if (!new_map) {
+			err = -ENOMEM;
+			goto out_unlock;
+		}
+
+		for (i = 0, pos = 0; i < nr; i++)
+			if (map->queues[i] != index)
+				new_map->queues[pos++] = map->queues[i];
+		if (cpumask_test_cpu(cpu, mask))
+			new_map->queues[pos++] = index;
+
+		if (pos) {
+			new_map->len = pos;
+			new_dev_maps->cpu_map[cpu] = new_map;
+			nonempty = true;
+		} else
+			kfree(new_map);
+	}
+
+	if (!nonempty) {
+		kfree(new_dev_maps);
+		new_dev_maps = NULL;
+	}
+
+	rcu_assign_pointer(net->xps_maps, new_dev_maps);
+	rtnl_unlock();
+
+	if (dev_maps)
+		call_rcu(&dev_maps->rcu, xps_dev_maps_release);
+
+	free_cpumask_var(mask);
+	return len;
+
+out_unlock:
+	rtnl_unlock();
+	for_each_possible_cpu(cpu)
+		kfree(new_dev_maps->cpu_map[cpu]);
+	kfree(new_dev_maps);
+out_free_mask:
+	free_cpumask_var(mask);
+	return err;
+}
+#endif
+
+#ifdef CONFIG_BQL
+/*
+ * Byte queue limits.  The limit_max, limit_min and hold_time knobs
+ * apply to every tx queue of the device and show queue 0's settings;
+ * bql_inflight shows "<queue> <limit> <inflight>" per queue.
+ */
+static ssize_t bql_show(struct device *dev, char *buf, size_t offset)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct dql *dql = &netdev_get_tx_queue(net, 0)->dql;
+
+	return sprintf(buf, "%u\n", *(unsigned int *)((char *)dql + offset));
+}
+
+static ssize_t bql_set(struct device *dev, const char *buf, size_t len,
+		       size_t offset, unsigned long max, bool ms)
+{
+	struct net_device *net = to_net_dev(dev);
+	unsigned long value;
+	unsigned int i;
+	char *endp;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!strncmp(buf, "max", 3))
+		value = max;
+	else {
+		value = simple_strtoul(buf, &endp, 0);
+		if (endp == buf || value > max)
+			return -EINVAL;
+	}
+	if (ms)
+		value = msecs_to_jiffies(value);
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+	for (i = 0; i < net->num_tx_queues; i++) {
+		struct dql *dql = &netdev_get_tx_queue(net, i)->dql;
+
+		*(unsigned int *)((char *)dql + offset) = value;
+	}
+	rtnl_unlock();
+
+	return len;
+}
+
+#define BQL_ATTR(NAME, FIELD)						\
+static ssize_t show_bql_##NAME(struct device *dev,			\
+			       struct device_attribute *attr, char *buf) \
+{									\
+	return bql_show(dev, buf, offsetof(struct dql, FIELD));		\
+}									\
+static ssize_t store_bql_##NAME(struct device *dev,			\
+				struct device_attribute *attr,		\
+				const char *buf, size_t len)		\
+{									\
+	return bql_set(dev, buf, len, offsetof(struct dql, FIELD),	\
+		       DQL_MAX_LIMIT, false);				\
+}
+
+BQL_ATTR(limit_max, max_limit)
+BQL_ATTR(limit_min, min_limit)
+
+static ssize_t show_bql_hold_time(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct dql *dql = &netdev_get_tx_queue(net, 0)->dql;
+
+	return sprintf(buf, "%u\n", jiffies_to_msecs(dql->slack_hold_time));
+}
+
+static ssize_t store_bql_hold_time(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t len)
+{
+	return bql_set(dev, buf, len, offsetof(struct dql, slack_hold_time),
+		       UINT_MAX, true);
+}
+
+static ssize_t show_bql_inflight(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < net->real_num_tx_queues; i++) {
+		struct dql *dql = &netdev_get_tx_queue(net, i)->dql;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %u %u\n", i,
+				 dql->limit,
+				 dql->num_queued - dql->num_completed);
+	}
+
+	return len;
+}
+#endif
+
 static struct device_attribute net_class_attributes[] = {
 	__ATTR(addr_len, S_IRUGO, show_addr_len, NULL),
 	__ATTR(dev_id, S_IRUGO, show_dev_id, NULL),
@@ -265,6 +681,23 @@ static struct device_attribute net_class_attributes[] = {
 	__ATTR(flags, S_IRUGO | S_IWUSR, show_flags, store_flags),
 	__ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len,
 	       store_tx_queue_len),
+#ifdef CONFIG_RPS
+	__ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_cpus, store_rps_cpus),
+	__ATTR(rps_flow_cnt, S_IRUGO | S_IWUSR, show_rps_flow_cnt,
+	       store_rps_flow_cnt),
+#endif
+#ifdef CONFIG_XPS
+	__ATTR(xps_cpus, S_IRUGO | S_IWUSR, show_xps_cpus, store_xps_cpus),
+#endif
+#ifdef CONFIG_BQL
+	__ATTR(bql_limit_max, S_IRUGO | S_IWUSR, show_bql_limit_max,
+	       store_bql_limit_max),
+	__ATTR(bql_limit_min, S_IRUGO | S_IWUSR, show_bql_limit_min,
+	       store_bql_limit_min),
+	__ATTR(bql_hold_time, S_IRUGO | S_IWUSR, show_bql_hold_time,
+	       store_bql_hold_time),
+	__ATTR(bql_inflight, S_IRUGO, show_bql_inflight, NULL),
+#endif
 	{}
 };
 
@@ -205,8 +205,13 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 static struct proc_dir_entry *pg_proc_dir;
 
+#define PKTGEN_MAX_QUEUES 64	/* tx queues accounted one by one */
+#define PKTGEN_RX_QUEUES 16	/* rx queues accounted one by one */
+#define PKTGEN_LAT_BUCKETS 24	/* log2 latency histogram, in usecs */
+
 #define MAX_CFLOWS  65536
 
 #define VLAN_TAG_SIZE(x) ((x)->vlan_id == 0xffff ? 0 : 4)
@@ -372,6 +377,7 @@ struct pktgen_dev {
 
 	u16 queue_map_min;
 	u16 queue_map_max;
+	__u64 queue_sent[PKTGEN_MAX_QUEUES];	/* pkts sent per tx queue */
 
 #ifdef CONFIG_XFRM
 	__u8	ipsmode;		/* IPSEC mode (config) */
@@ -515,11 +521,250 @@ static const struct file_operations pktgen_fops = {
 	.release = single_release,
 };
 
+/*
+ * Receive side.  Once pointed at a device, pktgen counts the packets it
+ * generated (by their magic) arriving there: per rx queue, and by the
+ * latency from the timestamp the sender put in.  The latency only means
+ * something with clone_skb 0, when every packet is stamped anew, and a
+ * clock in sync with the sender's.
+ */
+struct pktgen_rx_stats {
+	u64 pkts;
+	u64 bytes;
+	u64 lat_sum;		/* usecs */
+	u32 lat_min;
+	u32 lat_max;
+	u64 lat_early;		/* stamped in our future */
+	u64 queue_pkts[PKTGEN_RX_QUEUES];
+	u64 lat_hist[PKTGEN_LAT_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct pktgen_rx_stats, pktgen_rx_stats);
+static struct net_device *pktgen_rx_dev;	/* under RTNL */
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_rx_stats *s;
+	struct pktgen_hdr _pgh, *pgh;
+	struct timeval now;
+	unsigned int off;
+	s64 lat;
+	u16 queue;
+
+	if (pt->type == htons(ETH_P_IP)) {
+		struct iphdr _iph, *iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (!iph || iph->protocol != IPPROTO_UDP)
+			goto out;
+		off = iph->ihl * 4;
+	} else {
+		struct ipv6hdr _ip6h, *ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (!ip6h || ip6h->nexthdr != IPPROTO_UDP)
+			goto out;
+		off = sizeof(*ip6h);
+	}
+
+	pgh = skb_header_pointer(skb, off + sizeof(struct udphdr),
+				 sizeof(_pgh), &_pgh);
+	if (!pgh || pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto out;
+
+	do_gettimeofday(&now);
+	lat = ((s64)now.tv_sec - ntohl(pgh->tv_sec)) * USEC_PER_SEC +
+	      (s64)now.tv_usec - ntohl(pgh->tv_usec);
+
+	queue = skb_rx_queue_recorded(skb) ? skb_get_rx_queue(skb) : 0;
+	if (queue >= PKTGEN_RX_QUEUES)
+		queue = PKTGEN_RX_QUEUES - 1;
+
+	s = &__get_cpu_var(pktgen_rx_stats);
+	if (lat < 0) {
+		s->lat_early++;
+		lat = 0;
+	}
+	if (lat > UINT_MAX)
+		lat = UINT_MAX;
+	if (!s->pkts || lat < s->lat_min)
+		s->lat_min = lat;
+	if (lat > s->lat_max)
+		s->lat_max = lat;
+	s->lat_sum += lat;
+	s->lat_hist[min(fls(lat), PKTGEN_LAT_BUCKETS - 1)]++;
+	s->queue_pkts[queue]++;
+	s->pkts++;
+	s->bytes += skb->len;
+out:
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct packet_type pktgen_rx_ip __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IP),
+	.func = pktgen_rcv,
+};
+
+static struct packet_type pktgen_rx_ipv6 __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IPV6),
+	.func = pktgen_rcv,
+};
+
+/* Called with RTNL held. */
+static void pktgen_rx_stop(void)
+{
+	if (!pktgen_rx_dev)
+		return;
+
+	dev_remove_pack(&pktgen_rx_ip);
+	dev_remove_pack(&pktgen_rx_ipv6);
+	dev_put(pktgen_rx_dev);
+	pktgen_rx_dev = NULL;
+}
+
+/* Called with RTNL held. */
+static int pktgen_rx_start(const char *ifname)
+{
+	struct net_device *dev = __dev_get_by_name(&init_net, ifname);
+
+	if (!dev)
+		return -ENODEV;
+
+	pktgen_rx_stop();
+
+	dev_hold(dev);
+	pktgen_rx_dev = dev;
+	pktgen_rx_ip.dev = dev;
+	pktgen_rx_ipv6.dev = dev;
+	dev_add_pack(&pktgen_rx_ip);
+	dev_add_pack(&pktgen_rx_ipv6);
+	return 0;
+}
+
+static void pktgen_rx_reset(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(pktgen_rx_stats, cpu), 0,
+		       sizeof(struct pktgen_rx_stats));
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	struct pktgen_rx_stats sum;
+	u64 avg;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		const struct pktgen_rx_stats *s = &per_cpu(pktgen_rx_stats, cpu);
+
+		if (!s->pkts)
+			continue;
+		if (!sum.pkts || s->lat_min < sum.lat_min)
+			sum.lat_min = s->lat_min;
+		if (s->lat_max > sum.lat_max)
+			sum.lat_max = s->lat_max;
+		sum.pkts += s->pkts;
+		sum.bytes += s->bytes;
+		sum.lat_sum += s->lat_sum;
+		sum.lat_early += s->lat_early;
+		for (i = 0; i < PKTGEN_RX_QUEUES; i++)
+			sum.queue_pkts[i] += s->queue_pkts[i];
+		for (i = 0; i < PKTGEN_LAT_BUCKETS; i++)
+			sum.lat_hist[i] += s->lat_hist[i];
+	}
+
+	rtnl_lock();
+	seq_printf(seq, "Receiving on: %s\n",
+		   pktgen_rx_dev ? pktgen_rx_dev->name : "none");
+	rtnl_unlock();
+
+	avg = sum.lat_sum;
+	if (sum.pkts)
+		do_div(avg, sum.pkts);
+	seq_printf(seq, "     pkts: %llu  bytes: %llu\n",
+		   (unsigned long long)sum.pkts,
+		   (unsigned long long)sum.bytes);
+	seq_printf(seq,
+		   "     latency min: %uus  avg: %lluus  max: %uus  early: %llu\n",
+		   sum.lat_min, (unsigned long long)avg, sum.lat_max,
+		   (unsigned long long)sum.lat_early);
+
+	seq_puts(seq, "     queue_pkts:");
+	for (i = 0; i < PKTGEN_RX_QUEUES; i++)
+		if (sum.queue_pkts[i])
+			seq_printf(seq, " %d:%llu", i,
+				   (unsigned long long)sum.queue_pkts[i]);
+	seq_puts(seq, "\n");
+
+	seq_puts(seq, "     latency histogram (us):\n");
+	for (i = 0; i < PKTGEN_LAT_BUCKETS - 1; i++)
+		if (sum.lat_hist[i])
+			seq_printf(seq, "       < %lu: %llu\n", 1UL << i,
+				   (unsigned long long)sum.lat_hist[i]);
+	if (sum.lat_hist[i])
+		seq_printf(seq, "       >= %lu: %llu\n", 1UL << (i - 1),
+			   (unsigned long long)sum.lat_hist[i]);
+	return 0;
+}
+
+static ssize_t pgrx_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	char data[IFNAMSIZ + 16];
+	int err = 0;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (count > sizeof(data))
+		count = sizeof(data);
+	if (copy_from_user(data, buf, count))
+		return -EFAULT;
+	data[count - 1] = 0;	/* Make string */
+
+	rtnl_lock();
+	if (!strncmp(data, "rx ", 3)) {
+		err = pktgen_rx_start(strstrip(data + 3));
+		if (!err)
+			pktgen_rx_reset();
+	} else if (!strcmp(data, "rx_reset"))
+		pktgen_rx_reset();
+	else if (!strcmp(data, "rx_disable"))
+		pktgen_rx_stop();
+	else {
+		printk(KERN_WARNING "pktgen: Unknown command: %s\n", data);
+		err = -EINVAL;
+	}
+	rtnl_unlock();
+
+	return err ? err : count;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE(inode)->data);
+}
+
+static const struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = pgrx_write,
+	.release = single_release,
+};
+
 static int pktgen_if_show(struct seq_file *seq, void *v)
 {
 	const struct pktgen_dev *pkt_dev = seq->private;
 	ktime_t stopped;
 	u64 idle;
+	int i;
 
 	seq_printf(seq,
 		   "Params: count %llu  min_pkt_size: %u  max_pkt_size: %u\n",
@@ -697,6 +942,13 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 
 	seq_printf(seq, "     cur_queue_map: %u\n", pkt_dev->cur_queue_map);
 
+	seq_puts(seq, "     queue_sent:");
+	for (i = 0; i < PKTGEN_MAX_QUEUES; i++)
+		if (pkt_dev->queue_sent[i])
+			seq_printf(seq, " %d:%llu", i,
+				   (unsigned long long)pkt_dev->queue_sent[i]);
+	seq_puts(seq, "\n");
+
 	seq_printf(seq, "     flows: %u\n", pkt_dev->nflows);
 
 	if (pkt_dev->result[0])
@@ -1915,6 +2167,8 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(dev->name);
+		if (dev == pktgen_rx_dev)
+			pktgen_rx_stop();
 		break;
 	}
 
@@ -3087,6 +3341,7 @@ static void pktgen_clear_counters(struct pktgen_dev *pkt_dev)
 	pkt_dev->sofar = 0;
 	pkt_dev->tx_bytes = 0;
 	pkt_dev->errors = 0;
+	memset(pkt_dev->queue_sent, 0, sizeof(pkt_dev->queue_sent));
 }
 
 /* Set up structure for sending pkts, clear counters */
@@ -3450,7 +3705,7 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 	__netif_tx_lock_bh(txq);
 	atomic_inc(&(pkt_dev->skb->users));
 
-	if (unlikely(netif_tx_queue_stopped(txq) || netif_tx_queue_frozen(txq)))
+	if (unlikely(netif_xmit_stopped(txq) || netif_tx_queue_frozen(txq)))
 		ret = NETDEV_TX_BUSY;
 	else
 		ret = (*xmit)(pkt_dev->skb, odev);
@@ -3462,6 +3717,8 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		pkt_dev->sofar++;
 		pkt_dev->seq_num++;
 		pkt_dev->tx_bytes += pkt_dev->cur_pkt_size;
+		if (queue_map < PKTGEN_MAX_QUEUES)
+			pkt_dev->queue_sent[queue_map]++;
 		break;
 	default: /* Drivers are not supposed to return other values! */
 		if (net_ratelimit())
@@ -3811,6 +4068,15 @@ static int __init pg_init(void)
 		return -EINVAL;
 	}
 
+	pe = proc_create(PGRX, 0600, pg_proc_dir, &pktgen_rx_fops);
+	if (pe == NULL) {
+		printk(KERN_ERR "pktgen: ERROR: cannot create %s "
+		       "procfs entry.\n", PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(&init_net, PG_PROC_DIR);
+		return -EINVAL;
+	}
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3827,6 +4093,7 @@ static int __init pg_init(void)
 		printk(KERN_ERR "pktgen: ERROR: Initialization failed for "
 		       "all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(&init_net, PG_PROC_DIR);
 		return -ENODEV;
@@ -3850,10 +4117,15 @@ static void __exit pg_cleanup(void)
 		kfree(t);
 	}
 
+	rtnl_lock();
+	pktgen_rx_stop();
+	rtnl_unlock();
+
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
 
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(&init_net, PG_PROC_DIR);
 }
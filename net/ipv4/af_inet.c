@@ -427,6 +427,8 @@ int inet_release(struct socket *sock)
 		 * If the close is due to the process exiting, we never
 		 * linger..
 		 */
+		sock_rps_reset_flow(sk);
+
 		timeout = 0;
 		if (sock_flag(sk, SOCK_LINGER) &&
 		    !(current->flags & PF_EXITING))
@@ -1212,6 +1214,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int features)
 	int proto;
 	int ihl;
 	int id;
+	int ufo;
 	unsigned int offset = 0;
 
 	if (!(features & NETIF_F_V4_CSUM))
@@ -1222,9 +1225,12 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int features)
 		       SKB_GSO_UDP |
 		       SKB_GSO_DODGY |
 		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_UDP_L4 |
 		       0)))
 		goto out;
 
+	ufo = skb_shinfo(skb)->gso_type & SKB_GSO_UDP;
+
 	if (unlikely(!pskb_may_pull(skb, sizeof(*iph))))
 		goto out;
 
@@ -1255,7 +1261,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int features)
 	skb = segs;
 	do {
 		iph = ip_hdr(skb);
-		if (proto == IPPROTO_UDP) {
+		if (ufo) {
 			iph->id = htons(id);
 			iph->frag_off = htons(offset >> 3);
 			if (skb->next != NULL)
@@ -1272,8 +1278,7 @@ out:
 	return segs;
 }
 
-static struct sk_buff **inet_gro_receive(struct sk_buff **head,
-					 struct sk_buff *skb)
+struct sk_buff **inet_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 {
 	const struct net_protocol *ops;
 	struct sk_buff **pp = NULL;
@@ -1283,6 +1288,7 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 	unsigned int off;
 	unsigned int id;
 	int flush = 1;
+	int flush_id;
 	int proto;
 
 	off = skb_gro_offset(skb);
@@ -1317,7 +1323,10 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ip_hdr(p);
+		/* Under a tunnel this is not the header ip_hdr() points at;
+		 * the held packets have the same layout as @skb, though.
+		 */
+		iph2 = (struct iphdr *)(p->data + off);
 
 		if ((iph->protocol ^ iph2->protocol) |
 		    (iph->tos ^ iph2->tos) |
@@ -1327,10 +1336,16 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 			continue;
 		}
 
-		/* All fields must match except length and checksum. */
-		NAPI_GRO_CB(p)->flush |=
-			(iph->ttl ^ iph2->ttl) |
-			((u16)(ntohs(iph2->id) + NAPI_GRO_CB(p)->count) ^ id);
+		/* All fields must match except length and checksum.  The ID
+		 * goes up by one per packet, or is always zero: that is what
+		 * DF packets sent without a connected socket get, tunnel
+		 * traffic in particular.
+		 */
+		flush_id = (u16)(ntohs(iph2->id) + NAPI_GRO_CB(p)->count) ^ id;
+		if (!iph2->id && !id)
+			flush_id = 0;
+
+		NAPI_GRO_CB(p)->flush |= (iph->ttl ^ iph2->ttl) | flush_id;
 
 		NAPI_GRO_CB(p)->flush |= flush;
 	}
@@ -1349,8 +1364,9 @@ out:
 
 	return pp;
 }
+EXPORT_SYMBOL(inet_gro_receive);
 
-static int inet_gro_complete(struct sk_buff *skb)
+int inet_gro_complete(struct sk_buff *skb)
 {
 	const struct net_protocol *ops;
 	struct iphdr *iph = ip_hdr(skb);
@@ -1373,6 +1389,7 @@ out_unlock:
 
 	return err;
 }
+EXPORT_SYMBOL(inet_gro_complete);
 
 int inet_ctl_sock_create(struct sock **sk, unsigned short family,
 			 unsigned short type, unsigned char protocol,
@@ -1459,6 +1476,8 @@ static const struct net_protocol udp_protocol = {
 	.err_handler =	udp_err,
 	.gso_send_check = udp4_ufo_send_check,
 	.gso_segment = udp4_ufo_fragment,
+	.gro_receive =	udp4_gro_receive,
+	.gro_complete =	udp4_gro_complete,
 	.no_policy =	1,
 	.netns_ok =	1,
 };
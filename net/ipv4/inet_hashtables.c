@@ -14,6 +14,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/hash.h>
 #include <linux/random.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -39,6 +40,7 @@ struct inet_bind_bucket *inet_bind_bucket_create(struct kmem_cache *cachep,
 		write_pnet(&tb->ib_net, hold_net(net));
 		tb->port      = snum;
 		tb->fastreuse = 0;
+		tb->fastreuseport = 0;
 		tb->num_owners = 0;
 		INIT_HLIST_HEAD(&tb->owners);
 		hlist_add_head(&tb->node, &head->chain);
@@ -150,11 +152,16 @@ static inline int compute_score(struct sock *sk, struct net *net,
  * BSD API does not allow a listening sock to specify the remote port nor the
  * remote address for the connection. So always assume those are both
  * wildcarded during the search since they can never be otherwise.
+ *
+ * Listeners sharing a port through SO_REUSEPORT score the same; one of
+ * them is picked by a hash of the connection's addresses and ports, so
+ * a given peer lands on the same socket while the set is unchanged.
  */
 
 
 struct sock *__inet_lookup_listener(struct net *net,
 				    struct inet_hashinfo *hashinfo,
+				    const __be32 saddr, __be16 sport,
 				    const __be32 daddr, const unsigned short hnum,
 				    const int dif)
 {
@@ -162,7 +169,8 @@ struct sock *__inet_lookup_listener(struct net *net,
 	struct hlist_nulls_node *node;
 	unsigned int hash = inet_lhashfn(net, hnum);
 	struct inet_listen_hashbucket *ilb = &hashinfo->listening_hash[hash];
-	int score, hiscore;
+	int score, hiscore, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
@@ -173,6 +181,17 @@ begin:
 		if (score > hiscore) {
 			result = sk;
 			hiscore = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == hiscore && reuseport) {
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -418,6 +437,16 @@ void inet_unhash(struct sock *sk)
 }
 EXPORT_SYMBOL_GPL(inet_unhash);
 
+/*
+ * Where the search for a free ephemeral port starts, per destination.
+ * port_offset already differs for every (saddr, daddr, dport); keeping
+ * a separate hint for each slot means connects to one busy destination
+ * pick up right after the port they got last time instead of rescanning
+ * the range from wherever connects elsewhere left a shared hint.
+ */
+#define INET_TABLE_PERTURB_SHIFT	8
+static u32 table_perturb[1 << INET_TABLE_PERTURB_SHIFT];
+
 int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 		struct sock *sk, u32 port_offset,
 		int (*check_established)(struct inet_timewait_death_row *,
@@ -433,20 +462,31 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 
 	if (!snum) {
 		int i, remaining, low, high, port;
-		static u32 hint;
-		u32 offset = hint + port_offset;
+		u32 index, offset;
 		struct hlist_node *node;
 		struct inet_timewait_sock *tw = NULL;
 
 		inet_get_local_port_range(&low, &high);
-		remaining = (high - low) + 1;
-
-		local_bh_disable();
-		for (i = 1; i <= remaining; i++) {
-			port = low + (i + offset) % remaining;
+		high++; /* [32768, 60999] -> [32768, 61000[ */
+		remaining = high - low;
+		if (likely(remaining > 1))
+			remaining &= ~1U;
+
+		index = hash_32(port_offset, INET_TABLE_PERTURB_SHIFT);
+		offset = (table_perturb[index] + port_offset) % remaining;
+		/*
+		 * Scan the ports of one parity first; most of the time the
+		 * first pass succeeds and only half the range is touched.
+		 */
+		offset &= ~1U;
+other_parity_scan:
+		port = low + offset;
+		for (i = 0; i < remaining; i += 2, port += 2) {
+			if (unlikely(port >= high))
+				port -= remaining;
 			head = &hinfo->bhash[inet_bhashfn(net, port,
 					hinfo->bhash_size)];
-			spin_lock(&head->lock);
+			spin_lock_bh(&head->lock);
 
 			/* Does not bother with rcv_saddr checks,
 			 * because the established check is already
@@ -454,7 +494,8 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			 */
 			inet_bind_bucket_for_each(tb, node, &head->chain) {
 				if (ib_net(tb) == net && tb->port == port) {
-					if (tb->fastreuse >= 0)
+					if (tb->fastreuse >= 0 ||
+					    tb->fastreuseport >= 0)
 						goto next_port;
 					WARN_ON(hlist_empty(&tb->owners));
 					if (!check_established(death_row, sk,
@@ -467,21 +508,30 @@ int __inet_hash_connect(struct inet_timewait_death_row *death_row,
 			tb = inet_bind_bucket_create(hinfo->bind_bucket_cachep,
 					net, head, port);
 			if (!tb) {
-				spin_unlock(&head->lock);
-				break;
+				spin_unlock_bh(&head->lock);
+				return -ENOMEM;
 			}
 			tb->fastreuse = -1;
+			tb->fastreuseport = -1;
 			goto ok;
 
 		next_port:
-			spin_unlock(&head->lock);
+			spin_unlock_bh(&head->lock);
+			cond_resched();
 		}
-		local_bh_enable();
+
+		offset++;
+		if ((offset & 1) && remaining > 1)
+			goto other_parity_scan;
 
 		return -EADDRNOTAVAIL;
 
 ok:
-		hint += i;
+		/*
+		 * Skip past the port just taken (and the one of the other
+		 * parity next to it) for the next connect to this slot.
+		 */
+		table_perturb[index] += i + 2;
 
 		/* Head lock still held and bh's disabled */
 		inet_bind_hash(sk, tb, port);
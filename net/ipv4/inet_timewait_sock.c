@@ -57,6 +57,7 @@ static noinline void inet_twsk_free(struct inet_timewait_sock *tw)
 #ifdef SOCK_REFCNT_DEBUG
 	pr_debug("%s timewait_sock %p released\n", tw->tw_prot->name, tw);
 #endif
+	atomic_dec(&twsk_net(tw)->ipv4.tw_count);
 	release_net(twsk_net(tw));
 	kmem_cache_free(tw->tw_prot->twsk_prot->twsk_slab, tw);
 	module_put(owner);
@@ -115,9 +116,15 @@ EXPORT_SYMBOL_GPL(__inet_twsk_hashdance);
 
 struct inet_timewait_sock *inet_twsk_alloc(const struct sock *sk, const int state)
 {
-	struct inet_timewait_sock *tw =
-		kmem_cache_alloc(sk->sk_prot_creator->twsk_prot->twsk_slab,
-				 GFP_ATOMIC);
+	struct net *net = sock_net(sk);
+	struct inet_timewait_sock *tw;
+	int max = net->ipv4.sysctl_tw_max_buckets;
+
+	if (max > 0 && atomic_read(&net->ipv4.tw_count) >= max)
+		return NULL;
+
+	tw = kmem_cache_alloc(sk->sk_prot_creator->twsk_prot->twsk_slab,
+			      GFP_ATOMIC);
 	if (tw != NULL) {
 		const struct inet_sock *inet = inet_sk(sk);
 
@@ -134,11 +141,13 @@ struct inet_timewait_sock *inet_twsk_alloc(const struct sock *sk, const int stat
 		tw->tw_dport	    = inet->dport;
 		tw->tw_family	    = sk->sk_family;
 		tw->tw_reuse	    = sk->sk_reuse;
+		tw->tw_reuseport    = sk->sk_reuseport;
 		tw->tw_hash	    = sk->sk_hash;
 		tw->tw_ipv6only	    = 0;
 		tw->tw_transparent  = inet->transparent;
 		tw->tw_prot	    = sk->sk_prot_creator;
-		twsk_net_set(tw, hold_net(sock_net(sk)));
+		twsk_net_set(tw, hold_net(net));
+		atomic_inc(&net->ipv4.tw_count);
 		atomic_set(&tw->tw_refcnt, 1);
 		inet_twsk_dead_node_init(tw);
 		__module_get(tw->tw_prot->owner);
@@ -149,53 +158,73 @@ struct inet_timewait_sock *inet_twsk_alloc(const struct sock *sk, const int stat
 
 EXPORT_SYMBOL_GPL(inet_twsk_alloc);
 
+/*
+ * Kill buckets already unlinked from the death row.  Their death row
+ * reference is dropped here.  Called without death_lock, BHs disabled.
+ */
+static void inet_twdr_reap(struct inet_timewait_death_row *twdr,
+			   struct inet_timewait_sock **batch, int n,
+			   int mib)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct inet_timewait_sock *tw = batch[i];
+
+		__inet_twsk_kill(tw, twdr->hashinfo);
+#ifdef CONFIG_NET_NS
+		NET_INC_STATS_BH(twsk_net(tw), mib);
+#endif
+		inet_twsk_put(tw);
+	}
+#ifndef CONFIG_NET_NS
+	NET_ADD_STATS_BH(&init_net, mib, n);
+#endif
+}
+
 /* Returns non-zero if quota exceeded.  */
 static int inet_twdr_do_twkill_work(struct inet_timewait_death_row *twdr,
 				    const int slot)
 {
+	struct inet_timewait_sock *batch[INET_TWDR_REAP_BATCH];
 	struct inet_timewait_sock *tw;
-	struct hlist_node *node;
+	struct hlist_node *node, *safe;
 	unsigned int killed;
-	int ret;
+	int n;
 
 	/* NOTE: compare this to previous version where lock
 	 * was released after detaching chain. It was racy,
 	 * because tw buckets are scheduled in not serialized context
 	 * in 2.3 (with netfilter), and with softnet it is common, because
 	 * soft irqs are not sequenced.
+	 *
+	 * So buckets are unlinked one by one under death_lock, but only
+	 * a batch at a time, and the lock is dropped once per batch to
+	 * kill them.  While it is dropped another cpu may kill off
+	 * buckets still in the cell; the cell is walked afresh each time.
 	 */
 	killed = 0;
-	ret = 0;
-rescan:
-	inet_twsk_for_each_inmate(tw, node, &twdr->cells[slot]) {
-		__inet_twsk_del_dead_node(tw);
+	for (;;) {
+		n = 0;
+		inet_twsk_for_each_inmate_safe(tw, node, safe,
+					       &twdr->cells[slot]) {
+			__inet_twsk_del_dead_node(tw);
+			batch[n++] = tw;
+			if (n == INET_TWDR_REAP_BATCH)
+				break;
+		}
+		if (!n)
+			return 0;
+
+		twdr->tw_count -= n;
 		spin_unlock(&twdr->death_lock);
-		__inet_twsk_kill(tw, twdr->hashinfo);
-#ifdef CONFIG_NET_NS
-		NET_INC_STATS_BH(twsk_net(tw), LINUX_MIB_TIMEWAITED);
-#endif
-		inet_twsk_put(tw);
-		killed++;
+		inet_twdr_reap(twdr, batch, n, LINUX_MIB_TIMEWAITED);
 		spin_lock(&twdr->death_lock);
-		if (killed > INET_TWDR_TWKILL_QUOTA) {
-			ret = 1;
-			break;
-		}
 
-		/* While we dropped twdr->death_lock, another cpu may have
-		 * killed off the next TW bucket in the list, therefore
-		 * do a fresh re-read of the hlist head node with the
-		 * lock reacquired.  We still use the hlist traversal
-		 * macro in order to get the prefetches.
-		 */
-		goto rescan;
+		killed += n;
+		if (killed > INET_TWDR_TWKILL_QUOTA)
+			return !hlist_empty(&twdr->cells[slot]);
 	}
-
-	twdr->tw_count -= killed;
-#ifndef CONFIG_NET_NS
-	NET_ADD_STATS_BH(&init_net, LINUX_MIB_TIMEWAITED, killed);
-#endif
-	return ret;
 }
 
 void inet_twdr_hangman(unsigned long data)
@@ -362,11 +391,13 @@ EXPORT_SYMBOL_GPL(inet_twsk_schedule);
 
 void inet_twdr_twcal_tick(unsigned long data)
 {
+	struct inet_timewait_sock *batch[INET_TWDR_REAP_BATCH];
 	struct inet_timewait_death_row *twdr;
 	int n, slot;
 	unsigned long j;
 	unsigned long now = jiffies;
 	int killed = 0;
+	int batched = 0;
 	int adv = 0;
 
 	twdr = (struct inet_timewait_death_row *)data;
@@ -386,12 +417,18 @@ void inet_twdr_twcal_tick(unsigned long data)
 			inet_twsk_for_each_inmate_safe(tw, node, safe,
 						       &twdr->twcal_row[slot]) {
 				__inet_twsk_del_dead_node(tw);
-				__inet_twsk_kill(tw, twdr->hashinfo);
-#ifdef CONFIG_NET_NS
-				NET_INC_STATS_BH(twsk_net(tw), LINUX_MIB_TIMEWAITKILLED);
-#endif
-				inet_twsk_put(tw);
 				killed++;
+				/*
+				 * The calendar has to stay consistent while
+				 * it is walked, so only the first batch is
+				 * left for after the lock is dropped.
+				 */
+				if (batched < INET_TWDR_REAP_BATCH) {
+					batch[batched++] = tw;
+					continue;
+				}
+				inet_twdr_reap(twdr, &tw, 1,
+					       LINUX_MIB_TIMEWAITKILLED);
 			}
 		} else {
 			if (!adv) {
@@ -413,10 +450,9 @@ void inet_twdr_twcal_tick(unsigned long data)
 out:
 	if ((twdr->tw_count -= killed) == 0)
 		del_timer(&twdr->tw_timer);
-#ifndef CONFIG_NET_NS
-	NET_ADD_STATS_BH(&init_net, LINUX_MIB_TIMEWAITKILLED, killed);
-#endif
 	spin_unlock(&twdr->death_lock);
+
+	inet_twdr_reap(twdr, batch, batched, LINUX_MIB_TIMEWAITKILLED);
 }
 
 EXPORT_SYMBOL_GPL(inet_twdr_twcal_tick);
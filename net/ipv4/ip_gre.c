@@ -43,6 +43,7 @@
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
 #include <net/rtnetlink.h>
+#include <net/inet_common.h>
 
 #ifdef CONFIG_IPV6
 #include <net/ipv6.h>
@@ -1276,10 +1277,108 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 	ign->tunnels_wc[0]	= tunnel;
 }
 
+/*
+ * GRO for GRE carrying IPv4.  Once the GRE headers of two packets match
+ * (their outer IP headers already do) the inner IPv4 and transport
+ * handlers decide whether they merge.  Checksummed and sequenced GRE is
+ * left alone, as is anything but IPv4 inside.
+ */
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	__be16 *greh;
+	unsigned int grehlen;
+	unsigned int hlen;
+	unsigned int off;
+	int nhoff;
+	int flush = 1;
+	__wsum csum;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if ((greh[0] & (GRE_CSUM|GRE_ROUTING|GRE_SEQ|GRE_VERSION)) ||
+	    greh[1] != htons(ETH_P_IP))
+		goto out;
+
+	grehlen = (greh[0] & GRE_KEY) ? 8 : 4;
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Flags, protocol and key. */
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	/* Few NICs checksum what is inside GRE, and TCP will not merge
+	 * segments it cannot check.
+	 */
+	if (skb->ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, off, skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	}
+
+	skb_gro_pull(skb, grehlen);
+
+	csum = skb->csum;
+	skb->csum = csum_sub(csum, csum_partial(greh, grehlen, 0));
+
+	nhoff = skb_network_offset(skb);
+	skb_set_network_header(skb, skb_gro_offset(skb));
+
+	pp = inet_gro_receive(head, skb);
+
+	skb_set_network_header(skb, nhoff);
+	skb->csum = csum;
+	flush = 0;
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb);
+	int off = nhoff + ip_hdrlen(skb);
+	__be16 *greh = (__be16 *)(skb->data + off);
+	int err;
+
+	off += (greh[0] & GRE_KEY) ? 8 : 4;
+
+	skb_set_network_header(skb, off);
+	err = inet_gro_complete(skb);
+	skb_set_network_header(skb, nhoff);
+
+	return err;
+}
 
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -131,6 +131,7 @@ static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
 static int ip_rt_secret_interval __read_mostly	= 10 * 60 * HZ;
 static int rt_chain_length_max __read_mostly	= 20;
+static int ip_rt_percpu_cache __read_mostly;
 
 static struct delayed_work expires_work;
 static unsigned long expires_ljiffies;
@@ -254,6 +255,22 @@ static struct rt_hash_bucket 	*rt_hash_table __read_mostly;
 static unsigned			rt_hash_mask __read_mostly;
 static unsigned int		rt_hash_log  __read_mostly;
 
+/*
+ * Per-CPU route cache.  Instead of the shared hash table each CPU keeps a
+ * direct-mapped array of entries indexed by the route hash; a miss goes
+ * to the FIB and the result replaces whatever was in the slot.  The cache
+ * can never grow past RT_PCPU_SLOTS entries per CPU, so a flood of new
+ * flows costs FIB lookups but neither hash chain growth nor GC runs.
+ * Slots are only written with xchg/cmpxchg and read under RCU.
+ */
+#define RT_PCPU_SLOTS	1024
+
+struct rt_pcpu_cache {
+	struct rtable	*slot[RT_PCPU_SLOTS];
+};
+
+static struct rt_pcpu_cache	*rt_pcpu_cache __read_mostly;
+
 static DEFINE_PER_CPU(struct rt_cache_stat, rt_cache_stat);
 #define RT_CACHE_STAT_INC(field) \
 	(__raw_get_cpu_var(rt_cache_stat).field++)
@@ -712,6 +729,65 @@ static inline int rt_is_expired(struct rtable *rth)
 	return rth->rt_genid != rt_genid(dev_net(rth->u.dst.dev));
 }
 
+/*
+ * A namespace whose hash table rebuilds went over the limit falls back to
+ * the per-CPU cache too, rather than to no cache at all.
+ */
+static inline bool rt_pcpu_caching(const struct net *net)
+{
+	return ip_rt_percpu_cache || !rt_caching(net);
+}
+
+static inline struct rtable **rt_pcpu_slot(int cpu, unsigned hash)
+{
+	return &per_cpu_ptr(rt_pcpu_cache, cpu)->slot[hash & (RT_PCPU_SLOTS - 1)];
+}
+
+/*
+ * Looking at another CPU's slot after a migration is harmless, it only
+ * makes a hit less likely.  Called under rcu_read_lock(_bh).
+ */
+static inline struct rtable *rt_pcpu_lookup(unsigned hash)
+{
+	return rcu_dereference(*rt_pcpu_slot(raw_smp_processor_id(), hash));
+}
+
+static void rt_pcpu_insert(unsigned hash, struct rtable *rt)
+{
+	struct rtable *old;
+
+	/* xchg orders the writes to rt before it becomes visible. */
+	old = xchg(rt_pcpu_slot(get_cpu(), hash), rt);
+	put_cpu();
+	if (old)
+		rt_free(old);
+}
+
+/*
+ * Empty the per-CPU slots, or with @all == 0 only those holding
+ * expired entries.
+ */
+static void rt_pcpu_flush(int all, int process_context)
+{
+	struct rtable **slot, *rth;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		if (process_context && need_resched())
+			cond_resched();
+		rcu_read_lock_bh();
+		for (i = 0; i < RT_PCPU_SLOTS; i++) {
+			slot = &per_cpu_ptr(rt_pcpu_cache, cpu)->slot[i];
+			rth = rcu_dereference(*slot);
+			if (!rth || (!all && !rt_is_expired(rth)))
+				continue;
+			if (cmpxchg(slot, rth, NULL) == rth)
+				rt_free(rth);
+		}
+		rcu_read_unlock_bh();
+	}
+}
+
 /*
  * Perform a full scan of hash table and free all entries.
  * Can be called by a softirq or a process.
@@ -768,6 +844,12 @@ static void rt_do_flush(int process_context)
 			rt_free(rth);
 		}
 	}
+
+#ifdef CONFIG_NET_NS
+	rt_pcpu_flush(0, process_context);
+#else
+	rt_pcpu_flush(1, process_context);
+#endif
 }
 
 /*
@@ -956,6 +1038,10 @@ static int rt_garbage_collect(struct dst_ops *ops)
 	unsigned long now = jiffies;
 	int goal;
 
+	/* Per-CPU caches recycle their own slots, there is nothing to scan. */
+	if (ip_rt_percpu_cache)
+		return atomic_read(&ipv4_dst_ops.entries) >= ip_rt_max_size;
+
 	/*
 	 * Garbage collection is pretty expensive,
 	 * do not make it too frequently.
@@ -1085,21 +1171,13 @@ restart:
 	candp = NULL;
 	now = jiffies;
 
-	if (!rt_caching(dev_net(rt->u.dst.dev))) {
+	if (rt_pcpu_caching(dev_net(rt->u.dst.dev))) {
 		/*
-		 * If we're not caching, just tell the caller we
-		 * were successful and don't touch the route.  The
-		 * caller hold the sole reference to the cache entry, and
-		 * it will be released when the caller is done with it.
-		 * If we drop it here, the callers have no way to resolve routes
-		 * when we're not caching.  Instead, just point *rp at rt, so
-		 * the caller gets a single use out of the route
-		 * Note that we do rt_free on this new route entry, so that
-		 * once its refcount hits zero, we are still able to reap it
-		 * (Thanks Alexey)
-		 * Note also the rt_free uses call_rcu.  We don't actually
-		 * need rcu protection here, this is just our path to get
-		 * on the route gc list.
+		 * Per-CPU caching: the entry goes into this CPU's slot,
+		 * which like a hash chain holds no reference of its own.
+		 * The caller keeps the reference it got from the slow
+		 * path.  Whatever the slot held before is rt_free'd and
+		 * gets reaped once its last user is done with it.
 		 */
 
 		if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
@@ -1113,7 +1191,7 @@ restart:
 			}
 		}
 
-		rt_free(rt);
+		rt_pcpu_insert(hash, rt);
 		goto skip_hashing;
 	}
 
@@ -1617,6 +1695,53 @@ static inline unsigned short guess_mtu(unsigned short old_mtu)
 	return 68;
 }
 
+/*
+ * Apply a Fragmentation Needed to one cached output route.  Returns the
+ * new estimate, or 0 if @rth is not the route the ICMP was about.
+ */
+static unsigned short rt_frag_needed_one(struct rtable *rth, struct net *net,
+					 struct iphdr *iph, __be32 skey,
+					 int ikey, unsigned short new_mtu,
+					 unsigned short *old_mtu)
+{
+	unsigned short mtu = new_mtu;
+
+	if (rth->fl.fl4_dst != iph->daddr ||
+	    rth->fl.fl4_src != skey ||
+	    rth->rt_dst != iph->daddr ||
+	    rth->rt_src != iph->saddr ||
+	    rth->fl.oif != ikey ||
+	    rth->fl.iif != 0 ||
+	    dst_metric_locked(&rth->u.dst, RTAX_MTU) ||
+	    !net_eq(dev_net(rth->u.dst.dev), net) ||
+	    rt_is_expired(rth))
+		return 0;
+
+	if (new_mtu < 68 || new_mtu >= *old_mtu) {
+
+		/* BSD 4.2 compatibility hack :-( */
+		if (mtu == 0 &&
+		    *old_mtu >= dst_mtu(&rth->u.dst) &&
+		    *old_mtu >= 68 + (iph->ihl << 2))
+			*old_mtu -= iph->ihl << 2;
+
+		mtu = guess_mtu(*old_mtu);
+	}
+	if (mtu > dst_mtu(&rth->u.dst))
+		return 0;
+
+	if (mtu < dst_mtu(&rth->u.dst)) {
+		dst_confirm(&rth->u.dst);
+		if (mtu < ip_rt_min_pmtu) {
+			mtu = ip_rt_min_pmtu;
+			rth->u.dst.metrics[RTAX_LOCK-1] |= (1 << RTAX_MTU);
+		}
+		rth->u.dst.metrics[RTAX_MTU-1] = mtu;
+		dst_set_expires(&rth->u.dst, ip_rt_mtu_expires);
+	}
+	return mtu;
+}
+
 unsigned short ip_rt_frag_needed(struct net *net, struct iphdr *iph,
 				 unsigned short new_mtu,
 				 struct net_device *dev)
@@ -1636,46 +1761,28 @@ unsigned short ip_rt_frag_needed(struct net *net, struct iphdr *iph,
 		for (i = 0; i < 2; i++) {
 			unsigned hash = rt_hash(daddr, skeys[i], ikeys[k],
 						rt_genid(net));
+			unsigned short mtu;
+			int cpu;
 
 			rcu_read_lock();
 			for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
 			     rth = rcu_dereference(rth->u.dst.rt_next)) {
-				unsigned short mtu = new_mtu;
-
-				if (rth->fl.fl4_dst != daddr ||
-				    rth->fl.fl4_src != skeys[i] ||
-				    rth->rt_dst != daddr ||
-				    rth->rt_src != iph->saddr ||
-				    rth->fl.oif != ikeys[k] ||
-				    rth->fl.iif != 0 ||
-				    dst_metric_locked(&rth->u.dst, RTAX_MTU) ||
-				    !net_eq(dev_net(rth->u.dst.dev), net) ||
-				    rt_is_expired(rth))
-					continue;
-
-				if (new_mtu < 68 || new_mtu >= old_mtu) {
-
-					/* BSD 4.2 compatibility hack :-( */
-					if (mtu == 0 &&
-					    old_mtu >= dst_mtu(&rth->u.dst) &&
-					    old_mtu >= 68 + (iph->ihl << 2))
-						old_mtu -= iph->ihl << 2;
-
-					mtu = guess_mtu(old_mtu);
-				}
-				if (mtu <= dst_mtu(&rth->u.dst)) {
-					if (mtu < dst_mtu(&rth->u.dst)) {
-						dst_confirm(&rth->u.dst);
-						if (mtu < ip_rt_min_pmtu) {
-							mtu = ip_rt_min_pmtu;
-							rth->u.dst.metrics[RTAX_LOCK-1] |=
-								(1 << RTAX_MTU);
-						}
-						rth->u.dst.metrics[RTAX_MTU-1] = mtu;
-						dst_set_expires(&rth->u.dst,
-							ip_rt_mtu_expires);
-					}
+				mtu = rt_frag_needed_one(rth, net, iph, skeys[i],
+							 ikeys[k], new_mtu,
+							 &old_mtu);
+				if (mtu)
 					est_mtu = mtu;
+			}
+			if (rt_pcpu_caching(net)) {
+				for_each_possible_cpu(cpu) {
+					rth = rcu_dereference(*rt_pcpu_slot(cpu, hash));
+					if (!rth)
+						continue;
+					mtu = rt_frag_needed_one(rth, net, iph,
+								 skeys[i], ikeys[k],
+								 new_mtu, &old_mtu);
+					if (mtu)
+						est_mtu = mtu;
 				}
 			}
 			rcu_read_unlock();
@@ -2272,15 +2379,16 @@ int ip_route_input(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 
 	net = dev_net(dev);
 
-	if (!rt_caching(net))
-		goto skip_cache;
-
 	tos &= IPTOS_RT_MASK;
 	hash = rt_hash(daddr, saddr, iif, rt_genid(net));
 
+	/* A per-CPU slot is searched as a chain of (at most) one. */
 	rcu_read_lock();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
-	     rth = rcu_dereference(rth->u.dst.rt_next)) {
+	if (rt_pcpu_caching(net))
+		rth = rt_pcpu_lookup(hash);
+	else
+		rth = rcu_dereference(rt_hash_table[hash].chain);
+	for (; rth; rth = rcu_dereference(rth->u.dst.rt_next)) {
 		if (((rth->fl.fl4_dst ^ daddr) |
 		     (rth->fl.fl4_src ^ saddr) |
 		     (rth->fl.iif ^ iif) |
@@ -2299,7 +2407,6 @@ int ip_route_input(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	}
 	rcu_read_unlock();
 
-skip_cache:
 	/* Multicast recognition logic is moved from route cache to here.
 	   The problem was that too many Ethernet cards have broken/missing
 	   hardware multicast filters :-( As result the host on multicasting
@@ -2686,14 +2793,14 @@ int __ip_route_output_key(struct net *net, struct rtable **rp,
 	unsigned hash;
 	struct rtable *rth;
 
-	if (!rt_caching(net))
-		goto slow_output;
-
 	hash = rt_hash(flp->fl4_dst, flp->fl4_src, flp->oif, rt_genid(net));
 
 	rcu_read_lock_bh();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
-		rth = rcu_dereference(rth->u.dst.rt_next)) {
+	if (rt_pcpu_caching(net))
+		rth = rt_pcpu_lookup(hash);
+	else
+		rth = rcu_dereference(rt_hash_table[hash].chain);
+	for (; rth; rth = rcu_dereference(rth->u.dst.rt_next)) {
 		if (rth->fl.fl4_dst == flp->fl4_dst &&
 		    rth->fl.fl4_src == flp->fl4_src &&
 		    rth->fl.iif == 0 &&
@@ -2713,7 +2820,6 @@ int __ip_route_output_key(struct net *net, struct rtable **rp,
 	}
 	rcu_read_unlock_bh();
 
-slow_output:
 	return ip_route_output_slow(net, rp, flp);
 }
 
@@ -3130,6 +3236,20 @@ static int ipv4_sysctl_rt_secret_interval(ctl_table *ctl, int write,
 	return ret;
 }
 
+static int ipv4_sysctl_rt_percpu_cache(ctl_table *ctl, int write,
+				       void __user *buffer, size_t *lenp,
+				       loff_t *ppos)
+{
+	int old = ip_rt_percpu_cache;
+	int ret = proc_dointvec(ctl, write, buffer, lenp, ppos);
+
+	/* Entries left in the slots would not be found any more. */
+	if (write && !ret && old && !ip_rt_percpu_cache)
+		rt_pcpu_flush(1, 1);
+
+	return ret;
+}
+
 static int ipv4_sysctl_rt_secret_interval_strategy(ctl_table *table,
 						   void __user *oldval,
 						   size_t __user *oldlenp,
@@ -3281,6 +3401,14 @@ static ctl_table ipv4_route_table[] = {
 		.proc_handler	= ipv4_sysctl_rt_secret_interval,
 		.strategy	= ipv4_sysctl_rt_secret_interval_strategy,
 	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "percpu_cache",
+		.data		= &ip_rt_percpu_cache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= ipv4_sysctl_rt_percpu_cache,
+	},
 	{ .ctl_name = 0 }
 };
 
@@ -3435,6 +3563,10 @@ int __init ip_rt_init(void)
 	memset(rt_hash_table, 0, (rt_hash_mask + 1) * sizeof(struct rt_hash_bucket));
 	rt_hash_lock_init();
 
+	rt_pcpu_cache = alloc_percpu(struct rt_pcpu_cache);
+	if (!rt_pcpu_cache)
+		panic("IP: failed to allocate rt_pcpu_cache\n");
+
 	ipv4_dst_ops.gc_thresh = (rt_hash_mask + 1);
 	ip_rt_max_size = (rt_hash_mask + 1) * 16;
 
@@ -0,0 +1,189 @@
+/*
+ * TCP Fast Open, passive (server) side.
+ *
+ * A client that holds a cookie for this server may put data in its SYN.
+ * When the cookie checks out the child socket is created right away, the
+ * SYN's data is queued on it and it goes straight to the accept queue
+ * in SYN_RECV, so the application can read the request (and answer it)
+ * one round trip earlier.  Clients without a valid cookie are handed one
+ * in the SYN-ACK and go through the normal three way handshake.
+ *
+ * The cookie is a keyed hash of the client and server addresses, done
+ * the way syncookies are.
+ */
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <net/inet_connection_sock.h>
+#include <net/request_sock.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+static u32 tcp_fastopen_secret[16 - 4 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 4, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	tmp[2] = 0;
+	tmp[3] = 0;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/*
+ * Decide whether the data of the SYN in @skb can be accepted before the
+ * handshake completes.  If not, but the client asked for a cookie or
+ * sent a stale one, mark @req so the SYN-ACK hands out a fresh one.
+ */
+bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			struct request_sock *req,
+			struct tcp_fastopen_cookie *foc)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_fastopen_cookie valid;
+	bool syn_data = TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1;
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    !tp->fastopen_max_qlen || tcp_hdr(skb)->fin)
+		return false;
+
+	if (foc->len < 0) {
+		if (!syn_data ||
+		    !(sysctl_tcp_fastopen & TFO_SERVER_COOKIE_NOT_REQD))
+			return false;
+	} else {
+		tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+					&valid);
+		if (foc->len != valid.len ||
+		    memcmp(foc->val, valid.val, valid.len)) {
+			if (foc->len == 0)
+				NET_INC_STATS_BH(sock_net(sk),
+					LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+			else if (syn_data)
+				NET_INC_STATS_BH(sock_net(sk),
+					LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+			tcp_rsk(req)->tfo_cookie = 1;
+			tcp_rsk(req)->tfo_exp = foc->exp;
+			return false;
+		}
+	}
+
+	if (atomic_read(&tp->fastopen_qlen) >= tp->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Create and set up the child for a fast open SYN and put it on the
+ * accept queue.  The child keeps @req until the handshake completes: it
+ * retransmits the SYN-ACK from it and it is what counts against the
+ * listener's TCP_FASTOPEN limit.  The accept queue gets a bare request
+ * of its own, since accept() frees whatever request it dequeues.
+ *
+ * Returns false to fall back to a normal handshake.  Either way the
+ * caller still has to send the SYN-ACK.
+ */
+bool tcp_fastopen_create_child(struct sock *sk, struct sk_buff *skb,
+			       struct request_sock *req)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *acc_req;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	acc_req = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (!acc_req)
+		return false;
+
+	child = icsk->icsk_af_ops->syn_recv_sock(sk, skb, req, NULL);
+	if (!child) {
+		__reqsk_free(acc_req);
+		return false;
+	}
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+	atomic_inc(&tcp_sk(sk)->fastopen_qlen);
+
+	/* The SYN's window is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* Finish what normally happens when the handshake's ACK arrives;
+	 * the child may well send before that.
+	 */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tp->lsndtime = tcp_time_stamp;
+	tcp_mtup_init(child);
+	tcp_initialize_rcv_mss(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data carried in the SYN.  The caller frees its skb,
+	 * hence the extra reference.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+	}
+	tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	tp->rcv_wup = tp->rcv_nxt;
+	tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+
+	/* SYN-ACK retransmissions run off the child's timer. */
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, acc_req, child);
+	sk->sk_data_ready(sk, 0);
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	bh_unlock_sock(child);
+	sock_put(child);
+	return true;
+}
+
+/*
+ * Drop the request of a fast open child, once it leaves SYN_RECV or is
+ * destroyed before that.
+ */
+void tcp_fastopen_release(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
+	struct sock *lsk = tcp_rsk(req)->listener;
+
+	tp->fastopen_rsk = NULL;
+	atomic_dec(&tcp_sk(lsk)->fastopen_qlen);
+	sock_put(lsk);
+	reqsk_free(req);
+}
@@ -278,6 +278,28 @@ static void tcp_probe_timer(struct sock *sk)
 	}
 }
 
+/*
+ *	Timer for a fast open child: until the handshake completes it is
+ *	the child, not the listener's SYN table, that resends the SYN-ACK.
+ */
+static void tcp_fastopen_synack_timer(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *req = tcp_sk(sk)->fastopen_rsk;
+	int max_retries = icsk->icsk_syn_retries ? :
+			  sysctl_tcp_synack_retries + 1;
+
+	if (req->retrans >= max_retries) {
+		tcp_write_err(sk);
+		return;
+	}
+	req->rsk_ops->rtx_syn_ack(sk, req);
+	req->retrans++;
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT << req->retrans,
+				  TCP_RTO_MAX);
+}
+
 /*
  *	The TCP retransmit timer.
  */
@@ -287,6 +309,11 @@ void tcp_retransmit_timer(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
 
+	if (tp->fastopen_rsk) {
+		tcp_fastopen_synack_timer(sk);
+		return;
+	}
+
 	if (!tp->packets_out)
 		goto out;
 
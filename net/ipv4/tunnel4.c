@@ -9,6 +9,7 @@
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
 #include <net/icmp.h>
+#include <net/inet_common.h>
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/xfrm.h>
@@ -132,9 +133,57 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+/*
+ * GRO for IPIP: the inner IPv4 header follows the outer one directly, so
+ * aggregation is up to inet_gro_receive() again, pointed at the inner
+ * header.
+ */
+static struct sk_buff **tunnel4_gro_receive(struct sk_buff **head,
+					    struct sk_buff *skb)
+{
+	struct sk_buff **pp;
+	int nhoff;
+
+	if (NAPI_GRO_CB(skb)->encap_mark) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	/* The inner transport checksum is rarely done by the NIC. */
+	if (skb->ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, skb_gro_offset(skb),
+					 skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	}
+
+	nhoff = skb_network_offset(skb);
+	skb_set_network_header(skb, skb_gro_offset(skb));
+
+	pp = inet_gro_receive(head, skb);
+
+	skb_set_network_header(skb, nhoff);
+
+	return pp;
+}
+
+static int tunnel4_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb);
+	int err;
+
+	skb_set_network_header(skb, nhoff + ip_hdrlen(skb));
+	err = inet_gro_complete(skb);
+	skb_set_network_header(skb, nhoff);
+
+	return err;
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gro_receive	=	tunnel4_gro_receive,
+	.gro_complete	=	tunnel4_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
@@ -104,6 +104,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table;
@@ -132,12 +133,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net)			&&
 		    sk2 != sk					&&
 		    (bitmap || sk2->sk_hash == num)		&&
 		    (!sk2->sk_reuse || !sk->sk_reuse)		&&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2))			&&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if
 			|| sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -275,6 +279,9 @@ static inline int compute_score(struct sock *sk, struct net *net, __be32 saddr,
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
+ *
+ * Equally good SO_REUSEPORT sockets share the datagrams by a hash of the
+ * 4-tuple, which keeps each flow on one socket.
  */
 static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 		__be16 sport, __be32 daddr, __be16 dport,
@@ -285,7 +292,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash = udp_hashfn(net, hnum);
 	struct udp_hslot *hslot = &udptable->hash[hash];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
@@ -297,6 +305,17 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -950,6 +969,8 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (flags & MSG_ERRQUEUE)
 		return ip_recv_error(sk, msg, len);
 
+	sock_rps_record_flow(sk);
+
 try_again:
 	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
 				  &peeked, &err);
@@ -1004,6 +1025,11 @@ try_again:
 	}
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
+	if (udp_sk(sk)->gro_enabled && skb_is_gso(skb)) {
+		int gso_size = skb_shinfo(skb)->gso_size;
+
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
 
 	err = copied;
 	if (flags & MSG_TRUNC)
@@ -1069,11 +1095,18 @@ void udp_lib_unhash(struct sock *sk)
 }
 EXPORT_SYMBOL(udp_lib_unhash);
 
+/* Sockets with UDP_GRO set; until there is one GRO leaves UDP alone. */
+static atomic_t udp_gro_users = ATOMIC_INIT(0);
+
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int is_udplite = IS_UDPLITE(sk);
 	int rc;
 
+	/* Only a connected socket sees a single flow */
+	if (inet_sk(sk)->daddr)
+		sock_rps_save_rxhash(sk, skb->rxhash);
+
 	if ((rc = sock_queue_rcv_skb(sk, skb)) < 0) {
 		/* Note that an ENOMEM error is charged twice */
 		if (rc == -ENOMEM) {
@@ -1092,6 +1125,9 @@ drop:
 	return -1;
 }
 
+static struct sk_buff *udp4_gro_segment(struct sk_buff *skb, int features,
+					bool tx);
+
 /* returns:
  *  -1: error
  *   0: success
@@ -1100,7 +1136,7 @@ drop:
  * Note that in the success and error cases, the skb is assumed to
  * have either been requeued or freed.
  */
-int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
 	int rc;
@@ -1200,6 +1236,44 @@ drop:
 	return -1;
 }
 
+int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *segs;
+	struct sk_buff *next;
+
+	if (likely(!skb_is_gso(skb) ||
+		   !(skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) ||
+		   udp_sk(sk)->gro_enabled))
+		return udp_queue_rcv_one_skb(sk, skb);
+
+	/* A GRO train for a socket that takes one datagram at a time:
+	 * UDP_GRO was cleared meanwhile, or this is a broadcast.
+	 */
+	segs = udp4_gro_segment(skb, NETIF_F_SG, false);
+	if (IS_ERR(segs)) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+				 IS_UDPLITE(sk));
+		kfree_skb(skb);
+		return -1;
+	}
+	consume_skb(skb);
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+
+		ip_hdr(segs)->tot_len = htons(segs->len -
+					      skb_network_offset(segs));
+		ip_send_check(ip_hdr(segs));
+		__skb_pull(segs, skb_transport_offset(segs));
+
+		/* There is no resubmitting from here. */
+		if (udp_queue_rcv_one_skb(sk, segs) > 0)
+			kfree_skb(segs);
+	}
+	return 0;
+}
+
 /*
  *	Multicasts and broadcasts go to each listener.
  *
@@ -1329,7 +1403,10 @@ int __udp4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 	sk = __udp4_lib_lookup_skb(skb, uh->source, uh->dest, udptable);
 
 	if (sk != NULL) {
-		int ret = udp_queue_rcv_skb(sk, skb);
+		int ret;
+
+		sk_mark_napi_id(sk, skb);
+		ret = udp_queue_rcv_skb(sk, skb);
 		sock_put(sk);
 
 		/* a return value > 0 means to resubmit the input, but
@@ -1396,6 +1473,8 @@ void udp_destroy_sock(struct sock *sk)
 {
 	lock_sock(sk);
 	udp_flush_pending_frames(sk);
+	if (udp_sk(sk)->gro_enabled)
+		atomic_dec(&udp_gro_users);
 	release_sock(sk);
 }
 
@@ -1445,6 +1524,19 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	case UDP_GRO:
+		/* Only IPv4 UDP sockets are handed GRO trains. */
+		if (sk->sk_family != AF_INET || is_udplite)
+			return -ENOPROTOOPT;
+		lock_sock(sk);
+		if (val && !up->gro_enabled)
+			atomic_inc(&udp_gro_users);
+		else if (!val && up->gro_enabled)
+			atomic_dec(&udp_gro_users);
+		up->gro_enabled = !!val;
+		release_sock(sk);
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1527,6 +1619,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_GRO:
+		val = up->gro_enabled;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -1888,6 +1984,10 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	/* A GRO train being forwarded goes out as the datagrams it was. */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return udp4_gro_segment(skb, features, true);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -1923,3 +2023,178 @@ out:
 	return segs;
 }
 
+
+/*
+ * UDP GRO.  Datagram boundaries are visible to the application, so a
+ * train of a flow's datagrams is only built for a socket that asked for
+ * it with UDP_GRO: it reads the train in one go and learns the datagram
+ * size from a UDP_GRO control message.  All datagrams of a train are
+ * that size, bar a shorter last one.
+ */
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct udphdr *uh;
+	struct udphdr *uh2;
+	struct iphdr *iph;
+	struct sock *sk;
+	unsigned int len;
+	unsigned int hlen;
+	unsigned int off;
+	unsigned int mss = 1;
+	int flush = 1;
+	int gro;
+
+	if (!atomic_read(&udp_gro_users))
+		goto out;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto out;
+	}
+	iph = skb_gro_network_header(skb);
+
+	if (ntohs(uh->len) != skb_gro_len(skb))
+		goto out;
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		goto out;
+	gro = udp_sk(sk)->gro_enabled;
+	sock_put(sk);
+	if (!gro)
+		goto out;
+
+	if (!uh->check) {
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+	} else {
+		switch (skb->ip_summed) {
+		case CHECKSUM_COMPLETE:
+			if (!csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       skb_gro_len(skb), IPPROTO_UDP,
+					       skb->csum)) {
+				skb->ip_summed = CHECKSUM_UNNECESSARY;
+				break;
+			}
+
+			/* fall through */
+		case CHECKSUM_NONE:
+			goto out;
+		}
+	}
+
+	skb_gro_pull(skb, sizeof(*uh));
+	len = skb_gro_len(skb);
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+		if (*(u32 *)&uh->source ^ *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		goto found;
+	}
+
+	goto out_check_final;
+
+found:
+	flush = NAPI_GRO_CB(p)->flush;
+	mss = skb_shinfo(p)->gso_size;
+	flush |= len > mss;
+
+	if (flush || skb_gro_receive(head, skb))
+		mss = 1;
+
+out_check_final:
+	/* A short datagram ends the train. */
+	flush = len < mss;
+
+	if (p && (!NAPI_GRO_CB(skb)->same_flow || flush))
+		pp = head;
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct udphdr *uh = udp_hdr(skb);
+	unsigned int len = skb->len - skb_transport_offset(skb);
+
+	/* The datagrams' checksums have been verified; this one stands
+	 * for all of them should the train be forwarded.
+	 */
+	uh->len = htons(len);
+	uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, len,
+				       IPPROTO_UDP, 0);
+	skb->csum_start = skb_transport_header(skb) - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+
+	return 0;
+}
+
+/*
+ * Cut a GRO train back into its datagrams.  @skb->data is at the UDP
+ * header; the datagrams come back starting at their MAC headers.  Going
+ * out (@tx) they get checksums of their own, coming in they count as
+ * verified.
+ */
+static struct sk_buff *udp4_gro_segment(struct sk_buff *skb, int features,
+					bool tx)
+{
+	struct sk_buff *segs;
+	struct sk_buff *seg;
+	unsigned int ulen;
+	int thoff;
+	__wsum csum;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(struct udphdr))))
+		return ERR_PTR(-EINVAL);
+
+	__skb_pull(skb, sizeof(struct udphdr));
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		return segs;
+
+	for (seg = segs; seg; seg = seg->next) {
+		const struct iphdr *iph = ip_hdr(seg);
+		struct udphdr *uh = udp_hdr(seg);
+
+		thoff = skb_transport_offset(seg);
+		ulen = seg->len - thoff;
+		uh->len = htons(ulen);
+
+		if (!tx) {
+			seg->ip_summed = CHECKSUM_UNNECESSARY;
+			continue;
+		}
+
+		uh->check = 0;
+		csum = skb_checksum(seg, thoff, ulen, 0);
+		uh->check = csum_tcpudp_magic(iph->saddr, iph->daddr, ulen,
+					      IPPROTO_UDP, csum);
+		if (uh->check == 0)
+			uh->check = CSUM_MANGLED_0;
+		seg->ip_summed = CHECKSUM_NONE;
+	}
+
+	return segs;
+}
@@ -1295,8 +1295,12 @@ ctnetlink_create_conntrack(const struct nlattr * const cda[],
 		ct->master = master_ct;
 	}
 
-	add_timer(&ct->timeout);
-	nf_conntrack_hash_insert(ct);
+	err = nf_conntrack_hash_check_insert(ct);
+	if (err < 0) {
+		if (ct->master)
+			nf_ct_put(ct->master);
+		goto err2;
+	}
 	rcu_read_unlock();
 
 	return ct;
@@ -1333,9 +1337,9 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 
 	spin_lock_bh(&nf_conntrack_lock);
 	if (cda[CTA_TUPLE_ORIG])
-		h = __nf_conntrack_find(&init_net, &otuple);
+		h = nf_conntrack_find_get(&init_net, &otuple);
 	else if (cda[CTA_TUPLE_REPLY])
-		h = __nf_conntrack_find(&init_net, &rtuple);
+		h = nf_conntrack_find_get(&init_net, &rtuple);
 
 	if (h == NULL) {
 		err = -ENOENT;
@@ -1350,7 +1354,6 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 				goto out_unlock;
 			}
 			err = 0;
-			nf_conntrack_get(&ct->ct_general);
 			spin_unlock_bh(&nf_conntrack_lock);
 			if (test_bit(IPS_EXPECTED_BIT, &ct->status))
 				events = IPCT_RELATED;
@@ -1372,16 +1375,16 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 	}
 	/* implicit 'else' */
 
-	/* We manipulate the conntrack inside the global conntrack table lock,
-	 * so there's no need to increase the refcount */
+	/* The hash chains are not under nf_conntrack_lock, so we hold a
+	 * reference from the lookup on; the lock still keeps helpers and
+	 * expectations stable while we change the conntrack. */
 	err = -EEXIST;
 	if (!(nlh->nlmsg_flags & NLM_F_EXCL)) {
 		struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
 
 		err = ctnetlink_change_conntrack(ct, cda);
-		if (err == 0) {
-			nf_conntrack_get(&ct->ct_general);
-			spin_unlock_bh(&nf_conntrack_lock);
+		spin_unlock_bh(&nf_conntrack_lock);
+		if (err == 0)
 			nf_conntrack_eventmask_report((1 << IPCT_STATUS) |
 						      (1 << IPCT_HELPER) |
 						      (1 << IPCT_PROTOINFO) |
@@ -1389,12 +1392,10 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 						      (1 << IPCT_MARK),
 						      ct, NETLINK_CB(skb).pid,
 						      nlmsg_report(nlh));
-			nf_ct_put(ct);
-		} else
-			spin_unlock_bh(&nf_conntrack_lock);
-
+		nf_ct_put(ct);
 		return err;
 	}
+	nf_ct_put(nf_ct_tuplehash_to_ctrack(h));
 
 out_unlock:
 	spin_unlock_bh(&nf_conntrack_lock);
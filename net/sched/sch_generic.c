@@ -35,6 +35,9 @@
  * - enqueue, dequeue are serialized via qdisc root lock
  * - ingress filtering is also serialized via qdisc root lock
  * - updates to tree and tree walking are only done under the rtnl mutex.
+ *
+ * A TCQ_F_NOLOCK qdisc is enqueued to without the root lock.  Dequeue,
+ * reset and the rest still happen under it.
  */
 
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
@@ -57,7 +60,7 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) &&
+		if (!netif_xmit_stopped(txq) &&
 		    !netif_tx_queue_frozen(txq)) {
 			q->gso_skb = NULL;
 			q->q.qlen--;
@@ -119,7 +122,7 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) &&
+	if (!netif_xmit_stopped(txq) &&
 	    !netif_tx_queue_frozen(txq))
 		ret = dev_hard_start_xmit(skb, dev, txq);
 	HARD_TX_UNLOCK(dev, txq);
@@ -147,7 +150,7 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		break;
 	}
 
-	if (ret && (netif_tx_queue_stopped(txq) ||
+	if (ret && (netif_xmit_stopped(txq) ||
 		    netif_tx_queue_frozen(txq)))
 		ret = 0;
 
@@ -209,6 +212,16 @@ void __qdisc_run(struct Qdisc *q)
 	}
 
 	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+
+	/* A lockless enqueue that found us running left its packet to us;
+	 * a stopped queue picks it up when it is woken.
+	 */
+	if (q->flags & TCQ_F_NOLOCK) {
+		smp_mb__after_clear_bit();
+		if (!q->gso_skb && !netif_xmit_stopped(q->dev_queue) &&
+		    !netif_tx_queue_frozen(q->dev_queue) && q->ops->peek(q))
+			__netif_schedule(q);
+	}
 }
 
 unsigned long dev_trans_start(struct net_device *dev)
@@ -544,6 +557,178 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.owner		=	THIS_MODULE,
 };
 
+/*
+ * Lockless pfifo_fast, the default for the queues of a multiqueue device.
+ *
+ * Each band is a ring of skb pointers.  Senders only serialize on the
+ * band's producer lock, not on the qdisc root lock; the consumer is
+ * whoever holds __QDISC_STATE_RUNNING, under the root lock as before.
+ * The rings are sized from tx_queue_len when the qdisc is created.
+ *
+ * Packets are counted in bstats as they are dequeued, and q.qlen is the
+ * queue length as the consumer last saw it.
+ */
+struct pfifo_fast_ring {
+	spinlock_t		producer_lock;
+	unsigned int		head;
+	unsigned int		tail ____cacheline_aligned_in_smp;
+	unsigned int		mask;
+	struct sk_buff		**queue;
+};
+
+struct pfifo_fast_nolock_priv {
+	struct pfifo_fast_ring	ring[PFIFO_FAST_BANDS];
+	atomic_t		drops;
+};
+
+static inline unsigned int pfifo_fast_ring_len(struct pfifo_fast_ring *r)
+{
+	return ACCESS_ONCE(r->head) - r->tail;
+}
+
+static struct sk_buff *pfifo_fast_ring_peek(struct pfifo_fast_ring *r)
+{
+	if (r->tail == ACCESS_ONCE(r->head))
+		return NULL;
+
+	smp_rmb();
+	return r->queue[r->tail & r->mask];
+}
+
+static struct sk_buff *pfifo_fast_ring_consume(struct pfifo_fast_ring *r)
+{
+	struct sk_buff *skb = pfifo_fast_ring_peek(r);
+
+	if (skb) {
+		/* The slot must be read before a producer may reuse it. */
+		smp_mb();
+		r->tail++;
+	}
+	return skb;
+}
+
+static int pfifo_fast_nolock_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct pfifo_fast_ring *r = &priv->ring[band];
+
+	spin_lock(&r->producer_lock);
+	if (unlikely(r->head - ACCESS_ONCE(r->tail) > r->mask)) {
+		spin_unlock(&r->producer_lock);
+		atomic_inc(&priv->drops);
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
+	}
+	r->queue[r->head & r->mask] = skb;
+	smp_wmb();
+	r->head++;
+	spin_unlock(&r->producer_lock);
+
+	return NET_XMIT_SUCCESS;
+}
+
+static struct sk_buff *pfifo_fast_nolock_dequeue(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	unsigned int qlen = 0;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_fast_ring_consume(&priv->ring[band]);
+
+	if (skb)
+		__qdisc_update_bstats(qdisc, qdisc_pkt_len(skb));
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		qlen += pfifo_fast_ring_len(&priv->ring[band]);
+	qdisc->q.qlen = qlen;
+
+	if (unlikely(atomic_read(&priv->drops)))
+		qdisc->qstats.drops += atomic_xchg(&priv->drops, 0);
+
+	return skb;
+}
+
+static struct sk_buff *pfifo_fast_nolock_peek(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_fast_ring_peek(&priv->ring[band]);
+
+	return skb;
+}
+
+static void pfifo_fast_nolock_reset(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_fast_ring *r = &priv->ring[band];
+
+		if (!r->queue)
+			continue;
+		while ((skb = pfifo_fast_ring_consume(r)) != NULL)
+			kfree_skb(skb);
+	}
+
+	qdisc->qstats.drops += atomic_xchg(&priv->drops, 0);
+	qdisc->qstats.backlog = 0;
+	qdisc->q.qlen = 0;
+}
+
+static void pfifo_fast_nolock_destroy(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		kfree(priv->ring[band].queue);
+}
+
+static int pfifo_fast_nolock_init(struct Qdisc *qdisc, struct nlattr *opt)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	unsigned int size;
+	int band;
+
+	size = roundup_pow_of_two(max_t(unsigned long,
+					qdisc_dev(qdisc)->tx_queue_len, 1));
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_fast_ring *r = &priv->ring[band];
+
+		r->queue = kcalloc(size, sizeof(*r->queue), GFP_KERNEL);
+		if (!r->queue)
+			return -ENOMEM;
+		spin_lock_init(&r->producer_lock);
+		r->mask = size - 1;
+	}
+	atomic_set(&priv->drops, 0);
+
+	qdisc->flags |= TCQ_F_NOLOCK;
+	return 0;
+}
+
+struct Qdisc_ops pfifo_fast_nolock_ops __read_mostly = {
+	.id		=	"pfifo_fast",
+	.priv_size	=	sizeof(struct pfifo_fast_nolock_priv),
+	.enqueue	=	pfifo_fast_nolock_enqueue,
+	.dequeue	=	pfifo_fast_nolock_dequeue,
+	.peek		=	pfifo_fast_nolock_peek,
+	.init		=	pfifo_fast_nolock_init,
+	.reset		=	pfifo_fast_nolock_reset,
+	.destroy	=	pfifo_fast_nolock_destroy,
+	.dump		=	pfifo_fast_dump,
+	.owner		=	THIS_MODULE,
+};
+
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 			  struct Qdisc_ops *ops)
 {
@@ -800,6 +985,20 @@ static bool some_qdisc_is_busy(struct net_device *dev)
 	return false;
 }
 
+/* Drop what lockless enqueues put in after dev_deactivate_queue(). */
+static void dev_reset_queue(struct net_device *dev,
+			    struct netdev_queue *dev_queue,
+			    void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
+
+	if (qdisc && (qdisc->flags & TCQ_F_NOLOCK)) {
+		spin_lock_bh(qdisc_lock(qdisc));
+		qdisc_reset(qdisc);
+		spin_unlock_bh(qdisc_lock(qdisc));
+	}
+}
+
 void dev_deactivate(struct net_device *dev)
 {
 	netdev_for_each_tx_queue(dev, dev_deactivate_queue, &noop_qdisc);
@@ -813,6 +1012,8 @@ void dev_deactivate(struct net_device *dev)
 	/* Wait for outstanding qdisc_run calls. */
 	while (some_qdisc_is_busy(dev))
 		yield();
+
+	netdev_for_each_tx_queue(dev, dev_reset_queue, NULL);
 }
 
 static void dev_init_scheduler_queue(struct net_device *dev,
@@ -930,20 +930,56 @@ void xprt_transmit(struct rpc_task *task)
 	spin_unlock_bh(&xprt->transport_lock);
 }
 
+/*
+ * Beyond the preallocated slot table, slots are allocated on demand up
+ * to xprt->max_reqs, so that a fast server isn't held back by a small
+ * fixed number of outstanding calls.  Called with xprt->reserve_lock.
+ */
+static struct rpc_rqst *xprt_dynamic_alloc_slot(struct rpc_xprt *xprt)
+{
+	struct rpc_rqst *req;
+
+	if (xprt->num_reqs >= xprt->max_reqs)
+		return NULL;
+	req = kzalloc(sizeof(*req), GFP_NOWAIT);
+	if (req == NULL)
+		return NULL;
+	INIT_LIST_HEAD(&req->rq_list);
+	xprt->num_reqs++;
+	return req;
+}
+
+/* Free the slot if it was allocated on demand */
+static bool xprt_dynamic_free_slot(struct rpc_xprt *xprt, struct rpc_rqst *req)
+{
+	if (req >= xprt->slot && req < xprt->slot + xprt->min_reqs)
+		return false;
+	xprt->num_reqs--;
+	kfree(req);
+	return true;
+}
+
 static inline void do_xprt_reserve(struct rpc_task *task)
 {
 	struct rpc_xprt	*xprt = task->tk_xprt;
+	struct rpc_rqst	*req;
 
 	task->tk_status = 0;
 	if (task->tk_rqstp)
 		return;
 	if (!list_empty(&xprt->free)) {
-		struct rpc_rqst	*req = list_entry(xprt->free.next, struct rpc_rqst, rq_list);
+		req = list_entry(xprt->free.next, struct rpc_rqst, rq_list);
 		list_del_init(&req->rq_list);
 		task->tk_rqstp = req;
 		xprt_request_init(task, xprt);
 		return;
 	}
+	req = xprt_dynamic_alloc_slot(xprt);
+	if (req != NULL) {
+		task->tk_rqstp = req;
+		xprt_request_init(task, xprt);
+		return;
+	}
 	dprintk("RPC:       waiting for request slot\n");
 	task->tk_status = -EAGAIN;
 	task->tk_timeout = 0;
@@ -1040,7 +1076,8 @@ void xprt_release(struct rpc_task *task)
 	dprintk("RPC: %5u release request %p\n", task->tk_pid, req);
 
 	spin_lock(&xprt->reserve_lock);
-	list_add(&req->rq_list, &xprt->free);
+	if (!xprt_dynamic_free_slot(xprt, req))
+		list_add(&req->rq_list, &xprt->free);
 	rpc_wake_up_next(&xprt->backlog);
 	spin_unlock(&xprt->reserve_lock);
 }
@@ -1103,13 +1140,16 @@ found:
 	rpc_init_priority_wait_queue(&xprt->backlog, "xprt_backlog");
 
 	/* initialize free list */
-	for (req = &xprt->slot[xprt->max_reqs-1]; req >= &xprt->slot[0]; req--)
+	if (!xprt->min_reqs)
+		xprt->min_reqs = xprt->max_reqs;
+	xprt->num_reqs = xprt->min_reqs;
+	for (req = &xprt->slot[xprt->min_reqs-1]; req >= &xprt->slot[0]; req--)
 		list_add(&req->rq_list, &xprt->free);
 
 	xprt_init_xid(xprt);
 
-	dprintk("RPC:       created transport %p with %u slots\n", xprt,
-			xprt->max_reqs);
+	dprintk("RPC:       created transport %p with %u (max %u) slots\n",
+			xprt, xprt->min_reqs, xprt->max_reqs);
 	return xprt;
 }
 
@@ -499,6 +499,8 @@ static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t, int);
 static int unix_dgram_connect(struct socket *, struct sockaddr *,
 			      int, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
+				    size_t size, int flags);
 static int unix_seqpacket_sendmsg(struct kiocb *, struct socket *,
 				  struct msghdr *, size_t);
 static int unix_seqpacket_recvmsg(struct kiocb *, struct socket *,
@@ -522,7 +524,7 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1524,6 +1526,18 @@ out:
 }
 
 
+/*
+ * Stream data beyond what fits in an order-0 head goes in page frags,
+ * so large writes get big skbs (and few peer wakeups) without needing
+ * high-order allocations.
+ */
+#define UNIX_SKB_FRAGS_SZ	32768
+
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
 {
@@ -1531,7 +1545,7 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	struct sock *sk = sock->sk;
 	struct sock *other = NULL;
 	struct sockaddr_un *sunaddr = msg->msg_name;
-	int err, size;
+	int err, size, data_len;
 	struct sk_buff *skb;
 	int sent = 0;
 	struct scm_cookie tmp_scm;
@@ -1575,28 +1589,21 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		if (size > ((sk->sk_sndbuf >> 1) - 64))
 			size = (sk->sk_sndbuf >> 1) - 64;
 
-		if (size > SKB_MAX_ALLOC)
-			size = SKB_MAX_ALLOC;
+		if (size > SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ)
+			size = SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ;
+
+		data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
 
 		/*
 		 *	Grab a buffer
 		 */
 
-		skb = sock_alloc_send_skb(sk, size, msg->msg_flags&MSG_DONTWAIT,
-					  &err);
+		skb = sock_alloc_send_pskb(sk, size - data_len, data_len,
+					   msg->msg_flags & MSG_DONTWAIT, &err);
 
 		if (skb == NULL)
 			goto out_err;
 
-		/*
-		 *	If you pass two values to the sock_alloc_send_skb
-		 *	it tries to grab the large buffer with GFP_NOFS
-		 *	(which can fail easily), and if it fails grab the
-		 *	fallback size buffer which is under a page and will
-		 *	succeed. [Alan]
-		 */
-		size = min_t(int, size, skb_tailroom(skb));
-
 		memcpy(UNIXCREDS(skb), &siocb->scm->creds, sizeof(struct ucred));
 		/* Only send the fds in the first buffer */
 		if (siocb->scm->fp && !fds_sent) {
@@ -1609,7 +1616,11 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			fds_sent = true;
 		}
 
-		err = memcpy_fromiovec(skb_put(skb, size), msg->msg_iov, size);
+		skb_put(skb, size - data_len);
+		skb->data_len = data_len;
+		skb->len = size;
+		err = skb_copy_datagram_from_iovec(skb, 0, msg->msg_iov,
+						   sent, size);
 		if (err) {
 			kfree_skb(skb);
 			goto out_err;
@@ -1647,6 +1658,68 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ * splice() to a stream socket: queue a reference to the page instead
+ * of copying it, the way TCP's sendpage does.  The reader copies it out
+ * once, in recvmsg.
+ */
+static ssize_t unix_stream_sendpage(struct socket *sock, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sock *other;
+	struct sk_buff *skb;
+	struct scm_cookie scm;
+	struct msghdr msg = { .msg_flags = flags };
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	skb = sock_alloc_send_pskb(sk, 0, 0, flags & MSG_DONTWAIT, &err);
+	if (skb == NULL)
+		return err;
+
+	err = scm_send(sock, &msg, &scm);
+	if (err < 0) {
+		kfree_skb(skb);
+		return err;
+	}
+	memcpy(UNIXCREDS(skb), &scm.creds, sizeof(struct ucred));
+	scm_destroy(&scm);
+
+	get_page(page);
+	skb_fill_page_desc(skb, 0, page, offset, size);
+	skb->len = size;
+	skb->data_len = size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	unix_state_lock(other);
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		unix_state_unlock(other);
+		kfree_skb(skb);
+		goto pipe_err;
+	}
+	skb_queue_tail(&other->sk_receive_queue, skb);
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+	return size;
+
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	return -EPIPE;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1905,8 +1978,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1917,13 +1991,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
@@ -2016,7 +2090,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
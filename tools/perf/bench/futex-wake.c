@@ -0,0 +1,160 @@
+/*
+ * futex-wake.c
+ *
+ * wake: Benchmark for FUTEX_WAKE
+ *
+ * A number of threads block on one private futex, and then get woken
+ * up one at a time; the time it takes to wake them all is the result.
+ * The round is repeated to smooth out the noise.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+
+static int nthreads;
+static int nrepeat = 10;
+
+/* the one futex the threads wait on, never changes value */
+static int futex_word;
+
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_parent = PTHREAD_COND_INITIALIZER;
+static int threads_starting;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nthreads,
+		    "Specify number of threads (default: number of cpus)"),
+	OPT_INTEGER('r', "repeat", &nrepeat,
+		    "Specify number of times to repeat the run"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static inline int futex_wait(int *uaddr, int val)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_WAIT_PRIVATE, val,
+		       NULL, NULL, 0);
+}
+
+static inline int futex_wake(int *uaddr, int nr)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_WAKE_PRIVATE, nr,
+		       NULL, NULL, 0);
+}
+
+static void *workerfn(void *arg __used)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_mutex_unlock(&thread_lock);
+
+	/* the value never changes, so the only way out is a wakeup */
+	while (futex_wait(&futex_word, 0) && errno == EINTR)
+		;
+	return NULL;
+}
+
+static unsigned long long wake_round(pthread_t *workers)
+{
+	struct timeval start, end, diff;
+	int i, nwoken = 0, ret;
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&workers[i], NULL, workerfn, NULL);
+		if (ret)
+			die("pthread_create: %s", strerror(ret));
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	/* give the last of them the time to actually block */
+	usleep(100000);
+
+	gettimeofday(&start, NULL);
+	while (nwoken != nthreads) {
+		ret = futex_wake(&futex_word, 1);
+		if (ret < 0)
+			die("futex_wake: %s", strerror(errno));
+		nwoken += ret;
+	}
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i], NULL);
+
+	timersub(&end, &start, &diff);
+	return diff.tv_sec * 1000000ULL + diff.tv_usec;
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned long long usec, total = 0, min_usec = ~0ULL, max_usec = 0;
+	pthread_t *workers;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_wake_usage, 0);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1 || nrepeat < 1)
+		usage_with_options(bench_futex_wake_usage, options);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc: %s", strerror(errno));
+
+	for (i = 0; i < nrepeat; i++) {
+		usec = wake_round(workers);
+		total += usec;
+		if (usec < min_usec)
+			min_usec = usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+
+	free(workers);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Woke up %d threads one by one, %d time(s)\n\n",
+		       nthreads, nrepeat);
+		printf(" %14lf usecs/round (min %llu, max %llu)\n",
+		       (double)total / nrepeat, min_usec, max_usec);
+		printf(" %14lf usecs/wakeup\n",
+		       (double)total / nrepeat / nthreads);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", (double)total / nrepeat / nthreads);
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
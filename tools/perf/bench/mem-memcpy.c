@@ -0,0 +1,237 @@
+/*
+ * mem-memcpy.c
+ *
+ * memcpy: Simple memory copy
+ *
+ * Copies a buffer of the given length, either timed with gettimeofday()
+ * or counted in cpu cycles with a perf counter.  The buffers are touched
+ * before the copy so page faults are not part of the result.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../util/string.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#define K 1024
+
+static const char	*length_str	= "1MB";
+static const char	*routine	= "default";
+static int		iterations	= 1;
+static int		use_clock;
+static int		clock_fd;
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "1MB",
+		    "Specify length of memory to copy. "
+		    "available unit: B, KB, MB, GB (upper and lower)"),
+	OPT_STRING('r', "routine", &routine, "default",
+		    "Specify routine to copy"),
+	OPT_INTEGER('i', "iterations", &iterations,
+		    "Specify number of copies to time"),
+	OPT_BOOLEAN('c', "clock", &use_clock,
+		    "Use CPU clock for measuring"),
+	OPT_END()
+};
+
+struct routine {
+	const char *name;
+	const char *desc;
+	void * (*fn)(void *dst, const void *src, size_t len);
+};
+
+#ifdef __x86_64__
+/* mem-memcpy-x86-64-asm.S */
+extern void *memcpy_x86_64_unrolled(void *dst, const void *src, size_t len);
+extern void *memcpy_x86_64_movsq(void *dst, const void *src, size_t len);
+extern void *memcpy_x86_64_movsb(void *dst, const void *src, size_t len);
+extern void *memcpy_x86_64_erms(void *dst, const void *src, size_t len);
+#endif
+
+static struct routine routines[] = {
+	{ "default",
+	  "Default memcpy() provided by glibc",
+	  memcpy },
+#ifdef __x86_64__
+	{ "x86-64-unrolled",
+	  "unrolled memcpy() of the kernel",
+	  memcpy_x86_64_unrolled },
+	{ "x86-64-movsq",
+	  "REP MOVSQ memcpy() of the kernel, with REP_GOOD",
+	  memcpy_x86_64_movsq },
+	{ "x86-64-erms",
+	  "REP MOVSB memcpy() of the kernel, with ERMS",
+	  memcpy_x86_64_erms },
+	{ "x86-64-movsb",
+	  "REP MOVSB for every length",
+	  memcpy_x86_64_movsb },
+#endif
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+static const char * const bench_mem_memcpy_usage[] = {
+	"perf bench mem memcpy <options>",
+	NULL
+};
+
+static struct perf_event_attr clock_attr = {
+	.type		= PERF_TYPE_HARDWARE,
+	.config		= PERF_COUNT_HW_CPU_CYCLES
+};
+
+static void init_clock(void)
+{
+	clock_fd = sys_perf_event_open(&clock_attr, getpid(), -1, -1, 0);
+
+	if (clock_fd < 0 && errno == ENOSYS)
+		die("No CONFIG_PERF_EVENTS=y kernel support configured?\n");
+	else if (clock_fd < 0)
+		die("sys_perf_event_open() failed: %s\n", strerror(errno));
+}
+
+static u64 get_clock(void)
+{
+	int ret;
+	u64 clk;
+
+	ret = read(clock_fd, &clk, sizeof(u64));
+	if (ret != sizeof(u64))
+		die("read of the cpu cycle counter failed\n");
+
+	return clk;
+}
+
+static double timeval2double(struct timeval *ts)
+{
+	return (double)ts->tv_sec +
+		(double)ts->tv_usec / (double)1000000;
+}
+
+int bench_mem_memcpy(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	int i;
+	struct routine *r;
+	void *dst, *src;
+	size_t length;
+	double bps = 0.0;
+	struct timeval tv_start, tv_end, tv_diff;
+	u64 clock_start, clock_end, clock_diff;
+
+	clock_start = clock_end = clock_diff = 0ULL;
+	argc = parse_options(argc, argv, options,
+			     bench_mem_memcpy_usage, 0);
+
+	tv_diff.tv_sec = 0;
+	tv_diff.tv_usec = 0;
+	length = (size_t)perf_atoll(length_str);
+
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+
+	if (iterations < 1) {
+		fprintf(stderr, "Invalid number of iterations:%d\n",
+			iterations);
+		return 1;
+	}
+
+	for (i = 0; routines[i].name; i++) {
+		if (!strcmp(routines[i].name, routine))
+			break;
+	}
+	if (!routines[i].name) {
+		printf("Unknown routine:%s\n", routine);
+		printf("Available routines...\n");
+		for (i = 0; routines[i].name; i++) {
+			printf("\t%s ... %s\n",
+			       routines[i].name, routines[i].desc);
+		}
+		return 1;
+	}
+	r = &routines[i];
+
+	dst = calloc(1, length);
+	if (!dst)
+		die("memory allocation failed - maybe length is too large?\n");
+
+	src = calloc(1, length);
+	if (!src)
+		die("memory allocation failed - maybe length is too large?\n");
+
+	/* fault both buffers in, and warm them up */
+	memset(src, 0xa5, length);
+	r->fn(dst, src, length);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		printf("# Copying %s Bytes from %p to %p %d time(s) ...\n\n",
+		       length_str, src, dst, iterations);
+	}
+
+	if (use_clock) {
+		init_clock();
+		clock_start = get_clock();
+	} else {
+		gettimeofday(&tv_start, NULL);
+	}
+
+	for (i = 0; i < iterations; i++)
+		r->fn(dst, src, length);
+
+	if (use_clock) {
+		clock_end = get_clock();
+		clock_diff = clock_end - clock_start;
+	} else {
+		gettimeofday(&tv_end, NULL);
+		timersub(&tv_end, &tv_start, &tv_diff);
+		bps = (double)((double)length * iterations /
+			       timeval2double(&tv_diff));
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		if (use_clock) {
+			printf(" %14lf Clock/Byte\n",
+			       (double)clock_diff /
+			       ((double)length * iterations));
+		} else {
+			if (bps < K)
+				printf(" %14lf B/Sec\n", bps);
+			else if (bps < K * K)
+				printf(" %14lf KB/Sec\n", bps / 1024);
+			else if (bps < K * K * K)
+				printf(" %14lf MB/Sec\n", bps / 1024 / 1024);
+			else {
+				printf(" %14lf GB/Sec\n",
+				       bps / 1024 / 1024 / 1024);
+			}
+		}
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		if (use_clock) {
+			printf("%lf\n",
+			       (double)clock_diff /
+			       ((double)length * iterations));
+		} else
+			printf("%lf\n", bps);
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * sched-pipe.c
+ *
+ * pipe: Benchmark for pipe()
+ *
+ * Two tasks bounce an int over a pair of pipes, so every operation is
+ * a wakeup and a context switch.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 1000000
+static int loops = LOOPS_DEFAULT;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of loops"),
+	OPT_END()
+};
+
+static const char * const bench_sched_pipe_usage[] = {
+	"perf bench sched pipe <options>",
+	NULL
+};
+
+static void pipe_xfer(int rfd, int wfd, int *m, int first_write)
+{
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		if (first_write && write(wfd, m, sizeof(int)) != sizeof(int))
+			die("pipe write: %s", strerror(errno));
+		if (read(rfd, m, sizeof(int)) != sizeof(int))
+			die("pipe read: %s", strerror(errno));
+		if (!first_write && write(wfd, m, sizeof(int)) != sizeof(int))
+			die("pipe write: %s", strerror(errno));
+	}
+}
+
+int bench_sched_pipe(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	int pipe_1[2], pipe_2[2];
+	int m = 0;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec = 0;
+	int wait_stat;
+	pid_t pid, retpid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_pipe_usage, 0);
+	if (loops < 1)
+		usage_with_options(bench_sched_pipe_usage, options);
+
+	if (pipe(pipe_1) || pipe(pipe_2))
+		die("pipe: %s", strerror(errno));
+
+	pid = fork();
+	if (pid < 0)
+		die("fork: %s", strerror(errno));
+
+	gettimeofday(&start, NULL);
+
+	if (!pid) {
+		pipe_xfer(pipe_1[0], pipe_2[1], &m, 0);
+		exit(0);
+	}
+
+	pipe_xfer(pipe_2[0], pipe_1[1], &m, 1);
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	retpid = waitpid(pid, &wait_stat, 0);
+	if (retpid != pid || !WIFEXITED(wait_stat))
+		die("pipe benchmark child failed");
+
+	result_usec = diff.tv_sec * 1000000ULL;
+	result_usec += diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %d pipe operations between two tasks\n\n",
+		       loops);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       (unsigned long)diff.tv_sec,
+		       (unsigned long)(diff.tv_usec / 1000));
+
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec / (double)loops);
+		printf(" %14llu ops/sec\n",
+		       result_usec ? loops * 1000000ULL / result_usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       (unsigned long)diff.tv_sec,
+		       (unsigned long)(diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * xen-hypercall.c
+ *
+ * multicall: the cost of a cheap hypercall, issued one by one and
+ *            batched into multicalls
+ * grant:     the same for a grant table operation
+ *
+ * The hypercalls go through /proc/xen/privcmd, so this needs to run as
+ * root in a domain that has xenfs mounted, normally dom0.  Both suites
+ * only use operations that read state.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+/*
+ * The bits of the privcmd and hypercall ABIs used here; see
+ * include/xen/privcmd.h and include/xen/interface/.
+ */
+struct privcmd_hypercall {
+	u64 op;
+	u64 arg[5];
+};
+
+#define IOCTL_PRIVCMD_HYPERCALL					\
+	_IOC(_IOC_NONE, 'P', 0, sizeof(struct privcmd_hypercall))
+
+#define __HYPERVISOR_multicall		13
+#define __HYPERVISOR_xen_version	17
+#define __HYPERVISOR_grant_table_op	20
+
+#define XENVER_version			0
+#define GNTTABOP_query_size		6
+#define DOMID_SELF			0x7FF0U
+
+struct multicall_entry {
+	unsigned long op;
+	long result;
+	unsigned long args[6];
+};
+
+struct gnttab_query_size {
+	uint16_t dom;
+	uint32_t nr_frames;
+	uint32_t max_nr_frames;
+	int16_t status;
+};
+
+static int loops = 100000;
+static int batch = 32;
+
+static int privcmd_fd = -1;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of hypercalls"),
+	OPT_INTEGER('b', "batch", &batch,
+		    "Specify number of hypercalls per multicall"),
+	OPT_END()
+};
+
+static const char * const bench_xen_multicall_usage[] = {
+	"perf bench xen multicall <options>",
+	NULL
+};
+
+static const char * const bench_xen_grant_usage[] = {
+	"perf bench xen grant <options>",
+	NULL
+};
+
+static long hypercall(struct privcmd_hypercall *call)
+{
+	return ioctl(privcmd_fd, IOCTL_PRIVCMD_HYPERCALL, call);
+}
+
+static unsigned long long time_calls(struct privcmd_hypercall *call,
+				     int count)
+{
+	struct timeval start, stop, diff;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+		hypercall(call);
+	gettimeofday(&stop, NULL);
+
+	timersub(&stop, &start, &diff);
+	return diff.tv_sec * 1000000ULL + diff.tv_usec;
+}
+
+/*
+ * Time @loops copies of @one issued one by one, then loops / batch
+ * multicalls of batch copies each.  Hypercall arguments pointing to
+ * memory must stay locked, Xen cannot fault them in.
+ */
+static int run_bench(const char *name, struct privcmd_hypercall *one)
+{
+	struct privcmd_hypercall multi;
+	struct multicall_entry *entries;
+	unsigned long long single_usec, batched_usec;
+	int i, j, nbatches;
+	long ret;
+
+	privcmd_fd = open("/proc/xen/privcmd", O_RDWR);
+	if (privcmd_fd < 0) {
+		fprintf(stderr, "Cannot open /proc/xen/privcmd: %s\n"
+			"(needs root in a Xen domain with xenfs mounted)\n",
+			strerror(errno));
+		return 1;
+	}
+
+	entries = calloc(batch, sizeof(*entries));
+	if (!entries)
+		die("calloc: %s", strerror(errno));
+	if (mlock(entries, batch * sizeof(*entries)))
+		die("mlock: %s", strerror(errno));
+
+	for (i = 0; i < batch; i++) {
+		entries[i].op = one->op;
+		for (j = 0; j < 5; j++)
+			entries[i].args[j] = one->arg[j];
+	}
+
+	memset(&multi, 0, sizeof(multi));
+	multi.op = __HYPERVISOR_multicall;
+	multi.arg[0] = (unsigned long)entries;
+	multi.arg[1] = batch;
+
+	/* check both work before timing them */
+	ret = hypercall(one);
+	if (ret < 0) {
+		fprintf(stderr, "%s hypercall failed: %s\n",
+			name, strerror(errno));
+		return 1;
+	}
+	ret = hypercall(&multi);
+	if (ret < 0 || entries[0].result < 0) {
+		fprintf(stderr, "multicall of %s failed: %ld / %ld\n",
+			name, ret < 0 ? -errno : ret, entries[0].result);
+		return 1;
+	}
+
+	nbatches = loops / batch;
+	if (!nbatches)
+		nbatches = 1;
+
+	single_usec = time_calls(one, loops);
+	batched_usec = time_calls(&multi, nbatches);
+
+	munlock(entries, batch * sizeof(*entries));
+	free(entries);
+	close(privcmd_fd);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d %s hypercalls, single and in multicalls of %d\n\n",
+		       loops, name, batch);
+		printf(" %14s: %14lf nsecs/op\n", "single",
+		       single_usec * 1000.0 / loops);
+		printf(" %14s: %14lf nsecs/op\n", "batched",
+		       batched_usec * 1000.0 / ((double)nbatches * batch));
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", single_usec * 1000.0 / loops);
+		printf("%lf\n",
+		       batched_usec * 1000.0 / ((double)nbatches * batch));
+		break;
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
+
+int bench_xen_multicall(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct privcmd_hypercall call;
+
+	argc = parse_options(argc, argv, options,
+			     bench_xen_multicall_usage, 0);
+	if (loops < 1 || batch < 1)
+		usage_with_options(bench_xen_multicall_usage, options);
+
+	/* about the cheapest hypercall there is: no arguments, no locks */
+	memset(&call, 0, sizeof(call));
+	call.op = __HYPERVISOR_xen_version;
+	call.arg[0] = XENVER_version;
+
+	return run_bench("xen_version", &call);
+}
+
+int bench_xen_grant(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	static struct gnttab_query_size query;
+	struct privcmd_hypercall call;
+
+	argc = parse_options(argc, argv, options,
+			     bench_xen_grant_usage, 0);
+	if (loops < 1 || batch < 1)
+		usage_with_options(bench_xen_grant_usage, options);
+
+	/* takes the grant table lock of our own domain */
+	query.dom = DOMID_SELF;
+	if (mlock(&query, sizeof(query)))
+		die("mlock: %s", strerror(errno));
+
+	memset(&call, 0, sizeof(call));
+	call.op = __HYPERVISOR_grant_table_op;
+	call.arg[0] = GNTTABOP_query_size;
+	call.arg[1] = (unsigned long)&query;
+	call.arg[2] = 1;
+
+	return run_bench("grant_table_op(query_size)", &call);
+}
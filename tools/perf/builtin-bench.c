@@ -0,0 +1,215 @@
+/*
+ * builtin-bench.c
+ *
+ * General benchmarking subsystem provided by perf
+ *
+ * Available subsystem list:
+ *  sched ... scheduler and IPC mechanism
+ *  mem   ... memory access performance
+ *  futex ... futex wait and wake
+ *  xen   ... hypercall costs, when running on Xen
+ */
+
+#include "perf.h"
+#include "util/util.h"
+#include "util/parse-options.h"
+#include "builtin.h"
+#include "bench/bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bench_suite {
+	const char *name;
+	const char *summary;
+	int (*fn)(int, const char **, const char *);
+};
+
+static struct bench_suite sched_suites[] = {
+	{ "messaging",
+	  "Benchmark for scheduler and IPC mechanisms",
+	  bench_sched_messaging },
+	{ "pipe",
+	  "Flood of communication over pipe() between two processes",
+	  bench_sched_pipe },
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+static struct bench_suite mem_suites[] = {
+	{ "memcpy",
+	  "Simple memory copy",
+	  bench_mem_memcpy },
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+static struct bench_suite futex_suites[] = {
+	{ "wake",
+	  "Wake up threads blocked on one futex",
+	  bench_futex_wake },
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+static struct bench_suite xen_suites[] = {
+	{ "multicall",
+	  "Single hypercalls against batches of them in one multicall",
+	  bench_xen_multicall },
+	{ "grant",
+	  "Grant table operations, single and batched",
+	  bench_xen_grant },
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+struct bench_subsys {
+	const char *name;
+	const char *summary;
+	struct bench_suite *suites;
+};
+
+static struct bench_subsys subsystems[] = {
+	{ "sched",
+	  "scheduler and IPC mechanism",
+	  sched_suites },
+	{ "mem",
+	  "memory access performance",
+	  mem_suites },
+	{ "futex",
+	  "futex wait and wake",
+	  futex_suites },
+	{ "xen",
+	  "Xen hypercall costs (needs /proc/xen/privcmd)",
+	  xen_suites },
+	{ NULL,
+	  NULL,
+	  NULL }
+};
+
+static void dump_suites(int subsys_index)
+{
+	int i;
+
+	printf("List of available suites for %s...\n\n",
+	       subsystems[subsys_index].name);
+
+	for (i = 0; subsystems[subsys_index].suites[i].name; i++)
+		printf("\t%s: %s\n",
+		       subsystems[subsys_index].suites[i].name,
+		       subsystems[subsys_index].suites[i].summary);
+
+	printf("\n");
+}
+
+static const char *bench_format_str;
+int bench_format = BENCH_FORMAT_DEFAULT;
+
+static const struct option bench_options[] = {
+	OPT_STRING('f', "format", &bench_format_str, "default",
+		    "Specify format style"),
+	OPT_END()
+};
+
+static const char * const bench_usage[] = {
+	"perf bench [<common options>] <subsystem> <suite> [<options>]",
+	NULL
+};
+
+static void print_usage(void)
+{
+	int i;
+
+	printf("Usage: \n");
+	for (i = 0; bench_usage[i]; i++)
+		printf("\t%s\n", bench_usage[i]);
+	printf("\n");
+
+	printf("List of available subsystems...\n\n");
+
+	for (i = 0; subsystems[i].name; i++)
+		printf("\t%s: %s\n",
+		       subsystems[i].name, subsystems[i].summary);
+	printf("\n");
+}
+
+static int bench_str2int(const char *str)
+{
+	if (!str)
+		return BENCH_FORMAT_DEFAULT;
+
+	if (!strcmp(str, BENCH_FORMAT_DEFAULT_STR))
+		return BENCH_FORMAT_DEFAULT;
+	else if (!strcmp(str, BENCH_FORMAT_SIMPLE_STR))
+		return BENCH_FORMAT_SIMPLE;
+
+	return BENCH_FORMAT_UNKNOWN;
+}
+
+int cmd_bench(int argc, const char **argv, const char *prefix)
+{
+	int i, j;
+
+	if (argc < 2) {
+		/* No subsystem specified. */
+		print_usage();
+		return 0;
+	}
+
+	argc = parse_options(argc, argv, bench_options, bench_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	bench_format = bench_str2int(bench_format_str);
+	if (bench_format == BENCH_FORMAT_UNKNOWN) {
+		fprintf(stderr, "Unknown format descriptor:%s\n",
+			bench_format_str);
+		return 1;
+	}
+
+	if (argc < 1) {
+		print_usage();
+		return 0;
+	}
+
+	for (i = 0; subsystems[i].name; i++) {
+		if (strcmp(subsystems[i].name, argv[0]))
+			continue;
+
+		if (argc < 2) {
+			/* No suite specified. */
+			dump_suites(i);
+			return 0;
+		}
+
+		for (j = 0; subsystems[i].suites[j].name; j++) {
+			if (strcmp(subsystems[i].suites[j].name, argv[1]))
+				continue;
+
+			if (bench_format == BENCH_FORMAT_DEFAULT) {
+				printf("# Running %s/%s benchmark...\n",
+				       subsystems[i].name,
+				       subsystems[i].suites[j].name);
+				/* the suites may fork, don't print it twice */
+				fflush(stdout);
+			}
+			return subsystems[i].suites[j].fn(argc - 1,
+							  argv + 1, prefix);
+		}
+
+		if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+			dump_suites(i);
+			return 0;
+		}
+
+		fprintf(stderr, "Unknown suite:%s for %s\n", argv[1], argv[0]);
+		return 1;
+	}
+
+	fprintf(stderr, "Unknown subsystem:%s\n", argv[0]);
+	return 1;
+}
@@ -1,4 +1,5 @@
 #include "string.h"
+#include "util.h"
 
 static int hex(char ch)
 {
@@ -32,3 +33,44 @@ int hex2u64(const char *ptr, u64 *long_val)
 
 	return p - ptr;
 }
+
+/*
+ * Parse a size like "256MB": a decimal number, optionally followed by
+ * k, m or g and an optional b, in any case.  Returns -1 if the string is
+ * malformed.
+ */
+s64 perf_atoll(const char *str)
+{
+	char *end;
+	s64 length;
+
+	if (!isdigit(*str))
+		return -1;
+
+	length = strtoll(str, &end, 10);
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		length <<= 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		length <<= 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		length <<= 30;
+		end++;
+		break;
+	default:
+		break;
+	}
+
+	if (*end == 'b' || *end == 'B')
+		end++;
+
+	return *end ? -1 : length;
+}
@@ -4,6 +4,7 @@
 #include "types.h"
 
 int hex2u64(const char *ptr, u64 *val);
+s64 perf_atoll(const char *str);
 
 #define _STR(x) #x
 #define STR(x) _STR(x)